@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "host_bench.h"
+#include "host_mocks.h"
+#include "actuator_hal.h"
+
+#define BENCH_ITERATIONS   100000
+#define BENCH_PWM_CHANNELS 2
+#define BENCH_FADE_MS      250
+#define BENCH_SCENES       3
+
+// Output capable pins of the ESP32, in both GPIO banks.
+static const int bench_pins[] = { 2, 4, 5, 12, 13, 14, 15, 16, 17, 18, 19, 21, 22, 23, 25, 26, 27, 32, 33 };
+
+static const char *const bench_names[] = { "ch0", "ch1", "ch2", "ch3", "ch4", "ch5", "ch6", "ch7",
+                                           "ch8", "ch9", "ch10", "ch11", "ch12", "ch13", "ch14", "ch15",
+                                           "ch16", "ch17", "ch18", "ch19", "ch20", "ch21", "ch22", "ch23",
+                                           "ch24", "ch25", "ch26", "ch27", "ch28", "ch29", "ch30", "ch31" };
+
+static actuator_channel_config_t configs[ACTUATOR_HAL_MAX_CHANNELS];
+static uint8_t channel_count;
+
+// The last BENCH_PWM_CHANNELS channels are PWM, odd channels active low.
+static int setup_channels(void)
+{
+    size_t pins = sizeof(bench_pins) / sizeof(bench_pins[0]);
+    channel_count = ACTUATOR_HAL_MAX_CHANNELS < pins ? ACTUATOR_HAL_MAX_CHANNELS : (uint8_t)pins;
+
+    if (actuator_hal_init(&mock_actuator_backend) != ESP_OK) {
+        printf("Actuator: FAIL init\n");
+        return 1;
+    }
+    for (uint8_t i = 0; i < channel_count; i++) {
+        bool pwm = i >= channel_count - BENCH_PWM_CHANNELS;
+        uint8_t id;
+        configs[i] = (actuator_channel_config_t) {
+            .name = bench_names[i],
+            .type = pwm ? ACTUATOR_CHANNEL_PWM : ACTUATOR_CHANNEL_DIGITAL,
+            .gpio = bench_pins[i],
+            .active_low = i & 1,
+            .pwm_channel = pwm ? i - (channel_count - BENCH_PWM_CHANNELS) : 0,
+            .fade_ms = pwm ? BENCH_FADE_MS : 0,
+        };
+        if (actuator_hal_add_channel(&configs[i], &id) != ESP_OK || id != i) {
+            printf("Actuator: FAIL adding channel %u\n", i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Pin levels and duties must follow the applied levels, inverted where active low.
+static int check_outputs(const char *what)
+{
+    mock_actuator_stats_t mock;
+
+    mock_actuator_get_stats(&mock);
+    for (uint8_t i = 0; i < channel_count; i++) {
+        const actuator_channel_config_t *c = &configs[i];
+        uint8_t level = actuator_hal_get(i);
+        if (c->type == ACTUATOR_CHANNEL_DIGITAL) {
+            bool high = (mock.levels >> c->gpio) & 1;
+            if (!(mock.outputs & (1ULL << c->gpio)) || high != ((level != 0) != c->active_low)) {
+                printf("Actuator: FAIL %s, channel %u level %u pin %d high=%d\n", what, i, level, c->gpio, high);
+                return 1;
+            }
+        } else {
+            uint32_t duty = MOCK_ACTUATOR_MAX_DUTY * level / ACTUATOR_LEVEL_MAX;
+            if (c->active_low) {
+                duty = MOCK_ACTUATOR_MAX_DUTY - duty;
+            }
+            if (mock.duty[c->pwm_channel] != duty) {
+                printf("Actuator: FAIL %s, channel %u level %u duty %u\n", what, i, level,
+                       (unsigned)mock.duty[c->pwm_channel]);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int check_errors(void)
+{
+    actuator_state_t state = { 0 };
+    actuator_channel_config_t dup = configs[0];
+    uint8_t id;
+    int failures = 0;
+
+    dup.name = "dup";
+    failures += actuator_hal_add_channel(&dup, &id) != ESP_ERR_INVALID_ARG; // GPIO in use
+    if (channel_count < ACTUATOR_HAL_MAX_CHANNELS) {
+        actuator_state_set(&state, channel_count, 1);
+        failures += actuator_hal_apply(&state) != ESP_ERR_INVALID_ARG;
+    }
+    failures += actuator_hal_find("ch1", 3) != 1;
+    failures += actuator_hal_find("nope", 4) != -1;
+    if (failures) {
+        printf("Actuator: FAIL %d error checks\n", failures);
+    }
+    return failures;
+}
+
+int bench_actuator(void)
+{
+    actuator_state_t scenes[BENCH_SCENES] = { 0 };
+    mock_actuator_stats_t before;
+    mock_actuator_stats_t after;
+    int failures = setup_channels();
+
+    if (failures) {
+        return failures;
+    }
+    failures += check_outputs("registered off");
+
+    // All on, all off, every other one on; PWM at 100, 0 and 50 percent.
+    for (uint8_t i = 0; i < channel_count; i++) {
+        bool pwm = configs[i].type == ACTUATOR_CHANNEL_PWM;
+        actuator_state_set(&scenes[0], i, pwm ? ACTUATOR_LEVEL_MAX : 1);
+        actuator_state_set(&scenes[1], i, 0);
+        actuator_state_set(&scenes[2], i, pwm ? ACTUATOR_LEVEL_MAX / 2 : (i + 1) & 1);
+    }
+    for (int s = 0; s < BENCH_SCENES; s++) {
+        if (actuator_hal_apply(&scenes[s]) != ESP_OK) {
+            printf("Actuator: FAIL applying scene %d\n", s);
+            failures++;
+        }
+        failures += check_outputs("scene");
+    }
+    // Applying the same scene again changes nothing and writes nothing.
+    mock_actuator_get_stats(&before);
+    actuator_hal_apply(&scenes[BENCH_SCENES - 1]);
+    mock_actuator_get_stats(&after);
+    if (after.digital_writes != before.digital_writes || after.pwm_fades != before.pwm_fades) {
+        printf("Actuator: FAIL unchanged scene was written\n");
+        failures++;
+    }
+    failures += check_errors();
+
+    // One state vector per scene...
+    mock_actuator_get_stats(&before);
+    uint64_t t0 = bench_now_ns();
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+        actuator_hal_apply(&scenes[i % BENCH_SCENES]);
+    }
+    uint64_t hal_ns = bench_now_ns() - t0;
+    mock_actuator_get_stats(&after);
+    failures += check_outputs("after benchmark");
+
+    // ...against one gpio_set_level() per digital output, as led_control.c does.
+    uint32_t digital = channel_count - BENCH_PWM_CHANNELS;
+    for (uint32_t i = 0; i < digital; i++) {
+        gpio_config_t io_conf = { .pin_bit_mask = 1ULL << configs[i].gpio, .mode = GPIO_MODE_OUTPUT };
+        gpio_config(&io_conf);
+    }
+    t0 = bench_now_ns();
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+        const actuator_state_t *scene = &scenes[i % BENCH_SCENES];
+        for (uint32_t c = 0; c < digital; c++) {
+            gpio_set_level((gpio_num_t)configs[c].gpio, (scene->level[c] != 0) != configs[c].active_low);
+        }
+    }
+    uint64_t per_pin_ns = bench_now_ns() - t0;
+
+    printf("BENCH actuator channels=%u digital=%u pwm=%u apply_ns=%.1f digital_writes_per_scene=%.2f "
+           "pwm_fades_per_scene=%.2f per_pin_ns=%.1f per_pin_calls_per_scene=%u\n",
+           channel_count, (unsigned)digital, BENCH_PWM_CHANNELS, (double)hal_ns / BENCH_ITERATIONS,
+           (double)(after.digital_writes - before.digital_writes) / BENCH_ITERATIONS,
+           (double)(after.pwm_fades - before.pwm_fades) / BENCH_ITERATIONS,
+           (double)per_pin_ns / BENCH_ITERATIONS, (unsigned)digital);
+    return failures;
+}
@@ -0,0 +1,200 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "host_bench.h"
+#include "cbor_lite.h"
+#include "device_crypto.h"
+#include "json_lite.h"
+#include "telemetry.h"
+
+#define BENCH_ITERATIONS 20000
+#define BENCH_BATCH_SAMPLES 30
+
+static const char *const batch_keys[] = { "ledState", "freeHeap", "rssi" };
+
+static uint8_t payload[CONFIG_TELEMETRY_PAYLOAD_MAX];
+static size_t payload_len;
+static uint32_t batch_tick;
+
+static size_t heap_in_use(void)
+{
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks;
+}
+
+static int capture_publish(const char *subtopic, char *buf, size_t len, size_t buf_size)
+{
+    memcpy(payload, buf, len);
+    payload_len = len;
+    return 0;
+}
+
+static bool read_led(void *ctx, float *value)
+{
+    *value = (float)((batch_tick / 7u) & 1u);
+    return true;
+}
+
+static bool read_heap(void *ctx, float *value)
+{
+    *value = 180000.0f - 64.0f * (float)batch_tick;
+    return true;
+}
+
+static bool read_rssi(void *ctx, float *value)
+{
+    *value = -61.5f + (float)(batch_tick % 4u);
+    return true;
+}
+
+static int encode_command(telemetry_encoding_t encoding, bool state)
+{
+    if (encoding == TELEMETRY_ENCODING_CBOR) {
+        cbor_lite_writer_t w;
+        cbor_lite_writer_init(&w, payload, sizeof(payload));
+        cbor_lite_put_map(&w, 1);
+        cbor_lite_put_cstr(&w, "state");
+        cbor_lite_put_bool(&w, state);
+        payload_len = w.len;
+        return w.overflow ? -1 : 0;
+    }
+    int n = snprintf((char *)payload, sizeof(payload), "{\"state\":%s}", state ? "true" : "false");
+    payload_len = (size_t)n;
+    return n > 0 ? 0 : -1;
+}
+
+static int decode_command(telemetry_encoding_t encoding, bool *state)
+{
+    esp_err_t err = encoding == TELEMETRY_ENCODING_CBOR
+                        ? cbor_lite_get_bool(payload, payload_len, "state", state)
+                        : json_lite_get_bool((const char *)payload, payload_len, "state", state);
+    return err == ESP_OK ? 0 : -1;
+}
+
+// Fills the telemetry ring with one batch and flushes it into payload.
+static int encode_batch(telemetry_encoding_t encoding)
+{
+    telemetry_config_t config = {
+        .sample_period_ms = 1000,
+        .flush_interval_ms = UINT32_MAX,
+        .high_water = CONFIG_TELEMETRY_RING_SIZE,
+        .encoding = encoding,
+    };
+    if (telemetry_init(&config, capture_publish) != ESP_OK) {
+        return -1;
+    }
+    telemetry_register_source(batch_keys[0], read_led, NULL, 0.0f);
+    telemetry_register_source(batch_keys[1], read_heap, NULL, 0.0f);
+    telemetry_register_source(batch_keys[2], read_rssi, NULL, 0.0f);
+    for (batch_tick = 0; batch_tick < BENCH_BATCH_SAMPLES / 3; batch_tick++) {
+        telemetry_poll(batch_tick * 1000);
+    }
+    return telemetry_flush(batch_tick * 1000) == ESP_OK ? 0 : -1;
+}
+
+// What the backend needs from a batch: the latest value of every source.
+static int decode_batch(telemetry_encoding_t encoding, float *sum)
+{
+    for (size_t i = 0; i < sizeof(batch_keys) / sizeof(batch_keys[0]); i++) {
+        float v;
+        esp_err_t err = encoding == TELEMETRY_ENCODING_CBOR
+                            ? cbor_lite_get_float(payload, payload_len, batch_keys[i], &v)
+                            : json_lite_get_float((const char *)payload, payload_len, batch_keys[i], &v);
+        if (err != ESP_OK) {
+            return -1;
+        }
+        *sum += v;
+    }
+    return 0;
+}
+
+static int run_case(const char *name, telemetry_encoding_t encoding)
+{
+    const char *enc_name = encoding == TELEMETRY_ENCODING_CBOR ? "cbor" : "json";
+    bool is_batch = strcmp(name, "telemetry_batch") == 0;
+    uint64_t encode_ns = 0;
+    uint64_t decode_ns = 0;
+    float sink = 0.0f;
+    bool state = false;
+
+    size_t heap_before = heap_in_use();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        uint64_t t0 = bench_now_ns();
+        int rc = is_batch ? encode_batch(encoding) : encode_command(encoding, i & 1);
+        uint64_t t1 = bench_now_ns();
+        if (rc == 0) {
+            rc = is_batch ? decode_batch(encoding, &sink) : decode_command(encoding, &state);
+        }
+        uint64_t t2 = bench_now_ns();
+        if (rc != 0 || (!is_batch && state != (i & 1))) {
+            printf("Codec: FAIL %s/%s round trip\n", name, enc_name);
+            return 1;
+        }
+        encode_ns += t1 - t0;
+        decode_ns += t2 - t1;
+    }
+    size_t heap_after = heap_in_use();
+
+    printf("BENCH codec payload=%s encoding=%s bytes=%u wire_bytes=%u encode_ns=%.0f decode_ns=%.0f "
+           "heap_delta=%d\n",
+           name, enc_name, (unsigned)payload_len, (unsigned)(DEVICE_CRYPTO_HEADER_LEN + 2 * payload_len),
+           (double)encode_ns / BENCH_ITERATIONS, (double)decode_ns / BENCH_ITERATIONS,
+           (int)(heap_after - heap_before));
+    return heap_after != heap_before;
+}
+
+// Inputs the JSON reader must refuse or take exactly.
+static int check_json_edges(void)
+{
+    // The escape is the last byte of the input; the quote after it is outside.
+    static const char cut_escape[] = "{\"a\":\"x\\\"\"}";
+    const char *str;
+    size_t len;
+    float f;
+    int32_t i;
+    int failures = 0;
+
+    if (json_lite_get_string(cut_escape, sizeof(cut_escape) - 4, "a", &str, &len) != ESP_ERR_INVALID_ARG ||
+        json_lite_get_string(cut_escape, sizeof(cut_escape) - 1, "a", &str, &len) != ESP_OK || len != 3) {
+        printf("Codec: FAIL escape at the end of the input\n");
+        failures++;
+    }
+    if (json_lite_get_float("{\"a\":+1}", 8, "a", &f) != ESP_ERR_INVALID_ARG ||
+        json_lite_get_int("{\"a\":+1}", 8, "a", &i) != ESP_ERR_INVALID_ARG ||
+        json_lite_get_float("{\"a\":-1.5e+2}", 13, "a", &f) != ESP_OK || f != -150.0f ||
+        json_lite_get_int("{\"a\":-2147483648}", 17, "a", &i) != ESP_OK || i != INT32_MIN) {
+        printf("Codec: FAIL number edge cases\n");
+        failures++;
+    }
+    return failures;
+}
+
+int bench_codec(void)
+{
+    int failures = check_json_edges();
+
+    // A bare CBOR boolean must be told apart from JSON text.
+    static const uint8_t cbor_true[] = { 0xf5 };
+    bool state = false;
+    if (!cbor_lite_is_cbor(cbor_true, sizeof(cbor_true)) || cbor_lite_is_cbor("true", 4) ||
+        cbor_lite_get_bool(cbor_true, sizeof(cbor_true), NULL, &state) != ESP_OK || !state) {
+        printf("Codec: FAIL bare boolean\n");
+        failures++;
+    }
+
+    // Batch encoded on the device, printed so it can be checked against the backend decoder.
+    if (encode_batch(TELEMETRY_ENCODING_CBOR) == 0) {
+        printf("Codec device CBOR: ");
+        for (size_t i = 0; i < payload_len; i++) {
+            printf("%02x", payload[i]);
+        }
+        printf("\n");
+    }
+
+    failures += run_case("command", TELEMETRY_ENCODING_JSON);
+    failures += run_case("command", TELEMETRY_ENCODING_CBOR);
+    failures += run_case("telemetry_batch", TELEMETRY_ENCODING_JSON);
+    failures += run_case("telemetry_batch", TELEMETRY_ENCODING_CBOR);
+    return failures;
+}
@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "host_bench.h"
+#include "host_mocks.h"
+#include "network_mqtt_handler.h"
+#include "command_router.h"
+#include "command_ack.h"
+#include "device_crypto.h"
+#include "json_lite.h"
+#include "cbor_lite.h"
+
+#define BENCH_ITERATIONS 1000000
+#define BENCH_FRAME_MAX  256
+
+#define DEVICE_TOPIC(name) "home/devices/" CONFIG_ESP_MQTT_DEVICE_ID "/command/" name
+
+static uint32_t led_runs;
+static command_ack_token_t taken;
+static command_ack_token_t taken_twice;
+
+static char ack_payload[512];
+static size_t ack_len;
+static unsigned ack_publishes;
+
+static char rx_topic[MOCK_MQTT_TOPIC_MAX_LEN];
+static char rx_buffer[BENCH_FRAME_MAX];
+
+static int capture_ack(const char *subtopic, char *buf, size_t len, size_t buf_size)
+{
+    if (strcmp(subtopic, "ack") != 0 || len >= sizeof(ack_payload)) {
+        return -1;
+    }
+    memcpy(ack_payload, buf, len);
+    ack_len = len;
+    ack_publishes++;
+    return 1;
+}
+
+// Runs inline, as a handler that finishes the command on the MQTT task.
+static esp_err_t bench_led_handler(const char *data, size_t data_len, void *ctx)
+{
+    led_runs++;
+    return ESP_OK;
+}
+
+// Hands the command on, as actuator_task_submit() does.
+static esp_err_t bench_queued_handler(const char *data, size_t data_len, void *ctx)
+{
+    taken = command_ack_take();
+    taken_twice = command_ack_take();
+    return ESP_OK;
+}
+
+// Delivers a command as the backend sends it: encrypted when payload encryption is on.
+static int send_command(const char *topic, const char *payload)
+{
+    size_t topic_len = strlen(topic);
+    size_t frame_len = strlen(payload);
+
+    memcpy(rx_topic, topic, topic_len);
+    memcpy(rx_buffer, payload, frame_len);
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+    device_crypto_t crypto = { 0 };
+    esp_err_t err = device_crypto_init(&crypto, CONFIG_DEVICE_AES_KEY, strlen(CONFIG_DEVICE_AES_KEY));
+    if (err == ESP_OK) {
+        err = device_crypto_encrypt_in_place(&crypto, rx_buffer, frame_len, sizeof(rx_buffer), &frame_len);
+    }
+    device_crypto_free(&crypto);
+    if (err != ESP_OK) {
+        printf("Command ack: FAIL encrypting %s\n", payload);
+        return 1;
+    }
+#endif
+    esp_mqtt_event_t event = {
+        .topic = rx_topic,
+        .topic_len = (int)topic_len,
+        .data = rx_buffer,
+        .data_len = (int)frame_len,
+        .total_data_len = (int)frame_len,
+    };
+    mock_mqtt_emit(MQTT_EVENT_DATA, &event);
+    return 0;
+}
+
+static esp_err_t setup(telemetry_encoding_t encoding)
+{
+    command_ack_config_t config = COMMAND_ACK_CONFIG_DEFAULT();
+    config.encoding = encoding;
+    ack_publishes = 0;
+    ack_len = 0;
+    return command_ack_init(&config, capture_ack);
+}
+
+// Parses a published JSON batch into (seq, status, us) triples.
+static size_t read_acks(uint32_t acks[][3], size_t max)
+{
+    const char *raw;
+    size_t raw_len;
+    size_t count = 0;
+
+    if (json_lite_get_raw(ack_payload, ack_len, "acks", &raw, &raw_len) != ESP_OK) {
+        return 0;
+    }
+    const char *p = raw + 1;
+    while (count < max) {
+        int status;
+        int n = 0;
+        if (sscanf(p, "[%u,%d,%u]%n", &acks[count][0], &status, &acks[count][2], &n) != 3) {
+            break;
+        }
+        acks[count][1] = (uint32_t)status;
+        count++;
+        p += n + (p[n] == ',');
+    }
+    return count;
+}
+
+static int check_subscribe_qos(void)
+{
+    mock_mqtt_stats_t mqtt;
+
+    network_mqtt_app_start();
+    esp_mqtt_event_t connected = { 0 };
+    mock_mqtt_emit(MQTT_EVENT_CONNECTED, &connected);
+    network_mqtt_subscribe("home/groups/bench/command/#", true);
+    mock_mqtt_get_stats(&mqtt);
+    if (mqtt.subscribes == 0 || mqtt.subscribe_qos0 != 0) {
+        printf("Command ack: FAIL %u of %u filters subscribed at QoS 0\n", (unsigned)mqtt.subscribe_qos0,
+               (unsigned)mqtt.subscribe_filters);
+        return 1;
+    }
+    return 0;
+}
+
+// A redelivery is acked again but not run again; unsequenced commands are not acked.
+static int check_dedup(void)
+{
+    uint32_t acks[4][3];
+    int failures = 0;
+
+    setup(TELEMETRY_ENCODING_JSON);
+    led_runs = 0;
+    failures += send_command(DEVICE_TOPIC("setLed"), "{\"state\":true,\"seq\":100}");
+    failures += send_command(DEVICE_TOPIC("setLed"), "{\"state\":true,\"seq\":100}");
+    failures += send_command(DEVICE_TOPIC("setLed"), "{\"state\":false}");
+    failures += send_command(DEVICE_TOPIC("no_such_command"), "{\"seq\":101}");
+    size_t flushed = command_ack_flush();
+    size_t count = read_acks(acks, 4);
+
+    if (led_runs != 2 || flushed != 3 || ack_publishes != 1 || count != 3 ||
+        acks[0][0] != 100 || acks[0][1] != ESP_OK ||
+        acks[1][0] != 100 || acks[1][1] != COMMAND_ACK_DUPLICATE || acks[1][2] != 0 ||
+        acks[2][0] != 101 || acks[2][1] != (uint32_t)ESP_ERR_NOT_FOUND) {
+        printf("Command ack: FAIL dedup (ran %u, flushed %u): %.*s\n", (unsigned)led_runs, (unsigned)flushed,
+               (int)ack_len, ack_payload);
+        failures++;
+    }
+
+    // Once a full window of newer numbers came in, an old number is no longer known.
+    for (uint32_t seq = 200; seq <= 200 + COMMAND_ACK_DEDUP_WINDOW; seq++) {
+        command_ack_begin(seq, 0);
+        command_ack_end(ESP_OK);
+    }
+    bool kept = !command_ack_begin(201, 0);
+    bool evicted = command_ack_begin(200, 0);
+    command_ack_end(ESP_OK);
+    command_ack_stats_t st;
+    command_ack_get_stats(&st);
+    if (!kept || !evicted || st.duplicates != 2) {
+        printf("Command ack: FAIL window (kept %d, evicted %d, duplicates %u)\n", kept, evicted,
+               (unsigned)st.duplicates);
+        failures++;
+    }
+    return failures;
+}
+
+// A handler that takes the command is acked by whoever completes it.
+static int check_deferred(void)
+{
+    uint32_t acks[1][3];
+
+    setup(TELEMETRY_ENCODING_JSON);
+    if (send_command(DEVICE_TOPIC("queued"), "{\"light\":1,\"seq\":300}")) {
+        return 1;
+    }
+    size_t before = command_ack_flush();
+    command_ack_complete(taken, ESP_OK);
+    command_ack_complete(taken_twice, ESP_OK);
+    size_t after = command_ack_flush();
+    if (taken.seq != 300 || taken_twice.seq != 0 || before != 0 || after != 1 || read_acks(acks, 1) != 1 ||
+        acks[0][0] != 300 || acks[0][1] != ESP_OK) {
+        printf("Command ack: FAIL deferred ack (seq %u, %u then %u acks)\n", (unsigned)taken.seq, (unsigned)before,
+               (unsigned)after);
+        return 1;
+    }
+    return 0;
+}
+
+static int check_cbor(void)
+{
+    uint8_t payload[32];
+    cbor_lite_writer_t w;
+    int failures = 0;
+
+    cbor_lite_writer_init(&w, payload, sizeof(payload));
+    cbor_lite_put_map(&w, 2);
+    cbor_lite_put_cstr(&w, "state");
+    cbor_lite_put_bool(&w, true);
+    cbor_lite_put_cstr(&w, "seq");
+    cbor_lite_put_uint(&w, 7);
+    if (command_ack_get_seq((const char *)payload, w.len) != 7 || command_ack_get_seq("true", 4) != 0 ||
+        command_ack_get_seq("{\"seq\":0}", 9) != 0 || command_ack_get_seq("{\"seq\":-3}", 10) != 0) {
+        printf("Command ack: FAIL reading sequence numbers\n");
+        failures++;
+    }
+
+    setup(TELEMETRY_ENCODING_CBOR);
+    command_ack_begin(7, 0);
+    command_ack_end(ESP_OK);
+    command_ack_flush();
+    if (ack_publishes != 1 || !cbor_lite_is_cbor(ack_payload, ack_len)) {
+        printf("Command ack: FAIL CBOR acks\n");
+        failures++;
+    }
+    return failures;
+}
+
+// A full queue drops acks instead of blocking the MQTT task.
+static int check_overflow(void)
+{
+    command_ack_stats_t st;
+
+    setup(TELEMETRY_ENCODING_JSON);
+    for (uint32_t seq = 1; seq <= COMMAND_ACK_QUEUE_LEN + 3; seq++) {
+        command_ack_begin(seq, 0);
+        command_ack_end(ESP_OK);
+    }
+    size_t flushed = command_ack_flush();
+    command_ack_get_stats(&st);
+    if (flushed != COMMAND_ACK_QUEUE_LEN || st.dropped != 3 || st.acked != COMMAND_ACK_QUEUE_LEN) {
+        printf("Command ack: FAIL overflow (flushed %u, dropped %u)\n", (unsigned)flushed, (unsigned)st.dropped);
+        return 1;
+    }
+    return 0;
+}
+
+int bench_command_ack(void)
+{
+    static const char payload[] = "{\"state\":true,\"seq\":123456}";
+    int failures = 0;
+
+    if (command_router_init(CONFIG_ESP_MQTT_DEVICE_ID) != ESP_OK ||
+        command_router_register("setLed", bench_led_handler, NULL) != ESP_OK ||
+        command_router_register("queued", bench_queued_handler, NULL) != ESP_OK) {
+        printf("Command ack: FAIL router setup\n");
+        return 1;
+    }
+    failures += check_subscribe_qos();
+    failures += check_dedup();
+    failures += check_deferred();
+    failures += check_cbor();
+    failures += check_overflow();
+
+    // Per command: read the number, look it up in a full window, queue the ack.
+    setup(TELEMETRY_ENCODING_JSON);
+    uint64_t overhead_ns = 0;
+    uint64_t flush_ns = 0;
+    uint32_t seq = 1000;
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i += COMMAND_ACK_QUEUE_LEN) {
+        uint64_t t0 = bench_now_ns();
+        for (uint32_t j = 0; j < COMMAND_ACK_QUEUE_LEN; j++) {
+            if (command_ack_get_seq(payload, sizeof(payload) - 1) && command_ack_begin(seq++, 0)) {
+                command_ack_end(ESP_OK);
+            }
+        }
+        uint64_t t1 = bench_now_ns();
+        command_ack_flush();
+        overhead_ns += t1 - t0;
+        flush_ns += bench_now_ns() - t1;
+    }
+    uint32_t commands = seq - 1000;
+
+    setup(TELEMETRY_ENCODING_JSON);
+    for (uint32_t i = 0; i < COMMAND_ACK_BATCH; i++) {
+        command_ack_begin(2147483600u + i, 0);
+        command_ack_end(ESP_OK);
+    }
+    command_ack_flush();
+    size_t json_batch = ack_len;
+    setup(TELEMETRY_ENCODING_CBOR);
+    for (uint32_t i = 0; i < COMMAND_ACK_BATCH; i++) {
+        command_ack_begin(2147483600u + i, 0);
+        command_ack_end(ESP_OK);
+    }
+    command_ack_flush();
+    size_t cbor_batch = ack_len;
+
+    printf("BENCH command_ack per_command_ns=%.1f flush_per_ack_ns=%.1f window=%u "
+           "batch_bytes_json=%u batch_bytes_cbor=%u acks_per_batch=%u\n",
+           (double)overhead_ns / commands, (double)flush_ns / commands, (unsigned)COMMAND_ACK_DEDUP_WINDOW,
+           (unsigned)json_batch, (unsigned)cbor_batch, (unsigned)COMMAND_ACK_BATCH);
+    return failures;
+}
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "host_bench.h"
+#include "device_crypto.h"
+
+#define BENCH_ITERATIONS 2000
+#define BENCH_MAX_PAYLOAD 4096
+
+// Produced by the backend EncryptionService (Node crypto, aes-256-gcm) for
+// JSON.stringify({state: true}) with aesKey BENCH_DEVICE_KEY and a fixed IV.
+#define BENCH_DEVICE_KEY  "0123456789abcdef-device-key"
+#define NODE_FRAME        "000102030405060708090a0b:9ba108d4aae65e89bd90ef0b02e39537:43ab53fc53e433d2afe40988c249"
+#define NODE_PLAINTEXT    "{\"state\":true}"
+
+static const size_t payload_sizes[] = { 16, 64, 256, 1024, BENCH_MAX_PAYLOAD };
+
+static char work_buf[DEVICE_CRYPTO_FRAME_SIZE(BENCH_MAX_PAYLOAD)];
+
+static int check_node_interop(device_crypto_t *ctx)
+{
+    char frame[] = NODE_FRAME;
+    size_t plain_len = 0;
+    int failures = 0;
+
+    esp_err_t err = device_crypto_decrypt_in_place(ctx, frame, strlen(frame), &plain_len);
+    if (err != ESP_OK || plain_len != strlen(NODE_PLAINTEXT) || memcmp(frame, NODE_PLAINTEXT, plain_len) != 0) {
+        printf("Crypto interop: FAIL decrypting Node frame (%s)\n", esp_err_to_name(err));
+        failures++;
+    }
+
+    // A tampered tag must be rejected.
+    char tampered[] = NODE_FRAME;
+    tampered[30] = tampered[30] == '0' ? '1' : '0';
+    if (device_crypto_decrypt_in_place(ctx, tampered, strlen(tampered), &plain_len) != ESP_ERR_INVALID_CRC) {
+        printf("Crypto interop: FAIL tampered frame accepted\n");
+        failures++;
+    }
+
+    // Device frames must use the same "<iv>:<tag>:<ct>" layout the backend splits on.
+    strcpy(work_buf, NODE_PLAINTEXT);
+    size_t frame_len = 0;
+    err = device_crypto_encrypt_in_place(ctx, work_buf, strlen(NODE_PLAINTEXT), sizeof(work_buf), &frame_len);
+    if (err != ESP_OK || frame_len != DEVICE_CRYPTO_HEADER_LEN + 2 * strlen(NODE_PLAINTEXT) ||
+        work_buf[24] != ':' || work_buf[57] != ':') {
+        printf("Crypto interop: FAIL encrypt layout\n");
+        failures++;
+    } else {
+        // Printed so the pytest can hand it to Node for the reverse check.
+        printf("Crypto device frame: %s\n", work_buf);
+    }
+
+    if (failures == 0) {
+        printf("Crypto interop: OK\n");
+    }
+    return failures;
+}
+
+int bench_crypto(void)
+{
+    device_crypto_t ctx = { 0 };
+    int failures = 0;
+
+    if (device_crypto_init(&ctx, BENCH_DEVICE_KEY, strlen(BENCH_DEVICE_KEY)) != ESP_OK) {
+        printf("Crypto interop: FAIL init\n");
+        return 1;
+    }
+    failures += check_node_interop(&ctx);
+
+    for (size_t s = 0; s < sizeof(payload_sizes) / sizeof(payload_sizes[0]); s++) {
+        size_t size = payload_sizes[s];
+        uint64_t encrypt_ns = 0;
+        uint64_t decrypt_ns = 0;
+
+        memset(work_buf, 'a', size);
+        for (int i = 0; i < BENCH_ITERATIONS; i++) {
+            size_t frame_len;
+            size_t plain_len;
+
+            // Encrypt then decrypt in place, which restores the plaintext for the next round.
+            uint64_t t0 = bench_now_ns();
+            esp_err_t err = device_crypto_encrypt_in_place(&ctx, work_buf, size, sizeof(work_buf), &frame_len);
+            uint64_t t1 = bench_now_ns();
+            if (err == ESP_OK) {
+                err = device_crypto_decrypt_in_place(&ctx, work_buf, frame_len, &plain_len);
+            }
+            uint64_t t2 = bench_now_ns();
+            if (err != ESP_OK || plain_len != size) {
+                printf("Crypto round trip: FAIL at size %u\n", (unsigned)size);
+                failures++;
+                break;
+            }
+            encrypt_ns += t1 - t0;
+            decrypt_ns += t2 - t1;
+        }
+
+        double enc_s = (double)encrypt_ns / 1e9;
+        double dec_s = (double)decrypt_ns / 1e9;
+        printf("BENCH crypto size=%u encrypt_msgs_per_s=%.0f encrypt_bytes_per_s=%.0f "
+               "decrypt_msgs_per_s=%.0f decrypt_bytes_per_s=%.0f\n",
+               (unsigned)size,
+               BENCH_ITERATIONS / enc_s, (double)size * BENCH_ITERATIONS / enc_s,
+               BENCH_ITERATIONS / dec_s, (double)size * BENCH_ITERATIONS / dec_s);
+    }
+
+    device_crypto_free(&ctx);
+    return failures;
+}
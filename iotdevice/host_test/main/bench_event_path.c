@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_bench.h"
+#include "host_mocks.h"
+#include "network_mqtt_handler.h"
+#include "command_router.h"
+#include "mqtt_reassembly.h"
+#include "device_crypto.h"
+#include "led_control.h"
+#include "boot_profile.h"
+#include "offline_queue.h"
+#include "esp_timer.h"
+
+#define BENCH_LED_GPIO        GPIO_NUM_15
+#define BENCH_STREAM_REPEAT   200
+#define BENCH_MAX_MESSAGES    512
+#define BENCH_MAX_EVENTS      65536
+#define BENCH_ARENA_SIZE      (128 * 1024)
+#define BENCH_RX_BUFFER_SIZE  CONFIG_NETWORK_MQTT_RX_BUFFER_SIZE
+#define BENCH_STREAM_ENV      "HOST_BENCH_STREAM"
+
+#if CONFIG_NETWORK_MQTT_PERSISTENT_SESSION
+#define MQTT_PERSISTENT_SESSION true
+#else
+#define MQTT_PERSISTENT_SESSION false
+#endif
+
+#define COMMAND_TOPIC(name) "home/devices/" CONFIG_ESP_MQTT_DEVICE_ID "/command/" name
+
+/*
+ * Recorded command streams, in the format of
+ *     mosquitto_sub -v -t 'home/devices/+/command/#'
+ * on a plaintext broker: one "<topic> <payload>" per line, "hex:" marks a
+ * binary payload. Plaintext payloads are encrypted before the replay when
+ * CONFIG_DEVICE_PAYLOAD_ENCRYPTION is set, "<iv>:<tag>:<ct>" frames are
+ * replayed as they are. A capture of a real broker can be replayed with
+ * HOST_BENCH_STREAM=<file>.
+ */
+static const char stream_dashboard_json[] =
+    COMMAND_TOPIC("setLed") " {\"state\":true}\n"
+    COMMAND_TOPIC("setLed") " {\"state\":false}\n"
+    COMMAND_TOPIC("setLed") " true\n"
+    COMMAND_TOPIC("setLed") " false\n"
+    COMMAND_TOPIC("setLed") " {\"source\":\"dashboard\",\"user\":\"admin\",\"state\":true}\n"
+    COMMAND_TOPIC("setBrightness") " {\"level\":40}\n"
+    COMMAND_TOPIC("setLed") " {\"state\":\"on\"}\n"
+    COMMAND_TOPIC("setLed") " {\"state\":false}\n";
+
+// The same commands as sent by the backend to a device that publishes CBOR.
+static const char stream_dashboard_cbor[] =
+    COMMAND_TOPIC("setLed") " hex:a1657374617465f5\n"
+    COMMAND_TOPIC("setLed") " hex:a1657374617465f4\n"
+    COMMAND_TOPIC("setLed") " hex:f5\n"
+    COMMAND_TOPIC("setLed") " hex:f4\n"
+    COMMAND_TOPIC("setBrightness") " hex:a1656c6576656c1828\n"
+    COMMAND_TOPIC("setLed") " hex:a165737461746501\n"
+    COMMAND_TOPIC("setLed") " hex:a1657374617465f4\n";
+
+typedef struct {
+    const char *name;
+    const char *stream;
+    size_t rx_buffer_size; // Larger messages are delivered in fragments
+} event_path_scenario_t;
+
+static const event_path_scenario_t scenarios[] = {
+    { "json", stream_dashboard_json, BENCH_RX_BUFFER_SIZE },
+    { "cbor", stream_dashboard_cbor, BENCH_RX_BUFFER_SIZE },
+    { "json_fragmented", stream_dashboard_json, 32 },
+};
+
+typedef struct {
+    size_t topic_off;
+    size_t topic_len;
+    size_t payload_off;
+    size_t payload_len;
+} bench_message_t;
+
+static char arena[BENCH_ARENA_SIZE];
+static size_t arena_len;
+static bench_message_t messages[BENCH_MAX_MESSAGES];
+static size_t message_count;
+static char capture[BENCH_ARENA_SIZE];
+
+// The client buffer the firmware decrypts in place, refilled before every event.
+static char rx_topic[MQTT_REASSEMBLY_TOPIC_MAX_LEN];
+static char rx_buffer[BENCH_RX_BUFFER_SIZE];
+static uint32_t latencies_ns[BENCH_MAX_EVENTS];
+
+static gpio_num_t led_gpio = BENCH_LED_GPIO;
+static uint32_t led_accepted;
+static uint32_t led_rejected;
+static bool led_last_state;
+
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+static device_crypto_t backend_crypto; // Plays the backend EncryptionService
+#endif
+
+/*
+ * @brief setLed handler of main.c, with the actuator queue left out.
+ *
+ *  The GPIO is written inline so the whole path from MQTT event to pin is
+ *  measured on one thread.
+ */
+static esp_err_t bench_led_handler(const char *data, size_t data_len, void *ctx)
+{
+    bool state;
+    if (led_parse_command(data, data_len, &state) != ESP_OK) {
+        led_rejected++;
+        return ESP_ERR_INVALID_ARG;
+    }
+    led_set_state(*(gpio_num_t *)ctx, state);
+    led_last_state = state;
+    led_accepted++;
+    return ESP_OK;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static bool is_frame(const char *payload, size_t len)
+{
+    return len > DEVICE_CRYPTO_HEADER_LEN && payload[2 * DEVICE_CRYPTO_IV_LEN] == ':' &&
+           payload[2 * DEVICE_CRYPTO_IV_LEN + 1 + 2 * DEVICE_CRYPTO_TAG_LEN] == ':';
+}
+
+// Appends one payload to the arena as it would arrive from the broker.
+static bool load_payload(const char *payload, size_t len, bench_message_t *msg)
+{
+    size_t plain_len = len;
+    char *dst = &arena[arena_len];
+    size_t room = sizeof(arena) - arena_len;
+
+    if (len > 4 && memcmp(payload, "hex:", 4) == 0) {
+        plain_len = (len - 4) / 2;
+        if (plain_len > room) {
+            return false;
+        }
+        for (size_t i = 0; i < plain_len; i++) {
+            int hi = hex_value(payload[4 + 2 * i]);
+            int lo = hex_value(payload[5 + 2 * i]);
+            if (hi < 0 || lo < 0) {
+                return false;
+            }
+            dst[i] = (char)(hi << 4 | lo);
+        }
+    } else {
+        if (len > room) {
+            return false;
+        }
+        memcpy(dst, payload, len);
+    }
+
+    msg->payload_off = arena_len;
+    msg->payload_len = plain_len;
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+    if (!is_frame(dst, plain_len) &&
+        device_crypto_encrypt_in_place(&backend_crypto, dst, plain_len, room, &msg->payload_len) != ESP_OK) {
+        return false;
+    }
+#endif
+    arena_len += msg->payload_len;
+    return true;
+}
+
+// Splits a recorded stream into messages; returns the number of setLed commands.
+static int load_stream(const char *stream, size_t stream_len)
+{
+    const char *end = stream + stream_len;
+    const char *led_topic = COMMAND_TOPIC("setLed");
+    int led_commands = 0;
+
+    arena_len = 0;
+    message_count = 0;
+    for (const char *line = stream; line < end && message_count < BENCH_MAX_MESSAGES;) {
+        const char *eol = memchr(line, '\n', (size_t)(end - line));
+        eol = eol ? eol : end;
+        const char *space = memchr(line, ' ', (size_t)(eol - line));
+        if (space && space > line) {
+            bench_message_t *msg = &messages[message_count];
+            msg->topic_off = arena_len;
+            msg->topic_len = (size_t)(space - line);
+            if (msg->topic_len >= sizeof(rx_topic) || msg->topic_len > sizeof(arena) - arena_len) {
+                return -1;
+            }
+            memcpy(&arena[arena_len], line, msg->topic_len);
+            arena_len += msg->topic_len;
+            if (!load_payload(space + 1, (size_t)(eol - space - 1), msg)) {
+                return -1;
+            }
+            if (msg->topic_len == strlen(led_topic) && memcmp(line, led_topic, msg->topic_len) == 0) {
+                led_commands++;
+            }
+            message_count++;
+        }
+        line = eol + 1;
+    }
+    return led_commands;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t percentile(const uint32_t *sorted, size_t n, unsigned pct)
+{
+    return n ? sorted[(n - 1) * pct / 100] : 0;
+}
+
+// Delivers every message as esp-mqtt would, one MQTT_EVENT_DATA per fragment.
+static size_t replay(size_t rx_buffer_size, unsigned repeat)
+{
+    size_t events = 0;
+
+    for (unsigned r = 0; r < repeat; r++) {
+        for (size_t m = 0; m < message_count; m++) {
+            const bench_message_t *msg = &messages[m];
+            for (size_t offset = 0; offset < msg->payload_len; offset += rx_buffer_size) {
+                if (events == BENCH_MAX_EVENTS) {
+                    return events;
+                }
+                size_t chunk = msg->payload_len - offset;
+                chunk = chunk < rx_buffer_size ? chunk : rx_buffer_size;
+                memcpy(rx_buffer, &arena[msg->payload_off + offset], chunk);
+                memcpy(rx_topic, &arena[msg->topic_off], msg->topic_len);
+                esp_mqtt_event_t event = {
+                    .topic = offset == 0 ? rx_topic : NULL,
+                    .topic_len = offset == 0 ? (int)msg->topic_len : 0,
+                    .data = rx_buffer,
+                    .data_len = (int)chunk,
+                    .current_data_offset = (int)offset,
+                    .total_data_len = (int)msg->payload_len,
+                };
+
+                uint64_t t0 = bench_now_ns();
+                mock_mqtt_emit(MQTT_EVENT_DATA, &event);
+                latencies_ns[events++] = (uint32_t)(bench_now_ns() - t0);
+            }
+        }
+    }
+    return events;
+}
+
+static int run_scenario(const char *name, const char *stream, size_t stream_len, size_t rx_buffer_size)
+{
+    mock_heap_stats_t heap_before;
+    mock_heap_stats_t heap_after;
+    mqtt_reassembly_stats_t reasm_before;
+    mqtt_reassembly_stats_t reasm_after;
+    int failures = 0;
+
+    int led_commands = load_stream(stream, stream_len);
+    if (led_commands < 0 || message_count == 0) {
+        printf("Event path %s: FAIL loading stream\n", name);
+        return 1;
+    }
+    unsigned repeat = BENCH_STREAM_REPEAT;
+    led_accepted = 0;
+    led_rejected = 0;
+    uint32_t writes_before = mock_gpio_get_writes(led_gpio);
+    mqtt_reassembly_get_stats(&reasm_before);
+    mock_heap_reset_peak();
+    mock_heap_get_stats(&heap_before);
+
+    size_t events = replay(rx_buffer_size, repeat);
+
+    mock_heap_get_stats(&heap_after);
+    mqtt_reassembly_get_stats(&reasm_after);
+    uint32_t delivered = reasm_after.messages - reasm_before.messages;
+    uint64_t allocs = heap_after.allocs - heap_before.allocs;
+
+    // Every message must reach the router, every setLed its handler, and
+    // every accepted command the pin.
+    if (events == BENCH_MAX_EVENTS || delivered != message_count * repeat) {
+        printf("Event path %s: FAIL %u of %u messages delivered\n", name, (unsigned)delivered,
+               (unsigned)(message_count * repeat));
+        failures++;
+    }
+    if (led_accepted + led_rejected != (uint32_t)led_commands * repeat ||
+        mock_gpio_get_writes(led_gpio) - writes_before != led_accepted ||
+        gpio_get_level(led_gpio) != (led_last_state ? 1 : 0)) {
+        printf("Event path %s: FAIL LED commands accepted=%u rejected=%u expected=%u\n", name,
+               (unsigned)led_accepted, (unsigned)led_rejected, (unsigned)(led_commands * repeat));
+        failures++;
+    }
+    // The message path is allocation free by design.
+    if (allocs != 0) {
+        printf("Event path %s: FAIL %llu heap allocations\n", name, (unsigned long long)allocs);
+        failures++;
+    }
+
+    qsort(latencies_ns, events, sizeof(latencies_ns[0]), compare_u32);
+    printf("BENCH event_path stream=%s messages=%u events=%u fragmented=%u p50_ns=%u p90_ns=%u p99_ns=%u "
+           "max_ns=%u peak_heap_bytes=%lld allocs_per_msg=%.3f\n",
+           name, (unsigned)delivered, (unsigned)events, (unsigned)(reasm_after.reassembled - reasm_before.reassembled),
+           (unsigned)percentile(latencies_ns, events, 50), (unsigned)percentile(latencies_ns, events, 90),
+           (unsigned)percentile(latencies_ns, events, 99), (unsigned)percentile(latencies_ns, events, 100),
+           (long long)(heap_after.peak_bytes - heap_before.live_bytes),
+           delivered ? (double)allocs / delivered : 0.0);
+    return failures;
+}
+
+static int run_capture(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("Event path capture: FAIL opening %s\n", path);
+        return 1;
+    }
+    size_t len = fread(capture, 1, sizeof(capture), f);
+    fclose(f);
+    return run_scenario("capture", capture, len, BENCH_RX_BUFFER_SIZE);
+}
+
+// Brings the handler up as the firmware does, against the mocked client.
+static int setup_event_path(void)
+{
+    offline_queue_config_t queue_config = { .replay_rate = 1000, .replay_batch = 10 };
+    mock_mqtt_stats_t mqtt;
+    char status[DEVICE_CRYPTO_FRAME_SIZE(16)] = "{\"online\":true}";
+
+    led_init(led_gpio);
+    if (command_router_init(CONFIG_ESP_MQTT_DEVICE_ID) != ESP_OK ||
+        command_router_register("setLed", bench_led_handler, &led_gpio) != ESP_OK) {
+        printf("Event path: FAIL router setup\n");
+        return 1;
+    }
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+    if (device_crypto_init(&backend_crypto, CONFIG_DEVICE_AES_KEY, strlen(CONFIG_DEVICE_AES_KEY)) != ESP_OK) {
+        printf("Event path: FAIL crypto setup\n");
+        return 1;
+    }
+#endif
+    offline_queue_init(&queue_config, network_mqtt_send);
+    // A second GOT_IP must not re-create the client, only reconnect it.
+    network_mqtt_app_start();
+    network_mqtt_app_start();
+
+    esp_mqtt_event_t connected = { 0 };
+    mock_mqtt_emit(MQTT_EVENT_CONNECTED, &connected);
+    esp_mqtt_event_t subscribed = { .msg_id = 1 };
+    mock_mqtt_emit(MQTT_EVENT_SUBSCRIBED, &subscribed);
+    // The event handler holds the client lock: the boot profile is sent by the replay task.
+    mock_mqtt_get_stats(&mqtt);
+    if (mqtt.publishes != 0) {
+        printf("Event path: FAIL boot profile published from the event handler\n");
+        return 1;
+    }
+    offline_queue_poll((uint32_t)(esp_timer_get_time() / 1000));
+    mock_mqtt_get_stats(&mqtt);
+    if (strcmp(mqtt.last_publish, "home/devices/" CONFIG_ESP_MQTT_DEVICE_ID "/boot") != 0 ||
+        boot_profile_get(BOOT_PHASE_SUBSCRIBED) < 0) {
+        printf("Event path: FAIL boot profile not published (last publish \"%s\")\n", mqtt.last_publish);
+        return 1;
+    }
+
+    // A resumed session keeps the subscription: no second subscribe, no second boot profile.
+    esp_mqtt_event_t resumed = { .session_present = 1 };
+    mock_mqtt_emit(MQTT_EVENT_CONNECTED, &resumed);
+    int msg_id = network_mqtt_publish("status", status, strlen(status), sizeof(status), 1, 0);
+
+    mock_mqtt_get_stats(&mqtt);
+    if (mqtt.created != 1 || mqtt.started != 1 || mqtt.persistent_session != MQTT_PERSISTENT_SESSION ||
+        mqtt.auto_reconnect || mqtt.reconnects != 1 ||
+        mqtt.subscribes != 1 || strcmp(mqtt.last_subscribe, COMMAND_TOPIC("#")) != 0 || mqtt.publishes != 2 ||
+        msg_id <= 0 || strcmp(mqtt.last_publish, "home/devices/" CONFIG_ESP_MQTT_DEVICE_ID "/status") != 0) {
+        printf("Event path: FAIL client setup (created %u, started %u, subscribed %u \"%s\", published %u \"%s\")\n",
+               (unsigned)mqtt.created, (unsigned)mqtt.started, (unsigned)mqtt.subscribes, mqtt.last_subscribe,
+               (unsigned)mqtt.publishes, mqtt.last_publish);
+        return 1;
+    }
+    return 0;
+}
+
+int bench_event_path(void)
+{
+    int failures = setup_event_path();
+    if (failures) {
+        return failures;
+    }
+
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        const event_path_scenario_t *s = &scenarios[i];
+        failures += run_scenario(s->name, s->stream, strlen(s->stream), s->rx_buffer_size);
+    }
+    const char *capture_path = getenv(BENCH_STREAM_ENV);
+    if (capture_path && capture_path[0]) {
+        failures += run_capture(capture_path);
+    }
+
+    if (mock_gpio_get_stray_writes()) {
+        printf("Event path: FAIL %u writes to unconfigured pins\n", (unsigned)mock_gpio_get_stray_writes());
+        failures++;
+    }
+    esp_mqtt_event_t disconnected = { 0 };
+    mock_mqtt_emit(MQTT_EVENT_DISCONNECTED, &disconnected);
+    return failures;
+}
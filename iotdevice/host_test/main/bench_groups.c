@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "host_bench.h"
+#include "host_mocks.h"
+#include "network_mqtt_handler.h"
+#include "command_router.h"
+#include "device_groups.h"
+#include "device_crypto.h"
+#include "actuator_hal.h"
+
+#define BENCH_ITERATIONS 20000
+#define BENCH_GROUP      "kitchen"
+#define BENCH_GROUP_KEY  "kitchen-group-key"
+#define BENCH_OTHER      "downstairs"
+#define BENCH_FRAME_MAX  512
+
+#define DEVICE_TOPIC(name) "home/devices/" CONFIG_ESP_MQTT_DEVICE_ID "/command/" name
+#define GROUP_TOPIC(group, name) "home/groups/" group "/command/" name
+
+// A room's outputs: ceiling lights, a dimmer and a fan on the kitchen device.
+static const actuator_channel_config_t bench_channels[] = {
+    { .name = "light1", .type = ACTUATOR_CHANNEL_DIGITAL, .gpio = 2 },
+    { .name = "light2", .type = ACTUATOR_CHANNEL_DIGITAL, .gpio = 4 },
+    { .name = "light3", .type = ACTUATOR_CHANNEL_DIGITAL, .gpio = 5 },
+    { .name = "counter", .type = ACTUATOR_CHANNEL_DIGITAL, .gpio = 12, .active_low = true },
+    { .name = "dimmer", .type = ACTUATOR_CHANNEL_PWM, .gpio = 13, .pwm_channel = 0 },
+    { .name = "fan", .type = ACTUATOR_CHANNEL_PWM, .gpio = 14, .pwm_channel = 1 },
+};
+#define BENCH_CHANNELS (sizeof(bench_channels) / sizeof(bench_channels[0]))
+
+static const char scene_evening[] = "{\"light1\":true,\"light2\":false,\"light3\":1,\"counter\":1,"
+                                    "\"dimmer\":30,\"fan\":0,\"tv\":1}";
+static const char scene_off[] = "{\"light1\":0,\"light2\":0,\"light3\":0,\"counter\":0,\"dimmer\":0,\"fan\":0}";
+static const uint8_t scene_evening_levels[BENCH_CHANNELS] = { 1, 0, 1, 1, 30, 0 };
+
+static uint32_t scenes_applied;
+static uint32_t device_only_calls;
+
+typedef struct {
+    char topic[MOCK_MQTT_TOPIC_MAX_LEN];
+    char frame[BENCH_FRAME_MAX];
+    size_t frame_len;
+} bench_message_t;
+
+static char rx_topic[MOCK_MQTT_TOPIC_MAX_LEN];
+static char rx_buffer[BENCH_FRAME_MAX];
+
+/*
+ * @brief scene handler of main.c, applied inline instead of queued, so the
+ *        path from MQTT event to outputs is measured on one thread.
+ */
+static esp_err_t bench_scene_handler(const char *data, size_t data_len, void *ctx)
+{
+    actuator_state_t state;
+    esp_err_t err = actuator_hal_parse_state(data, data_len, &state);
+    if (err == ESP_OK) {
+        err = actuator_hal_apply(&state);
+        scenes_applied++;
+    }
+    return err == ESP_ERR_NOT_FOUND ? ESP_OK : err;
+}
+
+// Stands in for a device only command such as rules.
+static esp_err_t bench_device_only_handler(const char *data, size_t data_len, void *ctx)
+{
+    device_only_calls++;
+    return ESP_OK;
+}
+
+// Builds a message as the backend sends it: encrypted under key when payload encryption is on.
+static int make_message(bench_message_t *msg, const char *topic, const char *payload, const char *key)
+{
+    snprintf(msg->topic, sizeof(msg->topic), "%s", topic);
+    msg->frame_len = strlen(payload);
+    memcpy(msg->frame, payload, msg->frame_len);
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+    device_crypto_t crypto = { 0 };
+    esp_err_t err = device_crypto_init(&crypto, key, strlen(key));
+    if (err == ESP_OK) {
+        err = device_crypto_encrypt_in_place(&crypto, msg->frame, msg->frame_len, sizeof(msg->frame), &msg->frame_len);
+    }
+    device_crypto_free(&crypto);
+    if (err != ESP_OK) {
+        printf("Groups: FAIL encrypting %s\n", topic);
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+// Delivers a message as one MQTT_EVENT_DATA, from a copy since it is decrypted in place.
+static void deliver(const bench_message_t *msg)
+{
+    size_t topic_len = strlen(msg->topic);
+    memcpy(rx_topic, msg->topic, topic_len);
+    memcpy(rx_buffer, msg->frame, msg->frame_len);
+    esp_mqtt_event_t event = {
+        .topic = rx_topic,
+        .topic_len = (int)topic_len,
+        .data = rx_buffer,
+        .data_len = (int)msg->frame_len,
+        .total_data_len = (int)msg->frame_len,
+    };
+    mock_mqtt_emit(MQTT_EVENT_DATA, &event);
+}
+
+static int send_message(const char *topic, const char *payload, const char *key)
+{
+    bench_message_t msg;
+    if (make_message(&msg, topic, payload, key)) {
+        return 1;
+    }
+    deliver(&msg);
+    return 0;
+}
+
+static int check_levels(const uint8_t *expected, const char *what)
+{
+    for (uint8_t i = 0; i < BENCH_CHANNELS; i++) {
+        if (actuator_hal_get(i) != expected[i]) {
+            printf("Groups: FAIL %s, %s at %u instead of %u\n", what, bench_channels[i].name,
+                   (unsigned)actuator_hal_get(i), (unsigned)expected[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int setup_groups(void)
+{
+    uint8_t id;
+
+    if (actuator_hal_init(&mock_actuator_backend) != ESP_OK) {
+        printf("Groups: FAIL actuator init\n");
+        return 1;
+    }
+    for (size_t i = 0; i < BENCH_CHANNELS; i++) {
+        if (actuator_hal_add_channel(&bench_channels[i], &id) != ESP_OK) {
+            printf("Groups: FAIL adding channel %s\n", bench_channels[i].name);
+            return 1;
+        }
+    }
+    if (command_router_init(CONFIG_ESP_MQTT_DEVICE_ID) != ESP_OK ||
+        command_router_register_group("scene", bench_scene_handler, NULL) != ESP_OK ||
+        command_router_register("rules", bench_device_only_handler, NULL) != ESP_OK ||
+        command_router_register("groups", device_groups_command_handler, NULL) != ESP_OK ||
+        device_groups_init(network_mqtt_subscribe) != ESP_OK) {
+        printf("Groups: FAIL setup\n");
+        return 1;
+    }
+    if (device_groups_count() != 0) {
+        printf("Groups: FAIL %u groups before any join\n", (unsigned)device_groups_count());
+        return 1;
+    }
+    esp_mqtt_event_t connected = { 0 };
+    mock_mqtt_emit(MQTT_EVENT_CONNECTED, &connected);
+    return 0;
+}
+
+// Join and leave through the device command, subscriptions and the stored list.
+static int check_membership(void)
+{
+    mock_mqtt_stats_t before;
+    mock_mqtt_stats_t after;
+    device_groups_stats_t st;
+    int failures = 0;
+
+    mock_mqtt_get_stats(&before);
+    failures += send_message(DEVICE_TOPIC("groups"), "{\"join\":\"" BENCH_GROUP "\",\"key\":\"" BENCH_GROUP_KEY "\"}",
+                             CONFIG_DEVICE_AES_KEY);
+    failures += send_message(DEVICE_TOPIC("groups"), "{\"join\":\"" BENCH_OTHER "\",\"key\":\"other-key\"}",
+                             CONFIG_DEVICE_AES_KEY);
+    // A wildcard in the name is rejected, joining again only replaces the key.
+    failures += send_message(DEVICE_TOPIC("groups"), "{\"join\":\"a/#\",\"key\":\"k\"}", CONFIG_DEVICE_AES_KEY);
+    failures += send_message(DEVICE_TOPIC("groups"), "{\"join\":\"" BENCH_GROUP "\",\"key\":\"" BENCH_GROUP_KEY "\"}",
+                             CONFIG_DEVICE_AES_KEY);
+    mock_mqtt_get_stats(&after);
+    if (device_groups_count() != 2 || after.subscribes - before.subscribes != 2 ||
+        strcmp(after.last_subscribe, GROUP_TOPIC(BENCH_OTHER, "#")) != 0) {
+        printf("Groups: FAIL join (%u groups, %u subscribes, last \"%s\")\n", (unsigned)device_groups_count(),
+               (unsigned)(after.subscribes - before.subscribes), after.last_subscribe);
+        failures++;
+    }
+
+    // Reconnect without a session: device and group topics in one SUBSCRIBE.
+    esp_mqtt_event_t disconnected = { 0 };
+    esp_mqtt_event_t connected = { 0 };
+    mock_mqtt_emit(MQTT_EVENT_DISCONNECTED, &disconnected);
+    mock_mqtt_emit(MQTT_EVENT_CONNECTED, &connected);
+    mock_mqtt_get_stats(&before);
+    if (before.subscribes - after.subscribes != 1 || before.subscribe_filters - after.subscribe_filters != 3) {
+        printf("Groups: FAIL resubscribe (%u packets, %u filters)\n", (unsigned)(before.subscribes - after.subscribes),
+               (unsigned)(before.subscribe_filters - after.subscribe_filters));
+        failures++;
+    }
+
+    failures += send_message(DEVICE_TOPIC("groups"), "{\"leave\":\"" BENCH_OTHER "\"}", CONFIG_DEVICE_AES_KEY);
+    mock_mqtt_get_stats(&after);
+    if (device_groups_count() != 1 || after.unsubscribes - before.unsubscribes != 1 ||
+        strcmp(after.last_unsubscribe, GROUP_TOPIC(BENCH_OTHER, "#")) != 0) {
+        printf("Groups: FAIL leave (%u groups, last unsubscribe \"%s\")\n", (unsigned)device_groups_count(),
+               after.last_unsubscribe);
+        failures++;
+    }
+
+    // Changes made offline go out when the broker resumes the session.
+    esp_mqtt_event_t resumed = { .session_present = 1 };
+    mock_mqtt_emit(MQTT_EVENT_DISCONNECTED, &disconnected);
+    failures += send_message(DEVICE_TOPIC("groups"), "{\"join\":\"" BENCH_OTHER "\",\"key\":\"other-key\"}",
+                             CONFIG_DEVICE_AES_KEY);
+    mock_mqtt_get_stats(&before);
+    mock_mqtt_emit(MQTT_EVENT_CONNECTED, &resumed);
+    mock_mqtt_get_stats(&after);
+    if (before.subscribes != after.subscribes - 1 || strcmp(after.last_subscribe, GROUP_TOPIC(BENCH_OTHER, "#")) != 0) {
+        printf("Groups: FAIL offline join (%u subscribes on resume, last \"%s\")\n",
+               (unsigned)(after.subscribes - before.subscribes), after.last_subscribe);
+        failures++;
+    }
+    mock_mqtt_emit(MQTT_EVENT_DISCONNECTED, &disconnected);
+    failures += send_message(DEVICE_TOPIC("groups"), "{\"leave\":\"" BENCH_OTHER "\"}", CONFIG_DEVICE_AES_KEY);
+    mock_mqtt_get_stats(&before);
+    mock_mqtt_emit(MQTT_EVENT_CONNECTED, &resumed);
+    mock_mqtt_get_stats(&after);
+    if (before.unsubscribes != after.unsubscribes - 1 || after.subscribes != before.subscribes ||
+        strcmp(after.last_unsubscribe, GROUP_TOPIC(BENCH_OTHER, "#")) != 0) {
+        printf("Groups: FAIL offline leave (%u unsubscribes on resume)\n",
+               (unsigned)(after.unsubscribes - before.unsubscribes));
+        failures++;
+    }
+
+    // Reboot: the membership comes back from NVS.
+    if (device_groups_init(network_mqtt_subscribe) != ESP_OK || device_groups_count() != 1 ||
+        device_groups_get_topic(0) == NULL || strcmp(device_groups_get_topic(0), GROUP_TOPIC(BENCH_GROUP, "#")) != 0) {
+        printf("Groups: FAIL membership not restored (%u groups)\n", (unsigned)device_groups_count());
+        failures++;
+    }
+    device_groups_get_stats(&st);
+    if (st.members != 1) {
+        printf("Groups: FAIL members=%u\n", (unsigned)st.members);
+        failures++;
+    }
+    return failures;
+}
+
+// Group messages reach group commands only, and only for groups joined.
+static int check_routing(void)
+{
+    static const uint8_t all_off[BENCH_CHANNELS] = { 0 };
+    mock_actuator_stats_t before;
+    mock_actuator_stats_t after;
+    device_groups_stats_t st;
+    int failures = 0;
+
+    mock_actuator_get_stats(&before);
+    uint32_t applied = scenes_applied;
+    failures += send_message(GROUP_TOPIC(BENCH_GROUP, "scene"), scene_evening, BENCH_GROUP_KEY);
+    mock_actuator_get_stats(&after);
+    failures += check_levels(scene_evening_levels, "group scene");
+    if (scenes_applied - applied != 1 || after.digital_writes - before.digital_writes != 1) {
+        printf("Groups: FAIL scene took %u digital writes\n", (unsigned)(after.digital_writes - before.digital_writes));
+        failures++;
+    }
+
+    failures += send_message(GROUP_TOPIC(BENCH_GROUP, "rules"), "{}", BENCH_GROUP_KEY);
+    failures += send_message(GROUP_TOPIC(BENCH_OTHER, "scene"), scene_off, "other-key");
+    failures += send_message(GROUP_TOPIC("attic", "scene"), scene_off, BENCH_GROUP_KEY);
+    failures += check_levels(scene_evening_levels, "scene of a group not joined");
+    if (device_only_calls != 0) {
+        printf("Groups: FAIL device only command ran from a group topic\n");
+        failures++;
+    }
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+    // Under the device key instead of the group key.
+    device_groups_get_stats(&st);
+    uint32_t undecryptable = st.undecryptable;
+    failures += send_message(GROUP_TOPIC(BENCH_GROUP, "scene"), scene_off, CONFIG_DEVICE_AES_KEY);
+    device_groups_get_stats(&st);
+    failures += check_levels(scene_evening_levels, "scene under the wrong key");
+    if (st.undecryptable != undecryptable + 1) {
+        printf("Groups: FAIL wrong key not rejected\n");
+        failures++;
+    }
+#endif
+    // The device topic still works, and a scene can be sent there too.
+    failures += send_message(DEVICE_TOPIC("scene"), scene_off, CONFIG_DEVICE_AES_KEY);
+    failures += check_levels(all_off, "device scene");
+    device_groups_get_stats(&st);
+    if (st.messages < 2) {
+        printf("Groups: FAIL group messages=%u\n", (unsigned)st.messages);
+        failures++;
+    }
+    return failures;
+}
+
+// Leaves made offline wait for the next connect; once DEVICE_GROUPS_MAX
+// wait, a further leave is refused and the group kept.
+static int check_offline_leaves(void)
+{
+    esp_mqtt_event_t disconnected = { 0 };
+    esp_mqtt_event_t resumed = { .session_present = 1 };
+    mock_mqtt_stats_t before;
+    mock_mqtt_stats_t after;
+    device_groups_stats_t st;
+    char name[16];
+    int failures = 0;
+
+    mock_mqtt_emit(MQTT_EVENT_DISCONNECTED, &disconnected);
+    for (int i = 0; i <= DEVICE_GROUPS_MAX; i++) {
+        int len = snprintf(name, sizeof(name), "spare%d", i);
+        esp_err_t expected = i < DEVICE_GROUPS_MAX ? ESP_OK : ESP_ERR_NO_MEM;
+        if (device_groups_join(name, len, "spare-key", 9) != ESP_OK || device_groups_leave(name, len) != expected) {
+            printf("Groups: FAIL offline leave of %s\n", name);
+            failures++;
+        }
+    }
+    device_groups_get_stats(&st);
+    if (device_groups_count() != 2 || st.leaves_refused != 1) {
+        printf("Groups: FAIL %u groups, %u leaves refused\n", (unsigned)device_groups_count(),
+               (unsigned)st.leaves_refused);
+        failures++;
+    }
+    mock_mqtt_get_stats(&before);
+    mock_mqtt_emit(MQTT_EVENT_CONNECTED, &resumed);
+    mock_mqtt_get_stats(&after);
+    if (after.unsubscribes - before.unsubscribes != DEVICE_GROUPS_MAX) {
+        printf("Groups: FAIL %u unsubscribes on resume\n", (unsigned)(after.unsubscribes - before.unsubscribes));
+        failures++;
+    }
+    // Connected again, the refused leave goes through.
+    if (device_groups_leave(name, strlen(name)) != ESP_OK || device_groups_count() != 1) {
+        printf("Groups: FAIL leave of %s once connected\n", name);
+        failures++;
+    }
+    return failures;
+}
+
+int bench_groups(void)
+{
+    static bench_message_t scenes[2];
+    mock_actuator_stats_t before;
+    mock_actuator_stats_t after;
+
+    int failures = setup_groups();
+    if (failures) {
+        return failures;
+    }
+    failures += check_membership();
+    failures += check_routing();
+    failures += check_offline_leaves();
+
+    // One group message, from the MQTT event to all outputs of the device.
+    failures += make_message(&scenes[0], GROUP_TOPIC(BENCH_GROUP, "scene"), scene_evening, BENCH_GROUP_KEY);
+    failures += make_message(&scenes[1], GROUP_TOPIC(BENCH_GROUP, "scene"), scene_off, BENCH_GROUP_KEY);
+    uint32_t applied = scenes_applied;
+    mock_actuator_get_stats(&before);
+    uint64_t t0 = bench_now_ns();
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+        deliver(&scenes[i & 1]);
+    }
+    double scene_ns = (double)(bench_now_ns() - t0) / BENCH_ITERATIONS;
+    mock_actuator_get_stats(&after);
+    applied = scenes_applied - applied;
+    if (applied != BENCH_ITERATIONS) {
+        printf("Groups: FAIL %u of %u scenes applied\n", (unsigned)applied, BENCH_ITERATIONS);
+        failures++;
+    }
+
+    printf("BENCH groups channels=%u scene_ns=%.0f digital_writes_per_scene=%.2f pwm_fades_per_scene=%.2f "
+           "groups=%u\n", (unsigned)BENCH_CHANNELS, scene_ns,
+           (double)(after.digital_writes - before.digital_writes) / BENCH_ITERATIONS,
+           (double)(after.pwm_fades - before.pwm_fades) / BENCH_ITERATIONS, (unsigned)device_groups_count());
+
+    esp_mqtt_event_t disconnected = { 0 };
+    mock_mqtt_emit(MQTT_EVENT_DISCONNECTED, &disconnected);
+    return failures;
+}
@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "host_bench.h"
+#include "host_mocks.h"
+#include "network_mqtt_handler.h"
+#include "command_router.h"
+#include "command_ack.h"
+#include "device_crypto.h"
+#include "lan_listener.h"
+
+#define BENCH_COMMANDS   2000
+#define BENCH_FRAME_MAX  256
+#define BENCH_TIMEOUT_MS 1000
+
+#define LED_TOPIC "home/devices/" CONFIG_ESP_MQTT_DEVICE_ID "/command/setLed"
+
+static uint32_t led_runs;
+
+static char announce_payload[128];
+static size_t announce_len;
+
+// Sockets on the loopback interface: the hub's datagram socket, and for the
+// MQTT path a TCP relay standing in for the broker between hub and device.
+static int hub_udp = -1;
+static struct sockaddr_in lan_addr;
+static int hub_tcp = -1;
+static int broker_in = -1;
+static int broker_out = -1;
+static int device_tcp = -1;
+
+static char rx_topic[MOCK_MQTT_TOPIC_MAX_LEN];
+static char rx_buffer[BENCH_FRAME_MAX];
+static char relay_buffer[BENCH_FRAME_MAX];
+
+static esp_err_t bench_led_handler(const char *data, size_t data_len, void *ctx)
+{
+    led_runs++;
+    return ESP_OK;
+}
+
+static int capture_announce(const char *subtopic, char *buf, size_t len, size_t buf_size)
+{
+    if (strcmp(subtopic, "lan") != 0 || len >= sizeof(announce_payload)) {
+        return -1;
+    }
+    memcpy(announce_payload, buf, len);
+    announce_len = len;
+    return 1;
+}
+
+static int discard_ack(const char *subtopic, char *buf, size_t len, size_t buf_size)
+{
+    return 1;
+}
+
+// Encrypts a setLed command with the device key, as the backend sends it both ways.
+static size_t build_frame(uint32_t seq, char *out, size_t out_size)
+{
+    size_t len = (size_t)snprintf(out, out_size, "{\"state\":%s,\"seq\":%u}", seq % 2 ? "true" : "false",
+                                  (unsigned)seq);
+    if (seq == 0) {
+        len = (size_t)snprintf(out, out_size, "{\"state\":true}");
+    }
+    device_crypto_t crypto = { 0 };
+    esp_err_t err = device_crypto_init(&crypto, CONFIG_DEVICE_AES_KEY, strlen(CONFIG_DEVICE_AES_KEY));
+    if (err == ESP_OK) {
+        err = device_crypto_encrypt_in_place(&crypto, out, len, out_size, &len);
+    }
+    device_crypto_free(&crypto);
+    return err == ESP_OK ? len : 0;
+}
+
+// Sends "<topic> <frame>" to the listener and lets it handle the datagram.
+static esp_err_t send_lan(const char *frame, size_t frame_len)
+{
+    char datagram[sizeof(LED_TOPIC) + BENCH_FRAME_MAX];
+    memcpy(datagram, LED_TOPIC, sizeof(LED_TOPIC) - 1);
+    datagram[sizeof(LED_TOPIC) - 1] = ' ';
+    memcpy(datagram + sizeof(LED_TOPIC), frame, frame_len);
+    if (sendto(hub_udp, datagram, sizeof(LED_TOPIC) + frame_len, 0, (const struct sockaddr *)&lan_addr,
+               sizeof(lan_addr)) < 0) {
+        return ESP_FAIL;
+    }
+    return lan_listener_receive(BENCH_TIMEOUT_MS);
+}
+
+static int read_exact(int sock, char *buf, size_t len)
+{
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = recv(sock, buf + got, len - got, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        got += (size_t)n;
+    }
+    return 0;
+}
+
+// hub -> broker -> device over TCP, then the message event as esp-mqtt raises it.
+static int send_mqtt(const char *frame, size_t frame_len)
+{
+    if (send(hub_tcp, frame, frame_len, 0) != (ssize_t)frame_len ||
+        read_exact(broker_in, relay_buffer, frame_len) != 0 ||
+        send(broker_out, relay_buffer, frame_len, 0) != (ssize_t)frame_len ||
+        read_exact(device_tcp, rx_buffer, frame_len) != 0) {
+        return 1;
+    }
+    memcpy(rx_topic, LED_TOPIC, sizeof(LED_TOPIC) - 1);
+    esp_mqtt_event_t event = {
+        .topic = rx_topic,
+        .topic_len = (int)sizeof(LED_TOPIC) - 1,
+        .data = rx_buffer,
+        .data_len = (int)frame_len,
+        .total_data_len = (int)frame_len,
+    };
+    mock_mqtt_emit(MQTT_EVENT_DATA, &event);
+    return 0;
+}
+
+// A connected TCP pair through a listening socket: *client and *server.
+static int tcp_pair(int *client, int *server)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_len = sizeof(addr);
+    int one = 1;
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 1) != 0 ||
+        getsockname(listener, (struct sockaddr *)&addr, &addr_len) != 0) {
+        return 1;
+    }
+    *client = socket(AF_INET, SOCK_STREAM, 0);
+    if (*client < 0 || connect(*client, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(listener);
+        return 1;
+    }
+    *server = accept(listener, NULL, NULL);
+    close(listener);
+    if (*server < 0) {
+        return 1;
+    }
+    // esp-mqtt and the broker write each packet out at once.
+    setsockopt(*client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(*server, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return 0;
+}
+
+static int open_sockets(void)
+{
+    lan_listener_stats_t st;
+    lan_listener_get_stats(&st);
+    lan_addr = (struct sockaddr_in){
+        .sin_family = AF_INET,
+        .sin_port = htons(st.port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    hub_udp = socket(AF_INET, SOCK_DGRAM, 0);
+    if (hub_udp < 0 || tcp_pair(&hub_tcp, &broker_in) != 0 || tcp_pair(&device_tcp, &broker_out) != 0) {
+        return 1;
+    }
+    return 0;
+}
+
+static void close_sockets(void)
+{
+    int *socks[] = { &hub_udp, &hub_tcp, &broker_in, &broker_out, &device_tcp };
+    for (size_t i = 0; i < sizeof(socks) / sizeof(socks[0]); i++) {
+        if (*socks[i] >= 0) {
+            close(*socks[i]);
+            *socks[i] = -1;
+        }
+    }
+}
+
+static esp_err_t reset_acks(void)
+{
+    command_ack_config_t config = COMMAND_ACK_CONFIG_DEFAULT();
+    return command_ack_init(&config, discard_ack);
+}
+
+// Same sequence number both ways: the first copy runs, the second is a duplicate.
+// LAN frames are refused until a number came over MQTT, and outside the window around it.
+static int check_freshness(void)
+{
+    char frame[BENCH_FRAME_MAX];
+    size_t len;
+    lan_listener_stats_t before, st;
+    int failures = 0;
+
+    reset_acks();
+    led_runs = 0;
+    lan_listener_get_stats(&before);
+
+    len = build_frame(500, frame, sizeof(frame));
+    send_lan(frame, len);
+    uint32_t runs_unanchored = led_runs;
+
+    len = build_frame(500, frame, sizeof(frame));
+    failures += send_mqtt(frame, len);
+    len = build_frame(501, frame, sizeof(frame));
+    send_lan(frame, len);
+    failures += send_mqtt(frame, len);
+    send_lan(frame, len);
+    uint32_t runs_dedup = led_runs;
+
+    len = build_frame(501 + CONFIG_LAN_LISTENER_SEQ_AHEAD + 1, frame, sizeof(frame));
+    send_lan(frame, len);
+    len = build_frame(501 - COMMAND_ACK_DEDUP_WINDOW, frame, sizeof(frame));
+    send_lan(frame, len);
+    len = build_frame(0, frame, sizeof(frame));
+    send_lan(frame, len);
+    len = build_frame(502, frame, sizeof(frame));
+    frame[len - 1] = frame[len - 1] == '0' ? '1' : '0';
+    send_lan(frame, len);
+    uint32_t runs_refused = led_runs;
+
+    lan_listener_get_stats(&st);
+    if (runs_unanchored != 0 || runs_dedup != 2 || runs_refused != 2 ||
+        st.dispatched - before.dispatched != 2 || st.refused - before.refused != 5) {
+        printf("LAN: FAIL freshness (runs %u/%u/%u, dispatched %u, refused %u)\n", (unsigned)runs_unanchored,
+               (unsigned)runs_dedup, (unsigned)runs_refused, (unsigned)(st.dispatched - before.dispatched),
+               (unsigned)(st.refused - before.refused));
+        failures++;
+    }
+    return failures;
+}
+
+static int check_malformed(void)
+{
+    static const char *datagrams[] = { "no-space", " leading", LED_TOPIC " " };
+    lan_listener_stats_t before, st;
+
+    lan_listener_get_stats(&before);
+    for (size_t i = 0; i < sizeof(datagrams) / sizeof(datagrams[0]); i++) {
+        sendto(hub_udp, datagrams[i], strlen(datagrams[i]), 0, (const struct sockaddr *)&lan_addr, sizeof(lan_addr));
+        lan_listener_receive(BENCH_TIMEOUT_MS);
+    }
+    lan_listener_get_stats(&st);
+    if (st.malformed - before.malformed != 3 || lan_listener_receive(0) != ESP_ERR_TIMEOUT) {
+        printf("LAN: FAIL malformed datagrams (%u)\n", (unsigned)(st.malformed - before.malformed));
+        return 1;
+    }
+    return 0;
+}
+
+static int check_announce(void)
+{
+    lan_listener_stats_t st;
+    char expected[64];
+
+    lan_listener_get_stats(&st);
+    snprintf(expected, sizeof(expected), "{\"address\":\"192.168.1.23\",\"port\":%u}", (unsigned)st.port);
+    if (lan_listener_announce("192.168.1.23") != ESP_OK || announce_len != strlen(expected) ||
+        memcmp(announce_payload, expected, announce_len) != 0 ||
+        lan_listener_announce("192.168.1.23\",\"x") != ESP_ERR_INVALID_ARG) {
+        printf("LAN: FAIL announcement %.*s\n", (int)announce_len, announce_payload);
+        return 1;
+    }
+    return 0;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Time from the hub's send to the handler run, per path; frames are built beforehand.
+static int measure(bool lan, uint64_t *samples, uint32_t first_seq)
+{
+    char frame[BENCH_FRAME_MAX];
+
+    for (uint32_t i = 0; i < BENCH_COMMANDS; i++) {
+        size_t len = build_frame(first_seq + i, frame, sizeof(frame));
+        uint32_t runs = led_runs;
+        uint64_t t0 = bench_now_ns();
+        if (lan ? send_lan(frame, len) != ESP_OK : send_mqtt(frame, len) != 0) {
+            return 1;
+        }
+        samples[i] = bench_now_ns() - t0;
+        if (led_runs != runs + 1) {
+            return 1;
+        }
+    }
+    qsort(samples, BENCH_COMMANDS, sizeof(samples[0]), compare_u64);
+    return 0;
+}
+
+int bench_lan(void)
+{
+    static uint64_t lan_ns[BENCH_COMMANDS];
+    static uint64_t mqtt_ns[BENCH_COMMANDS];
+    lan_listener_config_t config = LAN_LISTENER_CONFIG_DEFAULT();
+    int failures = 0;
+
+    config.port = 0;
+    config.encoding = TELEMETRY_ENCODING_JSON;
+    network_mqtt_app_start();
+    if (command_router_init(CONFIG_ESP_MQTT_DEVICE_ID) != ESP_OK ||
+        command_router_register("setLed", bench_led_handler, NULL) != ESP_OK ||
+        lan_listener_init(&config, network_dispatch_lan, capture_announce) != ESP_OK || open_sockets() != 0) {
+        printf("LAN: FAIL setup\n");
+        close_sockets();
+        return 1;
+    }
+    failures += check_freshness();
+    failures += check_malformed();
+    failures += check_announce();
+
+    // Each path moves the anchor on by its own commands; MQTT goes first to set it.
+    reset_acks();
+    if (measure(false, mqtt_ns, 1000) != 0 || measure(true, lan_ns, 1000 + BENCH_COMMANDS) != 0) {
+        printf("LAN: FAIL latency run\n");
+        failures++;
+    }
+    close_sockets();
+
+    printf("BENCH lan commands=%u lan_p50_us=%.1f lan_p99_us=%.1f mqtt_relay_p50_us=%.1f mqtt_relay_p99_us=%.1f\n",
+           (unsigned)BENCH_COMMANDS, lan_ns[BENCH_COMMANDS / 2] / 1000.0, lan_ns[BENCH_COMMANDS * 99 / 100] / 1000.0,
+           mqtt_ns[BENCH_COMMANDS / 2] / 1000.0, mqtt_ns[BENCH_COMMANDS * 99 / 100] / 1000.0);
+    return failures;
+}
@@ -0,0 +1,255 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "host_bench.h"
+#include "host_mocks.h"
+#include "device_metrics.h"
+#include "network_mqtt_handler.h"
+#include "json_lite.h"
+#include "cbor_lite.h"
+
+#define BENCH_ITERATIONS 1000000
+#define BENCH_WRITER_THREADS 2
+#define BENCH_WRITES_PER_THREAD 200000
+#define BENCH_PERIOD_MS 60000
+
+static char snapshot[CONFIG_DEVICE_METRICS_PAYLOAD_MAX + 1];
+static size_t snapshot_len;
+static unsigned snapshots;
+static unsigned samples;
+
+static int capture_snapshot(const char *subtopic, char *buf, size_t len, size_t buf_size)
+{
+    if (strcmp(subtopic, "telemetry/metrics") != 0 || len >= sizeof(snapshot)) {
+        return -1;
+    }
+    memcpy(snapshot, buf, len);
+    snapshot_len = len;
+    snapshots++;
+    return 1;
+}
+
+static void sample_gauges(void)
+{
+    device_metrics_set(METRIC_HEAP_FREE, 123456);
+    device_metrics_set(METRIC_RSSI, -61);
+    samples++;
+}
+
+static esp_err_t setup(telemetry_encoding_t encoding)
+{
+    device_metrics_config_t config = DEVICE_METRICS_CONFIG_DEFAULT();
+    config.period_ms = BENCH_PERIOD_MS;
+    config.encoding = encoding;
+    snapshots = 0;
+    samples = 0;
+    return device_metrics_init(&config, sample_gauges, capture_snapshot);
+}
+
+static uint32_t bucket(device_metric_histogram_t id, size_t b)
+{
+    return atomic_load(&device_metrics.buckets[id][b]);
+}
+
+static void *writer_thread(void *arg)
+{
+    for (uint32_t i = 0; i < BENCH_WRITES_PER_THREAD; i++) {
+        device_metrics_count(METRIC_MSG_OUT);
+        device_metrics_observe(METRIC_PUBLISH_US, i & 1023);
+    }
+    return NULL;
+}
+
+// Counts from several threads at once must all land.
+static int check_concurrent(void)
+{
+    pthread_t threads[BENCH_WRITER_THREADS];
+    uint32_t expected = BENCH_WRITER_THREADS * BENCH_WRITES_PER_THREAD;
+    uint32_t observed = 0;
+
+    for (uintptr_t t = 0; t < BENCH_WRITER_THREADS; t++) {
+        pthread_create(&threads[t], NULL, writer_thread, NULL);
+    }
+    for (size_t t = 0; t < BENCH_WRITER_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    for (size_t b = 0; b < DEVICE_METRICS_BUCKETS; b++) {
+        observed += bucket(METRIC_PUBLISH_US, b);
+    }
+    uint32_t counted = atomic_load(&device_metrics.counters[METRIC_MSG_OUT]);
+    if (counted != expected || observed != expected) {
+        printf("Metrics: FAIL concurrent updates, counted %u observed %u of %u\n", (unsigned)counted,
+               (unsigned)observed, (unsigned)expected);
+        return 1;
+    }
+    return 0;
+}
+
+static int check_buckets(void)
+{
+    static const struct {
+        uint32_t value;
+        size_t bucket;
+    } cases[] = {
+        { 0, 0 }, { 1, 1 }, { 2, 2 }, { 3, 2 }, { 4, 3 }, { 1000, 10 }, { 1024, 11 },
+        { UINT32_MAX, DEVICE_METRICS_BUCKETS - 1 },
+    };
+    int failures = 0;
+
+    setup(TELEMETRY_ENCODING_JSON);
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        uint32_t before = bucket(METRIC_DISPATCH_US, cases[i].bucket);
+        device_metrics_observe(METRIC_DISPATCH_US, cases[i].value);
+        if (bucket(METRIC_DISPATCH_US, cases[i].bucket) != before + 1) {
+            printf("Metrics: FAIL %u not in bucket %u\n", (unsigned)cases[i].value, (unsigned)cases[i].bucket);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+// One snapshot per period, with the gauges sampled right before it.
+static int check_snapshot_json(void)
+{
+    const char *raw;
+    size_t raw_len;
+    int32_t value;
+    int failures = 0;
+
+    setup(TELEMETRY_ENCODING_JSON);
+    device_metrics_count(METRIC_MSG_IN);
+    device_metrics_count(METRIC_MSG_IN);
+    device_metrics_count(METRIC_RECONNECTS);
+    device_metrics_observe(METRIC_DISPATCH_US, 5);
+    device_metrics_observe(METRIC_DISPATCH_US, 6);
+    device_metrics_observe(METRIC_DISPATCH_US, 300);
+
+    bool early = device_metrics_poll(1000) || device_metrics_poll(1000 + BENCH_PERIOD_MS - 1);
+    bool published = device_metrics_poll(1000 + BENCH_PERIOD_MS);
+    if (early || !published || snapshots != 1 || samples != 1) {
+        printf("Metrics: FAIL poll published %u snapshots, sampled %u times\n", snapshots, samples);
+        return 1;
+    }
+    if (json_lite_get_int(snapshot, snapshot_len, "msgIn", &value) != ESP_OK || value != 2 ||
+        json_lite_get_int(snapshot, snapshot_len, "reconnects", &value) != ESP_OK || value != 1 ||
+        json_lite_get_int(snapshot, snapshot_len, "rssi", &value) != ESP_OK || value != -61 ||
+        json_lite_get_int(snapshot, snapshot_len, "up", &value) != ESP_OK || value != 1000 + BENCH_PERIOD_MS) {
+        printf("Metrics: FAIL JSON snapshot values: %.*s\n", (int)snapshot_len, snapshot);
+        failures++;
+    }
+    // Sum first, then buckets 0..9 (300 is in [256, 512)), trailing empty buckets left out.
+    if (json_lite_get_raw(snapshot, snapshot_len, "dispatchUs", &raw, &raw_len) != ESP_OK ||
+        raw_len != strlen("[311,0,0,0,2,0,0,0,0,0,1]") || memcmp(raw, "[311,0,0,0,2,0,0,0,0,0,1]", raw_len) != 0 ||
+        json_lite_get_raw(snapshot, snapshot_len, "actuateUs", &raw, &raw_len) != ESP_OK || raw_len != 3) {
+        printf("Metrics: FAIL JSON histograms: %.*s\n", (int)snapshot_len, snapshot);
+        failures++;
+    }
+    return failures;
+}
+
+static int check_snapshot_cbor(void)
+{
+    int32_t value;
+
+    setup(TELEMETRY_ENCODING_CBOR);
+    device_metrics_count(METRIC_WIFI_DISCONNECTS);
+    device_metrics_poll(0);
+    if (!device_metrics_poll(BENCH_PERIOD_MS) || !cbor_lite_is_cbor(snapshot, snapshot_len) ||
+        cbor_lite_get_int(snapshot, snapshot_len, "wifiDisconnects", &value) != ESP_OK || value != 1 ||
+        cbor_lite_get_int(snapshot, snapshot_len, "rssi", &value) != ESP_OK || value != -61) {
+        printf("Metrics: FAIL CBOR snapshot\n");
+        return 1;
+    }
+    return 0;
+}
+
+// A message through the event path is counted and timed.
+static int check_event_path(void)
+{
+    static char topic[] = "home/devices/" CONFIG_ESP_MQTT_DEVICE_ID "/command/no_such_command";
+    static char data[] = "{\"state\":1}";
+    uint32_t dispatched = 0;
+
+    setup(TELEMETRY_ENCODING_JSON);
+    network_mqtt_app_start();
+    esp_mqtt_event_t event = {
+        .topic = topic,
+        .topic_len = (int)strlen(topic),
+        .data = data,
+        .data_len = (int)strlen(data),
+        .total_data_len = (int)strlen(data),
+    };
+    mock_mqtt_emit(MQTT_EVENT_DATA, &event);
+
+    for (size_t b = 0; b < DEVICE_METRICS_BUCKETS; b++) {
+        dispatched += bucket(METRIC_DISPATCH_US, b);
+    }
+    // Plaintext is rejected when encryption is on, an unknown command otherwise.
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+    uint32_t rejected = atomic_load(&device_metrics.counters[METRIC_UNDECRYPTABLE]);
+    uint32_t expected_dispatched = 0;
+#else
+    uint32_t rejected = atomic_load(&device_metrics.counters[METRIC_COMMAND_FAILURES]);
+    uint32_t expected_dispatched = 1;
+#endif
+    if (atomic_load(&device_metrics.counters[METRIC_MSG_IN]) != 1 || rejected != 1 ||
+        dispatched != expected_dispatched) {
+        printf("Metrics: FAIL event path counters (rejected %u, dispatched %u)\n", (unsigned)rejected,
+               (unsigned)dispatched);
+        return 1;
+    }
+    return 0;
+}
+
+int bench_metrics(void)
+{
+    char buf[CONFIG_DEVICE_METRICS_PAYLOAD_MAX];
+    int failures = 0;
+
+    failures += check_buckets();
+    failures += check_snapshot_json();
+    failures += check_snapshot_cbor();
+    failures += check_event_path();
+
+    setup(TELEMETRY_ENCODING_JSON);
+    uint64_t t0 = bench_now_ns();
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+        device_metrics_count(METRIC_MSG_IN);
+    }
+    double count_ns = (double)(bench_now_ns() - t0) / BENCH_ITERATIONS;
+
+    t0 = bench_now_ns();
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+        device_metrics_observe(METRIC_DISPATCH_US, i & 0xffff);
+    }
+    double observe_ns = (double)(bench_now_ns() - t0) / BENCH_ITERATIONS;
+
+    t0 = bench_now_ns();
+    failures += check_concurrent();
+    double concurrent_ns = (double)(bench_now_ns() - t0) / (BENCH_WRITER_THREADS * BENCH_WRITES_PER_THREAD);
+
+    // Every histogram bucket in use, counters in the millions: a busy device.
+    for (size_t h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+        for (size_t b = 0; b < DEVICE_METRICS_BUCKETS; b++) {
+            device_metrics_observe(h, b ? 1u << (b - 1) : 0);
+        }
+    }
+    t0 = bench_now_ns();
+    size_t json_len = device_metrics_snapshot(BENCH_PERIOD_MS, buf, sizeof(buf));
+    double snapshot_ns = (double)(bench_now_ns() - t0);
+    setup(TELEMETRY_ENCODING_CBOR);
+    size_t cbor_idle_len = device_metrics_snapshot(BENCH_PERIOD_MS, buf, sizeof(buf));
+    setup(TELEMETRY_ENCODING_JSON);
+    size_t json_idle_len = device_metrics_snapshot(BENCH_PERIOD_MS, buf, sizeof(buf));
+    if (json_len == 0 || json_idle_len == 0 || cbor_idle_len == 0) {
+        printf("Metrics: FAIL snapshot does not fit CONFIG_DEVICE_METRICS_PAYLOAD_MAX\n");
+        failures++;
+    }
+
+    printf("BENCH metrics count_ns=%.1f observe_ns=%.1f concurrent_ns=%.1f snapshot_ns=%.0f "
+           "snapshot_bytes_json=%u snapshot_bytes_json_idle=%u snapshot_bytes_cbor_idle=%u slots_bytes=%u\n",
+           count_ns, observe_ns, concurrent_ns, snapshot_ns, (unsigned)json_len, (unsigned)json_idle_len,
+           (unsigned)cbor_idle_len, (unsigned)sizeof(device_metrics));
+    return failures;
+}
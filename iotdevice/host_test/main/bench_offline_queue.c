@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "host_bench.h"
+#include "host_mocks.h"
+#include "nvs_flash.h"
+#include "esp_timer.h"
+#include "offline_queue.h"
+#include "network_mqtt_handler.h"
+#include "device_crypto.h"
+
+#define BENCH_OUTAGE_MESSAGES 400
+#define BENCH_REBOOT_MESSAGES 100
+#define BENCH_REPLAY_RATE     50
+#define BENCH_REPLAY_BATCH    5
+#define BENCH_JITTER_MS       2000
+#define BENCH_TICK_MS         10
+#define BENCH_PAYLOAD_SIZE    DEVICE_CRYPTO_FRAME_SIZE(96)
+
+#define DEVICE_TOPIC(sub) "home/devices/" CONFIG_ESP_MQTT_DEVICE_ID "/" sub
+
+// What the replay handed to the send function, on the simulated clock.
+static uint32_t sim_now_ms;
+static bool send_fails;
+static uint32_t sent;
+static int32_t last_seq;
+static uint32_t first_seq;
+static uint32_t order_errors;
+static uint32_t first_send_ms;
+static uint32_t last_send_ms;
+
+static int capture_send(const char *subtopic, char *buf, size_t len, size_t buf_size, int qos, int retain)
+{
+    char text[32];
+    unsigned seq;
+
+    if (send_fails) {
+        return -1;
+    }
+    snprintf(text, sizeof(text), "%.*s", (int)len, buf);
+    if (strcmp(subtopic, "telemetry") != 0 || sscanf(text, "{\"seq\":%u", &seq) != 1 ||
+        (last_seq >= 0 && seq != (unsigned)last_seq + 1)) {
+        order_errors++;
+    }
+    if (sent++ == 0) {
+        first_seq = seq;
+        first_send_ms = sim_now_ms;
+    }
+    last_seq = (int32_t)seq;
+    last_send_ms = sim_now_ms;
+    return (int)sent;
+}
+
+static void reset_capture(void)
+{
+    send_fails = false;
+    sent = 0;
+    last_seq = -1;
+    order_errors = 0;
+}
+
+static esp_err_t push_seq(uint32_t seq)
+{
+    char payload[BENCH_PAYLOAD_SIZE];
+    int len = snprintf(payload, sizeof(payload), "{\"seq\":%u,\"samples\":[[1,0,1],[1,1,53120],[1,2,-61]]}",
+                       (unsigned)seq);
+    return offline_queue_push("telemetry", payload, (size_t)len, 0, 0);
+}
+
+// Polls as the replay task would until the queue is drained or time runs out.
+static void replay_until_empty(uint32_t limit_ms)
+{
+    for (uint32_t end = sim_now_ms + limit_ms; sim_now_ms < end && !offline_queue_is_empty();
+         sim_now_ms += BENCH_TICK_MS) {
+        offline_queue_poll(sim_now_ms);
+    }
+    offline_queue_poll(sim_now_ms); // Completes the replay statistics
+}
+
+// A long outage: RAM fills, older messages spill to flash, the oldest are
+// dropped. After reconnecting the rest is replayed in order, at the rate.
+static int check_outage(double *push_ns, double *replay_rate, offline_queue_stats_t *st)
+{
+    offline_queue_config_t config = { .replay_rate = BENCH_REPLAY_RATE, .replay_batch = BENCH_REPLAY_BATCH };
+    int failures = 0;
+
+    reset_capture();
+    sim_now_ms = 0;
+    offline_queue_init(&config, capture_send);
+
+    uint64_t t0 = bench_now_ns();
+    for (uint32_t i = 0; i < BENCH_OUTAGE_MESSAGES; i++) {
+        push_seq(i);
+    }
+    *push_ns = (double)(bench_now_ns() - t0) / BENCH_OUTAGE_MESSAGES;
+
+    offline_queue_get_stats(st);
+    if (st->queued != BENCH_OUTAGE_MESSAGES || st->spilled == 0 || st->dropped == 0 ||
+        st->flash_segments != CONFIG_OFFLINE_QUEUE_SPILL_SEGMENTS || sent != 0) {
+        printf("Offline queue: FAIL outage (queued %u, spilled %u, dropped %u, segments %u, sent %u)\n",
+               (unsigned)st->queued, (unsigned)st->spilled, (unsigned)st->dropped, (unsigned)st->flash_segments,
+               (unsigned)sent);
+        failures++;
+    }
+
+    sim_now_ms = 1000;
+    offline_queue_set_online(true, sim_now_ms);
+    // A failing send mid-replay retries the same message.
+    for (int i = 0; i < 10; i++, sim_now_ms += BENCH_TICK_MS) {
+        offline_queue_poll(sim_now_ms);
+    }
+    send_fails = true;
+    for (int i = 0; i < 30; i++, sim_now_ms += BENCH_TICK_MS) {
+        offline_queue_poll(sim_now_ms);
+    }
+    send_fails = false;
+    replay_until_empty(60000);
+    offline_queue_get_stats(st);
+
+    uint32_t duration_ms = last_send_ms - first_send_ms;
+    *replay_rate = duration_ms ? (double)(sent - 1) * 1000.0 / duration_ms : 0.0;
+    // Bursts of replay_batch, so the rate holds from the first message of one burst to the first of the last.
+    if (order_errors || first_seq != st->dropped || last_seq != BENCH_OUTAGE_MESSAGES - 1 ||
+        st->replayed != sent || st->replayed + st->dropped != st->queued || st->replay_failures == 0 ||
+        st->flash_segments != 0 || st->ram_used != 0 || st->last_replay_msgs != sent ||
+        (uint64_t)(sent - BENCH_REPLAY_BATCH) * 1000 > (uint64_t)BENCH_REPLAY_RATE * duration_ms) {
+        printf("Offline queue: FAIL replay (sent %u seq %u..%d, order errors %u, replayed %u, dropped %u, "
+               "failures %u, %u ms)\n", (unsigned)sent, (unsigned)first_seq, (int)last_seq, (unsigned)order_errors,
+               (unsigned)st->replayed, (unsigned)st->dropped, (unsigned)st->replay_failures, (unsigned)duration_ms);
+        failures++;
+    }
+    return failures;
+}
+
+// Spilled messages survive a reboot, the RAM ring does not.
+static int check_reboot(void)
+{
+    offline_queue_config_t config = { .replay_rate = 1000, .replay_batch = 10 };
+    offline_queue_stats_t st;
+
+    reset_capture();
+    offline_queue_init(&config, capture_send);
+    for (uint32_t i = 0; i < BENCH_REBOOT_MESSAGES; i++) {
+        push_seq(i);
+    }
+    offline_queue_get_stats(&st);
+    uint32_t spilled = st.spilled;
+
+    offline_queue_init(&config, capture_send);
+    offline_queue_get_stats(&st);
+    if (spilled == 0 || st.flash_segments == 0) {
+        printf("Offline queue: FAIL nothing kept across reboot (spilled %u)\n", (unsigned)spilled);
+        return 1;
+    }
+    offline_queue_set_online(true, sim_now_ms);
+    replay_until_empty(10000);
+    if (order_errors || sent != spilled || first_seq != 0 || !offline_queue_is_empty()) {
+        printf("Offline queue: FAIL replay after reboot (sent %u of %u spilled, first seq %u)\n", (unsigned)sent,
+               (unsigned)spilled, (unsigned)first_seq);
+        return 1;
+    }
+    return 0;
+}
+
+static int check_jitter(void)
+{
+    offline_queue_config_t config = { .replay_rate = 1000, .replay_batch = 10, .replay_jitter_ms = BENCH_JITTER_MS };
+
+    reset_capture();
+    offline_queue_init(&config, capture_send);
+    push_seq(0);
+    uint32_t online_ms = sim_now_ms;
+    offline_queue_set_online(true, online_ms);
+    replay_until_empty(2 * BENCH_JITTER_MS);
+    if (sent != 1 || first_send_ms - online_ms > BENCH_JITTER_MS) {
+        printf("Offline queue: FAIL jitter (sent %u after %u ms)\n", (unsigned)sent,
+               (unsigned)(first_send_ms - online_ms));
+        return 1;
+    }
+    return 0;
+}
+
+// Through the MQTT handler, on the mocked client that bench_event_path left disconnected.
+static int check_publish_path(void)
+{
+    offline_queue_config_t config = { .replay_rate = 1000, .replay_batch = 10 };
+    mock_mqtt_stats_t before;
+    mock_mqtt_stats_t after;
+    char payload[BENCH_PAYLOAD_SIZE];
+    int failures = 0;
+
+    offline_queue_init(&config, network_mqtt_send);
+    mock_mqtt_get_stats(&before);
+    for (int i = 0; i < 3; i++) {
+        int len = snprintf(payload, sizeof(payload), "{\"seq\":%d}", i);
+        failures += network_mqtt_publish("telemetry", payload, (size_t)len, sizeof(payload), 0, 0) != 0;
+    }
+    esp_mqtt_event_t connected = { .session_present = 1 };
+    mock_mqtt_emit(MQTT_EVENT_CONNECTED, &connected);
+    // Still behind the queued ones, or the order would change.
+    strcpy(payload, "{\"seq\":3}");
+    network_mqtt_publish("telemetry", payload, strlen(payload), sizeof(payload), 0, 0);
+    mock_mqtt_get_stats(&after);
+    failures += after.publishes != before.publishes;
+
+    offline_queue_poll((uint32_t)(esp_timer_get_time() / 1000));
+    strcpy(payload, "{\"seq\":4}");
+    network_mqtt_publish("telemetry", payload, strlen(payload), sizeof(payload), 0, 0);
+    mock_mqtt_get_stats(&after);
+    if (failures || after.publishes != before.publishes + 5 ||
+        strcmp(after.last_publish, DEVICE_TOPIC("telemetry")) != 0) {
+        printf("Offline queue: FAIL publish path (%u publishes, last \"%s\")\n",
+               (unsigned)(after.publishes - before.publishes), after.last_publish);
+        failures++;
+    }
+    esp_mqtt_event_t disconnected = { 0 };
+    mock_mqtt_emit(MQTT_EVENT_DISCONNECTED, &disconnected);
+    return failures;
+}
+
+int bench_offline_queue(void)
+{
+    offline_queue_stats_t st;
+    double push_ns;
+    double replay_rate;
+    int failures = 0;
+
+    // Starts from an empty spill area.
+    nvs_flash_erase();
+    if (nvs_flash_init() != ESP_OK) {
+        printf("Offline queue: FAIL NVS init\n");
+        return 1;
+    }
+    failures += check_outage(&push_ns, &replay_rate, &st);
+    failures += check_reboot();
+    failures += check_jitter();
+    failures += check_publish_path();
+
+    printf("BENCH offline_queue queued=%u spilled=%u dropped=%u replayed=%u replay_msgs_per_s=%.1f push_ns=%.0f "
+           "ram_used_max=%u\n", (unsigned)st.queued, (unsigned)st.spilled, (unsigned)st.dropped,
+           (unsigned)st.replayed, replay_rate, push_ns, (unsigned)st.ram_used_max);
+    return failures;
+}
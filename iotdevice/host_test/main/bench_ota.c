@@ -0,0 +1,349 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "host_bench.h"
+#include "nvs_flash.h"
+#include "esp_partition.h"
+#include "mbedtls/sha256.h"
+#include "ota_update.h"
+#include "cbor_lite.h"
+#include "json_lite.h"
+
+#define BENCH_BASE_SIZE   (512 * 1024)
+#define BENCH_IMAGE_MAX   (BENCH_BASE_SIZE + 8192)
+#define BENCH_CHUNK       1024      // Data bytes per ota/chunk, as the backend sends them
+#define BENCH_RUNNING     "1.0.0"
+#define BENCH_VERSION     "1.1.0"
+
+/*
+ * The new image as edits of the running one: code that moved, new code,
+ * a padding region and a patch near the end. Gives both the image and
+ * the delta stream the backend would send for it.
+ */
+typedef struct {
+    uint8_t op;
+    uint32_t src;
+    uint32_t len;
+    uint8_t value;
+} bench_edit_t;
+
+static const bench_edit_t edits[] = {
+    { OTA_OP_COPY, 0, 100000, 0 },
+    { OTA_OP_INSERT, 0, 3000, 0 },
+    { OTA_OP_COPY, 100000, 200000, 0 },
+    { OTA_OP_FILL, 0, 20000, 0xff },
+    { OTA_OP_COPY, 320000, 150000, 0 },
+    { OTA_OP_INSERT, 0, 512, 0 },
+    { OTA_OP_COPY, 470512, BENCH_BASE_SIZE - 470512, 0 },
+};
+
+static uint8_t base[BENCH_BASE_SIZE];
+static uint8_t image[BENCH_IMAGE_MAX];
+static uint8_t delta[BENCH_IMAGE_MAX];
+static uint32_t image_len;
+static uint32_t delta_len;
+static char sha_hex[65];
+
+static const esp_partition_t *running;
+static const esp_partition_t *target;
+static ota_update_config_t config;
+
+static char progress_state[16];
+static uint32_t progress_offset;
+static uint32_t progress_reports;
+static char finished_version[OTA_UPDATE_VERSION_MAX_LEN + 1];
+static uint32_t finished;
+static uint32_t resumed;
+
+static uint32_t rand_state = 0x2545f491;
+
+static uint8_t next_byte(void)
+{
+    rand_state = rand_state * 1103515245u + 12345u;
+    return (uint8_t)(rand_state >> 16);
+}
+
+static int capture_progress(const char *subtopic, char *buf, size_t len, size_t buf_size)
+{
+    const char *state = NULL;
+    size_t state_len = 0;
+    int32_t offset = 0;
+
+    if (strcmp(subtopic, "ota/progress") != 0) {
+        return 1;
+    }
+    if (cbor_lite_is_cbor(buf, len)) {
+        cbor_lite_get_string(buf, len, "state", &state, &state_len);
+        cbor_lite_get_int(buf, len, "offset", &offset);
+    } else {
+        json_lite_get_string(buf, len, "state", &state, &state_len);
+        json_lite_get_int(buf, len, "offset", &offset);
+    }
+    if (state_len >= sizeof(progress_state)) {
+        state_len = 0;
+    }
+    memcpy(progress_state, state, state_len);
+    progress_state[state_len] = '\0';
+    progress_offset = (uint32_t)offset;
+    progress_reports++;
+    return 1;
+}
+
+// Stands in for esp_ota_set_boot_partition() and the restart.
+static esp_err_t record_finish(const esp_partition_t *partition, const char *version)
+{
+    snprintf(finished_version, sizeof(finished_version), "%s", version);
+    finished++;
+    return partition == target ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+static size_t put_varint(uint8_t *out, uint32_t v)
+{
+    size_t n = 0;
+    do {
+        out[n++] = (uint8_t)(v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+        v >>= 7;
+    } while (v);
+    return n;
+}
+
+static void build_images(void)
+{
+    uint8_t digest[32];
+
+    for (size_t i = 0; i < sizeof(base); i++) {
+        base[i] = next_byte();
+    }
+    image_len = 0;
+    delta_len = 0;
+    for (size_t i = 0; i < sizeof(edits) / sizeof(edits[0]); i++) {
+        const bench_edit_t *e = &edits[i];
+        delta[delta_len++] = e->op;
+        if (e->op == OTA_OP_COPY) {
+            delta_len += put_varint(delta + delta_len, e->src);
+        }
+        delta_len += put_varint(delta + delta_len, e->len);
+        if (e->op == OTA_OP_COPY) {
+            memcpy(image + image_len, base + e->src, e->len);
+        } else if (e->op == OTA_OP_FILL) {
+            delta[delta_len++] = e->value;
+            memset(image + image_len, e->value, e->len);
+        } else {
+            for (uint32_t j = 0; j < e->len; j++) {
+                image[image_len + j] = next_byte();
+            }
+            memcpy(delta + delta_len, image + image_len, e->len);
+            delta_len += e->len;
+        }
+        image_len += e->len;
+    }
+    mbedtls_sha256(image, image_len, digest, 0);
+    for (int i = 0; i < 32; i++) {
+        snprintf(sha_hex + 2 * i, 3, "%02x", digest[i]);
+    }
+}
+
+static esp_err_t begin(bool is_delta, const char *sha, const char *base_version)
+{
+    char payload[256];
+    int len = snprintf(payload, sizeof(payload),
+                       "{\"version\":\"" BENCH_VERSION "\",\"size\":%u,\"sha256\":\"%s\",\"format\":\"%s\","
+                       "\"stream\":%u,\"base\":\"%s\"}",
+                       (unsigned)image_len, sha, is_delta ? "delta" : "raw",
+                       (unsigned)(is_delta ? delta_len : image_len), base_version);
+    // The OTA task is not running, the bench runs the queue itself.
+    esp_err_t err = ota_update_begin_handler(payload, (size_t)len, NULL);
+    ota_update_process();
+    return err;
+}
+
+static esp_err_t send_chunk(const uint8_t *stream, uint32_t stream_len, uint32_t off)
+{
+    static uint8_t payload[BENCH_CHUNK + 32];
+    uint32_t n = stream_len - off < BENCH_CHUNK ? stream_len - off : BENCH_CHUNK;
+    cbor_lite_writer_t w;
+
+    cbor_lite_writer_init(&w, payload, sizeof(payload));
+    cbor_lite_put_map(&w, 2);
+    cbor_lite_put_cstr(&w, "off");
+    cbor_lite_put_uint(&w, off);
+    cbor_lite_put_cstr(&w, "data");
+    cbor_lite_put_byte_string(&w, stream + off, n);
+    esp_err_t err = ota_update_chunk_handler((const char *)payload, w.len, NULL);
+    ota_update_process();
+    return err;
+}
+
+// Sends [from, until) in chunks, as the backend streams from a reported offset.
+static int send_range(const uint8_t *stream, uint32_t stream_len, uint32_t from, uint32_t until)
+{
+    for (uint32_t off = from; off < until; off += BENCH_CHUNK) {
+        esp_err_t err = send_chunk(stream, stream_len, off);
+        if (err != ESP_OK) {
+            printf("OTA: FAIL chunk at %u: %s\n", (unsigned)off, esp_err_to_name(err));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int check_written(const char *what)
+{
+    static uint8_t sector[OTA_UPDATE_SECTOR_SIZE];
+    for (uint32_t off = 0; off < image_len; off += sizeof(sector)) {
+        uint32_t n = image_len - off < sizeof(sector) ? image_len - off : sizeof(sector);
+        if (esp_partition_read(target, off, sector, n) != ESP_OK || memcmp(sector, image + off, n) != 0) {
+            printf("OTA: FAIL %s image differs in the sector at %u\n", what, (unsigned)off);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * One update; with interrupt_at the device "reboots" there (RAM state is
+ * gone, ota_update_init() runs again) and the backend begins again and
+ * sends from the offset the device reports. Returns failed checks.
+ */
+static int run_update(bool is_delta, uint32_t interrupt_at, uint64_t *ns, uint32_t *resent)
+{
+    const uint8_t *stream = is_delta ? delta : image;
+    uint32_t stream_len = is_delta ? delta_len : image_len;
+    const char *what = is_delta ? "delta" : "raw";
+    uint32_t finished_before = finished;
+    uint32_t from = 0;
+    int failures = 0;
+
+    uint64_t t0 = bench_now_ns();
+    if (begin(is_delta, sha_hex, BENCH_RUNNING) != ESP_OK || progress_offset != 0) {
+        printf("OTA: FAIL %s begin, offset %u\n", what, (unsigned)progress_offset);
+        return 1;
+    }
+    if (interrupt_at) {
+        interrupt_at -= interrupt_at % BENCH_CHUNK;
+        failures += send_range(stream, stream_len, 0, interrupt_at);
+        ota_update_init(&config, record_finish, capture_progress);
+        if (begin(is_delta, sha_hex, BENCH_RUNNING) != ESP_OK || progress_offset == 0 || progress_offset > interrupt_at) {
+            printf("OTA: FAIL %s resume offset %u after %u bytes\n", what, (unsigned)progress_offset,
+                   (unsigned)interrupt_at);
+            return failures + 1;
+        }
+        from = progress_offset;
+        *resent = interrupt_at - from;
+        resumed++;
+    }
+    failures += send_range(stream, stream_len, from, stream_len);
+    *ns = bench_now_ns() - t0;
+
+    if (finished != finished_before + 1 || strcmp(progress_state, "done") != 0 ||
+        strcmp(finished_version, BENCH_VERSION) != 0) {
+        printf("OTA: FAIL %s update ended in state %s\n", what, progress_state);
+        return failures + 1;
+    }
+    return failures + check_written(what);
+}
+
+// Redelivery, a lost chunk, a bad digest and a delta on the wrong base.
+static int check_rejects(void)
+{
+    int failures = 0;
+    ota_update_stats_t st;
+
+    begin(false, sha_hex, BENCH_RUNNING);
+    send_chunk(image, image_len, 0);
+    send_chunk(image, image_len, 0);
+    send_chunk(image, image_len, 2 * BENCH_CHUNK);
+    ota_update_get_stats(&st);
+    if (st.duplicates != 1 || st.gaps != 1 || strcmp(progress_state, "resend") != 0 || progress_offset != BENCH_CHUNK) {
+        printf("OTA: FAIL duplicates=%u gaps=%u state=%s offset=%u\n", (unsigned)st.duplicates, (unsigned)st.gaps,
+               progress_state, (unsigned)progress_offset);
+        failures++;
+    }
+    // The handlers only queue; nothing is reported before the queue runs.
+    uint32_t reports = progress_reports;
+    ota_update_abort_handler("", 0, NULL);
+    if (progress_reports != reports || ota_update_process() != 1) {
+        printf("OTA: FAIL abort ran on the handler's task\n");
+        failures++;
+    }
+    uint32_t sectors = st.sectors;
+    send_chunk(image, image_len, BENCH_CHUNK);
+    ota_update_get_stats(&st);
+    if (strcmp(progress_state, "aborted") != 0 || st.sectors != sectors || st.active) {
+        printf("OTA: FAIL abort, state %s\n", progress_state);
+        failures++;
+    }
+
+    uint32_t finished_before = finished;
+    begin(false, "00000000000000000000000000000000000000000000000000000000000000ff", BENCH_RUNNING);
+    for (uint32_t off = 0; off < image_len; off += BENCH_CHUNK) {
+        send_chunk(image, image_len, off);
+    }
+    if (finished != finished_before || strcmp(progress_state, "failed") != 0) {
+        printf("OTA: FAIL image with a bad digest ended in state %s\n", progress_state);
+        failures++;
+    }
+
+    if (begin(true, sha_hex, "0.9.0") != ESP_ERR_INVALID_VERSION) {
+        printf("OTA: FAIL delta on another base accepted\n");
+        failures++;
+    }
+    return failures;
+}
+
+int bench_ota(void)
+{
+    ota_update_stats_t st;
+    uint64_t raw_ns = 0;
+    uint64_t delta_ns = 0;
+    uint64_t resume_ns = 0;
+    uint32_t raw_resent = 0;
+    uint32_t delta_resent = 0;
+    int failures = 0;
+
+    nvs_flash_init();
+    running = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, NULL);
+    target = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, NULL);
+    if (running == NULL || target == NULL) {
+        printf("OTA: FAIL no ota_0/ota_1 partitions in the emulated flash\n");
+        return 1;
+    }
+    build_images();
+    // The running firmware, the source of COPY ops.
+    if (esp_partition_erase_range(running, 0, BENCH_BASE_SIZE) != ESP_OK ||
+        esp_partition_write(running, 0, base, BENCH_BASE_SIZE) != ESP_OK) {
+        printf("OTA: FAIL writing the running image\n");
+        return 1;
+    }
+
+    ota_update_config_t cfg = OTA_UPDATE_CONFIG_DEFAULT();
+    cfg.target = target;
+    cfg.running = running;
+    cfg.running_version = BENCH_RUNNING;
+    config = cfg;
+    if (ota_update_init(&config, record_finish, capture_progress) != ESP_OK) {
+        printf("OTA: FAIL init\n");
+        return 1;
+    }
+
+    failures += run_update(false, 0, &raw_ns, &raw_resent);
+    failures += run_update(true, 0, &delta_ns, &delta_resent);
+    // Interrupted in the middle of a chunk's worth of COPY ops and of a raw stream.
+    failures += run_update(true, delta_len * 3 / 5, &resume_ns, &delta_resent);
+    failures += run_update(false, image_len * 3 / 5, &resume_ns, &raw_resent);
+    if (raw_resent > config.checkpoint_bytes + BENCH_CHUNK) {
+        printf("OTA: FAIL resume sent %u bytes again\n", (unsigned)raw_resent);
+        failures++;
+    }
+    ota_update_get_stats(&st);
+    failures += check_rejects();
+
+    // mb_s counts image bytes written, sectors erased and the digest check.
+    printf("BENCH ota image_kb=%u chunk=%u raw_mb_s=%.1f delta_mb_s=%.1f delta_stream_kb=%u delta_ratio=%.3f "
+           "raw_chunk_us=%.1f checkpoints=%u resumes=%u raw_resent_kb=%.1f delta_resent_b=%u\n",
+           (unsigned)(image_len / 1024), BENCH_CHUNK, image_len / (raw_ns / 1e3), image_len / (delta_ns / 1e3),
+           (unsigned)(delta_len / 1024), (double)delta_len / image_len,
+           raw_ns / 1e3 / ((image_len + BENCH_CHUNK - 1) / BENCH_CHUNK), (unsigned)st.checkpoints,
+           (unsigned)resumed, raw_resent / 1024.0, (unsigned)delta_resent);
+    return failures;
+}
@@ -0,0 +1,288 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "host_bench.h"
+#include "host_mocks.h"
+#include "nvs_flash.h"
+#include "rule_engine.h"
+#include "telemetry.h"
+#include "actuator_hal.h"
+#include "device_crypto.h"
+#include "led_control.h"
+
+#define BENCH_ITERATIONS  200000
+#define BENCH_REACTIONS   20000
+#define BENCH_CRYPTO_RUNS 2000
+
+/*
+ * Compiled by the backend (src/tests/rules.bench.ts) from:
+ *   0 fan_on     payload.temperature > 28                           -> fan 100
+ *   1 fan_off    payload.temperature <= 26                          -> fan 0
+ *   2 humid_led  payload.humidity > 70 && payload.temperature > 24  -> led 1
+ *   3 dry_led    !(payload.humidity > 60) || payload.ledState === 0 -> led 0
+ */
+#define BENCH_PROGRAM_ID 28839
+#define BENCH_PROGRAM_HEX                                                                                    \
+    "48520100a7700000030204000b74656d70657261747572650868756d6964697479086c656453746174650366616e036c6564" \
+    "08000200010000e0411001006408000200010000d04113010000110002010100008c42100200010000c04110200101011200" \
+    "020101000070421022020201000000001421010100"
+
+static float temperature;
+static float humidity;
+static bool humidity_ok;
+static uint8_t led_channel;
+static uint8_t fan_channel;
+static uint32_t actions;
+static uint64_t step_start_ns;
+static uint64_t reaction_ns_total;
+static uint32_t reports;
+static uint32_t reported_firings;
+static char last_report[256];
+
+static bool read_temperature(void *ctx, float *value)
+{
+    *value = temperature;
+    return true;
+}
+
+static bool read_humidity(void *ctx, float *value)
+{
+    *value = humidity;
+    return humidity_ok;
+}
+
+static bool read_led(void *ctx, float *value)
+{
+    *value = actuator_hal_get(led_channel);
+    return true;
+}
+
+// Straight to the HAL: the firmware queues to the actuator task instead.
+static esp_err_t bench_action(uint8_t channel, uint8_t level)
+{
+    actions++;
+    reaction_ns_total += bench_now_ns() - step_start_ns;
+    return actuator_hal_set(channel, level);
+}
+
+static int capture_report(const char *subtopic, char *buf, size_t len, size_t buf_size)
+{
+    if (strcmp(subtopic, "rules/fired") != 0) {
+        return 0; // Telemetry batches
+    }
+    snprintf(last_report, sizeof(last_report), "%.*s", (int)len, buf);
+    const char *p = strstr(last_report, "\"fired\":[");
+    while (p && (p = strchr(p + sizeof("\"fired\":[") - 1, '[')) != NULL) {
+        reported_firings++;
+    }
+    return (int)++reports;
+}
+
+static esp_err_t load_hex(const char *hex)
+{
+    return rule_engine_load_hex(hex, strlen(hex), true);
+}
+
+static int setup(void)
+{
+    const telemetry_config_t telemetry_cfg = { .sample_period_ms = 1000, .flush_interval_ms = 60000, .high_water = 32 };
+    const rule_engine_config_t rules_cfg = { .report_interval_ms = 1000, .encoding = TELEMETRY_ENCODING_JSON };
+    const actuator_channel_config_t led = { .name = "led", .type = ACTUATOR_CHANNEL_DIGITAL, .gpio = 2 };
+    const actuator_channel_config_t fan = { .name = "fan", .type = ACTUATOR_CHANNEL_PWM, .gpio = 4 };
+    int failures = 0;
+
+    failures += actuator_hal_init(&mock_actuator_backend) != ESP_OK;
+    failures += actuator_hal_add_channel(&led, &led_channel) != ESP_OK;
+    failures += actuator_hal_add_channel(&fan, &fan_channel) != ESP_OK;
+    failures += telemetry_init(&telemetry_cfg, capture_report) != ESP_OK;
+    failures += telemetry_register_source("temperature", read_temperature, NULL, 0.5f) != ESP_OK;
+    failures += telemetry_register_source("humidity", read_humidity, NULL, 1.0f) != ESP_OK;
+    failures += telemetry_register_source("ledState", read_led, NULL, 0.0f) != ESP_OK;
+    failures += rule_engine_init(&rules_cfg, bench_action, capture_report) != ESP_OK;
+    if (failures) {
+        printf("Rules: FAIL setup\n");
+    }
+    return failures;
+}
+
+// A rejected program keeps the running one.
+static int check_rejects(void)
+{
+    static const uint8_t underflow[] = { 'H', 'R', 1, 0, 1, 0, 0, 0, 0, 0, 1, 0, 1, 0, RULE_OP_GT, 0 };
+    char hex[sizeof(BENCH_PROGRAM_HEX)];
+    rule_engine_stats_t st;
+    int failures = 0;
+
+    failures += rule_engine_load(underflow, sizeof(underflow), false) != ESP_ERR_INVALID_ARG;
+    strcpy(hex, BENCH_PROGRAM_HEX);
+    hex[0] = '5';
+    failures += load_hex(hex) != ESP_ERR_INVALID_VERSION;
+    strcpy(hex, BENCH_PROGRAM_HEX);
+    hex[strlen(hex) - 2] = '\0';
+    failures += load_hex(hex) != ESP_ERR_INVALID_ARG; // Truncated
+    strcpy(hex, BENCH_PROGRAM_HEX);
+    memcpy(strstr(hex, "74656d70"), "5865", 4);  // "Xemperature"
+    failures += load_hex(hex) != ESP_ERR_NOT_FOUND;
+    strcpy(hex, BENCH_PROGRAM_HEX);
+    hex[1] = 'x';
+    failures += load_hex(hex) != ESP_ERR_INVALID_ARG; // Not hex
+
+    rule_engine_get_stats(&st);
+    if (failures || st.program_id != BENCH_PROGRAM_ID || st.load_errors != 5) {
+        printf("Rules: FAIL rejects (%d wrong results, program %u, %u load errors)\n", failures,
+               (unsigned)st.program_id, (unsigned)st.load_errors);
+        failures++;
+    }
+    return failures;
+}
+
+typedef struct {
+    float temperature;
+    float humidity;
+    bool humidity_ok;
+    uint8_t fan;        // Expected outputs after the step
+    uint8_t led;
+    uint32_t fired;     // Expected firings so far
+} rule_step_t;
+
+// Edge triggered: a rule fires once when its condition turns true.
+static const rule_step_t steps[] = {
+    { 25.0f, 50.0f, true,    0, 0, 2 },    // fan_off, dry_led
+    { 29.0f, 50.0f, true,  100, 0, 3 },    // fan_on
+    { 29.5f, 50.0f, true,  100, 0, 3 },    // Still hot, no second firing
+    { 26.0f, 75.0f, true,    0, 1, 5 },    // fan_off, humid_led
+    { 26.0f, 75.0f, false,   0, 1, 5 },    // Humidity not read: unknown, nothing fires
+    { 26.0f, 50.0f, true,    0, 0, 6 },    // dry_led
+};
+
+static int check_steps(uint32_t *now_ms)
+{
+    rule_engine_stats_t st;
+    int failures = 0;
+
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        temperature = steps[i].temperature;
+        humidity = steps[i].humidity;
+        humidity_ok = steps[i].humidity_ok;
+        telemetry_poll(*now_ms += 1000);
+        rule_engine_get_stats(&st);
+        if (actuator_hal_get(fan_channel) != steps[i].fan || actuator_hal_get(led_channel) != steps[i].led ||
+            st.fired != steps[i].fired) {
+            printf("Rules: FAIL step %u (fan %u led %u fired %u)\n", (unsigned)i, actuator_hal_get(fan_channel),
+                   actuator_hal_get(led_channel), (unsigned)st.fired);
+            failures++;
+        }
+    }
+    if (reported_firings != st.fired || strncmp(last_report, "{\"program\":28839,", 17) != 0) {
+        printf("Rules: FAIL reports (%u of %u firings, last %s)\n", (unsigned)reported_firings, (unsigned)st.fired,
+               last_report);
+        failures++;
+    }
+    return failures;
+}
+
+// The stored program runs again after a reboot.
+static int check_reboot(void)
+{
+    rule_engine_stats_t st;
+    const rule_engine_config_t rules_cfg = { .report_interval_ms = 1000, .encoding = TELEMETRY_ENCODING_JSON };
+
+    rule_engine_init(&rules_cfg, bench_action, capture_report);
+    rule_engine_get_stats(&st);
+    if (st.program_id != BENCH_PROGRAM_ID || st.rules != 4) {
+        printf("Rules: FAIL program not kept across reboot (program %u, %u rules)\n", (unsigned)st.program_id,
+               (unsigned)st.rules);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * What the same reaction costs the device on the server path: encrypt the
+ * telemetry, then decrypt and parse the command coming back. Broker hops
+ * and the backend (src/tests/rules.bench.ts) come on top.
+ */
+static double server_path_device_ns(void)
+{
+    device_crypto_t ctx = { 0 };
+    char buf[DEVICE_CRYPTO_FRAME_SIZE(96)];
+    size_t frame_len;
+    size_t plain_len;
+    bool state;
+
+    device_crypto_init(&ctx, CONFIG_DEVICE_AES_KEY, strlen(CONFIG_DEVICE_AES_KEY));
+    uint64_t total = 0;
+    for (int i = 0; i < BENCH_CRYPTO_RUNS; i++) {
+        uint64_t t0 = bench_now_ns();
+        int len = snprintf(buf, sizeof(buf), "{\"temperature\":29.5,\"humidity\":50,\"ledState\":0}");
+        device_crypto_encrypt_in_place(&ctx, buf, (size_t)len, sizeof(buf), &frame_len);
+        total += bench_now_ns() - t0;
+
+        len = snprintf(buf, sizeof(buf), "{\"state\":true}");
+        device_crypto_encrypt_in_place(&ctx, buf, (size_t)len, sizeof(buf), &frame_len); // Plays the backend
+        t0 = bench_now_ns();
+        device_crypto_decrypt_in_place(&ctx, buf, frame_len, &plain_len);
+        led_parse_command(buf, plain_len, &state);
+        total += bench_now_ns() - t0;
+    }
+    device_crypto_free(&ctx);
+    return (double)total / BENCH_CRYPTO_RUNS;
+}
+
+int bench_rules(void)
+{
+    rule_engine_stats_t st;
+    uint32_t now_ms = 0;
+    int failures;
+
+    nvs_flash_init();
+    failures = setup();
+    if (failures) {
+        return failures;
+    }
+    if (load_hex(BENCH_PROGRAM_HEX) != ESP_OK) {
+        printf("Rules: FAIL loading the backend program\n");
+        return 1;
+    }
+    failures += check_rejects();
+    failures += check_steps(&now_ms);
+    failures += check_reboot();
+
+    // Evaluation alone, nothing fires: the cost every telemetry step pays.
+    const float quiet[] = { 27.0f, 65.0f, 0.0f };
+    rule_engine_evaluate(quiet, 3, now_ms);
+    uint64_t t0 = bench_now_ns();
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+        rule_engine_evaluate(quiet, 3, now_ms);
+    }
+    double eval_ns = (double)(bench_now_ns() - t0) / BENCH_ITERATIONS;
+
+    // Sample to output: every step crosses a threshold and moves the fan.
+    humidity_ok = true;
+    humidity = 65.0f;
+    uint32_t actions_before = actions;
+    uint64_t step_ns_total = 0;
+    reaction_ns_total = 0;
+    for (uint32_t i = 0; i < BENCH_REACTIONS; i++) {
+        temperature = (i & 1) ? 25.0f : 30.0f;
+        step_start_ns = bench_now_ns();
+        telemetry_poll(now_ms += 1000);
+        step_ns_total += bench_now_ns() - step_start_ns;
+    }
+    double reaction_ns = (double)reaction_ns_total / BENCH_REACTIONS;
+    if (actions - actions_before != BENCH_REACTIONS) {
+        printf("Rules: FAIL %u actions for %u reactions\n", (unsigned)(actions - actions_before), BENCH_REACTIONS);
+        failures++;
+    }
+    rule_engine_get_stats(&st);
+    telemetry_set_observer(NULL);
+
+    // reaction_ns: sampling step start to the output change; step_ns adds the firing report.
+    printf("BENCH rules rules=%u program_bytes=%u eval_ns=%.1f eval_ns_per_rule=%.1f reaction_ns=%.0f step_ns=%.0f "
+           "server_path_device_ns=%.0f reports=%u report_dropped=%u\n", (unsigned)st.rules,
+           (unsigned)(sizeof(BENCH_PROGRAM_HEX) - 1) / 2, eval_ns, eval_ns / st.rules, reaction_ns,
+           (double)step_ns_total / BENCH_REACTIONS, server_path_device_ns(), (unsigned)reports,
+           (unsigned)st.report_dropped);
+    return failures;
+}
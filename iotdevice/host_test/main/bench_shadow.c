@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "host_bench.h"
+#include "host_mocks.h"
+#include "actuator_hal.h"
+#include "command_ack.h"
+#include "device_shadow.h"
+#include "json_lite.h"
+
+#define BENCH_BURST        100
+#define BENCH_SEQUENCED    8
+#define BENCH_ITERATIONS   100000
+#define BENCH_FAN_PWM      0
+
+static const actuator_channel_config_t led_config = {
+    .name = "led",
+    .type = ACTUATOR_CHANNEL_DIGITAL,
+    .gpio = 2,
+};
+
+static const actuator_channel_config_t fan_config = {
+    .name = "fan",
+    .type = ACTUATOR_CHANNEL_PWM,
+    .gpio = 4,
+    .pwm_channel = BENCH_FAN_PWM,
+};
+
+static uint8_t led_id;
+static uint8_t fan_id;
+
+static char status_payload[DEVICE_SHADOW_PAYLOAD_MAX + 1];
+static size_t status_len;
+static uint32_t status_publishes;
+static bool status_refuse;
+
+static uint32_t schedules;
+static uint32_t last_delay_ms;
+
+static uint32_t ack_publishes;
+
+static int capture_status(const char *subtopic, char *buf, size_t len, size_t buf_size)
+{
+    if (status_refuse || strcmp(subtopic, "status") != 0 || len > DEVICE_SHADOW_PAYLOAD_MAX) {
+        return -1;
+    }
+    memcpy(status_payload, buf, len);
+    status_payload[len] = '\0';
+    status_len = len;
+    status_publishes++;
+    return 0;
+}
+
+static esp_err_t count_schedule(uint32_t delay_ms)
+{
+    schedules++;
+    last_delay_ms = delay_ms;
+    return ESP_OK;
+}
+
+static int count_acks(const char *subtopic, char *buf, size_t len, size_t buf_size)
+{
+    ack_publishes++;
+    return 0;
+}
+
+static bool status_is(const char *expected)
+{
+    return status_len == strlen(expected) && memcmp(status_payload, expected, status_len) == 0;
+}
+
+static esp_err_t desire(uint8_t channel, uint8_t level)
+{
+    actuator_state_t state = { 0 };
+    actuator_state_set(&state, channel, level);
+    return device_shadow_desire(&state);
+}
+
+static int setup(void)
+{
+    device_shadow_config_t shadow_cfg = DEVICE_SHADOW_CONFIG_DEFAULT();
+    command_ack_config_t ack_cfg = COMMAND_ACK_CONFIG_DEFAULT();
+
+    shadow_cfg.encoding = TELEMETRY_ENCODING_JSON;
+    ack_cfg.encoding = TELEMETRY_ENCODING_JSON;
+    if (actuator_hal_init(&mock_actuator_backend) != ESP_OK ||
+        actuator_hal_add_channel(&led_config, &led_id) != ESP_OK ||
+        actuator_hal_add_channel(&fan_config, &fan_id) != ESP_OK ||
+        device_shadow_init(&shadow_cfg, count_schedule, capture_status) != ESP_OK ||
+        command_ack_init(&ack_cfg, count_acks) != ESP_OK) {
+        printf("Shadow: FAIL setup\n");
+        return 1;
+    }
+    return 0;
+}
+
+// A burst of commands is applied once, with the last level, and acked after the apply.
+static int check_burst(uint32_t *digital_writes)
+{
+    mock_actuator_stats_t before;
+    mock_actuator_stats_t after;
+    command_ack_stats_t acks_before;
+    command_ack_stats_t acks_after;
+    int failures = 0;
+
+    command_ack_get_stats(&acks_before);
+    mock_actuator_get_stats(&before);
+    schedules = 0;
+    for (uint32_t i = 0; i < BENCH_BURST; i++) {
+        // The last BENCH_SEQUENCED carry a sequence number, as from the backend.
+        bool sequenced = i >= BENCH_BURST - BENCH_SEQUENCED;
+        if (sequenced) {
+            command_ack_begin(i + 1, 0);
+        }
+        failures += desire(led_id, (i & 1) ^ 1) != ESP_OK;
+        if (sequenced) {
+            command_ack_end(ESP_OK);
+        }
+    }
+    size_t early_acks = command_ack_flush();
+    device_shadow_apply();
+    size_t acks = command_ack_flush();
+    mock_actuator_get_stats(&after);
+    command_ack_get_stats(&acks_after);
+    *digital_writes = after.digital_writes - before.digital_writes;
+
+    // BENCH_BURST is even, so the last command turned the LED off: nothing to write.
+    if (failures || schedules != 1 || early_acks != 0 || acks != BENCH_SEQUENCED ||
+        acks_after.acked - acks_before.acked != BENCH_SEQUENCED || *digital_writes != 0 ||
+        actuator_hal_get(led_id) != 0 || status_publishes != 1) {
+        printf("Shadow: FAIL burst (%d failed, %u scheduled, %u+%u acks, %u writes, %u published)\n", failures,
+               (unsigned)schedules, (unsigned)early_acks, (unsigned)acks, (unsigned)*digital_writes,
+               (unsigned)status_publishes);
+        return 1;
+    }
+
+    // Ending on the odd count turns it on, with one write.
+    mock_actuator_get_stats(&before);
+    for (uint32_t i = 0; i <= BENCH_BURST; i++) {
+        desire(led_id, i & 1 ? 0 : 1);
+    }
+    device_shadow_apply();
+    mock_actuator_get_stats(&after);
+    *digital_writes = after.digital_writes - before.digital_writes;
+    if (*digital_writes != 1 || actuator_hal_get(led_id) != 1) {
+        printf("Shadow: FAIL burst on, %u writes\n", (unsigned)*digital_writes);
+        return 1;
+    }
+    return 0;
+}
+
+static int check_deltas(void)
+{
+    int failures = 0;
+
+    // Only the changed channel, one version up; the LED went on in check_burst().
+    if (!status_is("{\"version\":2,\"reported\":{\"led\":1}}")) {
+        printf("Shadow: FAIL delta %s\n", status_payload);
+        failures++;
+    }
+    // Asking for the level a channel has publishes nothing.
+    uint32_t published = status_publishes;
+    desire(led_id, 1);
+    device_shadow_apply();
+    if (status_publishes != published) {
+        printf("Shadow: FAIL unchanged level published %s\n", status_payload);
+        failures++;
+    }
+    // PWM levels are clamped by the HAL; what was set is what is reported.
+    desire(fan_id, 40);
+    device_shadow_apply();
+    if (!status_is("{\"version\":3,\"reported\":{\"fan\":40}}")) {
+        printf("Shadow: FAIL fan delta %s\n", status_payload);
+        failures++;
+    }
+    // A refused publish goes out with the next change.
+    status_refuse = true;
+    desire(led_id, 0);
+    device_shadow_apply();
+    status_refuse = false;
+    desire(fan_id, 60);
+    device_shadow_apply();
+    if (!status_is("{\"version\":4,\"reported\":{\"led\":0,\"fan\":60}}")) {
+        printf("Shadow: FAIL delta after a refused publish %s\n", status_payload);
+        failures++;
+    }
+    // shadow/get gets every channel, published by the apply it schedules.
+    uint32_t before = status_publishes;
+    schedules = 0;
+    device_shadow_get_handler("{}", 2, NULL);
+    if (status_publishes != before || schedules != 1) {
+        printf("Shadow: FAIL snapshot published on the handler's task\n");
+        failures++;
+    }
+    device_shadow_apply();
+    if (!status_is("{\"version\":5,\"full\":true,\"reported\":{\"led\":0,\"fan\":60}}")) {
+        printf("Shadow: FAIL snapshot %s\n", status_payload);
+        failures++;
+    }
+    return failures;
+}
+
+// Within the window after an apply the next one waits for the rest of it.
+static int check_window(void)
+{
+    schedules = 0;
+    desire(fan_id, 10);
+    device_shadow_apply();
+    desire(fan_id, 20);
+    uint32_t delay_ms = last_delay_ms;
+    device_shadow_apply();
+    if (DEVICE_SHADOW_COALESCE_MS > 0 && (schedules != 2 || delay_ms == 0 || delay_ms > DEVICE_SHADOW_COALESCE_MS)) {
+        printf("Shadow: FAIL window, %u scheduled, delay %u ms\n", (unsigned)schedules, (unsigned)delay_ms);
+        return 1;
+    }
+    return 0;
+}
+
+// Past DEVICE_SHADOW_MAX_PENDING waiting sequenced commands the next one is refused and acked.
+static int check_refused(void)
+{
+    device_shadow_stats_t stats;
+    int failures = 0;
+
+    command_ack_flush();
+    for (uint32_t i = 0; i <= DEVICE_SHADOW_MAX_PENDING; i++) {
+        command_ack_begin(1000 + i, 0);
+        esp_err_t err = desire(led_id, i & 1);
+        command_ack_end(err);
+        failures += err != (i < DEVICE_SHADOW_MAX_PENDING ? ESP_OK : ESP_ERR_NO_MEM);
+    }
+    size_t refused_acks = command_ack_flush();
+    device_shadow_apply();
+    size_t acks = command_ack_flush();
+    device_shadow_get_stats(&stats);
+    if (failures || stats.refused != 1 || refused_acks != 1 || acks != DEVICE_SHADOW_MAX_PENDING) {
+        printf("Shadow: FAIL refusal (%d failed, %u refused, %u+%u acks)\n", failures, (unsigned)stats.refused,
+               (unsigned)refused_acks, (unsigned)acks);
+        return 1;
+    }
+    return 0;
+}
+
+int bench_shadow(void)
+{
+    device_shadow_stats_t stats;
+    uint32_t burst_writes = 0;
+    int failures = setup();
+
+    if (failures) {
+        return failures;
+    }
+    // Nothing changed since boot, the first message is the full snapshot.
+    device_shadow_publish(false);
+    if (!status_is("{\"version\":1,\"full\":true,\"reported\":{\"led\":0,\"fan\":0}}")) {
+        printf("Shadow: FAIL boot snapshot %s\n", status_payload);
+        failures++;
+    }
+    failures += check_burst(&burst_writes);
+    failures += check_deltas();
+    failures += check_window();
+    failures += check_refused();
+
+    // Cost of recording a command that joins a scheduled apply.
+    desire(fan_id, 0);
+    uint64_t t0 = bench_now_ns();
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+        desire(fan_id, (uint8_t)(i % ACTUATOR_LEVEL_MAX));
+    }
+    uint64_t desire_ns = bench_now_ns() - t0;
+    t0 = bench_now_ns();
+    device_shadow_apply();
+    uint64_t apply_ns = bench_now_ns() - t0;
+    device_shadow_get_stats(&stats);
+
+    printf("BENCH shadow burst=%u schedules_per_burst=1 writes_per_burst=%u desire_ns=%.1f apply_ns=%llu "
+           "status_bytes=%u commands=%u coalesced=%u published=%u version=%u\n",
+           BENCH_BURST + 1, (unsigned)burst_writes, (double)desire_ns / BENCH_ITERATIONS,
+           (unsigned long long)apply_ns, (unsigned)status_len, (unsigned)stats.commands, (unsigned)stats.coalesced,
+           (unsigned)stats.published, (unsigned)stats.version);
+    return failures;
+}
@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "host_bench.h"
+#include "host_mocks.h"
+#include "network_mqtt_handler.h"
+#include "command_router.h"
+#include "command_ack.h"
+#include "actuator_hal.h"
+#include "led_control.h"
+#include "telemetry.h"
+#include "device_metrics.h"
+#include "offline_queue.h"
+#include "device_crypto.h"
+#include "esp_timer.h"
+
+#define BENCH_WARMUP_ROUNDS   2
+#define BENCH_ITERATIONS      10000
+#define BENCH_OUTAGE_EVERY    250       // Iterations between broker outages
+#define BENCH_STEP_MS         100       // Simulated time per iteration
+#define BENCH_FRAME_MAX       256
+
+#define COMMAND_TOPIC(name) "home/devices/" CONFIG_ESP_MQTT_DEVICE_ID "/command/" name
+
+static const actuator_channel_config_t bench_led = {
+    .name = "led",
+    .type = ACTUATOR_CHANNEL_DIGITAL,
+    .gpio = GPIO_NUM_2,
+};
+
+static uint8_t led_id;
+static uint32_t seq = 1;
+static uint32_t now_ms;
+static uint32_t actuations;
+
+static char rx_topic[MOCK_MQTT_TOPIC_MAX_LEN];
+static char rx_buffer[BENCH_FRAME_MAX];
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+static device_crypto_t backend_crypto;  // The backend side, set up once
+#endif
+
+static int device_publish(const char *subtopic, char *buf, size_t len, size_t buf_size)
+{
+    return network_mqtt_publish(subtopic, buf, len, buf_size, 0, 0);
+}
+
+// What the actuator task does with a setLed command, inline on the MQTT task.
+static esp_err_t bench_led_handler(const char *data, size_t data_len, void *ctx)
+{
+    bool state;
+    esp_err_t err = led_parse_command(data, data_len, &state);
+    if (err != ESP_OK) {
+        return err;
+    }
+    command_ack_token_t ack = command_ack_take();
+    err = actuator_hal_set(led_id, state ? 1 : 0);
+    command_ack_complete(ack, err);
+    actuations++;
+    return err;
+}
+
+static bool read_led(void *ctx, float *value)
+{
+    *value = actuator_hal_get(led_id);
+    return true;
+}
+
+// Delivers one sequenced command as the backend sends it.
+static int send_command(bool state)
+{
+    size_t topic_len = sizeof(COMMAND_TOPIC("setLed")) - 1;
+    size_t frame_len = (size_t)snprintf(rx_buffer, sizeof(rx_buffer), "{\"state\":%s,\"seq\":%u}",
+                                        state ? "true" : "false", (unsigned)seq++);
+
+    memcpy(rx_topic, COMMAND_TOPIC("setLed"), topic_len);
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+    if (device_crypto_encrypt_in_place(&backend_crypto, rx_buffer, frame_len, sizeof(rx_buffer), &frame_len) !=
+        ESP_OK) {
+        return 1;
+    }
+#endif
+    esp_mqtt_event_t event = {
+        .topic = rx_topic,
+        .topic_len = (int)topic_len,
+        .data = rx_buffer,
+        .data_len = (int)frame_len,
+        .total_data_len = (int)frame_len,
+    };
+    mock_mqtt_emit(MQTT_EVENT_DATA, &event);
+    return 0;
+}
+
+/*
+ * One pass of the steady-state loop: a command is received, dispatched,
+ * actuated and acked, telemetry and metrics go out. Every
+ * BENCH_OUTAGE_EVERY passes the broker goes away while publishing (the
+ * offline queue takes over), comes back with a new IP address and the
+ * queue is replayed.
+ */
+static int run_iteration(uint32_t i)
+{
+    int failures = send_command(i & 1);
+
+    command_ack_flush();
+    now_ms += BENCH_STEP_MS;
+    telemetry_poll(now_ms);
+    device_metrics_poll(now_ms);
+
+    if (i % BENCH_OUTAGE_EVERY == BENCH_OUTAGE_EVERY - 1) {
+        esp_mqtt_event_t disconnected = { 0 };
+        mock_mqtt_emit(MQTT_EVENT_DISCONNECTED, &disconnected);
+        failures += send_command(true);
+        command_ack_flush();
+        telemetry_flush(now_ms);
+        network_mqtt_app_start();
+        esp_mqtt_event_t connected = { 0 };
+        mock_mqtt_emit(MQTT_EVENT_CONNECTED, &connected);
+        offline_queue_poll((uint32_t)(esp_timer_get_time() / 1000));
+        failures += !offline_queue_is_empty();
+    }
+    return failures;
+}
+
+static int setup(void)
+{
+    telemetry_config_t telemetry_cfg = TELEMETRY_CONFIG_DEFAULT();
+    device_metrics_config_t metrics_cfg = DEVICE_METRICS_CONFIG_DEFAULT();
+    command_ack_config_t ack_cfg = COMMAND_ACK_CONFIG_DEFAULT();
+    offline_queue_config_t queue_cfg = OFFLINE_QUEUE_CONFIG_DEFAULT();
+    esp_err_t err;
+
+    // Replay right after reconnecting, all of an outage in one step.
+    queue_cfg.replay_jitter_ms = 0;
+    queue_cfg.replay_batch = 16;
+    telemetry_cfg.sample_period_ms = BENCH_STEP_MS;
+    telemetry_cfg.flush_interval_ms = 8 * BENCH_STEP_MS;
+    metrics_cfg.period_ms = 16 * BENCH_STEP_MS;
+
+    err = actuator_hal_init(&mock_actuator_backend);
+    if (err == ESP_OK) {
+        err = actuator_hal_add_channel(&bench_led, &led_id);
+    }
+    if (err == ESP_OK) {
+        err = command_router_init(CONFIG_ESP_MQTT_DEVICE_ID);
+    }
+    if (err == ESP_OK) {
+        err = command_router_register("setLed", bench_led_handler, NULL);
+    }
+    if (err == ESP_OK) {
+        err = command_ack_init(&ack_cfg, device_publish);
+    }
+    if (err == ESP_OK) {
+        err = telemetry_init(&telemetry_cfg, device_publish);
+    }
+    if (err == ESP_OK) {
+        err = telemetry_register_source("ledState", read_led, NULL, 0.0f);
+    }
+    if (err == ESP_OK) {
+        err = device_metrics_init(&metrics_cfg, NULL, device_publish);
+    }
+    if (err == ESP_OK) {
+        err = offline_queue_init(&queue_cfg, network_mqtt_send);
+    }
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+    if (err == ESP_OK) {
+        err = device_crypto_init(&backend_crypto, CONFIG_DEVICE_AES_KEY, strlen(CONFIG_DEVICE_AES_KEY));
+    }
+#endif
+    if (err != ESP_OK) {
+        printf("Steady state: FAIL setup: %s\n", esp_err_to_name(err));
+        return 1;
+    }
+    network_mqtt_app_start();
+    esp_mqtt_event_t connected = { .session_present = 1 };
+    mock_mqtt_emit(MQTT_EVENT_CONNECTED, &connected);
+    return 0;
+}
+
+// The client gets the Kconfig buffer sizes and outbox limit.
+static int check_client_config(const mock_mqtt_stats_t *mqtt)
+{
+    if (mqtt->rx_buffer_size != CONFIG_NETWORK_MQTT_RX_BUFFER_SIZE ||
+        mqtt->tx_buffer_size != CONFIG_NETWORK_MQTT_TX_BUFFER_SIZE ||
+        mqtt->task_stack_size != CONFIG_NETWORK_MQTT_TASK_STACK_SIZE ||
+        mqtt->outbox_limit != CONFIG_NETWORK_MQTT_OUTBOX_LIMIT) {
+        printf("Steady state: FAIL client config (rx %d, tx %d, stack %d, outbox %u)\n", mqtt->rx_buffer_size,
+               mqtt->tx_buffer_size, mqtt->task_stack_size, (unsigned)mqtt->outbox_limit);
+        return 1;
+    }
+    return 0;
+}
+
+int bench_steady_state(void)
+{
+    mock_heap_stats_t heap_before;
+    mock_heap_stats_t heap_after;
+    mock_mqtt_stats_t mqtt_before;
+    mock_mqtt_stats_t mqtt_after;
+    command_ack_stats_t acks;
+    int failures = 0;
+
+    if (setup()) {
+        return 1;
+    }
+    // Lazily set up state (stdio buffers, first outage, first snapshot) is not steady state.
+    for (uint32_t i = 0; i < BENCH_WARMUP_ROUNDS * BENCH_OUTAGE_EVERY; i++) {
+        failures += run_iteration(i);
+    }
+
+    actuations = 0;
+    mock_mqtt_get_stats(&mqtt_before);
+    mock_heap_get_stats(&heap_before);
+    uint64_t t0 = bench_now_ns();
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+        failures += run_iteration(i);
+    }
+    uint64_t elapsed_ns = bench_now_ns() - t0;
+    mock_heap_get_stats(&heap_after);
+    mock_mqtt_get_stats(&mqtt_after);
+    command_ack_get_stats(&acks);
+
+    uint64_t allocs = heap_after.allocs - heap_before.allocs;
+    uint32_t outages = BENCH_ITERATIONS / BENCH_OUTAGE_EVERY;
+    if (failures) {
+        printf("Steady state: FAIL %d commands not delivered or queues not drained\n", failures);
+    }
+    if (allocs != 0 || heap_after.live_bytes != heap_before.live_bytes) {
+        printf("Steady state: FAIL %u heap allocations, %lld bytes held\n", (unsigned)allocs,
+               (long long)(heap_after.live_bytes - heap_before.live_bytes));
+        failures++;
+    }
+    if (mqtt_after.created != 1 || actuations != BENCH_ITERATIONS + outages ||
+        acks.acked != acks.sequenced || acks.dropped != 0) {
+        printf("Steady state: FAIL %u clients created, %u of %u commands actuated, %u of %u acked\n",
+               (unsigned)mqtt_after.created, (unsigned)actuations, (unsigned)(BENCH_ITERATIONS + outages),
+               (unsigned)acks.acked, (unsigned)acks.sequenced);
+        failures++;
+    }
+    failures += check_client_config(&mqtt_after);
+
+    printf("BENCH steady_state iterations=%u outages=%u iteration_ns=%.0f publishes_per_iteration=%.2f "
+           "allocs=%u clients_created=%u rx_buffer=%d tx_buffer=%d outbox_limit=%u\n",
+           (unsigned)BENCH_ITERATIONS, (unsigned)outages, (double)elapsed_ns / BENCH_ITERATIONS,
+           (double)(mqtt_after.publishes - mqtt_before.publishes) / BENCH_ITERATIONS, (unsigned)allocs,
+           (unsigned)mqtt_after.created, mqtt_after.rx_buffer_size, mqtt_after.tx_buffer_size,
+           (unsigned)mqtt_after.outbox_limit);
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+    device_crypto_free(&backend_crypto);
+#endif
+    return failures;
+}
@@ -0,0 +1,162 @@
+#include <malloc.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "host_bench.h"
+#include "telemetry.h"
+
+#define SIM_DURATION_MS (60u * 60u * 1000u) // One simulated hour
+
+typedef struct {
+    const char *name;
+    telemetry_config_t config;
+} telemetry_scenario_t;
+
+// Per sample publishing is the baseline the batched configurations are compared with.
+static const telemetry_scenario_t scenarios[] = {
+    { "per_sample", { .sample_period_ms = 1000, .flush_interval_ms = 1000, .high_water = 1 } },
+    { "batch_10s", { .sample_period_ms = 1000, .flush_interval_ms = 10000, .high_water = 48 } },
+    { "batch_30s", { .sample_period_ms = 1000, .flush_interval_ms = 30000, .high_water = 48 } },
+    { "batch_60s", { .sample_period_ms = 1000, .flush_interval_ms = 60000, .high_water = CONFIG_TELEMETRY_RING_SIZE } },
+    { "batch_30s_cbor", { .sample_period_ms = 1000, .flush_interval_ms = 30000, .high_water = 48,
+                          .encoding = TELEMETRY_ENCODING_CBOR } },
+};
+
+static uint32_t sim_now_ms;
+static uint32_t publish_count;
+static uint64_t publish_bytes;
+static size_t heap_peak;
+static int malformed;
+static char last_payload[CONFIG_TELEMETRY_PAYLOAD_MAX + 1];
+
+static size_t heap_in_use(void)
+{
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks;
+}
+
+static int mock_publish(const char *subtopic, char *buf, size_t len, size_t buf_size)
+{
+    size_t heap = heap_in_use();
+    if (heap > heap_peak) {
+        heap_peak = heap;
+    }
+    bool json_ok = len > 0 && buf[0] == '{' && buf[len - 1] == '}';
+    // CBOR batches are a map closed by the break code of the samples array.
+    bool cbor_ok = len > 0 && ((uint8_t)buf[0] & 0xe0) == 0xa0 && (uint8_t)buf[len - 1] == 0xff;
+    if (strcmp(subtopic, "telemetry") != 0 || !(json_ok || cbor_ok)) {
+        malformed++;
+    }
+    size_t n = len < sizeof(last_payload) - 1 ? len : sizeof(last_payload) - 1;
+    memcpy(last_payload, buf, n);
+    last_payload[n] = '\0';
+    publish_count++;
+    publish_bytes += len;
+    return (int)publish_count;
+}
+
+// Temperature that moves by 0.1 every 30 s: mostly repeated values.
+static bool read_temperature(void *ctx, float *value)
+{
+    *value = 21.0f + 0.1f * (float)((sim_now_ms / 30000u) % 20u);
+    return true;
+}
+
+// Uptime changes every sample and is never merged.
+static bool read_uptime(void *ctx, float *value)
+{
+    *value = (float)(sim_now_ms / 1000u);
+    return true;
+}
+
+// Door contact that toggles every 10 minutes.
+static bool read_door(void *ctx, float *value)
+{
+    *value = (float)((sim_now_ms / 600000u) & 1u);
+    return true;
+}
+
+// Noisy signal, only changes beyond the 2.0 deadband are reported.
+static bool read_rssi(void *ctx, float *value)
+{
+    *value = -60.0f + (float)((sim_now_ms / 1000u * 7u) % 5u);
+    return true;
+}
+
+// Failed sensor that reports NaN, then an overflowing one.
+static bool read_broken(void *ctx, float *value)
+{
+    *value = sim_now_ms < 2000u ? NAN : INFINITY;
+    return true;
+}
+
+// JSON has no NaN or Infinity, they must go out as null.
+static int check_non_finite(void)
+{
+    const telemetry_config_t config = { .sample_period_ms = 1000, .flush_interval_ms = 60000, .high_water = 48 };
+
+    malformed = 0;
+    last_payload[0] = '\0';
+    telemetry_init(&config, mock_publish);
+    telemetry_register_source("temperature", read_temperature, NULL, 0.0f);
+    telemetry_register_source("broken", read_broken, NULL, 0.0f);
+    for (sim_now_ms = 0; sim_now_ms < 4000u; sim_now_ms += config.sample_period_ms) {
+        telemetry_poll(sim_now_ms);
+    }
+    telemetry_flush(sim_now_ms);
+    if (malformed || strstr(last_payload, "\"broken\":null,") == NULL || strstr(last_payload, "[1,0,null]") == NULL ||
+        strstr(last_payload, "[1,3000,null]") == NULL || strstr(last_payload, "nan") || strstr(last_payload, "inf")) {
+        printf("Telemetry: FAIL non-finite values: %s\n", last_payload);
+        return 1;
+    }
+    return 0;
+}
+
+int bench_telemetry(void)
+{
+    int failures = check_non_finite();
+
+    for (size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++) {
+        const telemetry_scenario_t *sc = &scenarios[s];
+        telemetry_stats_t stats;
+
+        publish_count = 0;
+        publish_bytes = 0;
+        malformed = 0;
+        if (telemetry_init(&sc->config, mock_publish) != ESP_OK) {
+            printf("Telemetry: FAIL init %s\n", sc->name);
+            failures++;
+            continue;
+        }
+        telemetry_register_source("temperature", read_temperature, NULL, 0.0f);
+        telemetry_register_source("uptime", read_uptime, NULL, 0.0f);
+        telemetry_register_source("door", read_door, NULL, 0.0f);
+        telemetry_register_source("rssi", read_rssi, NULL, 2.0f);
+
+        size_t heap_before = heap_in_use();
+        heap_peak = heap_before;
+        uint64_t t0 = bench_now_ns();
+        for (sim_now_ms = 0; sim_now_ms < SIM_DURATION_MS; sim_now_ms += sc->config.sample_period_ms) {
+            telemetry_poll(sim_now_ms);
+        }
+        telemetry_flush(sim_now_ms);
+        uint64_t elapsed_ns = bench_now_ns() - t0;
+        size_t heap_after = heap_in_use();
+
+        telemetry_get_stats(&stats);
+        if (malformed || heap_after != heap_before || stats.publish_failures) {
+            printf("Telemetry: FAIL %s (malformed %d, heap delta %d)\n", sc->name, malformed,
+                   (int)(heap_after - heap_before));
+            failures++;
+        }
+        printf("BENCH telemetry scenario=%s samples=%u merged=%u publishes_per_hour=%u bytes_per_hour=%llu "
+               "samples_per_publish=%.1f buffered_max=%u heap_delta=%d heap_peak_delta=%d cpu_us=%llu\n",
+               sc->name, (unsigned)stats.samples, (unsigned)stats.merged, (unsigned)publish_count,
+               (unsigned long long)publish_bytes,
+               publish_count ? (double)(stats.samples - stats.merged) / publish_count : 0.0,
+               (unsigned)stats.buffered_max, (int)(heap_after - heap_before), (int)(heap_peak - heap_before),
+               (unsigned long long)(elapsed_ns / 1000));
+    }
+    return failures;
+}
@@ -0,0 +1,164 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "host_bench.h"
+#include "host_mocks.h"
+#include "mqtt_tls.h"
+#include "network_mqtt_handler.h"
+
+#define BENCH_ROUNDS     20
+#define BENCH_TIMEOUT_MS 5000
+#define BENCH_CA_MAX     8192
+
+// Self-signed CA for the checks without a broker; its key is not kept anywhere.
+static const char bench_fixture_ca[] =
+    "-----BEGIN CERTIFICATE-----\n"
+    "MIIBmjCCAUGgAwIBAgIUeSZTWqdmA6eDScS2ifwV2s50kMswCgYIKoZIzj0EAwIw\n"
+    "IjEgMB4GA1UEAwwXSG9tZUNvbnRyb2xIdWIgYmVuY2ggQ0EwIBcNMjYxMDE2MTgw\n"
+    "NjEyWhgPMjEyNjA5MjIxODA2MTJaMCIxIDAeBgNVBAMMF0hvbWVDb250cm9sSHVi\n"
+    "IGJlbmNoIENBMFkwEwYHKoZIzj0CAQYIKoZIzj0DAQcDQgAEk5fn4YAWMa3AvqRe\n"
+    "U4tItUAW1pGzg9fnQ3AdiBbdgzB3gP6vkmZJZFgUxOTHOPb3YqlMFG3jJhF4HhCA\n"
+    "qlhKyKNTMFEwHQYDVR0OBBYEFDRzNFwOfKpRVVGrN5TuNN6FKLXXMB8GA1UdIwQY\n"
+    "MBaAFDRzNFwOfKpRVVGrN5TuNN6FKLXXMA8GA1UdEwEB/wQFMAMBAf8wCgYIKoZI\n"
+    "zj0EAwIDRwAwRAIgJUrWn5qKwhxgpcZsOBFfTZk/yd658i4Ng7zDDAz5qDoCIGIQ\n"
+    "JCIV+KO0jGogkjWkVkj6OMV0wevoElasgdBD/f74\n"
+    "-----END CERTIFICATE-----\n";
+
+static char ca_pem[BENCH_CA_MAX];
+
+// MQTT 3.1.1 CONNECT, clean session, 60 s keepalive, client ID "hch-tls-bench".
+static const char connect_packet[] = {
+    0x10, 25, 0, 4, 'M', 'Q', 'T', 'T', 4, 0x02, 0, 60,
+    0, 13, 'h', 'c', 'h', '-', 't', 'l', 's', '-', 'b', 'e', 'n', 'c', 'h',
+};
+
+static size_t load_ca(void)
+{
+    FILE *f = fopen(CONFIG_HOST_TEST_TLS_CA_FILE, "rb");
+    size_t len = 0;
+
+    if (f) {
+        len = fread(ca_pem, 1, sizeof(ca_pem) - 1, f);
+        fclose(f);
+    }
+    if (len == 0) {
+        len = sizeof(bench_fixture_ca) - 1;
+        memcpy(ca_pem, bench_fixture_ca, len);
+    }
+    ca_pem[len] = '\0';
+    return len + 1;
+}
+
+// A port nothing listens on: bound, then closed again.
+static int closed_port(void)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    getsockname(fd, (struct sockaddr *)&addr, &addr_len);
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+// Checks that need no broker: setup errors, the transport, the client options.
+static int check_setup(void)
+{
+    mock_mqtt_stats_t mqtt;
+    mqtt_tls_stats_t stats;
+    int failures = 0;
+
+    failures += mqtt_tls_connect("localhost", 8883, BENCH_TIMEOUT_MS) != ESP_ERR_INVALID_STATE;
+    mqtt_tls_config_t bad = { .ca_pem = "not a certificate", .ca_pem_len = 18 };
+    failures += mqtt_tls_init(&bad) != ESP_ERR_INVALID_ARG;
+
+    mqtt_tls_config_t config = { .ca_pem = ca_pem, .ca_pem_len = load_ca(), .persist_session = true };
+    if (mqtt_tls_init(&config) != ESP_OK || !mock_transport_is_complete(mqtt_tls_get_transport())) {
+        printf("TLS: FAIL init\n");
+        return failures + 1;
+    }
+    failures += mqtt_tls_init(&config) != ESP_ERR_INVALID_STATE;
+    failures += mqtt_tls_connect("127.0.0.1", closed_port(), BENCH_TIMEOUT_MS) != ESP_FAIL;
+    mqtt_tls_get_stats(&stats);
+    failures += stats.failures != 1 || stats.connects != 0;
+
+    network_mqtt_app_start();
+    mock_mqtt_get_stats(&mqtt);
+    failures += mqtt.keepalive_s != CONFIG_NETWORK_MQTT_KEEPALIVE_S;
+    if (failures) {
+        printf("TLS: FAIL %d setup checks\n", failures);
+    }
+    return failures;
+}
+
+// Connect, MQTT CONNECT to CONNACK, close; 0 on failure.
+static uint64_t reconnect_ns(const char *host, int port)
+{
+    char connack[4];
+    int got = 0;
+
+    uint64_t t0 = bench_now_ns();
+    if (mqtt_tls_connect(host, port, BENCH_TIMEOUT_MS) != ESP_OK) {
+        return 0;
+    }
+    bool ok = mqtt_tls_write(connect_packet, sizeof(connect_packet), BENCH_TIMEOUT_MS) == sizeof(connect_packet);
+    while (ok && got < (int)sizeof(connack)) {
+        int n = mqtt_tls_read(connack + got, sizeof(connack) - got, BENCH_TIMEOUT_MS);
+        ok = n > 0;
+        got += ok ? n : 0;
+    }
+    uint64_t elapsed = bench_now_ns() - t0;
+    mqtt_tls_close();
+    return ok && connack[0] == 0x20 && connack[3] == 0 ? elapsed : 0;
+}
+
+int bench_tls(void)
+{
+    mqtt_tls_stats_t before;
+    mqtt_tls_stats_t after;
+    uint64_t full_ns = 0;
+    uint64_t resumed_ns = 0;
+    int failures = check_setup();
+
+    char host[MQTT_TLS_HOST_MAX_LEN + 1] = CONFIG_HOST_TEST_TLS_BROKER;
+    char *colon = strrchr(host, ':');
+    if (failures || colon == NULL) {
+        printf("BENCH tls skipped=1 (%s)\n", failures       ? "setup checks failed"
+                                              : host[0] != '\0' ? "no port in CONFIG_HOST_TEST_TLS_BROKER"
+                                                                : "no broker configured");
+        return failures;
+    }
+    *colon = '\0';
+    int port = atoi(colon + 1);
+
+    // Full handshakes: the session is dropped before each connect.
+    mqtt_tls_get_stats(&before);
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        mqtt_tls_forget_session();
+        uint64_t ns = reconnect_ns(host, port);
+        failures += ns == 0;
+        full_ns += ns;
+    }
+    // Resumed: the session of the last full handshake is offered each time.
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        uint64_t ns = reconnect_ns(host, port);
+        failures += ns == 0;
+        resumed_ns += ns;
+    }
+    mqtt_tls_get_stats(&after);
+    uint32_t resumed = after.resumed - before.resumed;
+    if (failures || resumed != BENCH_ROUNDS) {
+        printf("TLS: FAIL %d reconnects failed, %u of %d resumed\n", failures, (unsigned)resumed, BENCH_ROUNDS);
+        failures += failures ? 0 : 1;
+    }
+
+    printf("BENCH tls skipped=0 rounds=%d full_ms=%.2f resumed_ms=%.2f resumed=%u session_saves=%u\n",
+           BENCH_ROUNDS, (double)full_ns / BENCH_ROUNDS / 1e6, (double)resumed_ns / BENCH_ROUNDS / 1e6,
+           (unsigned)resumed, (unsigned)(after.session_saves - before.session_saves));
+    return failures;
+}
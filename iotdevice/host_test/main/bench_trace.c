@@ -0,0 +1,122 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "host_bench.h"
+#include "trace_log.h"
+
+#define BENCH_ITERATIONS 200000
+#define BENCH_WRITER_THREADS 2
+#define BENCH_WRITES_PER_THREAD 100000
+
+static trace_record_t records[CONFIG_TRACE_LOG_SLOTS];
+static unsigned dump_chunks;
+
+static int print_chunk(const char *subtopic, char *buf, size_t len, size_t buf_size)
+{
+    // Hex, as a subscriber would save it, for tools/trace_decode.py in the pytest.
+    printf("Trace dump chunk: ");
+    for (size_t i = 0; i < len; i++) {
+        printf("%02x", (uint8_t)buf[i]);
+    }
+    printf("\n");
+    dump_chunks++;
+    return 0;
+}
+
+static void *writer_thread(void *arg)
+{
+    uint32_t thread_id = (uint32_t)(uintptr_t)arg;
+    for (uint32_t i = 0; i < BENCH_WRITES_PER_THREAD; i++) {
+        // Both words derive from i, a torn record would not match.
+        TRACE(MQTT_DATA, thread_id, i, ~i, i * 3u);
+    }
+    return NULL;
+}
+
+// Concurrent writers must never produce a record mixing two writes.
+static int check_concurrent_writers(uint64_t *elapsed_ns)
+{
+    pthread_t threads[BENCH_WRITER_THREADS];
+    uint32_t cursor = 0;
+    int torn = 0;
+
+    uint64_t t0 = bench_now_ns();
+    for (uintptr_t t = 0; t < BENCH_WRITER_THREADS; t++) {
+        pthread_create(&threads[t], NULL, writer_thread, (void *)t);
+    }
+    for (int t = 0; t < BENCH_WRITER_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    *elapsed_ns = bench_now_ns() - t0;
+
+    size_t n = trace_log_read(&cursor, records, CONFIG_TRACE_LOG_SLOTS);
+    for (size_t i = 0; i < n; i++) {
+        const trace_record_t *r = &records[i];
+        if (r->id != TRACE_ID_MQTT_DATA || r->nargs != 4 || r->args[2] != ~r->args[1] ||
+            r->args[3] != r->args[1] * 3u || (i > 0 && r->seq <= records[i - 1].seq)) {
+            torn++;
+        }
+    }
+    if (n == 0 || torn) {
+        printf("Trace: FAIL concurrent writers (%u records, %d torn)\n", (unsigned)n, torn);
+        return 1;
+    }
+    return 0;
+}
+
+int bench_trace(void)
+{
+    char line[128];
+    int failures = 0;
+    uint64_t t0;
+    uint64_t trace_ns;
+    uint64_t printf_ns;
+    uint64_t concurrent_ns;
+    volatile int sink = 0;
+
+    // Per message cost on the hot path: one binary record...
+    t0 = bench_now_ns();
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+        TRACE(MQTT_DATA, 42, i, 0, i);
+    }
+    trace_ns = bench_now_ns() - t0;
+
+    // ...against formatting the same line, before any UART time.
+    t0 = bench_now_ns();
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+        sink += snprintf(line, sizeof(line), "D (%u) NETWORK_MQTT: MQTT_EVENT_DATA topic=%.*s len=%u offset=%d total=%u",
+                         (unsigned)i, 42, "home/devices/esp32_led_controller_01/command/setLed", (unsigned)i, 0,
+                         (unsigned)i);
+    }
+    printf_ns = bench_now_ns() - t0;
+
+    failures += check_concurrent_writers(&concurrent_ns);
+
+    // Known tail for the decoder check in the pytest.
+    TRACE(MQTT_CONNECTED, 7);
+    TRACE(LED_COMMAND, 1);
+    TRACE(MQTT_ERROR, 1, 0x8001, 0, -1);
+
+    uint32_t cursor = 0;
+    size_t n = trace_log_read(&cursor, records, CONFIG_TRACE_LOG_SLOTS);
+    if (n == 0 || trace_log_format(&records[n - 1], line, sizeof(line)) <= 0 ||
+        strstr(line, "NET: MQTT error type=1 tls=0x8001 tls_stack=0x0 errno=-1") == NULL) {
+        printf("Trace: FAIL format \"%s\"\n", line);
+        failures++;
+    }
+
+    dump_chunks = 0;
+    if (trace_log_dump_request(print_chunk, false) != ESP_OK || trace_log_dump_process() == 0 || dump_chunks == 0) {
+        printf("Trace: FAIL dump\n");
+        failures++;
+    }
+    printf("Trace dump done: %u chunks\n", dump_chunks);
+
+    printf("BENCH trace trace_ns=%.1f snprintf_ns=%.1f concurrent_records_per_s=%.0f record_bytes=%u ring_bytes=%u\n",
+           (double)trace_ns / BENCH_ITERATIONS, (double)printf_ns / BENCH_ITERATIONS,
+           (double)BENCH_WRITER_THREADS * BENCH_WRITES_PER_THREAD / ((double)concurrent_ns / 1e9),
+           (unsigned)sizeof(trace_record_t), (unsigned)(CONFIG_TRACE_LOG_SLOTS * sizeof(trace_record_t)));
+    (void)sink;
+    return failures;
+}
@@ -0,0 +1,40 @@
+#ifndef HOST_BENCH_H
+#define HOST_BENCH_H
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief Monotonic clock in nanoseconds for the host benchmarks.
+ */
+static inline uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Benchmarks and interoperability checks, one per module.
+ *
+ * Each prints "BENCH <name> key=value ..." lines and returns the number of
+ * failed checks.
+ */
+int bench_crypto(void);
+int bench_telemetry(void);
+int bench_codec(void);
+int bench_trace(void);
+int bench_event_path(void);
+int bench_offline_queue(void);
+int bench_actuator(void);
+int bench_rules(void);
+int bench_groups(void);
+int bench_metrics(void);
+int bench_command_ack(void);
+int bench_steady_state(void);
+int bench_ota(void);
+int bench_lan(void);
+int bench_shadow(void);
+int bench_tls(void);
+
+#endif // HOST_BENCH_H
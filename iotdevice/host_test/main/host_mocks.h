@@ -0,0 +1,114 @@
+#ifndef HOST_MOCKS_H
+#define HOST_MOCKS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "mqtt_client.h"
+#include "driver/gpio.h"
+#include "actuator_hal.h"
+
+#define MOCK_MQTT_TOPIC_MAX_LEN 128
+
+/**
+ * @brief What the firmware asked of the mocked MQTT client.
+ */
+typedef struct {
+    uint32_t created;           // esp_mqtt_client_init() calls
+    bool persistent_session;    // Last client was configured with clean session off
+    bool auto_reconnect;        // Last client was left to reconnect by itself
+    int keepalive_s;            // MQTT keepalive of the last client, 0 for the esp-mqtt default
+    esp_transport_handle_t transport; // Custom transport of the last client, NULL for esp-mqtt's own
+    int rx_buffer_size;         // Buffer sizes of the last client, 0 for the esp-mqtt default
+    int tx_buffer_size;
+    int task_stack_size;
+    uint64_t outbox_limit;      // 0 for no limit
+    uint32_t started;           // esp_mqtt_client_start() calls
+    uint32_t reconnects;        // esp_mqtt_client_reconnect() calls
+    uint32_t subscribes;        // SUBSCRIBE packets (esp_mqtt_client_subscribe_*() calls)
+    uint32_t subscribe_filters; // Topic filters in those packets
+    uint32_t subscribe_qos0;    // Filters among them subscribed at QoS 0
+    uint32_t unsubscribes;      // esp_mqtt_client_unsubscribe() calls
+    uint32_t publishes;         // esp_mqtt_client_publish() calls
+    char last_subscribe[MOCK_MQTT_TOPIC_MAX_LEN];   // Last filter subscribed
+    char last_unsubscribe[MOCK_MQTT_TOPIC_MAX_LEN];
+    char last_publish[MOCK_MQTT_TOPIC_MAX_LEN];
+    int last_publish_len;
+} mock_mqtt_stats_t;
+
+/**
+ * @brief Heap use of the statically linked code, counted through
+ *        -Wl,--wrap=malloc and friends (mock_heap.c).
+ */
+typedef struct {
+    uint64_t allocs;            // malloc, calloc and realloc calls
+    uint64_t frees;             // free calls with a non NULL pointer
+    int64_t live_bytes;         // Bytes currently allocated
+    int64_t peak_bytes;         // Highest live_bytes since the last reset
+} mock_heap_stats_t;
+
+#define MOCK_ACTUATOR_PWM_CHANNELS 8
+#define MOCK_ACTUATOR_MAX_DUTY 8191 // 13 bit, as CONFIG_ACTUATOR_PWM_RESOLUTION_BITS defaults
+
+/**
+ * @brief Output state behind mock_actuator_backend.
+ */
+typedef struct {
+    uint64_t outputs;           // Pins configured as outputs
+    uint64_t levels;            // Pin levels, bit per GPIO
+    uint32_t digital_writes;    // digital_write() calls
+    uint32_t pwm_fades;         // pwm_fade() calls
+    uint32_t duty[MOCK_ACTUATOR_PWM_CHANNELS];
+    uint32_t fade_ms[MOCK_ACTUATOR_PWM_CHANNELS];
+} mock_actuator_stats_t;
+
+/**
+ * @brief Actuator HAL backend that records outputs instead of driving pins.
+ */
+extern const actuator_backend_t mock_actuator_backend;
+
+/**
+ * @brief Copies the mocked output state.
+ */
+void mock_actuator_get_stats(mock_actuator_stats_t *out);
+
+/**
+ * @brief Runs the registered MQTT event handler, as the esp-mqtt event loop would.
+ *
+ * Sets event->client and event->event_id before the call.
+ *
+ * @param event_id Event to deliver.
+ * @param event Event data.
+ */
+void mock_mqtt_emit(esp_mqtt_event_id_t event_id, esp_mqtt_event_t *event);
+
+/**
+ * @brief Copies the MQTT client counters.
+ */
+void mock_mqtt_get_stats(mock_mqtt_stats_t *out);
+
+/**
+ * @brief Gets the number of gpio_set_level() calls on a pin.
+ */
+uint32_t mock_gpio_get_writes(gpio_num_t gpio_num);
+
+/**
+ * @brief Gets the number of writes to pins that were not configured as outputs.
+ */
+uint32_t mock_gpio_get_stray_writes(void);
+
+/**
+ * @brief Tells whether every callback and the default port of a transport are set.
+ */
+bool mock_transport_is_complete(esp_transport_handle_t t);
+
+/**
+ * @brief Copies the heap counters.
+ */
+void mock_heap_get_stats(mock_heap_stats_t *out);
+
+/**
+ * @brief Restarts peak tracking from the current live byte count.
+ */
+void mock_heap_reset_peak(void);
+
+#endif // HOST_MOCKS_H
@@ -0,0 +1,31 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host_bench.h"
+
+void app_main(void)
+{
+    int failures = 0;
+
+    printf("Host benchmarks starting\n");
+    failures += bench_crypto();
+    failures += bench_telemetry();
+    failures += bench_codec();
+    failures += bench_trace();
+    failures += bench_event_path();
+    failures += bench_offline_queue();
+    failures += bench_actuator();
+    failures += bench_rules();
+    failures += bench_groups();
+    failures += bench_metrics();
+    failures += bench_command_ack();
+    failures += bench_steady_state();
+    failures += bench_ota();
+    failures += bench_lan();
+    failures += bench_shadow();
+    failures += bench_tls();
+
+    printf("Host benchmarks done, %d failure(s)\n", failures);
+    fflush(stdout);
+    exit(failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
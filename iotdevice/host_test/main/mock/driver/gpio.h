@@ -0,0 +1,41 @@
+#ifndef MOCK_DRIVER_GPIO_H
+#define MOCK_DRIVER_GPIO_H
+
+/*
+ * Host stand-in for the GPIO driver API, see mock_gpio.c.
+ */
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#define MOCK_GPIO_NUM_MAX 40
+
+typedef enum {
+    GPIO_NUM_NC = -1,
+    GPIO_NUM_2 = 2,
+    GPIO_NUM_15 = 15,
+} gpio_num_t;
+
+typedef enum {
+    GPIO_INTR_DISABLE = 0,
+} gpio_int_type_t;
+
+typedef enum {
+    GPIO_MODE_DISABLE = 0,
+    GPIO_MODE_INPUT = 1,
+    GPIO_MODE_OUTPUT = 2,
+} gpio_mode_t;
+
+typedef struct {
+    uint64_t pin_bit_mask;
+    gpio_mode_t mode;
+    uint32_t pull_up_en;
+    uint32_t pull_down_en;
+    gpio_int_type_t intr_type;
+} gpio_config_t;
+
+esp_err_t gpio_config(const gpio_config_t *config);
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level);
+int gpio_get_level(gpio_num_t gpio_num);
+
+#endif // MOCK_DRIVER_GPIO_H
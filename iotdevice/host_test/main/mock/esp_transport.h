@@ -0,0 +1,35 @@
+#ifndef MOCK_ESP_TRANSPORT_H
+#define MOCK_ESP_TRANSPORT_H
+
+/*
+ * Host stand-in for the tcp_transport API, see mock_transport.c.
+ *
+ * Declares only what hal/mqtt_tls.c uses, with the tcp_transport names and
+ * signatures. The transport records its callbacks; the benchmarks drive
+ * mqtt_tls directly.
+ */
+
+#include "esp_err.h"
+
+typedef struct esp_transport_item_t *esp_transport_handle_t;
+
+typedef enum esp_tcp_transport_err_t {
+    ERR_TCP_TRANSPORT_NO_MEM = -3,
+    ERR_TCP_TRANSPORT_CONNECTION_FAILED = -2,
+    ERR_TCP_TRANSPORT_CONNECTION_CLOSED_BY_FIN = -1,
+    ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT = 0,
+} esp_tcp_transport_err_t;
+
+typedef int (*connect_func)(esp_transport_handle_t t, const char *host, int port, int timeout_ms);
+typedef int (*io_func)(esp_transport_handle_t t, const char *buffer, int len, int timeout_ms);
+typedef int (*io_read_func)(esp_transport_handle_t t, char *buffer, int len, int timeout_ms);
+typedef int (*trans_func)(esp_transport_handle_t t);
+typedef int (*poll_func)(esp_transport_handle_t t, int timeout_ms);
+
+esp_transport_handle_t esp_transport_init(void);
+esp_err_t esp_transport_set_func(esp_transport_handle_t t, connect_func _connect, io_read_func _read,
+                                 io_func _write, trans_func _close, poll_func _poll_read, poll_func _poll_write,
+                                 trans_func _destroy);
+esp_err_t esp_transport_set_default_port(esp_transport_handle_t t, int port);
+
+#endif // MOCK_ESP_TRANSPORT_H
@@ -0,0 +1,61 @@
+#include <string.h>
+
+#include "host_mocks.h"
+
+static mock_actuator_stats_t state;
+
+static esp_err_t mock_init(void)
+{
+    memset(&state, 0, sizeof(state));
+    return ESP_OK;
+}
+
+static esp_err_t mock_digital_config(uint64_t gpio_mask)
+{
+    if (gpio_mask >> MOCK_GPIO_NUM_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    state.outputs |= gpio_mask;
+    return ESP_OK;
+}
+
+// Same semantics as the W1TS/W1TC registers: bits not in either mask keep their level.
+static void mock_digital_write(uint64_t set_mask, uint64_t clear_mask)
+{
+    state.levels = (state.levels | set_mask) & ~clear_mask;
+    state.digital_writes++;
+}
+
+static esp_err_t mock_pwm_config(uint8_t pwm_channel, int gpio)
+{
+    if (pwm_channel >= MOCK_ACTUATOR_PWM_CHANNELS || gpio < 0 || gpio >= MOCK_GPIO_NUM_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    state.outputs |= 1ULL << gpio;
+    return ESP_OK;
+}
+
+static esp_err_t mock_pwm_fade(uint8_t pwm_channel, uint32_t duty, uint32_t fade_ms)
+{
+    if (pwm_channel >= MOCK_ACTUATOR_PWM_CHANNELS || duty > MOCK_ACTUATOR_MAX_DUTY) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    state.duty[pwm_channel] = duty;
+    state.fade_ms[pwm_channel] = fade_ms;
+    state.pwm_fades++;
+    return ESP_OK;
+}
+
+const actuator_backend_t mock_actuator_backend = {
+    .init = mock_init,
+    .digital_config = mock_digital_config,
+    .digital_write = mock_digital_write,
+    .pwm_config = mock_pwm_config,
+    .pwm_fade = mock_pwm_fade,
+    .pwm_max_duty = MOCK_ACTUATOR_MAX_DUTY,
+};
+
+void mock_actuator_get_stats(mock_actuator_stats_t *out)
+{
+    *out = state;
+}
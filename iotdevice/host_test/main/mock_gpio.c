@@ -0,0 +1,47 @@
+#include "host_mocks.h"
+
+static uint64_t output_mask;
+static uint8_t levels[MOCK_GPIO_NUM_MAX];
+static uint32_t writes[MOCK_GPIO_NUM_MAX];
+static uint32_t stray_writes;
+
+esp_err_t gpio_config(const gpio_config_t *config)
+{
+    if (config->pin_bit_mask >> MOCK_GPIO_NUM_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config->mode & GPIO_MODE_OUTPUT) {
+        output_mask |= config->pin_bit_mask;
+    } else {
+        output_mask &= ~config->pin_bit_mask;
+    }
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    if (gpio_num < 0 || gpio_num >= MOCK_GPIO_NUM_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!(output_mask & (1ULL << gpio_num))) {
+        stray_writes++;
+    }
+    levels[gpio_num] = level ? 1 : 0;
+    writes[gpio_num]++;
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    return gpio_num >= 0 && gpio_num < MOCK_GPIO_NUM_MAX ? levels[gpio_num] : 0;
+}
+
+uint32_t mock_gpio_get_writes(gpio_num_t gpio_num)
+{
+    return gpio_num >= 0 && gpio_num < MOCK_GPIO_NUM_MAX ? writes[gpio_num] : 0;
+}
+
+uint32_t mock_gpio_get_stray_writes(void)
+{
+    return stray_writes;
+}
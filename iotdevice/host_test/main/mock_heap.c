@@ -0,0 +1,79 @@
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "host_mocks.h"
+
+// Linked with -Wl,--wrap=<fn> (see CMakeLists.txt): calls from the firmware
+// modules and IDF components land here, allocations made inside shared
+// libraries (libc, libcrypto) are not counted.
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static _Atomic uint64_t allocs;
+static _Atomic uint64_t frees;
+static _Atomic int64_t live_bytes;
+static _Atomic int64_t peak_bytes;
+
+static void account(int64_t delta)
+{
+    int64_t live = atomic_fetch_add(&live_bytes, delta) + delta;
+    int64_t peak = atomic_load(&peak_bytes);
+    while (live > peak && !atomic_compare_exchange_weak(&peak_bytes, &peak, live)) {
+    }
+}
+
+void *__wrap_malloc(size_t size)
+{
+    void *ptr = __real_malloc(size);
+    if (ptr) {
+        atomic_fetch_add(&allocs, 1);
+        account((int64_t)malloc_usable_size(ptr));
+    }
+    return ptr;
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    void *ptr = __real_calloc(n, size);
+    if (ptr) {
+        atomic_fetch_add(&allocs, 1);
+        account((int64_t)malloc_usable_size(ptr));
+    }
+    return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    int64_t old_size = ptr ? (int64_t)malloc_usable_size(ptr) : 0;
+    void *new_ptr = __real_realloc(ptr, size);
+    if (new_ptr) {
+        atomic_fetch_add(&allocs, 1);
+        account((int64_t)malloc_usable_size(new_ptr) - old_size);
+    }
+    return new_ptr;
+}
+
+void __wrap_free(void *ptr)
+{
+    if (ptr) {
+        atomic_fetch_add(&frees, 1);
+        account(-(int64_t)malloc_usable_size(ptr));
+    }
+    __real_free(ptr);
+}
+
+void mock_heap_get_stats(mock_heap_stats_t *out)
+{
+    out->allocs = atomic_load(&allocs);
+    out->frees = atomic_load(&frees);
+    out->live_bytes = atomic_load(&live_bytes);
+    out->peak_bytes = atomic_load(&peak_bytes);
+}
+
+void mock_heap_reset_peak(void)
+{
+    atomic_store(&peak_bytes, atomic_load(&live_bytes));
+}
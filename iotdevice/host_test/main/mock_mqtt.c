@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "host_mocks.h"
+
+// One static client, enough for the firmware, and nothing is allocated.
+struct esp_mqtt_client {
+    const char *uri;
+    esp_event_handler_t handler;
+    void *handler_arg;
+    int next_msg_id;
+    mock_mqtt_stats_t stats;
+};
+
+static const char MOCK_MQTT_EVENTS[] = "MQTT_EVENTS";
+static struct esp_mqtt_client mock_client;
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+    mock_mqtt_stats_t stats = mock_client.stats;
+
+    memset(&mock_client, 0, sizeof(mock_client));
+    mock_client.uri = config->broker.address.uri;
+    mock_client.stats = stats;
+    mock_client.stats.created++;
+    mock_client.stats.persistent_session = config->session.disable_clean_session;
+    mock_client.stats.auto_reconnect = !config->network.disable_auto_reconnect;
+    mock_client.stats.keepalive_s = config->session.keepalive;
+    mock_client.stats.transport = config->network.transport;
+    mock_client.stats.rx_buffer_size = config->buffer.size;
+    mock_client.stats.tx_buffer_size = config->buffer.out_size;
+    mock_client.stats.task_stack_size = config->task.stack_size;
+    mock_client.stats.outbox_limit = config->outbox.limit;
+    return &mock_client;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+    client->stats.started++;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_reconnect(esp_mqtt_client_handle_t client)
+{
+    client->stats.reconnects++;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client)
+{
+    return ESP_OK;
+}
+
+int esp_mqtt_client_subscribe_multiple(esp_mqtt_client_handle_t client, const esp_mqtt_topic_t *topic_list, int size)
+{
+    client->stats.subscribes++;
+    client->stats.subscribe_filters += size;
+    for (int i = 0; i < size; i++) {
+        client->stats.subscribe_qos0 += topic_list[i].qos == 0;
+    }
+    snprintf(client->stats.last_subscribe, sizeof(client->stats.last_subscribe), "%s", topic_list[size - 1].filter);
+    return ++client->next_msg_id;
+}
+
+int esp_mqtt_client_subscribe_single(esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+    esp_mqtt_topic_t filter = { .filter = topic, .qos = qos };
+    return esp_mqtt_client_subscribe_multiple(client, &filter, 1);
+}
+
+int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t client, const char *topic)
+{
+    client->stats.unsubscribes++;
+    snprintf(client->stats.last_unsubscribe, sizeof(client->stats.last_unsubscribe), "%s", topic);
+    return ++client->next_msg_id;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len,
+                            int qos, int retain)
+{
+    client->stats.publishes++;
+    snprintf(client->stats.last_publish, sizeof(client->stats.last_publish), "%s", topic);
+    client->stats.last_publish_len = len;
+    return qos > 0 ? ++client->next_msg_id : 0;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                         esp_event_handler_t event_handler, void *event_handler_arg)
+{
+    client->handler = event_handler;
+    client->handler_arg = event_handler_arg;
+    return ESP_OK;
+}
+
+void mock_mqtt_emit(esp_mqtt_event_id_t event_id, esp_mqtt_event_t *event)
+{
+    event->client = &mock_client;
+    event->event_id = event_id;
+    if (mock_client.handler) {
+        mock_client.handler(mock_client.handler_arg, MOCK_MQTT_EVENTS, event_id, event);
+    }
+}
+
+void mock_mqtt_get_stats(mock_mqtt_stats_t *out)
+{
+    *out = mock_client.stats;
+}
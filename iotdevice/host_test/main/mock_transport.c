@@ -0,0 +1,47 @@
+#include <string.h>
+
+#include "host_mocks.h"
+
+// One static transport, enough for the firmware, and nothing is allocated.
+struct esp_transport_item_t {
+    connect_func connect;
+    io_read_func read;
+    io_func write;
+    trans_func close;
+    poll_func poll_read;
+    poll_func poll_write;
+    int default_port;
+};
+
+static struct esp_transport_item_t mock_transport;
+
+esp_transport_handle_t esp_transport_init(void)
+{
+    memset(&mock_transport, 0, sizeof(mock_transport));
+    return &mock_transport;
+}
+
+esp_err_t esp_transport_set_func(esp_transport_handle_t t, connect_func _connect, io_read_func _read,
+                                 io_func _write, trans_func _close, poll_func _poll_read, poll_func _poll_write,
+                                 trans_func _destroy)
+{
+    t->connect = _connect;
+    t->read = _read;
+    t->write = _write;
+    t->close = _close;
+    t->poll_read = _poll_read;
+    t->poll_write = _poll_write;
+    return ESP_OK;
+}
+
+esp_err_t esp_transport_set_default_port(esp_transport_handle_t t, int port)
+{
+    t->default_port = port;
+    return ESP_OK;
+}
+
+bool mock_transport_is_complete(esp_transport_handle_t t)
+{
+    return t && t->connect && t->read && t->write && t->close && t->poll_read && t->poll_write &&
+           t->default_port > 0;
+}
@@ -0,0 +1,125 @@
+import logging
+import os
+import shutil
+import subprocess
+import sys
+
+import pytest
+from pytest_embedded_idf.dut import IdfDut
+
+BENCH_DEVICE_KEY = '0123456789abcdef-device-key'
+
+# Same derivation and frame layout as EncryptionService.decrypt in src/code/services.ts.
+NODE_DECRYPT = r'''
+const crypto = require('crypto');
+const [iv, tag, ct] = process.argv[2].split(':');
+const key = crypto.createHash('sha256').update(process.argv[1]).digest();
+const d = crypto.createDecipheriv('aes-256-gcm', key, Buffer.from(iv, 'hex'));
+d.setAuthTag(Buffer.from(tag, 'hex'));
+process.stdout.write(d.update(ct, 'hex', 'utf8') + d.final('utf8'));
+'''
+
+
+TRACE_DECODE = os.path.join(os.path.dirname(__file__), '..', 'tools', 'trace_decode.py')
+
+
+def node_decrypt(frame: str) -> str:
+    return subprocess.check_output(['node', '-e', NODE_DECRYPT, BENCH_DEVICE_KEY, frame], text=True)
+
+
+def trace_decode(chunks: list) -> str:
+    return subprocess.check_output([sys.executable, TRACE_DECODE, '-'], input='\n'.join(chunks), text=True)
+
+
+@pytest.mark.linux
+@pytest.mark.host_test
+def test_host_benchmarks(dut: IdfDut) -> None:
+    frame = dut.expect(r'Crypto device frame: ([0-9a-f:]+)').group(1).decode('utf-8')
+    dut.expect_exact('Crypto interop: OK')
+    if shutil.which('node'):
+        assert node_decrypt(frame) == '{"state":true}'
+    else:
+        logging.warning('node not found, skipping device -> backend decrypt check')
+
+    for _ in range(5):
+        line = dut.expect(r'BENCH crypto (.*)\n').group(1).decode('utf-8')
+        logging.info('crypto %s', line.strip())
+
+    for _ in range(5):
+        line = dut.expect(r'BENCH telemetry (.*)\n').group(1).decode('utf-8')
+        logging.info('telemetry %s', line.strip())
+
+    cbor_hex = dut.expect(r'Codec device CBOR: ([0-9a-f]+)').group(1).decode('utf-8')
+    try:
+        import cbor2
+        batch = cbor2.loads(bytes.fromhex(cbor_hex))
+        assert batch['keys'] == ['ledState', 'freeHeap', 'rssi']
+        assert len(batch['samples']) == 22
+    except ImportError:
+        logging.warning('cbor2 not found, skipping device CBOR decode check')
+    for _ in range(4):
+        line = dut.expect(r'BENCH codec (.*)\n').group(1).decode('utf-8')
+        logging.info('codec %s', line.strip())
+
+    chunks = []
+    while True:
+        match = dut.expect(r'Trace dump (chunk: ([0-9a-f]+)|done: (\d+) chunks)')
+        if match.group(3):
+            break
+        chunks.append(match.group(2).decode('utf-8'))
+    decoded = trace_decode(chunks)
+    assert 'NET    MQTT error type=1 tls=0x8001 tls_stack=0x0 errno=-1' in decoded
+    assert 'APP    LED command state=1' in decoded
+    line = dut.expect(r'BENCH trace (.*)\n').group(1).decode('utf-8')
+    logging.info('trace %s', line.strip())
+
+    for stream in ('json', 'cbor', 'json_fragmented'):
+        line = dut.expect(r'BENCH event_path stream=%s (.*)\n' % stream).group(1).decode('utf-8')
+        logging.info('event_path %s %s', stream, line.strip())
+        assert 'allocs_per_msg=0.000' in line
+
+    line = dut.expect(r'BENCH offline_queue (.*)\n').group(1).decode('utf-8')
+    logging.info('offline_queue %s', line.strip())
+
+    line = dut.expect(r'BENCH actuator (.*)\n').group(1).decode('utf-8')
+    logging.info('actuator %s', line.strip())
+    assert 'digital_writes_per_scene=1.00' in line
+
+    line = dut.expect(r'BENCH rules (.*)\n').group(1).decode('utf-8')
+    logging.info('rules %s', line.strip())
+
+    line = dut.expect(r'BENCH groups (.*)\n').group(1).decode('utf-8')
+    logging.info('groups %s', line.strip())
+    assert 'digital_writes_per_scene=1.00' in line
+
+    line = dut.expect(r'BENCH metrics (.*)\n').group(1).decode('utf-8')
+    logging.info('metrics %s', line.strip())
+
+    line = dut.expect(r'BENCH command_ack (.*)\n').group(1).decode('utf-8')
+    logging.info('command_ack %s', line.strip())
+
+    line = dut.expect(r'BENCH steady_state (.*)\n').group(1).decode('utf-8')
+    logging.info('steady_state %s', line.strip())
+    assert 'allocs=0 clients_created=1' in line
+
+    line = dut.expect(r'BENCH ota (.*)\n').group(1).decode('utf-8')
+    logging.info('ota %s', line.strip())
+    assert 'resumes=2' in line
+
+    line = dut.expect(r'BENCH lan (.*)\n').group(1).decode('utf-8')
+    logging.info('lan %s', line.strip())
+
+    line = dut.expect(r'BENCH shadow (.*)\n').group(1).decode('utf-8')
+    logging.info('shadow %s', line.strip())
+    assert 'schedules_per_burst=1 writes_per_burst=1' in line
+
+    # Timed only with CONFIG_HOST_TEST_TLS_BROKER set, against the compose Mosquitto.
+    line = dut.expect(r'BENCH tls (.*)\n').group(1).decode('utf-8')
+    logging.info('tls %s', line.strip())
+    tls_skipped = 'skipped=1' in line
+    if not tls_skipped:
+        assert 'resumed=20' in line
+
+    dut.expect_exact('Host benchmarks done, 0 failure(s)')
+    if tls_skipped:
+        pytest.skip('TLS reconnects not timed: %s' % line.strip())
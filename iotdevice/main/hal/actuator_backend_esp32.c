@@ -0,0 +1,102 @@
+#include "actuator_hal.h"
+
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+#include "soc/soc.h"
+#include "soc/gpio_reg.h"
+#include "esp_log.h"
+
+#define ACT_PWM_MODE LEDC_LOW_SPEED_MODE
+#define ACT_PWM_TIMER LEDC_TIMER_0
+#define ACT_PWM_MAX_DUTY ((1u << CONFIG_ACTUATOR_PWM_RESOLUTION_BITS) - 1)
+
+static const char *TAG_ACT_ESP32 = "ACTUATOR_ESP32";
+
+static esp_err_t esp32_init(void)
+{
+    static bool fade_installed;
+    const ledc_timer_config_t timer_cfg = {
+        .speed_mode = ACT_PWM_MODE,
+        .duty_resolution = CONFIG_ACTUATOR_PWM_RESOLUTION_BITS,
+        .timer_num = ACT_PWM_TIMER,
+        .freq_hz = CONFIG_ACTUATOR_PWM_FREQ_HZ,
+        .clk_cfg = LEDC_AUTO_CLK,
+    };
+    esp_err_t err = ledc_timer_config(&timer_cfg);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_ACT_ESP32, "LEDC timer setup failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    // Fades run in hardware; the service only handles the end-of-fade interrupt.
+    if (!fade_installed) {
+        err = ledc_fade_func_install(0);
+        fade_installed = err == ESP_OK;
+    }
+    return err;
+}
+
+static esp_err_t esp32_digital_config(uint64_t gpio_mask)
+{
+    const gpio_config_t io_conf = {
+        .pin_bit_mask = gpio_mask,
+        .mode = GPIO_MODE_OUTPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+    return gpio_config(&io_conf);
+}
+
+// Write-1-to-set and write-1-to-clear registers: every pin of a bank changes
+// with one store and without a read-modify-write of the output register.
+static void esp32_digital_write(uint64_t set_mask, uint64_t clear_mask)
+{
+    if ((uint32_t)set_mask) {
+        REG_WRITE(GPIO_OUT_W1TS_REG, (uint32_t)set_mask);
+    }
+    if ((uint32_t)clear_mask) {
+        REG_WRITE(GPIO_OUT_W1TC_REG, (uint32_t)clear_mask);
+    }
+    // GPIO 32..39
+    if (set_mask >> 32) {
+        REG_WRITE(GPIO_OUT1_W1TS_REG, (uint32_t)(set_mask >> 32));
+    }
+    if (clear_mask >> 32) {
+        REG_WRITE(GPIO_OUT1_W1TC_REG, (uint32_t)(clear_mask >> 32));
+    }
+}
+
+static esp_err_t esp32_pwm_config(uint8_t pwm_channel, int gpio)
+{
+    const ledc_channel_config_t channel_cfg = {
+        .gpio_num = gpio,
+        .speed_mode = ACT_PWM_MODE,
+        .channel = (ledc_channel_t)pwm_channel,
+        .intr_type = LEDC_INTR_DISABLE,
+        .timer_sel = ACT_PWM_TIMER,
+        .duty = 0,
+        .hpoint = 0,
+    };
+    return ledc_channel_config(&channel_cfg);
+}
+
+static esp_err_t esp32_pwm_fade(uint8_t pwm_channel, uint32_t duty, uint32_t fade_ms)
+{
+    // A new duty cannot be set while the channel fades; stop the running
+    // fade so the latest command wins instead of queueing behind it.
+    ledc_fade_stop(ACT_PWM_MODE, (ledc_channel_t)pwm_channel);
+    if (fade_ms == 0) {
+        return ledc_set_duty_and_update(ACT_PWM_MODE, (ledc_channel_t)pwm_channel, duty, 0);
+    }
+    return ledc_set_fade_time_and_start(ACT_PWM_MODE, (ledc_channel_t)pwm_channel, duty, fade_ms,
+                                        LEDC_FADE_NO_WAIT);
+}
+
+const actuator_backend_t actuator_backend_esp32 = {
+    .init = esp32_init,
+    .digital_config = esp32_digital_config,
+    .digital_write = esp32_digital_write,
+    .pwm_config = esp32_pwm_config,
+    .pwm_fade = esp32_pwm_fade,
+    .pwm_max_duty = ACT_PWM_MAX_DUTY,
+};
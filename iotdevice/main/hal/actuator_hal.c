@@ -0,0 +1,223 @@
+#include "actuator_hal.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "json_lite.h"
+#include "cbor_lite.h"
+
+typedef struct {
+    char name[ACTUATOR_HAL_NAME_MAX_LEN + 1];
+    actuator_channel_type_t type;
+    uint8_t pwm_channel;
+    uint32_t fade_ms;
+    uint64_t gpio_bit;
+    bool active_low;
+} actuator_channel_t;
+
+static const char *TAG_ACT_HAL = "ACTUATOR_HAL";
+
+static const actuator_backend_t *backend;
+static actuator_channel_t channels[ACTUATOR_HAL_MAX_CHANNELS];
+static uint8_t channel_count;
+static uint64_t gpio_in_use;
+static uint8_t levels[ACTUATOR_HAL_MAX_CHANNELS];
+static actuator_hal_stats_t stats;
+
+esp_err_t actuator_hal_init(const actuator_backend_t *new_backend)
+{
+    if (new_backend == NULL || new_backend->init == NULL || new_backend->digital_config == NULL ||
+        new_backend->digital_write == NULL || new_backend->pwm_config == NULL || new_backend->pwm_fade == NULL ||
+        new_backend->pwm_max_duty == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = new_backend->init();
+    if (err != ESP_OK) {
+        return err;
+    }
+    backend = new_backend;
+    memset(channels, 0, sizeof(channels));
+    channel_count = 0;
+    gpio_in_use = 0;
+    memset(levels, 0, sizeof(levels));
+    memset(&stats, 0, sizeof(stats));
+    return ESP_OK;
+}
+
+esp_err_t actuator_hal_add_channel(const actuator_channel_config_t *config, uint8_t *id)
+{
+    esp_err_t err;
+
+    if (backend == NULL || config == NULL || config->name == NULL || config->name[0] == '\0' ||
+        strlen(config->name) > ACTUATOR_HAL_NAME_MAX_LEN || config->gpio < 0 || config->gpio >= 64 ||
+        (gpio_in_use & (1ULL << config->gpio)) || actuator_hal_find(config->name, strlen(config->name)) >= 0 ||
+        (config->type != ACTUATOR_CHANNEL_DIGITAL && config->type != ACTUATOR_CHANNEL_PWM)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (channel_count >= ACTUATOR_HAL_MAX_CHANNELS) {
+        return ESP_ERR_NO_MEM;
+    }
+    actuator_channel_t *ch = &channels[channel_count];
+    strcpy(ch->name, config->name);
+    ch->type = config->type;
+    ch->pwm_channel = config->pwm_channel;
+    ch->fade_ms = config->fade_ms;
+    ch->gpio_bit = 1ULL << config->gpio;
+    ch->active_low = config->active_low;
+
+    // Off before the pin turns into an output, so it does not glitch on.
+    if (ch->type == ACTUATOR_CHANNEL_DIGITAL) {
+        backend->digital_write(ch->active_low ? ch->gpio_bit : 0, ch->active_low ? 0 : ch->gpio_bit);
+        err = backend->digital_config(ch->gpio_bit);
+    } else {
+        err = backend->pwm_config(ch->pwm_channel, config->gpio);
+        if (err == ESP_OK) {
+            err = backend->pwm_fade(ch->pwm_channel, ch->active_low ? backend->pwm_max_duty : 0, 0);
+        }
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_ACT_HAL, "Failed to set up channel '%s' on GPIO %d: %s", config->name, config->gpio,
+                 esp_err_to_name(err));
+        return err;
+    }
+    gpio_in_use |= ch->gpio_bit;
+    levels[channel_count] = 0;
+    *id = channel_count++;
+    ESP_LOGI(TAG_ACT_HAL, "Channel %u '%s': %s on GPIO %d", *id, ch->name,
+             ch->type == ACTUATOR_CHANNEL_PWM ? "PWM" : "digital", config->gpio);
+    return ESP_OK;
+}
+
+int actuator_hal_find(const char *name, size_t name_len)
+{
+    for (uint8_t i = 0; i < channel_count; i++) {
+        if (strlen(channels[i].name) == name_len && memcmp(channels[i].name, name, name_len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+esp_err_t actuator_hal_apply(const actuator_state_t *state)
+{
+    uint64_t set_mask = 0;
+    uint64_t clear_mask = 0;
+    esp_err_t result = ESP_OK;
+
+    if (backend == NULL || (channel_count < 32 && (state->mask >> channel_count))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    stats.applies++;
+    for (uint8_t i = 0; i < channel_count; i++) {
+        if (!(state->mask & (1u << i))) {
+            continue;
+        }
+        actuator_channel_t *ch = &channels[i];
+        uint8_t level = state->level[i];
+        if (ch->type == ACTUATOR_CHANNEL_DIGITAL) {
+            level = level ? 1 : 0;
+        } else if (level > ACTUATOR_LEVEL_MAX) {
+            level = ACTUATOR_LEVEL_MAX;
+        }
+        if (level == levels[i]) {
+            stats.unchanged++;
+            continue;
+        }
+        if (ch->type == ACTUATOR_CHANNEL_DIGITAL) {
+            // Collected here, written below in one go.
+            if (level != ch->active_low) {
+                set_mask |= ch->gpio_bit;
+            } else {
+                clear_mask |= ch->gpio_bit;
+            }
+            levels[i] = level;
+            continue;
+        }
+        uint32_t duty = (uint32_t)((uint64_t)backend->pwm_max_duty * level / ACTUATOR_LEVEL_MAX);
+        esp_err_t err = backend->pwm_fade(ch->pwm_channel, ch->active_low ? backend->pwm_max_duty - duty : duty,
+                                          ch->fade_ms);
+        stats.pwm_fades++;
+        if (err != ESP_OK) {
+            if (result == ESP_OK) {
+                result = err;
+            }
+            continue;
+        }
+        levels[i] = level;
+    }
+    if (set_mask | clear_mask) {
+        backend->digital_write(set_mask, clear_mask);
+        stats.digital_writes++;
+    }
+    return result;
+}
+
+esp_err_t actuator_hal_set(uint8_t id, uint8_t level)
+{
+    actuator_state_t state = { 0 };
+
+    if (id >= ACTUATOR_HAL_MAX_CHANNELS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    actuator_state_set(&state, id, level);
+    return actuator_hal_apply(&state);
+}
+
+// Looks up one channel of a scene: a number is a level, a boolean full level or off.
+static esp_err_t parse_level(const char *data, size_t data_len, bool cbor, const char *name, uint8_t *level)
+{
+    int32_t value;
+    bool on;
+    esp_err_t err = cbor ? cbor_lite_get_int(data, data_len, name, &value)
+                         : json_lite_get_int(data, data_len, name, &value);
+    if (err == ESP_ERR_INVALID_ARG) {
+        err = cbor ? cbor_lite_get_bool(data, data_len, name, &on) : json_lite_get_bool(data, data_len, name, &on);
+        value = on ? ACTUATOR_LEVEL_MAX : 0;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (value < 0 || value > ACTUATOR_LEVEL_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *level = (uint8_t)value;
+    return ESP_OK;
+}
+
+esp_err_t actuator_hal_parse_state(const char *data, size_t data_len, actuator_state_t *state)
+{
+    bool cbor = cbor_lite_is_cbor(data, data_len);
+
+    memset(state, 0, sizeof(*state));
+    for (uint8_t i = 0; i < channel_count; i++) {
+        uint8_t level;
+        esp_err_t err = parse_level(data, data_len, cbor, channels[i].name, &level);
+        if (err == ESP_ERR_NOT_FOUND) {
+            continue;
+        }
+        if (err != ESP_OK) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        actuator_state_set(state, i, level);
+    }
+    return state->mask ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+uint8_t actuator_hal_get(uint8_t id)
+{
+    return id < channel_count ? levels[id] : 0;
+}
+
+const char *actuator_hal_get_name(uint8_t id)
+{
+    return id < channel_count ? channels[id].name : NULL;
+}
+
+uint8_t actuator_hal_channel_count(void)
+{
+    return channel_count;
+}
+
+void actuator_hal_get_stats(actuator_hal_stats_t *out)
+{
+    *out = stats;
+}
@@ -0,0 +1,158 @@
+#ifndef ACTUATOR_HAL_H
+#define ACTUATOR_HAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define ACTUATOR_HAL_MAX_CHANNELS CONFIG_ACTUATOR_HAL_MAX_CHANNELS
+#define ACTUATOR_HAL_NAME_MAX_LEN 15
+#define ACTUATOR_LEVEL_MAX 100 // PWM levels are percent, digital ones 0 or 1
+
+typedef enum {
+    ACTUATOR_CHANNEL_DIGITAL,   // GPIO output, on/off
+    ACTUATOR_CHANNEL_PWM,       // LEDC channel, 0..ACTUATOR_LEVEL_MAX with hardware fades
+} actuator_channel_type_t;
+
+typedef struct {
+    const char *name;               // Channel name in commands and scenes, e.g. "led"
+    actuator_channel_type_t type;
+    int gpio;
+    bool active_low;                // Output inverted, e.g. LED wired to VCC
+    uint8_t pwm_channel;            // LEDC channel (PWM only)
+    uint32_t fade_ms;               // Fade time of level changes (PWM only, 0 to jump)
+} actuator_channel_config_t;
+
+/**
+ * @brief Output backend: the hardware on the device, a mock on the host.
+ *
+ * All functions are called from the task that applies states.
+ */
+typedef struct {
+    esp_err_t (*init)(void);
+    esp_err_t (*digital_config)(uint64_t gpio_mask);
+    // Drives every pin of set_mask high and every pin of clear_mask low at once.
+    void (*digital_write)(uint64_t set_mask, uint64_t clear_mask);
+    esp_err_t (*pwm_config)(uint8_t pwm_channel, int gpio);
+    // Starts a fade to duty and returns without waiting for it.
+    esp_err_t (*pwm_fade)(uint8_t pwm_channel, uint32_t duty, uint32_t fade_ms);
+    uint32_t pwm_max_duty;
+} actuator_backend_t;
+
+/**
+ * @brief Target levels for a set of channels, applied in one operation.
+ *
+ * Channels whose bit is clear in mask keep their level.
+ */
+typedef struct {
+    uint32_t mask;
+    uint8_t level[ACTUATOR_HAL_MAX_CHANNELS];
+} actuator_state_t;
+
+typedef struct {
+    uint32_t applies;           // actuator_hal_apply() calls
+    uint32_t digital_writes;    // Backend digital_write() calls
+    uint32_t pwm_fades;         // Backend pwm_fade() calls
+    uint32_t unchanged;         // Channel levels skipped because they were already set
+} actuator_hal_stats_t;
+
+/**
+ * @brief GPIO (W1TS/W1TC registers) and LEDC backend of the device.
+ */
+extern const actuator_backend_t actuator_backend_esp32;
+
+/**
+ * @brief Removes all channels and initializes the backend.
+ *
+ * @param backend Backend driving the outputs. Must stay valid.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for an incomplete backend,
+ *         or the error of the backend init.
+ */
+esp_err_t actuator_hal_init(const actuator_backend_t *backend);
+
+/**
+ * @brief Registers an output channel and drives it off.
+ *
+ * @param config Channel configuration. The name is copied.
+ * @param id Set to the channel ID used in states.
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if all channels are used,
+ *         ESP_ERR_INVALID_ARG for a bad configuration or a pin in use.
+ */
+esp_err_t actuator_hal_add_channel(const actuator_channel_config_t *config, uint8_t *id);
+
+/**
+ * @brief Looks up a channel by name.
+ *
+ * @return Channel ID, or -1 if not found.
+ */
+int actuator_hal_find(const char *name, size_t name_len);
+
+/**
+ * @brief Applies a state vector.
+ *
+ * All digital channels change with a single backend write, PWM channels
+ * start their fades. Channels already at the requested level are skipped.
+ * Call from one task only, normally the actuator task.
+ *
+ * @param state Levels to apply; levels above the channel maximum are clamped.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the mask names an
+ *         unregistered channel, or the first PWM backend error.
+ */
+esp_err_t actuator_hal_apply(const actuator_state_t *state);
+
+/**
+ * @brief Applies a single channel level, see actuator_hal_apply().
+ */
+esp_err_t actuator_hal_set(uint8_t id, uint8_t level);
+
+/**
+ * @brief Gets the last applied level of a channel (0 for an unknown channel).
+ */
+uint8_t actuator_hal_get(uint8_t id);
+
+/**
+ * @brief Gets the name of a channel (NULL for an unknown channel).
+ */
+const char *actuator_hal_get_name(uint8_t id);
+
+/**
+ * @brief Gets the number of registered channels.
+ */
+uint8_t actuator_hal_channel_count(void);
+
+/**
+ * @brief Reads a scene payload into a state vector.
+ *
+ * A scene maps channel names to levels, {"led": 1, "fan": 40} in JSON or
+ * the same map in CBOR; true and false stand for full level and off.
+ * Channels missing from the scene are left out of the mask, names of
+ * channels this device does not have are ignored.
+ *
+ * @param data Payload (not null terminated).
+ * @param data_len Length of the payload.
+ * @param state Cleared, then filled with the levels of the scene.
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the scene names none of
+ *         the channels, ESP_ERR_INVALID_ARG for a malformed payload or a
+ *         level that is neither a number from 0 to ACTUATOR_LEVEL_MAX nor
+ *         a boolean. Nothing is applied either way.
+ */
+esp_err_t actuator_hal_parse_state(const char *data, size_t data_len, actuator_state_t *state);
+
+/**
+ * @brief Adds a channel level to a state vector.
+ */
+static inline void actuator_state_set(actuator_state_t *state, uint8_t id, uint8_t level)
+{
+    state->mask |= 1u << id;
+    state->level[id] = level;
+}
+
+/**
+ * @brief Gets the counters.
+ *
+ * @param out Destination for the counters.
+ */
+void actuator_hal_get_stats(actuator_hal_stats_t *out);
+
+#endif // ACTUATOR_HAL_H
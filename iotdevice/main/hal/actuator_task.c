@@ -0,0 +1,132 @@
+#include "actuator_task.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "trace_log.h"
+#include "device_metrics.h"
+#include "command_ack.h"
+
+#if CONFIG_ACTUATOR_TASK_CORE < 0
+#define ACTUATOR_TASK_CORE tskNO_AFFINITY
+#else
+#define ACTUATOR_TASK_CORE CONFIG_ACTUATOR_TASK_CORE
+#endif
+
+typedef struct {
+    actuator_fn_t fn;
+    void *ctx;
+    int32_t value;
+    int64_t enqueued_us;
+    command_ack_token_t ack;    // Acked once the outputs changed
+} actuator_cmd_t;
+
+static const char *TAG_ACT = "ACTUATOR";
+
+static StaticQueue_t cmd_queue_storage;
+static uint8_t cmd_queue_buffer[CONFIG_ACTUATOR_TASK_QUEUE_LEN * sizeof(actuator_cmd_t)];
+static QueueHandle_t cmd_queue;
+
+static StaticTask_t actuator_task_tcb;
+static StackType_t actuator_task_stack[CONFIG_ACTUATOR_TASK_STACK_SIZE];
+static TaskHandle_t actuator_task_handle;
+
+// Producer (MQTT task) and consumer (actuator task) both update the counters.
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static actuator_task_stats_t stats;
+
+static void actuator_task(void *arg)
+{
+    actuator_cmd_t cmd;
+    for (;;) {
+        if (xQueueReceive(cmd_queue, &cmd, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        cmd.fn(cmd.ctx, cmd.value);
+        uint32_t latency_us = (uint32_t)(esp_timer_get_time() - cmd.enqueued_us);
+        command_ack_complete(cmd.ack, ESP_OK);
+
+        portENTER_CRITICAL(&stats_lock);
+        stats.executed++;
+        stats.latency_us_last = latency_us;
+        stats.latency_us_total += latency_us;
+        if (latency_us > stats.latency_us_max) {
+            stats.latency_us_max = latency_us;
+        }
+        portEXIT_CRITICAL(&stats_lock);
+        device_metrics_observe(METRIC_ACTUATE_US, latency_us);
+        TRACE(ACT_EXECUTED, cmd.value, latency_us);
+    }
+}
+
+esp_err_t actuator_task_start(void)
+{
+    if (actuator_task_handle) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    cmd_queue = xQueueCreateStatic(CONFIG_ACTUATOR_TASK_QUEUE_LEN, sizeof(actuator_cmd_t),
+                                   cmd_queue_buffer, &cmd_queue_storage);
+    actuator_task_handle = xTaskCreateStaticPinnedToCore(actuator_task, "actuator", CONFIG_ACTUATOR_TASK_STACK_SIZE,
+                                                         NULL, CONFIG_ACTUATOR_TASK_PRIORITY, actuator_task_stack,
+                                                         &actuator_task_tcb, ACTUATOR_TASK_CORE);
+    if (actuator_task_handle == NULL) {
+        ESP_LOGE(TAG_ACT, "Failed to create actuator task");
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG_ACT, "Actuator task started (prio %d, core %d, queue %d)",
+             CONFIG_ACTUATOR_TASK_PRIORITY, CONFIG_ACTUATOR_TASK_CORE, CONFIG_ACTUATOR_TASK_QUEUE_LEN);
+    return ESP_OK;
+}
+
+static esp_err_t submit(actuator_cmd_t *cmd)
+{
+    if (cmd_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    cmd->enqueued_us = esp_timer_get_time();
+    // Called from a command handler, the ack waits for the outputs to change.
+    cmd->ack = command_ack_take();
+    bool queued = xQueueSend(cmd_queue, cmd, 0) == pdTRUE;
+    uint32_t depth = uxQueueMessagesWaiting(cmd_queue);
+
+    portENTER_CRITICAL(&stats_lock);
+    if (queued) {
+        stats.enqueued++;
+        if (depth > stats.queue_depth_max) {
+            stats.queue_depth_max = depth;
+        }
+    } else {
+        stats.dropped++;
+    }
+    uint32_t dropped = stats.dropped;
+    portEXIT_CRITICAL(&stats_lock);
+
+    if (!queued) {
+        TRACE(ACT_QUEUE_FULL, dropped);
+        command_ack_complete(cmd->ack, ESP_ERR_NO_MEM);
+    }
+
+    return queued ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t actuator_task_submit(actuator_fn_t fn, void *ctx, int32_t value)
+{
+    actuator_cmd_t cmd = {
+        .fn = fn,
+        .ctx = ctx,
+        .value = value,
+    };
+    return submit(&cmd);
+}
+
+void actuator_task_get_stats(actuator_task_stats_t *out)
+{
+    portENTER_CRITICAL(&stats_lock);
+    memcpy(out, &stats, sizeof(*out));
+    portEXIT_CRITICAL(&stats_lock);
+    out->queue_depth = cmd_queue ? uxQueueMessagesWaiting(cmd_queue) : 0;
+}
@@ -0,0 +1,65 @@
+#ifndef ACTUATOR_TASK_H
+#define ACTUATOR_TASK_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * @brief Function that drives an output, run on the actuator task.
+ *
+ * @param ctx Context pointer given with the command.
+ * @param value Parsed command value (e.g. 0/1 for on/off).
+ */
+typedef void (*actuator_fn_t)(void *ctx, int32_t value);
+
+/**
+ * @brief Counters of the actuator queue.
+ *
+ * Latencies are measured from actuator_task_submit() to the moment the
+ * actuator function returns.
+ */
+typedef struct {
+    uint32_t enqueued;          // Commands accepted into the queue
+    uint32_t dropped;           // Commands rejected because the queue was full
+    uint32_t executed;          // Commands run by the worker
+    uint32_t queue_depth;       // Commands currently waiting
+    uint32_t queue_depth_max;   // Highest depth seen since boot
+    uint32_t latency_us_last;   // Enqueue-to-actuate time of the last command
+    uint32_t latency_us_max;    // Worst enqueue-to-actuate time
+    uint64_t latency_us_total;  // Sum over all executed commands, for averages
+} actuator_task_stats_t;
+
+/**
+ * @brief Creates the command queue and the actuator worker task.
+ *
+ * Queue and task are statically allocated. Core, priority, stack and queue
+ * length come from Kconfig (ACTUATOR_TASK_*).
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if already started,
+ *         ESP_FAIL if the task could not be created.
+ */
+esp_err_t actuator_task_start(void);
+
+/**
+ * @brief Queues a command for the actuator task.
+ *
+ * Never blocks and never allocates, so it is safe to call from the MQTT
+ * event handler. Called from a command handler, it takes over the ack of a
+ * sequenced command (see command_ack.h): the command is acked once fn returned.
+ *
+ * @param fn Function to run on the actuator task.
+ * @param ctx Context passed to fn. Must outlive the command.
+ * @param value Value passed to fn.
+ * @return ESP_OK if queued, ESP_ERR_NO_MEM if the queue is full,
+ *         ESP_ERR_INVALID_STATE if the task is not running.
+ */
+esp_err_t actuator_task_submit(actuator_fn_t fn, void *ctx, int32_t value);
+
+/**
+ * @brief Copies a consistent snapshot of the queue counters.
+ *
+ * @param out Destination for the counters.
+ */
+void actuator_task_get_stats(actuator_task_stats_t *out);
+
+#endif // ACTUATOR_TASK_H
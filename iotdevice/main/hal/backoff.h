@@ -0,0 +1,43 @@
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+#include <stdint.h>
+#include "esp_random.h"
+
+/*
+ * Exponential reconnect backoff with "equal jitter": the delay doubles
+ * from min_ms up to max_ms and half of it is randomized, so devices that
+ * lost the network together do not come back in lockstep.
+ */
+typedef struct {
+    uint32_t min_ms;
+    uint32_t max_ms;
+    uint32_t attempt;   // Delays handed out since the last reset
+} backoff_t;
+
+#define BACKOFF_INIT(min, max) { .min_ms = (min), .max_ms = (max), .attempt = 0 }
+
+/**
+ * @brief Gets the delay before the next attempt and advances the backoff.
+ *
+ * @param b Backoff state.
+ * @return Delay in milliseconds, between half and all of the current step.
+ */
+static inline uint32_t backoff_next_ms(backoff_t *b)
+{
+    uint64_t step = (uint64_t)b->min_ms << (b->attempt < 31 ? b->attempt : 31);
+    uint32_t delay = step > b->max_ms ? b->max_ms : (uint32_t)step;
+
+    b->attempt++;
+    return delay / 2 + esp_random() % (delay / 2 + 1);
+}
+
+/**
+ * @brief Starts over from min_ms, after a successful connection.
+ */
+static inline void backoff_reset(backoff_t *b)
+{
+    b->attempt = 0;
+}
+
+#endif // BACKOFF_H
@@ -0,0 +1,102 @@
+#include "boot_profile.h"
+#include "device_crypto.h"
+#include "cbor_lite.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include "esp_timer.h"
+
+#define BOOT_PROFILE_PAYLOAD_MAX 192
+
+// Member names in the published profile, indexed by boot_phase_t.
+static const char *const phase_names[BOOT_PHASE_COUNT] = {
+    "nvsInit", "associated", "gotIp", "mqttConnected", "subscribed",
+};
+
+// Phases are stamped from the main task, the event loop and the MQTT task.
+static _Atomic int64_t phase_us[BOOT_PHASE_COUNT];
+static _Atomic uint32_t boot_flags;
+static atomic_bool published;
+static char payload_buf[DEVICE_CRYPTO_FRAME_LEN(BOOT_PROFILE_PAYLOAD_MAX)];
+
+void boot_profile_mark(boot_phase_t phase)
+{
+    int64_t unset = 0;
+    if (phase < BOOT_PHASE_COUNT) {
+        // A timestamp of 0 means unset; esp_timer is well past 0 by app_main.
+        atomic_compare_exchange_strong(&phase_us[phase], &unset, esp_timer_get_time());
+    }
+}
+
+void boot_profile_set_flags(uint32_t flags)
+{
+    atomic_fetch_or(&boot_flags, flags);
+}
+
+int64_t boot_profile_get(boot_phase_t phase)
+{
+    int64_t us = phase < BOOT_PHASE_COUNT ? atomic_load(&phase_us[phase]) : 0;
+    return us ? us : -1;
+}
+
+#if CONFIG_DEVICE_PAYLOAD_FORMAT_CBOR
+static size_t pack_profile(const int64_t *us, uint32_t flags)
+{
+    cbor_lite_writer_t w;
+    size_t reached = 0;
+
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+        reached += us[i] >= 0;
+    }
+    cbor_lite_writer_init(&w, payload_buf, BOOT_PROFILE_PAYLOAD_MAX);
+    cbor_lite_put_map(&w, 2);
+    cbor_lite_put_cstr(&w, "phasesUs");
+    cbor_lite_put_map(&w, reached);
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+        if (us[i] >= 0) {
+            cbor_lite_put_cstr(&w, phase_names[i]);
+            cbor_lite_put_uint(&w, (uint64_t)us[i]);
+        }
+    }
+    cbor_lite_put_cstr(&w, "flags");
+    cbor_lite_put_uint(&w, flags);
+    return w.overflow ? 0 : w.len;
+}
+#else
+static size_t pack_profile(const int64_t *us, uint32_t flags)
+{
+    size_t len = 0;
+    int n = snprintf(payload_buf, BOOT_PROFILE_PAYLOAD_MAX, "{\"phasesUs\":{");
+
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+        if (us[i] >= 0 && n > 0 && (len += (size_t)n) < BOOT_PROFILE_PAYLOAD_MAX) {
+            n = snprintf(&payload_buf[len], BOOT_PROFILE_PAYLOAD_MAX - len, "%s\"%s\":%lld",
+                         payload_buf[len - 1] == '{' ? "" : ",", phase_names[i], (long long)us[i]);
+        }
+    }
+    if (n > 0 && (len += (size_t)n) < BOOT_PROFILE_PAYLOAD_MAX) {
+        n = snprintf(&payload_buf[len], BOOT_PROFILE_PAYLOAD_MAX - len, "},\"flags\":%u}", (unsigned)flags);
+    }
+    return n > 0 && (len += (size_t)n) < BOOT_PROFILE_PAYLOAD_MAX ? len : 0;
+}
+#endif
+
+esp_err_t boot_profile_publish(boot_profile_publish_fn_t publish)
+{
+    int64_t us[BOOT_PHASE_COUNT];
+    bool expected = false;
+
+    if (!atomic_compare_exchange_strong(&published, &expected, true)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // Snapshot first, a phase stamped meanwhile must not change the member count.
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+        us[i] = boot_profile_get(i);
+    }
+    size_t len = pack_profile(us, atomic_load(&boot_flags));
+    if (len == 0 || publish("boot", payload_buf, len, sizeof(payload_buf)) < 0) {
+        atomic_store(&published, false);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
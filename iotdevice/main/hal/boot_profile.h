@@ -0,0 +1,77 @@
+#ifndef BOOT_PROFILE_H
+#define BOOT_PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * Boot-to-first-command timing.
+ *
+ * Each phase is stamped once per boot with esp_timer_get_time(), i.e.
+ * microseconds since the timer started early in startup. The profile is
+ * published once, on home/devices/<id>/boot, when the device is ready to
+ * receive commands.
+ */
+
+typedef enum {
+    BOOT_PHASE_NVS_INIT,        // NVS ready
+    BOOT_PHASE_ASSOCIATED,      // Wi-Fi associated with the AP
+    BOOT_PHASE_GOT_IP,          // IP address assigned
+    BOOT_PHASE_MQTT_CONNECTED,  // Broker accepted the connection
+    BOOT_PHASE_SUBSCRIBED,      // Command subscription active (or kept by the session)
+    BOOT_PHASE_COUNT
+} boot_phase_t;
+
+typedef enum {
+    BOOT_FLAG_WIFI_CACHED = 1 << 0,       // Associated with the cached BSSID and channel
+    BOOT_FLAG_IP_REUSED = 1 << 1,         // Cached IP used, DHCP skipped
+    BOOT_FLAG_SESSION_PRESENT = 1 << 2,   // Broker resumed the persistent session
+} boot_flag_t;
+
+/**
+ * @brief Publishes on home/devices/<id>/<subtopic>, same contract as
+ *        network_mqtt_publish(): buf is encrypted in place and must hold
+ *        DEVICE_CRYPTO_FRAME_LEN(len) bytes.
+ *
+ * @return Message ID, or a negative value on failure.
+ */
+typedef int (*boot_profile_publish_fn_t)(const char *subtopic, char *buf, size_t len, size_t buf_size);
+
+/**
+ * @brief Stamps a phase; only the first call per phase counts.
+ *
+ * @param phase Phase reached.
+ */
+void boot_profile_mark(boot_phase_t phase);
+
+/**
+ * @brief Sets flags describing how the boot went.
+ *
+ * @param flags Bitwise OR of boot_flag_t values.
+ */
+void boot_profile_set_flags(uint32_t flags);
+
+/**
+ * @brief Gets the time a phase was reached.
+ *
+ * @param phase Phase to query.
+ * @return Microseconds since boot, or -1 if the phase was not reached.
+ */
+int64_t boot_profile_get(boot_phase_t phase);
+
+/**
+ * @brief Publishes the profile on the "boot" subtopic, once per boot.
+ *
+ * Encoded as JSON or CBOR following CONFIG_DEVICE_PAYLOAD_FORMAT, e.g.
+ * {"phasesUs":{"nvsInit":31000,...,"subscribed":1240000},"flags":3}.
+ * Phases not reached are left out.
+ *
+ * @param publish Function used to send the message.
+ * @return ESP_OK once published, ESP_ERR_INVALID_STATE if it already was,
+ *         ESP_FAIL if publishing failed (the next call retries).
+ */
+esp_err_t boot_profile_publish(boot_profile_publish_fn_t publish);
+
+#endif // BOOT_PROFILE_H
@@ -0,0 +1,428 @@
+#include "cbor_lite.h"
+
+#include <math.h>
+#include <string.h>
+
+#define CBOR_LITE_MAX_DEPTH 16
+
+// Major types (RFC 8949 section 3.1)
+#define CBOR_UINT   0
+#define CBOR_NINT   1
+#define CBOR_BYTES  2
+#define CBOR_TEXT   3
+#define CBOR_ARRAY  4
+#define CBOR_MAP    5
+#define CBOR_TAG    6
+#define CBOR_SIMPLE 7
+
+#define CBOR_AI_INDEF   31
+#define CBOR_FALSE      20
+#define CBOR_TRUE       21
+#define CBOR_HALF       25
+#define CBOR_SINGLE     26
+#define CBOR_DOUBLE     27
+#define CBOR_BREAK      0xff
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+} cbor_cursor_t;
+
+void cbor_lite_writer_init(cbor_lite_writer_t *w, void *buf, size_t size)
+{
+    w->buf = buf;
+    w->size = size;
+    w->len = 0;
+    w->overflow = false;
+}
+
+static void put_bytes(cbor_lite_writer_t *w, const void *data, size_t len)
+{
+    if (w->overflow || w->size - w->len < len) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+// Initial byte plus the argument in the shortest encoding.
+static void put_head(cbor_lite_writer_t *w, uint8_t major, uint64_t arg)
+{
+    uint8_t head[9];
+    size_t n;
+
+    if (arg < 24) {
+        head[0] = (uint8_t)(major << 5 | arg);
+        n = 1;
+    } else if (arg <= UINT8_MAX) {
+        head[0] = (uint8_t)(major << 5 | 24);
+        n = 2;
+    } else if (arg <= UINT16_MAX) {
+        head[0] = (uint8_t)(major << 5 | 25);
+        n = 3;
+    } else if (arg <= UINT32_MAX) {
+        head[0] = (uint8_t)(major << 5 | 26);
+        n = 5;
+    } else {
+        head[0] = (uint8_t)(major << 5 | 27);
+        n = 9;
+    }
+    for (size_t i = 1; i < n; i++) {
+        head[i] = (uint8_t)(arg >> (8 * (n - 1 - i)));
+    }
+    put_bytes(w, head, n);
+}
+
+void cbor_lite_put_map(cbor_lite_writer_t *w, size_t pairs)
+{
+    put_head(w, CBOR_MAP, pairs);
+}
+
+void cbor_lite_put_array(cbor_lite_writer_t *w, size_t items)
+{
+    put_head(w, CBOR_ARRAY, items);
+}
+
+void cbor_lite_put_array_indef(cbor_lite_writer_t *w)
+{
+    uint8_t b = CBOR_ARRAY << 5 | CBOR_AI_INDEF;
+    put_bytes(w, &b, 1);
+}
+
+void cbor_lite_put_break(cbor_lite_writer_t *w)
+{
+    uint8_t b = CBOR_BREAK;
+    put_bytes(w, &b, 1);
+}
+
+void cbor_lite_put_uint(cbor_lite_writer_t *w, uint64_t value)
+{
+    put_head(w, CBOR_UINT, value);
+}
+
+void cbor_lite_put_int(cbor_lite_writer_t *w, int64_t value)
+{
+    if (value < 0) {
+        put_head(w, CBOR_NINT, (uint64_t)(-1 - value));
+    } else {
+        put_head(w, CBOR_UINT, (uint64_t)value);
+    }
+}
+
+void cbor_lite_put_bool(cbor_lite_writer_t *w, bool value)
+{
+    uint8_t b = CBOR_SIMPLE << 5 | (value ? CBOR_TRUE : CBOR_FALSE);
+    put_bytes(w, &b, 1);
+}
+
+void cbor_lite_put_text(cbor_lite_writer_t *w, const char *str, size_t len)
+{
+    put_head(w, CBOR_TEXT, len);
+    put_bytes(w, str, len);
+}
+
+void cbor_lite_put_byte_string(cbor_lite_writer_t *w, const void *data, size_t len)
+{
+    put_head(w, CBOR_BYTES, len);
+    put_bytes(w, data, len);
+}
+
+void cbor_lite_put_cstr(cbor_lite_writer_t *w, const char *str)
+{
+    cbor_lite_put_text(w, str, strlen(str));
+}
+
+void cbor_lite_put_number(cbor_lite_writer_t *w, float value)
+{
+    if (isfinite(value) && fabsf(value) < 4294967296.0f && value == truncf(value)) {
+        cbor_lite_put_int(w, (int64_t)value);
+        return;
+    }
+
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int exponent = (int)((bits >> 23) & 0xff) - 127;
+    uint32_t mantissa = bits & 0x7fffff;
+    uint8_t out[5];
+
+    if (exponent >= -14 && exponent <= 15 && (mantissa & 0x1fff) == 0) {
+        // Normal half float holds this value exactly.
+        uint16_t half = (uint16_t)((bits >> 16 & 0x8000) | (uint32_t)(exponent + 15) << 10 | mantissa >> 13);
+        out[0] = CBOR_SIMPLE << 5 | CBOR_HALF;
+        out[1] = (uint8_t)(half >> 8);
+        out[2] = (uint8_t)half;
+        put_bytes(w, out, 3);
+        return;
+    }
+    out[0] = CBOR_SIMPLE << 5 | CBOR_SINGLE;
+    out[1] = (uint8_t)(bits >> 24);
+    out[2] = (uint8_t)(bits >> 16);
+    out[3] = (uint8_t)(bits >> 8);
+    out[4] = (uint8_t)bits;
+    put_bytes(w, out, 5);
+}
+
+// Reads an initial byte and its argument; *ai is the raw additional info.
+static bool read_head(cbor_cursor_t *c, uint8_t *major, uint8_t *ai, uint64_t *arg)
+{
+    if (c->p >= c->end) {
+        return false;
+    }
+    *major = *c->p >> 5;
+    *ai = *c->p & 0x1f;
+    c->p++;
+    *arg = 0;
+    if (*ai < 24) {
+        *arg = *ai;
+        return true;
+    }
+    if (*ai == CBOR_AI_INDEF) {
+        // Only strings, arrays, maps and the break code have no argument.
+        return (*major >= CBOR_BYTES && *major <= CBOR_MAP) || *major == CBOR_SIMPLE;
+    }
+    if (*ai > 27) {
+        return false;
+    }
+    size_t n = (size_t)1 << (*ai - 24);
+    if ((size_t)(c->end - c->p) < n) {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        *arg = *arg << 8 | *c->p++;
+    }
+    return true;
+}
+
+static bool at_break(cbor_cursor_t *c)
+{
+    if (c->p < c->end && *c->p == CBOR_BREAK) {
+        c->p++;
+        return true;
+    }
+    return false;
+}
+
+static bool skip_item(cbor_cursor_t *c, int depth)
+{
+    uint8_t major;
+    uint8_t ai;
+    uint64_t arg;
+
+    if (depth > CBOR_LITE_MAX_DEPTH || !read_head(c, &major, &ai, &arg)) {
+        return false;
+    }
+    switch (major) {
+    case CBOR_UINT:
+    case CBOR_NINT:
+        return true;
+    case CBOR_BYTES:
+    case CBOR_TEXT:
+        if (ai == CBOR_AI_INDEF) {
+            // Chunks until the break code.
+            while (!at_break(c)) {
+                if (c->p >= c->end || (*c->p >> 5) != major || !skip_item(c, depth + 1)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        if ((uint64_t)(c->end - c->p) < arg) {
+            return false;
+        }
+        c->p += arg;
+        return true;
+    case CBOR_ARRAY:
+    case CBOR_MAP: {
+        uint64_t items = major == CBOR_MAP ? 2 * arg : arg;
+        if (ai == CBOR_AI_INDEF) {
+            while (!at_break(c)) {
+                if (!skip_item(c, depth + 1)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        for (uint64_t i = 0; i < items; i++) {
+            if (!skip_item(c, depth + 1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    case CBOR_TAG:
+        return skip_item(c, depth + 1);
+    default:
+        // A break code here is not inside an indefinite item.
+        return ai != CBOR_AI_INDEF;
+    }
+}
+
+static esp_err_t find_member(const void *data, size_t len, const char *key, cbor_cursor_t *value)
+{
+    cbor_cursor_t c = { .p = data, .end = (const uint8_t *)data + len };
+    uint8_t major;
+    uint8_t ai;
+    uint64_t pairs;
+
+    if (key == NULL) {
+        *value = c;
+        return ESP_OK;
+    }
+    if (!read_head(&c, &major, &ai, &pairs) || major != CBOR_MAP) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t key_len = strlen(key);
+    bool indef = ai == CBOR_AI_INDEF;
+    for (uint64_t i = 0; indef || i < pairs; i++) {
+        if (indef && at_break(&c)) {
+            break;
+        }
+        const uint8_t *name = c.p;
+        uint64_t name_len;
+        bool match = false;
+        if (read_head(&c, &major, &ai, &name_len) && major == CBOR_TEXT && ai != CBOR_AI_INDEF) {
+            if ((uint64_t)(c.end - c.p) < name_len) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            match = name_len == key_len && memcmp(c.p, key, key_len) == 0;
+            c.p += name_len;
+        } else {
+            // Not a definite text key, never matches.
+            c.p = name;
+            if (!skip_item(&c, 1)) {
+                return ESP_ERR_INVALID_ARG;
+            }
+        }
+        const uint8_t *v = c.p;
+        if (!skip_item(&c, 1)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (match) {
+            value->p = v;
+            value->end = c.p;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+static float half_to_float(uint16_t half)
+{
+    int exponent = (half >> 10) & 0x1f;
+    float mantissa = (float)(half & 0x3ff);
+    float value;
+
+    if (exponent == 0) {
+        value = ldexpf(mantissa, -24);
+    } else if (exponent == 31) {
+        value = mantissa != 0.0f ? NAN : INFINITY;
+    } else {
+        value = ldexpf(mantissa + 1024.0f, exponent - 25);
+    }
+    return (half & 0x8000) ? -value : value;
+}
+
+// Integers and floats of any width.
+static bool read_number(cbor_cursor_t *c, double *out)
+{
+    uint8_t major;
+    uint8_t ai;
+    uint64_t arg;
+
+    if (!read_head(c, &major, &ai, &arg)) {
+        return false;
+    }
+    if (major == CBOR_UINT) {
+        *out = (double)arg;
+    } else if (major == CBOR_NINT) {
+        *out = -1.0 - (double)arg;
+    } else if (major == CBOR_SIMPLE && ai == CBOR_HALF) {
+        *out = half_to_float((uint16_t)arg);
+    } else if (major == CBOR_SIMPLE && ai == CBOR_SINGLE) {
+        uint32_t bits = (uint32_t)arg;
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        *out = f;
+    } else if (major == CBOR_SIMPLE && ai == CBOR_DOUBLE) {
+        memcpy(out, &arg, sizeof(*out));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+esp_err_t cbor_lite_get_bool(const void *data, size_t len, const char *key, bool *out)
+{
+    cbor_cursor_t v;
+    esp_err_t err = find_member(data, len, key, &v);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (v.p >= v.end || (*v.p != (CBOR_SIMPLE << 5 | CBOR_TRUE) && *v.p != (CBOR_SIMPLE << 5 | CBOR_FALSE))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out = *v.p == (CBOR_SIMPLE << 5 | CBOR_TRUE);
+    return ESP_OK;
+}
+
+esp_err_t cbor_lite_get_float(const void *data, size_t len, const char *key, float *out)
+{
+    cbor_cursor_t v;
+    double value;
+    esp_err_t err = find_member(data, len, key, &v);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (!read_number(&v, &value)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out = (float)value;
+    return ESP_OK;
+}
+
+esp_err_t cbor_lite_get_int(const void *data, size_t len, const char *key, int32_t *out)
+{
+    cbor_cursor_t v;
+    double value;
+    esp_err_t err = find_member(data, len, key, &v);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (!read_number(&v, &value) || !(value >= INT32_MIN && value <= INT32_MAX)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out = (int32_t)value;
+    return ESP_OK;
+}
+
+static esp_err_t get_string_member(const void *data, size_t len, const char *key, uint8_t want,
+                                   const uint8_t **str, size_t *str_len)
+{
+    cbor_cursor_t v;
+    uint8_t major;
+    uint8_t ai;
+    uint64_t n;
+    esp_err_t err = find_member(data, len, key, &v);
+    if (err != ESP_OK) {
+        return err;
+    }
+    // Indefinite (chunked) strings are not contiguous and not supported here.
+    if (!read_head(&v, &major, &ai, &n) || major != want || ai == CBOR_AI_INDEF ||
+        (uint64_t)(v.end - v.p) < n) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *str = v.p;
+    *str_len = (size_t)n;
+    return ESP_OK;
+}
+
+esp_err_t cbor_lite_get_string(const void *data, size_t len, const char *key, const char **str, size_t *str_len)
+{
+    return get_string_member(data, len, key, CBOR_TEXT, (const uint8_t **)str, str_len);
+}
+
+esp_err_t cbor_lite_get_bytes(const void *data, size_t len, const char *key, const uint8_t **bytes, size_t *bytes_len)
+{
+    return get_string_member(data, len, key, CBOR_BYTES, bytes, bytes_len);
+}
@@ -0,0 +1,109 @@
+#ifndef CBOR_LITE_H
+#define CBOR_LITE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * Minimal, allocation free CBOR (RFC 8949) writer and reader.
+ *
+ * The writer covers what the device publishes: maps, arrays (definite or
+ * indefinite length), integers, floats, booleans and text strings. The
+ * reader mirrors json_lite: it looks up keys of the top level map and
+ * skips everything else.
+ */
+
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    bool overflow;  // Set once a put did not fit; later puts are ignored
+} cbor_lite_writer_t;
+
+/**
+ * @brief Tells whether a payload is CBOR rather than JSON text.
+ *
+ * Maps, arrays and simple values all have an initial byte >= 0x80, which
+ * never starts a JSON document, so the first byte is enough.
+ *
+ * @param data Payload.
+ * @param len Length of the payload.
+ * @return true if the payload should be decoded as CBOR.
+ */
+static inline bool cbor_lite_is_cbor(const void *data, size_t len)
+{
+    return len > 0 && ((const uint8_t *)data)[0] >= 0x80;
+}
+
+/**
+ * @brief Starts writing into buf.
+ *
+ * @param w Writer.
+ * @param buf Destination.
+ * @param size Size of buf.
+ */
+void cbor_lite_writer_init(cbor_lite_writer_t *w, void *buf, size_t size);
+
+void cbor_lite_put_map(cbor_lite_writer_t *w, size_t pairs);
+void cbor_lite_put_array(cbor_lite_writer_t *w, size_t items);
+void cbor_lite_put_array_indef(cbor_lite_writer_t *w);
+void cbor_lite_put_break(cbor_lite_writer_t *w);
+void cbor_lite_put_uint(cbor_lite_writer_t *w, uint64_t value);
+void cbor_lite_put_int(cbor_lite_writer_t *w, int64_t value);
+void cbor_lite_put_bool(cbor_lite_writer_t *w, bool value);
+void cbor_lite_put_text(cbor_lite_writer_t *w, const char *str, size_t len);
+void cbor_lite_put_cstr(cbor_lite_writer_t *w, const char *str);
+void cbor_lite_put_byte_string(cbor_lite_writer_t *w, const void *data, size_t len);
+
+/**
+ * @brief Writes a number in its shortest lossless form.
+ *
+ * Integral values become integers, others a half float when exact and a
+ * single float otherwise.
+ */
+void cbor_lite_put_number(cbor_lite_writer_t *w, float value);
+
+/**
+ * @brief Reads a boolean member of the top level map.
+ *
+ * @param data Payload.
+ * @param len Length of the payload.
+ * @param key Member name, or NULL to read a payload that is a bare boolean.
+ * @param out Value of the member.
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the key is missing,
+ *         ESP_ERR_INVALID_ARG if the value is not a boolean or the CBOR is malformed.
+ */
+esp_err_t cbor_lite_get_bool(const void *data, size_t len, const char *key, bool *out);
+
+/**
+ * @brief Reads an integer member of the top level map.
+ *
+ * Floats are truncated. Same return codes as cbor_lite_get_bool().
+ */
+esp_err_t cbor_lite_get_int(const void *data, size_t len, const char *key, int32_t *out);
+
+/**
+ * @brief Reads a numeric member of the top level map.
+ *
+ * Same return codes as cbor_lite_get_bool().
+ */
+esp_err_t cbor_lite_get_float(const void *data, size_t len, const char *key, float *out);
+
+/**
+ * @brief Finds a text string member of the top level map.
+ *
+ * The result points into the payload and is not null terminated.
+ * Same return codes as cbor_lite_get_bool().
+ */
+esp_err_t cbor_lite_get_string(const void *data, size_t len, const char *key, const char **str, size_t *str_len);
+
+/**
+ * @brief Finds a byte string member of the top level map.
+ *
+ * The result points into the payload. Same return codes as cbor_lite_get_bool().
+ */
+esp_err_t cbor_lite_get_bytes(const void *data, size_t len, const char *key, const uint8_t **bytes, size_t *bytes_len);
+
+#endif // CBOR_LITE_H
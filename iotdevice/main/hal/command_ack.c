@@ -0,0 +1,287 @@
+#include "command_ack.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "json_lite.h"
+#include "cbor_lite.h"
+#include "device_metrics.h"
+#include "trace_log.h"
+#include "device_crypto.h"
+
+// "[4294967295,-2147483648,4294967295]," is the longest JSON entry.
+#define ACK_PAYLOAD_MAX (16 + COMMAND_ACK_BATCH * 37)
+
+#define ACK_BUF_SIZE DEVICE_CRYPTO_FRAME_LEN(ACK_PAYLOAD_MAX)
+
+typedef struct {
+    uint32_t seq;
+    int32_t status;
+    uint32_t us;
+} command_ack_t;
+
+static const char *TAG_ACK = "COMMAND_ACK";
+
+static command_ack_config_t ack_config;
+static command_ack_publish_fn_t ack_publish;
+
+// Sequence numbers seen last, only used by the task dispatching commands
+// (see command_ack_begin()). 0 marks a free slot.
+static uint32_t window[COMMAND_ACK_DEDUP_WINDOW];
+static size_t window_next;
+// Newest number run, 0 before the first sequenced command.
+static uint32_t latest_seq;
+
+// The command being dispatched, see command_ack_begin().
+static uint32_t current_seq;
+static int64_t current_rx_us;
+static TaskHandle_t current_task;
+
+// Producers are the MQTT and actuator tasks, the consumer is the ack task.
+static portMUX_TYPE ack_lock = portMUX_INITIALIZER_UNLOCKED;
+static command_ack_t ack_ring[COMMAND_ACK_QUEUE_LEN];
+static size_t ack_head;
+static size_t ack_count;
+static command_ack_stats_t stats;
+
+// Only used on the ack task (or by the host benchmarks).
+static char ack_buf[ACK_BUF_SIZE];
+
+static StaticTask_t ack_task_tcb;
+static StackType_t ack_task_stack[CONFIG_COMMAND_ACK_TASK_STACK_SIZE];
+static TaskHandle_t ack_task_handle;
+
+esp_err_t command_ack_init(const command_ack_config_t *config, command_ack_publish_fn_t publish)
+{
+    if (config == NULL || publish == NULL ||
+        (config->encoding != TELEMETRY_ENCODING_JSON && config->encoding != TELEMETRY_ENCODING_CBOR)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ack_config = *config;
+    ack_publish = publish;
+    memset(window, 0, sizeof(window));
+    window_next = 0;
+    latest_seq = 0;
+    current_seq = 0;
+    current_task = NULL;
+    portENTER_CRITICAL(&ack_lock);
+    ack_head = 0;
+    ack_count = 0;
+    memset(&stats, 0, sizeof(stats));
+    portEXIT_CRITICAL(&ack_lock);
+    return ESP_OK;
+}
+
+uint32_t command_ack_get_seq(const char *data, size_t len)
+{
+    int32_t seq;
+    esp_err_t err = cbor_lite_is_cbor(data, len) ? cbor_lite_get_int(data, len, "seq", &seq)
+                                                 : json_lite_get_int(data, len, "seq", &seq);
+    return err == ESP_OK && seq > 0 ? (uint32_t)seq : 0;
+}
+
+// Distance from one sequence number to another, in the number space the backend wraps around.
+static int64_t seq_distance(uint32_t from, uint32_t to)
+{
+    int64_t d = (int64_t)to - (int64_t)from;
+    if (d > COMMAND_ACK_SEQ_MAX / 2) {
+        d -= COMMAND_ACK_SEQ_MAX;
+    } else if (d < -(int64_t)(COMMAND_ACK_SEQ_MAX / 2)) {
+        d += COMMAND_ACK_SEQ_MAX;
+    }
+    return d;
+}
+
+bool command_ack_is_recent(uint32_t seq, uint32_t max_ahead)
+{
+    if (latest_seq == 0 || seq == 0) {
+        return false;
+    }
+    int64_t d = seq_distance(latest_seq, seq);
+    return d > -(int64_t)COMMAND_ACK_DEDUP_WINDOW && d <= (int64_t)max_ahead;
+}
+
+static void enqueue(uint32_t seq, int32_t status, uint32_t us)
+{
+    bool queued = false;
+
+    portENTER_CRITICAL(&ack_lock);
+    if (ack_count < COMMAND_ACK_QUEUE_LEN) {
+        ack_ring[(ack_head + ack_count) % COMMAND_ACK_QUEUE_LEN] = (command_ack_t){ seq, status, us };
+        ack_count++;
+        queued = true;
+    } else {
+        stats.dropped++;
+    }
+    portEXIT_CRITICAL(&ack_lock);
+
+    if (queued && ack_task_handle) {
+        xTaskNotifyGive(ack_task_handle);
+    }
+}
+
+bool command_ack_begin(uint32_t seq, int64_t rx_us)
+{
+    bool duplicate = false;
+    for (size_t i = 0; i < COMMAND_ACK_DEDUP_WINDOW; i++) {
+        if (window[i] == seq) {
+            duplicate = true;
+            break;
+        }
+    }
+    portENTER_CRITICAL(&ack_lock);
+    stats.sequenced++;
+    stats.duplicates += duplicate;
+    portEXIT_CRITICAL(&ack_lock);
+
+    if (duplicate) {
+        device_metrics_count(METRIC_DUPLICATES);
+        TRACE(CMD_DUPLICATE, seq);
+        enqueue(seq, COMMAND_ACK_DUPLICATE, 0);
+        return false;
+    }
+    window[window_next] = seq;
+    window_next = (window_next + 1) % COMMAND_ACK_DEDUP_WINDOW;
+    // A jump far back is a restarted backend numbering from a new start.
+    int64_t d = seq_distance(latest_seq, seq);
+    if (latest_seq == 0 || d > 0 || d <= -(int64_t)COMMAND_ACK_DEDUP_WINDOW) {
+        latest_seq = seq;
+    }
+    current_rx_us = rx_us;
+    current_seq = seq;
+    current_task = xTaskGetCurrentTaskHandle();
+    return true;
+}
+
+void command_ack_end(esp_err_t err)
+{
+    if (current_seq) {
+        enqueue(current_seq, err, (uint32_t)(esp_timer_get_time() - current_rx_us));
+    }
+    current_seq = 0;
+    current_task = NULL;
+}
+
+command_ack_token_t command_ack_take(void)
+{
+    command_ack_token_t token = { 0 };
+    // Rules actuate from the telemetry task while a command may be dispatched.
+    if (current_seq && current_task == xTaskGetCurrentTaskHandle()) {
+        token.seq = current_seq;
+        token.rx_us = current_rx_us;
+        current_seq = 0;
+    }
+    return token;
+}
+
+void command_ack_complete(command_ack_token_t token, esp_err_t err)
+{
+    if (token.seq) {
+        enqueue(token.seq, err, (uint32_t)(esp_timer_get_time() - token.rx_us));
+    }
+}
+
+static size_t pack_json(const command_ack_t *acks, size_t count)
+{
+    // ACK_PAYLOAD_MAX holds a full batch, no need to check for truncation.
+    size_t pos = strlen(strcpy(ack_buf, "{\"acks\":["));
+    for (size_t i = 0; i < count; i++) {
+        pos += (size_t)snprintf(ack_buf + pos, ACK_PAYLOAD_MAX - pos, "%s[%" PRIu32 ",%" PRId32 ",%" PRIu32 "]",
+                                i ? "," : "", acks[i].seq, acks[i].status, acks[i].us);
+    }
+    memcpy(ack_buf + pos, "]}", 3);
+    return pos + 2;
+}
+
+static size_t pack_cbor(const command_ack_t *acks, size_t count)
+{
+    cbor_lite_writer_t w;
+
+    cbor_lite_writer_init(&w, ack_buf, ACK_PAYLOAD_MAX);
+    cbor_lite_put_map(&w, 1);
+    cbor_lite_put_cstr(&w, "acks");
+    cbor_lite_put_array(&w, count);
+    for (size_t i = 0; i < count; i++) {
+        cbor_lite_put_array(&w, 3);
+        cbor_lite_put_uint(&w, acks[i].seq);
+        cbor_lite_put_int(&w, acks[i].status);
+        cbor_lite_put_uint(&w, acks[i].us);
+    }
+    return w.overflow ? 0 : w.len;
+}
+
+size_t command_ack_flush(void)
+{
+    command_ack_t batch[COMMAND_ACK_BATCH];
+    size_t published = 0;
+
+    if (ack_publish == NULL) {
+        return 0;
+    }
+    for (;;) {
+        size_t count = 0;
+        portENTER_CRITICAL(&ack_lock);
+        while (count < COMMAND_ACK_BATCH && ack_count > 0) {
+            batch[count++] = ack_ring[ack_head];
+            ack_head = (ack_head + 1) % COMMAND_ACK_QUEUE_LEN;
+            ack_count--;
+        }
+        portEXIT_CRITICAL(&ack_lock);
+        if (count == 0) {
+            break;
+        }
+
+        size_t len = ack_config.encoding == TELEMETRY_ENCODING_CBOR ? pack_cbor(batch, count)
+                                                                    : pack_json(batch, count);
+        int msg_id = ack_publish("ack", ack_buf, len, sizeof(ack_buf));
+        TRACE(CMD_ACKED, count, msg_id);
+
+        portENTER_CRITICAL(&ack_lock);
+        if (msg_id < 0) {
+            stats.publish_failures++;
+        } else {
+            stats.acked += count;
+        }
+        portEXIT_CRITICAL(&ack_lock);
+        if (msg_id < 0) {
+            // The backend times the command out; do not spin on a full offline queue.
+            break;
+        }
+        published += count;
+    }
+    return published;
+}
+
+static void command_ack_task(void *arg)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        command_ack_flush();
+    }
+}
+
+esp_err_t command_ack_start(void)
+{
+    if (ack_task_handle || ack_publish == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    ack_task_handle = xTaskCreateStatic(command_ack_task, "cmd_ack", CONFIG_COMMAND_ACK_TASK_STACK_SIZE, NULL,
+                                        CONFIG_COMMAND_ACK_TASK_PRIORITY, ack_task_stack, &ack_task_tcb);
+    if (ack_task_handle == NULL) {
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG_ACK, "Command acks started: dedup window %d, queue %d", COMMAND_ACK_DEDUP_WINDOW,
+             COMMAND_ACK_QUEUE_LEN);
+    return ESP_OK;
+}
+
+void command_ack_get_stats(command_ack_stats_t *out)
+{
+    portENTER_CRITICAL(&ack_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&ack_lock);
+}
@@ -0,0 +1,176 @@
+#ifndef COMMAND_ACK_H
+#define COMMAND_ACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "telemetry.h"
+
+/**
+ * Command sequence numbers, duplicate suppression and acks.
+ *
+ * Commands are subscribed at QoS 1, so the broker may deliver one twice
+ * (e.g. when the PUBACK was lost in a reconnect). The backend puts a
+ * sequence number into each command payload ("seq": n, n > 0). The last
+ * CONFIG_COMMAND_ACK_DEDUP_WINDOW numbers are kept in a fixed ring; a
+ * command whose number is in it is not run again, only acked again.
+ * Commands without "seq" are run as before and not acked.
+ *
+ * Every sequenced command is acked on home/devices/<id>/ack once it took
+ * effect: when the actuator task has driven the outputs for commands it
+ * queued, right after the handler otherwise. Acks are batched by a small
+ * task (JSON or CBOR, same keys):
+ *
+ *   {"acks":[[<seq>,<status>,<receive to actuate us>],...]}
+ *
+ * status is 0 when the command was applied, COMMAND_ACK_DUPLICATE when it
+ * was a redelivery, otherwise the esp_err_t of the failure.
+ *
+ * The ring only lives in RAM: a command redelivered after a reboot runs
+ * again.
+ *
+ * Commands may also arrive outside the broker (hal/lan_listener.h), on a
+ * path where a recorded frame can be sent again later. Those must carry a
+ * number close to the newest one run, see command_ack_is_recent().
+ */
+
+#define COMMAND_ACK_DEDUP_WINDOW CONFIG_COMMAND_ACK_DEDUP_WINDOW
+#define COMMAND_ACK_QUEUE_LEN CONFIG_COMMAND_ACK_QUEUE_LEN
+#define COMMAND_ACK_BATCH 8             // Acks per published message
+#define COMMAND_ACK_DUPLICATE 1         // Not an esp_err_t value
+#define COMMAND_ACK_SEQ_MAX 0x7fffffff  // The backend wraps around to 1 after this
+
+/**
+ * @brief Publishes a batch of acks, same contract as telemetry_publish_fn_t.
+ */
+typedef int (*command_ack_publish_fn_t)(const char *subtopic, char *buf, size_t len, size_t buf_size);
+
+/**
+ * @brief A command whose ack is sent later, by whoever completes it.
+ *
+ * seq 0 means there is nothing to ack.
+ */
+typedef struct {
+    uint32_t seq;
+    int64_t rx_us;              // Time the command was received
+} command_ack_token_t;
+
+typedef struct {
+    telemetry_encoding_t encoding;  // Payload encoding of the acks
+} command_ack_config_t;
+
+#define COMMAND_ACK_CONFIG_DEFAULT() {                              \
+    .encoding = TELEMETRY_ENCODING_DEFAULT,                         \
+}
+
+typedef struct {
+    uint32_t sequenced;         // Commands received with a sequence number
+    uint32_t duplicates;        // Redeliveries that were not run again
+    uint32_t acked;             // Acks published
+    uint32_t dropped;           // Acks lost because the queue was full
+    uint32_t publish_failures;  // Batches the publish function rejected
+} command_ack_stats_t;
+
+/**
+ * @brief Clears the dedup window and the ack queue and sets the sink.
+ *
+ * Does not start the ack task.
+ *
+ * @param config Ack encoding.
+ * @param publish Function that sends a batch of acks.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a bad configuration.
+ */
+esp_err_t command_ack_init(const command_ack_config_t *config, command_ack_publish_fn_t publish);
+
+/**
+ * @brief Starts the task that publishes queued acks.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if already started or not initialized.
+ */
+esp_err_t command_ack_start(void);
+
+/**
+ * @brief Reads the sequence number of a command payload.
+ *
+ * @param data JSON or CBOR payload.
+ * @param len Length of data.
+ * @return The sequence number, 0 if the payload has none.
+ */
+uint32_t command_ack_get_seq(const char *data, size_t len);
+
+/**
+ * @brief Starts handling a sequenced command on the calling task.
+ *
+ * Duplicates are acked right away with COMMAND_ACK_DUPLICATE. Otherwise
+ * the number enters the dedup window and the command becomes the current
+ * one of the calling task until command_ack_end(). Only called with
+ * command dispatch serialized: on the MQTT task, or on the LAN listener
+ * task under the dispatch lock of network_mqtt_handler.c.
+ *
+ * @param seq Sequence number (> 0).
+ * @param rx_us Time the command was received.
+ * @return true if the command should run, false for a duplicate.
+ */
+bool command_ack_begin(uint32_t seq, int64_t rx_us);
+
+/**
+ * @brief Checks that a sequence number is close to the newest one run.
+ *
+ * Accepted are numbers from COMMAND_ACK_DEDUP_WINDOW below the newest up
+ * to max_ahead above it, wrapping like the backend counter. An older
+ * number could be a recorded frame sent again once it left the dedup
+ * window. Nothing is accepted before the first sequenced command since
+ * init, which has to come through the broker. Same calling rules as
+ * command_ack_begin().
+ *
+ * @param seq Sequence number of the command.
+ * @param max_ahead Largest distance above the newest number accepted.
+ * @return true if the command may run.
+ */
+bool command_ack_is_recent(uint32_t seq, uint32_t max_ahead);
+
+/**
+ * @brief Finishes the current command.
+ *
+ * Acks it with err unless a handler took it with command_ack_take().
+ *
+ * @param err Result of the dispatch.
+ */
+void command_ack_end(esp_err_t err);
+
+/**
+ * @brief Takes over the ack of the current command.
+ *
+ * For handlers that hand the command to another task: that task calls
+ * command_ack_complete() once the command took effect. Returns an empty
+ * token when called from another task than the one running the command,
+ * or a second time for the same command.
+ */
+command_ack_token_t command_ack_take(void);
+
+/**
+ * @brief Queues the ack of a taken command. Safe from any task.
+ *
+ * @param token Token from command_ack_take(); empty tokens are ignored.
+ * @param err ESP_OK if the command was applied, the error otherwise.
+ */
+void command_ack_complete(command_ack_token_t token, esp_err_t err);
+
+/**
+ * @brief Publishes queued acks, COMMAND_ACK_BATCH per message.
+ *
+ * Called by the ack task; exposed so the host benchmarks can drive it.
+ *
+ * @return Number of acks published.
+ */
+size_t command_ack_flush(void);
+
+/**
+ * @brief Gets the counters.
+ *
+ * @param out Destination for the counters.
+ */
+void command_ack_get_stats(command_ack_stats_t *out);
+
+#endif // COMMAND_ACK_H
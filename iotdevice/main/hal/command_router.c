@@ -0,0 +1,152 @@
+#include "command_router.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "esp_log.h"
+
+#define COMMAND_PREFIX_MAX_LEN 96
+#define COMMAND_TABLE_SIZE     (2 * CONFIG_COMMAND_ROUTER_MAX_COMMANDS)
+
+// Open addressing table, kept at most half full so probes stay short.
+typedef struct {
+    command_handler_t handler;
+    void *ctx;
+    uint32_t hash;
+    uint8_t suffix_len;
+    bool group;                 // Also accepted from group topics
+    char suffix[COMMAND_ROUTER_MAX_SUFFIX_LEN];
+} command_entry_t;
+
+static const char *TAG_ROUTER = "CMD_ROUTER";
+
+static command_entry_t command_table[COMMAND_TABLE_SIZE];
+static size_t command_count;
+static char command_prefix[COMMAND_PREFIX_MAX_LEN];
+static size_t command_prefix_len;
+static char subscribe_topic[COMMAND_PREFIX_MAX_LEN + 2];
+
+// FNV-1a, cheap enough to run over every incoming topic suffix.
+static uint32_t suffix_hash(const char *s, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)s[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static command_entry_t *find_slot(const char *suffix, size_t len, uint32_t hash)
+{
+    size_t idx = hash % COMMAND_TABLE_SIZE;
+    for (size_t probe = 0; probe < COMMAND_TABLE_SIZE; probe++) {
+        command_entry_t *entry = &command_table[idx];
+        if (entry->handler == NULL) {
+            return entry;
+        }
+        if (entry->hash == hash && entry->suffix_len == len && memcmp(entry->suffix, suffix, len) == 0) {
+            return entry;
+        }
+        idx = (idx + 1) % COMMAND_TABLE_SIZE;
+    }
+    return NULL;
+}
+
+esp_err_t command_router_init(const char *device_id)
+{
+    int len = snprintf(command_prefix, sizeof(command_prefix), "home/devices/%s/command/", device_id);
+    if (len < 0 || len >= (int)sizeof(command_prefix)) {
+        ESP_LOGE(TAG_ROUTER, "Device ID too long for command prefix: %s", device_id);
+        command_prefix[0] = '\0';
+        command_prefix_len = 0;
+        return ESP_ERR_INVALID_ARG;
+    }
+    command_prefix_len = (size_t)len;
+    snprintf(subscribe_topic, sizeof(subscribe_topic), "%s#", command_prefix);
+
+    memset(command_table, 0, sizeof(command_table));
+    command_count = 0;
+    return ESP_OK;
+}
+
+static esp_err_t register_command(const char *suffix, command_handler_t handler, void *ctx, bool group)
+{
+    size_t len = suffix ? strlen(suffix) : 0;
+    if (handler == NULL || len == 0 || len > COMMAND_ROUTER_MAX_SUFFIX_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (command_count >= CONFIG_COMMAND_ROUTER_MAX_COMMANDS) {
+        ESP_LOGE(TAG_ROUTER, "Command table full, cannot register '%s'", suffix);
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint32_t hash = suffix_hash(suffix, len);
+    command_entry_t *entry = find_slot(suffix, len, hash);
+    if (entry == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (entry->handler != NULL) {
+        ESP_LOGE(TAG_ROUTER, "Command '%s' already registered", suffix);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    memcpy(entry->suffix, suffix, len);
+    entry->suffix_len = (uint8_t)len;
+    entry->hash = hash;
+    entry->ctx = ctx;
+    entry->group = group;
+    entry->handler = handler;
+    command_count++;
+    ESP_LOGI(TAG_ROUTER, "Registered command '%s'%s", suffix, group ? " (group)" : "");
+    return ESP_OK;
+}
+
+esp_err_t command_router_register(const char *suffix, command_handler_t handler, void *ctx)
+{
+    return register_command(suffix, handler, ctx, false);
+}
+
+esp_err_t command_router_register_group(const char *suffix, command_handler_t handler, void *ctx)
+{
+    return register_command(suffix, handler, ctx, true);
+}
+
+const char *command_router_get_subscribe_topic(void)
+{
+    return subscribe_topic;
+}
+
+esp_err_t command_router_dispatch(const char *topic, size_t topic_len, const char *data, size_t data_len)
+{
+    if (command_prefix_len == 0 || topic_len <= command_prefix_len ||
+        memcmp(topic, command_prefix, command_prefix_len) != 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const char *suffix = topic + command_prefix_len;
+    size_t suffix_len = topic_len - command_prefix_len;
+    if (suffix_len > COMMAND_ROUTER_MAX_SUFFIX_LEN) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    command_entry_t *entry = find_slot(suffix, suffix_len, suffix_hash(suffix, suffix_len));
+    if (entry == NULL || entry->handler == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return entry->handler(data, data_len, entry->ctx);
+}
+
+esp_err_t command_router_dispatch_group(const char *command, size_t command_len, const char *data, size_t data_len)
+{
+    if (command_len == 0 || command_len > COMMAND_ROUTER_MAX_SUFFIX_LEN) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    command_entry_t *entry = find_slot(command, command_len, suffix_hash(command, command_len));
+    if (entry == NULL || entry->handler == NULL || !entry->group) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return entry->handler(data, data_len, entry->ctx);
+}
@@ -0,0 +1,87 @@
+#ifndef COMMAND_ROUTER_H
+#define COMMAND_ROUTER_H
+
+#include <stddef.h>
+#include "esp_err.h"
+
+#define COMMAND_ROUTER_MAX_SUFFIX_LEN 32 // Longest command name after .../command/
+
+/**
+ * @brief Handler invoked for a command topic.
+ *
+ * @param data Payload of the MQTT message (not null terminated).
+ * @param data_len Length of the payload.
+ * @param ctx Context pointer given at registration.
+ * @return ESP_OK if the command was accepted, an error code otherwise.
+ */
+typedef esp_err_t (*command_handler_t)(const char *data, size_t data_len, void *ctx);
+
+/**
+ * @brief Initializes the router for the given device.
+ *
+ * Builds the "home/devices/<id>/command/" prefix once and clears the
+ * command table. Must be called before any command is registered.
+ *
+ * @param device_id Device ID used in the topic namespace.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the prefix does not fit.
+ */
+esp_err_t command_router_init(const char *device_id);
+
+/**
+ * @brief Registers a handler for a command topic suffix.
+ *
+ * Registration is not thread safe and is meant to happen at startup,
+ * before the MQTT client delivers data.
+ *
+ * @param suffix Command name, e.g. "setLed" for home/devices/<id>/command/setLed.
+ * @param handler Function called when the command arrives.
+ * @param ctx Pointer passed back to the handler.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a bad suffix,
+ *         ESP_ERR_INVALID_STATE if the suffix is already registered,
+ *         ESP_ERR_NO_MEM if the table is full.
+ */
+esp_err_t command_router_register(const char *suffix, command_handler_t handler, void *ctx);
+
+/**
+ * @brief Registers a handler that also accepts the command from group topics.
+ *
+ * Same as command_router_register(); the command is additionally routed by
+ * command_router_dispatch_group(). Membership, configuration and debug
+ * commands should stay device only.
+ */
+esp_err_t command_router_register_group(const char *suffix, command_handler_t handler, void *ctx);
+
+/**
+ * @brief Gets the wildcard topic covering all registered commands.
+ *
+ * @return "home/devices/<id>/command/#", valid for the lifetime of the program.
+ */
+const char *command_router_get_subscribe_topic(void);
+
+/**
+ * @brief Routes an incoming message to its handler.
+ *
+ * Runs in O(topic length) and does not allocate. The topic has to match
+ * the command prefix and a registered suffix exactly.
+ *
+ * @param topic Topic of the message (not null terminated).
+ * @param topic_len Length of the topic.
+ * @param data Payload of the message.
+ * @param data_len Length of the payload.
+ * @return The handler result, or ESP_ERR_NOT_FOUND if no handler matches.
+ */
+esp_err_t command_router_dispatch(const char *topic, size_t topic_len, const char *data, size_t data_len);
+
+/**
+ * @brief Routes a command received on a group topic to its handler.
+ *
+ * @param command Command name, the topic part after home/groups/<group>/command/.
+ * @param command_len Length of the command name.
+ * @param data Payload of the message.
+ * @param data_len Length of the payload.
+ * @return The handler result, or ESP_ERR_NOT_FOUND if no handler was
+ *         registered for the command with command_router_register_group().
+ */
+esp_err_t command_router_dispatch_group(const char *command, size_t command_len, const char *data, size_t data_len);
+
+#endif // COMMAND_ROUTER_H
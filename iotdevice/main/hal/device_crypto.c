@@ -0,0 +1,142 @@
+#include "device_crypto.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_random.h"
+#include "mbedtls/sha256.h"
+
+static const char *TAG_CRYPTO = "DEVICE_CRYPTO";
+static const char hex_digits[] = "0123456789abcdef";
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Decodes 2 * len hex characters. dst may alias src as long as dst <= src.
+static bool hex_decode(uint8_t *dst, const char *src, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        int hi = hex_value(src[2 * i]);
+        int lo = hex_value(src[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        dst[i] = (uint8_t)((hi << 4) | lo);
+    }
+    return true;
+}
+
+static void hex_encode(char *dst, const uint8_t *src, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        dst[2 * i] = hex_digits[src[i] >> 4];
+        dst[2 * i + 1] = hex_digits[src[i] & 0x0f];
+    }
+}
+
+esp_err_t device_crypto_init(device_crypto_t *ctx, const char *device_key, size_t key_len)
+{
+    uint8_t key[32];
+
+    if (device_key == NULL || key_len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // Same derivation as EncryptionService.getDerivedKey: SHA-256 of the key string.
+    if (mbedtls_sha256((const unsigned char *)device_key, key_len, key, 0) != 0) {
+        return ESP_FAIL;
+    }
+
+    mbedtls_gcm_init(&ctx->gcm);
+    int ret = mbedtls_gcm_setkey(&ctx->gcm, MBEDTLS_CIPHER_ID_AES, key, 256);
+    memset(key, 0, sizeof(key));
+    if (ret != 0) {
+        ESP_LOGE(TAG_CRYPTO, "mbedtls_gcm_setkey failed: -0x%x", -ret);
+        mbedtls_gcm_free(&ctx->gcm);
+        return ESP_FAIL;
+    }
+    ctx->initialized = 1;
+    return ESP_OK;
+}
+
+void device_crypto_free(device_crypto_t *ctx)
+{
+    if (ctx->initialized) {
+        mbedtls_gcm_free(&ctx->gcm);
+        ctx->initialized = 0;
+    }
+}
+
+esp_err_t device_crypto_decrypt_in_place(device_crypto_t *ctx, char *frame, size_t frame_len, size_t *plain_len)
+{
+    uint8_t iv[DEVICE_CRYPTO_IV_LEN];
+    uint8_t tag[DEVICE_CRYPTO_TAG_LEN];
+    const size_t tag_pos = 2 * DEVICE_CRYPTO_IV_LEN + 1;
+
+    if (!ctx->initialized || frame_len < DEVICE_CRYPTO_HEADER_LEN ||
+        frame[tag_pos - 1] != ':' || frame[DEVICE_CRYPTO_HEADER_LEN - 1] != ':' ||
+        (frame_len - DEVICE_CRYPTO_HEADER_LEN) % 2 != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t cipher_len = (frame_len - DEVICE_CRYPTO_HEADER_LEN) / 2;
+    if (!hex_decode(iv, frame, sizeof(iv)) || !hex_decode(tag, frame + tag_pos, sizeof(tag)) ||
+        !hex_decode((uint8_t *)frame, frame + DEVICE_CRYPTO_HEADER_LEN, cipher_len)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int ret = mbedtls_gcm_auth_decrypt(&ctx->gcm, cipher_len, iv, sizeof(iv), NULL, 0, tag, sizeof(tag),
+                                       (const unsigned char *)frame, (unsigned char *)frame);
+    if (ret != 0) {
+        ESP_LOGW(TAG_CRYPTO, "Decryption failed: -0x%x", -ret);
+        return ret == MBEDTLS_ERR_GCM_AUTH_FAILED ? ESP_ERR_INVALID_CRC : ESP_FAIL;
+    }
+    *plain_len = cipher_len;
+    return ESP_OK;
+}
+
+esp_err_t device_crypto_encrypt_in_place(device_crypto_t *ctx, char *buf, size_t plain_len, size_t buf_size, size_t *frame_len)
+{
+    uint8_t iv[DEVICE_CRYPTO_IV_LEN];
+    uint8_t tag[DEVICE_CRYPTO_TAG_LEN];
+
+    if (!ctx->initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (buf_size < DEVICE_CRYPTO_FRAME_SIZE(plain_len)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    esp_fill_random(iv, sizeof(iv));
+    int ret = mbedtls_gcm_crypt_and_tag(&ctx->gcm, MBEDTLS_GCM_ENCRYPT, plain_len, iv, sizeof(iv), NULL, 0,
+                                        (const unsigned char *)buf, (unsigned char *)buf, sizeof(tag), tag);
+    if (ret != 0) {
+        ESP_LOGE(TAG_CRYPTO, "Encryption failed: -0x%x", -ret);
+        return ESP_FAIL;
+    }
+
+    // Expand the ciphertext to hex from the back so no byte is overwritten before it is read.
+    for (size_t i = plain_len; i-- > 0;) {
+        uint8_t b = (uint8_t)buf[i];
+        buf[DEVICE_CRYPTO_HEADER_LEN + 2 * i] = hex_digits[b >> 4];
+        buf[DEVICE_CRYPTO_HEADER_LEN + 2 * i + 1] = hex_digits[b & 0x0f];
+    }
+    hex_encode(buf, iv, sizeof(iv));
+    buf[2 * DEVICE_CRYPTO_IV_LEN] = ':';
+    hex_encode(buf + 2 * DEVICE_CRYPTO_IV_LEN + 1, tag, sizeof(tag));
+    buf[DEVICE_CRYPTO_HEADER_LEN - 1] = ':';
+
+    *frame_len = DEVICE_CRYPTO_HEADER_LEN + 2 * plain_len;
+    buf[*frame_len] = '\0';
+    return ESP_OK;
+}
@@ -0,0 +1,85 @@
+#ifndef DEVICE_CRYPTO_H
+#define DEVICE_CRYPTO_H
+
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "mbedtls/gcm.h"
+
+/**
+ * Payload encryption compatible with the backend EncryptionService:
+ * AES-256-GCM with key = SHA-256(device aesKey), a random 96-bit IV and
+ * frames of the form "<iv hex>:<tag hex>:<ciphertext hex>".
+ *
+ * On ESP32 targets mbedTLS runs the AES rounds on the hardware engine
+ * (CONFIG_MBEDTLS_HARDWARE_AES). The GCM key schedule is computed once in
+ * device_crypto_init() and reused for every message.
+ */
+
+#define DEVICE_CRYPTO_IV_LEN     12
+#define DEVICE_CRYPTO_TAG_LEN    16
+#define DEVICE_CRYPTO_HEADER_LEN (2 * DEVICE_CRYPTO_IV_LEN + 1 + 2 * DEVICE_CRYPTO_TAG_LEN + 1)
+
+// Buffer size needed to encrypt plain_len bytes in place (frame plus terminator).
+#define DEVICE_CRYPTO_FRAME_SIZE(plain_len) (DEVICE_CRYPTO_HEADER_LEN + 2 * (plain_len) + 1)
+
+// Size of a buffer handed to the publish path for plain_len bytes, which
+// encrypts in place when CONFIG_DEVICE_PAYLOAD_ENCRYPTION is set.
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+#define DEVICE_CRYPTO_FRAME_LEN(plain_len) DEVICE_CRYPTO_FRAME_SIZE(plain_len)
+#else
+#define DEVICE_CRYPTO_FRAME_LEN(plain_len) ((plain_len) + 1)
+#endif
+
+typedef struct {
+    mbedtls_gcm_context gcm;
+    int initialized;
+} device_crypto_t;
+
+/**
+ * @brief Derives the AES key from the device key and sets up the GCM context.
+ *
+ * A context is not thread safe; use one per task or guard it with a lock.
+ *
+ * @param ctx Context to initialize.
+ * @param device_key Device aesKey as stored in the backend.
+ * @param key_len Length of device_key.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for an empty key, ESP_FAIL on mbedTLS errors.
+ */
+esp_err_t device_crypto_init(device_crypto_t *ctx, const char *device_key, size_t key_len);
+
+/**
+ * @brief Releases the GCM context.
+ */
+void device_crypto_free(device_crypto_t *ctx);
+
+/**
+ * @brief Decrypts a frame in place.
+ *
+ * The plaintext is written to the start of the frame buffer.
+ *
+ * @param ctx Initialized context.
+ * @param frame "<iv>:<tag>:<ciphertext>" text, overwritten with the plaintext.
+ * @param frame_len Length of the frame.
+ * @param plain_len Set to the plaintext length.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a malformed frame,
+ *         ESP_ERR_INVALID_CRC if authentication fails.
+ */
+esp_err_t device_crypto_decrypt_in_place(device_crypto_t *ctx, char *frame, size_t frame_len, size_t *plain_len);
+
+/**
+ * @brief Encrypts a buffer in place into a frame.
+ *
+ * The buffer must hold DEVICE_CRYPTO_FRAME_SIZE(plain_len) bytes. The frame
+ * is null terminated.
+ *
+ * @param ctx Initialized context.
+ * @param buf Plaintext on input, frame on output.
+ * @param plain_len Length of the plaintext.
+ * @param buf_size Size of buf.
+ * @param frame_len Set to the frame length (without terminator).
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if buf is too small, ESP_FAIL on mbedTLS errors.
+ */
+esp_err_t device_crypto_encrypt_in_place(device_crypto_t *ctx, char *buf, size_t plain_len, size_t buf_size, size_t *frame_len);
+
+#endif // DEVICE_CRYPTO_H
@@ -0,0 +1,346 @@
+#include "device_groups.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "device_nvs.h"
+#include "json_lite.h"
+#include "cbor_lite.h"
+#include "trace_log.h"
+
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+#include "device_crypto.h"
+#endif
+
+#define GROUP_NVS_NAMESPACE "groups"
+#define GROUP_NVS_KEY "members"
+#define GROUP_TOPIC_PREFIX "home/groups/"
+#define GROUP_TOPIC_COMMAND "/command/"
+#define GROUP_TOPIC_MAX_LEN (sizeof(GROUP_TOPIC_PREFIX) + DEVICE_GROUPS_NAME_MAX_LEN + sizeof(GROUP_TOPIC_COMMAND) + 1)
+
+// Stored as is in NVS, one record per group.
+typedef struct {
+    uint8_t name_len;
+    uint8_t key_len;
+    char name[DEVICE_GROUPS_NAME_MAX_LEN];
+    char key[DEVICE_GROUPS_KEY_MAX_LEN];
+} group_record_t;
+
+typedef struct {
+    group_record_t record;
+    char topic[GROUP_TOPIC_MAX_LEN];
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+    device_crypto_t crypto;
+#endif
+} group_t;
+
+static const char *TAG_GROUPS = "DEVICE_GROUPS";
+
+static device_groups_subscribe_fn_t groups_subscribe;
+// Fixed slots, a slot is in use when its name is set. Groups never move,
+// so their GCM contexts are never copied.
+static group_t groups[DEVICE_GROUPS_MAX];
+static size_t group_count;
+static device_groups_stats_t stats;
+
+// Names end up in topics: no separators, no wildcards.
+static bool name_valid(const char *name, size_t len)
+{
+    if (len == 0 || len > DEVICE_GROUPS_NAME_MAX_LEN) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (name[i] == '/' || name[i] == '+' || name[i] == '#' || (uint8_t)name[i] < 0x20) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int find_group(const char *name, size_t len)
+{
+    for (size_t i = 0; i < DEVICE_GROUPS_MAX; i++) {
+        if (groups[i].record.name_len == len && memcmp(groups[i].record.name, name, len) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// Builds the topic and key schedule of a group from its record.
+static esp_err_t group_setup(group_t *group)
+{
+    char *topic = group->topic;
+    memcpy(topic, GROUP_TOPIC_PREFIX, sizeof(GROUP_TOPIC_PREFIX) - 1);
+    topic += sizeof(GROUP_TOPIC_PREFIX) - 1;
+    memcpy(topic, group->record.name, group->record.name_len);
+    topic += group->record.name_len;
+    memcpy(topic, GROUP_TOPIC_COMMAND "#", sizeof(GROUP_TOPIC_COMMAND "#"));
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+    device_crypto_free(&group->crypto);
+    return device_crypto_init(&group->crypto, group->record.key, group->record.key_len);
+#else
+    return ESP_OK;
+#endif
+}
+
+static void group_clear(group_t *group)
+{
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+    device_crypto_free(&group->crypto);
+#endif
+    memset(group, 0, sizeof(*group));
+}
+
+static esp_err_t groups_persist(void)
+{
+    group_record_t records[DEVICE_GROUPS_MAX];
+    nvs_handle_t nvs;
+    size_t count = 0;
+
+    for (size_t i = 0; i < DEVICE_GROUPS_MAX; i++) {
+        if (groups[i].record.name_len) {
+            records[count++] = groups[i].record;
+        }
+    }
+    esp_err_t err = device_nvs_handle(GROUP_NVS_NAMESPACE, &nvs);
+    if (err == ESP_OK) {
+        err = count ? nvs_set_blob(nvs, GROUP_NVS_KEY, records, count * sizeof(records[0]))
+                    : nvs_erase_key(nvs, GROUP_NVS_KEY);
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            err = ESP_OK;
+        }
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+    }
+    memset(records, 0, sizeof(records));
+    return err;
+}
+
+esp_err_t device_groups_init(device_groups_subscribe_fn_t subscribe)
+{
+    group_record_t records[DEVICE_GROUPS_MAX];
+    size_t len = sizeof(records);
+    nvs_handle_t nvs;
+    esp_err_t err = ESP_OK;
+
+    groups_subscribe = subscribe;
+    for (size_t i = 0; i < DEVICE_GROUPS_MAX; i++) {
+        group_clear(&groups[i]);
+    }
+    group_count = 0;
+    memset(&stats, 0, sizeof(stats));
+
+    if (device_nvs_handle(GROUP_NVS_NAMESPACE, &nvs) != ESP_OK || nvs_get_blob(nvs, GROUP_NVS_KEY, records, &len) != ESP_OK) {
+        len = 0; // No groups stored
+    }
+
+    for (size_t i = 0; i < len / sizeof(records[0]) && err == ESP_OK; i++) {
+        const group_record_t *rec = &records[i];
+        if (!name_valid(rec->name, rec->name_len) || rec->key_len > DEVICE_GROUPS_KEY_MAX_LEN ||
+            find_group(rec->name, rec->name_len) >= 0) {
+            continue;
+        }
+        group_t *group = &groups[group_count];
+        group->record = *rec;
+        err = group_setup(group);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG_GROUPS, "Failed to set up group %.*s: %s", rec->name_len, rec->name, esp_err_to_name(err));
+            group_clear(group);
+        } else {
+            group_count++;
+        }
+    }
+    memset(records, 0, sizeof(records));
+    stats.members = group_count;
+    ESP_LOGI(TAG_GROUPS, "Member of %u groups", (unsigned)group_count);
+    return err;
+}
+
+esp_err_t device_groups_join(const char *name, size_t name_len, const char *key, size_t key_len)
+{
+    esp_err_t err = ESP_OK;
+    int index = -1;
+
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+    if (key == NULL || key_len == 0) {
+        err = ESP_ERR_INVALID_ARG;
+    }
+#else
+    key_len = 0;
+#endif
+    if (!name_valid(name, name_len) || key_len > DEVICE_GROUPS_KEY_MAX_LEN) {
+        err = ESP_ERR_INVALID_ARG;
+    }
+    if (err == ESP_OK) {
+        index = find_group(name, name_len);
+    }
+    bool added = index < 0;
+    if (err == ESP_OK && added) {
+        index = find_group("", 0); // First free slot
+        if (index < 0) {
+            err = ESP_ERR_NO_MEM;
+        }
+    }
+    if (err != ESP_OK) {
+        TRACE(GROUP_REJECTED, err);
+        return err;
+    }
+
+    group_t *group = &groups[index];
+    group_record_t previous = group->record;
+    memset(&group->record, 0, sizeof(group->record));
+    group->record.name_len = (uint8_t)name_len;
+    group->record.key_len = (uint8_t)key_len;
+    memcpy(group->record.name, name, name_len);
+    if (key_len) {
+        memcpy(group->record.key, key, key_len);
+    }
+    err = group_setup(group);
+    if (err == ESP_OK) {
+        err = groups_persist();
+    }
+    if (err != ESP_OK) {
+        if (added) {
+            group_clear(group);
+        } else {
+            group->record = previous; // Keep the old key
+            group_setup(group);
+        }
+        memset(&previous, 0, sizeof(previous));
+        TRACE(GROUP_REJECTED, err);
+        return err;
+    }
+    memset(&previous, 0, sizeof(previous));
+
+    int msg_id = 0;
+    if (added) {
+        group_count++;
+        if (groups_subscribe) {
+            msg_id = groups_subscribe(group->topic, true);
+        }
+    }
+    stats.joins++;
+    stats.members = group_count;
+    TRACE(GROUP_JOINED, index, msg_id);
+    return ESP_OK;
+}
+
+esp_err_t device_groups_leave(const char *name, size_t name_len)
+{
+    int index = name_len ? find_group(name, name_len) : -1;
+    if (index < 0) {
+        TRACE(GROUP_REJECTED, ESP_ERR_NOT_FOUND);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    group_t *group = &groups[index];
+    // Unsubscribed first: a leave that can be neither sent nor kept for
+    // the next connect would leave the subscription behind for good.
+    int msg_id = groups_subscribe ? groups_subscribe(group->topic, false) : 0;
+    if (msg_id < 0) {
+        stats.leaves_refused++;
+        TRACE(GROUP_REJECTED, ESP_ERR_NO_MEM);
+        return ESP_ERR_NO_MEM;
+    }
+    uint8_t saved_len = group->record.name_len;
+    group->record.name_len = 0; // Left out of the stored list
+    esp_err_t err = groups_persist();
+    group->record.name_len = saved_len;
+    if (err != ESP_OK) {
+        if (groups_subscribe) {
+            groups_subscribe(group->topic, true); // Still a member
+        }
+        TRACE(GROUP_REJECTED, err);
+        return err;
+    }
+    group_clear(group);
+    group_count--;
+    stats.leaves++;
+    stats.members = group_count;
+    TRACE(GROUP_LEFT, index, msg_id);
+    return ESP_OK;
+}
+
+// Reads a string member of a JSON or CBOR command.
+static esp_err_t get_string(const char *data, size_t data_len, const char *key, const char **str, size_t *len)
+{
+    return cbor_lite_is_cbor(data, data_len) ? cbor_lite_get_string(data, data_len, key, str, len)
+                                             : json_lite_get_string(data, data_len, key, str, len);
+}
+
+esp_err_t device_groups_command_handler(const char *data, size_t data_len, void *ctx)
+{
+    const char *name = NULL;
+    const char *key = NULL;
+    size_t name_len = 0;
+    size_t key_len = 0;
+
+    if (get_string(data, data_len, "join", &name, &name_len) == ESP_OK) {
+        get_string(data, data_len, "key", &key, &key_len);
+        return device_groups_join(name, name_len, key, key_len);
+    }
+    if (get_string(data, data_len, "leave", &name, &name_len) == ESP_OK) {
+        return device_groups_leave(name, name_len);
+    }
+    TRACE(GROUP_REJECTED, ESP_ERR_INVALID_ARG);
+    return ESP_ERR_INVALID_ARG;
+}
+
+size_t device_groups_count(void)
+{
+    return group_count;
+}
+
+const char *device_groups_get_topic(size_t index)
+{
+    return index < DEVICE_GROUPS_MAX && groups[index].record.name_len ? groups[index].topic : NULL;
+}
+
+int device_groups_match(const char *topic, size_t topic_len, size_t *command_off)
+{
+    const size_t prefix_len = sizeof(GROUP_TOPIC_PREFIX) - 1;
+    const size_t command_len = sizeof(GROUP_TOPIC_COMMAND) - 1;
+
+    if (group_count == 0 || topic_len <= prefix_len || memcmp(topic, GROUP_TOPIC_PREFIX, prefix_len) != 0) {
+        return -1;
+    }
+    const char *name = topic + prefix_len;
+    const char *end = memchr(name, '/', topic_len - prefix_len);
+    if (end == NULL) {
+        return -1;
+    }
+    size_t name_len = (size_t)(end - name);
+    size_t off = prefix_len + name_len + command_len;
+    if (off >= topic_len || memcmp(end, GROUP_TOPIC_COMMAND, command_len) != 0) {
+        return -1;
+    }
+    int index = find_group(name, name_len);
+    if (index >= 0) {
+        *command_off = off;
+        stats.messages++;
+    }
+    return index;
+}
+
+esp_err_t device_groups_decrypt_in_place(int index, char *frame, size_t frame_len, size_t *plain_len)
+{
+    if (index < 0 || index >= DEVICE_GROUPS_MAX || groups[index].record.name_len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+    esp_err_t err = device_crypto_decrypt_in_place(&groups[index].crypto, frame, frame_len, plain_len);
+    if (err != ESP_OK) {
+        stats.undecryptable++;
+    }
+    return err;
+#else
+    *plain_len = frame_len;
+    return ESP_OK;
+#endif
+}
+
+void device_groups_get_stats(device_groups_stats_t *out)
+{
+    *out = stats;
+}
@@ -0,0 +1,129 @@
+#ifndef DEVICE_GROUPS_H
+#define DEVICE_GROUPS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * Group membership of the device.
+ *
+ * The backend switches a room or a scene with one message on
+ * home/groups/<group>/command/<name> instead of one message per device.
+ * Group messages are encrypted with a key shared by the members, handed
+ * to each device (under its own key) when it joins. Memberships are kept
+ * in NVS and resubscribed on every connect.
+ *
+ * Membership commands and group messages both arrive on the MQTT task,
+ * so apart from device_groups_init(), called before the client starts,
+ * and device_groups_get_stats() the functions run on that task only.
+ */
+
+#define DEVICE_GROUPS_MAX CONFIG_DEVICE_GROUPS_MAX
+#define DEVICE_GROUPS_NAME_MAX_LEN 32
+#define DEVICE_GROUPS_KEY_MAX_LEN 64
+
+/**
+ * @brief Subscribes to or unsubscribes from a topic filter.
+ *
+ * @param topic Topic filter.
+ * @param subscribe true to subscribe, false to unsubscribe.
+ * @return Message ID, 0 if the change is left to the next connect, -1 on failure.
+ */
+typedef int (*device_groups_subscribe_fn_t)(const char *topic, bool subscribe);
+
+typedef struct {
+    uint32_t members;           // Groups the device is a member of
+    uint32_t joins;             // Groups joined (or rekeyed) since boot
+    uint32_t leaves;            // Groups left since boot
+    uint32_t leaves_refused;    // Leaves refused as the unsubscribe could not be sent or queued
+    uint32_t messages;          // Messages received on group topics
+    uint32_t undecryptable;     // Group messages that failed authentication
+} device_groups_stats_t;
+
+/**
+ * @brief Loads the memberships kept in NVS.
+ *
+ * NVS must be initialized.
+ *
+ * @param subscribe Function changing subscriptions when a group is joined or left.
+ * @return ESP_OK on success (with or without stored groups), or the error
+ *         setting up a group key.
+ */
+esp_err_t device_groups_init(device_groups_subscribe_fn_t subscribe);
+
+/**
+ * @brief Joins a group, or replaces the key of a group already joined.
+ *
+ * @param name Group name, the topic segment after home/groups/.
+ * @param name_len Length of the name.
+ * @param key Group key; ignored without CONFIG_DEVICE_PAYLOAD_ENCRYPTION.
+ * @param key_len Length of the key.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a bad name or key,
+ *         ESP_ERR_NO_MEM if DEVICE_GROUPS_MAX groups are joined, or the
+ *         NVS error storing the membership.
+ */
+esp_err_t device_groups_join(const char *name, size_t name_len, const char *key, size_t key_len);
+
+/**
+ * @brief Leaves a group.
+ *
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if not a member,
+ *         ESP_ERR_NO_MEM if the unsubscribe could be neither sent nor
+ *         queued, or the NVS error storing the membership.
+ */
+esp_err_t device_groups_leave(const char *name, size_t name_len);
+
+/**
+ * @brief Handler for home/devices/<id>/command/groups (command_handler_t).
+ *
+ * Payloads, JSON or CBOR: {"join": "<group>", "key": "<group key>"} joins
+ * a group or replaces its key, {"leave": "<group>"} leaves it. Sent under
+ * the device key, so the group key is never on the wire in clear.
+ *
+ * @return ESP_ERR_INVALID_ARG for a payload with neither member, otherwise
+ *         the result of device_groups_join() or device_groups_leave().
+ */
+esp_err_t device_groups_command_handler(const char *data, size_t data_len, void *ctx);
+
+/**
+ * @brief Gets the number of groups joined.
+ */
+size_t device_groups_count(void);
+
+/**
+ * @brief Gets the subscription of a group slot.
+ *
+ * @param index Slot, below DEVICE_GROUPS_MAX.
+ * @return "home/groups/<group>/command/#", or NULL for an unused slot.
+ */
+const char *device_groups_get_topic(size_t index);
+
+/**
+ * @brief Checks whether a topic is a command of a group the device is in.
+ *
+ * @param topic Topic of the message (not null terminated).
+ * @param topic_len Length of the topic.
+ * @param command_off Set to the offset of the command name in the topic.
+ * @return Group slot, or -1 if the topic is not a command of a joined group.
+ */
+int device_groups_match(const char *topic, size_t topic_len, size_t *command_off);
+
+/**
+ * @brief Decrypts a group message in place with the group key.
+ *
+ * Same contract as device_crypto_decrypt_in_place().
+ *
+ * @param index Group slot returned by device_groups_match().
+ */
+esp_err_t device_groups_decrypt_in_place(int index, char *frame, size_t frame_len, size_t *plain_len);
+
+/**
+ * @brief Gets the counters.
+ *
+ * @param out Destination for the counters.
+ */
+void device_groups_get_stats(device_groups_stats_t *out);
+
+#endif // DEVICE_GROUPS_H
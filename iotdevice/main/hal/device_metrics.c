@@ -0,0 +1,246 @@
+#include "device_metrics.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "cbor_lite.h"
+#include "trace_log.h"
+#include "device_crypto.h"
+
+#define METRICS_BUF_SIZE DEVICE_CRYPTO_FRAME_LEN(CONFIG_DEVICE_METRICS_PAYLOAD_MAX)
+
+// Payload keys, in enum order.
+static const char *const counter_keys[METRIC_COUNTER_COUNT] = {
+    [METRIC_MSG_IN] = "msgIn",
+    [METRIC_MSG_OUT] = "msgOut",
+    [METRIC_MSG_QUEUED] = "msgQueued",
+    [METRIC_PUBLISH_FAILURES] = "publishFailures",
+    [METRIC_UNDECRYPTABLE] = "undecryptable",
+    [METRIC_COMMAND_FAILURES] = "commandFailures",
+    [METRIC_RECONNECTS] = "reconnects",
+    [METRIC_WIFI_DISCONNECTS] = "wifiDisconnects",
+    [METRIC_DUPLICATES] = "duplicates",
+    [METRIC_LAN_IN] = "lanIn",
+    [METRIC_TLS_RESUMED] = "tlsResumed",
+};
+
+static const char *const gauge_keys[METRIC_GAUGE_COUNT] = {
+    [METRIC_HEAP_FREE] = "heapFree",
+    [METRIC_HEAP_MIN] = "heapMin",
+    [METRIC_HEAP_LARGEST] = "heapLargest",
+    [METRIC_HEAP_BLOCKS] = "heapBlocks",
+    [METRIC_RSSI] = "rssi",
+    [METRIC_ACTUATOR_QUEUE] = "actuatorQueue",
+    [METRIC_OFFLINE_QUEUE] = "offlineQueueBytes",
+};
+
+static const char *const histogram_keys[METRIC_HISTOGRAM_COUNT] = {
+    [METRIC_DISPATCH_US] = "dispatchUs",
+    [METRIC_PUBLISH_US] = "publishUs",
+    [METRIC_ACTUATE_US] = "actuateUs",
+    [METRIC_TLS_CONNECT_US] = "tlsConnectUs",
+};
+
+static const char *TAG_METRICS = "DEVICE_METRICS";
+
+device_metrics_t device_metrics;
+
+static device_metrics_config_t metrics_config;
+static device_metrics_sample_fn_t metrics_sample;
+static device_metrics_publish_fn_t metrics_publish;
+static bool period_started;
+static uint32_t last_snapshot_ms;
+static char snapshot_buf[METRICS_BUF_SIZE];
+static device_metrics_stats_t stats;
+
+static StaticTask_t metrics_task_tcb;
+static StackType_t metrics_task_stack[CONFIG_DEVICE_METRICS_TASK_STACK_SIZE];
+static TaskHandle_t metrics_task_handle;
+
+esp_err_t device_metrics_init(const device_metrics_config_t *config, device_metrics_sample_fn_t sample,
+                              device_metrics_publish_fn_t publish)
+{
+    if (config == NULL || publish == NULL || config->period_ms == 0 ||
+        (config->encoding != TELEMETRY_ENCODING_JSON && config->encoding != TELEMETRY_ENCODING_CBOR)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    metrics_config = *config;
+    metrics_sample = sample;
+    metrics_publish = publish;
+    period_started = false;
+    for (size_t i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        atomic_store(&device_metrics.counters[i], 0);
+    }
+    for (size_t i = 0; i < METRIC_GAUGE_COUNT; i++) {
+        atomic_store(&device_metrics.gauges[i], 0);
+    }
+    for (size_t i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+        atomic_store(&device_metrics.sums[i], 0);
+        for (size_t b = 0; b < DEVICE_METRICS_BUCKETS; b++) {
+            atomic_store(&device_metrics.buckets[i][b], 0);
+        }
+    }
+    memset(&stats, 0, sizeof(stats));
+    return ESP_OK;
+}
+
+// Copies a histogram and returns the number of buckets up to the last non-empty one.
+static size_t read_histogram(size_t id, uint32_t *sum, uint32_t buckets[DEVICE_METRICS_BUCKETS])
+{
+    size_t used = 0;
+    *sum = atomic_load_explicit(&device_metrics.sums[id], memory_order_relaxed);
+    for (size_t b = 0; b < DEVICE_METRICS_BUCKETS; b++) {
+        buckets[b] = atomic_load_explicit(&device_metrics.buckets[id][b], memory_order_relaxed);
+        if (buckets[b]) {
+            used = b + 1;
+        }
+    }
+    return used;
+}
+
+static bool append(char *buf, size_t size, size_t *pos, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf + *pos, size - *pos, fmt, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= size - *pos) {
+        return false;
+    }
+    *pos += (size_t)n;
+    return true;
+}
+
+static size_t pack_json(uint32_t now_ms, char *buf, size_t size)
+{
+    uint32_t buckets[DEVICE_METRICS_BUCKETS];
+    uint32_t sum;
+    size_t pos = 0;
+    bool ok = append(buf, size, &pos, "{\"up\":%" PRIu32, now_ms);
+
+    for (size_t i = 0; ok && i < METRIC_COUNTER_COUNT; i++) {
+        ok = append(buf, size, &pos, ",\"%s\":%" PRIu32, counter_keys[i],
+                    (uint32_t)atomic_load_explicit(&device_metrics.counters[i], memory_order_relaxed));
+    }
+    for (size_t i = 0; ok && i < METRIC_GAUGE_COUNT; i++) {
+        ok = append(buf, size, &pos, ",\"%s\":%" PRId32, gauge_keys[i],
+                    (int32_t)atomic_load_explicit(&device_metrics.gauges[i], memory_order_relaxed));
+    }
+    for (size_t i = 0; ok && i < METRIC_HISTOGRAM_COUNT; i++) {
+        size_t used = read_histogram(i, &sum, buckets);
+        ok = append(buf, size, &pos, ",\"%s\":[%" PRIu32, histogram_keys[i], sum);
+        for (size_t b = 0; ok && b < used; b++) {
+            ok = append(buf, size, &pos, ",%" PRIu32, buckets[b]);
+        }
+        ok = ok && append(buf, size, &pos, "]");
+    }
+    ok = ok && append(buf, size, &pos, "}");
+    return ok ? pos : 0;
+}
+
+static size_t pack_cbor(uint32_t now_ms, char *buf, size_t size)
+{
+    uint32_t buckets[DEVICE_METRICS_BUCKETS];
+    uint32_t sum;
+    cbor_lite_writer_t w;
+
+    cbor_lite_writer_init(&w, buf, size);
+    cbor_lite_put_map(&w, 1 + METRIC_COUNTER_COUNT + METRIC_GAUGE_COUNT + METRIC_HISTOGRAM_COUNT);
+    cbor_lite_put_cstr(&w, "up");
+    cbor_lite_put_uint(&w, now_ms);
+    for (size_t i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        cbor_lite_put_cstr(&w, counter_keys[i]);
+        cbor_lite_put_uint(&w, atomic_load_explicit(&device_metrics.counters[i], memory_order_relaxed));
+    }
+    for (size_t i = 0; i < METRIC_GAUGE_COUNT; i++) {
+        cbor_lite_put_cstr(&w, gauge_keys[i]);
+        cbor_lite_put_int(&w, atomic_load_explicit(&device_metrics.gauges[i], memory_order_relaxed));
+    }
+    for (size_t i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+        size_t used = read_histogram(i, &sum, buckets);
+        cbor_lite_put_cstr(&w, histogram_keys[i]);
+        cbor_lite_put_array(&w, 1 + used);
+        cbor_lite_put_uint(&w, sum);
+        for (size_t b = 0; b < used; b++) {
+            cbor_lite_put_uint(&w, buckets[b]);
+        }
+    }
+    return w.overflow ? 0 : w.len;
+}
+
+size_t device_metrics_snapshot(uint32_t now_ms, char *buf, size_t size)
+{
+    if (metrics_sample) {
+        metrics_sample();
+    }
+    return metrics_config.encoding == TELEMETRY_ENCODING_CBOR ? pack_cbor(now_ms, buf, size)
+                                                              : pack_json(now_ms, buf, size);
+}
+
+static bool publish_snapshot(uint32_t now_ms)
+{
+    last_snapshot_ms = now_ms;
+    size_t len = device_metrics_snapshot(now_ms, snapshot_buf, CONFIG_DEVICE_METRICS_PAYLOAD_MAX);
+    if (len == 0) {
+        ESP_LOGE(TAG_METRICS, "CONFIG_DEVICE_METRICS_PAYLOAD_MAX too small for a snapshot");
+        stats.publish_failures++;
+        return false;
+    }
+    stats.last_len = len;
+    int msg_id = metrics_publish("telemetry/metrics", snapshot_buf, len, sizeof(snapshot_buf));
+    TRACE(METRICS_SNAPSHOT, len, msg_id);
+    if (msg_id < 0) {
+        stats.publish_failures++;
+        return false;
+    }
+    stats.snapshots++;
+    return true;
+}
+
+bool device_metrics_poll(uint32_t now_ms)
+{
+    if (!period_started) {
+        period_started = true;
+        last_snapshot_ms = now_ms;
+        return false;
+    }
+    if (now_ms - last_snapshot_ms < metrics_config.period_ms) {
+        return false;
+    }
+    return publish_snapshot(now_ms);
+}
+
+// The task wakes up once per period, no need to check the elapsed time.
+static void metrics_task(void *arg)
+{
+    TickType_t last_wake = xTaskGetTickCount();
+    for (;;) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(metrics_config.period_ms));
+        publish_snapshot((uint32_t)(esp_timer_get_time() / 1000));
+    }
+}
+
+esp_err_t device_metrics_start(void)
+{
+    if (metrics_task_handle || metrics_publish == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    metrics_task_handle = xTaskCreateStatic(metrics_task, "metrics", CONFIG_DEVICE_METRICS_TASK_STACK_SIZE, NULL,
+                                            CONFIG_DEVICE_METRICS_TASK_PRIORITY, metrics_task_stack,
+                                            &metrics_task_tcb);
+    if (metrics_task_handle == NULL) {
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG_METRICS, "Metrics started: snapshot every %" PRIu32 " ms", metrics_config.period_ms);
+    return ESP_OK;
+}
+
+void device_metrics_get_stats(device_metrics_stats_t *out)
+{
+    *out = stats;
+}
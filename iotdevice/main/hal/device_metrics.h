@@ -0,0 +1,189 @@
+#ifndef DEVICE_METRICS_H
+#define DEVICE_METRICS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "telemetry.h"
+
+/**
+ * Device metrics: counters, gauges and latency histograms.
+ *
+ * All metrics are fixed slots of 32-bit atomics, updated with relaxed
+ * atomic operations from any task (not from ISRs on targets without
+ * native atomics). Recording is inline: a counter is one atomic add, a
+ * histogram sample is a count-leading-zeros and two atomic adds. Nothing
+ * is formatted or allocated on the recording side.
+ *
+ * A snapshot is published every CONFIG_DEVICE_METRICS_PERIOD_MS on
+ * home/devices/<id>/telemetry/metrics (JSON or CBOR, same keys):
+ *
+ *   {"up":<uptime ms>,"<counter>":<n>,...,"<gauge>":<v>,...,
+ *    "<histogram>":[<sum>,<bucket 0>,<bucket 1>,...]}
+ *
+ * Counters and histograms are cumulative since boot (they wrap at 2^32);
+ * rates come from the difference between two snapshots, and a smaller
+ * "up" means the device rebooted. Histogram bucket 0 counts zeros and
+ * bucket i (i >= 1) values in [2^(i-1), 2^i), the last bucket everything
+ * above; trailing empty buckets are left out. The slots are read one by
+ * one, so a snapshot is not an atomic cut across metrics.
+ */
+
+#define DEVICE_METRICS_BUCKETS 20
+
+typedef enum {
+    METRIC_MSG_IN,              // Messages received, after reassembly
+    METRIC_MSG_OUT,             // Messages handed to the MQTT client
+    METRIC_MSG_QUEUED,          // Messages put into the offline queue
+    METRIC_PUBLISH_FAILURES,    // Sends the MQTT client rejected
+    METRIC_UNDECRYPTABLE,       // Messages that failed authentication
+    METRIC_COMMAND_FAILURES,    // Commands without handler or whose handler failed
+    METRIC_RECONNECTS,          // Broker connections after the first one
+    METRIC_WIFI_DISCONNECTS,    // Wi-Fi station disconnections
+    METRIC_DUPLICATES,          // Redelivered commands that were not run again
+    METRIC_LAN_IN,              // Commands received by the LAN listener
+    METRIC_TLS_RESUMED,         // Broker connections that resumed a TLS session
+    METRIC_COUNTER_COUNT
+} device_metric_counter_t;
+
+typedef enum {
+    METRIC_HEAP_FREE,           // Free heap (bytes)
+    METRIC_HEAP_MIN,            // Lowest free heap since boot (bytes)
+    METRIC_HEAP_LARGEST,        // Largest free heap block (bytes)
+    METRIC_HEAP_BLOCKS,         // Allocated heap blocks
+    METRIC_RSSI,                // Signal strength of the AP (dBm)
+    METRIC_ACTUATOR_QUEUE,      // Commands waiting for the actuator task
+    METRIC_OFFLINE_QUEUE,       // Bytes in the offline queue RAM ring
+    METRIC_GAUGE_COUNT
+} device_metric_gauge_t;
+
+typedef enum {
+    METRIC_DISPATCH_US,         // Message decrypt and dispatch time
+    METRIC_PUBLISH_US,          // Encrypt and esp_mqtt_client_publish() time
+    METRIC_ACTUATE_US,          // Command enqueue to actuation time
+    METRIC_TLS_CONNECT_US,      // TCP connect and TLS handshake time
+    METRIC_HISTOGRAM_COUNT
+} device_metric_histogram_t;
+
+typedef struct {
+    _Atomic uint32_t counters[METRIC_COUNTER_COUNT];
+    _Atomic int32_t gauges[METRIC_GAUGE_COUNT];
+    _Atomic uint32_t sums[METRIC_HISTOGRAM_COUNT];
+    _Atomic uint32_t buckets[METRIC_HISTOGRAM_COUNT][DEVICE_METRICS_BUCKETS];
+} device_metrics_t;
+
+// The slots, for the inline recording functions below.
+extern device_metrics_t device_metrics;
+
+/**
+ * @brief Updates the gauges before a snapshot, on the metrics task.
+ *
+ * Gauges of values owned by other modules (heap, RSSI, queue depths) are
+ * read here rather than updated on every change.
+ */
+typedef void (*device_metrics_sample_fn_t)(void);
+
+/**
+ * @brief Publishes a snapshot, same contract as telemetry_publish_fn_t.
+ */
+typedef int (*device_metrics_publish_fn_t)(const char *subtopic, char *buf, size_t len, size_t buf_size);
+
+typedef struct {
+    uint32_t period_ms;             // Time between two snapshots
+    telemetry_encoding_t encoding;  // Payload encoding of the snapshots
+} device_metrics_config_t;
+
+#define DEVICE_METRICS_CONFIG_DEFAULT() {                           \
+    .period_ms = CONFIG_DEVICE_METRICS_PERIOD_MS,                   \
+    .encoding = TELEMETRY_ENCODING_DEFAULT,                         \
+}
+
+typedef struct {
+    uint32_t snapshots;         // Snapshots published
+    uint32_t publish_failures;  // Snapshots the publish function rejected
+    uint32_t last_len;          // Plaintext size of the last snapshot
+} device_metrics_stats_t;
+
+/**
+ * @brief Adds one to a counter.
+ */
+static inline void device_metrics_count(device_metric_counter_t id)
+{
+    atomic_fetch_add_explicit(&device_metrics.counters[id], 1, memory_order_relaxed);
+}
+
+/**
+ * @brief Sets a gauge.
+ */
+static inline void device_metrics_set(device_metric_gauge_t id, int32_t value)
+{
+    atomic_store_explicit(&device_metrics.gauges[id], value, memory_order_relaxed);
+}
+
+/**
+ * @brief Records one histogram sample.
+ *
+ * @param id Histogram.
+ * @param value Sample, e.g. a duration in microseconds.
+ */
+static inline void device_metrics_observe(device_metric_histogram_t id, uint32_t value)
+{
+    uint32_t bucket = value ? 32 - (uint32_t)__builtin_clz(value) : 0;
+    if (bucket >= DEVICE_METRICS_BUCKETS) {
+        bucket = DEVICE_METRICS_BUCKETS - 1;
+    }
+    atomic_fetch_add_explicit(&device_metrics.buckets[id][bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&device_metrics.sums[id], value, memory_order_relaxed);
+}
+
+/**
+ * @brief Clears all metrics and sets configuration, gauge sampler and sink.
+ *
+ * Does not start the metrics task.
+ *
+ * @param config Snapshot period and encoding.
+ * @param sample Function updating the sampled gauges (may be NULL).
+ * @param publish Function that sends a snapshot.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a bad configuration.
+ */
+esp_err_t device_metrics_init(const device_metrics_config_t *config, device_metrics_sample_fn_t sample,
+                              device_metrics_publish_fn_t publish);
+
+/**
+ * @brief Starts the task that publishes a snapshot every period.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if already started or not initialized.
+ */
+esp_err_t device_metrics_start(void);
+
+/**
+ * @brief Publishes a snapshot if a period has passed since the last one.
+ *
+ * Called by the metrics task; exposed so the host benchmarks can drive it
+ * with a simulated clock.
+ *
+ * @param now_ms Current time in milliseconds.
+ * @return true if a snapshot was published.
+ */
+bool device_metrics_poll(uint32_t now_ms);
+
+/**
+ * @brief Samples the gauges and packs a snapshot.
+ *
+ * @param now_ms Uptime reported in the snapshot.
+ * @param buf Destination buffer.
+ * @param size Size of buf.
+ * @return Length of the snapshot, 0 if it does not fit.
+ */
+size_t device_metrics_snapshot(uint32_t now_ms, char *buf, size_t size);
+
+/**
+ * @brief Gets the counters of the metrics publisher itself.
+ *
+ * @param out Destination for the counters.
+ */
+void device_metrics_get_stats(device_metrics_stats_t *out);
+
+#endif // DEVICE_METRICS_H
@@ -0,0 +1,57 @@
+#include "device_nvs.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+
+typedef struct {
+    const char *name_space;
+    nvs_handle_t handle;
+} device_nvs_entry_t;
+
+static portMUX_TYPE nvs_lock = portMUX_INITIALIZER_UNLOCKED;
+static device_nvs_entry_t entries[DEVICE_NVS_MAX_NAMESPACES];
+static size_t entry_count;
+
+// Under nvs_lock.
+static bool find(const char *name_space, nvs_handle_t *out)
+{
+    for (size_t i = 0; i < entry_count; i++) {
+        if (strcmp(entries[i].name_space, name_space) == 0) {
+            *out = entries[i].handle;
+            return true;
+        }
+    }
+    return false;
+}
+
+esp_err_t device_nvs_handle(const char *name_space, nvs_handle_t *out)
+{
+    portENTER_CRITICAL(&nvs_lock);
+    bool found = find(name_space, out);
+    portEXIT_CRITICAL(&nvs_lock);
+    if (found) {
+        return ESP_OK;
+    }
+
+    // Opened outside the lock; two tasks opening the same namespace at once keep the first handle.
+    nvs_handle_t handle;
+    if (nvs_open(name_space, NVS_READWRITE, &handle) != ESP_OK) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    esp_err_t err = ESP_OK;
+    portENTER_CRITICAL(&nvs_lock);
+    if (find(name_space, out)) {
+        found = true;
+    } else if (entry_count < DEVICE_NVS_MAX_NAMESPACES) {
+        entries[entry_count++] = (device_nvs_entry_t){ name_space, handle };
+        *out = handle;
+    } else {
+        err = ESP_ERR_NO_MEM;
+    }
+    portEXIT_CRITICAL(&nvs_lock);
+    if (found || err != ESP_OK) {
+        nvs_close(handle);
+    }
+    return err;
+}
@@ -0,0 +1,29 @@
+#ifndef DEVICE_NVS_H
+#define DEVICE_NVS_H
+
+#include "esp_err.h"
+#include "nvs.h"
+
+/*
+ * Read-write NVS handles shared by the modules that keep state in flash.
+ * nvs_open() allocates on the heap, so each namespace is opened on first
+ * use and the handle is kept for the lifetime of the firmware; later
+ * stores do not allocate.
+ */
+
+#define DEVICE_NVS_MAX_NAMESPACES 8
+
+/**
+ * @brief Gets the read-write handle of a namespace, opening it on first use.
+ *
+ * Safe to call from any task. A failed open is retried on the next call,
+ * e.g. once nvs_flash_init() ran.
+ *
+ * @param name_space NVS namespace, a string literal (the pointer is kept).
+ * @param out Destination for the handle.
+ * @return ESP_OK, ESP_ERR_NVS_NOT_INITIALIZED if the namespace cannot be
+ *         opened, ESP_ERR_NO_MEM if DEVICE_NVS_MAX_NAMESPACES are open.
+ */
+esp_err_t device_nvs_handle(const char *name_space, nvs_handle_t *out);
+
+#endif // DEVICE_NVS_H
@@ -0,0 +1,351 @@
+#include "device_shadow.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "cbor_lite.h"
+#include "command_ack.h"
+#include "trace_log.h"
+#include "device_crypto.h"
+
+#define SHADOW_BUF_SIZE DEVICE_CRYPTO_FRAME_LEN(DEVICE_SHADOW_PAYLOAD_MAX)
+
+static device_shadow_config_t shadow_config;
+static device_shadow_schedule_fn_t shadow_schedule;
+static device_shadow_publish_fn_t shadow_publish;
+
+// Commands come from the MQTT, LAN and telemetry tasks, applies run on the
+// actuator task; shadow_lock guards everything up to the stats.
+static portMUX_TYPE shadow_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t desired[ACTUATOR_HAL_MAX_CHANNELS];
+static uint32_t pending_mask;                   // Channels desired since the last apply
+static uint32_t pending_commands;
+static command_ack_token_t pending_acks[DEVICE_SHADOW_MAX_PENDING];
+static size_t pending_ack_count;
+static bool apply_scheduled;
+static bool snapshot_requested;                 // By shadow/get, sent by the next apply
+static int64_t applied_us;                      // Last apply, 0 before the first
+static device_shadow_stats_t stats;
+
+// Only used by device_shadow_apply().
+static command_ack_token_t apply_acks[DEVICE_SHADOW_MAX_PENDING];
+
+// publish_lock guards what was last published and the payload buffer.
+static StaticSemaphore_t publish_lock_storage;
+static SemaphoreHandle_t publish_lock;
+static uint8_t reported_sent[ACTUATOR_HAL_MAX_CHANNELS];
+static uint8_t desired_sent[ACTUATOR_HAL_MAX_CHANNELS];
+static bool snapshot_sent;
+static char payload_buf[SHADOW_BUF_SIZE];
+
+esp_err_t device_shadow_init(const device_shadow_config_t *config, device_shadow_schedule_fn_t schedule,
+                             device_shadow_publish_fn_t publish)
+{
+    if (config == NULL || schedule == NULL || publish == NULL ||
+        (config->encoding != TELEMETRY_ENCODING_JSON && config->encoding != TELEMETRY_ENCODING_CBOR)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (publish_lock == NULL) {
+        publish_lock = xSemaphoreCreateMutexStatic(&publish_lock_storage);
+    }
+    shadow_config = *config;
+    shadow_schedule = schedule;
+    shadow_publish = publish;
+
+    portENTER_CRITICAL(&shadow_lock);
+    for (uint8_t i = 0; i < ACTUATOR_HAL_MAX_CHANNELS; i++) {
+        desired[i] = actuator_hal_get(i);
+    }
+    pending_mask = 0;
+    pending_commands = 0;
+    pending_ack_count = 0;
+    apply_scheduled = false;
+    snapshot_requested = false;
+    applied_us = 0;
+    memset(&stats, 0, sizeof(stats));
+    portEXIT_CRITICAL(&shadow_lock);
+
+    xSemaphoreTake(publish_lock, portMAX_DELAY);
+    snapshot_sent = false;
+    xSemaphoreGive(publish_lock);
+    return ESP_OK;
+}
+
+// Fails the commands waiting when their apply could not be scheduled.
+static void fail_pending(esp_err_t err)
+{
+    command_ack_token_t acks[DEVICE_SHADOW_MAX_PENDING];
+
+    portENTER_CRITICAL(&shadow_lock);
+    size_t count = pending_ack_count;
+    memcpy(acks, pending_acks, count * sizeof(acks[0]));
+    pending_ack_count = 0;
+    pending_mask = 0;
+    pending_commands = 0;
+    apply_scheduled = false;
+    snapshot_requested = false;
+    portEXIT_CRITICAL(&shadow_lock);
+
+    for (size_t i = 0; i < count; i++) {
+        command_ack_complete(acks[i], err);
+    }
+}
+
+esp_err_t device_shadow_desire(const actuator_state_t *state)
+{
+    uint8_t count = actuator_hal_channel_count();
+    if (state == NULL || shadow_schedule == NULL || (count < 32 && (state->mask >> count) != 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    command_ack_token_t token = command_ack_take();
+
+    portENTER_CRITICAL(&shadow_lock);
+    if (token.seq && pending_ack_count == DEVICE_SHADOW_MAX_PENDING) {
+        stats.refused++;
+        portEXIT_CRITICAL(&shadow_lock);
+        command_ack_complete(token, ESP_ERR_NO_MEM);
+        return ESP_ERR_NO_MEM;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        if (state->mask & (1u << i)) {
+            desired[i] = state->level[i];
+        }
+    }
+    pending_mask |= state->mask;
+    pending_commands++;
+    if (token.seq) {
+        pending_acks[pending_ack_count++] = token;
+    }
+    stats.commands++;
+    bool schedule = !apply_scheduled;
+    uint32_t delay_ms = 0;
+    if (schedule) {
+        // Leading edge: right away after a quiet period, else at the end of the window.
+        int64_t elapsed_us = esp_timer_get_time() - applied_us;
+        if (applied_us != 0 && elapsed_us < DEVICE_SHADOW_COALESCE_MS * 1000LL) {
+            delay_ms = (uint32_t)((DEVICE_SHADOW_COALESCE_MS * 1000LL - elapsed_us + 999) / 1000);
+        }
+        apply_scheduled = true;
+    } else {
+        stats.coalesced++;
+    }
+    portEXIT_CRITICAL(&shadow_lock);
+
+    if (schedule) {
+        esp_err_t err = shadow_schedule(delay_ms);
+        if (err != ESP_OK) {
+            fail_pending(err);
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+void device_shadow_apply(void)
+{
+    actuator_state_t state = { 0 };
+    uint8_t count = actuator_hal_channel_count();
+
+    portENTER_CRITICAL(&shadow_lock);
+    state.mask = pending_mask;
+    for (uint8_t i = 0; i < count; i++) {
+        state.level[i] = desired[i];
+    }
+    size_t ack_count = pending_ack_count;
+    memcpy(apply_acks, pending_acks, ack_count * sizeof(apply_acks[0]));
+    uint32_t commands = pending_commands;
+    bool full = snapshot_requested;
+    pending_mask = 0;
+    pending_commands = 0;
+    pending_ack_count = 0;
+    apply_scheduled = false;
+    snapshot_requested = false;
+    if (commands) {
+        applied_us = esp_timer_get_time();
+    }
+    portEXIT_CRITICAL(&shadow_lock);
+
+    if (commands == 0) {
+        if (full) {
+            device_shadow_publish(true);
+        }
+        return;
+    }
+    esp_err_t err = actuator_hal_apply(&state);
+
+    portENTER_CRITICAL(&shadow_lock);
+    if (err == ESP_OK) {
+        // The HAL clamps levels to what the channel can do; that is what was desired.
+        for (uint8_t i = 0; i < count; i++) {
+            if ((state.mask & ~pending_mask) & (1u << i)) {
+                desired[i] = actuator_hal_get(i);
+            }
+        }
+    }
+    stats.applies++;
+    portEXIT_CRITICAL(&shadow_lock);
+
+    for (size_t i = 0; i < ack_count; i++) {
+        command_ack_complete(apply_acks[i], err);
+    }
+    TRACE(SHADOW_APPLIED, state.mask, commands, err);
+    device_shadow_publish(full);
+}
+
+static bool append(size_t *pos, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(payload_buf + *pos, DEVICE_SHADOW_PAYLOAD_MAX + 1 - *pos, fmt, args);
+    va_end(args);
+    if (n < 0 || (size_t)n > DEVICE_SHADOW_PAYLOAD_MAX - *pos) {
+        return false;
+    }
+    *pos += (size_t)n;
+    return true;
+}
+
+static void put_levels_cbor(cbor_lite_writer_t *w, const char *key, uint32_t mask, const uint8_t *levels,
+                            uint8_t count)
+{
+    cbor_lite_put_cstr(w, key);
+    cbor_lite_put_map(w, (size_t)__builtin_popcount(mask));
+    for (uint8_t i = 0; i < count; i++) {
+        if (mask & (1u << i)) {
+            cbor_lite_put_cstr(w, actuator_hal_get_name(i));
+            cbor_lite_put_uint(w, levels[i]);
+        }
+    }
+}
+
+static bool put_levels_json(size_t *pos, const char *key, uint32_t mask, const uint8_t *levels, uint8_t count)
+{
+    bool ok = append(pos, ",\"%s\":{", key);
+    const char *sep = "";
+    for (uint8_t i = 0; ok && i < count; i++) {
+        if (mask & (1u << i)) {
+            ok = append(pos, "%s\"%s\":%u", sep, actuator_hal_get_name(i), (unsigned)levels[i]);
+            sep = ",";
+        }
+    }
+    return ok && append(pos, "}");
+}
+
+// Builds the status message; 0 if it does not fit.
+static size_t encode(uint32_t version, bool full, uint32_t reported_mask, const uint8_t *reported,
+                     uint32_t desired_mask, const uint8_t *wanted, uint8_t count)
+{
+    if (shadow_config.encoding == TELEMETRY_ENCODING_CBOR) {
+        cbor_lite_writer_t w;
+        cbor_lite_writer_init(&w, payload_buf, DEVICE_SHADOW_PAYLOAD_MAX);
+        cbor_lite_put_map(&w, 1 + full + (full || reported_mask) + (desired_mask != 0));
+        cbor_lite_put_cstr(&w, "version");
+        cbor_lite_put_uint(&w, version);
+        if (full) {
+            cbor_lite_put_cstr(&w, "full");
+            cbor_lite_put_bool(&w, true);
+        }
+        if (full || reported_mask) {
+            put_levels_cbor(&w, "reported", reported_mask, reported, count);
+        }
+        if (desired_mask) {
+            put_levels_cbor(&w, "desired", desired_mask, wanted, count);
+        }
+        return w.overflow ? 0 : w.len;
+    }
+    size_t pos = 0;
+    bool ok = append(&pos, "{\"version\":%u", (unsigned)version) && (!full || append(&pos, ",\"full\":true")) &&
+              (!(full || reported_mask) || put_levels_json(&pos, "reported", reported_mask, reported, count)) &&
+              (!desired_mask || put_levels_json(&pos, "desired", desired_mask, wanted, count)) &&
+              append(&pos, "}");
+    return ok ? pos : 0;
+}
+
+esp_err_t device_shadow_publish(bool full)
+{
+    uint8_t reported[ACTUATOR_HAL_MAX_CHANNELS];
+    uint8_t wanted[ACTUATOR_HAL_MAX_CHANNELS];
+    uint8_t count = actuator_hal_channel_count();
+    uint32_t reported_mask = 0;
+    uint32_t desired_mask = 0;
+    esp_err_t err = ESP_OK;
+
+    if (shadow_publish == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(publish_lock, portMAX_DELAY);
+    full = full || !snapshot_sent;
+
+    portENTER_CRITICAL(&shadow_lock);
+    memcpy(wanted, desired, count);
+    portEXIT_CRITICAL(&shadow_lock);
+    for (uint8_t i = 0; i < count; i++) {
+        reported[i] = actuator_hal_get(i);
+        if (full || reported[i] != reported_sent[i]) {
+            reported_mask |= 1u << i;
+        }
+        // A channel off its desired level, or back on it after it was.
+        bool off = wanted[i] != reported[i];
+        bool was_off = desired_sent[i] != reported_sent[i];
+        if ((off && (full || wanted[i] != desired_sent[i])) || (!full && !off && was_off)) {
+            desired_mask |= 1u << i;
+        }
+    }
+
+    if (full || reported_mask || desired_mask) {
+        uint32_t version = stats.version + 1;
+        size_t len = encode(version, full, reported_mask, reported, desired_mask, wanted, count);
+        if (len == 0) {
+            err = ESP_ERR_INVALID_SIZE;
+        } else if (shadow_publish("status", payload_buf, len, sizeof(payload_buf)) < 0) {
+            err = ESP_FAIL;
+        }
+        portENTER_CRITICAL(&shadow_lock);
+        if (err == ESP_OK) {
+            stats.version = version;
+            stats.published++;
+        } else {
+            stats.publish_failures++;
+        }
+        portEXIT_CRITICAL(&shadow_lock);
+        if (err == ESP_OK) {
+            memcpy(reported_sent, reported, count);
+            memcpy(desired_sent, wanted, count);
+            snapshot_sent = true;
+            TRACE(SHADOW_PUBLISHED, version, len, full);
+        } else {
+            TRACE(SHADOW_FAILED, version, err);
+        }
+    }
+    xSemaphoreGive(publish_lock);
+    return err == ESP_OK ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t device_shadow_get_handler(const char *data, size_t data_len, void *ctx)
+{
+    // Published by the apply task: the MQTT task must not wait for publish_lock.
+    portENTER_CRITICAL(&shadow_lock);
+    snapshot_requested = true;
+    bool schedule = !apply_scheduled;
+    apply_scheduled = true;
+    portEXIT_CRITICAL(&shadow_lock);
+
+    if (schedule) {
+        esp_err_t err = shadow_schedule(0);
+        if (err != ESP_OK) {
+            fail_pending(err);
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+void device_shadow_get_stats(device_shadow_stats_t *out)
+{
+    portENTER_CRITICAL(&shadow_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&shadow_lock);
+}
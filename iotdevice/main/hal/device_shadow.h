@@ -0,0 +1,134 @@
+#ifndef DEVICE_SHADOW_H
+#define DEVICE_SHADOW_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "actuator_hal.h"
+#include "telemetry.h"
+
+/**
+ * Desired and reported levels of the actuator channels, with a version.
+ *
+ * Output commands (setLed, scenes, rule actions) only record the level
+ * they want with device_shadow_desire(). The first one after a quiet
+ * period schedules an apply right away; the ones arriving within
+ * CONFIG_DEVICE_SHADOW_COALESCE_MS after the outputs last changed wait
+ * for the end of that window, and a burst is applied once with the last
+ * level asked for on each channel. Sequenced commands are acked when the
+ * apply that covers them ran.
+ *
+ * After an apply the channels whose level changed are published, retained
+ * at QoS 1, on home/devices/<id>/status:
+ *
+ *   {"version":7,"reported":{"led":1},"desired":{"fan":40}}
+ *
+ * "reported" has the channels whose level changed since the last message,
+ * "desired" the channels asked for a level they could not be set to (it
+ * is left out once reported and desired agree again). Every message bumps
+ * the version by one. A snapshot of all channels carries "full":true; one
+ * goes out after boot (version 1) and on .../command/shadow/get, which the
+ * backend sends when it misses a version.
+ */
+
+#define DEVICE_SHADOW_COALESCE_MS CONFIG_DEVICE_SHADOW_COALESCE_MS
+#define DEVICE_SHADOW_MAX_PENDING CONFIG_DEVICE_SHADOW_MAX_PENDING
+// Header and both objects naming every channel: "name":100, is the name and 7 bytes.
+#define DEVICE_SHADOW_PAYLOAD_MAX (48 + 2 * ACTUATOR_HAL_MAX_CHANNELS * (ACTUATOR_HAL_NAME_MAX_LEN + 7))
+
+/**
+ * @brief Has device_shadow_apply() run on the task that drives the outputs.
+ *
+ * Must not block, and the wait must not block that task either: e.g. a
+ * one-shot timer queues the apply once delay_ms ran out.
+ *
+ * @param delay_ms Time to wait before applying, the rest of the coalescing window.
+ * @return ESP_OK if scheduled; on an error the waiting commands fail with it.
+ */
+typedef esp_err_t (*device_shadow_schedule_fn_t)(uint32_t delay_ms);
+
+/**
+ * @brief Publishes the status message, same contract as telemetry_publish_fn_t.
+ *
+ * Should publish retained and at QoS 1.
+ */
+typedef int (*device_shadow_publish_fn_t)(const char *subtopic, char *buf, size_t len, size_t buf_size);
+
+typedef struct {
+    telemetry_encoding_t encoding;  // Payload encoding of the status messages
+} device_shadow_config_t;
+
+#define DEVICE_SHADOW_CONFIG_DEFAULT() {                            \
+    .encoding = TELEMETRY_ENCODING_DEFAULT,                         \
+}
+
+typedef struct {
+    uint32_t commands;          // device_shadow_desire() calls accepted
+    uint32_t coalesced;         // Commands applied together with an earlier one
+    uint32_t refused;           // Commands refused because DEVICE_SHADOW_MAX_PENDING were waiting
+    uint32_t applies;           // device_shadow_apply() runs that changed something
+    uint32_t published;         // Status messages published
+    uint32_t publish_failures;  // Status messages the publish function refused
+    uint32_t version;           // Version of the last status message
+} device_shadow_stats_t;
+
+/**
+ * @brief Takes the current channel levels as desired and reported state.
+ *
+ * Call after the channels were registered. The full snapshot is published
+ * by the first device_shadow_publish() call.
+ *
+ * @param config Encoding of the status messages.
+ * @param schedule Function scheduling device_shadow_apply().
+ * @param publish Function publishing status messages.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a bad configuration.
+ */
+esp_err_t device_shadow_init(const device_shadow_config_t *config, device_shadow_schedule_fn_t schedule,
+                             device_shadow_publish_fn_t publish);
+
+/**
+ * @brief Records the levels a command asks for and schedules their apply.
+ *
+ * Safe from any task; never blocks. Called from a command handler, it
+ * takes over the ack of a sequenced command (see command_ack.h).
+ *
+ * @param state Channels and levels; later calls win for the same channel.
+ * @return ESP_OK if recorded, ESP_ERR_INVALID_ARG for an unregistered
+ *         channel, ESP_ERR_NO_MEM if DEVICE_SHADOW_MAX_PENDING sequenced
+ *         commands wait already, or the error of the schedule function.
+ */
+esp_err_t device_shadow_desire(const actuator_state_t *state);
+
+/**
+ * @brief Applies the desired levels waiting and publishes what changed.
+ *
+ * Runs where the schedule function put it, on one task only.
+ */
+void device_shadow_apply(void);
+
+/**
+ * @brief Publishes the channels that changed since the last message.
+ *
+ * @param full Publish every channel instead.
+ * @return ESP_OK if published or nothing changed, ESP_FAIL if the publish
+ *         function refused it (the changes go out with the next message).
+ */
+esp_err_t device_shadow_publish(bool full);
+
+/**
+ * @brief Handler for home/devices/<id>/command/shadow/get, has the next apply publish a full snapshot.
+ *
+ * Schedules an apply unless one is scheduled already; the snapshot is
+ * published where the applies run, never on the calling task.
+ */
+esp_err_t device_shadow_get_handler(const char *data, size_t data_len, void *ctx);
+
+/**
+ * @brief Copies the counters.
+ *
+ * @param out Destination for the counters.
+ */
+void device_shadow_get_stats(device_shadow_stats_t *out);
+
+#endif // DEVICE_SHADOW_H
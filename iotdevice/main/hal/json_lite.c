@@ -0,0 +1,270 @@
+#include "json_lite.h"
+
+#include <math.h>
+#include <string.h>
+
+#define JSON_LITE_MAX_DEPTH 16
+
+typedef struct {
+    const char *p;
+    const char *end;
+} json_cursor_t;
+
+static void skip_ws(json_cursor_t *c)
+{
+    while (c->p < c->end && (*c->p == ' ' || *c->p == '\t' || *c->p == '\n' || *c->p == '\r')) {
+        c->p++;
+    }
+}
+
+// Leaves the cursor after the closing quote, *start/*len describe the contents.
+static bool scan_string(json_cursor_t *c, const char **start, size_t *len)
+{
+    if (c->p >= c->end || *c->p != '"') {
+        return false;
+    }
+    const char *s = ++c->p;
+    while (c->p < c->end) {
+        if (*c->p == '\\') {
+            if (c->end - c->p < 2) {
+                break; // Escape cut off by the end of the input
+            }
+            c->p += 2;
+            continue;
+        }
+        if (*c->p == '"') {
+            *start = s;
+            *len = (size_t)(c->p - s);
+            c->p++;
+            return true;
+        }
+        c->p++;
+    }
+    return false;
+}
+
+static bool skip_value(json_cursor_t *c)
+{
+    const char *s;
+    size_t n;
+    int depth = 0;
+
+    skip_ws(c);
+    if (c->p >= c->end) {
+        return false;
+    }
+    if (*c->p == '"') {
+        return scan_string(c, &s, &n);
+    }
+    if (*c->p != '{' && *c->p != '[') {
+        // Literal or number: runs until a delimiter.
+        while (c->p < c->end && *c->p != ',' && *c->p != '}' && *c->p != ']' &&
+               *c->p != ' ' && *c->p != '\t' && *c->p != '\n' && *c->p != '\r') {
+            c->p++;
+        }
+        return true;
+    }
+    do {
+        if (*c->p == '"') {
+            if (!scan_string(c, &s, &n)) {
+                return false;
+            }
+            continue;
+        }
+        if (*c->p == '{' || *c->p == '[') {
+            if (++depth > JSON_LITE_MAX_DEPTH) {
+                return false;
+            }
+        } else if (*c->p == '}' || *c->p == ']') {
+            depth--;
+        }
+        c->p++;
+    } while (depth > 0 && c->p < c->end);
+    return depth == 0;
+}
+
+static esp_err_t find_member(const char *json, size_t len, const char *key, const char **value, size_t *value_len)
+{
+    json_cursor_t c = { .p = json, .end = json + len };
+    size_t key_len = strlen(key);
+
+    skip_ws(&c);
+    if (c.p >= c.end || *c.p != '{') {
+        return ESP_ERR_INVALID_ARG;
+    }
+    c.p++;
+    for (;;) {
+        const char *name;
+        size_t name_len;
+
+        skip_ws(&c);
+        if (c.p < c.end && *c.p == '}') {
+            return ESP_ERR_NOT_FOUND;
+        }
+        if (!scan_string(&c, &name, &name_len)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        skip_ws(&c);
+        if (c.p >= c.end || *c.p != ':') {
+            return ESP_ERR_INVALID_ARG;
+        }
+        c.p++;
+        skip_ws(&c);
+        const char *v = c.p;
+        if (!skip_value(&c)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (name_len == key_len && memcmp(name, key, key_len) == 0) {
+            *value = v;
+            *value_len = (size_t)(c.p - v);
+            return ESP_OK;
+        }
+        skip_ws(&c);
+        if (c.p < c.end && *c.p == ',') {
+            c.p++;
+            continue;
+        }
+        return (c.p < c.end && *c.p == '}') ? ESP_ERR_NOT_FOUND : ESP_ERR_INVALID_ARG;
+    }
+}
+
+// Parses a JSON number without needing a terminator (strtof would).
+static bool parse_number(const char *s, size_t len, float *out)
+{
+    const char *end = s + len;
+    bool negative = false;
+    float value = 0.0f;
+    bool digits = false;
+
+    // JSON allows a '+' in the exponent only.
+    if (s < end && *s == '-') {
+        negative = true;
+        s++;
+    }
+    while (s < end && *s >= '0' && *s <= '9') {
+        value = value * 10.0f + (float)(*s++ - '0');
+        digits = true;
+    }
+    if (s < end && *s == '.') {
+        float scale = 0.1f;
+        s++;
+        while (s < end && *s >= '0' && *s <= '9') {
+            value += (float)(*s++ - '0') * scale;
+            scale *= 0.1f;
+            digits = true;
+        }
+    }
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        bool exp_negative = false;
+        int exponent = 0;
+        s++;
+        if (s < end && (*s == '-' || *s == '+')) {
+            exp_negative = *s == '-';
+            s++;
+        }
+        while (s < end && *s >= '0' && *s <= '9') {
+            exponent = exponent * 10 + (*s++ - '0');
+            if (exponent > 38) {
+                return false;
+            }
+        }
+        while (exponent-- > 0) {
+            value = exp_negative ? value / 10.0f : value * 10.0f;
+        }
+    }
+    if (!digits || s != end) {
+        return false;
+    }
+    *out = negative ? -value : value;
+    return true;
+}
+
+esp_err_t json_lite_get_raw(const char *json, size_t len, const char *key, const char **value, size_t *value_len)
+{
+    return find_member(json, len, key, value, value_len);
+}
+
+esp_err_t json_lite_get_bool(const char *json, size_t len, const char *key, bool *out)
+{
+    const char *v;
+    size_t n;
+    esp_err_t err = find_member(json, len, key, &v, &n);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (n == 4 && memcmp(v, "true", 4) == 0) {
+        *out = true;
+    } else if (n == 5 && memcmp(v, "false", 5) == 0) {
+        *out = false;
+    } else {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+esp_err_t json_lite_get_float(const char *json, size_t len, const char *key, float *out)
+{
+    const char *v;
+    size_t n;
+    esp_err_t err = find_member(json, len, key, &v, &n);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return parse_number(v, n, out) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t json_lite_get_int(const char *json, size_t len, const char *key, int32_t *out)
+{
+    const char *v;
+    size_t n;
+    esp_err_t err = find_member(json, len, key, &v, &n);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // Integer fast path avoids float rounding for large values. Digits are
+    // accumulated negatively, so INT32_MIN is in range too.
+    const char *s = v;
+    const char *end = v + n;
+    bool negative = s < end && *s == '-';
+    int64_t limit = negative ? INT32_MIN : -(int64_t)INT32_MAX;
+    int64_t value = 0;
+    if (negative) {
+        s++;
+    }
+    if (s == end) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    while (s < end && *s >= '0' && *s <= '9') {
+        value = value * 10 - (*s++ - '0');
+        if (value < limit) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    if (s != end) {
+        float f;
+        if (!parse_number(v, n, &f) || isnan(f) || (double)f < (double)INT32_MIN || (double)f > (double)INT32_MAX) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        *out = (int32_t)f;
+        return ESP_OK;
+    }
+    *out = (int32_t)(negative ? value : -value);
+    return ESP_OK;
+}
+
+esp_err_t json_lite_get_string(const char *json, size_t len, const char *key, const char **str, size_t *str_len)
+{
+    const char *v;
+    size_t n;
+    esp_err_t err = find_member(json, len, key, &v, &n);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (n < 2 || v[0] != '"' || v[n - 1] != '"') {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *str = v + 1;
+    *str_len = n - 2;
+    return ESP_OK;
+}
@@ -0,0 +1,64 @@
+#ifndef JSON_LITE_H
+#define JSON_LITE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * Minimal, allocation free JSON reader for command payloads.
+ *
+ * Only looks up keys of the top level object; nested objects and arrays
+ * are skipped. Input does not need to be null terminated.
+ */
+
+/**
+ * @brief Reads a boolean member of the top level object.
+ *
+ * @param json Payload.
+ * @param len Length of the payload.
+ * @param key Member name.
+ * @param out Value of the member.
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the key is missing,
+ *         ESP_ERR_INVALID_ARG if the value is not a boolean or the JSON is malformed.
+ */
+esp_err_t json_lite_get_bool(const char *json, size_t len, const char *key, bool *out);
+
+/**
+ * @brief Reads an integer member of the top level object.
+ *
+ * Fractional parts are truncated. Same return codes as json_lite_get_bool().
+ */
+esp_err_t json_lite_get_int(const char *json, size_t len, const char *key, int32_t *out);
+
+/**
+ * @brief Reads a numeric member of the top level object.
+ *
+ * Same return codes as json_lite_get_bool().
+ */
+esp_err_t json_lite_get_float(const char *json, size_t len, const char *key, float *out);
+
+/**
+ * @brief Finds a string member of the top level object.
+ *
+ * The result points into the payload and is not unescaped.
+ *
+ * @param str Set to the first character of the string contents.
+ * @param str_len Set to the length of the string contents.
+ * Same return codes as json_lite_get_bool().
+ */
+esp_err_t json_lite_get_string(const char *json, size_t len, const char *key, const char **str, size_t *str_len);
+
+/**
+ * @brief Finds the raw text of a member of the top level object.
+ *
+ * Useful to hand a nested object or array to another parser.
+ *
+ * @param value Set to the first character of the value.
+ * @param value_len Set to the length of the value text.
+ * Same return codes as json_lite_get_bool().
+ */
+esp_err_t json_lite_get_raw(const char *json, size_t len, const char *key, const char **value, size_t *value_len);
+
+#endif // JSON_LITE_H
@@ -0,0 +1,190 @@
+#include "lan_listener.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "cbor_lite.h"
+#include "trace_log.h"
+#include "device_crypto.h"
+
+#define LAN_ANNOUNCE_PAYLOAD_MAX 64
+#define LAN_SOCKET_RETRY_MS 1000
+
+#define LAN_ANNOUNCE_BUF_SIZE DEVICE_CRYPTO_FRAME_LEN(LAN_ANNOUNCE_PAYLOAD_MAX)
+
+static const char *TAG_LAN = "LAN_LISTENER";
+
+static lan_listener_config_t lan_config;
+static lan_listener_dispatch_fn_t lan_dispatch;
+static lan_listener_announce_fn_t lan_announce;
+static int lan_sock = -1;
+static lan_listener_stats_t stats;
+
+// One byte more than a valid datagram, to tell a truncated one apart.
+// Only used by the receiving task, the frame is decrypted in place.
+static char rx_buf[LAN_LISTENER_DATAGRAM_MAX + 1];
+// Only used by the task announcing (the event loop).
+static char announce_buf[LAN_ANNOUNCE_BUF_SIZE];
+
+static StaticTask_t lan_task_tcb;
+static StackType_t lan_task_stack[CONFIG_LAN_LISTENER_TASK_STACK_SIZE];
+static TaskHandle_t lan_task_handle;
+
+esp_err_t lan_listener_init(const lan_listener_config_t *config, lan_listener_dispatch_fn_t dispatch,
+                            lan_listener_announce_fn_t announce)
+{
+    if (config == NULL || dispatch == NULL || announce == NULL ||
+        (config->encoding != TELEMETRY_ENCODING_JSON && config->encoding != TELEMETRY_ENCODING_CBOR)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (lan_task_handle) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (lan_sock >= 0) {
+        close(lan_sock);
+        lan_sock = -1;
+    }
+    memset(&stats, 0, sizeof(stats));
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        ESP_LOGE(TAG_LAN, "Failed to create socket: errno %d", errno);
+        return ESP_FAIL;
+    }
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(config->port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    socklen_t addr_len = sizeof(addr);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        getsockname(sock, (struct sockaddr *)&addr, &addr_len) != 0) {
+        ESP_LOGE(TAG_LAN, "Failed to bind UDP port %u: errno %d", (unsigned)config->port, errno);
+        close(sock);
+        return ESP_FAIL;
+    }
+    lan_config = *config;
+    lan_dispatch = dispatch;
+    lan_announce = announce;
+    lan_sock = sock;
+    stats.port = ntohs(addr.sin_port);
+    return ESP_OK;
+}
+
+esp_err_t lan_listener_announce(const char *address)
+{
+    if (lan_sock < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // Only digits and dots, so the address can go into the JSON as it is.
+    size_t address_len = address ? strlen(address) : 0;
+    if (address_len == 0 || address_len > LAN_LISTENER_ADDRESS_MAX_LEN ||
+        strspn(address, "0123456789.") != address_len) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    size_t len;
+    if (lan_config.encoding == TELEMETRY_ENCODING_CBOR) {
+        cbor_lite_writer_t w;
+        cbor_lite_writer_init(&w, announce_buf, LAN_ANNOUNCE_PAYLOAD_MAX);
+        cbor_lite_put_map(&w, 2);
+        cbor_lite_put_cstr(&w, "address");
+        cbor_lite_put_cstr(&w, address);
+        cbor_lite_put_cstr(&w, "port");
+        cbor_lite_put_uint(&w, stats.port);
+        len = w.len;
+    } else {
+        len = (size_t)snprintf(announce_buf, LAN_ANNOUNCE_PAYLOAD_MAX, "{\"address\":\"%s\",\"port\":%u}", address,
+                               (unsigned)stats.port);
+    }
+    return lan_announce("lan", announce_buf, len, sizeof(announce_buf)) < 0 ? ESP_FAIL : ESP_OK;
+}
+
+// Splits "<topic> <frame>" and hands it to the dispatch function.
+static void handle_datagram(size_t len)
+{
+    stats.received++;
+    const char *space = len <= LAN_LISTENER_DATAGRAM_MAX ? memchr(rx_buf, ' ', len) : NULL;
+    size_t topic_len = space ? (size_t)(space - rx_buf) : 0;
+    if (topic_len == 0 || topic_len + 1 >= len) {
+        stats.malformed++;
+        TRACE(LAN_MALFORMED, len);
+        return;
+    }
+
+    esp_err_t err = lan_dispatch(rx_buf, topic_len, rx_buf + topic_len + 1, len - topic_len - 1);
+    if (err == ESP_OK) {
+        stats.dispatched++;
+        return;
+    }
+    if (err == ESP_ERR_INVALID_STATE || err == ESP_ERR_INVALID_CRC) {
+        stats.refused++;
+    } else {
+        stats.failed++;
+    }
+    TRACE(LAN_FAILED, err, len);
+}
+
+esp_err_t lan_listener_receive(uint32_t timeout_ms)
+{
+    if (lan_sock < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (timeout_ms != LAN_LISTENER_WAIT_FOREVER) {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(lan_sock, &readable);
+        struct timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+        int ready = select(lan_sock + 1, &readable, NULL, NULL, &tv);
+        if (ready == 0 || (ready < 0 && errno == EINTR)) {
+            return ESP_ERR_TIMEOUT;
+        }
+        if (ready < 0) {
+            return ESP_FAIL;
+        }
+    }
+    ssize_t n = recv(lan_sock, rx_buf, sizeof(rx_buf), 0);
+    if (n < 0) {
+        return errno == EINTR || errno == EAGAIN ? ESP_ERR_TIMEOUT : ESP_FAIL;
+    }
+    handle_datagram((size_t)n);
+    return ESP_OK;
+}
+
+static void lan_listener_task(void *arg)
+{
+    for (;;) {
+        if (lan_listener_receive(LAN_LISTENER_WAIT_FOREVER) == ESP_FAIL) {
+            // E.g. the interface went away; the bound socket works again once it is back.
+            ESP_LOGW(TAG_LAN, "Receive failed: errno %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(LAN_SOCKET_RETRY_MS));
+        }
+    }
+}
+
+esp_err_t lan_listener_start(void)
+{
+    if (lan_task_handle || lan_sock < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    lan_task_handle = xTaskCreateStatic(lan_listener_task, "lan_cmd", CONFIG_LAN_LISTENER_TASK_STACK_SIZE, NULL,
+                                        CONFIG_LAN_LISTENER_TASK_PRIORITY, lan_task_stack, &lan_task_tcb);
+    if (lan_task_handle == NULL) {
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG_LAN, "LAN commands on UDP port %u", (unsigned)stats.port);
+    return ESP_OK;
+}
+
+void lan_listener_get_stats(lan_listener_stats_t *out)
+{
+    *out = stats;
+}
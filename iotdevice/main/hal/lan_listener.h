@@ -0,0 +1,130 @@
+#ifndef LAN_LISTENER_H
+#define LAN_LISTENER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "telemetry.h"
+
+/**
+ * Commands sent by the hub straight to the device over UDP, next to MQTT.
+ *
+ * A datagram carries one command as it would be published on the broker,
+ * topic and payload separated by one space:
+ *
+ *   home/devices/<id>/command/setLed <iv>:<tag>:<ciphertext>
+ *
+ * The frame is encrypted with the device key, or with the group key on a
+ * home/groups/<group>/command/... topic, and runs through the same
+ * decryption, dedup and command_router path as an MQTT delivery (the
+ * dispatch function, network_dispatch_lan() in the firmware). The backend
+ * publishes every command on MQTT as well, with the same sequence number:
+ * whichever copy arrives first runs, the other one is acked as a
+ * duplicate. A lost datagram only costs the broker round trip, and acks
+ * go out on MQTT either way; nothing is sent back over UDP.
+ *
+ * The listener address is published, retained, on home/devices/<id>/lan
+ * each time the station gets an address (JSON or CBOR, same keys):
+ *
+ *   {"address":"192.168.1.23","port":47808}
+ */
+
+#define LAN_LISTENER_DATAGRAM_MAX 1472      // UDP payload of a datagram in one Ethernet frame
+#define LAN_LISTENER_ADDRESS_MAX_LEN 15     // Dotted IPv4 address
+#define LAN_LISTENER_WAIT_FOREVER UINT32_MAX
+
+/**
+ * @brief Runs a received command, e.g. network_dispatch_lan().
+ *
+ * @param topic Command topic.
+ * @param topic_len Length of topic.
+ * @param data Frame, may be decrypted in place.
+ * @param data_len Length of data.
+ * @return ESP_OK if the command ran or was a duplicate,
+ *         ESP_ERR_INVALID_STATE or ESP_ERR_INVALID_CRC if it was refused,
+ *         any other error if it failed.
+ */
+typedef esp_err_t (*lan_listener_dispatch_fn_t)(const char *topic, size_t topic_len, char *data, size_t data_len);
+
+/**
+ * @brief Publishes the listener address, same contract as telemetry_publish_fn_t.
+ *
+ * Should publish retained and at QoS 1, so the backend learns the address
+ * whenever it subscribes.
+ */
+typedef int (*lan_listener_announce_fn_t)(const char *subtopic, char *buf, size_t len, size_t buf_size);
+
+typedef struct {
+    uint16_t port;                  // UDP port, 0 for one picked by the stack
+    telemetry_encoding_t encoding;  // Payload encoding of the announcement
+} lan_listener_config_t;
+
+#define LAN_LISTENER_CONFIG_DEFAULT() {                             \
+    .port = CONFIG_LAN_LISTENER_PORT,                               \
+    .encoding = TELEMETRY_ENCODING_DEFAULT,                         \
+}
+
+typedef struct {
+    uint16_t port;              // Port the socket is bound to
+    uint32_t received;          // Datagrams read
+    uint32_t malformed;         // Datagrams without topic or frame, or too long
+    uint32_t dispatched;        // Commands run or dropped as duplicates
+    uint32_t refused;           // Forged frames, stale or missing sequence numbers
+    uint32_t failed;            // Commands whose handler failed
+} lan_listener_stats_t;
+
+/**
+ * @brief Opens the UDP socket and sets the sinks.
+ *
+ * Does not start the listener task.
+ *
+ * @param config Port and announcement encoding.
+ * @param dispatch Function running the commands.
+ * @param announce Function publishing the address.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a bad configuration,
+ *         ESP_ERR_INVALID_STATE once started, ESP_FAIL if the socket
+ *         cannot be opened or bound.
+ */
+esp_err_t lan_listener_init(const lan_listener_config_t *config, lan_listener_dispatch_fn_t dispatch,
+                            lan_listener_announce_fn_t announce);
+
+/**
+ * @brief Starts the task that reads and runs datagrams.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if already started or not initialized.
+ */
+esp_err_t lan_listener_start(void);
+
+/**
+ * @brief Publishes the address the hub sends commands to.
+ *
+ * Called whenever the station gets an address, from one task at a time.
+ *
+ * @param address Station IPv4 address, dotted.
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if not initialized,
+ *         ESP_ERR_INVALID_ARG for a bad address, ESP_FAIL if the publish failed.
+ */
+esp_err_t lan_listener_announce(const char *address);
+
+/**
+ * @brief Waits for one datagram and runs it.
+ *
+ * Called by the listener task; exposed so the host benchmarks can drive it.
+ *
+ * @param timeout_ms Longest wait, LAN_LISTENER_WAIT_FOREVER to block.
+ * @return ESP_OK if a datagram was handled (whatever its outcome),
+ *         ESP_ERR_TIMEOUT if none arrived, ESP_ERR_INVALID_STATE if not
+ *         initialized, ESP_FAIL on a socket error.
+ */
+esp_err_t lan_listener_receive(uint32_t timeout_ms);
+
+/**
+ * @brief Gets the counters.
+ *
+ * Only the receiving task changes them; a copy taken elsewhere may mix two datagrams.
+ *
+ * @param out Destination for the counters.
+ */
+void lan_listener_get_stats(lan_listener_stats_t *out);
+
+#endif // LAN_LISTENER_H
@@ -1,5 +1,9 @@
 #include "led_control.h"
 
+#include <string.h>
+#include "json_lite.h"
+#include "cbor_lite.h"
+
 void led_init(gpio_num_t gpio_num) {
     gpio_config_t io_conf = {};
     io_conf.intr_type = GPIO_INTR_DISABLE;
@@ -12,4 +16,23 @@ void led_init(gpio_num_t gpio_num) {
 
 void led_set_state(gpio_num_t gpio_num, bool state) {
     gpio_set_level(gpio_num, state ? 1 : 0);
-} 
\ No newline at end of file
+}
+
+esp_err_t led_parse_command(const char *data, size_t data_len, bool *state) {
+    if (cbor_lite_is_cbor(data, data_len)) {
+        if (cbor_lite_get_bool(data, data_len, NULL, state) == ESP_OK ||
+            cbor_lite_get_bool(data, data_len, "state", state) == ESP_OK) {
+            return ESP_OK;
+        }
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (data_len == 4 && memcmp(data, "true", 4) == 0) {
+        *state = true;
+        return ESP_OK;
+    }
+    if (data_len == 5 && memcmp(data, "false", 5) == 0) {
+        *state = false;
+        return ESP_OK;
+    }
+    return json_lite_get_bool(data, data_len, "state", state);
+}
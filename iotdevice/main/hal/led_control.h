@@ -1,6 +1,9 @@
 #ifndef LED_CONTROL_H
 #define LED_CONTROL_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
 #include "driver/gpio.h"
 
 /**
@@ -18,4 +21,18 @@ void led_init(gpio_num_t gpio_num);
  */
 void led_set_state(gpio_num_t gpio_num, bool state);
 
+/**
+ * @brief Parses the payload of a setLed command.
+ *
+ * Accepts "true"/"false" or an object such as {"state": true}, in JSON or
+ * CBOR. Does not allocate.
+ *
+ * @param data Payload (not null terminated).
+ * @param data_len Length of the payload.
+ * @param state Set to the requested LED state on success.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG or ESP_ERR_NOT_FOUND for
+ *         an unknown payload.
+ */
+esp_err_t led_parse_command(const char *data, size_t data_len, bool *state);
+
 #endif // LED_CONTROL_H 
\ No newline at end of file
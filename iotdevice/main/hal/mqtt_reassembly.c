@@ -0,0 +1,100 @@
+#include "mqtt_reassembly.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include "trace_log.h"
+
+static char topic_buf[MQTT_REASSEMBLY_TOPIC_MAX_LEN];
+static size_t topic_buf_len;
+static char payload_buf[CONFIG_MQTT_REASSEMBLY_BUFFER_SIZE];
+static size_t expected_len;
+static size_t received_len;
+static bool in_progress;
+static bool discarding;
+
+static mqtt_reassembly_stats_t stats;
+
+void mqtt_reassembly_reset(void)
+{
+    in_progress = false;
+    discarding = false;
+    expected_len = 0;
+    received_len = 0;
+    topic_buf_len = 0;
+}
+
+static esp_err_t start_message(const char *topic, size_t topic_len, size_t total_len)
+{
+    mqtt_reassembly_reset();
+    in_progress = true;
+    expected_len = total_len;
+
+    if (total_len > sizeof(payload_buf) || topic_len > sizeof(topic_buf)) {
+        // Swallow the remaining fragments of this message.
+        discarding = true;
+        stats.dropped_oversize++;
+        TRACE(REASM_TOO_LARGE, total_len, sizeof(payload_buf));
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(topic_buf, topic, topic_len);
+    topic_buf_len = topic_len;
+    return ESP_OK;
+}
+
+esp_err_t mqtt_reassembly_feed(const char *topic, size_t topic_len, char *data, size_t data_len,
+                               size_t offset, size_t total_len, mqtt_message_cb_t on_message)
+{
+    if (offset == 0) {
+        if (data_len == total_len) {
+            // Common case: the whole message fits the client buffer, no copy needed.
+            if (in_progress && !discarding) {
+                stats.dropped_sequence++;
+            }
+            mqtt_reassembly_reset();
+            stats.messages++;
+            on_message(topic, topic_len, data, data_len);
+            return ESP_OK;
+        }
+        if (in_progress && !discarding) {
+            stats.dropped_sequence++;
+        }
+        esp_err_t err = start_message(topic, topic_len, total_len);
+        if (err != ESP_OK) {
+            return err;
+        }
+    } else if (!in_progress) {
+        // Continuation without a start, the first fragment was lost or rejected.
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (discarding) {
+        if (offset + data_len >= expected_len) {
+            mqtt_reassembly_reset();
+        }
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (offset != received_len || total_len != expected_len || offset + data_len > expected_len) {
+        TRACE(REASM_SEQUENCE, offset, received_len);
+        stats.dropped_sequence++;
+        mqtt_reassembly_reset();
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    memcpy(payload_buf + offset, data, data_len);
+    received_len += data_len;
+    if (received_len < expected_len) {
+        return ESP_ERR_NOT_FINISHED;
+    }
+
+    stats.messages++;
+    stats.reassembled++;
+    on_message(topic_buf, topic_buf_len, payload_buf, received_len);
+    mqtt_reassembly_reset();
+    return ESP_OK;
+}
+
+void mqtt_reassembly_get_stats(mqtt_reassembly_stats_t *out)
+{
+    *out = stats;
+}
@@ -0,0 +1,64 @@
+#ifndef MQTT_REASSEMBLY_H
+#define MQTT_REASSEMBLY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define MQTT_REASSEMBLY_TOPIC_MAX_LEN 128
+
+/**
+ * @brief Called once per complete message.
+ *
+ * The payload points either into the MQTT client buffer (single fragment)
+ * or into the static reassembly buffer. It may be modified in place but is
+ * only valid for the duration of the call.
+ */
+typedef void (*mqtt_message_cb_t)(const char *topic, size_t topic_len, char *data, size_t data_len);
+
+/**
+ * @brief Counters of the reassembly stage.
+ */
+typedef struct {
+    uint32_t messages;          // Complete messages delivered
+    uint32_t reassembled;       // Of those, messages that arrived in more than one fragment
+    uint32_t dropped_oversize;  // Messages larger than the reassembly buffer
+    uint32_t dropped_sequence;  // Messages with missing or out of order fragments
+} mqtt_reassembly_stats_t;
+
+/**
+ * @brief Feeds one MQTT_EVENT_DATA fragment into the reassembly stage.
+ *
+ * esp-mqtt splits messages larger than its receive buffer into several
+ * MQTT_EVENT_DATA events; only the first one carries the topic. Single
+ * fragment messages are passed through without copying, larger ones are
+ * streamed into a static buffer of CONFIG_MQTT_REASSEMBLY_BUFFER_SIZE bytes.
+ * Must be called from a single task (the MQTT task).
+ *
+ * @param topic Topic of the fragment (only set on the first fragment).
+ * @param topic_len Length of the topic.
+ * @param data Fragment payload.
+ * @param data_len Length of the fragment.
+ * @param offset Offset of the fragment in the message (current_data_offset).
+ * @param total_len Total length of the message (total_data_len).
+ * @param on_message Callback run when the message is complete.
+ * @return ESP_OK if the message was delivered, ESP_ERR_NOT_FINISHED if more
+ *         fragments are expected, ESP_ERR_INVALID_SIZE if the message is too
+ *         large, ESP_ERR_INVALID_STATE on a sequence error.
+ */
+esp_err_t mqtt_reassembly_feed(const char *topic, size_t topic_len, char *data, size_t data_len,
+                               size_t offset, size_t total_len, mqtt_message_cb_t on_message);
+
+/**
+ * @brief Discards a partially received message, e.g. after a disconnect.
+ */
+void mqtt_reassembly_reset(void);
+
+/**
+ * @brief Gets the reassembly counters.
+ *
+ * @param out Destination for the counters.
+ */
+void mqtt_reassembly_get_stats(mqtt_reassembly_stats_t *out);
+
+#endif // MQTT_REASSEMBLY_H
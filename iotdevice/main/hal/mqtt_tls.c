@@ -0,0 +1,419 @@
+#include "mqtt_tls.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "device_nvs.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/x509_crt.h"
+#include "device_metrics.h"
+#include "trace_log.h"
+
+#define MQTT_TLS_NVS_NAMESPACE  "mqtt_tls"
+#define MQTT_TLS_NVS_KEY_HOST   "host"
+#define MQTT_TLS_NVS_KEY_SESSION "session"
+#define MQTT_TLS_DEFAULT_PORT   8883
+
+static const char *TAG_TLS = "MQTT_TLS";
+
+static mqtt_tls_config_t tls_config;
+static esp_transport_handle_t tls_transport;
+static mbedtls_ssl_config ssl_conf;
+static mbedtls_x509_crt ca_chain;
+static mqtt_tls_stats_t stats;
+
+// Connection state, only used by the MQTT task (or the benchmark).
+static mbedtls_ssl_context ssl;
+static mbedtls_net_context net;
+static bool connected;
+static bool full_handshake;     // Set by the verify callback, only called on a full handshake
+
+// Session of the last full handshake, for the broker in session_host.
+static mbedtls_ssl_session session;
+static bool have_session;
+static char session_host[MQTT_TLS_HOST_MAX_LEN + 1];
+// Serialized session and the hash of what is in NVS, so an unchanged
+// session is not written again on every resumed connect.
+static unsigned char session_blob[MQTT_TLS_SESSION_MAX];
+static unsigned char saved_hash[32];
+
+static int tls_random(void *ctx, unsigned char *buf, size_t len)
+{
+    esp_fill_random(buf, len);
+    return 0;
+}
+
+static int tls_verify(void *ctx, mbedtls_x509_crt *crt, int depth, uint32_t *flags)
+{
+    full_handshake = true;
+    return 0;
+}
+
+static void session_clear(void)
+{
+    mbedtls_ssl_session_free(&session);
+    mbedtls_ssl_session_init(&session);
+    have_session = false;
+}
+
+static void session_load(void)
+{
+    nvs_handle_t nvs;
+    size_t host_len = sizeof(session_host);
+    size_t len = sizeof(session_blob);
+
+    if (device_nvs_handle(MQTT_TLS_NVS_NAMESPACE, &nvs) != ESP_OK) {
+        return;
+    }
+    if (nvs_get_str(nvs, MQTT_TLS_NVS_KEY_HOST, session_host, &host_len) == ESP_OK &&
+        nvs_get_blob(nvs, MQTT_TLS_NVS_KEY_SESSION, session_blob, &len) == ESP_OK &&
+        mbedtls_ssl_session_load(&session, session_blob, len) == 0) {
+        have_session = true;
+        stats.session_loaded = true;
+        mbedtls_sha256(session_blob, len, saved_hash, 0);
+    } else {
+        // Saved by another mbedTLS build, or half written.
+        session_clear();
+    }
+}
+
+// Writes the session to NVS if it changed since the last write.
+static void session_persist(void)
+{
+    unsigned char hash[32];
+    nvs_handle_t nvs;
+    size_t len;
+
+    if (mbedtls_ssl_session_save(&session, session_blob, sizeof(session_blob), &len) != 0) {
+        // E.g. a long peer certificate; resumption still works until reboot.
+        return;
+    }
+    mbedtls_sha256(session_blob, len, hash, 0);
+    if (memcmp(hash, saved_hash, sizeof(hash)) == 0) {
+        return;
+    }
+    if (device_nvs_handle(MQTT_TLS_NVS_NAMESPACE, &nvs) != ESP_OK) {
+        return;
+    }
+    esp_err_t err = nvs_set_str(nvs, MQTT_TLS_NVS_KEY_HOST, session_host);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, MQTT_TLS_NVS_KEY_SESSION, session_blob, len);
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    if (err == ESP_OK) {
+        memcpy(saved_hash, hash, sizeof(hash));
+        stats.session_saves++;
+        TRACE(TLS_SESSION_SAVED, len);
+    }
+}
+
+// TCP connect bounded by the deadline; the socket is left blocking.
+static int tcp_connect(const char *host, int port, int64_t deadline_us)
+{
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *addr = NULL;
+    char port_str[8];
+
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    if (getaddrinfo(host, port_str, &hints, &addr) != 0 || addr == NULL) {
+        return -1;
+    }
+    int fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (fd >= 0) {
+        int flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+        if (connect(fd, addr->ai_addr, addr->ai_addrlen) != 0 && errno != EINPROGRESS) {
+            close(fd);
+            fd = -1;
+        }
+        if (fd >= 0) {
+            int64_t left_us = deadline_us - esp_timer_get_time();
+            struct timeval tv = { .tv_sec = left_us / 1000000, .tv_usec = left_us % 1000000 };
+            fd_set writable;
+            FD_ZERO(&writable);
+            FD_SET(fd, &writable);
+            int error = 0;
+            socklen_t error_len = sizeof(error);
+            if (left_us <= 0 || select(fd + 1, NULL, &writable, NULL, &tv) <= 0 ||
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_len) != 0 || error != 0) {
+                close(fd);
+                fd = -1;
+            } else {
+                fcntl(fd, F_SETFL, flags);
+            }
+        }
+    }
+    freeaddrinfo(addr);
+    return fd;
+}
+
+static void set_socket_timeout(int fd, int timeout_ms)
+{
+    struct timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+esp_err_t mqtt_tls_connect(const char *host, int port, int timeout_ms)
+{
+    if (tls_transport == NULL || connected) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (host == NULL || strlen(host) > MQTT_TLS_HOST_MAX_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int64_t start_us = esp_timer_get_time();
+    int64_t deadline_us = start_us + (int64_t)timeout_ms * 1000;
+    if (have_session && strcmp(session_host, host) != 0) {
+        // A session is only good with the broker that issued it.
+        session_clear();
+    }
+
+    mbedtls_net_init(&net);
+    mbedtls_ssl_init(&ssl);
+    net.fd = tcp_connect(host, port, deadline_us);
+    int ret = net.fd < 0 ? -1 : mbedtls_ssl_setup(&ssl, &ssl_conf);
+    if (ret == 0) {
+        ret = mbedtls_ssl_set_hostname(&ssl, host);
+    }
+    bool offered = have_session && ret == 0 && mbedtls_ssl_set_session(&ssl, &session) == 0;
+    if (ret == 0) {
+        // Bounds each blocking socket call; the loop below bounds the handshake.
+        set_socket_timeout(net.fd, timeout_ms);
+        mbedtls_ssl_set_bio(&ssl, &net, mbedtls_net_send, mbedtls_net_recv, NULL);
+        full_handshake = false;
+        do {
+            ret = mbedtls_ssl_handshake(&ssl);
+        } while ((ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) &&
+                 esp_timer_get_time() < deadline_us);
+    }
+    uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - start_us);
+
+    if (ret != 0) {
+        stats.failures++;
+        TRACE(TLS_FAILED, -ret, offered);
+        mbedtls_ssl_free(&ssl);
+        mbedtls_net_free(&net);
+        if (offered && ret == MBEDTLS_ERR_SSL_FATAL_ALERT_MESSAGE) {
+            // Do not keep failing on a session the broker chokes on; a
+            // timeout or a lost network says nothing about the session.
+            mqtt_tls_forget_session();
+        }
+        return ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE ? ESP_ERR_TIMEOUT : ESP_FAIL;
+    }
+    connected = true;
+    bool resumed = offered && !full_handshake;
+    stats.connects++;
+    stats.last_handshake_us = elapsed_us;
+    if (resumed) {
+        stats.resumed++;
+        device_metrics_count(METRIC_TLS_RESUMED);
+    }
+    device_metrics_observe(METRIC_TLS_CONNECT_US, elapsed_us);
+    TRACE(TLS_CONNECTED, resumed, elapsed_us);
+
+    // Keep what the broker issued: a new session after a full handshake,
+    // possibly a renewed ticket after a resumed one.
+    session_clear();
+    if (mbedtls_ssl_get_session(&ssl, &session) == 0) {
+        have_session = true;
+        strcpy(session_host, host);
+        if (tls_config.persist_session) {
+            session_persist();
+        }
+    }
+    return ESP_OK;
+}
+
+static int poll_read(int timeout_ms)
+{
+    if (!connected) {
+        return -1;
+    }
+    if (mbedtls_ssl_get_bytes_avail(&ssl) > 0) {
+        return 1;
+    }
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(net.fd, &readable);
+    struct timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+    return select(net.fd + 1, &readable, NULL, NULL, timeout_ms < 0 ? NULL : &tv);
+}
+
+static int poll_write(int timeout_ms)
+{
+    if (!connected) {
+        return -1;
+    }
+    fd_set writable;
+    FD_ZERO(&writable);
+    FD_SET(net.fd, &writable);
+    struct timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+    return select(net.fd + 1, NULL, &writable, NULL, timeout_ms < 0 ? NULL : &tv);
+}
+
+int mqtt_tls_read(char *buf, int len, int timeout_ms)
+{
+    int ready = poll_read(timeout_ms);
+    if (ready <= 0) {
+        return ready == 0 ? ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT : ready;
+    }
+    int ret = mbedtls_ssl_read(&ssl, (unsigned char *)buf, (size_t)len);
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+        return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    }
+    if (ret == 0 || ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+        return ERR_TCP_TRANSPORT_CONNECTION_CLOSED_BY_FIN;
+    }
+    return ret < 0 ? -1 : ret;
+}
+
+int mqtt_tls_write(const char *buf, int len, int timeout_ms)
+{
+    int written = 0;
+
+    while (written < len) {
+        int ready = poll_write(timeout_ms);
+        if (ready <= 0) {
+            return ready == 0 ? ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT : ready;
+        }
+        int ret = mbedtls_ssl_write(&ssl, (const unsigned char *)buf + written, (size_t)(len - written));
+        if (ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            return -1;
+        }
+        written += ret > 0 ? ret : 0;
+    }
+    return written;
+}
+
+void mqtt_tls_close(void)
+{
+    if (!connected) {
+        return;
+    }
+    mbedtls_ssl_close_notify(&ssl);
+    mbedtls_ssl_free(&ssl);
+    mbedtls_net_free(&net);
+    connected = false;
+}
+
+void mqtt_tls_forget_session(void)
+{
+    nvs_handle_t nvs;
+
+    session_clear();
+    memset(saved_hash, 0, sizeof(saved_hash));
+    if (device_nvs_handle(MQTT_TLS_NVS_NAMESPACE, &nvs) == ESP_OK &&
+        nvs_erase_key(nvs, MQTT_TLS_NVS_KEY_SESSION) == ESP_OK) {
+        nvs_commit(nvs);
+    }
+}
+
+// esp_transport callbacks around the functions above.
+
+static int transport_connect(esp_transport_handle_t t, const char *host, int port, int timeout_ms)
+{
+    return mqtt_tls_connect(host, port, timeout_ms) == ESP_OK ? 0 : -1;
+}
+
+static int transport_read(esp_transport_handle_t t, char *buf, int len, int timeout_ms)
+{
+    return mqtt_tls_read(buf, len, timeout_ms);
+}
+
+static int transport_write(esp_transport_handle_t t, const char *buf, int len, int timeout_ms)
+{
+    return mqtt_tls_write(buf, len, timeout_ms);
+}
+
+static int transport_poll_read(esp_transport_handle_t t, int timeout_ms)
+{
+    return poll_read(timeout_ms);
+}
+
+static int transport_poll_write(esp_transport_handle_t t, int timeout_ms)
+{
+    return poll_write(timeout_ms);
+}
+
+static int transport_close(esp_transport_handle_t t)
+{
+    mqtt_tls_close();
+    return 0;
+}
+
+esp_err_t mqtt_tls_init(const mqtt_tls_config_t *config)
+{
+    if (config == NULL || config->ca_pem == NULL || config->ca_pem_len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (tls_transport) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    memset(&stats, 0, sizeof(stats));
+    mbedtls_x509_crt_init(&ca_chain);
+    mbedtls_ssl_config_init(&ssl_conf);
+    mbedtls_ssl_session_init(&session);
+
+    int ret = mbedtls_x509_crt_parse(&ca_chain, (const unsigned char *)config->ca_pem, config->ca_pem_len);
+    if (ret != 0) {
+        ESP_LOGE(TAG_TLS, "Bad broker CA certificate: -0x%x", -ret);
+        mbedtls_x509_crt_free(&ca_chain);
+        return ESP_ERR_INVALID_ARG;
+    }
+    ret = mbedtls_ssl_config_defaults(&ssl_conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT);
+    if (ret != 0) {
+        mbedtls_x509_crt_free(&ca_chain);
+        return ESP_ERR_NO_MEM;
+    }
+    mbedtls_ssl_conf_max_tls_version(&ssl_conf, MBEDTLS_SSL_VERSION_TLS1_2);
+    mbedtls_ssl_conf_authmode(&ssl_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_ca_chain(&ssl_conf, &ca_chain, NULL);
+    mbedtls_ssl_conf_verify(&ssl_conf, tls_verify, NULL);
+    mbedtls_ssl_conf_rng(&ssl_conf, tls_random, NULL);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    // Without tickets the session ID is resumed, if the broker caches sessions.
+    mbedtls_ssl_conf_session_tickets(&ssl_conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+
+    tls_transport = esp_transport_init();
+    if (tls_transport == NULL) {
+        mbedtls_ssl_config_free(&ssl_conf);
+        mbedtls_x509_crt_free(&ca_chain);
+        return ESP_ERR_NO_MEM;
+    }
+    // The transport lives as long as the client, i.e. until reboot; nothing to destroy.
+    esp_transport_set_func(tls_transport, transport_connect, transport_read, transport_write, transport_close,
+                           transport_poll_read, transport_poll_write, NULL);
+    esp_transport_set_default_port(tls_transport, MQTT_TLS_DEFAULT_PORT);
+
+    tls_config = *config;
+    if (tls_config.persist_session) {
+        session_load();
+    }
+    ESP_LOGI(TAG_TLS, "TLS transport ready, %s", have_session ? "stored session found" : "no stored session");
+    return ESP_OK;
+}
+
+esp_transport_handle_t mqtt_tls_get_transport(void)
+{
+    return tls_transport;
+}
+
+void mqtt_tls_get_stats(mqtt_tls_stats_t *out)
+{
+    *out = stats;
+}
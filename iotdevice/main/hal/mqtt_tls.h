@@ -0,0 +1,107 @@
+#ifndef MQTT_TLS_H
+#define MQTT_TLS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_transport.h"
+
+/**
+ * TLS transport of the MQTT client for mqtts:// brokers, with session resumption.
+ *
+ * The TLS session of the last full handshake is kept for the lifetime of
+ * the client and, with CONFIG_NETWORK_MQTT_TLS_PERSIST_SESSION, in NVS, so
+ * reconnects and reboots resume it (session ticket or session ID, whatever
+ * the broker supports) instead of running a full handshake: no certificate
+ * chain to send and verify, no key exchange. A broker that no longer
+ * knows the session simply answers with a full handshake, which is
+ * stored in turn. TLS 1.2 only: a TLS 1.3 ticket arrives after the
+ * handshake and would need the first read to be stored.
+ *
+ * The broker certificate is verified against the CA given at init, with
+ * the host of the broker URI as expected name.
+ */
+
+#define MQTT_TLS_SESSION_MAX 2048       // Serialized session, peer certificate included
+#define MQTT_TLS_HOST_MAX_LEN 63
+
+typedef struct {
+    const char *ca_pem;         // Broker CA, PEM, NUL terminated
+    size_t ca_pem_len;          // Length of ca_pem, NUL included
+    bool persist_session;       // Keep the session in NVS across reboots
+} mqtt_tls_config_t;
+
+#define MQTT_TLS_CONFIG_DEFAULT() {                                 \
+    .ca_pem = NULL,                                                 \
+    .ca_pem_len = 0,                                                \
+    .persist_session = CONFIG_NETWORK_MQTT_TLS_PERSIST_SESSION,     \
+}
+
+typedef struct {
+    uint32_t connects;          // Handshakes completed
+    uint32_t resumed;           // Among them, abbreviated ones on a stored session
+    uint32_t failures;          // TCP connects or handshakes that failed
+    uint32_t session_saves;     // Sessions written to NVS
+    uint32_t last_handshake_us; // TCP connect and handshake time of the last connect
+    bool session_loaded;        // A session from NVS was used after boot
+} mqtt_tls_stats_t;
+
+/**
+ * @brief Parses the CA, loads the stored session and creates the transport.
+ *
+ * @param config CA and session persistence.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a missing or bad CA,
+ *         ESP_ERR_INVALID_STATE if already initialized, ESP_ERR_NO_MEM.
+ */
+esp_err_t mqtt_tls_init(const mqtt_tls_config_t *config);
+
+/**
+ * @brief Transport for esp_mqtt_client_config_t.network.transport.
+ *
+ * @return The transport, NULL before mqtt_tls_init().
+ */
+esp_transport_handle_t mqtt_tls_get_transport(void);
+
+/**
+ * @brief Connects and runs the handshake, resuming the stored session if there is one.
+ *
+ * The connect function of the transport; exposed so the host benchmarks
+ * can drive it. One connection at a time.
+ *
+ * @param host Broker host name, also the name its certificate must carry.
+ * @param port Broker port.
+ * @param timeout_ms Longest time for the TCP connect and the handshake.
+ * @return ESP_OK when connected, ESP_ERR_INVALID_STATE if not initialized
+ *         or already connected, ESP_ERR_TIMEOUT, ESP_FAIL otherwise.
+ */
+esp_err_t mqtt_tls_connect(const char *host, int port, int timeout_ms);
+
+/**
+ * @brief Reads decrypted bytes, same return values as an esp_transport read.
+ */
+int mqtt_tls_read(char *buf, int len, int timeout_ms);
+
+/**
+ * @brief Writes all of buf, same return values as an esp_transport write.
+ */
+int mqtt_tls_write(const char *buf, int len, int timeout_ms);
+
+/**
+ * @brief Sends close_notify and closes the connection; the session is kept.
+ */
+void mqtt_tls_close(void);
+
+/**
+ * @brief Drops the stored session, in RAM and NVS; the next connect runs a full handshake.
+ */
+void mqtt_tls_forget_session(void);
+
+/**
+ * @brief Copies the counters.
+ *
+ * @param out Destination for the counters.
+ */
+void mqtt_tls_get_stats(mqtt_tls_stats_t *out);
+
+#endif // MQTT_TLS_H
@@ -1,45 +1,103 @@
 #include "network_mqtt_handler.h"
-#include "led_control.h" // For LED_GPIO_PIN and led_set_state
-
+#include "command_router.h"
+#include "command_ack.h"
+#include "device_groups.h"
+#include "device_metrics.h"
+#include "mqtt_reassembly.h"
+#include "device_crypto.h"
+#include "boot_profile.h"
+#include "offline_queue.h"
+#include "backoff.h"
+#include "trace_log.h"
+#if CONFIG_NETWORK_MQTT_TLS
+#include "mqtt_tls.h"
+#endif
+
+#include <stdatomic.h>
 #include <stdio.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <string.h>
-#include "esp_wifi.h"
 #include "esp_system.h"
 #include "esp_event.h"
-#include "esp_netif.h"
-// #include "protocol_examples_common.h" // Not strictly needed here if main handles NVS
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "freertos/queue.h"
+#include "freertos/timers.h"
 
-#include "lwip/sockets.h"
-#include "lwip/dns.h"
-#include "lwip/netdb.h"
-
+#include "esp_timer.h"
 #include "esp_log.h"
 
 // Definitions moved from main.c
-#define WIFI_SSID       CONFIG_ESP_WIFI_SSID      // Using Kconfig via sdkconfig
-#define WIFI_PASS       CONFIG_ESP_WIFI_PASSWORD  // Using Kconfig via sdkconfig
 #define MQTT_BROKER_URL CONFIG_ESP_MQTT_BROKER    // Using Kconfig via sdkconfig
-#define MQTT_DEVICE_ID  "esp32_led_controller_01" // Example Device ID
+#define MQTT_DEVICE_ID  CONFIG_ESP_MQTT_DEVICE_ID  // Using Kconfig via sdkconfig
+
+// Command handling lives in command_router.c; handlers are registered by main.c.
 
-// GPIO for LED is better defined in main.c or passed to functions, 
-// but for this example, we will use the one from main.c via led_control.h if needed by handler.
-// For now, we assume main.c passes the correct GPIO to led_set_state.
-// #define LED_GPIO_PIN    GPIO_NUM_15 // This should be managed by the main application logic
+#define MQTT_TOPIC_MAX_LEN 128
+
+#if CONFIG_NETWORK_MQTT_PERSISTENT_SESSION
+#define MQTT_PERSISTENT_SESSION 1
+#else
+#define MQTT_PERSISTENT_SESSION 0
+#endif
+
+#if CONFIG_NETWORK_MQTT_TLS
+#define MQTT_TLS 1
+#else
+#define MQTT_TLS 0
+#endif
 
 static const char *TAG_NET = "NETWORK_MQTT";
 static esp_mqtt_client_handle_t client_handle;
-static char current_led_command_topic[100];
-
-// Forward declaration for wifi_event_handler
-static void wifi_event_handler_internal(void* arg, esp_event_base_t event_base,
-                                int32_t event_id, void* event_data);
+static atomic_bool mqtt_connected;
+static bool mqtt_connected_before; // Only used on the MQTT task
+static network_mqtt_connected_fn_t connected_callback;
+
+// esp-mqtt's own reconnect uses a fixed delay; this one backs off. A
+// FreeRTOS timer, unlike esp_timer, also runs in the linux host build.
+static backoff_t reconnect_backoff = BACKOFF_INIT(CONFIG_NETWORK_RECONNECT_BACKOFF_MIN_MS,
+                                                  CONFIG_NETWORK_RECONNECT_BACKOFF_MAX_MS);
+static StaticTimer_t reconnect_timer_storage;
+static TimerHandle_t reconnect_timer;
+
+// Publishing may happen from several tasks; the transmit crypto context is
+// shared and guarded by tx_lock. It is never held across
+// esp_mqtt_client_publish(), which takes the client lock the MQTT task
+// holds while it runs the event handler. The "home/devices/<id>/" prefix
+// is written once; each publish copies it to build its topic.
+static StaticSemaphore_t tx_lock_storage;
+static SemaphoreHandle_t tx_lock;
+static char tx_prefix[MQTT_TOPIC_MAX_LEN];
+static size_t tx_prefix_len;
+
+// Group changes network_mqtt_subscribe() could not send, guarded by rx_lock
+// (joins and leaves come from command handlers). Sent on the next
+// CONNECTED, also when the broker resumed the session and no full
+// subscribe goes out: joins re-subscribe every group, leaves are kept here.
+static bool pending_joins;
+static char pending_leaves[DEVICE_GROUPS_MAX][MQTT_TOPIC_MAX_LEN];
+static size_t pending_leave_count;
+
+// Commands arrive on the MQTT task and, with CONFIG_LAN_LISTENER, on the
+// LAN listener task. rx_lock runs them one at a time, so handlers, the
+// dedup window and the receive crypto context see a single dispatcher.
+static StaticSemaphore_t rx_lock_storage;
+static SemaphoreHandle_t rx_lock;
+
+#if CONFIG_NETWORK_MQTT_TLS
+// Broker CA, embedded from main/certs/mqtt_broker_ca.pem by main/CMakeLists.txt.
+extern const char mqtt_broker_ca_pem_start[] asm("_binary_mqtt_broker_ca_pem_start");
+extern const char mqtt_broker_ca_pem_end[] asm("_binary_mqtt_broker_ca_pem_end");
+#endif
+
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+static device_crypto_t rx_crypto; // Guarded by rx_lock
+static device_crypto_t tx_crypto;
+#endif
 
 static void log_error_if_nonzero(const char *message, int error_code)
 {
@@ -48,75 +106,276 @@ static void log_error_if_nonzero(const char *message, int error_code)
     }
 }
 
-const char* network_get_led_command_topic(char *buffer, size_t buffer_size) {
-    if (strlen(current_led_command_topic) > 0) {
-        strncpy(buffer, current_led_command_topic, buffer_size -1);
-        buffer[buffer_size - 1] = '\0'; // Ensure null termination
-        return buffer;
+static esp_err_t network_payload_init(void)
+{
+    if (tx_lock) {
+        return ESP_OK;
+    }
+    tx_lock = xSemaphoreCreateMutexStatic(&tx_lock_storage);
+    rx_lock = xSemaphoreCreateMutexStatic(&rx_lock_storage);
+    tx_prefix_len = (size_t)snprintf(tx_prefix, sizeof(tx_prefix), "home/devices/%s/", MQTT_DEVICE_ID);
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+    // GCM key schedules are set up once and reused for every message.
+    esp_err_t err = device_crypto_init(&rx_crypto, CONFIG_DEVICE_AES_KEY, strlen(CONFIG_DEVICE_AES_KEY));
+    if (err == ESP_OK) {
+        err = device_crypto_init(&tx_crypto, CONFIG_DEVICE_AES_KEY, strlen(CONFIG_DEVICE_AES_KEY));
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_NET, "Failed to set up payload encryption: %s", esp_err_to_name(err));
+        return err;
+    }
+#endif
+    return ESP_OK;
+}
+
+// Decrypts and runs one command, with rx_lock held.
+// Runs once per message: only binary trace records here, no log formatting.
+static esp_err_t network_dispatch_locked(const char *topic, size_t topic_len, char *data, size_t data_len, bool lan)
+{
+    int64_t start_us = esp_timer_get_time();
+    size_t frame_len = data_len;
+    esp_err_t err;
+
+    device_metrics_count(lan ? METRIC_LAN_IN : METRIC_MSG_IN);
+
+    // Group commands are encrypted with the group key and only reach group commands.
+    size_t command_off = 0;
+    int group = device_groups_match(topic, topic_len, &command_off);
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+    // Decrypt in the receive buffer, the plaintext replaces the hex frame.
+    err = group >= 0 ? device_groups_decrypt_in_place(group, data, data_len, &data_len)
+                     : device_crypto_decrypt_in_place(&rx_crypto, data, data_len, &data_len);
+    if (err != ESP_OK) {
+        device_metrics_count(METRIC_UNDECRYPTABLE);
+        TRACE(MSG_UNDECRYPTABLE, frame_len, err);
+        return err;
+    }
+#endif
+    uint32_t seq = command_ack_get_seq(data, data_len);
+#if CONFIG_LAN_LISTENER
+    // Nothing stops a LAN frame from being sent again; only recent numbers run.
+    if (lan && !command_ack_is_recent(seq, CONFIG_LAN_LISTENER_SEQ_AHEAD)) {
+        TRACE(LAN_STALE, seq);
+        return ESP_ERR_INVALID_STATE;
+    }
+#endif
+    // A redelivered command, or one that came the other way first, is acked again but not run again.
+    if (seq && !command_ack_begin(seq, start_us)) {
+        return ESP_OK;
+    }
+    if (group >= 0) {
+        err = command_router_dispatch_group(topic + command_off, topic_len - command_off, data, data_len);
+    } else {
+        err = command_router_dispatch(topic, topic_len, data, data_len);
+    }
+    if (seq) {
+        command_ack_end(err);
+    }
+    if (err != ESP_OK) {
+        device_metrics_count(METRIC_COMMAND_FAILURES);
+    }
+    if (err == ESP_ERR_NOT_FOUND) {
+        TRACE(CMD_NO_HANDLER, topic_len);
+    } else if (err != ESP_OK) {
+        TRACE(CMD_FAILED, err);
+    }
+    uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - start_us);
+    device_metrics_observe(METRIC_DISPATCH_US, elapsed_us);
+    TRACE(MSG_DISPATCHED, frame_len, elapsed_us);
+    return err;
+}
+
+// Called by the reassembly stage with a complete message.
+static void network_dispatch_message(const char *topic, size_t topic_len, char *data, size_t data_len)
+{
+    xSemaphoreTake(rx_lock, portMAX_DELAY);
+    network_dispatch_locked(topic, topic_len, data, data_len, false);
+    xSemaphoreGive(rx_lock);
+}
+
+#if CONFIG_LAN_LISTENER
+esp_err_t network_dispatch_lan(const char *topic, size_t topic_len, char *data, size_t data_len)
+{
+    if (rx_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(rx_lock, portMAX_DELAY);
+    esp_err_t err = network_dispatch_locked(topic, topic_len, data, data_len, true);
+    xSemaphoreGive(rx_lock);
+    return err;
+}
+#endif
+
+static uint32_t network_now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static void network_reconnect_timer_cb(TimerHandle_t timer)
+{
+    esp_mqtt_client_reconnect(client_handle);
+}
+
+static void network_schedule_reconnect(void)
+{
+    uint32_t attempt = reconnect_backoff.attempt + 1;
+    uint32_t delay_ms = backoff_next_ms(&reconnect_backoff);
+
+    TRACE(MQTT_RETRY, delay_ms, attempt);
+    // Starts the timer too; the period must be at least one tick.
+    xTimerChangePeriod(reconnect_timer, pdMS_TO_TICKS(delay_ms) + 1, 0);
+}
+
+// The boot profile goes out once per boot, at QoS 1 so it is not lost.
+// It is queued and sent by the offline queue task on its next poll: the
+// event handler runs with the client lock held and must not publish.
+static int network_publish_boot_profile(const char *subtopic, char *buf, size_t len, size_t buf_size)
+{
+    return offline_queue_push(subtopic, buf, len, 1, 0) == ESP_OK ? 0 : -1;
+}
+
+// Records a change to send on the next CONNECTED, with rx_lock held.
+// Returns false when DEVICE_GROUPS_MAX leaves already wait.
+static bool network_queue_group_change(const char *topic, bool subscribe)
+{
+    size_t i = 0;
+    while (i < pending_leave_count && strcmp(pending_leaves[i], topic) != 0) {
+        i++;
+    }
+    if (subscribe) {
+        pending_joins = true;
+        if (i < pending_leave_count) {
+            // Joined again: drop the leave.
+            memmove(pending_leaves[i], pending_leaves[i + 1], (pending_leave_count - i - 1) * MQTT_TOPIC_MAX_LEN);
+            pending_leave_count--;
+        }
+    } else if (i == pending_leave_count) {
+        if (pending_leave_count == DEVICE_GROUPS_MAX) {
+            ESP_LOGW(TAG_NET, "Too many groups left while offline, keeping %s", topic);
+            return false;
+        }
+        snprintf(pending_leaves[pending_leave_count++], MQTT_TOPIC_MAX_LEN, "%s", topic);
+    }
+    return true;
+}
+
+static void network_clear_pending_groups(void)
+{
+    xSemaphoreTake(rx_lock, portMAX_DELAY);
+    pending_joins = false;
+    pending_leave_count = 0;
+    xSemaphoreGive(rx_lock);
+}
+
+// Sends the group changes made while offline; returns the last message ID, 0 if none.
+static int network_send_pending_groups(esp_mqtt_client_handle_t client)
+{
+    esp_mqtt_topic_t topics[DEVICE_GROUPS_MAX];
+    int topic_count = 0;
+    int msg_id = 0;
+
+    xSemaphoreTake(rx_lock, portMAX_DELAY);
+    if (pending_joins) {
+        // Subscribing again to a group kept by the broker does no harm.
+        for (size_t i = 0; i < DEVICE_GROUPS_MAX; i++) {
+            const char *group_topic = device_groups_get_topic(i);
+            if (group_topic) {
+                topics[topic_count++] = (esp_mqtt_topic_t){ .filter = group_topic, .qos = 1 };
+            }
+        }
+        if (topic_count > 0) {
+            msg_id = esp_mqtt_client_subscribe_multiple(client, topics, topic_count);
+        }
+        pending_joins = msg_id < 0;
     }
-    return NULL;
+    size_t kept = 0;
+    for (size_t i = 0; i < pending_leave_count; i++) {
+        int id = esp_mqtt_client_unsubscribe(client, pending_leaves[i]);
+        if (id < 0) {
+            memmove(pending_leaves[kept++], pending_leaves[i], MQTT_TOPIC_MAX_LEN);
+        } else {
+            msg_id = id;
+        }
+    }
+    pending_leave_count = kept;
+    xSemaphoreGive(rx_lock);
+    return msg_id;
 }
 
 void network_mqtt_event_handler_cb(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
 {
-    ESP_LOGD(TAG_NET, "Event dispatched from event loop base=%s, event_id=%lu", base, event_id);
     esp_mqtt_event_handle_t event = event_data;
     esp_mqtt_client_handle_t local_client = event->client;
+    esp_mqtt_topic_t topics[1 + DEVICE_GROUPS_MAX];
+    int topic_count = 0;
     int msg_id;
 
-    // GPIO pin should be passed or globally accessible if this handler directly controls hardware
-    // For this refactoring, we assume the main application or a specific LED module handles the GPIO action.
-    // extern const gpio_num_t LED_GPIO_PIN; // Example if it were global in main
-
     switch ((esp_mqtt_event_id_t)event_id) {
     case MQTT_EVENT_CONNECTED:
-        ESP_LOGI(TAG_NET, "MQTT_EVENT_CONNECTED");
-        snprintf(current_led_command_topic, sizeof(current_led_command_topic), "home/devices/%s/command/setLed", MQTT_DEVICE_ID);
-        msg_id = esp_mqtt_client_subscribe(local_client, current_led_command_topic, 0);
-        ESP_LOGI(TAG_NET, "sent subscribe successful, msg_id=%d, topic=%s", msg_id, current_led_command_topic);
+        ESP_LOGI(TAG_NET, "MQTT_EVENT_CONNECTED, session_present=%d", event->session_present);
+        boot_profile_mark(BOOT_PHASE_MQTT_CONNECTED);
+        backoff_reset(&reconnect_backoff);
+        if (mqtt_connected_before) {
+            device_metrics_count(METRIC_RECONNECTS);
+        }
+        mqtt_connected_before = true;
+        atomic_store(&mqtt_connected, true);
+        offline_queue_set_online(true, network_now_ms());
+        if (connected_callback) {
+            connected_callback();
+        }
+        if (event->session_present) {
+            // Persistent session: the broker kept the subscription, commands flow right away.
+            boot_profile_set_flags(BOOT_FLAG_SESSION_PRESENT);
+            boot_profile_mark(BOOT_PHASE_SUBSCRIBED);
+            boot_profile_publish(network_publish_boot_profile);
+            // Only group changes made while offline go out; msg_id 0 if there were none.
+            TRACE(MQTT_CONNECTED, network_send_pending_groups(local_client));
+            break;
+        }
+        // One wildcard subscription covers every command registered with the
+        // router, one more per group; all go out in a single SUBSCRIBE. QoS 1
+        // so commands are not lost, redeliveries are caught by command_ack.
+        topics[topic_count++] = (esp_mqtt_topic_t){ .filter = command_router_get_subscribe_topic(), .qos = 1 };
+        for (size_t i = 0; i < DEVICE_GROUPS_MAX; i++) {
+            const char *group_topic = device_groups_get_topic(i);
+            if (group_topic) {
+                topics[topic_count++] = (esp_mqtt_topic_t){ .filter = group_topic, .qos = 1 };
+            }
+        }
+        network_clear_pending_groups(); // The broker kept nothing, everything is in this subscribe
+        msg_id = esp_mqtt_client_subscribe_multiple(local_client, topics, topic_count);
+        ESP_LOGI(TAG_NET, "sent subscribe successful, msg_id=%d, topics=%d", msg_id, topic_count);
+        TRACE(MQTT_CONNECTED, msg_id);
         break;
     case MQTT_EVENT_DISCONNECTED:
         ESP_LOGI(TAG_NET, "MQTT_EVENT_DISCONNECTED");
+        TRACE(MQTT_DISCONNECTED);
+        atomic_store(&mqtt_connected, false);
+        offline_queue_set_online(false, network_now_ms());
+        mqtt_reassembly_reset();
+        network_schedule_reconnect();
         break;
     case MQTT_EVENT_SUBSCRIBED:
-        ESP_LOGI(TAG_NET, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
+        TRACE(MQTT_SUBSCRIBED, event->msg_id);
+        boot_profile_mark(BOOT_PHASE_SUBSCRIBED);
+        boot_profile_publish(network_publish_boot_profile);
         break;
     case MQTT_EVENT_UNSUBSCRIBED:
-        ESP_LOGI(TAG_NET, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
         break;
     case MQTT_EVENT_PUBLISHED:
-        ESP_LOGI(TAG_NET, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+        TRACE(MQTT_PUBLISHED, event->msg_id);
         break;
     case MQTT_EVENT_DATA:
-        ESP_LOGI(TAG_NET, "MQTT_EVENT_DATA");
-        printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
-        printf("DATA=%.*s\r\n", event->data_len, event->data);
-        if (strncmp(event->topic, current_led_command_topic, event->topic_len) == 0) {
-            ESP_LOGI(TAG_NET, "Received command for LED via network handler");
-            // Decision: This handler *could* call led_set_state directly if it knew the GPIO.
-            // Or, it could raise an application-specific event, or call a callback.
-            // For now, let's assume main.c will retrieve the topic and data if needed, 
-            // or that a more specific handler is registered for this topic.
-            // This callback is generic for all MQTT data. If direct action is needed here:
-            // led_set_state(SOME_LED_GPIO_PIN, (strncmp(event->data, "true", event->data_len) == 0));
-            // This example keeps the LED control in main.c for clarity of this refactor step.
-            // The original main.c's MQTT handler did this directly. We'll adjust main.c to use this callback.
-            if (handler_args) {
-                gpio_num_t led_pin = *(gpio_num_t*)handler_args;
-                 if (strncmp(event->data, "true", event->data_len) == 0) {
-                    led_set_state(led_pin, true);
-                    ESP_LOGI(TAG_NET, "LED turned ON by network_mqtt_event_handler_cb");
-                } else if (strncmp(event->data, "false", event->data_len) == 0) {
-                    led_set_state(led_pin, false);
-                    ESP_LOGI(TAG_NET, "LED turned OFF by network_mqtt_event_handler_cb");
-                } else {
-                    ESP_LOGW(TAG_NET, "Unknown LED command payload in network_mqtt_event_handler_cb: %.*s", event->data_len, event->data);
-                }
-            }
-        }
+        // Keep this path short: it runs on the MQTT task, handlers only parse and enqueue.
+        TRACE(MQTT_DATA, event->topic_len, event->data_len, event->current_data_offset, event->total_data_len);
+        mqtt_reassembly_feed(event->topic, event->topic_len, event->data, event->data_len,
+                             event->current_data_offset, event->total_data_len, network_dispatch_message);
         break;
     case MQTT_EVENT_ERROR:
         ESP_LOGI(TAG_NET, "MQTT_EVENT_ERROR");
+        TRACE(MQTT_ERROR, event->error_handle->error_type, event->error_handle->esp_tls_last_esp_error,
+              event->error_handle->esp_tls_stack_error, event->error_handle->esp_transport_sock_errno);
         if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
             log_error_if_nonzero("reported from esp-tls", event->error_handle->esp_tls_last_esp_error);
             log_error_if_nonzero("reported from tls stack", event->error_handle->esp_tls_stack_error);
@@ -125,178 +384,141 @@ void network_mqtt_event_handler_cb(void *handler_args, esp_event_base_t base, in
         }
         break;
     default:
-        ESP_LOGI(TAG_NET, "Other event id:%d", event->event_id);
         break;
     }
 }
 
-void network_mqtt_app_start(void)
+int network_mqtt_send(const char *subtopic, char *buf, size_t len, size_t buf_size, int qos, int retain)
 {
-    esp_mqtt_client_config_t mqtt_cfg = {
-        // .broker.address.uri = MQTT_BROKER_URL, // For ESP-IDF v5.x and later
-        .uri = MQTT_BROKER_URL, // For ESP-IDF v4.x. Ensure your IDF version matches.
-    };
-    client_handle = esp_mqtt_client_init(&mqtt_cfg);
-    // Pass LED_GPIO_PIN as handler_args. This requires LED_GPIO_PIN to be known here or passed to network_mqtt_app_start.
-    // For now, we will modify main.c to pass its LED_GPIO_PIN.
-    // The typecast (void*)&LED_GPIO_PIN assumes LED_GPIO_PIN is accessible and its address can be passed.
-    // This will be set up in main.c when calling this function.
-    // esp_mqtt_client_register_event(client_handle, ESP_EVENT_ANY_ID, network_mqtt_event_handler_cb, (void*)&LED_GPIO_PIN_FROM_MAIN);
-    // For now, passing NULL. Will adjust main to pass the arg.
-    // The handler_args in network_mqtt_event_handler_cb will receive this.     
-    // To make this more robust, network_mqtt_app_start could take the pin as an argument.
-    // For now, main.c will need to pass the address of its LED_GPIO_PIN variable.     
-    // We will adjust main.c to pass the LED_GPIO_PIN to this function, which then passes to register_event
-    // Let's assume network_mqtt_app_start will take a gpio_num_t argument for the LED pin.
-
-    // Simplification: Pass NULL for now, main.c must set up the handler args correctly.    
-    // esp_mqtt_client_register_event(client_handle, ESP_EVENT_ANY_ID, network_mqtt_event_handler_cb, NULL);
-    // Correct approach: network_mqtt_app_start should accept the pin and pass it.
-    // For now, the callback will have to be adapted or main provide the pin to it. The current callback expects it via handler_args.
-    // The provided signature for network_mqtt_app_start doesn't take args. Will modify main.c to call the event registration itself or modify this function.
-    // For this iteration, let main.c register the event with the correct arguments.
-    // This function will just init and start.
-    esp_mqtt_client_start(client_handle);
-    ESP_LOGI(TAG_NET, "MQTT client started.");
+    int msg_id = -1;
+
+    if (client_handle == NULL || tx_lock == NULL) {
+        return -1;
+    }
+    int64_t start_us = esp_timer_get_time();
+    size_t subtopic_len = strlen(subtopic);
+    char topic[MQTT_TOPIC_MAX_LEN];
+    if (tx_prefix_len + subtopic_len < sizeof(topic)) {
+        memcpy(topic, tx_prefix, tx_prefix_len);
+        memcpy(topic + tx_prefix_len, subtopic, subtopic_len + 1);
+        size_t frame_len = len;
+        esp_err_t err = ESP_OK;
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+        xSemaphoreTake(tx_lock, portMAX_DELAY);
+        err = device_crypto_encrypt_in_place(&tx_crypto, buf, len, buf_size, &frame_len);
+        xSemaphoreGive(tx_lock);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG_NET, "Failed to encrypt message for %s: %s", subtopic, esp_err_to_name(err));
+        }
+#endif
+        if (err == ESP_OK) {
+            msg_id = esp_mqtt_client_publish(client_handle, topic, buf, (int)frame_len, qos, retain);
+            device_metrics_count(msg_id >= 0 ? METRIC_MSG_OUT : METRIC_PUBLISH_FAILURES);
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+            if (msg_id < 0) {
+                // Hand the plaintext back so the caller can queue it.
+                xSemaphoreTake(tx_lock, portMAX_DELAY);
+                device_crypto_decrypt_in_place(&tx_crypto, buf, frame_len, &len);
+                xSemaphoreGive(tx_lock);
+            }
+#endif
+        }
+    }
+    device_metrics_observe(METRIC_PUBLISH_US, (uint32_t)(esp_timer_get_time() - start_us));
+    return msg_id;
 }
 
-// This internal handler is registered for Wi-Fi/IP events
-static void wifi_event_handler_internal(void* arg, esp_event_base_t event_base,
-                                int32_t event_id, void* event_data)
+int network_mqtt_publish(const char *subtopic, char *buf, size_t len, size_t buf_size, int qos, int retain)
 {
-    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        esp_wifi_connect();
-    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        ESP_LOGI(TAG_NET, "Wi-Fi disconnected, trying to reconnect...");
-        esp_wifi_connect(); // Simple reconnect
-    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
-        ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-        ESP_LOGI(TAG_NET, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
-        
-        // Get the LED pin from arg, passed from network_wifi_init_sta
-        if (arg) {
-            gpio_num_t led_pin_for_mqtt = *(gpio_num_t*)arg;
-            // Register event handler with the LED pin now that we have it.
-            // This assumes client_handle is initialized by network_mqtt_app_start which is called after this.
-            // This is a bit tangled. Let's simplify.
-            // network_mqtt_app_start should be called here, and *it* should handle its event registration.
-            // The arg to wifi_event_handler_internal can be the LED pin for MQTT handler setup.
-            esp_mqtt_client_register_event(client_handle, ESP_EVENT_ANY_ID, network_mqtt_event_handler_cb, arg /* Pass led_pin as arg */);
+    // While older messages wait in the offline queue new ones go behind them, to keep the order.
+    if (atomic_load(&mqtt_connected) && offline_queue_is_empty()) {
+        int msg_id = network_mqtt_send(subtopic, buf, len, buf_size, qos, retain);
+        if (msg_id >= 0) {
+            return msg_id;
         }
-        network_mqtt_app_start(); // Starts client, which should then register its own event handler *with the pin*
     }
+    if (offline_queue_push(subtopic, buf, len, qos, retain) != ESP_OK) {
+        return -1;
+    }
+    device_metrics_count(METRIC_MSG_QUEUED);
+    return 0;
 }
 
-void network_wifi_init_sta(void) // Modified to accept LED pin for MQTT handler
+int network_mqtt_subscribe(const char *topic, bool subscribe)
 {
-    // This function will now need the LED_GPIO_PIN to pass to the wifi_event_handler, 
-    // which in turn passes it to the mqtt_event_handler. This is getting complex.
-    // A better way: main.c gets the LED_GPIO_PIN. Calls network_wifi_init_sta.
-    // After IP, main.c calls network_mqtt_app_start, passing LED_GPIO_PIN to it.
-    // network_mqtt_app_start then registers network_mqtt_event_handler_cb with that pin.
-    // Let's adjust network_mqtt_app_start to take the pin.
-
-    // Current approach: wifi_event_handler_internal will call network_mqtt_app_start() WITHOUT the pin.
-    // network_mqtt_app_start() will then register ITS OWN callback network_mqtt_event_handler_cb, but it needs the pin.
-    // This means client_handle must be accessible to network_mqtt_event_handler_cb or its setup.
-
-    // Simpler: main calls network_wifi_init_sta. When IP is obtained, main calls network_mqtt_app_start(LED_GPIO_PIN).
-    // Let's revert wifi_event_handler_internal to not take args and simply call network_mqtt_app_start (which will be modified).
-
-    ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
-    esp_netif_create_default_wifi_sta();
-
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-
-    esp_event_handler_instance_t instance_any_id;
-    esp_event_handler_instance_t instance_got_ip;
-    // Pass NULL as arg here, the MQTT setup will be triggered by main after IP is obtained.
-    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler_internal, NULL, &instance_any_id));
-    ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler_internal, NULL, &instance_got_ip));
-
-    wifi_config_t wifi_config = {
-        .sta = {
-            //.ssid = WIFI_SSID, // Use Kconfig
-            //.password = WIFI_PASS, // Use Kconfig
-            .threshold.authmode = WIFI_AUTH_WPA2_PSK, // Example, adjust as needed
-        },
-    };
-    // For Kconfig, SSID and password are set if CONFIG_ESP_WIFI_SSID and CONFIG_ESP_WIFI_PASSWORD are in sdkconfig
-    // If you are using #defines directly like before, uncomment above and fill them.
-    // For this example, we assume Kconfig via sdkconfig will provide SSID/PASS.
-    // If not using Kconfig for SSID/PASS, ensure they are set in wifi_config.sta.ssid and .password
-    strncpy((char*)wifi_config.sta.ssid, WIFI_SSID, sizeof(wifi_config.sta.ssid));
-    strncpy((char*)wifi_config.sta.password, WIFI_PASS, sizeof(wifi_config.sta.password));
-
-
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config) );
-    ESP_ERROR_CHECK(esp_wifi_start() );
-
-    ESP_LOGI(TAG_NET, "wifi_init_sta finished.");
-    ESP_LOGI(TAG_NET, "connect to ap SSID:%s", WIFI_SSID);
+    int msg_id = -1;
+    if (client_handle != NULL && atomic_load(&mqtt_connected)) {
+        msg_id = subscribe ? esp_mqtt_client_subscribe_single(client_handle, topic, 1)
+                           : esp_mqtt_client_unsubscribe(client_handle, topic);
+    }
+    if (msg_id < 0) {
+        // Offline or not sent: the next CONNECTED sends it, session resumed or not.
+        return network_queue_group_change(topic, subscribe) ? 0 : -1;
+    }
+    return msg_id;
 }
 
-// Modify network_mqtt_app_start to accept the pin for the handler_args
-void network_mqtt_app_start_with_pin(gpio_num_t led_pin)
+void network_mqtt_set_connected_callback(network_mqtt_connected_fn_t connected)
 {
-    esp_mqtt_client_config_t mqtt_cfg = {
-        .uri = MQTT_BROKER_URL,
-    };
-    client_handle = esp_mqtt_client_init(&mqtt_cfg);
-    
-    // We need to pass the address of a gpio_num_t. 
-    // If led_pin is a local copy, its address is temporary.
-    // Best if main.c owns the gpio_num_t variable and passes its address.
-    // For now, let's assume led_pin itself (if it's global or static in main) can be cast and passed.
-    // This is tricky. The handler_args needs to be valid for the lifetime of the handler.
-    // A static variable in this file to hold the pin, set by this function, is safer.
-    static gpio_num_t mqtt_handler_led_pin;
-    mqtt_handler_led_pin = led_pin;
-
-    esp_mqtt_client_register_event(client_handle, ESP_EVENT_ANY_ID, network_mqtt_event_handler_cb, &mqtt_handler_led_pin);
-    esp_mqtt_client_start(client_handle);
-    ESP_LOGI(TAG_NET, "MQTT client started with LED pin %d for handler.", led_pin);
+    connected_callback = connected;
 }
 
-// Original network_mqtt_app_start, now calls the one with pin if we decide to pass it this way.
-// For clarity, main.c should call network_mqtt_app_start_with_pin directly.
-// So, we rename network_mqtt_app_start_with_pin to network_mqtt_app_start and update header.
-// The header for network_mqtt_app_start needs to be updated if it takes an arg.
-// The current header for network_mqtt_app_start has no args.
-// Let's modify the header and this function name to reflect it takes the pin.
-
-// Renaming network_mqtt_app_start_with_pin to network_mqtt_app_start and assuming header is updated.
-// The header has `void network_mqtt_app_start(void);`
-// This means main will call this, and this function needs to get the pin some other way, or the event handler needs to be registered by main.
-
-// To stick to the current header `void network_mqtt_app_start(void);`:
-// The event registration with the pin needs to happen in main.c after calling this, or this function needs a way to get the pin.
-// Let's go with: main.c registers the event handler using client_handle returned by this init function (if it returned it).
-// Or, make client_handle static global here and main.c can call esp_mqtt_client_register_event itself.
-// Let's make client_handle static here. main.c can then register the event handler.
-// Getter for client_handle:
 esp_mqtt_client_handle_t network_get_mqtt_client_handle(void) {
     return client_handle;
 }
 
-// network_mqtt_app_start will just init and start the client.
-// main.c will be responsible for registering the event handler with the correct (void*)led_gpio_pin_ptr argument.
-void network_mqtt_app_start(void) // Matches header: void network_mqtt_app_start(void);
+// Called on every IP_EVENT_STA_GOT_IP. The client is created and started
+// once; later calls reconnect right away instead of waiting out the backoff.
+void network_mqtt_app_start(void)
 {
     esp_mqtt_client_config_t mqtt_cfg = {
-        .uri = MQTT_BROKER_URL,
+        .broker.address.uri = MQTT_BROKER_URL,
+        // The broker keys persistent sessions by client ID, so it has to be stable.
+        .credentials.client_id = MQTT_DEVICE_ID,
+        .session.disable_clean_session = MQTT_PERSISTENT_SESSION,
+        .session.keepalive = CONFIG_NETWORK_MQTT_KEEPALIVE_S,
+        // Reconnects are scheduled by network_schedule_reconnect().
+        .network.disable_auto_reconnect = true,
+        // Allocated once with the client, which lives until reboot.
+        .buffer.size = CONFIG_NETWORK_MQTT_RX_BUFFER_SIZE,
+        .buffer.out_size = CONFIG_NETWORK_MQTT_TX_BUFFER_SIZE,
+        .task.stack_size = CONFIG_NETWORK_MQTT_TASK_STACK_SIZE,
+        .outbox.limit = CONFIG_NETWORK_MQTT_OUTBOX_LIMIT,
     };
     if (client_handle) {
-        ESP_LOGW(TAG_NET, "MQTT client already initialized. Re-starting.");
-        esp_mqtt_client_stop(client_handle);
-        esp_mqtt_client_destroy(client_handle);
+        if (!atomic_load(&mqtt_connected)) {
+            // A new IP means the broker is likely reachable again.
+            xTimerStop(reconnect_timer, 0);
+            backoff_reset(&reconnect_backoff);
+            esp_mqtt_client_reconnect(client_handle);
+        }
+        return;
+    }
+    if (network_payload_init() != ESP_OK) {
+        return;
+    }
+#if CONFIG_NETWORK_MQTT_TLS
+    // Our transport instead of the esp-tls one, which forgets the session on every reconnect.
+    mqtt_tls_config_t tls_cfg = MQTT_TLS_CONFIG_DEFAULT();
+    tls_cfg.ca_pem = mqtt_broker_ca_pem_start;
+    tls_cfg.ca_pem_len = (size_t)(mqtt_broker_ca_pem_end - mqtt_broker_ca_pem_start);
+    esp_err_t err = mqtt_tls_init(&tls_cfg);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG_NET, "Failed to set up the TLS transport");
+        return;
     }
+    mqtt_cfg.network.transport = mqtt_tls_get_transport();
+#endif
+    reconnect_timer = xTimerCreateStatic("mqtt_reconnect", 1, pdFALSE, NULL, network_reconnect_timer_cb,
+                                         &reconnect_timer_storage);
     client_handle = esp_mqtt_client_init(&mqtt_cfg);
-    // Event registration will be done in main.c using network_get_mqtt_client_handle()
-    // and network_mqtt_event_handler_cb
+    if (client_handle == NULL) {
+        ESP_LOGE(TAG_NET, "Failed to create the MQTT client");
+        return;
+    }
+    // Registered before the start so the first MQTT_EVENT_CONNECTED is not missed.
+    esp_mqtt_client_register_event(client_handle, ESP_EVENT_ANY_ID, network_mqtt_event_handler_cb, NULL);
     esp_mqtt_client_start(client_handle);
-    ESP_LOGI(TAG_NET, "MQTT client initialized and started. Register event handler in main.");
-} 
\ No newline at end of file
+    ESP_LOGI(TAG_NET, "MQTT client started (persistent session %s, TLS %s)",
+             MQTT_PERSISTENT_SESSION ? "on" : "off", MQTT_TLS ? "on" : "off");
+}
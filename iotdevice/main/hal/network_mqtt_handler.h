@@ -1,22 +1,34 @@
 #ifndef NETWORK_MQTT_HANDLER_H
 #define NETWORK_MQTT_HANDLER_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include "esp_event.h"
 #include "mqtt_client.h"
-#include "driver/gpio.h" // For gpio_num_t in callback signature if used directly
 
 /**
- * @brief Initializes Wi-Fi connection in STA mode.
+ * @brief Creates, registers and starts the MQTT client.
+ *
+ * Called by the Wi-Fi layer whenever an IP address is obtained. The first
+ * call creates the client, with a persistent session when
+ * CONFIG_NETWORK_MQTT_PERSISTENT_SESSION is set. Lost connections are
+ * retried with exponential backoff; later calls retry immediately.
+ */
+void network_mqtt_app_start(void);
+
+/**
+ * @brief Called on the MQTT task whenever the broker accepted the connection.
  */
-void network_wifi_init_sta(void);
+typedef void (*network_mqtt_connected_fn_t)(void);
 
 /**
- * @brief Initializes and starts the MQTT client application.
+ * @brief Sets the function called on every MQTT connect.
+ *
+ * Set before network_wifi_init_sta(), so the first connect is not missed.
  *
- * Call this after Wi-Fi is connected. The MQTT event handler
- * should be registered separately in main after calling this.
+ * @param connected Function to call, NULL for none.
  */
-void network_mqtt_app_start(void);
+void network_mqtt_set_connected_callback(network_mqtt_connected_fn_t connected);
 
 /**
  * @brief Gets the MQTT client handle.
@@ -25,23 +37,85 @@ void network_mqtt_app_start(void);
  */
 esp_mqtt_client_handle_t network_get_mqtt_client_handle(void);
 
+/**
+ * @brief Publishes a device message on home/devices/<id>/<subtopic>.
+ *
+ * With CONFIG_DEVICE_PAYLOAD_ENCRYPTION the payload is encrypted in place,
+ * so buf must hold DEVICE_CRYPTO_FRAME_LEN(len) bytes and is clobbered.
+ * While the broker is unreachable, or older messages are still queued,
+ * the message goes to the offline queue and is replayed after reconnecting.
+ * Safe to call from any task.
+ *
+ * @param subtopic Topic below the device namespace, e.g. "telemetry".
+ * @param buf Payload buffer.
+ * @param len Length of the payload.
+ * @param buf_size Size of buf.
+ * @param qos MQTT QoS level.
+ * @param retain MQTT retain flag.
+ * @return Message ID on success, 0 if queued, -1 on failure.
+ */
+int network_mqtt_publish(const char *subtopic, char *buf, size_t len, size_t buf_size, int qos, int retain);
+
+/**
+ * @brief Publishes a device message right away, bypassing the offline queue.
+ *
+ * Same as network_mqtt_publish() otherwise; this is the send function of
+ * the offline queue replay. On failure buf holds the plaintext again.
+ *
+ * @return Message ID on success, -1 on failure.
+ */
+int network_mqtt_send(const char *subtopic, char *buf, size_t len, size_t buf_size, int qos, int retain);
+
+/**
+ * @brief Subscribes to or unsubscribes from a topic filter at QoS 1.
+ *
+ * Used when a group is joined or left, from a command handler (the
+ * command lock held). A change that cannot be sent, e.g. while
+ * disconnected, is sent on the next connect, also when the broker resumed
+ * the session and the full subscribe is skipped. Up to DEVICE_GROUPS_MAX
+ * unsubscribes wait that way; beyond that the change is refused.
+ *
+ * @param topic Topic filter.
+ * @param subscribe true to subscribe, false to unsubscribe.
+ * @return Message ID, 0 if left for the next connect, -1 if refused.
+ */
+int network_mqtt_subscribe(const char *topic, bool subscribe);
+
+/**
+ * @brief Runs a command received outside MQTT, the dispatch function of hal/lan_listener.h.
+ *
+ * Same path as a message from the broker: decryption with the device or
+ * group key, dedup and ack by sequence number, command_router. The command
+ * must carry a sequence number command_ack_is_recent() accepts. Runs
+ * under the lock MQTT deliveries take, so handlers still see one command
+ * at a time. data is decrypted in place. Only built with CONFIG_LAN_LISTENER.
+ *
+ * @param topic Command topic, as it would be published on the broker.
+ * @param topic_len Length of topic.
+ * @param data Encrypted frame.
+ * @param data_len Length of data.
+ * @return ESP_OK when run or dropped as a duplicate, ESP_ERR_INVALID_STATE
+ *         before the MQTT client is set up or for a stale or missing
+ *         sequence number, the decryption error for a forged frame, or
+ *         the handler result.
+ */
+esp_err_t network_dispatch_lan(const char *topic, size_t topic_len, char *data, size_t data_len);
+
 /**
  * @brief Callback function for MQTT events.
  *
- * @param handler_args Arguments passed during registration (expected to be gpio_num_t* for LED pin).
+ * Subscribes to the command namespace and the topics of the device
+ * groups on connect (if the broker resumed the session, only the group
+ * changes made while offline), queues the boot profile once subscribed (the
+ * offline queue task sends it; nothing is published from this handler) and
+ * hands every MQTT_EVENT_DATA to command_router_dispatch(). Registered by
+ * network_mqtt_app_start().
+ *
+ * @param handler_args Arguments passed during registration (unused).
  * @param base Event base.
  * @param event_id Event ID.
  * @param event_data Event data.
  */
 void network_mqtt_event_handler_cb(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data);
 
-/**
- * @brief Get the LED command topic string.
- *
- * @param buffer Buffer to store the topic string.
- * @param buffer_size Size of the buffer.
- * @return Pointer to the buffer if successful, NULL otherwise.
- */
-const char* network_get_led_command_topic(char *buffer, size_t buffer_size);
-
 #endif // NETWORK_MQTT_HANDLER_H 
\ No newline at end of file
@@ -0,0 +1,284 @@
+#include "network_wifi.h"
+#include "network_mqtt_handler.h"
+#include "boot_profile.h"
+#include "device_metrics.h"
+#include "backoff.h"
+#include "trace_log.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include "esp_wifi.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_timer.h"
+#include "device_nvs.h"
+#include "esp_log.h"
+
+// Wi-Fi lives apart from the MQTT handler so the message path builds for the linux target.
+#define WIFI_SSID       CONFIG_ESP_WIFI_SSID
+#define WIFI_PASS       CONFIG_ESP_WIFI_PASSWORD
+
+#define WIFI_NVS_NAMESPACE      "net"
+#define WIFI_NVS_KEY_CACHE      "wifi_cache"
+#define WIFI_CACHE_VERSION      1
+#define WIFI_CACHE_MAX_FAILURES 2 // Failed associations before the cache is dropped
+#define WIFI_FALLBACK_RETRY_MS  100 // Event loop queue was full, post again
+
+static const char *TAG_WIFI = "NETWORK_WIFI";
+
+/*
+ * What a full scan and DHCP found on the last good connection. Written to
+ * NVS only when it changes, to spare the flash.
+ */
+typedef struct {
+    uint8_t version;
+    uint8_t channel;
+    uint8_t bssid[6];
+    char ssid[33];                  // Cache only applies to the SSID it was made for
+    esp_netif_ip_info_t ip_info;
+    esp_ip4_addr_t dns;
+} wifi_cache_t;
+
+static esp_netif_t *sta_netif;
+
+// Reconnects back off instead of retrying in a tight loop while the AP is away.
+static backoff_t reconnect_backoff = BACKOFF_INIT(CONFIG_NETWORK_RECONNECT_BACKOFF_MIN_MS,
+                                                  CONFIG_NETWORK_RECONNECT_BACKOFF_MAX_MS);
+static esp_timer_handle_t reconnect_timer;
+
+#if CONFIG_NETWORK_FAST_RECONNECT
+static wifi_cache_t wifi_cache;
+static bool cache_in_use;           // Associating with the cached BSSID and channel
+static bool ip_reused;              // Cached IP set as static, DHCP stopped
+static int cache_failures;
+static esp_timer_handle_t fallback_timer;
+
+// The cache state above is only touched on the event loop task (and in
+// network_wifi_init_sta() before it runs): the fallback timer posts this
+// event instead of dropping the cache from the esp_timer task.
+ESP_EVENT_DEFINE_BASE(NETWORK_WIFI_EVENT);
+#define NETWORK_WIFI_EVENT_FALLBACK 0
+
+static bool wifi_cache_load(wifi_cache_t *cache)
+{
+    size_t len = sizeof(*cache);
+    nvs_handle_t nvs;
+    if (device_nvs_handle(WIFI_NVS_NAMESPACE, &nvs) != ESP_OK) {
+        return false;
+    }
+    esp_err_t err = nvs_get_blob(nvs, WIFI_NVS_KEY_CACHE, cache, &len);
+    return err == ESP_OK && len == sizeof(*cache) && cache->version == WIFI_CACHE_VERSION &&
+           strncmp(cache->ssid, WIFI_SSID, sizeof(cache->ssid)) == 0;
+}
+
+static void wifi_cache_store(const wifi_cache_t *cache)
+{
+    nvs_handle_t nvs;
+    esp_err_t err = device_nvs_handle(WIFI_NVS_NAMESPACE, &nvs);
+    if (err == ESP_OK) {
+        err = cache ? nvs_set_blob(nvs, WIFI_NVS_KEY_CACHE, cache, sizeof(*cache))
+                    : nvs_erase_key(nvs, WIFI_NVS_KEY_CACHE);
+        if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) {
+            err = nvs_commit(nvs);
+        }
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG_WIFI, "Failed to update the Wi-Fi cache: %s", esp_err_to_name(err));
+    }
+}
+
+// Records the AP and address of a working connection.
+static void wifi_cache_update(const esp_netif_ip_info_t *ip_info)
+{
+    wifi_ap_record_t ap_info;
+    esp_netif_dns_info_t dns_info;
+    wifi_cache_t cache;
+
+    if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+        return;
+    }
+    // Compared with memcmp, so padding has to be zero too.
+    memset(&cache, 0, sizeof(cache));
+    cache.version = WIFI_CACHE_VERSION;
+    strncpy(cache.ssid, WIFI_SSID, sizeof(cache.ssid) - 1);
+    memcpy(cache.bssid, ap_info.bssid, sizeof(cache.bssid));
+    cache.channel = ap_info.primary;
+    cache.ip_info = *ip_info;
+    if (esp_netif_get_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &dns_info) == ESP_OK) {
+        cache.dns = dns_info.ip.u_addr.ip4;
+    }
+    if (memcmp(&cache, &wifi_cache, sizeof(cache)) != 0) {
+        wifi_cache = cache;
+        wifi_cache_store(&wifi_cache);
+    }
+}
+
+// Back to the slow path: full scan and DHCP, and forget the cache. With
+// reconnect set the current link is dropped so the new settings apply.
+static void wifi_cache_drop(const char *reason, bool reconnect)
+{
+    wifi_config_t wifi_config;
+
+    if (!cache_in_use && !ip_reused) {
+        return;
+    }
+    ESP_LOGW(TAG_WIFI, "Dropping cached association: %s", reason);
+    if (fallback_timer) {
+        esp_timer_stop(fallback_timer);
+    }
+    memset(&wifi_cache, 0, sizeof(wifi_cache));
+    wifi_cache_store(NULL);
+    if (cache_in_use && esp_wifi_get_config(WIFI_IF_STA, &wifi_config) == ESP_OK) {
+        wifi_config.sta.bssid_set = false;
+        wifi_config.sta.channel = 0;
+        esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    }
+    if (ip_reused) {
+        esp_netif_dhcpc_start(sta_netif);
+    }
+    cache_in_use = false;
+    ip_reused = false;
+    if (reconnect) {
+        esp_wifi_disconnect(); // The disconnect handler reconnects
+    }
+}
+
+// A reused IP that never reaches the broker is probably stale (lease given
+// to another host, different subnet): the event handler falls back to DHCP.
+static void wifi_fallback_timer_cb(void *arg)
+{
+    if (esp_event_post(NETWORK_WIFI_EVENT, NETWORK_WIFI_EVENT_FALLBACK, NULL, 0, 0) != ESP_OK) {
+        esp_timer_start_once(fallback_timer, (uint64_t)WIFI_FALLBACK_RETRY_MS * 1000);
+    }
+}
+
+// Points the driver and netif at the cached AP and address, skipping the scan and DHCP.
+static void wifi_cache_apply(wifi_config_t *wifi_config)
+{
+    if (!wifi_cache_load(&wifi_cache)) {
+        memset(&wifi_cache, 0, sizeof(wifi_cache));
+        return;
+    }
+    wifi_config->sta.bssid_set = true;
+    memcpy(wifi_config->sta.bssid, wifi_cache.bssid, sizeof(wifi_cache.bssid));
+    wifi_config->sta.channel = wifi_cache.channel;
+    cache_in_use = true;
+    boot_profile_set_flags(BOOT_FLAG_WIFI_CACHED);
+
+#if CONFIG_NETWORK_FAST_RECONNECT_REUSE_IP
+    esp_netif_dns_info_t dns_info = { .ip.type = ESP_IPADDR_TYPE_V4, .ip.u_addr.ip4 = wifi_cache.dns };
+    if (wifi_cache.ip_info.ip.addr != 0 && esp_netif_dhcpc_stop(sta_netif) == ESP_OK &&
+        esp_netif_set_ip_info(sta_netif, &wifi_cache.ip_info) == ESP_OK) {
+        esp_netif_set_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &dns_info);
+        ip_reused = true;
+        boot_profile_set_flags(BOOT_FLAG_IP_REUSED);
+
+        const esp_timer_create_args_t timer_args = {
+            .callback = wifi_fallback_timer_cb,
+            .name = "wifi_fallback",
+        };
+        if (esp_timer_create(&timer_args, &fallback_timer) == ESP_OK) {
+            esp_timer_start_once(fallback_timer, (uint64_t)CONFIG_NETWORK_FAST_RECONNECT_TIMEOUT_MS * 1000);
+        }
+    }
+#endif
+    ESP_LOGI(TAG_WIFI, "Using cached association: channel %d%s", wifi_cache.channel,
+             ip_reused ? ", cached IP" : "");
+}
+#endif // CONFIG_NETWORK_FAST_RECONNECT
+
+static void wifi_reconnect_timer_cb(void *arg)
+{
+    esp_wifi_connect();
+}
+
+static void wifi_schedule_reconnect(void)
+{
+    uint32_t attempt = reconnect_backoff.attempt + 1;
+    uint32_t delay_ms = backoff_next_ms(&reconnect_backoff);
+
+    ESP_LOGI(TAG_WIFI, "Wi-Fi disconnected, reconnecting in %" PRIu32 " ms", delay_ms);
+    TRACE(WIFI_RETRY, delay_ms, attempt);
+    esp_timer_stop(reconnect_timer);
+    esp_timer_start_once(reconnect_timer, (uint64_t)delay_ms * 1000);
+}
+
+// Connects, reconnects with backoff and starts MQTT once an address is obtained.
+static void wifi_event_handler_internal(void* arg, esp_event_base_t event_base,
+                                int32_t event_id, void* event_data)
+{
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
+        esp_wifi_connect();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        boot_profile_mark(BOOT_PHASE_ASSOCIATED);
+#if CONFIG_NETWORK_FAST_RECONNECT
+        cache_failures = 0;
+#endif
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        device_metrics_count(METRIC_WIFI_DISCONNECTS);
+#if CONFIG_NETWORK_FAST_RECONNECT
+        // The cached AP may be gone or have moved channel.
+        if (cache_in_use && ++cache_failures >= WIFI_CACHE_MAX_FAILURES) {
+            wifi_cache_drop("association failed", false);
+        }
+#endif
+        wifi_schedule_reconnect();
+    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+        ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
+        ESP_LOGI(TAG_WIFI, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+        boot_profile_mark(BOOT_PHASE_GOT_IP);
+        backoff_reset(&reconnect_backoff);
+#if CONFIG_NETWORK_FAST_RECONNECT
+        wifi_cache_update(&event->ip_info);
+#endif
+        network_mqtt_app_start(); // Only the first call creates the client, later ones reconnect
+#if CONFIG_NETWORK_FAST_RECONNECT
+    } else if (event_base == NETWORK_WIFI_EVENT && event_id == NETWORK_WIFI_EVENT_FALLBACK) {
+        if (boot_profile_get(BOOT_PHASE_MQTT_CONNECTED) < 0) {
+            wifi_cache_drop("no broker connection with the cached IP", true);
+        }
+#endif
+    }
+}
+
+void network_wifi_init_sta(void)
+{
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    sta_netif = esp_netif_create_default_wifi_sta();
+
+    const esp_timer_create_args_t reconnect_timer_args = {
+        .callback = wifi_reconnect_timer_cb,
+        .name = "wifi_reconnect",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&reconnect_timer_args, &reconnect_timer));
+
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler_internal, NULL, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler_internal, NULL, NULL));
+#if CONFIG_NETWORK_FAST_RECONNECT
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(NETWORK_WIFI_EVENT, NETWORK_WIFI_EVENT_FALLBACK,
+                                                        &wifi_event_handler_internal, NULL, NULL));
+#endif
+
+    wifi_config_t wifi_config = {
+        .sta = {
+            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
+        },
+    };
+    strncpy((char*)wifi_config.sta.ssid, WIFI_SSID, sizeof(wifi_config.sta.ssid));
+    strncpy((char*)wifi_config.sta.password, WIFI_PASS, sizeof(wifi_config.sta.password));
+#if CONFIG_NETWORK_FAST_RECONNECT
+    wifi_cache_apply(&wifi_config);
+#endif
+
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config) );
+    ESP_ERROR_CHECK(esp_wifi_start() );
+
+    ESP_LOGI(TAG_WIFI, "wifi_init_sta finished.");
+    ESP_LOGI(TAG_WIFI, "connect to ap SSID:%s", WIFI_SSID);
+}
@@ -0,0 +1,12 @@
+#ifndef NETWORK_WIFI_H
+#define NETWORK_WIFI_H
+
+/**
+ * @brief Initializes Wi-Fi connection in STA mode.
+ *
+ * Reconnects on disconnect and starts the MQTT client
+ * (network_mqtt_app_start()) once an IP address is obtained.
+ */
+void network_wifi_init_sta(void);
+
+#endif // NETWORK_WIFI_H
@@ -0,0 +1,548 @@
+#include "offline_queue.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp_log.h"
+#include "device_nvs.h"
+#include "trace_log.h"
+#include "device_crypto.h"
+
+#define OQ_SPILL_SEGMENTS CONFIG_OFFLINE_QUEUE_SPILL_SEGMENTS
+#define OQ_SEGMENT_SIZE CONFIG_OFFLINE_QUEUE_SEGMENT_SIZE
+#define OQ_RAM_SIZE CONFIG_OFFLINE_QUEUE_RAM_SIZE
+
+#define OQ_NVS_NAMESPACE "offq"
+#define OQ_NVS_KEY_HEAD "head"
+#define OQ_NVS_KEY_TAIL "tail"
+#define OQ_SEGMENT_KEY_LEN 12
+
+/*
+ * Record: payload length (u16 LE), subtopic length, flags, subtopic,
+ * payload. The same layout is used in the RAM ring and in flash segments,
+ * which start with a u16 LE record count.
+ */
+#define OQ_RECORD_HEADER_LEN 4
+#define OQ_SEGMENT_HEADER_LEN 2
+#define OQ_FLAG_QOS_MASK 0x03
+#define OQ_FLAG_RETAIN 0x04
+
+// A record has to fit in the RAM ring and, when spilling, in one segment.
+#if OQ_SPILL_SEGMENTS > 0 && OQ_SEGMENT_SIZE - OQ_SEGMENT_HEADER_LEN < OQ_RAM_SIZE
+#define OQ_RECORD_MAX (OQ_SEGMENT_SIZE - OQ_SEGMENT_HEADER_LEN)
+#else
+#define OQ_RECORD_MAX OQ_RAM_SIZE
+#endif
+#define OQ_PAYLOAD_MAX (OQ_RECORD_MAX - OQ_RECORD_HEADER_LEN - 1)
+
+#define OQ_SEND_BUF_SIZE DEVICE_CRYPTO_FRAME_LEN(OQ_PAYLOAD_MAX)
+
+static const char *TAG_OQ = "OFFLINE_QUEUE";
+
+static offline_queue_config_t oq_config;
+static offline_queue_send_fn_t oq_send;
+
+// Producers (any publishing task) and the replay task share the storage.
+static StaticSemaphore_t oq_lock_storage;
+static SemaphoreHandle_t oq_lock;
+
+// Most recent messages, oldest at ram_head.
+static uint8_t ram_ring[OQ_RAM_SIZE];
+static size_t ram_head;
+static size_t ram_used;
+static uint32_t ram_count;
+
+#if OQ_SPILL_SEGMENTS > 0
+// Older messages, in NVS blobs "s<n>" for seg_head <= n < seg_tail.
+static nvs_handle_t oq_nvs;     // Valid once a segment exists or spill_oldest() got it
+static uint32_t seg_head;
+static uint32_t seg_tail;
+static uint8_t seg_buf[OQ_SEGMENT_SIZE];        // Segment being written or dropped
+
+// Segment being replayed; erased from flash once all its records went out.
+static uint8_t replay_seg[OQ_SEGMENT_SIZE];
+static size_t replay_seg_len;
+static size_t replay_seg_off;
+static bool seg_taken;
+static uint32_t taken_seg;
+#endif
+
+// Message taken off the queue for replay, kept until the send succeeds.
+// Filled by the replay task; pending is read under oq_lock by the others.
+static bool pending;
+static char pending_subtopic[OFFLINE_QUEUE_SUBTOPIC_MAX_LEN + 1];
+static size_t pending_len;
+static uint8_t pending_flags;
+static char send_buf[OQ_SEND_BUF_SIZE];
+
+static atomic_bool online;
+static uint32_t replay_at_ms;   // Guarded by oq_lock, as is stats
+static bool replaying;
+static uint32_t replay_start_ms;
+static uint32_t replay_msgs;
+
+static offline_queue_stats_t stats;
+
+static StaticTask_t oq_task_tcb;
+static StackType_t oq_task_stack[CONFIG_OFFLINE_QUEUE_TASK_STACK_SIZE];
+static TaskHandle_t oq_task_handle;
+
+static void ram_write(const void *src, size_t n)
+{
+    size_t pos = (ram_head + ram_used) % OQ_RAM_SIZE;
+    size_t first = n < OQ_RAM_SIZE - pos ? n : OQ_RAM_SIZE - pos;
+
+    memcpy(&ram_ring[pos], src, first);
+    memcpy(ram_ring, (const uint8_t *)src + first, n - first);
+    ram_used += n;
+}
+
+static void ram_read(size_t offset, void *dst, size_t n)
+{
+    size_t pos = (ram_head + offset) % OQ_RAM_SIZE;
+    size_t first = n < OQ_RAM_SIZE - pos ? n : OQ_RAM_SIZE - pos;
+
+    memcpy(dst, &ram_ring[pos], first);
+    memcpy((uint8_t *)dst + first, ram_ring, n - first);
+}
+
+// Removes the oldest record from the ring and returns its size.
+static size_t ram_pop(void)
+{
+    uint8_t hdr[OQ_RECORD_HEADER_LEN];
+    ram_read(0, hdr, sizeof(hdr));
+    size_t len = OQ_RECORD_HEADER_LEN + hdr[2] + (hdr[0] | hdr[1] << 8);
+    ram_head = (ram_head + len) % OQ_RAM_SIZE;
+    ram_used -= len;
+    ram_count--;
+    return len;
+}
+
+static void count_dropped(uint32_t count, esp_err_t reason)
+{
+    stats.dropped += count;
+    TRACE(OQ_DROPPED, count, reason);
+}
+
+#if OQ_SPILL_SEGMENTS > 0
+static void segment_key(char *key, uint32_t seg)
+{
+    snprintf(key, OQ_SEGMENT_KEY_LEN, "s%08" PRIx32, seg);
+}
+
+// After a reboot replay resumes at the segment being replayed, if any.
+static void segment_store_head(void)
+{
+    if (nvs_set_u32(oq_nvs, OQ_NVS_KEY_HEAD, seg_taken ? taken_seg : seg_head) == ESP_OK) {
+        nvs_commit(oq_nvs);
+    }
+}
+
+// Spill area full: the oldest segment makes room for the newest.
+static void segment_drop_oldest(void)
+{
+    char key[OQ_SEGMENT_KEY_LEN];
+    size_t len = sizeof(seg_buf);
+    uint32_t count = 0;
+
+    segment_key(key, seg_head);
+    if (nvs_get_blob(oq_nvs, key, seg_buf, &len) == ESP_OK && len >= OQ_SEGMENT_HEADER_LEN) {
+        count = seg_buf[0] | seg_buf[1] << 8;
+    }
+    nvs_erase_key(oq_nvs, key);
+    seg_head++;
+    segment_store_head();
+    count_dropped(count, ESP_ERR_NO_MEM);
+}
+
+// Moves as many of the oldest RAM records as fit into a new segment.
+static bool spill_oldest(void)
+{
+    char key[OQ_SEGMENT_KEY_LEN];
+    size_t pos = OQ_SEGMENT_HEADER_LEN;
+    uint32_t count = 0;
+    esp_err_t err;
+
+    if (ram_count == 0 || device_nvs_handle(OQ_NVS_NAMESPACE, &oq_nvs) != ESP_OK) {
+        return false;
+    }
+    if (seg_tail - seg_head >= OQ_SPILL_SEGMENTS) {
+        segment_drop_oldest();
+    }
+    while (ram_count > 0) {
+        uint8_t hdr[OQ_RECORD_HEADER_LEN];
+        ram_read(0, hdr, sizeof(hdr));
+        size_t len = OQ_RECORD_HEADER_LEN + hdr[2] + (hdr[0] | hdr[1] << 8);
+        if (pos + len > sizeof(seg_buf)) {
+            break;
+        }
+        ram_read(0, &seg_buf[pos], len);
+        ram_pop();
+        pos += len;
+        count++;
+    }
+    seg_buf[0] = count & 0xff;
+    seg_buf[1] = count >> 8;
+
+    segment_key(key, seg_tail);
+    err = nvs_set_blob(oq_nvs, key, seg_buf, pos);
+    if (err == ESP_OK) {
+        err = nvs_set_u32(oq_nvs, OQ_NVS_KEY_TAIL, seg_tail + 1);
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(oq_nvs);
+    }
+    if (err != ESP_OK) {
+        // The records already left the ring, the space is freed either way.
+        ESP_LOGW(TAG_OQ, "Failed to spill %" PRIu32 " messages: %s", count, esp_err_to_name(err));
+        nvs_erase_key(oq_nvs, key);
+        count_dropped(count, err);
+        return true;
+    }
+    TRACE(OQ_SPILLED, count, pos, seg_tail);
+    seg_tail++;
+    stats.spilled += count;
+    return true;
+}
+
+// Loads the oldest segment for replay.
+static void segment_take(void)
+{
+    char key[OQ_SEGMENT_KEY_LEN];
+    size_t len = sizeof(replay_seg);
+
+    segment_key(key, seg_head);
+    esp_err_t err = nvs_get_blob(oq_nvs, key, replay_seg, &len);
+    taken_seg = seg_head++;
+    if (err != ESP_OK || len < OQ_SEGMENT_HEADER_LEN) {
+        // Missing when it was dropped while an older one was being replayed.
+        if (err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGW(TAG_OQ, "Skipping unreadable segment %" PRIu32 ": %s", taken_seg, esp_err_to_name(err));
+            nvs_erase_key(oq_nvs, key);
+        }
+        segment_store_head();
+        return;
+    }
+    seg_taken = true;
+    replay_seg_len = len;
+    replay_seg_off = OQ_SEGMENT_HEADER_LEN;
+}
+
+static void segment_finish(void)
+{
+    char key[OQ_SEGMENT_KEY_LEN];
+
+    segment_key(key, taken_seg);
+    nvs_erase_key(oq_nvs, key);
+    seg_taken = false;
+    segment_store_head();
+}
+
+// Copies the next record of the taken segment into the pending slot.
+static bool segment_next(void)
+{
+    const uint8_t *rec = &replay_seg[replay_seg_off];
+    size_t avail = replay_seg_len - replay_seg_off;
+
+    if (avail < OQ_RECORD_HEADER_LEN) {
+        replay_seg_off = replay_seg_len;
+        return false;
+    }
+    size_t len = rec[0] | rec[1] << 8;
+    size_t sub_len = rec[2];
+    if (sub_len == 0 || sub_len > OFFLINE_QUEUE_SUBTOPIC_MAX_LEN || len > OQ_PAYLOAD_MAX ||
+        OQ_RECORD_HEADER_LEN + sub_len + len > avail) {
+        ESP_LOGW(TAG_OQ, "Corrupt record in segment %" PRIu32 ", skipping the rest", taken_seg);
+        replay_seg_off = replay_seg_len;
+        return false;
+    }
+    memcpy(pending_subtopic, rec + OQ_RECORD_HEADER_LEN, sub_len);
+    pending_subtopic[sub_len] = '\0';
+    memcpy(send_buf, rec + OQ_RECORD_HEADER_LEN + sub_len, len);
+    pending_len = len;
+    pending_flags = rec[3];
+    replay_seg_off += OQ_RECORD_HEADER_LEN + sub_len + len;
+    return true;
+}
+#else
+static bool spill_oldest(void)
+{
+    return false;
+}
+#endif // OQ_SPILL_SEGMENTS > 0
+
+// Takes the oldest message into the pending slot: flash first, then RAM.
+// Called with oq_lock held.
+static bool take_next(void)
+{
+#if OQ_SPILL_SEGMENTS > 0
+    for (;;) {
+        if (seg_taken) {
+            if (segment_next()) {
+                return true;
+            }
+            segment_finish();
+        }
+        if (seg_head == seg_tail) {
+            break;
+        }
+        segment_take();
+    }
+#endif
+    if (ram_count == 0) {
+        return false;
+    }
+    uint8_t hdr[OQ_RECORD_HEADER_LEN];
+    ram_read(0, hdr, sizeof(hdr));
+    pending_len = hdr[0] | hdr[1] << 8;
+    pending_flags = hdr[3];
+    ram_read(OQ_RECORD_HEADER_LEN, pending_subtopic, hdr[2]);
+    pending_subtopic[hdr[2]] = '\0';
+    ram_read(OQ_RECORD_HEADER_LEN + hdr[2], send_buf, pending_len);
+    ram_pop();
+    return true;
+}
+
+static bool queue_is_empty_locked(void)
+{
+#if OQ_SPILL_SEGMENTS > 0
+    if (seg_taken || seg_head != seg_tail) {
+        return false;
+    }
+#endif
+    return ram_count == 0 && !pending;
+}
+
+esp_err_t offline_queue_init(const offline_queue_config_t *config, offline_queue_send_fn_t send)
+{
+    if (config == NULL || send == NULL || config->replay_rate == 0 || config->replay_batch == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (oq_lock == NULL) {
+        oq_lock = xSemaphoreCreateMutexStatic(&oq_lock_storage);
+    }
+    oq_config = *config;
+    ram_head = 0;
+    ram_used = 0;
+    ram_count = 0;
+    pending = false;
+    replaying = false;
+    atomic_store(&online, false);
+    memset(&stats, 0, sizeof(stats));
+
+#if OQ_SPILL_SEGMENTS > 0
+    seg_head = 0;
+    seg_tail = 0;
+    seg_taken = false;
+    esp_err_t err = device_nvs_handle(OQ_NVS_NAMESPACE, &oq_nvs);
+    if (err == ESP_OK) {
+        nvs_get_u32(oq_nvs, OQ_NVS_KEY_HEAD, &seg_head);
+        nvs_get_u32(oq_nvs, OQ_NVS_KEY_TAIL, &seg_tail);
+        if (seg_tail - seg_head > OQ_SPILL_SEGMENTS) {
+            // Spill area made smaller since: replay only the newest segments.
+            seg_head = seg_tail - OQ_SPILL_SEGMENTS;
+        }
+        if (seg_tail != seg_head) {
+            ESP_LOGI(TAG_OQ, "%" PRIu32 " segments from before the reboot waiting for replay", seg_tail - seg_head);
+        }
+    } else {
+        ESP_LOGW(TAG_OQ, "Spilling to flash disabled: %s", esp_err_to_name(err));
+    }
+#endif
+    oq_send = send;
+    return ESP_OK;
+}
+
+esp_err_t offline_queue_push(const char *subtopic, const char *data, size_t len, int qos, int retain)
+{
+    size_t sub_len = strlen(subtopic);
+    uint8_t hdr[OQ_RECORD_HEADER_LEN];
+    bool wake;
+
+    if (oq_send == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(oq_lock, portMAX_DELAY);
+    if (sub_len == 0 || sub_len > OFFLINE_QUEUE_SUBTOPIC_MAX_LEN || OQ_RECORD_HEADER_LEN + sub_len + len > OQ_RECORD_MAX) {
+        count_dropped(1, ESP_ERR_INVALID_SIZE);
+        xSemaphoreGive(oq_lock);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    size_t record_len = OQ_RECORD_HEADER_LEN + sub_len + len;
+    while (OQ_RAM_SIZE - ram_used < record_len) {
+        if (!spill_oldest()) {
+            ram_pop();
+            count_dropped(1, ESP_ERR_NO_MEM);
+        }
+    }
+    hdr[0] = len & 0xff;
+    hdr[1] = len >> 8;
+    hdr[2] = (uint8_t)sub_len;
+    hdr[3] = (qos & OQ_FLAG_QOS_MASK) | (retain ? OQ_FLAG_RETAIN : 0);
+    ram_write(hdr, sizeof(hdr));
+    ram_write(subtopic, sub_len);
+    ram_write(data, len);
+    ram_count++;
+    stats.queued++;
+    if (ram_used > stats.ram_used_max) {
+        stats.ram_used_max = ram_used;
+    }
+    wake = atomic_load(&online);
+    xSemaphoreGive(oq_lock);
+
+    // Queued while connected (the publish raced a disconnect): replay it.
+    if (wake && oq_task_handle) {
+        xTaskNotifyGive(oq_task_handle);
+    }
+    return ESP_OK;
+}
+
+bool offline_queue_is_empty(void)
+{
+    bool empty;
+
+    if (oq_send == NULL) {
+        return true;
+    }
+    xSemaphoreTake(oq_lock, portMAX_DELAY);
+    empty = queue_is_empty_locked();
+    xSemaphoreGive(oq_lock);
+    return empty;
+}
+
+void offline_queue_set_online(bool is_online, uint32_t now_ms)
+{
+    if (oq_lock == NULL) {
+        return;
+    }
+    xSemaphoreTake(oq_lock, portMAX_DELAY);
+    if (is_online && !atomic_load(&online)) {
+        uint32_t jitter = oq_config.replay_jitter_ms ? esp_random() % (oq_config.replay_jitter_ms + 1) : 0;
+        replay_at_ms = now_ms + jitter;
+    }
+    atomic_store(&online, is_online);
+    xSemaphoreGive(oq_lock);
+    if (is_online && oq_task_handle) {
+        xTaskNotifyGive(oq_task_handle);
+    }
+}
+
+// Milliseconds until the next replay step may run, <= 0 when due.
+static int32_t replay_wait_ms(uint32_t now_ms)
+{
+    xSemaphoreTake(oq_lock, portMAX_DELAY);
+    int32_t wait_ms = (int32_t)(replay_at_ms - now_ms);
+    xSemaphoreGive(oq_lock);
+    return wait_ms;
+}
+
+size_t offline_queue_poll(uint32_t now_ms)
+{
+    size_t sent = 0;
+
+    if (oq_send == NULL || !atomic_load(&online) || replay_wait_ms(now_ms) > 0) {
+        return 0;
+    }
+    while (sent < oq_config.replay_batch) {
+        xSemaphoreTake(oq_lock, portMAX_DELAY);
+        if (!pending) {
+            pending = take_next();
+        }
+        bool finished = !pending && replaying;
+        if (finished) {
+            replaying = false;
+            stats.last_replay_msgs = replay_msgs;
+            stats.last_replay_ms = now_ms - replay_start_ms;
+        }
+        xSemaphoreGive(oq_lock);
+        if (!pending) {
+            if (finished) {
+                ESP_LOGI(TAG_OQ, "Replayed %" PRIu32 " messages in %" PRIu32 " ms", replay_msgs,
+                         now_ms - replay_start_ms);
+                TRACE(OQ_REPLAYED, replay_msgs, now_ms - replay_start_ms);
+            }
+            break;
+        }
+        if (!replaying) {
+            replaying = true;
+            replay_start_ms = now_ms;
+            replay_msgs = 0;
+        }
+        // Sent without oq_lock, so pushes from other tasks do not wait on the network.
+        int msg_id = oq_send(pending_subtopic, send_buf, pending_len, sizeof(send_buf),
+                             pending_flags & OQ_FLAG_QOS_MASK, (pending_flags & OQ_FLAG_RETAIN) != 0);
+        xSemaphoreTake(oq_lock, portMAX_DELAY);
+        if (msg_id < 0) {
+            stats.replay_failures++;
+        } else {
+            pending = false;
+            stats.replayed++;
+            stats.replay_bytes += pending_len;
+        }
+        xSemaphoreGive(oq_lock);
+        if (msg_id < 0) {
+            break;
+        }
+        replay_msgs++;
+        sent++;
+    }
+    // Each message uses up 1/replay_rate s; a failed step waits a full batch.
+    xSemaphoreTake(oq_lock, portMAX_DELAY);
+    replay_at_ms = now_ms + (uint32_t)(sent ? sent : oq_config.replay_batch) * 1000u / oq_config.replay_rate;
+    xSemaphoreGive(oq_lock);
+    return sent;
+}
+
+static void offline_queue_task(void *arg)
+{
+    for (;;) {
+        if (!atomic_load(&online) || offline_queue_is_empty()) {
+            // Woken by offline_queue_set_online() or a push while online.
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+        int32_t wait_ms = replay_wait_ms(now_ms);
+        if (wait_ms > 0) {
+            vTaskDelay(pdMS_TO_TICKS(wait_ms) + 1);
+            continue;
+        }
+        offline_queue_poll(now_ms);
+    }
+}
+
+esp_err_t offline_queue_start(void)
+{
+    if (oq_task_handle || oq_send == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    oq_task_handle = xTaskCreateStatic(offline_queue_task, "offline_queue", CONFIG_OFFLINE_QUEUE_TASK_STACK_SIZE,
+                                       NULL, CONFIG_OFFLINE_QUEUE_TASK_PRIORITY, oq_task_stack, &oq_task_tcb);
+    if (oq_task_handle == NULL) {
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG_OQ, "Offline queue started: %u B RAM, %u x %u B flash, replay %u msg/s",
+             OQ_RAM_SIZE, OQ_SPILL_SEGMENTS, OQ_SEGMENT_SIZE, oq_config.replay_rate);
+    return ESP_OK;
+}
+
+void offline_queue_get_stats(offline_queue_stats_t *out)
+{
+    if (oq_lock) {
+        xSemaphoreTake(oq_lock, portMAX_DELAY);
+    }
+    *out = stats;
+    out->ram_used = ram_used;
+#if OQ_SPILL_SEGMENTS > 0
+    out->flash_segments = seg_tail - seg_head + (seg_taken ? 1 : 0);
+#endif
+    if (oq_lock) {
+        xSemaphoreGive(oq_lock);
+    }
+}
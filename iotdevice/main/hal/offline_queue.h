@@ -0,0 +1,124 @@
+#ifndef OFFLINE_QUEUE_H
+#define OFFLINE_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define OFFLINE_QUEUE_SUBTOPIC_MAX_LEN 48
+
+/**
+ * @brief Sends one replayed message.
+ *
+ * Same contract as network_mqtt_publish(): buf may be modified in place
+ * (e.g. encrypted) and holds buf_size bytes. On failure buf must hold the
+ * plaintext again, the message is retried on the next replay step.
+ *
+ * @return Message ID (>= 0) on success, negative on failure.
+ */
+typedef int (*offline_queue_send_fn_t)(const char *subtopic, char *buf, size_t len, size_t buf_size,
+                                       int qos, int retain);
+
+typedef struct {
+    uint16_t replay_rate;       // Messages per second sent while replaying
+    uint16_t replay_batch;      // Messages sent back to back per replay step
+    uint32_t replay_jitter_ms;  // Replay starts after a random delay of up to this
+} offline_queue_config_t;
+
+#define OFFLINE_QUEUE_CONFIG_DEFAULT() {                            \
+    .replay_rate = CONFIG_OFFLINE_QUEUE_REPLAY_RATE,                \
+    .replay_batch = CONFIG_OFFLINE_QUEUE_REPLAY_BATCH,              \
+    .replay_jitter_ms = CONFIG_OFFLINE_QUEUE_REPLAY_JITTER_MS,      \
+}
+
+typedef struct {
+    uint32_t queued;            // Messages accepted while offline
+    uint32_t spilled;           // Messages moved from RAM to flash
+    uint32_t dropped;           // Messages lost: too large, spill area full or flash error
+    uint32_t replayed;          // Messages sent after reconnecting
+    uint32_t replay_failures;   // Replay sends the send function rejected
+    uint64_t replay_bytes;      // Plaintext bytes replayed
+    uint32_t ram_used;          // Bytes in the RAM ring
+    uint32_t ram_used_max;      // Highest RAM ring fill level
+    uint32_t flash_segments;    // Segments waiting in flash
+    uint32_t last_replay_msgs;  // Messages sent by the last completed replay
+    uint32_t last_replay_ms;    // Duration of the last completed replay
+} offline_queue_stats_t;
+
+/**
+ * @brief Sets configuration and sink and loads the spill state from NVS.
+ *
+ * Messages spilled before a reboot are kept and replayed on the next
+ * connection. NVS must be initialized. Does not start the replay task.
+ *
+ * @param config Replay configuration.
+ * @param send Function that publishes a replayed message.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a bad configuration.
+ */
+esp_err_t offline_queue_init(const offline_queue_config_t *config, offline_queue_send_fn_t send);
+
+/**
+ * @brief Starts the task that replays queued messages while online.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if already started or not initialized.
+ */
+esp_err_t offline_queue_start(void);
+
+/**
+ * @brief Queues a message that could not be published.
+ *
+ * The payload is copied. When the RAM ring is full the oldest messages
+ * are spilled to flash; when the spill area is full too, the oldest
+ * spilled segment is dropped.
+ *
+ * @param subtopic Topic below the device namespace, e.g. "telemetry".
+ * @param data Plaintext payload.
+ * @param len Length of the payload.
+ * @param qos MQTT QoS level to replay with.
+ * @param retain MQTT retain flag to replay with.
+ * @return ESP_OK if queued, ESP_ERR_INVALID_STATE if not initialized,
+ *         ESP_ERR_INVALID_SIZE if the message can never fit.
+ */
+esp_err_t offline_queue_push(const char *subtopic, const char *data, size_t len, int qos, int retain);
+
+/**
+ * @brief Checks whether messages are waiting, in RAM, in flash or in flight.
+ *
+ * New messages must be queued behind waiting ones to keep the order.
+ *
+ * @return true if nothing is waiting or the queue is not initialized.
+ */
+bool offline_queue_is_empty(void);
+
+/**
+ * @brief Reports the broker connection state.
+ *
+ * Going online arms the replay after a random delay of up to
+ * replay_jitter_ms, so a fleet reconnecting together does not replay
+ * together.
+ *
+ * @param online true once connected, false when the connection is lost.
+ * @param now_ms Current time in milliseconds.
+ */
+void offline_queue_set_online(bool online, uint32_t now_ms);
+
+/**
+ * @brief Runs one replay step: up to replay_batch messages, paced to replay_rate.
+ *
+ * Called by the replay task; exposed so the host benchmarks can drive it
+ * with a simulated clock.
+ *
+ * @param now_ms Current time in milliseconds.
+ * @return Number of messages sent.
+ */
+size_t offline_queue_poll(uint32_t now_ms);
+
+/**
+ * @brief Gets the queue counters.
+ *
+ * @param out Destination for the counters.
+ */
+void offline_queue_get_stats(offline_queue_stats_t *out);
+
+#endif // OFFLINE_QUEUE_H
@@ -0,0 +1,741 @@
+#include "ota_update.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "device_nvs.h"
+#include "mbedtls/sha256.h"
+#include "cbor_lite.h"
+#include "json_lite.h"
+#include "command_ack.h"
+#include "trace_log.h"
+#include "device_crypto.h"
+
+#define OTA_NVS_NAMESPACE "ota"
+#define OTA_NVS_KEY "ckpt"
+
+#define OTA_SHA256_LEN 32
+#define OTA_REPORT_PAYLOAD_MAX 112
+// Longer than a sector erase; a chunk still not queued is dropped and sent again after a "resend".
+#define OTA_QUEUE_WAIT_MS 1000
+
+#define OTA_REPORT_BUF_SIZE DEVICE_CRYPTO_FRAME_LEN(OTA_REPORT_PAYLOAD_MAX)
+
+typedef enum {
+    STAGE_OPCODE,
+    STAGE_ARG0,                 // First varint: COPY source, INSERT and FILL length
+    STAGE_ARG1,                 // COPY length
+    STAGE_FILL_VALUE,
+    STAGE_EMIT,                 // Producing the bytes of op
+} ota_stage_t;
+
+// Decoder state between two stream bytes; a raw image is one INSERT op.
+typedef struct {
+    uint8_t stage;
+    uint8_t op;
+    uint8_t shift;              // Bits of varint read so far
+    uint8_t fill;
+    uint32_t varint;
+    uint32_t src;               // Next COPY source offset
+    uint32_t remaining;         // Bytes op still produces
+} ota_decoder_t;
+
+// A transfer; stored as is as the NVS checkpoint, taken right after a sector was written.
+typedef struct {
+    char version[OTA_UPDATE_VERSION_MAX_LEN + 1];
+    uint8_t sha256[OTA_SHA256_LEN];
+    uint32_t target_address;    // A checkpoint is void once the partitions swapped roles
+    uint32_t size;
+    uint32_t stream_size;
+    uint32_t format;
+    uint32_t stream_off;
+    uint32_t image_off;
+    ota_decoder_t dec;
+} ota_transfer_t;
+
+typedef enum {
+    WORK_BEGIN,
+    WORK_CHUNK,
+    WORK_ABORT,
+} ota_work_kind_t;
+
+// A command handed from the MQTT task to the OTA task, payload already parsed.
+typedef struct {
+    uint8_t kind;
+    command_ack_token_t ack;    // Acked once the OTA task ran the command
+    union {
+        ota_transfer_t begin;
+        struct {
+            uint32_t off;
+            uint32_t len;
+            uint8_t data[OTA_UPDATE_CHUNK_MAX];
+        } chunk;
+    };
+} ota_work_t;
+
+static const char *TAG_OTA = "OTA_UPDATE";
+
+static ota_update_config_t ota_config;
+static ota_update_finish_fn_t ota_finish;
+static ota_update_report_fn_t ota_report;
+
+static ota_transfer_t xfer;
+static ota_transfer_t checkpoint;
+static bool checkpoint_valid;
+
+// Image bytes of the sector at xfer.image_off - sector_fill.
+static uint8_t sector_buf[OTA_UPDATE_SECTOR_SIZE];
+static size_t sector_fill;
+
+static uint32_t last_report_off;
+static uint32_t resend_off;     // Offset of the last "resend", so a burst of gaps asks once
+static char report_buf[OTA_REPORT_BUF_SIZE];
+
+static ota_update_stats_t stats;
+
+static StaticQueue_t work_queue_storage;
+static uint8_t work_queue_buffer[CONFIG_OTA_UPDATE_QUEUE_LEN * sizeof(ota_work_t)];
+static QueueHandle_t work_queue;
+// Filled by the handlers, which the command lock runs one at a time; too
+// large for the MQTT task stack.
+static ota_work_t incoming;
+// Only used by the consumer of the queue, the OTA task (or the host benchmarks).
+static ota_work_t work;
+
+static StaticTask_t ota_task_tcb;
+static StackType_t ota_task_stack[CONFIG_OTA_UPDATE_TASK_STACK_SIZE];
+static TaskHandle_t ota_task_handle;
+
+static void store_checkpoint(void)
+{
+    nvs_handle_t nvs;
+    esp_err_t err = device_nvs_handle(OTA_NVS_NAMESPACE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, OTA_NVS_KEY, &xfer, sizeof(xfer));
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    if (err != ESP_OK) {
+        // The transfer goes on; an interruption resumes from the previous checkpoint.
+        ESP_LOGW(TAG_OTA, "Checkpoint at %" PRIu32 " not stored: %s", xfer.image_off, esp_err_to_name(err));
+        return;
+    }
+    checkpoint = xfer;
+    checkpoint_valid = true;
+    stats.checkpoints++;
+    TRACE(OTA_CHECKPOINT, xfer.stream_off, xfer.image_off);
+}
+
+static void drop_checkpoint(void)
+{
+    nvs_handle_t nvs;
+    if (!checkpoint_valid || device_nvs_handle(OTA_NVS_NAMESPACE, &nvs) != ESP_OK) {
+        return;
+    }
+    checkpoint_valid = false;
+    if (nvs_erase_key(nvs, OTA_NVS_KEY) == ESP_OK) {
+        nvs_commit(nvs);
+    }
+}
+
+static void report(const char *state)
+{
+    size_t len;
+    if (ota_config.encoding == TELEMETRY_ENCODING_CBOR) {
+        cbor_lite_writer_t w;
+        cbor_lite_writer_init(&w, report_buf, OTA_REPORT_PAYLOAD_MAX);
+        cbor_lite_put_map(&w, 3);
+        cbor_lite_put_cstr(&w, "version");
+        cbor_lite_put_cstr(&w, xfer.version);
+        cbor_lite_put_cstr(&w, "offset");
+        cbor_lite_put_uint(&w, xfer.stream_off);
+        cbor_lite_put_cstr(&w, "state");
+        cbor_lite_put_cstr(&w, state);
+        len = w.len;
+    } else {
+        // The version was checked for quotes and backslashes at begin.
+        len = (size_t)snprintf(report_buf, OTA_REPORT_PAYLOAD_MAX, "{\"version\":\"%s\",\"offset\":%" PRIu32 ",\"state\":\"%s\"}",
+                               xfer.version, xfer.stream_off, state);
+    }
+    last_report_off = xfer.stream_off;
+    ota_report("ota/progress", report_buf, len, sizeof(report_buf));
+}
+
+// {"version":"<running version>"} on telemetry/firmwareVersion, where the backend keeps it.
+static void report_version(void)
+{
+    size_t len;
+    if (ota_config.encoding == TELEMETRY_ENCODING_CBOR) {
+        cbor_lite_writer_t w;
+        cbor_lite_writer_init(&w, report_buf, OTA_REPORT_PAYLOAD_MAX);
+        cbor_lite_put_map(&w, 1);
+        cbor_lite_put_cstr(&w, "version");
+        cbor_lite_put_cstr(&w, ota_config.running_version);
+        len = w.len;
+    } else {
+        len = (size_t)snprintf(report_buf, OTA_REPORT_PAYLOAD_MAX, "{\"version\":\"%s\"}", ota_config.running_version);
+    }
+    ota_report("telemetry/firmwareVersion", report_buf, len, sizeof(report_buf));
+}
+
+static void fail(esp_err_t err)
+{
+    ESP_LOGW(TAG_OTA, "Update to %s failed at %" PRIu32 ": %s", xfer.version, xfer.stream_off, esp_err_to_name(err));
+    TRACE(OTA_FAILED, err, xfer.stream_off, xfer.image_off);
+    stats.failures++;
+    stats.active = false;
+    drop_checkpoint();
+    report("failed");
+}
+
+// Erases the sector and writes what the buffer holds, then checkpoints on the interval.
+static esp_err_t flush_sector(void)
+{
+    uint32_t sector_off = xfer.image_off - (uint32_t)sector_fill;
+    esp_err_t err = esp_partition_erase_range(ota_config.target, sector_off, OTA_UPDATE_SECTOR_SIZE);
+    if (err == ESP_OK) {
+        err = esp_partition_write(ota_config.target, sector_off, sector_buf, sector_fill);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    stats.sectors++;
+    stats.image_bytes += sector_fill;
+    sector_fill = 0;
+    if (xfer.image_off % ota_config.checkpoint_bytes == 0 && xfer.image_off < xfer.size) {
+        store_checkpoint();
+    }
+    return ESP_OK;
+}
+
+// Ends an argument varint; false if the op does not fit the image or the source.
+static bool start_op(ota_decoder_t *d)
+{
+    if (d->stage == STAGE_ARG0 && d->op == OTA_OP_COPY) {
+        d->src = d->varint;
+        d->stage = STAGE_ARG1;
+        d->varint = 0;
+        d->shift = 0;
+        return true;
+    }
+    d->remaining = d->varint;
+    if (d->remaining > xfer.size - xfer.image_off) {
+        return false;
+    }
+    if (d->op == OTA_OP_COPY && (d->src > ota_config.running->size || d->remaining > ota_config.running->size - d->src)) {
+        return false;
+    }
+    d->stage = d->op == OTA_OP_FILL ? STAGE_FILL_VALUE : STAGE_EMIT;
+    return true;
+}
+
+/*
+ * Runs stream bytes through the decoder into the sector buffer. COPY and
+ * FILL ops produce bytes without consuming any, so a sector can fill up in
+ * the middle of an op: the state saved with it is exact to the byte.
+ */
+static esp_err_t decode(const uint8_t *in, size_t len)
+{
+    ota_decoder_t *d = &xfer.dec;
+    size_t pos = 0;
+
+    for (;;) {
+        if (d->stage == STAGE_EMIT) {
+            if (d->remaining == 0) {
+                d->stage = STAGE_OPCODE;
+                continue;
+            }
+            size_t n = OTA_UPDATE_SECTOR_SIZE - sector_fill;
+            if (n > d->remaining) {
+                n = d->remaining;
+            }
+            if (d->op == OTA_OP_INSERT) {
+                if (pos == len) {
+                    return ESP_OK;
+                }
+                if (n > len - pos) {
+                    n = len - pos;
+                }
+                memcpy(sector_buf + sector_fill, in + pos, n);
+                pos += n;
+                xfer.stream_off += n;
+            } else if (d->op == OTA_OP_FILL) {
+                memset(sector_buf + sector_fill, d->fill, n);
+            } else {
+                esp_err_t err = esp_partition_read(ota_config.running, d->src, sector_buf + sector_fill, n);
+                if (err != ESP_OK) {
+                    return err;
+                }
+                d->src += n;
+            }
+            d->remaining -= n;
+            sector_fill += n;
+            xfer.image_off += n;
+            if (sector_fill == OTA_UPDATE_SECTOR_SIZE) {
+                esp_err_t err = flush_sector();
+                if (err != ESP_OK) {
+                    return err;
+                }
+            }
+            continue;
+        }
+        if (pos == len) {
+            return ESP_OK;
+        }
+        uint8_t b = in[pos++];
+        xfer.stream_off++;
+        switch (d->stage) {
+        case STAGE_OPCODE:
+            if (b < OTA_OP_COPY || b > OTA_OP_FILL) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            d->op = b;
+            d->stage = STAGE_ARG0;
+            d->varint = 0;
+            d->shift = 0;
+            break;
+        case STAGE_ARG0:
+        case STAGE_ARG1:
+            if (d->shift > 28 || (d->shift == 28 && (b & 0x70))) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            d->varint |= (uint32_t)(b & 0x7f) << d->shift;
+            d->shift += 7;
+            if (!(b & 0x80) && !start_op(d)) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            break;
+        case STAGE_FILL_VALUE:
+            d->fill = b;
+            d->stage = STAGE_EMIT;
+            break;
+        }
+    }
+}
+
+// Digest of the written image, read back from flash through the sector buffer.
+static esp_err_t verify_image(void)
+{
+    uint8_t digest[OTA_SHA256_LEN];
+    mbedtls_sha256_context sha;
+    esp_err_t err = ESP_OK;
+
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    for (uint32_t off = 0; off < xfer.size && err == ESP_OK; off += OTA_UPDATE_SECTOR_SIZE) {
+        size_t n = xfer.size - off < OTA_UPDATE_SECTOR_SIZE ? xfer.size - off : OTA_UPDATE_SECTOR_SIZE;
+        err = esp_partition_read(ota_config.target, off, sector_buf, n);
+        if (err == ESP_OK) {
+            mbedtls_sha256_update(&sha, sector_buf, n);
+        }
+    }
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return memcmp(digest, xfer.sha256, OTA_SHA256_LEN) == 0 ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+// After the last stream byte: write the tail, check the digest and switch.
+static esp_err_t complete(void)
+{
+    const ota_decoder_t *d = &xfer.dec;
+    esp_err_t err = ESP_OK;
+
+    if (xfer.image_off != xfer.size || (d->stage != STAGE_OPCODE && d->stage != STAGE_EMIT) || d->remaining) {
+        err = ESP_ERR_INVALID_ARG;
+    }
+    if (err == ESP_OK && sector_fill) {
+        err = flush_sector();
+    }
+    if (err == ESP_OK) {
+        err = verify_image();
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    ESP_LOGI(TAG_OTA, "Image %s written and verified, %" PRIu32 " bytes", xfer.version, xfer.size);
+    TRACE(OTA_DONE, xfer.size, xfer.stream_size);
+    stats.active = false;
+    stats.completed++;
+    drop_checkpoint();
+    report("done");
+    return ota_finish(ota_config.target, xfer.version);
+}
+
+static int hex_nibble(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+static bool hex_valid(const char *hex, size_t len)
+{
+    if (len % 2) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (hex_nibble(hex[i]) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void hex_decode(const char *hex, size_t bytes, uint8_t *out)
+{
+    for (size_t i = 0; i < bytes; i++) {
+        out[i] = (uint8_t)(hex_nibble(hex[2 * i]) << 4 | hex_nibble(hex[2 * i + 1]));
+    }
+}
+
+static bool version_valid(const char *version, size_t len)
+{
+    if (len == 0 || len > OTA_UPDATE_VERSION_MAX_LEN) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (version[i] < 0x20 || version[i] == '"' || version[i] == '\\') {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool same_image(const ota_transfer_t *a, const ota_transfer_t *b)
+{
+    return strcmp(a->version, b->version) == 0 && memcmp(a->sha256, b->sha256, OTA_SHA256_LEN) == 0 &&
+           a->target_address == b->target_address && a->size == b->size &&
+           a->stream_size == b->stream_size && a->format == b->format;
+}
+
+static esp_err_t parse_begin(const char *data, size_t data_len, ota_transfer_t *t)
+{
+    bool cbor = cbor_lite_is_cbor(data, data_len);
+    const char *version = NULL;
+    const char *sha = NULL;
+    const char *format = NULL;
+    const char *base = NULL;
+    size_t version_len = 0;
+    size_t sha_len = 0;
+    size_t format_len = 0;
+    size_t base_len = 0;
+    int32_t size = 0;
+    int32_t stream = 0;
+
+    esp_err_t err = cbor ? cbor_lite_get_string(data, data_len, "version", &version, &version_len)
+                         : json_lite_get_string(data, data_len, "version", &version, &version_len);
+    if (err == ESP_OK) {
+        err = cbor ? cbor_lite_get_string(data, data_len, "sha256", &sha, &sha_len)
+                   : json_lite_get_string(data, data_len, "sha256", &sha, &sha_len);
+    }
+    if (err == ESP_OK) {
+        err = cbor ? cbor_lite_get_int(data, data_len, "size", &size)
+                   : json_lite_get_int(data, data_len, "size", &size);
+    }
+    if (err != ESP_OK || !version_valid(version, version_len) || sha_len != 2 * OTA_SHA256_LEN ||
+        !hex_valid(sha, sha_len) || size <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (cbor) {
+        cbor_lite_get_string(data, data_len, "format", &format, &format_len);
+    } else {
+        json_lite_get_string(data, data_len, "format", &format, &format_len);
+    }
+
+    memset(t, 0, sizeof(*t));
+    memcpy(t->version, version, version_len);
+    hex_decode(sha, OTA_SHA256_LEN, t->sha256);
+    t->target_address = ota_config.target->address;
+    t->size = (uint32_t)size;
+    if (format_len == 5 && memcmp(format, "delta", 5) == 0) {
+        err = cbor ? cbor_lite_get_int(data, data_len, "stream", &stream)
+                   : json_lite_get_int(data, data_len, "stream", &stream);
+        if (err == ESP_OK) {
+            err = cbor ? cbor_lite_get_string(data, data_len, "base", &base, &base_len)
+                       : json_lite_get_string(data, data_len, "base", &base, &base_len);
+        }
+        if (err != ESP_OK || stream <= 0) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        // COPY ops read the running partition: any other base builds garbage.
+        if (base_len != strlen(ota_config.running_version) || memcmp(base, ota_config.running_version, base_len) != 0) {
+            return ESP_ERR_INVALID_VERSION;
+        }
+        t->format = OTA_FORMAT_DELTA;
+        t->stream_size = (uint32_t)stream;
+        t->dec.stage = STAGE_OPCODE;
+    } else if (format_len == 0 || (format_len == 3 && memcmp(format, "raw", 3) == 0)) {
+        t->format = OTA_FORMAT_RAW;
+        t->stream_size = t->size;
+        t->dec.stage = STAGE_EMIT;
+        t->dec.op = OTA_OP_INSERT;
+        t->dec.remaining = t->size;
+    } else {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return t->size <= ota_config.target->size ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+// Runs on the OTA task: a new transfer, or where to go on with the current or checkpointed one.
+static void begin_transfer(const ota_transfer_t *t)
+{
+    if (stats.active && same_image(t, &xfer)) {
+        // The backend lost track (reconnect, restart): tell it where to go on.
+    } else if (checkpoint_valid && same_image(t, &checkpoint)) {
+        xfer = checkpoint;
+        sector_fill = 0;
+        stats.resumes++;
+        ESP_LOGI(TAG_OTA, "Resuming %s at %" PRIu32 " of %" PRIu32, xfer.version, xfer.stream_off, xfer.stream_size);
+        TRACE(OTA_RESUMED, xfer.stream_off, xfer.image_off);
+    } else {
+        drop_checkpoint();
+        xfer = *t;
+        sector_fill = 0;
+        ESP_LOGI(TAG_OTA, "Receiving %s, %" PRIu32 " byte %s stream for %" PRIu32 " byte image", xfer.version,
+                 xfer.stream_size, xfer.format == OTA_FORMAT_DELTA ? "delta" : "raw", xfer.size);
+        TRACE(OTA_BEGIN, xfer.format, xfer.stream_size, xfer.size);
+    }
+    stats.active = true;
+    stats.stream_offset = xfer.stream_off;
+    stats.image_offset = xfer.image_off;
+    resend_off = UINT32_MAX;
+    report("receiving");
+}
+
+// Runs on the OTA task: decodes and writes the new part of a chunk.
+static esp_err_t apply_chunk(uint32_t start, const uint8_t *bytes, size_t len)
+{
+    if (!stats.active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (start > xfer.stream_size || len > xfer.stream_size - start) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (start + len <= xfer.stream_off) {
+        stats.duplicates++;
+        return ESP_OK;
+    }
+    if (start > xfer.stream_off) {
+        stats.gaps++;
+        if (resend_off != xfer.stream_off) {
+            resend_off = xfer.stream_off;
+            TRACE(OTA_GAP, start, xfer.stream_off);
+            report("resend");
+        }
+        return ESP_OK;
+    }
+    // A chunk reaching over a mid-chunk checkpoint: only its new part counts.
+    size_t skip = xfer.stream_off - start;
+    uint32_t before = xfer.stream_off;
+    esp_err_t err = decode(bytes + skip, len - skip);
+    stats.stream_bytes += xfer.stream_off - before;
+    stats.stream_offset = xfer.stream_off;
+    stats.image_offset = xfer.image_off;
+    if (err == ESP_OK && xfer.stream_off == xfer.stream_size) {
+        err = complete();
+        if (err != ESP_OK && !stats.active) {
+            // Verified and reported "done", only the switch failed.
+            ESP_LOGE(TAG_OTA, "Could not switch to %s: %s", xfer.version, esp_err_to_name(err));
+            stats.failures++;
+            return err;
+        }
+    } else if (err == ESP_OK && xfer.stream_off - last_report_off >= ota_config.report_bytes) {
+        report("receiving");
+    }
+    if (err != ESP_OK) {
+        fail(err);
+    }
+    return err;
+}
+
+// Runs on the OTA task.
+static void abort_transfer(void)
+{
+    if (stats.active || checkpoint_valid) {
+        if (!stats.active) {
+            xfer = checkpoint;
+        }
+        ESP_LOGI(TAG_OTA, "Update to %s aborted at %" PRIu32, xfer.version, xfer.stream_off);
+        TRACE(OTA_ABORTED, xfer.stream_off);
+        stats.active = false;
+        drop_checkpoint();
+        report("aborted");
+    }
+}
+
+// Hands a parsed command to the OTA task; waits for a free slot while it erases.
+static esp_err_t submit(ota_work_t *w)
+{
+    if (work_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    w->ack = command_ack_take();
+    if (xQueueSend(work_queue, w, pdMS_TO_TICKS(OTA_QUEUE_WAIT_MS)) != pdTRUE) {
+        // Not acked: the backend times a sequenced command out.
+        stats.dropped++;
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ota_update_begin_handler(const char *data, size_t data_len, void *ctx)
+{
+    esp_err_t err = parse_begin(data, data_len, &incoming.begin);
+    if (err != ESP_OK) {
+        TRACE(OTA_REJECTED, err, data_len);
+        return err;
+    }
+    incoming.kind = WORK_BEGIN;
+    return submit(&incoming);
+}
+
+esp_err_t ota_update_chunk_handler(const char *data, size_t data_len, void *ctx)
+{
+    bool cbor = cbor_lite_is_cbor(data, data_len);
+    const uint8_t *bytes = NULL;
+    const char *hex = NULL;
+    size_t len = 0;
+    int32_t off = -1;
+    esp_err_t err;
+
+    if (cbor) {
+        err = cbor_lite_get_int(data, data_len, "off", &off);
+        if (err == ESP_OK) {
+            err = cbor_lite_get_bytes(data, data_len, "data", &bytes, &len);
+        }
+    } else {
+        err = json_lite_get_int(data, data_len, "off", &off);
+        if (err == ESP_OK) {
+            err = json_lite_get_string(data, data_len, "data", &hex, &len);
+        }
+        if (err == ESP_OK && !hex_valid(hex, len)) {
+            err = ESP_ERR_INVALID_ARG;
+        }
+        len /= 2;
+    }
+    if (err != ESP_OK || off < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (len > OTA_UPDATE_CHUNK_MAX) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    incoming.kind = WORK_CHUNK;
+    incoming.chunk.off = (uint32_t)off;
+    incoming.chunk.len = (uint32_t)len;
+    if (cbor) {
+        memcpy(incoming.chunk.data, bytes, len);
+    } else {
+        hex_decode(hex, len, incoming.chunk.data);
+    }
+    return submit(&incoming);
+}
+
+esp_err_t ota_update_abort_handler(const char *data, size_t data_len, void *ctx)
+{
+    incoming.kind = WORK_ABORT;
+    return submit(&incoming);
+}
+
+static void run(const ota_work_t *w)
+{
+    esp_err_t err = ESP_OK;
+    switch (w->kind) {
+    case WORK_BEGIN:
+        begin_transfer(&w->begin);
+        break;
+    case WORK_CHUNK:
+        err = apply_chunk(w->chunk.off, w->chunk.data, w->chunk.len);
+        break;
+    case WORK_ABORT:
+        abort_transfer();
+        break;
+    }
+    command_ack_complete(w->ack, err);
+}
+
+size_t ota_update_process(void)
+{
+    size_t count = 0;
+    while (work_queue && xQueueReceive(work_queue, &work, 0) == pdTRUE) {
+        run(&work);
+        count++;
+    }
+    return count;
+}
+
+static void ota_task(void *arg)
+{
+    for (;;) {
+        if (xQueueReceive(work_queue, &work, portMAX_DELAY) == pdTRUE) {
+            run(&work);
+        }
+    }
+}
+
+esp_err_t ota_update_start(void)
+{
+    if (ota_task_handle || work_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    ota_task_handle = xTaskCreateStatic(ota_task, "ota", CONFIG_OTA_UPDATE_TASK_STACK_SIZE, NULL,
+                                        CONFIG_OTA_UPDATE_TASK_PRIORITY, ota_task_stack, &ota_task_tcb);
+    if (ota_task_handle == NULL) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ota_update_init(const ota_update_config_t *config, ota_update_finish_fn_t finish,
+                          ota_update_report_fn_t report_fn)
+{
+    if (config->target == NULL || config->running == NULL || config->target == config->running ||
+        config->running_version == NULL || !version_valid(config->running_version, strlen(config->running_version)) || config->checkpoint_bytes == 0 ||
+        config->checkpoint_bytes % OTA_UPDATE_SECTOR_SIZE || config->report_bytes == 0 ||
+        finish == NULL || report_fn == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ota_config = *config;
+    ota_finish = finish;
+    ota_report = report_fn;
+    if (work_queue == NULL) {
+        work_queue = xQueueCreateStatic(CONFIG_OTA_UPDATE_QUEUE_LEN, sizeof(ota_work_t), work_queue_buffer,
+                                        &work_queue_storage);
+    } else {
+        xQueueReset(work_queue);
+    }
+    memset(&stats, 0, sizeof(stats));
+    memset(&xfer, 0, sizeof(xfer));
+    sector_fill = 0;
+    checkpoint_valid = false;
+
+    size_t len = sizeof(checkpoint);
+    nvs_handle_t nvs;
+    if (device_nvs_handle(OTA_NVS_NAMESPACE, &nvs) == ESP_OK && nvs_get_blob(nvs, OTA_NVS_KEY, &checkpoint, &len) == ESP_OK) {
+        // A different layout (older firmware) or partition cannot be continued.
+        checkpoint_valid = len == sizeof(checkpoint) && checkpoint.target_address == config->target->address;
+        checkpoint.version[OTA_UPDATE_VERSION_MAX_LEN] = '\0';
+        if (checkpoint_valid) {
+            ESP_LOGI(TAG_OTA, "Update to %s can resume at %" PRIu32, checkpoint.version, checkpoint.stream_off);
+        } else {
+            checkpoint_valid = true;
+            drop_checkpoint();
+        }
+    }
+    report_version();
+    return ESP_OK;
+}
+
+void ota_update_get_stats(ota_update_stats_t *out)
+{
+    *out = stats;
+}
@@ -0,0 +1,204 @@
+#ifndef OTA_UPDATE_H
+#define OTA_UPDATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "telemetry.h"
+
+/**
+ * Firmware updates streamed over MQTT.
+ *
+ * The backend announces an image with the "ota/begin" command and sends it
+ * in chunks with "ota/chunk"; "ota/abort" drops a transfer. Payloads (JSON
+ * or CBOR, same keys):
+ *
+ *   begin: {"version":"1.2.0","size":<image bytes>,"sha256":"<hex>",
+ *           "format":"raw"|"delta","stream":<stream bytes>,"base":"1.1.0"}
+ *   chunk: {"off":<stream offset>,"data":<bytes>}    (hex text in JSON)
+ *
+ * Chunks are decoded as they arrive into one flash sector buffer; each
+ * full sector is erased and written to the target partition, so the image
+ * is never held in RAM and a sector is always written whole. Every
+ * CONFIG_OTA_UPDATE_CHECKPOINT_BYTES of image a checkpoint (stream offset,
+ * image offset and decoder state) goes to NVS. A begin for the same image
+ * after a reboot or reconnect continues from there.
+ *
+ * A "delta" stream is a list of ops building the image, mostly out of the
+ * running firmware (LEB128 varints):
+ *
+ *   0x01 COPY   src len     len bytes of the running partition at src
+ *   0x02 INSERT len data    len literal bytes
+ *   0x03 FILL   len value   len copies of one byte
+ *
+ * A delta without COPY ops is a run length compressed full image. "base"
+ * must match the running firmware version for a delta.
+ *
+ * Progress goes to home/devices/<id>/ota/progress:
+ *
+ *   {"version":"1.2.0","offset":<next stream offset>,"state":"<state>"}
+ *
+ * "receiving" at begin and every CONFIG_OTA_UPDATE_REPORT_BYTES, "resend"
+ * when a chunk past the expected offset arrived (the backend rewinds to
+ * "offset"), then "done", "failed" or "aborted". Chunks before the
+ * expected offset are QoS 1 redeliveries and dropped. After the last
+ * chunk the partition is read back and checked against "sha256" before
+ * the finish function runs.
+ *
+ * Handlers run on the MQTT task and only parse and queue the command;
+ * decoding, sector erases, the final check and the finish function run on
+ * the OTA task, so other commands are not held up. A sequenced command is
+ * acked once the OTA task ran it. The module does not call esp_ota_ops
+ * itself; the partitions and the switch to the new image are supplied by
+ * the caller.
+ */
+
+#define OTA_UPDATE_VERSION_MAX_LEN 31   // esp_app_desc_t.version without the terminator
+#define OTA_UPDATE_SECTOR_SIZE 4096     // Flash erase unit, and the size of the sector buffer
+#define OTA_UPDATE_CHUNK_MAX 1536       // Data bytes of one ota/chunk, as the backend sends them with CBOR
+
+typedef enum {
+    OTA_FORMAT_RAW,
+    OTA_FORMAT_DELTA,
+} ota_format_t;
+
+#define OTA_OP_COPY   0x01
+#define OTA_OP_INSERT 0x02
+#define OTA_OP_FILL   0x03
+
+/**
+ * @brief Switches to a verified image, e.g. esp_ota_set_boot_partition() and a restart.
+ *
+ * @param target Partition holding the new image.
+ * @param version Version announced for the image.
+ * @return ESP_OK, or an error reported as "failed".
+ */
+typedef esp_err_t (*ota_update_finish_fn_t)(const esp_partition_t *target, const char *version);
+
+/**
+ * @brief Publishes a progress report, same contract as telemetry_publish_fn_t.
+ */
+typedef int (*ota_update_report_fn_t)(const char *subtopic, char *buf, size_t len, size_t buf_size);
+
+typedef struct {
+    const esp_partition_t *target;      // Partition images are written to, not the running one
+    const esp_partition_t *running;     // Source of COPY ops
+    const char *running_version;        // Version a delta has to be based on
+    uint32_t checkpoint_bytes;          // Image bytes between NVS checkpoints, a multiple of the sector size
+    uint32_t report_bytes;              // Stream bytes between progress reports
+    telemetry_encoding_t encoding;      // Payload encoding of the reports
+} ota_update_config_t;
+
+#define OTA_UPDATE_CONFIG_DEFAULT() {                               \
+    .target = NULL,                                                 \
+    .running = NULL,                                                \
+    .running_version = "",                                          \
+    .checkpoint_bytes = CONFIG_OTA_UPDATE_CHECKPOINT_BYTES,         \
+    .report_bytes = CONFIG_OTA_UPDATE_REPORT_BYTES,                 \
+    .encoding = TELEMETRY_ENCODING_DEFAULT,                         \
+}
+
+typedef struct {
+    bool active;                // A transfer is in progress
+    uint32_t stream_offset;     // Next stream byte expected
+    uint32_t image_offset;      // Image bytes decoded, written or in the sector buffer
+    uint32_t stream_bytes;      // Stream bytes accepted, over all transfers
+    uint32_t image_bytes;       // Image bytes written to flash, over all transfers
+    uint32_t sectors;           // Sectors erased and written
+    uint32_t checkpoints;       // Checkpoints stored in NVS
+    uint32_t resumes;           // Transfers continued from a checkpoint
+    uint32_t duplicates;        // Chunks dropped as already received
+    uint32_t gaps;              // Chunks dropped because an earlier one was missing
+    uint32_t dropped;           // Commands not queued because the OTA task fell behind
+    uint32_t completed;         // Images verified and handed to the finish function
+    uint32_t failures;          // Transfers ended by a bad stream, flash error or digest mismatch
+} ota_update_stats_t;
+
+/**
+ * @brief Sets the partitions and sinks, creates the command queue and loads
+ *        the checkpoint kept in NVS.
+ *
+ * NVS must be initialized. Commands are run once ota_update_start() was called. A checkpoint is only used once the backend
+ * begins the same image again. Reports the running version on
+ * home/devices/<id>/telemetry/firmwareVersion, which tells the backend the
+ * base for delta images.
+ *
+ * @param config Partitions and intervals.
+ * @param finish Function switching to a verified image.
+ * @param report Function publishing progress reports.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a bad configuration
+ *         (no target, target is the running partition, bad intervals
+ *         or running version).
+ */
+esp_err_t ota_update_init(const ota_update_config_t *config, ota_update_finish_fn_t finish,
+                          ota_update_report_fn_t report);
+
+/**
+ * @brief Handler for home/devices/<id>/command/ota/begin
+ *
+ * Starts a transfer, or continues the one in progress or checkpointed when
+ * version, size, digest and format match, and reports the offset to send from.
+ *
+ * @return ESP_OK once queued, ESP_ERR_INVALID_ARG for a malformed payload,
+ *         ESP_ERR_INVALID_SIZE if the image does not fit the target,
+ *         ESP_ERR_INVALID_VERSION for a delta on another base,
+ *         ESP_ERR_TIMEOUT if the queue stayed full.
+ */
+esp_err_t ota_update_begin_handler(const char *data, size_t data_len, void *ctx);
+
+/**
+ * @brief Handler for home/devices/<id>/command/ota/chunk
+ *
+ * Waits up to a second for a free queue slot while the OTA task writes a
+ * sector; a chunk dropped then is asked for again with "resend".
+ *
+ * @return ESP_OK once queued, ESP_ERR_INVALID_ARG for a malformed payload,
+ *         ESP_ERR_INVALID_SIZE for more than OTA_UPDATE_CHUNK_MAX bytes,
+ *         ESP_ERR_TIMEOUT if the queue stayed full. On the OTA task,
+ *         duplicates and gaps are dropped and a chunk without a transfer
+ *         is ignored; a malformed stream, a flash error or a digest
+ *         mismatch ends the transfer and is reported as "failed".
+ */
+esp_err_t ota_update_chunk_handler(const char *data, size_t data_len, void *ctx);
+
+/**
+ * @brief Handler for home/devices/<id>/command/ota/abort
+ *
+ * Drops the transfer and its checkpoint. The payload is ignored.
+ *
+ * @return ESP_OK once queued, ESP_ERR_TIMEOUT if the queue stayed full.
+ */
+esp_err_t ota_update_abort_handler(const char *data, size_t data_len, void *ctx);
+
+/**
+ * @brief Starts the OTA task running the queued commands.
+ *
+ * Priority and stack come from Kconfig (OTA_UPDATE_TASK_*).
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if already started or
+ *         not initialized, ESP_FAIL if the task could not be created.
+ */
+esp_err_t ota_update_start(void);
+
+/**
+ * @brief Runs the queued commands on the calling task.
+ *
+ * What the OTA task does; for the host benchmarks, which run without it.
+ *
+ * @return Number of commands run.
+ */
+size_t ota_update_process(void);
+
+/**
+ * @brief Gets the counters.
+ *
+ * The OTA task changes them, the MQTT task only dropped; a copy taken
+ * elsewhere may mix two chunks.
+ *
+ * @param out Destination for the counters.
+ */
+void ota_update_get_stats(ota_update_stats_t *out);
+
+#endif // OTA_UPDATE_H
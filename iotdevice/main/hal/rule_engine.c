@@ -0,0 +1,570 @@
+#include "rule_engine.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "device_nvs.h"
+#include "actuator_hal.h"
+#include "cbor_lite.h"
+#include "trace_log.h"
+#include "device_crypto.h"
+
+#define RULE_NVS_NAMESPACE "rules"
+#define RULE_NVS_KEY "prog"
+
+#define RULE_HEADER_LEN 12
+#define RULE_MAX_SYMBOLS CONFIG_TELEMETRY_MAX_SOURCES
+#define RULE_MAX_CHANNELS ACTUATOR_HAL_MAX_CHANNELS
+#define RULE_REPORT_QUEUE CONFIG_RULE_ENGINE_REPORT_QUEUE
+#define RULE_REPORT_PAYLOAD_MAX 192
+
+#define RULE_REPORT_BUF_SIZE DEVICE_CRYPTO_FRAME_LEN(RULE_REPORT_PAYLOAD_MAX)
+
+typedef struct {
+    uint16_t code_off;          // Condition code in program_buf
+    uint16_t code_len;
+    uint16_t action_off;        // [channel ID][level] pairs in program_buf
+    uint8_t action_count;
+    bool active;                // Condition was true at the last evaluation
+} rule_t;
+
+typedef struct {
+    uint8_t rule;
+    uint32_t t_ms;
+} rule_firing_t;
+
+static const char *TAG_RULES = "RULE_ENGINE";
+
+static rule_engine_config_t rules_config;
+static rule_action_fn_t rules_action;
+static rule_report_fn_t rules_report;
+
+static StaticSemaphore_t rules_lock_storage;
+static SemaphoreHandle_t rules_lock;
+
+// Running program, with symbols and channels replaced by source indices and channel IDs.
+static uint8_t program_buf[RULE_ENGINE_PROGRAM_MAX];
+static rule_t rules[RULE_ENGINE_MAX_RULES];
+static uint8_t rule_count;
+static size_t values_needed;    // Telemetry sources the program reads
+
+// Hex commands and the NVS copy are decoded here, not on the caller's stack.
+static uint8_t load_buf[RULE_ENGINE_PROGRAM_MAX];
+
+// Firings waiting to be reported, oldest at report_head.
+static rule_firing_t report_ring[RULE_REPORT_QUEUE];
+static size_t report_head;
+static size_t report_count;
+static uint32_t last_report_ms;
+static uint32_t report_epoch;   // Bumped when the ring is cleared, see report_firings()
+
+static rule_engine_stats_t stats;
+
+static inline bool truth(float x)
+{
+    // NAN (unknown) is not true.
+    return x < 0.0f || x > 0.0f;
+}
+
+/*
+ * Three-valued logic: a comparison with a value that was not read is
+ * unknown (NAN), and stays unknown through NOT, AND and OR unless the other
+ * side decides the result.
+ */
+static inline float compare(bool yes, bool no)
+{
+    return yes ? 1.0f : no ? 0.0f : NAN;
+}
+
+static inline float logic_and(float a, float b)
+{
+    return a == 0.0f || b == 0.0f ? 0.0f : isnan(a) || isnan(b) ? NAN : 1.0f;
+}
+
+static inline float logic_or(float a, float b)
+{
+    return truth(a) || truth(b) ? 1.0f : isnan(a) || isnan(b) ? NAN : 0.0f;
+}
+
+/*
+ * Walks the condition code once at load time: every opcode known, every
+ * operand present, no stack underflow or overflow, one value left. The
+ * evaluator relies on this and checks nothing.
+ */
+static bool validate_code(const uint8_t *code, size_t len, uint8_t symbol_count)
+{
+    size_t pc = 0;
+    int depth = 0;
+
+    while (pc < len) {
+        switch (code[pc++]) {
+        case RULE_OP_PUSH:
+            if (len - pc < sizeof(float)) {
+                return false;
+            }
+            pc += sizeof(float);
+            depth++;
+            break;
+        case RULE_OP_LOAD:
+            if (pc >= len || code[pc] >= symbol_count) {
+                return false;
+            }
+            pc++;
+            depth++;
+            break;
+        case RULE_OP_GT: case RULE_OP_GE: case RULE_OP_LT: case RULE_OP_LE:
+        case RULE_OP_EQ: case RULE_OP_NE: case RULE_OP_AND: case RULE_OP_OR:
+            if (depth < 2) {
+                return false;
+            }
+            depth--;
+            break;
+        case RULE_OP_NOT:
+            if (depth < 1) {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+        if (depth > RULE_ENGINE_STACK_DEPTH) {
+            return false;
+        }
+    }
+    return depth == 1;
+}
+
+static bool run_condition(const uint8_t *code, size_t len, const float *values)
+{
+    float stack[RULE_ENGINE_STACK_DEPTH];
+    size_t sp = 0;
+    size_t pc = 0;
+
+    while (pc < len) {
+        switch (code[pc++]) {
+        case RULE_OP_PUSH:
+            memcpy(&stack[sp++], &code[pc], sizeof(float)); // Little endian, as the ESP32
+            pc += sizeof(float);
+            break;
+        case RULE_OP_LOAD:
+            stack[sp++] = values[code[pc++]];
+            break;
+        case RULE_OP_NOT:
+            stack[sp - 1] = isnan(stack[sp - 1]) ? NAN : !truth(stack[sp - 1]);
+            break;
+        default: {
+            // Binary operators
+            float b = stack[--sp];
+            float a = stack[sp - 1];
+            switch (code[pc - 1]) {
+            case RULE_OP_GT: a = compare(a > b, a <= b); break;
+            case RULE_OP_GE: a = compare(a >= b, a < b); break;
+            case RULE_OP_LT: a = compare(a < b, a >= b); break;
+            case RULE_OP_LE: a = compare(a <= b, a > b); break;
+            case RULE_OP_EQ: a = compare(a == b, a < b || a > b); break;
+            case RULE_OP_NE: a = compare(a < b || a > b, a == b); break;
+            case RULE_OP_AND: a = logic_and(a, b); break;
+            case RULE_OP_OR: a = logic_or(a, b); break;
+            }
+            stack[sp - 1] = a;
+            break;
+        }
+        }
+    }
+    return truth(stack[0]);
+}
+
+// Reads a [len][name] entry; false if it runs past the end.
+static bool read_name(const uint8_t *program, size_t len, size_t *pos, const char **name, size_t *name_len)
+{
+    if (*pos >= len || program[*pos] == 0 || len - *pos - 1 < program[*pos]) {
+        return false;
+    }
+    *name_len = program[*pos];
+    *name = (const char *)&program[*pos + 1];
+    *pos += 1 + *name_len;
+    return true;
+}
+
+esp_err_t rule_engine_load(const uint8_t *program, size_t len, bool persist)
+{
+    rule_t staged[RULE_ENGINE_MAX_RULES];
+    int8_t sources[RULE_MAX_SYMBOLS];
+    uint8_t channel_ids[RULE_MAX_CHANNELS];
+    size_t needed = 0;
+    size_t pos = RULE_HEADER_LEN;
+    esp_err_t err = ESP_OK;
+
+    if (rules_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (len > RULE_ENGINE_PROGRAM_MAX) {
+        err = ESP_ERR_INVALID_SIZE;
+        goto rejected;
+    }
+    if (len < RULE_HEADER_LEN || program[0] != 'H' || program[1] != 'R' || program[2] != RULE_PROGRAM_VERSION) {
+        err = ESP_ERR_INVALID_VERSION;
+        goto rejected;
+    }
+    uint32_t id = program[4] | (uint32_t)program[5] << 8 | (uint32_t)program[6] << 16 | (uint32_t)program[7] << 24;
+    uint8_t symbol_count = program[8];
+    uint8_t channel_count = program[9];
+    uint8_t count = program[10];
+    if (symbol_count > RULE_MAX_SYMBOLS || channel_count > RULE_MAX_CHANNELS || count > RULE_ENGINE_MAX_RULES) {
+        err = ESP_ERR_INVALID_SIZE;
+        goto rejected;
+    }
+
+    for (uint8_t i = 0; i < symbol_count; i++) {
+        const char *name;
+        size_t name_len;
+        if (!read_name(program, len, &pos, &name, &name_len)) {
+            err = ESP_ERR_INVALID_ARG;
+            goto rejected;
+        }
+        sources[i] = (int8_t)telemetry_find_source(name, name_len);
+        if (sources[i] < 0) {
+            ESP_LOGW(TAG_RULES, "Program %" PRIu32 ": no telemetry source '%.*s'", id, (int)name_len, name);
+            err = ESP_ERR_NOT_FOUND;
+            goto rejected;
+        }
+        if ((size_t)sources[i] + 1 > needed) {
+            needed = (size_t)sources[i] + 1;
+        }
+    }
+    for (uint8_t i = 0; i < channel_count; i++) {
+        const char *name;
+        size_t name_len;
+        if (!read_name(program, len, &pos, &name, &name_len)) {
+            err = ESP_ERR_INVALID_ARG;
+            goto rejected;
+        }
+        int ch = actuator_hal_find(name, name_len);
+        if (ch < 0) {
+            ESP_LOGW(TAG_RULES, "Program %" PRIu32 ": no actuator channel '%.*s'", id, (int)name_len, name);
+            err = ESP_ERR_NOT_FOUND;
+            goto rejected;
+        }
+        channel_ids[i] = (uint8_t)ch;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        rule_t *r = &staged[i];
+        if (len - pos < 2) {
+            err = ESP_ERR_INVALID_ARG;
+            goto rejected;
+        }
+        r->code_len = program[pos] | program[pos + 1] << 8;
+        r->code_off = pos + 2;
+        pos += 2;
+        if (len - pos < (size_t)r->code_len + 1 || !validate_code(&program[pos], r->code_len, symbol_count)) {
+            err = ESP_ERR_INVALID_ARG;
+            goto rejected;
+        }
+        pos += r->code_len;
+        r->action_count = program[pos++];
+        r->action_off = pos;
+        if (len - pos < 2u * r->action_count) {
+            err = ESP_ERR_INVALID_ARG;
+            goto rejected;
+        }
+        for (uint8_t a = 0; a < r->action_count; a++, pos += 2) {
+            if (program[pos] >= channel_count || program[pos + 1] > ACTUATOR_LEVEL_MAX) {
+                err = ESP_ERR_INVALID_ARG;
+                goto rejected;
+            }
+        }
+        r->active = false;
+    }
+    if (pos != len) {
+        err = ESP_ERR_INVALID_ARG;
+        goto rejected;
+    }
+
+    xSemaphoreTake(rules_lock, portMAX_DELAY);
+    memcpy(program_buf, program, len);
+    // Resolve once: LOAD operands become source indices, action channels HAL IDs.
+    for (uint8_t i = 0; i < count; i++) {
+        const rule_t *r = &staged[i];
+        for (size_t pc = r->code_off; pc < (size_t)r->code_off + r->code_len;) {
+            uint8_t op = program_buf[pc++];
+            if (op == RULE_OP_LOAD) {
+                program_buf[pc] = (uint8_t)sources[program_buf[pc]];
+                pc++;
+            } else if (op == RULE_OP_PUSH) {
+                pc += sizeof(float);
+            }
+        }
+        for (uint8_t a = 0; a < r->action_count; a++) {
+            program_buf[r->action_off + 2 * a] = channel_ids[program_buf[r->action_off + 2 * a]];
+        }
+    }
+    memcpy(rules, staged, count * sizeof(rule_t));
+    rule_count = count;
+    values_needed = needed;
+    // Pending firings refer to rule numbers of the previous program.
+    stats.report_dropped += report_count;
+    report_count = 0;
+    report_epoch++;
+    stats.program_id = id;
+    stats.rules = count;
+    stats.loads++;
+    xSemaphoreGive(rules_lock);
+
+    TRACE(RULES_LOADED, id, count, len);
+    if (persist) {
+        nvs_handle_t nvs;
+        err = device_nvs_handle(RULE_NVS_NAMESPACE, &nvs);
+        if (err == ESP_OK) {
+            err = count ? nvs_set_blob(nvs, RULE_NVS_KEY, program, len) : nvs_erase_key(nvs, RULE_NVS_KEY);
+            if (err == ESP_ERR_NVS_NOT_FOUND) {
+                err = ESP_OK;
+            }
+            if (err == ESP_OK) {
+                err = nvs_commit(nvs);
+            }
+        }
+        if (err != ESP_OK) {
+            // Still running, only lost on the next reboot.
+            ESP_LOGW(TAG_RULES, "Program %" PRIu32 " not stored: %s", id, esp_err_to_name(err));
+        }
+    }
+    return ESP_OK;
+
+rejected:
+    xSemaphoreTake(rules_lock, portMAX_DELAY);
+    stats.load_errors++;
+    xSemaphoreGive(rules_lock);
+    TRACE(RULES_REJECTED, err, len, pos);
+    return err;
+}
+
+static int hex_nibble(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+esp_err_t rule_engine_load_hex(const char *hex, size_t hex_len, bool persist)
+{
+    esp_err_t err = ESP_OK;
+
+    if (rules_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (hex_len / 2 > sizeof(load_buf)) {
+        err = ESP_ERR_INVALID_SIZE;
+    } else if (hex_len % 2 != 0) {
+        err = ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; err == ESP_OK && i < hex_len / 2; i++) {
+        int hi = hex_nibble(hex[2 * i]);
+        int lo = hex_nibble(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            err = ESP_ERR_INVALID_ARG;
+        }
+        load_buf[i] = (uint8_t)(hi << 4 | lo);
+    }
+    if (err != ESP_OK) {
+        xSemaphoreTake(rules_lock, portMAX_DELAY);
+        stats.load_errors++;
+        xSemaphoreGive(rules_lock);
+        TRACE(RULES_REJECTED, err, hex_len, 0);
+        return err;
+    }
+    return rule_engine_load(load_buf, hex_len / 2, persist);
+}
+
+/*
+ * Packs as many pending firings as fit into one report:
+ *   {"program":<id>,"now":<ms>,"fired":[[<rule>,<t ms>],...]}
+ * "now" lets the backend tell how long ago each rule fired.
+ */
+static size_t pack_report_json(uint32_t now_ms, char *report_buf, size_t *len)
+{
+    const size_t limit = RULE_REPORT_PAYLOAD_MAX - 2;
+    size_t packed = 0;
+    int n = snprintf(report_buf, limit, "{\"program\":%" PRIu32 ",\"now\":%" PRIu32 ",\"fired\":[",
+                     stats.program_id, now_ms);
+    size_t pos = (size_t)n;
+
+    while (packed < report_count) {
+        const rule_firing_t *f = &report_ring[(report_head + packed) % RULE_REPORT_QUEUE];
+        n = snprintf(report_buf + pos, limit - pos, "%s[%u,%" PRIu32 "]", packed ? "," : "", f->rule, f->t_ms);
+        if (n < 0 || (size_t)n >= limit - pos) {
+            break;
+        }
+        pos += (size_t)n;
+        packed++;
+    }
+    memcpy(report_buf + pos, "]}", 3);
+    *len = pos + 2;
+    return packed;
+}
+
+static size_t pack_report_cbor(uint32_t now_ms, char *report_buf, size_t *len)
+{
+    cbor_lite_writer_t w;
+    size_t packed = 0;
+
+    cbor_lite_writer_init(&w, report_buf, RULE_REPORT_PAYLOAD_MAX - 1);
+    cbor_lite_put_map(&w, 3);
+    cbor_lite_put_cstr(&w, "program");
+    cbor_lite_put_uint(&w, stats.program_id);
+    cbor_lite_put_cstr(&w, "now");
+    cbor_lite_put_uint(&w, now_ms);
+    cbor_lite_put_cstr(&w, "fired");
+    cbor_lite_put_array_indef(&w);
+    while (packed < report_count) {
+        const rule_firing_t *f = &report_ring[(report_head + packed) % RULE_REPORT_QUEUE];
+        size_t mark = w.len;
+        cbor_lite_put_array(&w, 2);
+        cbor_lite_put_uint(&w, f->rule);
+        cbor_lite_put_uint(&w, f->t_ms);
+        if (w.overflow) {
+            w.len = mark;
+            break;
+        }
+        packed++;
+    }
+    // Release the reserved byte for the break code.
+    w.size += 1;
+    w.overflow = false;
+    cbor_lite_put_break(&w);
+    *len = w.len;
+    return packed;
+}
+
+/*
+ * Publishes a report packed under rules_lock, without holding it: the
+ * publish path ends in the MQTT client lock, which the MQTT task holds
+ * when a rules command takes rules_lock. The firings are only taken off
+ * the ring once sent, unless a program load cleared it meanwhile.
+ */
+static void report_firings(char *buf, size_t len, size_t packed, uint32_t epoch)
+{
+    int msg_id = rules_report("rules/fired", buf, len, RULE_REPORT_BUF_SIZE);
+    TRACE(RULES_REPORTED, packed, msg_id);
+
+    xSemaphoreTake(rules_lock, portMAX_DELAY);
+    if (msg_id < 0) {
+        // Kept for the next interval; the offline queue normally takes them first.
+        stats.report_failures++;
+    } else if (epoch == report_epoch) {
+        report_head = (report_head + packed) % RULE_REPORT_QUEUE;
+        report_count -= packed;
+        stats.reported += packed;
+    }
+    xSemaphoreGive(rules_lock);
+}
+
+void rule_engine_evaluate(const float *values, size_t count, uint32_t now_ms)
+{
+    char report[RULE_REPORT_BUF_SIZE];
+    size_t report_len = 0;
+    size_t packed = 0;
+
+    if (rules_lock == NULL) {
+        return;
+    }
+    xSemaphoreTake(rules_lock, portMAX_DELAY);
+    if (count < values_needed) {
+        xSemaphoreGive(rules_lock);
+        return;
+    }
+    stats.evaluations++;
+    for (uint8_t i = 0; i < rule_count; i++) {
+        rule_t *r = &rules[i];
+        bool active = run_condition(&program_buf[r->code_off], r->code_len, values);
+        bool fired = active && !r->active;
+        r->active = active;
+        if (!fired) {
+            continue;
+        }
+        // Act first, report later: the report never delays the output.
+        const uint8_t *action = &program_buf[r->action_off];
+        for (uint8_t a = 0; a < r->action_count; a++, action += 2) {
+            if (rules_action(action[0], action[1]) != ESP_OK) {
+                stats.action_failures++;
+            }
+        }
+        stats.fired++;
+        TRACE(RULE_FIRED, i, r->action_count);
+        if (report_count == RULE_REPORT_QUEUE) {
+            stats.report_dropped++;
+            continue;
+        }
+        rule_firing_t *f = &report_ring[(report_head + report_count) % RULE_REPORT_QUEUE];
+        f->rule = i;
+        f->t_ms = now_ms;
+        report_count++;
+    }
+    if (report_count > 0 && now_ms - last_report_ms >= rules_config.report_interval_ms) {
+        packed = rules_config.encoding == TELEMETRY_ENCODING_CBOR ? pack_report_cbor(now_ms, report, &report_len)
+                                                                  : pack_report_json(now_ms, report, &report_len);
+        last_report_ms = now_ms;
+    }
+    uint32_t epoch = report_epoch;
+    xSemaphoreGive(rules_lock);
+
+    if (packed > 0) {
+        report_firings(report, report_len, packed, epoch);
+    }
+}
+
+esp_err_t rule_engine_init(const rule_engine_config_t *config, rule_action_fn_t action, rule_report_fn_t report)
+{
+    if (config == NULL || action == NULL || report == NULL ||
+        (config->encoding != TELEMETRY_ENCODING_JSON && config->encoding != TELEMETRY_ENCODING_CBOR)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (rules_lock == NULL) {
+        rules_lock = xSemaphoreCreateMutexStatic(&rules_lock_storage);
+    }
+    xSemaphoreTake(rules_lock, portMAX_DELAY);
+    rules_config = *config;
+    rules_action = action;
+    rules_report = report;
+    rule_count = 0;
+    values_needed = 0;
+    report_head = 0;
+    report_count = 0;
+    report_epoch++;
+    // First firing is reported without waiting for a whole interval.
+    last_report_ms = 0u - config->report_interval_ms;
+    memset(&stats, 0, sizeof(stats));
+    xSemaphoreGive(rules_lock);
+
+    size_t len = sizeof(load_buf);
+    nvs_handle_t nvs;
+    if (device_nvs_handle(RULE_NVS_NAMESPACE, &nvs) == ESP_OK) {
+        esp_err_t err = nvs_get_blob(nvs, RULE_NVS_KEY, load_buf, &len);
+        if (err == ESP_OK) {
+            err = rule_engine_load(load_buf, len, false);
+            if (err == ESP_OK) {
+                ESP_LOGI(TAG_RULES, "Running stored program %" PRIu32 ", %u rules", stats.program_id, rule_count);
+            } else {
+                ESP_LOGW(TAG_RULES, "Stored program rejected: %s", esp_err_to_name(err));
+            }
+        }
+    }
+    telemetry_set_observer(rule_engine_evaluate);
+    return ESP_OK;
+}
+
+void rule_engine_get_stats(rule_engine_stats_t *out)
+{
+    if (rules_lock == NULL) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    xSemaphoreTake(rules_lock, portMAX_DELAY);
+    *out = stats;
+    xSemaphoreGive(rules_lock);
+}
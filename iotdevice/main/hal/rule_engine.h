@@ -0,0 +1,142 @@
+#ifndef RULE_ENGINE_H
+#define RULE_ENGINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "telemetry.h"
+
+/**
+ * On-device automation rules.
+ *
+ * The backend compiles its automation rules into a program and sends it
+ * with the "rules" command. Each rule is a condition over local telemetry
+ * values and a list of actuator channel levels. Rules are evaluated on
+ * the telemetry task after every sampling step, without allocating, and
+ * fire when their condition turns true. Firings are reported in batches on
+ * home/devices/<id>/rules/fired.
+ *
+ * Program layout (multi-byte values little endian):
+ *
+ *   "HR" version(1) flags(0) program_id(u32)
+ *   symbol_count(u8) channel_count(u8) rule_count(u8) reserved(u8)
+ *   symbol_count x  [len(u8)][telemetry key]
+ *   channel_count x [len(u8)][actuator channel name]
+ *   rule_count x    [code_len(u16)][code][action_count(u8)] action_count x [channel(u8)][level(u8)]
+ *
+ * Condition code runs on a float stack and must leave exactly one value;
+ * non-zero means true. Values of sources not read in a step are NAN: a
+ * condition that depends on them is unknown and does not fire, so
+ * "!(humidity > 60)" stays false while humidity cannot be read.
+ */
+
+#define RULE_OP_PUSH 0x01   // [f32] push a constant
+#define RULE_OP_LOAD 0x02   // [u8 symbol] push a telemetry value
+#define RULE_OP_GT   0x10
+#define RULE_OP_GE   0x11
+#define RULE_OP_LT   0x12
+#define RULE_OP_LE   0x13
+#define RULE_OP_EQ   0x14
+#define RULE_OP_NE   0x15
+#define RULE_OP_AND  0x20
+#define RULE_OP_OR   0x21
+#define RULE_OP_NOT  0x22
+
+#define RULE_PROGRAM_VERSION 1
+#define RULE_ENGINE_MAX_RULES CONFIG_RULE_ENGINE_MAX_RULES
+#define RULE_ENGINE_PROGRAM_MAX CONFIG_RULE_ENGINE_PROGRAM_MAX
+#define RULE_ENGINE_STACK_DEPTH 16
+
+/**
+ * @brief Drives an actuator channel for a fired rule.
+ *
+ * Called on the telemetry task; should queue the change rather than wait for it.
+ *
+ * @param channel Actuator HAL channel ID.
+ * @param level Level to set.
+ */
+typedef esp_err_t (*rule_action_fn_t)(uint8_t channel, uint8_t level);
+
+/**
+ * @brief Publishes a firing report, same contract as telemetry_publish_fn_t.
+ */
+typedef int (*rule_report_fn_t)(const char *subtopic, char *buf, size_t len, size_t buf_size);
+
+typedef struct {
+    uint32_t report_interval_ms;    // Shortest time between two firing reports
+    telemetry_encoding_t encoding;  // Payload encoding of the reports
+} rule_engine_config_t;
+
+#define RULE_ENGINE_CONFIG_DEFAULT() {                              \
+    .report_interval_ms = CONFIG_RULE_ENGINE_REPORT_INTERVAL_MS,    \
+    .encoding = TELEMETRY_ENCODING_DEFAULT,                         \
+}
+
+typedef struct {
+    uint32_t program_id;        // ID of the loaded program, 0 if none
+    uint32_t rules;             // Rules in the loaded program
+    uint32_t loads;             // Programs loaded
+    uint32_t load_errors;       // Programs rejected
+    uint32_t evaluations;       // Sampling steps evaluated
+    uint32_t fired;             // Rule firings
+    uint32_t action_failures;   // Actions the action function rejected
+    uint32_t reported;          // Firings published
+    uint32_t report_dropped;    // Firings lost because the report queue was full
+    uint32_t report_failures;   // Reports the publish function rejected
+} rule_engine_stats_t;
+
+/**
+ * @brief Sets configuration and sinks and loads the program kept in NVS.
+ *
+ * Telemetry sources and actuator channels the program refers to must be
+ * registered before. NVS must be initialized. Also installs the telemetry
+ * observer that evaluates the rules.
+ *
+ * @param config Report configuration.
+ * @param action Function driving the outputs of fired rules.
+ * @param report Function publishing firing reports.
+ * @return ESP_OK on success (with or without a stored program),
+ *         ESP_ERR_INVALID_ARG for a bad configuration.
+ */
+esp_err_t rule_engine_init(const rule_engine_config_t *config, rule_action_fn_t action, rule_report_fn_t report);
+
+/**
+ * @brief Validates a program and replaces the running one.
+ *
+ * Symbols and channel names are resolved once here, so evaluation does not
+ * look anything up. A rejected program leaves the running one in place.
+ * An empty program (rule_count 0) removes all rules.
+ *
+ * @param program Program bytes, copied.
+ * @param len Length of the program.
+ * @param persist Store the program in NVS so it runs after a reboot.
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if the program is too
+ *         large, ESP_ERR_INVALID_VERSION for a bad header or version,
+ *         ESP_ERR_INVALID_ARG for malformed code, ESP_ERR_NOT_FOUND for an
+ *         unknown telemetry key or channel.
+ */
+esp_err_t rule_engine_load(const uint8_t *program, size_t len, bool persist);
+
+/**
+ * @brief Same as rule_engine_load() for a hex encoded program.
+ */
+esp_err_t rule_engine_load_hex(const char *hex, size_t hex_len, bool persist);
+
+/**
+ * @brief Evaluates all rules against one sampling step.
+ *
+ * Installed as telemetry observer; exposed so the host benchmarks can call
+ * it directly. Runs the actions of rules whose condition turned true and
+ * publishes pending firings when the report interval has passed.
+ */
+void rule_engine_evaluate(const float *values, size_t count, uint32_t now_ms);
+
+/**
+ * @brief Gets the counters.
+ *
+ * @param out Destination for the counters.
+ */
+void rule_engine_get_stats(rule_engine_stats_t *out);
+
+#endif // RULE_ENGINE_H
@@ -0,0 +1,341 @@
+#include "telemetry.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "cbor_lite.h"
+#include "trace_log.h"
+#include "device_crypto.h"
+
+#define TELEMETRY_BUF_SIZE DEVICE_CRYPTO_FRAME_LEN(CONFIG_TELEMETRY_PAYLOAD_MAX)
+
+// Bytes kept free while packing samples for the closing "]}" (JSON) or break code (CBOR).
+#define TELEMETRY_TRAILER_LEN 2
+#define TELEMETRY_CBOR_TRAILER_LEN 1
+
+typedef struct {
+    char key[TELEMETRY_KEY_MAX_LEN + 1];
+    telemetry_read_fn_t read;
+    void *ctx;
+    float deadband;
+    float last_value;   // Last value put into the ring
+    bool has_value;
+} telemetry_source_t;
+
+typedef struct {
+    uint32_t t_ms;
+    uint8_t source;
+    float value;
+} telemetry_sample_t;
+
+static const char *TAG_TELEM = "TELEMETRY";
+
+static telemetry_config_t telem_config;
+static telemetry_publish_fn_t telem_publish;
+static telemetry_source_t sources[CONFIG_TELEMETRY_MAX_SOURCES];
+static size_t source_count;
+static float step_values[CONFIG_TELEMETRY_MAX_SOURCES];   // Reads of the current step, for the observer
+static telemetry_observer_fn_t telem_observer;
+
+// Samples waiting to be published, oldest at ring_head.
+static telemetry_sample_t ring[CONFIG_TELEMETRY_RING_SIZE];
+static size_t ring_head;
+static size_t ring_count;
+static uint32_t batch_start_ms;
+
+static char payload_buf[TELEMETRY_BUF_SIZE];
+static telemetry_stats_t stats;
+
+static StaticTask_t telemetry_task_tcb;
+static StackType_t telemetry_task_stack[CONFIG_TELEMETRY_TASK_STACK_SIZE];
+static TaskHandle_t telemetry_task_handle;
+
+esp_err_t telemetry_init(const telemetry_config_t *config, telemetry_publish_fn_t publish)
+{
+    if (config == NULL || publish == NULL || config->sample_period_ms == 0 ||
+        config->high_water == 0 || config->high_water > CONFIG_TELEMETRY_RING_SIZE ||
+        (config->encoding != TELEMETRY_ENCODING_JSON && config->encoding != TELEMETRY_ENCODING_CBOR)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    telem_config = *config;
+    telem_publish = publish;
+    memset(sources, 0, sizeof(sources));
+    source_count = 0;
+    ring_head = 0;
+    ring_count = 0;
+    memset(&stats, 0, sizeof(stats));
+    return ESP_OK;
+}
+
+esp_err_t telemetry_register_source(const char *key, telemetry_read_fn_t read, void *ctx, float deadband)
+{
+    size_t key_len = key ? strlen(key) : 0;
+    if (read == NULL || key_len == 0 || key_len > TELEMETRY_KEY_MAX_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (source_count >= CONFIG_TELEMETRY_MAX_SOURCES) {
+        return ESP_ERR_NO_MEM;
+    }
+    telemetry_source_t *src = &sources[source_count++];
+    memcpy(src->key, key, key_len + 1);
+    src->read = read;
+    src->ctx = ctx;
+    src->deadband = deadband;
+    src->has_value = false;
+    return ESP_OK;
+}
+
+int telemetry_find_source(const char *key, size_t key_len)
+{
+    if (key_len == 0 || key_len > TELEMETRY_KEY_MAX_LEN) {
+        return -1;
+    }
+    for (size_t i = 0; i < source_count; i++) {
+        if (strncmp(sources[i].key, key, key_len) == 0 && sources[i].key[key_len] == '\0') {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+void telemetry_set_observer(telemetry_observer_fn_t observer)
+{
+    telem_observer = observer;
+}
+
+static void ring_push(uint8_t source, float value, uint32_t now_ms)
+{
+    if (ring_count == 0) {
+        batch_start_ms = now_ms;
+    }
+    if (ring_count == CONFIG_TELEMETRY_RING_SIZE) {
+        // Keep the newest data; the oldest sample is lost.
+        ring_head = (ring_head + 1) % CONFIG_TELEMETRY_RING_SIZE;
+        ring_count--;
+        stats.overwritten++;
+        batch_start_ms = ring[ring_head].t_ms;
+    }
+    telemetry_sample_t *s = &ring[(ring_head + ring_count) % CONFIG_TELEMETRY_RING_SIZE];
+    s->t_ms = now_ms;
+    s->source = source;
+    s->value = value;
+    ring_count++;
+    if (ring_count > stats.buffered_max) {
+        stats.buffered_max = ring_count;
+    }
+}
+
+static bool append(size_t *pos, size_t limit, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(payload_buf + *pos, limit - *pos, fmt, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= limit - *pos) {
+        payload_buf[*pos] = '\0';
+        return false;
+    }
+    *pos += (size_t)n;
+    return true;
+}
+
+// JSON has no NaN or Infinity: a reading that is neither goes out as null.
+static bool append_number(size_t *pos, size_t limit, float value)
+{
+    return isfinite(value) ? append(pos, limit, "%.6g", (double)value) : append(pos, limit, "null");
+}
+
+/*
+ * Packs as many buffered samples as fit into one payload:
+ *   {"<key>":<latest>,...,"keys":["<key>",...],"ts":<t0 ms>,"samples":[[<key idx>,<dt ms>,<value>],...]}
+ * Latest values stay at the top level so the backend and its automation
+ * rules keep seeing a flat state object.
+ */
+static size_t pack_batch_json(size_t *len)
+{
+    const size_t limit = CONFIG_TELEMETRY_PAYLOAD_MAX - TELEMETRY_TRAILER_LEN;
+    size_t pos = 0;
+    size_t packed = 0;
+    bool ok = append(&pos, limit, "{");
+
+    for (size_t i = 0; ok && i < source_count; i++) {
+        if (sources[i].has_value) {
+            ok = append(&pos, limit, "\"%s\":", sources[i].key) && append_number(&pos, limit, sources[i].last_value) &&
+                 append(&pos, limit, ",");
+        }
+    }
+    ok = ok && append(&pos, limit, "\"keys\":[");
+    for (size_t i = 0; ok && i < source_count; i++) {
+        ok = append(&pos, limit, "%s\"%s\"", i ? "," : "", sources[i].key);
+    }
+    ok = ok && append(&pos, limit, "],\"ts\":%" PRIu32 ",\"samples\":[", batch_start_ms);
+    if (!ok) {
+        return 0;
+    }
+
+    while (packed < ring_count) {
+        const telemetry_sample_t *s = &ring[(ring_head + packed) % CONFIG_TELEMETRY_RING_SIZE];
+        size_t mark = pos;
+        if (!append(&pos, limit, "%s[%u,%" PRIu32 ",", packed ? "," : "", s->source, s->t_ms - batch_start_ms) ||
+            !append_number(&pos, limit, s->value) || !append(&pos, limit, "]")) {
+            pos = mark;
+            break;
+        }
+        packed++;
+    }
+    memcpy(payload_buf + pos, "]}", TELEMETRY_TRAILER_LEN + 1);
+    *len = pos + TELEMETRY_TRAILER_LEN;
+    return packed;
+}
+
+/*
+ * Same layout as pack_batch_json() in CBOR, with the samples in an
+ * indefinite length array so they can be appended until the buffer is full.
+ */
+static size_t pack_batch_cbor(size_t *len)
+{
+    cbor_lite_writer_t w;
+    size_t latest = 0;
+    size_t packed = 0;
+
+    cbor_lite_writer_init(&w, payload_buf, CONFIG_TELEMETRY_PAYLOAD_MAX - TELEMETRY_CBOR_TRAILER_LEN);
+    for (size_t i = 0; i < source_count; i++) {
+        latest += sources[i].has_value ? 1 : 0;
+    }
+    cbor_lite_put_map(&w, latest + 3);
+    for (size_t i = 0; i < source_count; i++) {
+        if (sources[i].has_value) {
+            cbor_lite_put_cstr(&w, sources[i].key);
+            cbor_lite_put_number(&w, sources[i].last_value);
+        }
+    }
+    cbor_lite_put_cstr(&w, "keys");
+    cbor_lite_put_array(&w, source_count);
+    for (size_t i = 0; i < source_count; i++) {
+        cbor_lite_put_cstr(&w, sources[i].key);
+    }
+    cbor_lite_put_cstr(&w, "ts");
+    cbor_lite_put_uint(&w, batch_start_ms);
+    cbor_lite_put_cstr(&w, "samples");
+    cbor_lite_put_array_indef(&w);
+    if (w.overflow) {
+        return 0;
+    }
+
+    while (packed < ring_count) {
+        const telemetry_sample_t *s = &ring[(ring_head + packed) % CONFIG_TELEMETRY_RING_SIZE];
+        size_t mark = w.len;
+        cbor_lite_put_array(&w, 3);
+        cbor_lite_put_uint(&w, s->source);
+        cbor_lite_put_uint(&w, s->t_ms - batch_start_ms);
+        cbor_lite_put_number(&w, s->value);
+        if (w.overflow) {
+            w.len = mark;
+            break;
+        }
+        packed++;
+    }
+    // Release the reserved trailer byte for the break code.
+    w.size += TELEMETRY_CBOR_TRAILER_LEN;
+    w.overflow = false;
+    cbor_lite_put_break(&w);
+    *len = w.len;
+    return packed;
+}
+
+esp_err_t telemetry_flush(uint32_t now_ms)
+{
+    esp_err_t result = ESP_OK;
+
+    while (ring_count > 0) {
+        size_t len = 0;
+        size_t packed = telem_config.encoding == TELEMETRY_ENCODING_CBOR ? pack_batch_cbor(&len)
+                                                                         : pack_batch_json(&len);
+        if (packed == 0) {
+            ESP_LOGE(TAG_TELEM, "CONFIG_TELEMETRY_PAYLOAD_MAX too small for a single sample");
+            ring_count = 0;
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        stats.bytes += len;
+        int msg_id = telem_publish("telemetry", payload_buf, len, sizeof(payload_buf));
+        TRACE(TELEM_FLUSH, packed, len, msg_id);
+        if (msg_id >= 0) {
+            stats.publishes++;
+        } else {
+            stats.publish_failures++;
+            result = ESP_FAIL;
+        }
+
+        // Failed batches are dropped as well, the ring must not block sampling.
+        ring_head = (ring_head + packed) % CONFIG_TELEMETRY_RING_SIZE;
+        ring_count -= packed;
+        batch_start_ms = ring_count ? ring[ring_head].t_ms : now_ms;
+    }
+    return result;
+}
+
+void telemetry_poll(uint32_t now_ms)
+{
+    for (size_t i = 0; i < source_count; i++) {
+        telemetry_source_t *src = &sources[i];
+        float value;
+        if (!src->read(src->ctx, &value)) {
+            step_values[i] = NAN;
+            continue;
+        }
+        step_values[i] = value;
+        stats.samples++;
+        if (src->has_value && fabsf(value - src->last_value) <= src->deadband) {
+            stats.merged++;
+            continue;
+        }
+        src->last_value = value;
+        src->has_value = true;
+        ring_push((uint8_t)i, value, now_ms);
+    }
+    if (telem_observer) {
+        telem_observer(step_values, source_count, now_ms);
+    }
+
+    if (ring_count >= telem_config.high_water ||
+        (ring_count > 0 && now_ms - batch_start_ms >= telem_config.flush_interval_ms)) {
+        telemetry_flush(now_ms);
+    }
+}
+
+static void telemetry_task(void *arg)
+{
+    TickType_t last_wake = xTaskGetTickCount();
+    for (;;) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(telem_config.sample_period_ms));
+        telemetry_poll((uint32_t)(esp_timer_get_time() / 1000));
+    }
+}
+
+esp_err_t telemetry_start(void)
+{
+    if (telemetry_task_handle || telem_publish == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    telemetry_task_handle = xTaskCreateStatic(telemetry_task, "telemetry", CONFIG_TELEMETRY_TASK_STACK_SIZE, NULL,
+                                              CONFIG_TELEMETRY_TASK_PRIORITY, telemetry_task_stack, &telemetry_task_tcb);
+    if (telemetry_task_handle == NULL) {
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG_TELEM, "Telemetry started: %u sources, sample %" PRIu32 " ms, flush %" PRIu32 " ms / %u samples",
+             (unsigned)source_count, telem_config.sample_period_ms, telem_config.flush_interval_ms,
+             telem_config.high_water);
+    return ESP_OK;
+}
+
+void telemetry_get_stats(telemetry_stats_t *out)
+{
+    *out = stats;
+}
@@ -0,0 +1,150 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define TELEMETRY_KEY_MAX_LEN 24
+
+/**
+ * @brief Reads the current value of a telemetry source.
+ *
+ * @param ctx Context pointer given at registration.
+ * @param value Set to the sampled value.
+ * @return true if a value was read, false to skip this sample.
+ */
+typedef bool (*telemetry_read_fn_t)(void *ctx, float *value);
+
+/**
+ * @brief Publishes one packed telemetry batch.
+ *
+ * Same contract as network_mqtt_publish(): buf may be modified in place
+ * (e.g. encrypted) and holds buf_size bytes.
+ *
+ * @return Message ID (>= 0) on success, negative on failure.
+ */
+typedef int (*telemetry_publish_fn_t)(const char *subtopic, char *buf, size_t len, size_t buf_size);
+
+/**
+ * @brief Receives the values read in one sampling step, on the telemetry task.
+ *
+ * Called before deadband filtering, so every read is seen.
+ *
+ * @param values One value per registered source, in registration order;
+ *               NAN for sources that were not read in this step.
+ * @param count Number of registered sources.
+ * @param now_ms Time of the sampling step.
+ */
+typedef void (*telemetry_observer_fn_t)(const float *values, size_t count, uint32_t now_ms);
+
+typedef enum {
+    TELEMETRY_ENCODING_JSON,
+    TELEMETRY_ENCODING_CBOR,
+} telemetry_encoding_t;
+
+#if CONFIG_DEVICE_PAYLOAD_FORMAT_CBOR
+#define TELEMETRY_ENCODING_DEFAULT TELEMETRY_ENCODING_CBOR
+#else
+#define TELEMETRY_ENCODING_DEFAULT TELEMETRY_ENCODING_JSON
+#endif
+
+typedef struct {
+    uint32_t sample_period_ms;      // How often sources are read
+    uint32_t flush_interval_ms;     // Longest time a sample waits before being published
+    uint16_t high_water;            // Buffered samples that trigger an early flush
+    telemetry_encoding_t encoding;  // Payload encoding of published batches
+} telemetry_config_t;
+
+#define TELEMETRY_CONFIG_DEFAULT() {                                \
+    .sample_period_ms = CONFIG_TELEMETRY_SAMPLE_PERIOD_MS,          \
+    .flush_interval_ms = CONFIG_TELEMETRY_FLUSH_INTERVAL_MS,        \
+    .high_water = CONFIG_TELEMETRY_HIGH_WATER,                      \
+    .encoding = TELEMETRY_ENCODING_DEFAULT,                         \
+}
+
+typedef struct {
+    uint32_t samples;          // Values read from sources
+    uint32_t merged;           // Samples dropped because the value did not change
+    uint32_t buffered_max;     // Highest ring fill level
+    uint32_t overwritten;      // Samples lost because the ring was full
+    uint32_t publishes;        // Batches published
+    uint32_t publish_failures; // Batches the publish function rejected
+    uint64_t bytes;            // Plaintext bytes handed to the publish function
+} telemetry_stats_t;
+
+/**
+ * @brief Resets the telemetry state and sets configuration and sink.
+ *
+ * Removes all registered sources. Does not start the sampling task.
+ *
+ * @param config Sampling and flush configuration.
+ * @param publish Function that sends a packed batch.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a bad configuration.
+ */
+esp_err_t telemetry_init(const telemetry_config_t *config, telemetry_publish_fn_t publish);
+
+/**
+ * @brief Registers a telemetry source.
+ *
+ * Consecutive samples that differ by no more than deadband from the last
+ * buffered value are merged into it and not buffered again.
+ *
+ * @param key Name of the value in the published payload.
+ * @param read Function reading the value.
+ * @param ctx Context passed to read.
+ * @param deadband Smallest change worth reporting (0 to report any change).
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if all slots are used,
+ *         ESP_ERR_INVALID_ARG for a bad key.
+ */
+esp_err_t telemetry_register_source(const char *key, telemetry_read_fn_t read, void *ctx, float deadband);
+
+/**
+ * @brief Looks up a registered source by key.
+ *
+ * @return Index of the source in the observer values, or -1 if not found.
+ */
+int telemetry_find_source(const char *key, size_t key_len);
+
+/**
+ * @brief Sets the function that sees every sampling step (NULL to remove).
+ *
+ * Kept across telemetry_init().
+ */
+void telemetry_set_observer(telemetry_observer_fn_t observer);
+
+/**
+ * @brief Starts the task that samples sources and flushes batches.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if already started or not initialized.
+ */
+esp_err_t telemetry_start(void);
+
+/**
+ * @brief Runs one sampling step and flushes if a flush condition is met.
+ *
+ * Called by the telemetry task every sample period; exposed so the host
+ * benchmarks can drive it with a simulated clock.
+ *
+ * @param now_ms Current time in milliseconds.
+ */
+void telemetry_poll(uint32_t now_ms);
+
+/**
+ * @brief Publishes all buffered samples immediately.
+ *
+ * @param now_ms Current time in milliseconds.
+ * @return ESP_OK if everything was published (or nothing was buffered),
+ *         ESP_FAIL if the publish function failed.
+ */
+esp_err_t telemetry_flush(uint32_t now_ms);
+
+/**
+ * @brief Gets the telemetry counters.
+ *
+ * @param out Destination for the counters.
+ */
+void telemetry_get_stats(telemetry_stats_t *out);
+
+#endif // TELEMETRY_H
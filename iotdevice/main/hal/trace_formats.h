@@ -0,0 +1,69 @@
+#ifndef TRACE_FORMATS_H
+#define TRACE_FORMATS_H
+
+/*
+ * Trace record formats: X(name, tag, level, format)
+ *
+ * A record stores only the index of its format in this table, so append
+ * new entries at the end and never reorder them. tools/trace_decode.py
+ * reads this file to format dumps on the host.
+ *
+ * Formats take at most TRACE_LOG_MAX_ARGS integer arguments, stored as
+ * 32 bit words, and may only use the %d, %u and %x conversions.
+ * The tag selects the CONFIG_TRACE_LEVEL_<tag> option that compiles the
+ * record in or out; levels are NONE, ERROR, WARN, INFO, DEBUG, VERBOSE.
+ */
+#define TRACE_FORMATS(X)                                                                        \
+    X(MQTT_CONNECTED,    NET,    INFO,  "MQTT connected, subscribe msg_id=%d")                  \
+    X(MQTT_DISCONNECTED, NET,    INFO,  "MQTT disconnected")                                    \
+    X(MQTT_SUBSCRIBED,   NET,    INFO,  "MQTT subscribed msg_id=%d")                            \
+    X(MQTT_PUBLISHED,    NET,    DEBUG, "MQTT published msg_id=%d")                             \
+    X(MQTT_DATA,         NET,    DEBUG, "MQTT data topic_len=%u len=%u offset=%u total=%u")     \
+    X(MQTT_ERROR,        NET,    ERROR, "MQTT error type=%d tls=0x%x tls_stack=0x%x errno=%d")  \
+    X(MSG_UNDECRYPTABLE, NET,    WARN,  "Dropped undecryptable message len=%u err=0x%x")        \
+    X(MSG_DISPATCHED,    NET,    DEBUG, "Message len=%u handled in %u us")                      \
+    X(CMD_NO_HANDLER,    ROUTER, WARN,  "No handler for command topic_len=%u")                  \
+    X(CMD_FAILED,        ROUTER, WARN,  "Command failed err=0x%x")                              \
+    X(ACT_QUEUE_FULL,    ACT,    WARN,  "Actuator queue full, dropped=%u")                      \
+    X(ACT_EXECUTED,      ACT,    DEBUG, "Actuator ran value=%d latency=%u us")                  \
+    X(REASM_TOO_LARGE,   REASM,  WARN,  "Dropped %u byte message (buffer %u)")                  \
+    X(REASM_SEQUENCE,    REASM,  WARN,  "Fragment sequence error offset=%u expected=%u")        \
+    X(TELEM_FLUSH,       TELEM,  DEBUG, "Telemetry batch samples=%u bytes=%u msg_id=%d")        \
+    X(LED_COMMAND,       APP,    DEBUG, "LED command state=%d")                                 \
+    X(LED_BAD_PAYLOAD,   APP,    WARN,  "Unknown LED command payload len=%u first=0x%x")        \
+    X(TRACE_DUMP,        APP,    INFO,  "Trace dump requested, text=%d")                        \
+    X(OQ_SPILLED,        QUEUE,  INFO,  "Spilled %u messages (%u bytes) to segment %u")         \
+    X(OQ_DROPPED,        QUEUE,  WARN,  "Dropped %u queued messages err=0x%x")                  \
+    X(OQ_REPLAYED,       QUEUE,  INFO,  "Replayed %u queued messages in %u ms")                 \
+    X(WIFI_RETRY,        NET,    INFO,  "Wi-Fi reconnect in %u ms, attempt %u")                 \
+    X(MQTT_RETRY,        NET,    INFO,  "MQTT reconnect in %u ms, attempt %u")                  \
+    X(RULES_LOADED,      RULES,  INFO,  "Rule program %u loaded, %u rules, %u bytes")           \
+    X(RULES_REJECTED,    RULES,  WARN,  "Rule program rejected err=0x%x len=%u at %u")          \
+    X(RULE_FIRED,        RULES,  DEBUG, "Rule %u fired, %u actions")                            \
+    X(RULES_REPORTED,    RULES,  DEBUG, "Reported %u rule firings msg_id=%d")                   \
+    X(GROUP_JOINED,      ROUTER, INFO,  "Joined group %u, subscribe msg_id=%d")                 \
+    X(GROUP_LEFT,        ROUTER, INFO,  "Left group %u, unsubscribe msg_id=%d")                 \
+    X(GROUP_REJECTED,    ROUTER, WARN,  "Group membership change rejected err=0x%x")            \
+    X(SCENE_APPLIED,     ACT,    DEBUG, "Scene applied mask=0x%x err=0x%x")                     \
+    X(METRICS_SNAPSHOT,  TELEM,  DEBUG, "Metrics snapshot bytes=%u msg_id=%d")                  \
+    X(CMD_DUPLICATE,     ROUTER, INFO,  "Duplicate command seq=%u not run again")               \
+    X(CMD_ACKED,         ROUTER, DEBUG, "Acked %u commands msg_id=%d")                          \
+    X(OTA_BEGIN,         OTA,    INFO,  "OTA format=%u stream=%u image=%u bytes")               \
+    X(OTA_RESUMED,       OTA,    INFO,  "OTA resumed at stream=%u image=%u")                    \
+    X(OTA_CHECKPOINT,    OTA,    DEBUG, "OTA checkpoint stream=%u image=%u")                    \
+    X(OTA_GAP,           OTA,    INFO,  "OTA chunk at %u, expected %u, resend requested")       \
+    X(OTA_FAILED,        OTA,    WARN,  "OTA failed err=0x%x stream=%u image=%u")               \
+    X(OTA_DONE,          OTA,    INFO,  "OTA image of %u bytes verified, stream %u bytes")      \
+    X(OTA_ABORTED,       OTA,    INFO,  "OTA aborted at stream=%u")                             \
+    X(OTA_REJECTED,      OTA,    WARN,  "OTA begin rejected err=0x%x len=%u")                   \
+    X(LAN_MALFORMED,     LAN,    WARN,  "Dropped malformed LAN datagram len=%u")                \
+    X(LAN_STALE,         LAN,    WARN,  "Dropped LAN command with stale seq=%u")                \
+    X(LAN_FAILED,        LAN,    INFO,  "LAN command err=0x%x len=%u")                          \
+    X(SHADOW_APPLIED,    SHADOW, DEBUG, "Shadow applied mask=0x%x commands=%u err=0x%x")        \
+    X(SHADOW_PUBLISHED,  SHADOW, DEBUG, "Shadow version=%u published, %u bytes full=%d")        \
+    X(SHADOW_FAILED,     SHADOW, WARN,  "Shadow version=%u not published err=0x%x")             \
+    X(TLS_CONNECTED,     NET,    INFO,  "TLS connected resumed=%d in %u us")                    \
+    X(TLS_FAILED,        NET,    WARN,  "TLS connect failed err=-0x%x session=%d")              \
+    X(TLS_SESSION_SAVED, NET,    DEBUG, "TLS session saved, %u bytes")
+
+#endif // TRACE_FORMATS_H
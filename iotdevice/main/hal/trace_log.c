@@ -0,0 +1,264 @@
+#include "trace_log.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "device_crypto.h"
+#include "command_ack.h"
+
+#define TRACE_DUMP_BUF_SIZE DEVICE_CRYPTO_FRAME_LEN(CONFIG_TRACE_LOG_DUMP_CHUNK)
+
+#define TRACE_DUMP_HEADER_LEN   8
+#define TRACE_DUMP_RECORD_LEN(nargs) (12 + 4 * (nargs))
+#define TRACE_TEXT_LINE_MAX     128
+
+/*
+ * One ring slot. seq holds the stream position + 1 once the record is
+ * complete and 0 while a writer is filling it, so readers can detect
+ * torn or overwritten slots without taking a lock.
+ */
+typedef struct {
+    _Atomic uint32_t seq;
+    uint32_t ts_us;
+    uint16_t id;
+    uint8_t nargs;
+    uint32_t args[TRACE_LOG_MAX_ARGS];
+} trace_slot_t;
+
+static const char *TAG_TRACE = "TRACE";
+
+static const char *const trace_tags[] = {
+#define TRACE_TAG_ENTRY(name, tag, level, fmt) #tag,
+    TRACE_FORMATS(TRACE_TAG_ENTRY)
+#undef TRACE_TAG_ENTRY
+};
+
+static const char *const trace_fmts[] = {
+#define TRACE_FMT_ENTRY(name, tag, level, fmt) fmt,
+    TRACE_FORMATS(TRACE_FMT_ENTRY)
+#undef TRACE_FMT_ENTRY
+};
+
+static trace_slot_t slots[CONFIG_TRACE_LOG_SLOTS];
+static _Atomic uint32_t next_seq;
+
+enum {
+    DUMP_IDLE,
+    DUMP_CLAIMED,   // Being set up by trace_log_dump_request()
+    DUMP_READY,     // Owned by trace_log_dump_process()
+};
+
+// Dump in progress; dump_state hands it from the requesting task to the trace task.
+static _Atomic int dump_state;
+static trace_log_publish_fn_t dump_publish;
+static bool dump_text;
+static uint32_t dump_cursor;
+static uint32_t dump_end;
+static command_ack_token_t dump_ack;
+static char dump_buf[TRACE_DUMP_BUF_SIZE];
+
+static StaticTask_t trace_task_tcb;
+static StackType_t trace_task_stack[CONFIG_TRACE_LOG_TASK_STACK_SIZE];
+static TaskHandle_t trace_task_handle;
+
+void trace_log_write(trace_id_t id, const uint32_t *args, size_t nargs)
+{
+    // Claiming a position is the only shared step, concurrent writers get distinct slots.
+    uint32_t seq = atomic_fetch_add_explicit(&next_seq, 1, memory_order_relaxed);
+    trace_slot_t *slot = &slots[seq % CONFIG_TRACE_LOG_SLOTS];
+
+    atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->ts_us = (uint32_t)esp_timer_get_time();
+    slot->id = (uint16_t)id;
+    slot->nargs = (uint8_t)nargs;
+    memcpy(slot->args, args, nargs * sizeof(uint32_t));
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_release);
+}
+
+size_t trace_log_read(uint32_t *cursor, trace_record_t *out, size_t max)
+{
+    uint32_t end = atomic_load_explicit(&next_seq, memory_order_acquire);
+    uint32_t seq = *cursor;
+    size_t count = 0;
+
+    if (end - seq > CONFIG_TRACE_LOG_SLOTS) {
+        seq = end - CONFIG_TRACE_LOG_SLOTS;
+    }
+    for (; seq != end && count < max; seq++) {
+        const trace_slot_t *slot = &slots[seq % CONFIG_TRACE_LOG_SLOTS];
+        trace_record_t *rec = &out[count];
+
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != seq + 1) {
+            continue; // Still being written, or already overwritten
+        }
+        rec->seq = seq;
+        rec->ts_us = slot->ts_us;
+        rec->id = slot->id;
+        rec->nargs = slot->nargs;
+        memcpy(rec->args, slot->args, sizeof(rec->args));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq + 1 ||
+            rec->id >= TRACE_ID_COUNT || rec->nargs > TRACE_LOG_MAX_ARGS) {
+            continue; // Overwritten while copying
+        }
+        count++;
+    }
+    *cursor = seq;
+    return count;
+}
+
+int trace_log_format(const trace_record_t *rec, char *buf, size_t size)
+{
+    if (rec->id >= TRACE_ID_COUNT) {
+        return snprintf(buf, size, "%u %u ?: unknown format %u", (unsigned)rec->seq, (unsigned)rec->ts_us,
+                        (unsigned)rec->id);
+    }
+    int n = snprintf(buf, size, "%u %u %s: ", (unsigned)rec->seq, (unsigned)rec->ts_us, trace_tags[rec->id]);
+    if (n < 0 || (size_t)n >= size) {
+        return n;
+    }
+    // Formats only use 32 bit integer conversions, unused arguments are ignored.
+    int m = snprintf(buf + n, size - n, trace_fmts[rec->id], (unsigned)rec->args[0], (unsigned)rec->args[1],
+                     (unsigned)rec->args[2], (unsigned)rec->args[3]);
+    return m < 0 ? m : n + m;
+}
+
+static void put_le(uint8_t *p, uint32_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i++) {
+        p[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+// Fills dump_buf with the next records of the dump, up to CONFIG_TRACE_LOG_DUMP_CHUNK bytes.
+static uint16_t dump_fill(size_t *len)
+{
+    trace_record_t rec;
+    uint16_t records = 0;
+
+    *len = 0;
+    for (;;) {
+        uint32_t cursor = dump_cursor;
+        // Records written since the request are left for the next dump.
+        if ((int32_t)(dump_end - cursor) <= 0 || trace_log_read(&cursor, &rec, 1) == 0 ||
+            (int32_t)(dump_end - rec.seq) <= 0) {
+            dump_cursor = dump_end;
+            break;
+        }
+        if (dump_text) {
+            char line[TRACE_TEXT_LINE_MAX];
+            int line_len = trace_log_format(&rec, line, sizeof(line) - 1);
+            if (line_len >= 0) {
+                if ((size_t)line_len > sizeof(line) - 2) {
+                    line_len = sizeof(line) - 2; // Truncated by snprintf
+                }
+                line[line_len++] = '\n';
+                if (*len + line_len > CONFIG_TRACE_LOG_DUMP_CHUNK) {
+                    break;
+                }
+                memcpy(dump_buf + *len, line, line_len);
+                *len += line_len;
+                records++;
+            }
+        } else {
+            if (*len + TRACE_DUMP_RECORD_LEN(rec.nargs) > CONFIG_TRACE_LOG_DUMP_CHUNK) {
+                break;
+            }
+            if (*len == 0) {
+                memcpy(dump_buf, TRACE_LOG_DUMP_MAGIC, 4);
+                put_le((uint8_t *)dump_buf + 4, TRACE_ID_COUNT, 2);
+                *len = TRACE_DUMP_HEADER_LEN;
+            }
+            uint8_t *p = (uint8_t *)dump_buf + *len;
+            put_le(p, rec.seq, 4);
+            put_le(p + 4, rec.ts_us, 4);
+            put_le(p + 8, rec.id, 2);
+            p[10] = rec.nargs;
+            p[11] = 0;
+            for (size_t a = 0; a < rec.nargs; a++) {
+                put_le(p + 12 + 4 * a, rec.args[a], 4);
+            }
+            *len += TRACE_DUMP_RECORD_LEN(rec.nargs);
+            records++;
+        }
+        dump_cursor = cursor;
+    }
+    if (!dump_text && records) {
+        put_le((uint8_t *)dump_buf + 6, records, 2);
+    }
+    return records;
+}
+
+esp_err_t trace_log_dump_request(trace_log_publish_fn_t publish, bool text)
+{
+    int idle = DUMP_IDLE;
+    if (publish == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!atomic_compare_exchange_strong(&dump_state, &idle, DUMP_CLAIMED)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    dump_publish = publish;
+    dump_text = text;
+    dump_cursor = 0;
+    dump_end = atomic_load_explicit(&next_seq, memory_order_acquire);
+    // Called from the command handler, the ack waits for the last chunk.
+    dump_ack = command_ack_take();
+    atomic_store(&dump_state, DUMP_READY);
+    if (trace_task_handle) {
+        xTaskNotifyGive(trace_task_handle);
+    }
+    return ESP_OK;
+}
+
+size_t trace_log_dump_process(void)
+{
+    uint32_t total = 0;
+    size_t chunks = 0;
+    size_t len;
+    uint16_t records;
+    esp_err_t err = ESP_OK;
+
+    if (atomic_load(&dump_state) != DUMP_READY) {
+        return 0;
+    }
+    while ((records = dump_fill(&len)) > 0) {
+        if (dump_publish("debug/trace", dump_buf, len, sizeof(dump_buf)) < 0) {
+            err = ESP_FAIL;
+            break;
+        }
+        total += records;
+        chunks++;
+    }
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG_TRACE, "Dumped %u trace records", (unsigned)total);
+    } else {
+        ESP_LOGW(TAG_TRACE, "Trace dump stopped after %u records", (unsigned)total);
+    }
+    command_ack_complete(dump_ack, err);
+    atomic_store(&dump_state, DUMP_IDLE);
+    return chunks;
+}
+
+static void trace_task(void *arg)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        trace_log_dump_process();
+    }
+}
+
+esp_err_t trace_log_start(void)
+{
+    if (trace_task_handle) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    trace_task_handle = xTaskCreateStatic(trace_task, "trace", CONFIG_TRACE_LOG_TASK_STACK_SIZE, NULL,
+                                          CONFIG_TRACE_LOG_TASK_PRIORITY, trace_task_stack, &trace_task_tcb);
+    return trace_task_handle ? ESP_OK : ESP_FAIL;
+}
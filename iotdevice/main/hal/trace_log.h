@@ -0,0 +1,150 @@
+#ifndef TRACE_LOG_H
+#define TRACE_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "trace_formats.h"
+
+/**
+ * Deferred-format binary trace log.
+ *
+ * TRACE() stores a timestamp, the ID of a static format and its integer
+ * arguments into a lock-free RAM ring; nothing is formatted on the hot
+ * path. Records are turned into text only when the ring is dumped, on the
+ * device (by the trace task) or on the host with tools/trace_decode.py.
+ *
+ * Each tag has a compile-time level (CONFIG_TRACE_LEVEL_<tag>); records
+ * above it are compiled out.
+ */
+
+#define TRACE_LOG_MAX_ARGS 4
+
+#define TRACE_LVL_NONE      0
+#define TRACE_LVL_ERROR     1
+#define TRACE_LVL_WARN      2
+#define TRACE_LVL_INFO      3
+#define TRACE_LVL_DEBUG     4
+#define TRACE_LVL_VERBOSE   5
+
+// Magic at the start of every binary dump chunk.
+#define TRACE_LOG_DUMP_MAGIC "TRC1"
+
+typedef enum {
+#define TRACE_ID_ENTRY(name, tag, level, fmt) TRACE_ID_##name,
+    TRACE_FORMATS(TRACE_ID_ENTRY)
+#undef TRACE_ID_ENTRY
+    TRACE_ID_COUNT
+} trace_id_t;
+
+// TRACE_ON_<name> is 1 when the level of the record's tag lets it through.
+enum {
+#define TRACE_ON_ENTRY(name, tag, level, fmt) TRACE_ON_##name = CONFIG_TRACE_LEVEL_##tag >= TRACE_LVL_##level,
+    TRACE_FORMATS(TRACE_ON_ENTRY)
+#undef TRACE_ON_ENTRY
+};
+
+/**
+ * @brief Records a trace event, e.g. TRACE(MQTT_DATA, topic_len, len, offset, total).
+ *
+ * Safe from any task or ISR. Compiles to nothing when the record's tag
+ * level is below the record level; the arguments are still type checked.
+ */
+#define TRACE(name, ...)                                                                    \
+    do {                                                                                    \
+        if (TRACE_ON_##name) {                                                              \
+            const uint32_t trace_args_[] = { 0, ##__VA_ARGS__ };                            \
+            _Static_assert(sizeof(trace_args_) / sizeof(uint32_t) - 1 <= TRACE_LOG_MAX_ARGS, \
+                           "too many trace arguments");                                     \
+            trace_log_write(TRACE_ID_##name, trace_args_ + 1,                               \
+                            sizeof(trace_args_) / sizeof(uint32_t) - 1);                    \
+        }                                                                                   \
+    } while (0)
+
+typedef struct {
+    uint32_t seq;       // Position in the trace stream, gaps mean lost records
+    uint32_t ts_us;     // Low 32 bits of esp_timer_get_time()
+    uint16_t id;        // trace_id_t
+    uint8_t nargs;
+    uint32_t args[TRACE_LOG_MAX_ARGS];
+} trace_record_t;
+
+/**
+ * @brief Publishes one dump chunk.
+ *
+ * Same contract as network_mqtt_publish(): buf may be modified in place
+ * (e.g. encrypted) and holds buf_size bytes.
+ *
+ * @return Message ID (>= 0) on success, negative on failure.
+ */
+typedef int (*trace_log_publish_fn_t)(const char *subtopic, char *buf, size_t len, size_t buf_size);
+
+/**
+ * @brief Appends a record to the ring. Use TRACE() instead of calling this directly.
+ */
+void trace_log_write(trace_id_t id, const uint32_t *args, size_t nargs);
+
+/**
+ * @brief Copies committed records out of the ring.
+ *
+ * Records are returned oldest first starting at *cursor; if they have
+ * been overwritten in the meantime, reading resumes at the oldest record
+ * still in the ring. Pass *cursor = 0 to read everything available.
+ *
+ * @param cursor Sequence number to start at, advanced past the records returned.
+ * @param out Destination for the records.
+ * @param max Capacity of out.
+ * @return Number of records copied.
+ */
+size_t trace_log_read(uint32_t *cursor, trace_record_t *out, size_t max);
+
+/**
+ * @brief Formats a record as "<seq> <ts_us> <tag>: <message>".
+ *
+ * @return Length of the text (as snprintf).
+ */
+int trace_log_format(const trace_record_t *rec, char *buf, size_t size);
+
+/**
+ * @brief Requests a dump of the current content of the ring to subtopic "debug/trace".
+ *
+ * Returns at once; the trace task formats and publishes the records, one
+ * chunk of at most CONFIG_TRACE_LOG_DUMP_CHUNK bytes at a time. Records
+ * written after the request are not part of the dump. Called from a command
+ * handler, it takes over the ack of a sequenced command (see command_ack.h),
+ * which is sent once the last chunk went out.
+ *
+ * Binary chunks start with TRACE_LOG_DUMP_MAGIC, then the number of
+ * formats and of records (uint16 each), then per record seq, ts_us
+ * (uint32), id (uint16), nargs, a pad byte and nargs uint32 arguments,
+ * all little endian. Text chunks hold one trace_log_format() line per record.
+ *
+ * @param publish Function that sends a chunk.
+ * @param text true to format the records on the device.
+ * @return ESP_OK if requested, ESP_ERR_INVALID_STATE if a dump is still
+ *         running, ESP_ERR_INVALID_ARG without publish.
+ */
+esp_err_t trace_log_dump_request(trace_log_publish_fn_t publish, bool text);
+
+/**
+ * @brief Publishes the requested dump.
+ *
+ * Called by the trace task; exposed so the host benchmarks can drive it.
+ *
+ * @return Number of chunks published.
+ */
+size_t trace_log_dump_process(void);
+
+/**
+ * @brief Starts the trace task, which publishes the requested dumps.
+ *
+ * It runs below the MQTT task, so commands are handled while a large ring
+ * is formatted and sent.
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_STATE if already started, ESP_FAIL if
+ *         the task could not be created.
+ */
+esp_err_t trace_log_start(void);
+
+#endif // TRACE_LOG_H
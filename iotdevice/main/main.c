@@ -4,15 +4,17 @@
 #include <string.h>
 #include "esp_wifi.h"
 #include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_ota_ops.h"
 #include "nvs_flash.h"
 #include "esp_event.h"
 #include "esp_netif.h"
-#include "protocol_examples_common.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "freertos/queue.h"
+#include "freertos/timers.h"
 
 #include "lwip/sockets.h"
 #include "lwip/dns.h"
@@ -23,137 +25,334 @@
 
 #include "hal/led_control.h"
 #include "hal/network_mqtt_handler.h"
+#include "hal/network_wifi.h"
+#include "hal/command_router.h"
+#include "hal/actuator_task.h"
+#include "hal/actuator_hal.h"
+#include "hal/json_lite.h"
+#include "hal/cbor_lite.h"
+#include "hal/telemetry.h"
+#include "hal/trace_log.h"
+#include "hal/boot_profile.h"
+#include "hal/offline_queue.h"
+#include "hal/rule_engine.h"
+#include "hal/device_groups.h"
+#include "hal/device_metrics.h"
+#include "hal/command_ack.h"
+#include "hal/ota_update.h"
+#include "hal/device_shadow.h"
+#if CONFIG_LAN_LISTENER
+#include "hal/lan_listener.h"
+#endif
 
-#define WIFI_SSID       "WIFI_SSID"             // Replace with Wi-Fi SSID
-#define WIFI_PASS       "WIFI_PASSWORD"         // Replace with Wi-Fi Password
-#define MQTT_BROKER_URL "mqtt://MQTT_BROKER_IP" // Replace with MQTT Broker URL (e.g., mqtt://192.168.1.100)
-#define MQTT_DEVICE_ID  "esp32_dev_01"          // Replace with desired device ID
+// Wi-Fi, broker and device ID are set through menuconfig (main/Kconfig.projbuild)
 #define LED_GPIO_PIN    GPIO_NUM_15
 
 #define APP_MAIN_TAG    "APP_MAIN"
 
-static gpio_num_t app_led_gpio_pin = LED_GPIO_PIN;
+// Longest wait for the offline queue to send the OTA "done" report before the restart
+#define OTA_RESTART_DRAIN_MS    5000
+#define OTA_RESTART_POLL_MS     100
 
-static void log_error_if_nonzero(const char *message, int error_code)
+// Retry interval when the actuator queue is full as the coalescing window ends
+#define SHADOW_APPLY_RETRY_MS   10
+
+static uint8_t app_led_channel;
+static TimerHandle_t shadow_timer;
+static StaticTimer_t shadow_timer_storage;
+
+/*
+ * @brief Applies the levels the shadow collected, runs on the actuator task.
+ */
+static void shadow_apply(void *ctx, int32_t value)
+{
+    device_shadow_apply();
+}
+
+/*
+ * @brief End of the coalescing window, on the timer task: queues the apply.
+ *
+ *  Commands arriving until then are applied with it; the actuator task
+ *  keeps running the commands queued meanwhile.
+ */
+static void shadow_timer_cb(TimerHandle_t timer)
+{
+    if (actuator_task_submit(shadow_apply, NULL, 0) != ESP_OK) {
+        xTimerChangePeriod(timer, pdMS_TO_TICKS(SHADOW_APPLY_RETRY_MS) + 1, 0);
+    }
+}
+
+static esp_err_t shadow_schedule(uint32_t delay_ms)
 {
-    if (error_code != 0) {
-        ESP_LOGE(APP_MAIN_TAG, "Last error %s: 0x%x", message, error_code);
+    if (delay_ms == 0) {
+        return actuator_task_submit(shadow_apply, NULL, 0);
     }
+    // Starts the timer too; the period must be at least one tick.
+    return xTimerChangePeriod(shadow_timer, pdMS_TO_TICKS(delay_ms) + 1, 0) == pdPASS ? ESP_OK : ESP_ERR_NO_MEM;
 }
 
 /*
- * @brief Event handler registered to receive MQTT events
+ * @brief Sets one channel through the shadow.
+ */
+static esp_err_t channel_desire(uint8_t channel, uint8_t level)
+{
+    actuator_state_t state = { 0 };
+    actuator_state_set(&state, channel, level);
+    return device_shadow_desire(&state);
+}
+
+/*
+ * @brief Handler for home/devices/<id>/command/setLed
  *
- *  This function is called by the MQTT client event loop.
+ *  Runs on the MQTT task: only parses the payload and queues the actuation.
+ *  Payload forms are listed at led_parse_command().
+ *  ctx points to the LED channel ID.
  */
-static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
-{
-    ESP_LOGD(APP_MAIN_TAG, "Event dispatched from event loop base=%s, event_id=%lu", base, event_id);
-    esp_mqtt_event_handle_t event = event_data;
-    esp_mqtt_client_handle_t client = event->client;
-    int msg_id;
-    switch ((esp_mqtt_event_id_t)event_id) {
-    case MQTT_EVENT_CONNECTED:
-        ESP_LOGI(APP_MAIN_TAG, "MQTT_EVENT_CONNECTED");
-        snprintf(led_command_topic, sizeof(led_command_topic), "home/devices/%s/command/setLed", MQTT_DEVICE_ID);
-        msg_id = esp_mqtt_client_subscribe(client, led_command_topic, 0);
-        ESP_LOGI(APP_MAIN_TAG, "sent subscribe successful, msg_id=%d, topic=%s", msg_id, led_command_topic);
-        break;
-    case MQTT_EVENT_DISCONNECTED:
-        ESP_LOGI(APP_MAIN_TAG, "MQTT_EVENT_DISCONNECTED");
-        break;
-    case MQTT_EVENT_SUBSCRIBED:
-        ESP_LOGI(APP_MAIN_TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
-        // Example: publish a message after subscribing
-        // msg_id = esp_mqtt_client_publish(client, "/topic/qos0", "data", 0, 0, 0);
-        // ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
-        break;
-    case MQTT_EVENT_UNSUBSCRIBED:
-        ESP_LOGI(APP_MAIN_TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
-        break;
-    case MQTT_EVENT_PUBLISHED:
-        ESP_LOGI(APP_MAIN_TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
-        break;
-    case MQTT_EVENT_DATA:
-        ESP_LOGI(APP_MAIN_TAG, "MQTT_EVENT_DATA");
-        printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
-        printf("DATA=%.*s\r\n", event->data_len, event->data);
-        if (strncmp(event->topic, led_command_topic, event->topic_len) == 0) {
-            ESP_LOGI(APP_MAIN_TAG, "Received command for LED");
-            // For simplicity, expecting "true" or "false" as string payload
-            // A more robust solution would parse JSON, e.g., {"state": true}
-            if (strncmp(event->data, "true", event->data_len) == 0) {
-                led_set_state(app_led_gpio_pin, true);
-                ESP_LOGI(APP_MAIN_TAG, "LED turned ON");
-            } else if (strncmp(event->data, "false", event->data_len) == 0) {
-                led_set_state(app_led_gpio_pin, false);
-                ESP_LOGI(APP_MAIN_TAG, "LED turned OFF");
-            } else {
-                ESP_LOGW(APP_MAIN_TAG, "Unknown LED command payload: %.*s", event->data_len, event->data);
-            }
-        }
-        break;
-    case MQTT_EVENT_ERROR:
-        ESP_LOGI(APP_MAIN_TAG, "MQTT_EVENT_ERROR");
-        if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
-            log_error_if_nonzero("reported from esp-tls", event->error_handle->esp_tls_last_esp_error);
-            log_error_if_nonzero("reported from tls stack", event->error_handle->esp_tls_stack_error);
-            log_error_if_nonzero("captured as transport's socket errno", event->error_handle->esp_transport_sock_errno);
-            ESP_LOGI(APP_MAIN_TAG, "Last errno string (%s)", strerror(event->error_handle->esp_transport_sock_errno));
-        }
-        break;
-    default:
-        ESP_LOGI(APP_MAIN_TAG, "Other event id:%d", event->event_id);
-        break;
-    }
-}
-
-static void mqtt_app_start(void)
-{
-    esp_mqtt_client_config_t mqtt_cfg = {
-        // .broker.address.uri = MQTT_BROKER_URL, // For ESP-IDF v5.x
-        .uri = MQTT_BROKER_URL, // For ESP-IDF v4.x
-    };
-    client = esp_mqtt_client_init(&mqtt_cfg);
-    /* The last argument may be used to pass data to the event handler, in this example mqtt_event_handler */
-    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
-    esp_mqtt_client_start(client);
-}
-
-static void main_wifi_event_handler(void* arg, esp_event_base_t event_base,
-                                   int32_t event_id, void* event_data)
-{
-    if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
-        ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-        ESP_LOGI(APP_MAIN_TAG, "Got IP address: " IPSTR, IP2STR(&event->ip_info.ip));
-        ESP_LOGI(APP_MAIN_TAG, "Starting MQTT application...");
-        network_mqtt_app_start(); // Initialize and start the MQTT client
-        
-        esp_mqtt_client_handle_t client = network_get_mqtt_client_handle();
-        if (client) {
-            // Register the MQTT event handler from the network module, passing the LED pin as context
-            ESP_ERROR_CHECK(esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, network_mqtt_event_handler_cb, &app_led_gpio_pin));
-            ESP_LOGI(APP_MAIN_TAG, "MQTT event handler registered with LED pin %d", app_led_gpio_pin);
-        } else {
-            ESP_LOGE(APP_MAIN_TAG, "Failed to get MQTT client handle to register event handler.");
-        }
-    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        ESP_LOGI(APP_MAIN_TAG, "Wi-Fi disconnected in main handler, network_wifi_init_sta handles reconnection.");
-        // Reconnection logic is within network_wifi_init_sta's internal handler
+static esp_err_t led_command_handler(const char *data, size_t data_len, void *ctx)
+{
+    bool state;
+    esp_err_t err = led_parse_command(data, data_len, &state);
+    if (err != ESP_OK) {
+        TRACE(LED_BAD_PAYLOAD, data_len, data_len ? (uint8_t)data[0] : 0);
+        return ESP_ERR_INVALID_ARG;
     }
+    TRACE(LED_COMMAND, state);
+    return channel_desire(*(uint8_t *)ctx, state ? 1 : 0);
 }
 
+/*
+ * @brief Handler for .../command/scene, on the device and on group topics
+ *
+ *  Payload: {"<channel>": level, ...}, see actuator_hal_parse_state(). The
+ *  whole scene goes to the shadow as one state vector, so all outputs change
+ *  in one actuator_hal_apply(). A group scene naming none of this device's
+ *  channels is not an error.
+ */
+static esp_err_t scene_command_handler(const char *data, size_t data_len, void *ctx)
+{
+    actuator_state_t state;
+    esp_err_t err = actuator_hal_parse_state(data, data_len, &state);
+    if (err == ESP_ERR_NOT_FOUND) {
+        return ESP_OK;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    return device_shadow_desire(&state);
+}
+
+/*
+ * @brief Action of a fired automation rule, runs on the telemetry task.
+ *
+ *  Goes through the shadow like a command, so evaluation does not wait for
+ *  the output.
+ */
+static esp_err_t rule_actuate(uint8_t channel, uint8_t level)
+{
+    return channel_desire(channel, level);
+}
+
+/*
+ * @brief Handler for home/devices/<id>/command/rules
+ *
+ *  Payload: {"program": "<hex>"}, a rule program compiled by the backend
+ *  (layout in hal/rule_engine.h). It replaces the running program and is
+ *  kept in NVS.
+ */
+static esp_err_t rules_command_handler(const char *data, size_t data_len, void *ctx)
+{
+    const char *hex = NULL;
+    size_t hex_len = 0;
+    esp_err_t err = cbor_lite_is_cbor(data, data_len)
+                        ? cbor_lite_get_string(data, data_len, "program", &hex, &hex_len)
+                        : json_lite_get_string(data, data_len, "program", &hex, &hex_len);
+    if (err != ESP_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return rule_engine_load_hex(hex, hex_len, true);
+}
+
+/*
+ * @brief Telemetry sources, sampled on the telemetry task.
+ */
+static bool telemetry_read_led(void *ctx, float *value)
+{
+    *value = actuator_hal_get(app_led_channel);
+    return true;
+}
+
+static bool telemetry_read_free_heap(void *ctx, float *value)
+{
+    *value = (float)esp_get_free_heap_size();
+    return true;
+}
+
+// Lets the backend see which rule program runs and skip those rules itself.
+static bool telemetry_read_rule_program(void *ctx, float *value)
+{
+    rule_engine_stats_t stats;
+    rule_engine_get_stats(&stats);
+    *value = (float)stats.program_id;
+    return true;
+}
+
+static bool telemetry_read_rssi(void *ctx, float *value)
+{
+    wifi_ap_record_t ap_info;
+    if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+        return false;
+    }
+    *value = ap_info.rssi;
+    return true;
+}
+
+/*
+ * @brief Refreshes the gauges owned by other modules, before each metrics snapshot.
+ */
+static void metrics_sample(void)
+{
+    actuator_task_stats_t actuator_stats;
+    offline_queue_stats_t queue_stats;
+    wifi_ap_record_t ap_info;
+    multi_heap_info_t heap_info;
+
+    actuator_task_get_stats(&actuator_stats);
+    offline_queue_get_stats(&queue_stats);
+    // Block count and largest free block show fragmentation that free heap alone hides.
+    heap_caps_get_info(&heap_info, MALLOC_CAP_DEFAULT);
+    device_metrics_set(METRIC_HEAP_FREE, (int32_t)esp_get_free_heap_size());
+    device_metrics_set(METRIC_HEAP_MIN, (int32_t)esp_get_minimum_free_heap_size());
+    device_metrics_set(METRIC_HEAP_LARGEST, (int32_t)heap_info.largest_free_block);
+    device_metrics_set(METRIC_HEAP_BLOCKS, (int32_t)heap_info.allocated_blocks);
+    device_metrics_set(METRIC_RSSI, esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK ? ap_info.rssi : 0);
+    device_metrics_set(METRIC_ACTUATOR_QUEUE, (int32_t)actuator_stats.queue_depth);
+    device_metrics_set(METRIC_OFFLINE_QUEUE, (int32_t)queue_stats.ram_used);
+}
+
+/*
+ * @brief Publishes on home/devices/<id>/<subtopic> at QoS 0, used by telemetry, metrics, acks and trace dumps.
+ */
+static int device_publish(const char *subtopic, char *buf, size_t len, size_t buf_size)
+{
+    return network_mqtt_publish(subtopic, buf, len, buf_size, 0, 0);
+}
+
+/*
+ * @brief Publishes on home/devices/<id>/<subtopic> retained at QoS 1, used by
+ *        the shadow status and the LAN listener address.
+ */
+static int device_publish_retained(const char *subtopic, char *buf, size_t len, size_t buf_size)
+{
+    return network_mqtt_publish(subtopic, buf, len, buf_size, 1, 1);
+}
+
+/*
+ * @brief Handler for home/devices/<id>/command/debug/trace
+ *
+ *  Has the trace task publish the trace ring to home/devices/<id>/debug/trace.
+ *  With {"format": "text"} the records are formatted on the device, otherwise
+ *  they are sent as binary for tools/trace_decode.py.
+ */
+static esp_err_t trace_dump_handler(const char *data, size_t data_len, void *ctx)
+{
+    const char *format = NULL;
+    size_t format_len = 0;
+    if (cbor_lite_is_cbor(data, data_len)) {
+        cbor_lite_get_string(data, data_len, "format", &format, &format_len);
+    } else {
+        json_lite_get_string(data, data_len, "format", &format, &format_len);
+    }
+    bool text = format_len == 4 && memcmp(format, "text", 4) == 0;
+    TRACE(TRACE_DUMP, text);
+    return trace_log_dump_request(device_publish, text);
+}
+
+/*
+ * @brief Boots the image ota_update wrote and checked, runs on the OTA task.
+ *
+ *  "done" was already published, but may still wait in the offline queue
+ *  (offline, or behind other messages); the restart waits for it to be
+ *  sent, for at most OTA_RESTART_DRAIN_MS. Stopping the client then sends
+ *  DISCONNECT behind it and closes the socket, so the reset does not cut
+ *  the report off.
+ */
+static esp_err_t ota_finish(const esp_partition_t *target, const char *version)
+{
+    esp_err_t err = esp_ota_set_boot_partition(target);
+    if (err != ESP_OK) {
+        return err;
+    }
+    for (uint32_t waited = 0; !offline_queue_is_empty() && waited < OTA_RESTART_DRAIN_MS;
+         waited += OTA_RESTART_POLL_MS) {
+        vTaskDelay(pdMS_TO_TICKS(OTA_RESTART_POLL_MS));
+    }
+    if (!offline_queue_is_empty()) {
+        ESP_LOGW(APP_MAIN_TAG, "OTA report still queued after %d ms", OTA_RESTART_DRAIN_MS);
+    }
+    esp_mqtt_client_handle_t client = network_get_mqtt_client_handle();
+    if (client != NULL) {
+        esp_mqtt_client_stop(client);
+    }
+    ESP_LOGI(APP_MAIN_TAG, "Restarting into firmware %s", version);
+    esp_restart();
+    return ESP_OK;
+}
+
+/*
+ * @brief Confirms a freshly updated image, runs on the MQTT task on every connect.
+ *
+ *  With CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE a new image boots pending
+ *  verification and the bootloader goes back to the previous one if it
+ *  resets before being marked valid. Reaching the broker is what the
+ *  update needs to work again, so the image is only marked valid then.
+ */
+static void app_confirm_on_connect(void)
+{
+    static bool confirmed;
+    esp_ota_img_states_t state;
+
+    if (confirmed) {
+        return;
+    }
+    confirmed = true;
+    if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK &&
+        state == ESP_OTA_IMG_PENDING_VERIFY) {
+        esp_err_t err = esp_ota_mark_app_valid_cancel_rollback();
+        ESP_LOGI(APP_MAIN_TAG, "Firmware %s marked valid: %s", esp_app_get_description()->version,
+                 esp_err_to_name(err));
+    }
+}
+
+#if CONFIG_LAN_LISTENER
+/*
+ * @brief Announces the LAN listener for every address the station gets.
+ *
+ *  Registered after the Wi-Fi handler, so the MQTT client exists; the
+ *  announcement waits in the offline queue until it is connected.
+ */
+static void lan_got_ip_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    const ip_event_got_ip_t *event = (const ip_event_got_ip_t *)event_data;
+    char address[LAN_LISTENER_ADDRESS_MAX_LEN + 1];
+    esp_ip4addr_ntoa(&event->ip_info.ip, address, sizeof(address));
+    esp_err_t err = lan_listener_announce(address);
+    if (err != ESP_OK) {
+        ESP_LOGW(APP_MAIN_TAG, "Failed to announce LAN listener: %s", esp_err_to_name(err));
+    }
+}
+#endif
+
 void app_main(void)
 {
     ESP_LOGI(APP_MAIN_TAG, "[APP] Startup..");
     ESP_LOGI(APP_MAIN_TAG, "[APP] Free memory: %lu bytes", esp_get_free_heap_size());
     ESP_LOGI(APP_MAIN_TAG, "[APP] IDF version: %s", esp_get_idf_version());
 
-    esp_log_level_set("*", ESP_LOG_INFO);
-    esp_log_level_set("mqtt_client", ESP_LOG_VERBOSE);
-    esp_log_level_set("MQTT_EXAMPLE", ESP_LOG_VERBOSE);
-    esp_log_level_set("NETWORK_MQTT", ESP_LOG_VERBOSE);
-    esp_log_level_set(APP_MAIN_TAG, ESP_LOG_VERBOSE);
+    // Log levels come from menuconfig; per-message events go to the trace log (hal/trace_log.h).
+
+    // Counters are recorded from here on; snapshots go to home/devices/<id>/telemetry/metrics.
+    device_metrics_config_t metrics_cfg = DEVICE_METRICS_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(device_metrics_init(&metrics_cfg, metrics_sample, device_publish));
 
     //Initialize NVS
     esp_err_t ret = nvs_flash_init();
@@ -162,25 +361,102 @@ void app_main(void)
       ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
+    boot_profile_mark(BOOT_PHASE_NVS_INIT);
+
+    // Outputs are channels of the actuator HAL, registered off
+    const actuator_channel_config_t led_channel = {
+        .name = "led",
+        .type = ACTUATOR_CHANNEL_DIGITAL,
+        .gpio = LED_GPIO_PIN,
+    };
+    ESP_ERROR_CHECK(actuator_hal_init(&actuator_backend_esp32));
+    ESP_ERROR_CHECK(actuator_hal_add_channel(&led_channel, &app_led_channel));
+
+    // Actuation runs on its own task so the MQTT task only parses and enqueues
+    ESP_ERROR_CHECK(actuator_task_start());
+
+    // Output commands set desired levels; bursts are applied once and the
+    // changed levels published, retained, on home/devices/<id>/status.
+    shadow_timer = xTimerCreateStatic("shadow_apply", 1, pdFALSE, NULL, shadow_timer_cb, &shadow_timer_storage);
+    device_shadow_config_t shadow_cfg = DEVICE_SHADOW_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(device_shadow_init(&shadow_cfg, shadow_schedule, device_publish_retained));
+
+    // Commands arrive on home/devices/<id>/command/<name>
+    ESP_ERROR_CHECK(command_router_init(CONFIG_ESP_MQTT_DEVICE_ID));
+    ESP_ERROR_CHECK(command_router_register_group("setLed", led_command_handler, &app_led_channel));
+    ESP_ERROR_CHECK(command_router_register_group("scene", scene_command_handler, NULL));
+    ESP_ERROR_CHECK(command_router_register("groups", device_groups_command_handler, NULL));
+    ESP_ERROR_CHECK(command_router_register("debug/trace", trace_dump_handler, NULL));
+    ESP_ERROR_CHECK(command_router_register("rules", rules_command_handler, NULL));
+    ESP_ERROR_CHECK(command_router_register("shadow/get", device_shadow_get_handler, NULL));
+
+    // Commands carrying a sequence number are run once and acked on
+    // home/devices/<id>/ack when they took effect.
+    command_ack_config_t command_ack_cfg = COMMAND_ACK_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(command_ack_init(&command_ack_cfg, device_publish));
+    ESP_ERROR_CHECK(command_ack_start());
+
+    // Trace dumps are formatted and published by a low-priority task
+    ESP_ERROR_CHECK(trace_log_start());
 
-    // Initialize LED
-    led_init(app_led_gpio_pin);
-    led_set_state(app_led_gpio_pin, false); // Start with LED off
-    ESP_LOGI(APP_MAIN_TAG, "LED Initialized on GPIO %d", app_led_gpio_pin);
+    // Group commands arrive on home/groups/<group>/command/<name> for every
+    // group joined; only commands registered as group commands accept them.
+    ESP_ERROR_CHECK(device_groups_init(network_mqtt_subscribe));
+
+    // Messages published while offline are kept (spilled to NVS when RAM
+    // fills up) and replayed at a limited rate after reconnecting.
+    offline_queue_config_t offline_queue_cfg = OFFLINE_QUEUE_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(offline_queue_init(&offline_queue_cfg, network_mqtt_send));
+    ESP_ERROR_CHECK(offline_queue_start());
+
+    // Firmware images are streamed on .../command/ota/* into the inactive
+    // app partition by the OTA task; the running version goes out on
+    // telemetry/firmwareVersion.
+    ota_update_config_t ota_cfg = OTA_UPDATE_CONFIG_DEFAULT();
+    ota_cfg.target = esp_ota_get_next_update_partition(NULL);
+    ota_cfg.running = esp_ota_get_running_partition();
+    ota_cfg.running_version = esp_app_get_description()->version;
+    if (ota_cfg.target != NULL) {
+        ESP_ERROR_CHECK(ota_update_init(&ota_cfg, ota_finish, device_publish));
+        ESP_ERROR_CHECK(ota_update_start());
+        ESP_ERROR_CHECK(command_router_register("ota/begin", ota_update_begin_handler, NULL));
+        ESP_ERROR_CHECK(command_router_register("ota/chunk", ota_update_chunk_handler, NULL));
+        ESP_ERROR_CHECK(command_router_register("ota/abort", ota_update_abort_handler, NULL));
+    } else {
+        ESP_LOGW(APP_MAIN_TAG, "No OTA app partition in the partition table, updates disabled");
+    }
+
+    // An updated image stays pending verification until the broker is reached.
+    network_mqtt_set_connected_callback(app_confirm_on_connect);
 
     ESP_LOGI(APP_MAIN_TAG, "Initializing Wi-Fi...");
-    // Before calling network_wifi_init_sta, register main's IP event handler
-    // This is to ensure main can trigger MQTT start *after* IP is obtained.
-    // The network_wifi_init_sta will set up its own internal handlers for basic Wi-Fi events (connect, disconnect).
-    // We need a default event loop first.
-    ESP_ERROR_CHECK(esp_event_loop_create_default()); // Ensure default loop exists, network_wifi_init_sta might also do this.
-    // It's safer if network_wifi_init_sta ensures the default loop, and main registers its specific handlers after.
-    // For now, let's assume network_wifi_init_sta handles the creation of the default event loop if not present.
-
-    // Register our IP event handler to start MQTT
-    ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &main_wifi_event_handler, NULL, NULL));
-    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &main_wifi_event_handler, NULL, NULL));
-
-    network_wifi_init_sta(); // This will connect to Wi-Fi
-    // MQTT start and event handler registration will occur in main_wifi_event_handler upon getting an IP.
+    // Starts the MQTT client once an IP address is obtained; boot phases are
+    // published on home/devices/<id>/boot when commands can be received.
+    network_wifi_init_sta();
+    // Waits in the offline queue until the broker is reached.
+    device_shadow_publish(true);
+
+#if CONFIG_LAN_LISTENER
+    // The hub also sends commands over UDP to the address announced on
+    // home/devices/<id>/lan; they go through the same decryption and dedup.
+    lan_listener_config_t lan_cfg = LAN_LISTENER_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(lan_listener_init(&lan_cfg, network_dispatch_lan, device_publish_retained));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &lan_got_ip_handler, NULL, NULL));
+    ESP_ERROR_CHECK(lan_listener_start());
+#endif
+
+    // Samples are batched and published to home/devices/<id>/telemetry
+    telemetry_config_t telemetry_cfg = TELEMETRY_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(telemetry_init(&telemetry_cfg, device_publish));
+    ESP_ERROR_CHECK(telemetry_register_source("ledState", telemetry_read_led, NULL, 0.0f));
+    ESP_ERROR_CHECK(telemetry_register_source("freeHeap", telemetry_read_free_heap, NULL, 1024.0f));
+    ESP_ERROR_CHECK(telemetry_register_source("rssi", telemetry_read_rssi, NULL, 3.0f));
+    ESP_ERROR_CHECK(telemetry_register_source("ruleProgram", telemetry_read_rule_program, NULL, 0.0f));
+
+    // Automation rules pushed by the backend run on every sampling step and
+    // act locally; firings are reported on home/devices/<id>/rules/fired.
+    rule_engine_config_t rule_engine_cfg = RULE_ENGINE_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(rule_engine_init(&rule_engine_cfg, rule_actuate, device_publish));
+    ESP_ERROR_CHECK(telemetry_start());
+    ESP_ERROR_CHECK(device_metrics_start());
 }
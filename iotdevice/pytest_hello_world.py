@@ -16,21 +16,12 @@ from pytest_embedded_qemu.dut import QemuDut
 def test_hello_world(
     dut: IdfDut, log_minimum_free_heap_size: Callable[..., None]
 ) -> None:
-    dut.expect('Hello world!')
+    dut.expect_exact('[APP] Startup..')
     log_minimum_free_heap_size()
 
 
-@pytest.mark.linux
-@pytest.mark.host_test
-def test_hello_world_linux(dut: IdfDut) -> None:
-    dut.expect('Hello world!')
-
-
-@pytest.mark.linux
-@pytest.mark.host_test
-@pytest.mark.macos_shell
-def test_hello_world_macos(dut: IdfDut) -> None:
-    dut.expect('Hello world!')
+# The firmware needs Wi-Fi and does not build for the linux target; the
+# message path is covered on the host by host_test/pytest_host_test.py.
 
 
 def verify_elf_sha256_embedding(app: QemuApp, sha256_reported: str) -> None:
@@ -56,4 +47,4 @@ def test_hello_world_host(app: QemuApp, dut: QemuDut) -> None:
     )
     verify_elf_sha256_embedding(app, sha256_reported)
 
-    dut.expect('Hello world!')
+    dut.expect_exact('[APP] Startup..')
@@ -0,0 +1,461 @@
+/*
+ * Fleet simulator: thousands of virtual devices, each with its own aesKey
+ * and telemetry profile, against a local broker (src/docker/compose), to
+ * load-test MQTTService and AutomationService. Built from the firmware
+ * modules, see sim_device.h.
+ *
+ *   idf.py --preview set-target linux && idf.py build
+ *   FLEET_SIM_DEVICES=fleet.txt FLEET_SIM_COUNT=2000 ./build/fleet_sim.elf
+ *
+ * The devices file has one device per line, as registered in the backend:
+ *   <id> <aesKey> [idle|sensor|busy] [json|cbor]
+ * e.g. psql -At -F ' ' -c 'SELECT id, "aesKey" FROM "Device"' > fleet.txt
+ *
+ * Environment (defaults in brackets):
+ *   FLEET_SIM_BROKER          host:port [127.0.0.1:1884, the compose port]
+ *   FLEET_SIM_COUNT           devices taken from the file [all]
+ *   FLEET_SIM_PROFILE         profile of lines without one [sensor]
+ *   FLEET_SIM_RAMP_PER_S      new connections per second [200]
+ *   FLEET_SIM_DURATION_S      run time, 0 runs until killed [60]
+ *   FLEET_SIM_REPORT_S        report period [5]
+ *   FLEET_SIM_RULE_THRESHOLD  temperature the backend rules trigger at [28]
+ *   FLEET_SIM_BROKER_PID      broker process to sample CPU of [first "mosquitto" in /proc]
+ *
+ * Every report period one line goes to stdout:
+ *   FLEET t_s=.. devices=.. connected=.. publish_per_s=.. commands_per_s=..
+ *         rule_p50_ms=.. rule_p99_ms=.. broker_cpu_pct=.. backend_ingest_per_s=.. ...
+ * rule_*_ms is the time from a telemetry batch crossing the threshold to
+ * the command it triggers. backend_* comes from home/backend/stats, which
+ * the backend publishes when MQTT_STATS_INTERVAL_MS is set.
+ */
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "json_lite.h"
+#include "sim_device.h"
+
+#define FLEET_EPOLL_BATCH     256
+#define FLEET_TICK_MS         10
+#define FLEET_LINE_MAX        256
+#define FLEET_STATS_TOPIC     "home/backend/stats"
+
+static const char *TAG_FLEET = "FLEET_SIM";
+
+typedef struct {
+    int fd;             // Registered with epoll, -1 if none
+    uint32_t session;
+    uint32_t events;
+} fleet_slot_t;
+
+// Latest home/backend/stats message.
+typedef struct {
+    bool seen;
+    float ingest_per_s;
+    float failed;
+    float handler_p99_ms;
+    float rtt_p50_ms;
+    float rtt_p99_ms;
+    float timed_out;
+} backend_stats_t;
+
+typedef struct {
+    uint64_t ticks;
+    uint64_t at_us;
+} cpu_sample_t;
+
+static sim_fleet_config_t fleet_config;
+static sim_device_t *devices;
+static fleet_slot_t *slots;     // One per device, the monitor client last
+static size_t device_count;
+static mqtt_lite_client_t monitor;
+static backend_stats_t backend;
+static int epoll_fd = -1;
+
+static uint32_t now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static long env_long(const char *name, long def)
+{
+    const char *value = getenv(name);
+    return value && *value ? strtol(value, NULL, 10) : def;
+}
+
+static const char *env_str(const char *name, const char *def)
+{
+    const char *value = getenv(name);
+    return value && *value ? value : def;
+}
+
+static esp_err_t resolve_broker(const char *spec, struct sockaddr_in *out)
+{
+    char host[128];
+    const char *colon = strrchr(spec, ':');
+    size_t host_len = colon ? (size_t)(colon - spec) : strlen(spec);
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res = NULL;
+
+    if (host_len >= sizeof(host)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(host, spec, host_len);
+    host[host_len] = '\0';
+    if (getaddrinfo(host, colon ? colon + 1 : "1883", &hints, &res) != 0 || res == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    memcpy(out, res->ai_addr, sizeof(*out));
+    freeaddrinfo(res);
+    return ESP_OK;
+}
+
+// Lines of the devices file that name a device; comments and blank lines are skipped.
+static bool parse_line(const char *line, char *id, char *key, char *profile_name, char *encoding)
+{
+    profile_name[0] = '\0';
+    encoding[0] = '\0';
+    return line[0] != '#' && sscanf(line, "%49s %127s %15s %7s", id, key, profile_name, encoding) >= 2;
+}
+
+static esp_err_t load_devices(const char *path, size_t max, const sim_profile_t *default_profile, uint32_t ramp_per_s)
+{
+    char line[FLEET_LINE_MAX];
+    char id[SIM_DEVICE_ID_MAX_LEN + 2];
+    char key[128];
+    char profile_name[16];
+    char encoding[8];
+    size_t lines = 0;
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL) {
+        ESP_LOGE(TAG_FLEET, "Cannot open devices file %s: %s", path, strerror(errno));
+        return ESP_ERR_NOT_FOUND;
+    }
+    // Devices are allocated once: the GCM contexts and client IDs must not move.
+    while (lines < max && fgets(line, sizeof(line), f)) {
+        lines += parse_line(line, id, key, profile_name, encoding);
+    }
+    devices = lines ? calloc(lines, sizeof(devices[0])) : NULL;
+    if (devices == NULL) {
+        fclose(f);
+        return lines ? ESP_ERR_NO_MEM : ESP_ERR_NOT_FOUND;
+    }
+    rewind(f);
+
+    esp_err_t err = ESP_OK;
+    while (err == ESP_OK && device_count < lines && fgets(line, sizeof(line), f)) {
+        if (!parse_line(line, id, key, profile_name, encoding)) {
+            continue;
+        }
+        const sim_profile_t *profile = profile_name[0] ? sim_profile_find(profile_name) : default_profile;
+        if (profile == NULL) {
+            ESP_LOGE(TAG_FLEET, "Unknown profile '%s' for device %s", profile_name, id);
+            err = ESP_ERR_INVALID_ARG;
+            break;
+        }
+        telemetry_encoding_t enc = strcmp(encoding, "cbor") == 0 ? TELEMETRY_ENCODING_CBOR
+                                   : strcmp(encoding, "json") == 0 ? TELEMETRY_ENCODING_JSON
+                                                                   : TELEMETRY_ENCODING_DEFAULT;
+        // Connections ramp up at ramp_per_s, as a fleet coming back after a broker restart would.
+        uint32_t start_ms = now_ms() + (uint32_t)(device_count * 1000 / ramp_per_s);
+        err = sim_device_init(&devices[device_count], id, key, profile, enc, &fleet_config, start_ms);
+        device_count += err == ESP_OK;
+    }
+    fclose(f);
+    return err;
+}
+
+// Every device needs a socket; raise the soft limit as far as allowed.
+static void raise_fd_limit(size_t needed)
+{
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) != 0) {
+        return;
+    }
+    if (lim.rlim_cur < needed) {
+        lim.rlim_cur = needed < lim.rlim_max ? needed : lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+    if (lim.rlim_cur < needed) {
+        ESP_LOGW(TAG_FLEET, "Open file limit %lu is below %u, raise it with ulimit -n", (unsigned long)lim.rlim_cur,
+                 (unsigned)needed);
+    }
+}
+
+// Keeps the epoll registration in step with the client socket and its send buffer.
+static void sync_slot(size_t index, const mqtt_lite_client_t *c)
+{
+    fleet_slot_t *slot = &slots[index];
+    uint32_t events = EPOLLIN | (mqtt_lite_wants_write(c) ? EPOLLOUT : 0);
+    struct epoll_event ev = { .events = events, .data.u64 = index };
+
+    if (slot->fd != c->fd || slot->session != c->session) {
+        // A closed socket left the epoll set by itself.
+        if (c->fd >= 0) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->fd, &ev);
+        }
+        slot->fd = c->fd;
+        slot->session = c->session;
+        slot->events = events;
+    } else if (c->fd >= 0 && slot->events != events) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+        slot->events = events;
+    }
+}
+
+static void monitor_connected(void *ctx)
+{
+    mqtt_lite_subscribe(&monitor, FLEET_STATS_TOPIC, 0, now_ms());
+}
+
+static float json_number(const char *json, size_t len, const char *object, const char *key)
+{
+    const char *raw = json;
+    size_t raw_len = len;
+    float value = 0.0f;
+
+    if (object && json_lite_get_raw(json, len, object, &raw, &raw_len) != ESP_OK) {
+        return 0.0f;
+    }
+    json_lite_get_float(raw, raw_len, key, &value);
+    return value;
+}
+
+// The backend publishes its stats in plain JSON; device keys are not involved.
+static void monitor_message(void *ctx, const char *topic, size_t topic_len, char *data, size_t len)
+{
+    backend.seen = true;
+    backend.ingest_per_s = json_number(data, len, NULL, "ingestPerS");
+    backend.failed = json_number(data, len, NULL, "failed");
+    backend.handler_p99_ms = json_number(data, len, "handlerMs", "p99");
+    backend.rtt_p50_ms = json_number(data, len, "commandRoundTripMs", "p50");
+    backend.rtt_p99_ms = json_number(data, len, "commandRoundTripMs", "p99");
+    backend.timed_out = json_number(data, len, NULL, "commandsTimedOut");
+}
+
+static const mqtt_lite_callbacks_t monitor_callbacks = {
+    .on_connected = monitor_connected,
+    .on_message = monitor_message,
+};
+
+static pid_t find_broker_pid(void)
+{
+    DIR *proc = opendir("/proc");
+    struct dirent *entry;
+    pid_t pid = 0;
+
+    while (proc && pid == 0 && (entry = readdir(proc)) != NULL) {
+        char path[sizeof("/proc//comm") + sizeof(entry->d_name)];
+        char comm[32] = "";
+        if (!isdigit((unsigned char)entry->d_name[0])) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/proc/%s/comm", entry->d_name);
+        FILE *f = fopen(path, "r");
+        if (f && fgets(comm, sizeof(comm), f) && strncmp(comm, "mosquitto", 9) == 0) {
+            pid = (pid_t)atoi(entry->d_name);
+        }
+        if (f) {
+            fclose(f);
+        }
+    }
+    if (proc) {
+        closedir(proc);
+    }
+    return pid;
+}
+
+// utime + stime of a process, in clock ticks; false if it is gone.
+static bool read_cpu(pid_t pid, cpu_sample_t *out)
+{
+    char path[64];
+    char buf[512];
+    unsigned long long utime;
+    unsigned long long stime;
+
+    snprintf(path, sizeof(path), pid ? "/proc/%d/stat" : "/proc/self/stat", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return false;
+    }
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    // The command name may contain spaces; the fields after it do not.
+    const char *p = strrchr(buf, ')');
+    if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) {
+        return false;
+    }
+    out->ticks = utime + stime;
+    out->at_us = (uint64_t)esp_timer_get_time();
+    return true;
+}
+
+static float cpu_percent(const cpu_sample_t *before, const cpu_sample_t *after)
+{
+    uint64_t elapsed_us = after->at_us - before->at_us;
+    if (elapsed_us == 0) {
+        return 0.0f;
+    }
+    return (float)(after->ticks - before->ticks) * 1e8f / (float)sysconf(_SC_CLK_TCK) / (float)elapsed_us;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const uint32_t *sorted, size_t count, float p)
+{
+    if (count == 0) {
+        return 0;
+    }
+    size_t rank = (size_t)((float)count * p + 0.999f);
+    return sorted[(rank ? rank : 1) - 1];
+}
+
+static void report(uint32_t t_s, float interval_s, const sim_fleet_stats_t *prev, const sim_fleet_stats_t *cur,
+                   uint64_t publishes, float broker_cpu, float sim_cpu)
+{
+    static uint32_t latencies[4096];
+    size_t n = sim_device_take_rule_latencies(latencies, sizeof(latencies) / sizeof(latencies[0]));
+
+    qsort(latencies, n, sizeof(latencies[0]), compare_u32);
+    printf("FLEET t_s=%" PRIu32 " devices=%" PRIu32 " connected=%" PRIu32 " publish_per_s=%.0f telemetry_per_s=%.0f "
+           "commands_per_s=%.1f duplicates=%" PRIu64 " undecryptable=%" PRIu64 " rule_commands=%" PRIu64
+           " rule_p50_ms=%" PRIu32 " rule_p99_ms=%" PRIu32 " rule_timeouts=%" PRIu64 " reconnects=%" PRIu64
+           " broker_cpu_pct=%.1f sim_cpu_pct=%.1f",
+           t_s, cur->devices, cur->connected, (double)publishes / interval_s,
+           (double)(cur->telemetry_batches - prev->telemetry_batches) / interval_s,
+           (double)(cur->commands - prev->commands) / interval_s, cur->duplicates, cur->undecryptable,
+           cur->rule_commands - prev->rule_commands, percentile(latencies, n, 0.5f), percentile(latencies, n, 0.99f),
+           cur->rule_timeouts, cur->disconnects, (double)broker_cpu, (double)sim_cpu);
+    if (backend.seen) {
+        printf(" backend_ingest_per_s=%.0f backend_failed=%.0f backend_handler_p99_ms=%.1f "
+               "backend_rtt_p50_ms=%.1f backend_rtt_p99_ms=%.1f backend_timed_out=%.0f",
+               (double)backend.ingest_per_s, (double)backend.failed, (double)backend.handler_p99_ms,
+               (double)backend.rtt_p50_ms, (double)backend.rtt_p99_ms, (double)backend.timed_out);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+static void run(uint32_t duration_s, uint32_t report_s, pid_t broker_pid)
+{
+    struct epoll_event events[FLEET_EPOLL_BATCH];
+    sim_fleet_stats_t prev;
+    sim_fleet_stats_t cur;
+    mqtt_lite_stats_t mqtt_prev;
+    mqtt_lite_stats_t mqtt_cur;
+    cpu_sample_t broker_prev = { 0 };
+    cpu_sample_t broker_cur = { 0 };
+    cpu_sample_t self_prev = { 0 };
+    cpu_sample_t self_cur = { 0 };
+    uint32_t start_ms = now_ms();
+    uint32_t report_at_ms = start_ms + report_s * 1000;
+    uint32_t last_report_ms = start_ms;
+    uint32_t monitor_retry_ms = start_ms;
+
+    sim_device_get_stats(&prev);
+    mqtt_lite_get_stats(&mqtt_prev);
+    bool broker_cpu = broker_pid && read_cpu(broker_pid, &broker_prev);
+    read_cpu(0, &self_prev);
+
+    while (duration_s == 0 || now_ms() - start_ms < duration_s * 1000) {
+        int n = epoll_wait(epoll_fd, events, FLEET_EPOLL_BATCH, FLEET_TICK_MS);
+        uint32_t now = now_ms();
+        for (int i = 0; i < n; i++) {
+            size_t index = (size_t)events[i].data.u64;
+            bool readable = events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP);
+            bool writable = events[i].events & EPOLLOUT;
+            if (index == device_count) {
+                if ((writable && mqtt_lite_on_writable(&monitor) != ESP_OK) ||
+                    (readable && mqtt_lite_on_readable(&monitor, &monitor_callbacks, NULL, now) != ESP_OK)) {
+                    mqtt_lite_close(&monitor);
+                }
+            } else {
+                sim_device_on_io(&devices[index], readable, writable, now);
+                sync_slot(index, &devices[index].mqtt);
+            }
+        }
+
+        for (size_t i = 0; i < device_count; i++) {
+            sim_device_poll(&devices[i], now);
+            sync_slot(i, &devices[i].mqtt);
+        }
+        if (monitor.state == MQTT_LITE_DISCONNECTED && (int32_t)(now - monitor_retry_ms) >= 0) {
+            mqtt_lite_connect(&monitor, &fleet_config.broker, now);
+            monitor_retry_ms = now + 1000;
+        }
+        mqtt_lite_poll(&monitor, now);
+        sync_slot(device_count, &monitor);
+
+        if ((int32_t)(now - report_at_ms) >= 0) {
+            sim_device_get_stats(&cur);
+            mqtt_lite_get_stats(&mqtt_cur);
+            float broker_pct = broker_cpu && read_cpu(broker_pid, &broker_cur) ? cpu_percent(&broker_prev, &broker_cur) : 0.0f;
+            float sim_pct = read_cpu(0, &self_cur) ? cpu_percent(&self_prev, &self_cur) : 0.0f;
+            report((now - start_ms) / 1000, (float)(now - last_report_ms) / 1000.0f, &prev, &cur,
+                   mqtt_cur.publishes - mqtt_prev.publishes, broker_pct, sim_pct);
+            prev = cur;
+            mqtt_prev = mqtt_cur;
+            broker_prev = broker_cur;
+            self_prev = self_cur;
+            last_report_ms = now;
+            report_at_ms += report_s * 1000;
+        }
+    }
+}
+
+void app_main(void)
+{
+    const char *path = getenv("FLEET_SIM_DEVICES");
+    const sim_profile_t *profile = sim_profile_find(env_str("FLEET_SIM_PROFILE", "sensor"));
+    long count = env_long("FLEET_SIM_COUNT", 0);
+    long ramp = env_long("FLEET_SIM_RAMP_PER_S", 200);
+    pid_t broker_pid = (pid_t)env_long("FLEET_SIM_BROKER_PID", 0);
+
+    if (path == NULL || profile == NULL || ramp <= 0) {
+        ESP_LOGE(TAG_FLEET, "Set FLEET_SIM_DEVICES to the devices file; FLEET_SIM_PROFILE is idle, sensor or busy");
+        exit(EXIT_FAILURE);
+    }
+    fleet_config.keepalive_s = CONFIG_FLEET_SIM_KEEPALIVE_S;
+    fleet_config.rule_threshold = strtof(env_str("FLEET_SIM_RULE_THRESHOLD", "28"), NULL);
+    fleet_config.rule_timeout_ms = 30000;
+    ESP_ERROR_CHECK(resolve_broker(env_str("FLEET_SIM_BROKER", "127.0.0.1:1884"), &fleet_config.broker));
+    ESP_ERROR_CHECK(sim_device_register_commands());
+    ESP_ERROR_CHECK(load_devices(path, count > 0 ? (size_t)count : SIZE_MAX, profile, (uint32_t)ramp));
+
+    slots = malloc((device_count + 1) * sizeof(slots[0]));
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (slots == NULL || epoll_fd < 0) {
+        ESP_LOGE(TAG_FLEET, "Out of memory or epoll_create1() failed");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i <= device_count; i++) {
+        slots[i].fd = -1;
+    }
+    raise_fd_limit(device_count + 64);
+    mqtt_lite_init(&monitor, "fleet-sim-monitor", CONFIG_FLEET_SIM_KEEPALIVE_S);
+    if (broker_pid == 0) {
+        broker_pid = find_broker_pid();
+    }
+    ESP_LOGI(TAG_FLEET, "%u devices, broker pid %d", (unsigned)device_count, (int)broker_pid);
+
+    run((uint32_t)env_long("FLEET_SIM_DURATION_S", 60), (uint32_t)env_long("FLEET_SIM_REPORT_S", 5), broker_pid);
+    fflush(stdout);
+    exit(EXIT_SUCCESS);
+}
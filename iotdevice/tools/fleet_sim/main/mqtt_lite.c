@@ -0,0 +1,282 @@
+#include "mqtt_lite.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "esp_log.h"
+
+#define MQTT_CONNECT     0x10
+#define MQTT_CONNACK     0x20
+#define MQTT_PUBLISH     0x30
+#define MQTT_PUBACK      0x40
+#define MQTT_SUBSCRIBE   0x82      // Fixed header flags 0b0010 are mandatory
+#define MQTT_PINGREQ     0xc0
+
+#define MQTT_HEADER_MAX  5         // Type byte and up to four length bytes
+
+static const char *TAG_MQTT_LITE = "MQTT_LITE";
+
+static mqtt_lite_stats_t stats;
+
+void mqtt_lite_init(mqtt_lite_client_t *c, const char *client_id, uint16_t keepalive_s)
+{
+    memset(c, 0, offsetof(mqtt_lite_client_t, rx));
+    c->fd = -1;
+    c->client_id = client_id;
+    c->keepalive_s = keepalive_s;
+    c->next_packet_id = 1;
+}
+
+void mqtt_lite_close(mqtt_lite_client_t *c)
+{
+    if (c->fd >= 0) {
+        close(c->fd);
+    }
+    c->fd = -1;
+    c->state = MQTT_LITE_DISCONNECTED;
+    c->rx_len = 0;
+    c->tx_len = 0;
+}
+
+static size_t put_length(uint8_t *out, size_t len)
+{
+    size_t n = 0;
+    do {
+        uint8_t byte = len % 128;
+        len /= 128;
+        out[n++] = byte | (len ? 0x80 : 0);
+    } while (len);
+    return n;
+}
+
+static void put_u16(uint8_t *out, uint16_t v)
+{
+    out[0] = v >> 8;
+    out[1] = v & 0xff;
+}
+
+// Reserves room for a packet with the given remaining length; NULL if it does not fit.
+static uint8_t *begin_packet(mqtt_lite_client_t *c, uint8_t type, size_t remaining, uint32_t now_ms)
+{
+    uint8_t header[MQTT_HEADER_MAX];
+    size_t header_len;
+
+    header[0] = type;
+    header_len = 1 + put_length(header + 1, remaining);
+    if (c->tx_len + header_len + remaining > sizeof(c->tx)) {
+        stats.tx_full++;
+        return NULL;
+    }
+    memcpy(c->tx + c->tx_len, header, header_len);
+    uint8_t *body = c->tx + c->tx_len + header_len;
+    c->tx_len += header_len + remaining;
+    c->last_tx_ms = now_ms;
+    return body;
+}
+
+static uint16_t next_id(mqtt_lite_client_t *c)
+{
+    uint16_t id = c->next_packet_id++;
+    if (c->next_packet_id == 0) {
+        c->next_packet_id = 1;
+    }
+    return id;
+}
+
+esp_err_t mqtt_lite_connect(mqtt_lite_client_t *c, const struct sockaddr_in *broker, uint32_t now_ms)
+{
+    static const uint8_t variable_header[] = { 0, 4, 'M', 'Q', 'T', 'T', 4, 0x02 };   // Level 4, clean session
+    size_t id_len = strlen(c->client_id);
+    int one = 1;
+
+    mqtt_lite_close(c);
+    c->session++;
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd < 0) {
+        ESP_LOGE(TAG_MQTT_LITE, "socket() failed: %s", strerror(errno));
+        return ESP_FAIL;
+    }
+    // Commands and acks are small; do not let Nagle hold them back.
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(c->fd, (const struct sockaddr *)broker, sizeof(*broker)) < 0 && errno != EINPROGRESS) {
+        ESP_LOGW(TAG_MQTT_LITE, "connect() failed: %s", strerror(errno));
+        mqtt_lite_close(c);
+        return ESP_FAIL;
+    }
+
+    uint8_t *p = begin_packet(c, MQTT_CONNECT, sizeof(variable_header) + 2 + 2 + id_len, now_ms);
+    memcpy(p, variable_header, sizeof(variable_header));
+    p += sizeof(variable_header);
+    put_u16(p, c->keepalive_s);
+    put_u16(p + 2, (uint16_t)id_len);
+    memcpy(p + 4, c->client_id, id_len);
+    c->state = MQTT_LITE_CONNECTING;
+    return ESP_OK;
+}
+
+esp_err_t mqtt_lite_subscribe(mqtt_lite_client_t *c, const char *filter, uint8_t qos, uint32_t now_ms)
+{
+    size_t filter_len = strlen(filter);
+    uint8_t *p = begin_packet(c, MQTT_SUBSCRIBE, 2 + 2 + filter_len + 1, now_ms);
+
+    if (p == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    put_u16(p, next_id(c));
+    put_u16(p + 2, (uint16_t)filter_len);
+    memcpy(p + 4, filter, filter_len);
+    p[4 + filter_len] = qos;
+    return ESP_OK;
+}
+
+esp_err_t mqtt_lite_publish(mqtt_lite_client_t *c, const char *topic, const void *payload, size_t len,
+                            uint32_t now_ms)
+{
+    size_t topic_len = strlen(topic);
+
+    if (c->state != MQTT_LITE_CONNECTED) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint8_t *p = begin_packet(c, MQTT_PUBLISH, 2 + topic_len + len, now_ms);
+    if (p == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    put_u16(p, (uint16_t)topic_len);
+    memcpy(p + 2, topic, topic_len);
+    memcpy(p + 2 + topic_len, payload, len);
+    stats.publishes++;
+    return ESP_OK;
+}
+
+esp_err_t mqtt_lite_on_writable(mqtt_lite_client_t *c)
+{
+    size_t sent = 0;
+
+    while (sent < c->tx_len) {
+        ssize_t n = send(c->fd, c->tx + sent, c->tx_len - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return ESP_FAIL;
+        }
+        sent += (size_t)n;
+    }
+    memmove(c->tx, c->tx + sent, c->tx_len - sent);
+    c->tx_len -= sent;
+    stats.bytes_out += sent;
+    return ESP_OK;
+}
+
+// Parses the remaining length; 0 if more bytes are needed, -1 if malformed.
+static int get_length(const uint8_t *buf, size_t avail, size_t *len)
+{
+    size_t value = 0;
+    for (size_t i = 0; i < 4; i++) {
+        if (1 + i >= avail) {
+            return 0;
+        }
+        value |= (size_t)(buf[1 + i] & 0x7f) << (7 * i);
+        if (!(buf[1 + i] & 0x80)) {
+            *len = value;
+            return (int)(2 + i);
+        }
+    }
+    return -1;
+}
+
+static esp_err_t handle_publish(mqtt_lite_client_t *c, uint8_t flags, uint8_t *body, size_t len,
+                                mqtt_lite_message_fn_t on_message, void *ctx, uint32_t now_ms)
+{
+    uint8_t qos = (flags >> 1) & 0x03;
+    if (len < 2) {
+        return ESP_FAIL;
+    }
+    size_t topic_len = ((size_t)body[0] << 8) | body[1];
+    size_t offset = 2 + topic_len + (qos ? 2 : 0);
+    if (offset > len || qos > 1) {
+        return ESP_FAIL;
+    }
+    if (qos == 1) {
+        // Acked before the handler runs, like esp-mqtt does.
+        uint8_t *ack = begin_packet(c, MQTT_PUBACK, 2, now_ms);
+        if (ack) {
+            memcpy(ack, body + 2 + topic_len, 2);
+        }
+    }
+    stats.received++;
+    on_message(ctx, (const char *)body + 2, topic_len, (char *)body + offset, len - offset);
+    return ESP_OK;
+}
+
+esp_err_t mqtt_lite_on_readable(mqtt_lite_client_t *c, const mqtt_lite_callbacks_t *cb, void *ctx,
+                                uint32_t now_ms)
+{
+    for (;;) {
+        ssize_t n = recv(c->fd, c->rx + c->rx_len, sizeof(c->rx) - c->rx_len, 0);
+        if (n == 0) {
+            return ESP_FAIL;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return ESP_OK;
+            }
+            return ESP_FAIL;
+        }
+        c->rx_len += (size_t)n;
+        stats.bytes_in += (uint64_t)n;
+
+        size_t pos = 0;
+        while (pos < c->rx_len) {
+            size_t len = 0;
+            int header_len = get_length(c->rx + pos, c->rx_len - pos, &len);
+            if (header_len < 0 || (header_len > 0 && header_len + len > sizeof(c->rx))) {
+                ESP_LOGW(TAG_MQTT_LITE, "%s: packet too large or malformed", c->client_id);
+                return ESP_FAIL;
+            }
+            if (header_len == 0 || pos + header_len + len > c->rx_len) {
+                break;
+            }
+            uint8_t type = c->rx[pos] & 0xf0;
+            uint8_t *body = c->rx + pos + header_len;
+            esp_err_t err = ESP_OK;
+            if (type == MQTT_PUBLISH) {
+                err = handle_publish(c, c->rx[pos] & 0x0f, body, len, cb->on_message, ctx, now_ms);
+            } else if (type == MQTT_CONNACK) {
+                if (len != 2 || body[1] != 0) {
+                    ESP_LOGW(TAG_MQTT_LITE, "%s: connection refused, code %d", c->client_id, len == 2 ? body[1] : -1);
+                    return ESP_FAIL;
+                }
+                c->state = MQTT_LITE_CONNECTED;
+                cb->on_connected(ctx);
+            }
+            // SUBACK and PINGRESP need nothing; no PUBACK comes, only QoS 0 is published.
+            if (err != ESP_OK) {
+                return err;
+            }
+            pos += header_len + len;
+        }
+        memmove(c->rx, c->rx + pos, c->rx_len - pos);
+        c->rx_len -= pos;
+    }
+}
+
+void mqtt_lite_poll(mqtt_lite_client_t *c, uint32_t now_ms)
+{
+    if (c->state == MQTT_LITE_CONNECTED && now_ms - c->last_tx_ms >= c->keepalive_s * 500u) {
+        begin_packet(c, MQTT_PINGREQ, 0, now_ms);
+    }
+}
+
+void mqtt_lite_get_stats(mqtt_lite_stats_t *out)
+{
+    *out = stats;
+}
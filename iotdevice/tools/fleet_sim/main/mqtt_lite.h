@@ -0,0 +1,130 @@
+#ifndef MQTT_LITE_H
+#define MQTT_LITE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include "esp_err.h"
+
+/*
+ * Minimal non-blocking MQTT 3.1.1 client, one per simulated device.
+ *
+ * esp-mqtt runs a task and a pair of heap buffers per client, which does
+ * not scale to thousands of connections in one process. This client only
+ * keeps a socket and two fixed buffers; the caller runs all clients from
+ * one epoll loop. Supports what the firmware uses: clean sessions,
+ * SUBSCRIBE at QoS 1, PUBLISH at QoS 0 out, QoS 0/1 in (PUBACK sent here)
+ * and PINGREQ keepalive.
+ */
+
+#define MQTT_LITE_RX_SIZE CONFIG_FLEET_SIM_RX_BUFFER_SIZE
+#define MQTT_LITE_TX_SIZE CONFIG_FLEET_SIM_TX_BUFFER_SIZE
+
+typedef enum {
+    MQTT_LITE_DISCONNECTED,
+    MQTT_LITE_CONNECTING,       // TCP connect and CONNECT sent, waiting for CONNACK
+    MQTT_LITE_CONNECTED,
+} mqtt_lite_state_t;
+
+/**
+ * @brief Receives one PUBLISH.
+ *
+ * The payload lives in the receive buffer and may be modified in place
+ * (e.g. decrypted); it is gone after the callback returns.
+ */
+typedef void (*mqtt_lite_message_fn_t)(void *ctx, const char *topic, size_t topic_len, char *payload, size_t len);
+
+typedef struct {
+    void (*on_connected)(void *ctx);    // CONNACK accepted; subscribe from here
+    mqtt_lite_message_fn_t on_message;
+} mqtt_lite_callbacks_t;
+
+typedef struct {
+    int fd;
+    mqtt_lite_state_t state;
+    const char *client_id;
+    uint16_t keepalive_s;
+    uint16_t next_packet_id;
+    uint32_t session;           // Bumped on every connect; tells a reused fd number apart
+    uint32_t last_tx_ms;
+    size_t rx_len;
+    size_t tx_len;
+    uint8_t rx[MQTT_LITE_RX_SIZE];
+    uint8_t tx[MQTT_LITE_TX_SIZE];
+} mqtt_lite_client_t;
+
+typedef struct {
+    uint64_t publishes;     // PUBLISH packets queued for sending
+    uint64_t received;      // PUBLISH packets received
+    uint64_t tx_full;       // Publishes dropped because the send buffer was full
+    uint64_t bytes_out;
+    uint64_t bytes_in;
+} mqtt_lite_stats_t;
+
+/**
+ * @brief Sets up a disconnected client.
+ *
+ * @param client_id Client ID; must outlive the client.
+ */
+void mqtt_lite_init(mqtt_lite_client_t *c, const char *client_id, uint16_t keepalive_s);
+
+/**
+ * @brief Starts a non-blocking TCP connect and queues CONNECT (clean session).
+ *
+ * @return ESP_OK once the connect is in progress, ESP_FAIL if the socket could not be created.
+ */
+esp_err_t mqtt_lite_connect(mqtt_lite_client_t *c, const struct sockaddr_in *broker, uint32_t now_ms);
+
+/**
+ * @brief Closes the socket; queued data is dropped.
+ */
+void mqtt_lite_close(mqtt_lite_client_t *c);
+
+/**
+ * @brief Queues a SUBSCRIBE for one topic filter.
+ *
+ * @return ESP_OK, or ESP_ERR_NO_MEM if the send buffer is full.
+ */
+esp_err_t mqtt_lite_subscribe(mqtt_lite_client_t *c, const char *filter, uint8_t qos, uint32_t now_ms);
+
+/**
+ * @brief Queues a QoS 0 PUBLISH.
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_STATE when not connected, ESP_ERR_NO_MEM if the send buffer is full.
+ */
+esp_err_t mqtt_lite_publish(mqtt_lite_client_t *c, const char *topic, const void *payload, size_t len,
+                            uint32_t now_ms);
+
+/**
+ * @brief Reads from the socket and handles all complete packets.
+ *
+ * @return ESP_OK, or ESP_FAIL when the connection was closed or broke
+ *         the protocol; the caller closes the client then.
+ */
+esp_err_t mqtt_lite_on_readable(mqtt_lite_client_t *c, const mqtt_lite_callbacks_t *cb, void *ctx,
+                                uint32_t now_ms);
+
+/**
+ * @brief Writes as much of the send buffer as the socket takes.
+ *
+ * @return ESP_OK, or ESP_FAIL on a socket error.
+ */
+esp_err_t mqtt_lite_on_writable(mqtt_lite_client_t *c);
+
+/**
+ * @brief Sends PINGREQ when nothing was sent for half the keepalive.
+ */
+void mqtt_lite_poll(mqtt_lite_client_t *c, uint32_t now_ms);
+
+static inline bool mqtt_lite_wants_write(const mqtt_lite_client_t *c)
+{
+    return c->tx_len > 0;
+}
+
+/**
+ * @brief Counters over all clients since start.
+ */
+void mqtt_lite_get_stats(mqtt_lite_stats_t *out);
+
+#endif // MQTT_LITE_H
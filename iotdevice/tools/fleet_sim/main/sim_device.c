@@ -0,0 +1,454 @@
+#include "sim_device.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "cbor_lite.h"
+#include "command_router.h"
+#include "led_control.h"
+
+#define SIM_PAYLOAD_MAX      CONFIG_TELEMETRY_PAYLOAD_MAX
+#define SIM_TOPIC_MAX_LEN    (sizeof("home/devices//command/") + SIM_DEVICE_ID_MAX_LEN + 16)
+#define SIM_LATENCIES_MAX    4096
+#define SIM_TRAILER_LEN      2       // "]}" closing the JSON samples
+
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+#define SIM_PAYLOAD_BUF_SIZE DEVICE_CRYPTO_FRAME_SIZE(SIM_PAYLOAD_MAX)
+#else
+#define SIM_PAYLOAD_BUF_SIZE (SIM_PAYLOAD_MAX + 1)
+#endif
+
+static const char *TAG_SIM = "SIM_DEVICE";
+
+static const char *const source_keys[SIM_SOURCE_COUNT] = { "ledState", "temperature", "rssi" };
+// Same deadbands as the firmware registers, temperature as a typical sensor would.
+static const float source_deadband[SIM_SOURCE_COUNT] = { 0.0f, 0.1f, 3.0f };
+
+static const sim_profile_t profiles[] = {
+    { .name = "idle",   .sample_period_ms = 10000, .flush_interval_ms = 60000, .temp_cycle_ms = 600000, .temp_swing = 1.0f },
+    { .name = "sensor", .sample_period_ms = 1000,  .flush_interval_ms = 5000,  .temp_cycle_ms = 120000, .temp_swing = 6.0f },
+    { .name = "busy",   .sample_period_ms = 100,   .flush_interval_ms = 1000,  .temp_cycle_ms = 30000,  .temp_swing = 6.0f },
+};
+
+// One loop thread runs all devices, so the scratch buffers are shared.
+static char payload_buf[SIM_PAYLOAD_BUF_SIZE];
+static char topic_buf[SIM_TOPIC_MAX_LEN];
+static sim_device_t *dispatch_device;   // Device whose command is being dispatched
+
+static sim_fleet_stats_t stats;
+static uint32_t latencies[SIM_LATENCIES_MAX];
+static size_t latency_count;
+
+static bool time_reached(uint32_t now_ms, uint32_t at_ms)
+{
+    return (int32_t)(now_ms - at_ms) >= 0;
+}
+
+const sim_profile_t *sim_profile_find(const char *name)
+{
+    for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++) {
+        if (strcmp(profiles[i].name, name) == 0) {
+            return &profiles[i];
+        }
+    }
+    return NULL;
+}
+
+static esp_err_t sim_led_handler(const char *data, size_t data_len, void *ctx)
+{
+    bool state;
+    esp_err_t err = led_parse_command(data, data_len, &state);
+    if (err == ESP_OK) {
+        dispatch_device->led = state;
+    }
+    return err;
+}
+
+esp_err_t sim_device_register_commands(void)
+{
+    // Device topics are matched per device in handle_message(), the router
+    // only resolves the command name, so every command is a group command.
+    esp_err_t err = command_router_init("fleet-sim");
+    if (err == ESP_OK) {
+        err = command_router_register_group("setLed", sim_led_handler, NULL);
+    }
+    return err;
+}
+
+static int build_topic(const sim_device_t *d, const char *subtopic)
+{
+    return snprintf(topic_buf, sizeof(topic_buf), "home/devices/%s/%s", d->id, subtopic);
+}
+
+// Encrypts payload_buf in place and queues it; buffers are full when the broker falls behind.
+static void publish(sim_device_t *d, const char *subtopic, size_t len, uint32_t now_ms)
+{
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+    if (device_crypto_encrypt_in_place(&d->crypto, payload_buf, len, sizeof(payload_buf), &len) != ESP_OK) {
+        return;
+    }
+#endif
+    build_topic(d, subtopic);
+    mqtt_lite_publish(&d->mqtt, topic_buf, payload_buf, len, now_ms);
+}
+
+static bool append(size_t *pos, size_t limit, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+static bool append(size_t *pos, size_t limit, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(payload_buf + *pos, limit - *pos, fmt, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= limit - *pos) {
+        return false;
+    }
+    *pos += (size_t)n;
+    return true;
+}
+
+// As pack_batch_json() in telemetry.c.
+static size_t pack_batch_json(const sim_device_t *d, size_t *len)
+{
+    const size_t limit = SIM_PAYLOAD_MAX - SIM_TRAILER_LEN;
+    size_t pos = 0;
+    size_t packed = 0;
+    bool ok = append(&pos, limit, "{");
+
+    for (size_t i = 0; ok && i < SIM_SOURCE_COUNT; i++) {
+        if (d->has_value[i]) {
+            ok = append(&pos, limit, "\"%s\":%.6g,", source_keys[i], (double)d->last_value[i]);
+        }
+    }
+    ok = ok && append(&pos, limit, "\"keys\":[\"%s\",\"%s\",\"%s\"],\"ts\":%" PRIu32 ",\"samples\":[",
+                      source_keys[0], source_keys[1], source_keys[2], d->batch_start_ms);
+    if (!ok) {
+        return 0;
+    }
+    while (packed < d->sample_count) {
+        const sim_sample_t *s = &d->samples[packed];
+        if (!append(&pos, limit, "%s[%u,%" PRIu32 ",%.6g]", packed ? "," : "", s->source,
+                    s->t_ms - d->batch_start_ms, (double)s->value)) {
+            break;
+        }
+        packed++;
+    }
+    memcpy(payload_buf + pos, "]}", SIM_TRAILER_LEN + 1);
+    *len = pos + SIM_TRAILER_LEN;
+    return packed;
+}
+
+// As pack_batch_cbor() in telemetry.c.
+static size_t pack_batch_cbor(const sim_device_t *d, size_t *len)
+{
+    cbor_lite_writer_t w;
+    size_t latest = 0;
+    size_t packed = 0;
+
+    cbor_lite_writer_init(&w, payload_buf, SIM_PAYLOAD_MAX - 1);
+    for (size_t i = 0; i < SIM_SOURCE_COUNT; i++) {
+        latest += d->has_value[i] ? 1 : 0;
+    }
+    cbor_lite_put_map(&w, latest + 3);
+    for (size_t i = 0; i < SIM_SOURCE_COUNT; i++) {
+        if (d->has_value[i]) {
+            cbor_lite_put_cstr(&w, source_keys[i]);
+            cbor_lite_put_number(&w, d->last_value[i]);
+        }
+    }
+    cbor_lite_put_cstr(&w, "keys");
+    cbor_lite_put_array(&w, SIM_SOURCE_COUNT);
+    for (size_t i = 0; i < SIM_SOURCE_COUNT; i++) {
+        cbor_lite_put_cstr(&w, source_keys[i]);
+    }
+    cbor_lite_put_cstr(&w, "ts");
+    cbor_lite_put_uint(&w, d->batch_start_ms);
+    cbor_lite_put_cstr(&w, "samples");
+    cbor_lite_put_array_indef(&w);
+    if (w.overflow) {
+        return 0;
+    }
+    while (packed < d->sample_count) {
+        const sim_sample_t *s = &d->samples[packed];
+        size_t mark = w.len;
+        cbor_lite_put_array(&w, 3);
+        cbor_lite_put_uint(&w, s->source);
+        cbor_lite_put_uint(&w, s->t_ms - d->batch_start_ms);
+        cbor_lite_put_number(&w, s->value);
+        if (w.overflow) {
+            w.len = mark;
+            break;
+        }
+        packed++;
+    }
+    w.size += 1;
+    w.overflow = false;
+    cbor_lite_put_break(&w);
+    *len = w.len;
+    return packed;
+}
+
+static void record_latency(uint32_t ms)
+{
+    if (latency_count < SIM_LATENCIES_MAX) {
+        latencies[latency_count++] = ms;
+    }
+}
+
+static void flush_telemetry(sim_device_t *d, uint32_t now_ms)
+{
+    while (d->sample_count > 0) {
+        size_t len = 0;
+        size_t packed = d->encoding == TELEMETRY_ENCODING_CBOR ? pack_batch_cbor(d, &len) : pack_batch_json(d, &len);
+        if (packed == 0) {
+            d->sample_count = 0;
+            return;
+        }
+        publish(d, "telemetry", len, now_ms);
+        stats.telemetry_batches++;
+        stats.telemetry_samples += packed;
+        d->sample_count -= (uint8_t)packed;
+        memmove(d->samples, d->samples + packed, d->sample_count * sizeof(d->samples[0]));
+        d->batch_start_ms = d->sample_count ? d->samples[0].t_ms : now_ms;
+    }
+
+    // The batch carries the latest temperature; a crossing makes the backend rules fire.
+    bool over = d->has_value[1] && d->last_value[1] > d->fleet->rule_threshold;
+    if (over && !d->over_threshold && d->trigger_ms == 0) {
+        d->trigger_ms = now_ms ? now_ms : 1;
+    }
+    d->over_threshold = over;
+}
+
+static void sample(sim_device_t *d, uint32_t now_ms)
+{
+    float values[SIM_SOURCE_COUNT];
+    float noise = (float)(esp_random() % 200) / 1000.0f - 0.1f;
+
+    values[0] = d->led ? 1.0f : 0.0f;
+    values[1] = 24.0f + d->profile->temp_swing * sinf(d->phase + 6.2831853f * (float)(now_ms % d->profile->temp_cycle_ms) /
+                                                      (float)d->profile->temp_cycle_ms) + noise;
+    values[2] = -60.0f - (float)(esp_random() % 9);
+
+    for (uint8_t i = 0; i < SIM_SOURCE_COUNT; i++) {
+        if (d->has_value[i] && fabsf(values[i] - d->last_value[i]) <= source_deadband[i]) {
+            continue;
+        }
+        d->last_value[i] = values[i];
+        d->has_value[i] = true;
+        if (d->sample_count == 0) {
+            d->batch_start_ms = now_ms;
+        }
+        d->samples[d->sample_count++] = (sim_sample_t){ .t_ms = now_ms, .source = i, .value = values[i] };
+        if (d->sample_count == SIM_SAMPLES_MAX) {
+            flush_telemetry(d, now_ms);
+        }
+    }
+}
+
+// As pack_json()/pack_cbor() in command_ack.c.
+static void flush_acks(sim_device_t *d, uint32_t now_ms)
+{
+    size_t len;
+
+    if (d->ack_count == 0) {
+        return;
+    }
+    if (d->encoding == TELEMETRY_ENCODING_CBOR) {
+        cbor_lite_writer_t w;
+        cbor_lite_writer_init(&w, payload_buf, SIM_PAYLOAD_MAX);
+        cbor_lite_put_map(&w, 1);
+        cbor_lite_put_cstr(&w, "acks");
+        cbor_lite_put_array(&w, d->ack_count);
+        for (size_t i = 0; i < d->ack_count; i++) {
+            cbor_lite_put_array(&w, 3);
+            cbor_lite_put_uint(&w, d->acks[i][0]);
+            cbor_lite_put_int(&w, (int32_t)d->acks[i][1]);
+            cbor_lite_put_uint(&w, d->acks[i][2]);
+        }
+        len = w.len;
+    } else {
+        len = strlen(strcpy(payload_buf, "{\"acks\":["));
+        for (size_t i = 0; i < d->ack_count; i++) {
+            len += (size_t)snprintf(payload_buf + len, SIM_PAYLOAD_MAX - len, "%s[%" PRIu32 ",%" PRId32 ",%" PRIu32 "]",
+                                    i ? "," : "", d->acks[i][0], (int32_t)d->acks[i][1], d->acks[i][2]);
+        }
+        memcpy(payload_buf + len, "]}", 3);
+        len += 2;
+    }
+    publish(d, "ack", len, now_ms);
+    stats.acks += d->ack_count;
+    d->ack_count = 0;
+}
+
+static void queue_ack(sim_device_t *d, uint32_t seq, int32_t status, uint32_t us, uint32_t now_ms)
+{
+    if (d->ack_count == COMMAND_ACK_BATCH) {
+        flush_acks(d, now_ms);
+    }
+    d->acks[d->ack_count][0] = seq;
+    d->acks[d->ack_count][1] = (uint32_t)status;
+    d->acks[d->ack_count][2] = us;
+    d->ack_count++;
+}
+
+static bool seen_before(sim_device_t *d, uint32_t seq)
+{
+    for (size_t i = 0; i < COMMAND_ACK_DEDUP_WINDOW; i++) {
+        if (d->seen[i] == seq) {
+            return true;
+        }
+    }
+    d->seen[d->seen_next] = seq;
+    d->seen_next = (d->seen_next + 1) % COMMAND_ACK_DEDUP_WINDOW;
+    return false;
+}
+
+static void handle_message(void *ctx, const char *topic, size_t topic_len, char *data, size_t data_len)
+{
+    sim_device_t *d = ctx;
+    int64_t start_us = esp_timer_get_time();
+    uint32_t now_ms = (uint32_t)(start_us / 1000);
+    int prefix_len = build_topic(d, "command/");
+
+    if (topic_len <= (size_t)prefix_len || memcmp(topic, topic_buf, (size_t)prefix_len) != 0) {
+        return;
+    }
+#if CONFIG_DEVICE_PAYLOAD_ENCRYPTION
+    if (device_crypto_decrypt_in_place(&d->crypto, data, data_len, &data_len) != ESP_OK) {
+        stats.undecryptable++;
+        return;
+    }
+#endif
+    uint32_t seq = command_ack_get_seq(data, data_len);
+    if (seq && seen_before(d, seq)) {
+        stats.duplicates++;
+        queue_ack(d, seq, COMMAND_ACK_DUPLICATE, 0, now_ms);
+        return;
+    }
+
+    dispatch_device = d;
+    esp_err_t err = command_router_dispatch_group(topic + prefix_len, topic_len - (size_t)prefix_len, data, data_len);
+    dispatch_device = NULL;
+    stats.commands++;
+    if (seq) {
+        queue_ack(d, seq, err, (uint32_t)(esp_timer_get_time() - start_us), now_ms);
+    }
+    if (d->trigger_ms) {
+        record_latency(now_ms - d->trigger_ms);
+        stats.rule_commands++;
+        d->trigger_ms = 0;
+    }
+}
+
+static void handle_connected(void *ctx)
+{
+    sim_device_t *d = ctx;
+    uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+
+    build_topic(d, "command/#");
+    mqtt_lite_subscribe(&d->mqtt, topic_buf, 1, now_ms);
+    backoff_reset(&d->backoff);
+    // Nothing is sampled while offline; start over instead of catching up.
+    d->next_sample_ms = now_ms;
+    d->sample_count = 0;
+    stats.connects++;
+    stats.connected++;
+}
+
+static const mqtt_lite_callbacks_t callbacks = {
+    .on_connected = handle_connected,
+    .on_message = handle_message,
+};
+
+esp_err_t sim_device_init(sim_device_t *d, const char *id, const char *aes_key, const sim_profile_t *profile,
+                          telemetry_encoding_t encoding, const sim_fleet_config_t *fleet, uint32_t start_ms)
+{
+    size_t id_len = strlen(id);
+
+    if (id_len == 0 || id_len > SIM_DEVICE_ID_MAX_LEN) {
+        ESP_LOGE(TAG_SIM, "Device ID '%s' empty or longer than %d", id, SIM_DEVICE_ID_MAX_LEN);
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(d, 0, offsetof(sim_device_t, mqtt));
+    memcpy(d->id, id, id_len + 1);
+    d->profile = profile;
+    d->fleet = fleet;
+    d->encoding = encoding;
+    d->backoff = (backoff_t)BACKOFF_INIT(CONFIG_NETWORK_RECONNECT_BACKOFF_MIN_MS, CONFIG_NETWORK_RECONNECT_BACKOFF_MAX_MS);
+    d->reconnect_at_ms = start_ms;
+    d->next_sample_ms = start_ms;
+    d->phase = (float)(esp_random() % 6283) / 1000.0f;
+    mqtt_lite_init(&d->mqtt, d->id, fleet->keepalive_s);
+    stats.devices++;
+    return device_crypto_init(&d->crypto, aes_key, strlen(aes_key));
+}
+
+static void connection_lost(sim_device_t *d, uint32_t now_ms)
+{
+    if (d->mqtt.state == MQTT_LITE_CONNECTED) {
+        stats.connected--;
+        stats.disconnects++;
+    }
+    mqtt_lite_close(&d->mqtt);
+    d->reconnect_at_ms = now_ms + backoff_next_ms(&d->backoff);
+}
+
+void sim_device_poll(sim_device_t *d, uint32_t now_ms)
+{
+    if (d->mqtt.state == MQTT_LITE_DISCONNECTED) {
+        if (time_reached(now_ms, d->reconnect_at_ms) && mqtt_lite_connect(&d->mqtt, &d->fleet->broker, now_ms) != ESP_OK) {
+            connection_lost(d, now_ms);
+        }
+        return;
+    }
+    if (d->mqtt.state != MQTT_LITE_CONNECTED) {
+        return;
+    }
+    while (time_reached(now_ms, d->next_sample_ms)) {
+        sample(d, d->next_sample_ms);
+        d->next_sample_ms += d->profile->sample_period_ms;
+    }
+    if (d->sample_count > 0 && now_ms - d->batch_start_ms >= d->profile->flush_interval_ms) {
+        flush_telemetry(d, now_ms);
+    }
+    if (d->trigger_ms && time_reached(now_ms, d->trigger_ms + d->fleet->rule_timeout_ms)) {
+        stats.rule_timeouts++;
+        d->trigger_ms = 0;
+    }
+    flush_acks(d, now_ms);
+    mqtt_lite_poll(&d->mqtt, now_ms);
+}
+
+bool sim_device_on_io(sim_device_t *d, bool readable, bool writable, uint32_t now_ms)
+{
+    if (d->mqtt.fd < 0) {
+        return false;
+    }
+    if ((writable && mqtt_lite_on_writable(&d->mqtt) != ESP_OK) ||
+        (readable && mqtt_lite_on_readable(&d->mqtt, &callbacks, d, now_ms) != ESP_OK)) {
+        connection_lost(d, now_ms);
+        return false;
+    }
+    // Acks go out right after the commands, as the ack task does.
+    flush_acks(d, now_ms);
+    return true;
+}
+
+size_t sim_device_take_rule_latencies(uint32_t *out, size_t max)
+{
+    size_t n = latency_count < max ? latency_count : max;
+    memcpy(out, latencies, n * sizeof(out[0]));
+    latency_count = 0;
+    return n;
+}
+
+void sim_device_get_stats(sim_fleet_stats_t *out)
+{
+    *out = stats;
+}
@@ -0,0 +1,144 @@
+#ifndef SIM_DEVICE_H
+#define SIM_DEVICE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include "esp_err.h"
+#include "backoff.h"
+#include "command_ack.h"
+#include "device_crypto.h"
+#include "mqtt_lite.h"
+#include "telemetry.h"
+
+/*
+ * One virtual device: its own MQTT connection, aesKey and telemetry
+ * profile. Payloads go through the firmware modules (device_crypto,
+ * json_lite/cbor_lite, command_router, command_ack_get_seq(),
+ * led_parse_command()). telemetry.c and command_ack.c keep a single
+ * device's state in statics, so the batch and ack layouts they publish
+ * are reproduced here per device; keep them in step with
+ * pack_batch_json()/pack_batch_cbor() and pack_json()/pack_cbor().
+ *
+ * The device does not report "ruleProgram", so the backend evaluates all
+ * of its rules in AutomationService instead of pushing them to the device.
+ */
+
+#define SIM_DEVICE_ID_MAX_LEN 48
+#define SIM_SOURCE_COUNT      3      // ledState, temperature, rssi
+#define SIM_SAMPLES_MAX       32     // Batch size, like a small CONFIG_TELEMETRY_HIGH_WATER
+
+typedef struct {
+    const char *name;
+    uint32_t sample_period_ms;
+    uint32_t flush_interval_ms;
+    uint32_t temp_cycle_ms;     // Period of the temperature swing
+    float temp_swing;           // Peak deviation from 24 degrees
+} sim_profile_t;
+
+typedef struct {
+    struct sockaddr_in broker;
+    uint16_t keepalive_s;
+    float rule_threshold;       // Temperature that makes the backend rules fire
+    uint32_t rule_timeout_ms;   // Longest wait for the command a crossing triggers
+} sim_fleet_config_t;
+
+typedef struct {
+    uint32_t t_ms;
+    uint8_t source;
+    float value;
+} sim_sample_t;
+
+typedef struct {
+    char id[SIM_DEVICE_ID_MAX_LEN + 1];
+    const sim_profile_t *profile;
+    const sim_fleet_config_t *fleet;
+    telemetry_encoding_t encoding;
+    device_crypto_t crypto;
+    backoff_t backoff;
+    uint32_t reconnect_at_ms;
+
+    // Telemetry, sampled and batched like telemetry.c
+    float phase;
+    bool led;
+    bool has_value[SIM_SOURCE_COUNT];
+    float last_value[SIM_SOURCE_COUNT];
+    sim_sample_t samples[SIM_SAMPLES_MAX];
+    uint8_t sample_count;
+    uint32_t batch_start_ms;
+    uint32_t next_sample_ms;
+    bool over_threshold;        // Last published temperature was above rule_threshold
+    uint32_t trigger_ms;        // When the last crossing was published, 0 if no command is awaited
+
+    // Commands, deduplicated and acked like command_ack.c
+    uint32_t seen[COMMAND_ACK_DEDUP_WINDOW];
+    uint8_t seen_next;
+    uint32_t acks[COMMAND_ACK_BATCH][3];
+    uint8_t ack_count;
+
+    mqtt_lite_client_t mqtt;
+} sim_device_t;
+
+typedef struct {
+    uint32_t devices;
+    uint32_t connected;
+    uint64_t connects;
+    uint64_t disconnects;
+    uint64_t telemetry_batches;
+    uint64_t telemetry_samples;
+    uint64_t commands;          // Commands run, redeliveries not counted
+    uint64_t duplicates;        // Redeliveries dropped
+    uint64_t undecryptable;
+    uint64_t acks;
+    uint64_t rule_commands;     // Commands that followed a published crossing
+    uint64_t rule_timeouts;     // Crossings without a command within rule_timeout_ms
+} sim_fleet_stats_t;
+
+/**
+ * @brief Looks up a telemetry profile ("idle", "sensor", "busy").
+ *
+ * @return The profile, or NULL if there is none with that name.
+ */
+const sim_profile_t *sim_profile_find(const char *name);
+
+/**
+ * @brief Registers the firmware commands the simulated devices handle.
+ *
+ * Call once, before the first device connects.
+ */
+esp_err_t sim_device_register_commands(void);
+
+/**
+ * @brief Sets up a device; it connects on its first sim_device_poll().
+ *
+ * @param id Device ID as stored in the backend.
+ * @param aes_key Device aesKey as stored in the backend.
+ * @param start_ms First sampling step; spread over devices so they do not publish in lockstep.
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for an ID that is too long, or the device_crypto_init() error.
+ */
+esp_err_t sim_device_init(sim_device_t *d, const char *id, const char *aes_key, const sim_profile_t *profile,
+                          telemetry_encoding_t encoding, const sim_fleet_config_t *fleet, uint32_t start_ms);
+
+/**
+ * @brief Runs timers: reconnect, telemetry sampling and flush, ack flush, keepalive.
+ */
+void sim_device_poll(sim_device_t *d, uint32_t now_ms);
+
+/**
+ * @brief Handles readiness of the device socket reported by epoll.
+ *
+ * @return false when the connection was lost; the device reconnects after a backoff.
+ */
+bool sim_device_on_io(sim_device_t *d, bool readable, bool writable, uint32_t now_ms);
+
+/**
+ * @brief Takes the crossing to command latencies recorded since the last call.
+ *
+ * @param out Filled with up to max latencies in ms.
+ * @return Number of latencies written; the rest are dropped.
+ */
+size_t sim_device_take_rule_latencies(uint32_t *out, size_t max);
+
+void sim_device_get_stats(sim_fleet_stats_t *out);
+
+#endif // SIM_DEVICE_H
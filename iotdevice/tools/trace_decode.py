@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+"""Decode binary trace dumps published on home/devices/<id>/debug/trace.
+
+Record formats are read from main/hal/trace_formats.h, so the firmware
+never has to send format strings. Input may be raw binary chunks, one hex
+encoded chunk per line, or encrypted "<iv>:<tag>:<ciphertext>" frames
+(with --key, needs the 'cryptography' package).
+
+    mosquitto_sub -t 'home/devices/+/debug/trace' | tools/trace_decode.py --key <aesKey> -
+"""
+
+import argparse
+import hashlib
+import os
+import re
+import struct
+import sys
+
+MAGIC = b'TRC1'
+HEADER = struct.Struct('<4sHH')
+RECORD = struct.Struct('<IIHBx')
+DEFAULT_FORMATS = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'main', 'hal', 'trace_formats.h')
+
+ENTRY_RE = re.compile(r'X\(\s*(\w+)\s*,\s*(\w+)\s*,\s*(\w+)\s*,\s*"((?:[^"\\]|\\.)*)"\s*\)')
+CONVERSION_RE = re.compile(r'%([-+ #0]*\d*)([dux%])')
+
+
+def load_formats(path):
+    with open(path, encoding='utf-8') as f:
+        entries = ENTRY_RE.findall(f.read())
+    if not entries:
+        sys.exit(f'no trace formats found in {path}')
+    return [(name, tag, fmt.encode('utf-8').decode('unicode_escape')) for name, tag, _level, fmt in entries]
+
+
+def format_message(fmt, args):
+    """Applies a C format that only uses %d, %u and %x to 32 bit words."""
+    values = iter(args)
+
+    def convert(match):
+        flags, conv = match.groups()
+        if conv == '%':
+            return '%'
+        value = next(values, 0)
+        if conv == 'd' and value & 0x80000000:
+            value -= 1 << 32
+        return ('%' + flags + ('x' if conv == 'x' else 'd')) % value
+
+    return CONVERSION_RE.sub(convert, fmt)
+
+
+def decrypt_frame(frame, key):
+    try:
+        from cryptography.hazmat.primitives.ciphers.aead import AESGCM
+    except ImportError:
+        sys.exit("decrypting frames needs the 'cryptography' package")
+    iv, tag, ciphertext = (bytes.fromhex(part) for part in frame.split(':'))
+    # Same key derivation as the backend EncryptionService: sha256 of the aesKey string.
+    return AESGCM(hashlib.sha256(key.encode('utf-8')).digest()).decrypt(iv, ciphertext + tag, None)
+
+
+def read_chunks(data, key):
+    """Splits an input file into binary dump chunks."""
+    if data.startswith(MAGIC):
+        yield data
+        return
+    for line in data.decode('ascii', errors='replace').split():
+        if ':' in line:
+            if not key:
+                sys.exit('encrypted frame found, pass --key')
+            yield decrypt_frame(line, key)
+        else:
+            yield bytes.fromhex(line)
+
+
+def parse_chunk(chunk):
+    """Yields (seq, ts_us, id, args) for every record of one or more concatenated chunks."""
+    offset = 0
+    while offset < len(chunk):
+        magic, format_count, records = HEADER.unpack_from(chunk, offset)
+        if magic != MAGIC:
+            raise ValueError(f'bad chunk magic {magic!r} at offset {offset}')
+        offset += HEADER.size
+        for _ in range(records):
+            seq, ts_us, fmt_id, nargs = RECORD.unpack_from(chunk, offset)
+            offset += RECORD.size
+            args = struct.unpack_from(f'<{nargs}I', chunk, offset)
+            offset += 4 * nargs
+            yield format_count, seq, ts_us, fmt_id, args
+
+
+def decode(chunks, formats, out):
+    """Prints one line per record; returns the number of records."""
+    count = 0
+    last_seq = None
+    first_ts = None
+    last_ts = None
+    wraps = 0
+    warned = False
+
+    for chunk in chunks:
+        for format_count, seq, ts_us, fmt_id, args in parse_chunk(chunk):
+            if format_count != len(formats) and not warned:
+                print(f'# warning: firmware has {format_count} formats, {len(formats)} in table', file=out)
+                warned = True
+            if last_seq is not None and seq != last_seq + 1:
+                print(f'# {seq - last_seq - 1} record(s) lost', file=out)
+            # The device clock is the low 32 bits of a microsecond counter.
+            if last_ts is not None and ts_us < last_ts:
+                wraps += 1
+            last_seq, last_ts = seq, ts_us
+            ts = ts_us + (wraps << 32)
+            first_ts = ts if first_ts is None else first_ts
+
+            if fmt_id < len(formats):
+                _name, tag, fmt = formats[fmt_id]
+                message = format_message(fmt, args)
+            else:
+                tag, message = '?', f'unknown format {fmt_id} args={list(args)}'
+            print(f'{seq:8d} {(ts - first_ts) / 1000:12.3f} ms  {tag:<6} {message}', file=out)
+            count += 1
+    return count
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('inputs', nargs='+', help="dump files, or '-' for stdin")
+    parser.add_argument('--formats', default=DEFAULT_FORMATS, help='path to trace_formats.h')
+    parser.add_argument('--key', help='device aesKey, to decrypt "<iv>:<tag>:<ciphertext>" frames')
+    args = parser.parse_args()
+
+    formats = load_formats(args.formats)
+    chunks = []
+    for path in args.inputs:
+        if path == '-':
+            data = sys.stdin.buffer.read()
+        else:
+            with open(path, 'rb') as f:
+                data = f.read()
+        chunks.extend(read_chunks(data, args.key))
+    decode(chunks, formats, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()
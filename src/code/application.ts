@@ -14,7 +14,7 @@ import cors from 'cors';
 import swaggerUi from 'swagger-ui-express';
 import path from 'path';
 
-import { AuthController, DeviceController, UserController } from './controllers';
+import { AuthController, DeviceController, GroupController, UserController } from './controllers';
 import { AuthMiddleware, AttachContextMiddleware, RBACMiddleware } from './middlewares';
 import { Config, Database, Logger } from './infrastructure';
 import { UserRepository, DeviceRepository } from './repositories';
@@ -24,6 +24,10 @@ import {
     MQTTService, 
     EncryptionService, 
     AutomationService, 
+    GroupService,
+    MetricsService,
+    CommandAckService,
+    OtaService,
     NotificationService,
     AutomationRule
 } from './services';
@@ -53,6 +57,14 @@ export class App {
         
         mqttService.setAutomationService(automationService);
         automationService.setMqttService(mqttService);
+        const groupService = new GroupService(mqttService);
+        mqttService.setGroupService(groupService);
+        const metricsService = new MetricsService();
+        mqttService.setMetricsService(metricsService);
+        const commandAckService = new CommandAckService();
+        mqttService.setCommandAckService(commandAckService);
+        const otaService = new OtaService(mqttService, deviceRepository);
+        mqttService.setOtaService(otaService);
 
         const authMiddleware = new AuthMiddleware(authService);
         const attachContextMiddleware = new AttachContextMiddleware(userRepository, deviceRepository);
@@ -60,7 +72,9 @@ export class App {
 
         const authController = new AuthController(userRepository, authService);
         const userController = new UserController(userRepository, authService);
-        const deviceController = new DeviceController(deviceRepository, mqttService);
+        const deviceController = new DeviceController(deviceRepository, mqttService, metricsService, commandAckService,
+                                                      otaService);
+        const groupController = new GroupController(deviceRepository, groupService);
 
         this.server = new ServerInstance(
             config,
@@ -69,6 +83,7 @@ export class App {
             authController,
             userController,
             deviceController,
+            groupController,
             authMiddleware,
             attachContextMiddleware,
             rbacMiddleware
@@ -86,6 +101,11 @@ export class App {
             process.exit(1);
         }
     }
+
+    public async stop(): Promise<void> {
+        await this.server.stopServer();
+        this.logger.logInfo('Application stopped.');
+    }
 }
 
 class ServerInstance {
@@ -100,6 +120,7 @@ class ServerInstance {
     private authController: AuthController;
     private userController: UserController;
     private deviceController: DeviceController;
+    private groupController: GroupController;
     private authMiddleware: AuthMiddleware;
     private attachContextMiddleware: AttachContextMiddleware;
     private rbacMiddleware: RBACMiddleware;
@@ -111,6 +132,7 @@ class ServerInstance {
         authController: AuthController,
         userController: UserController,
         deviceController: DeviceController,
+        groupController: GroupController,
         authMiddleware: AuthMiddleware,
         attachContextMiddleware: AttachContextMiddleware,
         rbacMiddleware: RBACMiddleware
@@ -122,6 +144,7 @@ class ServerInstance {
         this.authController = authController;
         this.userController = userController;
         this.deviceController = deviceController;
+        this.groupController = groupController;
         this.authMiddleware = authMiddleware;
         this.attachContextMiddleware = attachContextMiddleware;
         this.rbacMiddleware = rbacMiddleware;
@@ -146,6 +169,7 @@ class ServerInstance {
             authController: this.authController,
             userController: this.userController,
             deviceController: this.deviceController,
+            groupController: this.groupController,
             authMiddleware: this.authMiddleware,
             attachContextMiddleware: this.attachContextMiddleware,
             rbacMiddleware: this.rbacMiddleware
@@ -208,6 +232,17 @@ class ServerInstance {
         }
     }
 
+    /*
+     * Closes the servers, then the MQTT client with the device state it still
+     * holds written, then the database.
+     */
+    public async stopServer(): Promise<void> {
+        this.wss?.close();
+        this.httpServer.close();
+        await this.mqttService.shutdown();
+        await this.database.disconnect();
+    }
+
     private attachWebsocketServer(): void {
         if (!this.httpServer) {
             this.logger.logError("HTTP server not initialized, cannot attach WebSocket server.");
@@ -0,0 +1,332 @@
+/*
+    * Home Control Hub
+    *
+    * This file contains the payload codec for the Home Control Hub application.
+    * Devices publish either JSON text or CBOR (RFC 8949); the codec detects which
+    * one a payload uses and encodes commands in the encoding a device expects.
+    *
+*/
+
+import { PayloadEncoding_ENUM } from './enums';
+
+const CBOR_UINT = 0;
+const CBOR_NINT = 1;
+const CBOR_BYTES = 2;
+const CBOR_TEXT = 3;
+const CBOR_ARRAY = 4;
+const CBOR_MAP = 5;
+const CBOR_TAG = 6;
+const CBOR_SIMPLE = 7;
+const CBOR_INDEFINITE = 31;
+const CBOR_BREAK = 0xff;
+const CBOR_MAX_DEPTH = 32;
+// Map keys that would reach Object.prototype through the decoded object.
+const CBOR_RESERVED_KEYS = new Set(['__proto__', 'constructor', 'prototype']);
+
+export interface DecodedPayload {
+    payload: any;
+    encoding: PayloadEncoding_ENUM;
+}
+
+class CborWriter {
+    private buffer: Buffer = Buffer.allocUnsafe(512);
+    private length = 0;
+
+    private reserve(bytes: number): void {
+        if (this.length + bytes <= this.buffer.length) {
+            return;
+        }
+        const grown = Buffer.allocUnsafe(Math.max(this.buffer.length * 2, this.length + bytes));
+        this.buffer.copy(grown, 0, 0, this.length);
+        this.buffer = grown;
+    }
+
+    private writeHead(major: number, arg: number): void {
+        this.reserve(9);
+        if (arg < 24) {
+            this.buffer[this.length++] = (major << 5) | arg;
+        } else if (arg <= 0xff) {
+            this.buffer[this.length++] = (major << 5) | 24;
+            this.buffer[this.length++] = arg;
+        } else if (arg <= 0xffff) {
+            this.buffer[this.length++] = (major << 5) | 25;
+            this.length = this.buffer.writeUInt16BE(arg, this.length);
+        } else if (arg <= 0xffffffff) {
+            this.buffer[this.length++] = (major << 5) | 26;
+            this.length = this.buffer.writeUInt32BE(arg, this.length);
+        } else {
+            this.buffer[this.length++] = (major << 5) | 27;
+            this.length = this.buffer.writeBigUInt64BE(BigInt(arg), this.length);
+        }
+    }
+
+    private writeNumber(value: number): void {
+        if (Number.isSafeInteger(value)) {
+            if (value >= 0) {
+                this.writeHead(CBOR_UINT, value);
+            } else {
+                this.writeHead(CBOR_NINT, -1 - value);
+            }
+            return;
+        }
+        this.reserve(9);
+        if (Math.fround(value) === value || Number.isNaN(value)) {
+            this.buffer[this.length++] = (CBOR_SIMPLE << 5) | 26;
+            this.length = this.buffer.writeFloatBE(value, this.length);
+        } else {
+            this.buffer[this.length++] = (CBOR_SIMPLE << 5) | 27;
+            this.length = this.buffer.writeDoubleBE(value, this.length);
+        }
+    }
+
+    private writeText(text: string): void {
+        const length = Buffer.byteLength(text, 'utf8');
+        this.writeHead(CBOR_TEXT, length);
+        this.reserve(length);
+        this.length += this.buffer.write(text, this.length, length, 'utf8');
+    }
+
+    private writeBytes(major: number, data: Buffer): void {
+        this.writeHead(major, data.length);
+        this.reserve(data.length);
+        data.copy(this.buffer, this.length);
+        this.length += data.length;
+    }
+
+    public write(value: any, depth = 0): void {
+        if (depth > CBOR_MAX_DEPTH) {
+            throw new Error('CBOR encode: nesting too deep');
+        }
+        if (value === null || value === undefined) {
+            this.reserve(1);
+            this.buffer[this.length++] = (CBOR_SIMPLE << 5) | 22;
+        } else if (typeof value === 'boolean') {
+            this.reserve(1);
+            this.buffer[this.length++] = (CBOR_SIMPLE << 5) | (value ? 21 : 20);
+        } else if (typeof value === 'number') {
+            this.writeNumber(value);
+        } else if (typeof value === 'string') {
+            this.writeText(value);
+        } else if (Buffer.isBuffer(value)) {
+            this.writeBytes(CBOR_BYTES, value);
+        } else if (Array.isArray(value)) {
+            this.writeHead(CBOR_ARRAY, value.length);
+            for (const item of value) {
+                this.write(item, depth + 1);
+            }
+        } else if (typeof value === 'object') {
+            // Same members JSON.stringify would keep.
+            const keys = Object.keys(value).filter((key) => value[key] !== undefined && typeof value[key] !== 'function');
+            this.writeHead(CBOR_MAP, keys.length);
+            for (const key of keys) {
+                this.writeText(key);
+                this.write(value[key], depth + 1);
+            }
+        } else {
+            throw new Error(`CBOR encode: unsupported type ${typeof value}`);
+        }
+    }
+
+    public result(): Buffer {
+        return this.buffer.subarray(0, this.length);
+    }
+}
+
+class CborReader {
+    private readonly data: Buffer;
+    private offset = 0;
+
+    constructor(data: Buffer) {
+        this.data = data;
+    }
+
+    private need(bytes: number): void {
+        if (this.offset + bytes > this.data.length) {
+            throw new Error('CBOR decode: truncated payload');
+        }
+    }
+
+    private readArgument(info: number): number {
+        if (info < 24) {
+            return info;
+        }
+        const width = [1, 2, 4, 8][info - 24];
+        if (width === undefined) {
+            throw new Error(`CBOR decode: invalid additional info ${info}`);
+        }
+        this.need(width);
+        let value: number;
+        switch (width) {
+            case 1: value = this.data.readUInt8(this.offset); break;
+            case 2: value = this.data.readUInt16BE(this.offset); break;
+            case 4: value = this.data.readUInt32BE(this.offset); break;
+            default: value = Number(this.data.readBigUInt64BE(this.offset)); break;
+        }
+        this.offset += width;
+        return value;
+    }
+
+    private atBreak(): boolean {
+        this.need(1);
+        if (this.data[this.offset] === CBOR_BREAK) {
+            this.offset++;
+            return true;
+        }
+        return false;
+    }
+
+    private readString(major: number, info: number): Buffer {
+        if (info === CBOR_INDEFINITE) {
+            const chunks: Buffer[] = [];
+            while (!this.atBreak()) {
+                const chunk = this.data[this.offset++];
+                if (chunk >> 5 !== major || (chunk & 0x1f) === CBOR_INDEFINITE) {
+                    throw new Error('CBOR decode: invalid string chunk');
+                }
+                chunks.push(this.readString(major, chunk & 0x1f));
+            }
+            return Buffer.concat(chunks);
+        }
+        const length = this.readArgument(info);
+        this.need(length);
+        const value = this.data.subarray(this.offset, this.offset + length);
+        this.offset += length;
+        return value;
+    }
+
+    private readSimple(info: number): any {
+        switch (info) {
+            case 20: return false;
+            case 21: return true;
+            case 22: return null;
+            case 23: return undefined;
+            case 25: {
+                this.need(2);
+                const half = this.data.readUInt16BE(this.offset);
+                this.offset += 2;
+                const exponent = (half >> 10) & 0x1f;
+                const mantissa = half & 0x3ff;
+                let value: number;
+                if (exponent === 0) {
+                    value = mantissa * 2 ** -24;
+                } else if (exponent === 31) {
+                    value = mantissa ? NaN : Infinity;
+                } else {
+                    value = (mantissa + 1024) * 2 ** (exponent - 25);
+                }
+                return half & 0x8000 ? -value : value;
+            }
+            case 26: {
+                this.need(4);
+                const value = this.data.readFloatBE(this.offset);
+                this.offset += 4;
+                return value;
+            }
+            case 27: {
+                this.need(8);
+                const value = this.data.readDoubleBE(this.offset);
+                this.offset += 8;
+                return value;
+            }
+            default:
+                if (info === CBOR_INDEFINITE) {
+                    throw new Error('CBOR decode: unexpected break');
+                }
+                // Unassigned simple value
+                return this.readArgument(info);
+        }
+    }
+
+    public read(depth = 0): any {
+        if (depth > CBOR_MAX_DEPTH) {
+            throw new Error('CBOR decode: nesting too deep');
+        }
+        this.need(1);
+        const initial = this.data[this.offset++];
+        const major = initial >> 5;
+        const info = initial & 0x1f;
+
+        switch (major) {
+            case CBOR_UINT:
+                return this.readArgument(info);
+            case CBOR_NINT:
+                return -1 - this.readArgument(info);
+            case CBOR_BYTES:
+                return Buffer.from(this.readString(major, info));
+            case CBOR_TEXT:
+                return this.readString(major, info).toString('utf8');
+            case CBOR_ARRAY: {
+                const items: any[] = [];
+                if (info === CBOR_INDEFINITE) {
+                    while (!this.atBreak()) {
+                        items.push(this.read(depth + 1));
+                    }
+                } else {
+                    const count = this.readArgument(info);
+                    for (let i = 0; i < count; i++) {
+                        items.push(this.read(depth + 1));
+                    }
+                }
+                return items;
+            }
+            case CBOR_MAP: {
+                const result: Record<string, any> = {};
+                const indefinite = info === CBOR_INDEFINITE;
+                const count = indefinite ? Infinity : this.readArgument(info);
+                for (let i = 0; i < count; i++) {
+                    if (indefinite && this.atBreak()) {
+                        break;
+                    }
+                    const key = String(this.read(depth + 1));
+                    if (CBOR_RESERVED_KEYS.has(key)) {
+                        throw new Error(`CBOR decode: reserved map key ${key}`);
+                    }
+                    result[key] = this.read(depth + 1);
+                }
+                return result;
+            }
+            case CBOR_TAG:
+                // Tags only annotate the item that follows; keep the item.
+                this.readArgument(info);
+                return this.read(depth + 1);
+            default:
+                return this.readSimple(info);
+        }
+    }
+
+    public finish(): void {
+        if (this.offset !== this.data.length) {
+            throw new Error(`CBOR decode: ${this.data.length - this.offset} trailing bytes`);
+        }
+    }
+}
+
+export class PayloadCodec {
+    /*
+     * CBOR maps, arrays and simple values all start with a byte >= 0x80, which
+     * never starts a JSON document (the firmware uses the same test).
+     */
+    public static detect(data: Buffer): PayloadEncoding_ENUM {
+        return data.length > 0 && data[0] >= 0x80 ? PayloadEncoding_ENUM.CBOR : PayloadEncoding_ENUM.JSON;
+    }
+
+    public static encode(payload: any, encoding: PayloadEncoding_ENUM): Buffer {
+        if (encoding === PayloadEncoding_ENUM.CBOR) {
+            const writer = new CborWriter();
+            writer.write(payload);
+            return writer.result();
+        }
+        return Buffer.from(JSON.stringify(payload), 'utf8');
+    }
+
+    public static decode(data: Buffer): DecodedPayload {
+        const encoding = PayloadCodec.detect(data);
+        if (encoding === PayloadEncoding_ENUM.CBOR) {
+            const reader = new CborReader(data);
+            const payload = reader.read();
+            reader.finish();
+            return { payload, encoding };
+        }
+        return { payload: JSON.parse(data.toString('utf8')), encoding };
+    }
+}
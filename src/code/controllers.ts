@@ -7,8 +7,8 @@
 */
 
 import { DeviceRepository, UserRepository } from './repositories';
-import { AuthService, MQTTService, AuthTokenPayload } from './services';
-import { User, Device, Command } from './entities';
+import { AuthService, MQTTService, GroupService, MetricsService, CommandAckService, OtaService, AuthTokenPayload } from './services';
+import { User, Device, Command, DeviceGroup } from './entities';
 import { UserRole_ENUM } from './enums';
 import { Logger } from './infrastructure';
 
@@ -17,11 +17,18 @@ import { Request, Response, NextFunction } from 'express';
 export class DeviceController {
     private deviceRepository: DeviceRepository;
     private mqttService: MQTTService;
+    private metricsService: MetricsService;
+    private commandAckService: CommandAckService;
+    private otaService: OtaService;
     private logger: Logger;
 
-    constructor(deviceRepository: DeviceRepository, mqttService: MQTTService) {
+    constructor(deviceRepository: DeviceRepository, mqttService: MQTTService, metricsService: MetricsService,
+                commandAckService: CommandAckService, otaService: OtaService) {
         this.deviceRepository = deviceRepository;
         this.mqttService = mqttService;
+        this.metricsService = metricsService;
+        this.commandAckService = commandAckService;
+        this.otaService = otaService;
         this.logger = Logger.getInstance();
     }
 
@@ -185,6 +192,106 @@ export class DeviceController {
         }
     }
 
+    public async getDeviceMetrics(req: Request, res: Response, next: NextFunction): Promise<void> {
+        try {
+            if (!req.device) {
+                res.status(404).json({ message: 'Device not found' });
+                return;
+            }
+            if (req.user?.role !== UserRole_ENUM.ADMIN && req.device.ownerId !== req.user?.userId) {
+                this.logger.logWarn(`User ${req.user?.username} attempt to read metrics of unowned device ${req.device.id}`);
+                res.status(403).json({ message: 'Forbidden: You do not own this device' });
+                return;
+            }
+            const metrics = this.metricsService.getDeviceMetrics(req.device.id);
+            if (!metrics) {
+                res.status(404).json({ message: 'No metrics received from this device yet' });
+                return;
+            }
+            res.status(200).json(metrics);
+        } catch (error) {
+            this.logger.logError(`Error in getDeviceMetrics ${req.params.deviceId}: ${error}`);
+            next(error);
+        }
+    }
+
+    public async getCommandLatency(req: Request, res: Response, next: NextFunction): Promise<void> {
+        try {
+            if (!req.device) {
+                res.status(404).json({ message: 'Device not found' });
+                return;
+            }
+            if (req.user?.role !== UserRole_ENUM.ADMIN && req.device.ownerId !== req.user?.userId) {
+                this.logger.logWarn(`User ${req.user?.username} attempt to read command latency of unowned device ${req.device.id}`);
+                res.status(403).json({ message: 'Forbidden: You do not own this device' });
+                return;
+            }
+            const latency = this.commandAckService.getCommandLatency(req.device.id);
+            if (!latency) {
+                res.status(404).json({ message: 'No commands sent to this device yet' });
+                return;
+            }
+            res.status(200).json(latency);
+        } catch (error) {
+            this.logger.logError(`Error in getCommandLatency ${req.params.deviceId}: ${error}`);
+            next(error);
+        }
+    }
+
+    public async startOta(req: Request, res: Response, next: NextFunction): Promise<void> {
+        try {
+            if (!req.device) {
+                res.status(404).json({ message: 'Device not found' });
+                return;
+            }
+            if (req.user?.role !== UserRole_ENUM.ADMIN && req.device.ownerId !== req.user?.userId) {
+                this.logger.logWarn(`User ${req.user?.username} attempt to update firmware of unowned device ${req.device.id}`);
+                res.status(403).json({ message: 'Forbidden: You do not own this device' });
+                return;
+            }
+            const { version } = req.body;
+            if (typeof version !== 'string' || !version) {
+                res.status(400).json({ message: 'Missing firmware version' });
+                return;
+            }
+            let transfer;
+            try {
+                transfer = await this.otaService.startUpdate(req.device.id, version);
+            } catch (error) {
+                // Unknown version, or the device already runs it.
+                res.status(400).json({ message: (error as Error).message });
+                return;
+            }
+            res.status(202).json(transfer);
+        } catch (error) {
+            this.logger.logError(`Error in startOta ${req.params.deviceId}: ${error}`);
+            next(error);
+        }
+    }
+
+    public async getOta(req: Request, res: Response, next: NextFunction): Promise<void> {
+        try {
+            if (!req.device) {
+                res.status(404).json({ message: 'Device not found' });
+                return;
+            }
+            if (req.user?.role !== UserRole_ENUM.ADMIN && req.device.ownerId !== req.user?.userId) {
+                this.logger.logWarn(`User ${req.user?.username} attempt to read firmware update of unowned device ${req.device.id}`);
+                res.status(403).json({ message: 'Forbidden: You do not own this device' });
+                return;
+            }
+            const transfer = this.otaService.getTransfer(req.device.id);
+            if (!transfer) {
+                res.status(404).json({ message: 'No firmware update started for this device' });
+                return;
+            }
+            res.status(200).json(transfer);
+        } catch (error) {
+            this.logger.logError(`Error in getOta ${req.params.deviceId}: ${error}`);
+            next(error);
+        }
+    }
+
     public async sendCommand(req: Request, res: Response, next: NextFunction): Promise<void> {
         console.error("DEVICE_CONTROLLER_SEND_COMMAND: Entry"); // DEBUG
         try {
@@ -225,6 +332,161 @@ export class DeviceController {
     }
 }
 
+export class GroupController {
+    private deviceRepository: DeviceRepository;
+    private groupService: GroupService;
+    private logger: Logger;
+
+    constructor(deviceRepository: DeviceRepository, groupService: GroupService) {
+        this.deviceRepository = deviceRepository;
+        this.groupService = groupService;
+        this.logger = Logger.getInstance();
+    }
+
+    // The key stays on the server and the members.
+    private toResponse(group: DeviceGroup): object {
+        return { id: group.id, name: group.name, ownerId: group.ownerId, deviceIds: [...group.deviceIds] };
+    }
+
+    private isAdmin(req: Request): boolean {
+        return req.user?.role === UserRole_ENUM.ADMIN;
+    }
+
+    // Sends the response itself and returns undefined when the group is not accessible.
+    private findOwnedGroup(req: Request, res: Response): DeviceGroup | undefined {
+        const group = this.groupService.getGroup(req.params.groupId);
+        if (!group) {
+            res.status(404).json({ message: 'Group not found' });
+            return undefined;
+        }
+        if (!this.isAdmin(req) && group.ownerId !== req.user?.userId) {
+            this.logger.logWarn(`User ${req.user?.username} attempt to access unowned group ${group.id}`);
+            res.status(403).json({ message: 'Forbidden: You do not own this group' });
+            return undefined;
+        }
+        return group;
+    }
+
+    public async createGroup(req: Request, res: Response, next: NextFunction): Promise<void> {
+        try {
+            const { name } = req.body;
+            if (!req.user?.userId) {
+                res.status(401).json({ message: 'Unauthorized: Authentication required to create groups' });
+                return;
+            }
+            if (!name || typeof name !== 'string') {
+                res.status(400).json({ message: 'Missing group name' });
+                return;
+            }
+            const group = this.groupService.createGroup(name, req.user.userId);
+            res.status(201).json(this.toResponse(group));
+        } catch (error) {
+            this.logger.logError(`Error in createGroup: ${error}`);
+            next(error);
+        }
+    }
+
+    public async listGroups(req: Request, res: Response, next: NextFunction): Promise<void> {
+        try {
+            const groups = this.groupService.listGroups(this.isAdmin(req) ? undefined : req.user?.userId);
+            res.status(200).json(groups.map(group => this.toResponse(group)));
+        } catch (error) {
+            this.logger.logError(`Error in listGroups: ${error}`);
+            next(error);
+        }
+    }
+
+    public async deleteGroup(req: Request, res: Response, next: NextFunction): Promise<void> {
+        try {
+            const group = this.findOwnedGroup(req, res);
+            if (!group) {
+                return;
+            }
+            await this.groupService.deleteGroup(group.id);
+            res.status(204).send();
+        } catch (error) {
+            this.logger.logError(`Error in deleteGroup ${req.params.groupId}: ${error}`);
+            next(error);
+        }
+    }
+
+    public async addDevice(req: Request, res: Response, next: NextFunction): Promise<void> {
+        try {
+            const group = this.findOwnedGroup(req, res);
+            if (!group) {
+                return;
+            }
+            const device = await this.deviceRepository.findById(req.params.deviceId);
+            if (!device) {
+                res.status(404).json({ message: 'Device not found' });
+                return;
+            }
+            if (!this.isAdmin(req) && device.ownerId !== req.user?.userId) {
+                this.logger.logWarn(`User ${req.user?.username} attempt to group unowned device ${device.id}`);
+                res.status(403).json({ message: 'Forbidden: You do not own this device' });
+                return;
+            }
+            await this.groupService.addDevice(group.id, device.id);
+            res.status(200).json(this.toResponse(group));
+        } catch (error) {
+            this.logger.logError(`Error in addDevice to group ${req.params.groupId}: ${error}`);
+            next(error);
+        }
+    }
+
+    public async removeDevice(req: Request, res: Response, next: NextFunction): Promise<void> {
+        try {
+            const group = this.findOwnedGroup(req, res);
+            if (!group) {
+                return;
+            }
+            await this.groupService.removeDevice(group.id, req.params.deviceId);
+            res.status(200).json(this.toResponse(group));
+        } catch (error) {
+            this.logger.logError(`Error in removeDevice from group ${req.params.groupId}: ${error}`);
+            next(error);
+        }
+    }
+
+    public async sendCommand(req: Request, res: Response, next: NextFunction): Promise<void> {
+        try {
+            const group = this.findOwnedGroup(req, res);
+            if (!group) {
+                return;
+            }
+            const { commandName, payload } = req.body;
+            if (!commandName || typeof payload === 'undefined') {
+                res.status(400).json({ message: 'Missing commandName or payload' });
+                return;
+            }
+            await this.groupService.sendCommand(group.id, commandName, payload);
+            res.status(202).json({ message: `Command '${commandName}' sent to group ${group.id} (${group.deviceIds.size} devices)` });
+        } catch (error) {
+            this.logger.logError(`Error in sendCommand to group ${req.params.groupId}: ${error}`);
+            next(error);
+        }
+    }
+
+    public async applyScene(req: Request, res: Response, next: NextFunction): Promise<void> {
+        try {
+            const group = this.findOwnedGroup(req, res);
+            if (!group) {
+                return;
+            }
+            const levels = req.body;
+            if (!levels || typeof levels !== 'object' || Array.isArray(levels) || Object.keys(levels).length === 0) {
+                res.status(400).json({ message: 'Missing channel levels' });
+                return;
+            }
+            await this.groupService.applyScene(group.id, levels);
+            res.status(202).json({ message: `Scene sent to group ${group.id} (${group.deviceIds.size} devices)` });
+        } catch (error) {
+            this.logger.logError(`Error in applyScene to group ${req.params.groupId}: ${error}`);
+            next(error);
+        }
+    }
+}
+
 export class UserController {
     private userRepository: UserRepository;
     private authService: AuthService;
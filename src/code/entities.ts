@@ -23,6 +23,27 @@ export class Command {
     }
 }
 
+/*
+ * Devices switched together with one message on home/groups/<id>/command/<name>.
+ * Members decrypt group messages with the group key, which they get from the
+ * "groups" command under their own key.
+ */
+export class DeviceGroup {
+    public id: string;
+    public name: string;
+    public key: string;
+    public ownerId: string;
+    public deviceIds: Set<string>;
+
+    constructor(id: string, name: string, key: string, ownerId: string, deviceIds: Iterable<string> = []) {
+        this.id = id;
+        this.name = name;
+        this.key = key;
+        this.ownerId = ownerId;
+        this.deviceIds = new Set(deviceIds);
+    }
+}
+
 export class Device {
     public id: string;
     public name: string;
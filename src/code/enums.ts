@@ -11,3 +11,8 @@ export enum UserRole_ENUM {
     STANDARD_USER = "STANDARD_USER",
     GUEST = "GUEST"
 }
+
+export enum PayloadEncoding_ENUM {
+    JSON = "JSON",
+    CBOR = "CBOR"
+}
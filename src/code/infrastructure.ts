@@ -7,7 +7,7 @@
 */
 
 
-import { PrismaClient } from '../db/prisma/generated/prisma-client';
+import { PrismaClient, Prisma } from '../db/prisma/generated/prisma-client';
 import * as dotenv from 'dotenv';
 import * as fs from 'fs';
 import * as path from 'path';
@@ -20,6 +20,12 @@ export class Config {
     private readonly mqttPort: number;
     private readonly encryptionAlgorithm: string;
     private readonly dbConnectionString: string; // For Prisma, often set in .env directly
+    private readonly mqttStatsIntervalMs: number; // 0 disables the home/backend/stats publisher
+    private readonly otaImageDir: string; // Firmware images, <version>.bin
+    private readonly otaWindowBytes: number; // OTA stream bytes sent ahead of the device's progress
+    private readonly lanCommands: boolean; // Also send commands over UDP to devices announcing a LAN listener
+    private readonly mqttCaFile: string; // CA of an mqtts:// broker, empty for the system CAs
+    private readonly ingestFlushMs: number; // Device state reported over MQTT is written to the database this often
 
     private constructor() {
         // Load .env file from project root
@@ -37,6 +43,12 @@ export class Config {
         this.mqttPort = parseInt(process.env.MQTT_PORT || "1883", 10);
         this.encryptionAlgorithm = process.env.ENCRYPTION_ALGORITHM || "aes-256-gcm";
         this.dbConnectionString = process.env.DATABASE_URL || "your-prisma-database-url"; // Prisma uses DATABASE_URL
+        this.mqttStatsIntervalMs = parseInt(process.env.MQTT_STATS_INTERVAL_MS || "0", 10);
+        this.otaImageDir = process.env.OTA_IMAGE_DIR || path.resolve(__dirname, '../../firmware');
+        this.otaWindowBytes = parseInt(process.env.OTA_WINDOW_BYTES || "32768", 10);
+        this.lanCommands = (process.env.LAN_COMMANDS || "true") !== "false";
+        this.mqttCaFile = process.env.MQTT_CA_FILE || "";
+        this.ingestFlushMs = parseInt(process.env.INGEST_FLUSH_MS || "500", 10);
 
         if (this.jwtSecret === "your-default-super-secret-key") {
             console.warn("Warning: JWT_SECRET is using a default insecure value. Please set it in your .env file.");
@@ -56,6 +68,12 @@ export class Config {
     public getMqttPort(): number { return this.mqttPort; }
     public getEncryptionAlgorithm(): string { return this.encryptionAlgorithm; }
     public getDbConnectionString(): string { return this.dbConnectionString; } // Though Prisma often handles this internally
+    public getMqttStatsIntervalMs(): number { return this.mqttStatsIntervalMs; }
+    public getOtaImageDir(): string { return this.otaImageDir; }
+    public getOtaWindowBytes(): number { return this.otaWindowBytes; }
+    public getLanCommands(): boolean { return this.lanCommands; }
+    public getMqttCaFile(): string { return this.mqttCaFile; }
+    public getIngestFlushMs(): number { return this.ingestFlushMs; }
 }
 
 export class Database {
@@ -96,6 +114,11 @@ export class Database {
     public get user() {
         return this.prisma.user;
     }
+
+    // For statements the delegates cannot express, e.g. one UPDATE for many rows.
+    public executeRaw(query: Prisma.Sql): Promise<number> {
+        return this.prisma.$executeRaw(query);
+    }
 }
 
 
@@ -0,0 +1,209 @@
+/*
+    * Home Control Hub
+    *
+    * This file contains the delta encoder for firmware updates over MQTT.
+    * A delta rebuilds the new image mostly out of the firmware the device
+    * runs, so only changed code travels to the device. Stream layout and the
+    * device side: iotdevice/main/hal/ota_update.h.
+    *
+*/
+
+export enum OtaOp {
+    COPY = 0x01,    // varint source offset, varint length
+    INSERT = 0x02,  // varint length, bytes
+    FILL = 0x03,    // varint length, byte
+}
+
+// Shortest match worth a COPY op (which takes up to 11 bytes itself).
+const MIN_MATCH = 32;
+// Base positions indexed; any common run of MIN_MATCH + INDEX_STEP - 1 bytes is found.
+const INDEX_STEP = 16;
+// Shortest run of one byte sent as FILL instead of literally.
+const MIN_FILL = 12;
+const HASH_MUL = 0x01000193;
+
+class DeltaWriter {
+    private readonly parts: Buffer[] = [];
+    private readonly header: number[] = [];
+
+    private varint(value: number): void {
+        do {
+            const low = value & 0x7f;
+            value = Math.floor(value / 128);
+            this.header.push(low | (value > 0 ? 0x80 : 0));
+        } while (value > 0);
+    }
+
+    private flushHeader(): void {
+        if (this.header.length > 0) {
+            this.parts.push(Buffer.from(this.header));
+            this.header.length = 0;
+        }
+    }
+
+    public copy(src: number, length: number): void {
+        this.header.push(OtaOp.COPY);
+        this.varint(src);
+        this.varint(length);
+    }
+
+    public fill(value: number, length: number): void {
+        this.header.push(OtaOp.FILL);
+        this.varint(length);
+        this.header.push(value);
+    }
+
+    // Literal bytes, with long runs of one byte turned into FILL ops.
+    public literal(data: Buffer): void {
+        let start = 0;
+        let i = 0;
+        while (i < data.length) {
+            let run = 1;
+            while (i + run < data.length && data[i + run] === data[i]) {
+                run++;
+            }
+            if (run >= MIN_FILL) {
+                this.insert(data.subarray(start, i));
+                this.fill(data[i], run);
+                start = i + run;
+            }
+            i += run;
+        }
+        this.insert(data.subarray(start));
+    }
+
+    private insert(data: Buffer): void {
+        if (data.length === 0) {
+            return;
+        }
+        this.header.push(OtaOp.INSERT);
+        this.varint(data.length);
+        this.flushHeader();
+        this.parts.push(data);
+    }
+
+    public result(): Buffer {
+        this.flushHeader();
+        return Buffer.concat(this.parts);
+    }
+}
+
+function hashAt(data: Buffer, pos: number): number {
+    let h = 0;
+    for (let i = 0; i < MIN_MATCH; i++) {
+        h = (Math.imul(h, HASH_MUL) + data[pos + i]) >>> 0;
+    }
+    return h;
+}
+
+export class DeltaEncoder {
+    /*
+     * Greedy block matching: base blocks are indexed by a hash of their first
+     * MIN_MATCH bytes, the target is scanned with a rolling hash of the same
+     * window, and every hit is grown in both directions. What no match covers
+     * goes out as INSERT and FILL. With an empty base the result is a run
+     * length compressed full image.
+     */
+    public static encode(base: Buffer, target: Buffer): Buffer {
+        const index = new Map<number, number>();
+        for (let pos = 0; pos + MIN_MATCH <= base.length; pos += INDEX_STEP) {
+            const h = hashAt(base, pos);
+            if (!index.has(h)) {
+                index.set(h, pos);
+            }
+        }
+
+        // HASH_MUL^MIN_MATCH, to drop the byte leaving the window.
+        let outFactor = 1;
+        for (let i = 0; i < MIN_MATCH; i++) {
+            outFactor = Math.imul(outFactor, HASH_MUL) >>> 0;
+        }
+
+        const writer = new DeltaWriter();
+        let literalStart = 0;
+        let pos = 0;
+        let h = target.length >= MIN_MATCH ? hashAt(target, 0) : 0;
+        while (pos + MIN_MATCH <= target.length) {
+            const src = index.get(h);
+            if (src !== undefined && base.compare(target, pos, pos + MIN_MATCH, src, src + MIN_MATCH) === 0) {
+                let start = pos;
+                let from = src;
+                let end = pos + MIN_MATCH;
+                while (end < target.length && from + (end - start) < base.length && target[end] === base[from + (end - start)]) {
+                    end++;
+                }
+                while (start > literalStart && from > 0 && target[start - 1] === base[from - 1]) {
+                    start--;
+                    from--;
+                }
+                writer.literal(target.subarray(literalStart, start));
+                writer.copy(from, end - start);
+                literalStart = pos = end;
+                if (pos + MIN_MATCH <= target.length) {
+                    h = hashAt(target, pos);
+                }
+                continue;
+            }
+            if (pos + MIN_MATCH < target.length) {
+                h = (Math.imul(h, HASH_MUL) - Math.imul(target[pos], outFactor) + target[pos + MIN_MATCH]) >>> 0;
+            }
+            pos++;
+        }
+        writer.literal(target.subarray(literalStart));
+        return writer.result();
+    }
+
+    /*
+     * Builds the image a delta describes, as the device does. Used to check a
+     * delta before it is sent; throws on a malformed stream.
+     */
+    public static apply(base: Buffer, delta: Buffer, size: number): Buffer {
+        const out = Buffer.alloc(size);
+        let outPos = 0;
+        let pos = 0;
+        const varint = (): number => {
+            let value = 0;
+            let scale = 1;
+            for (;;) {
+                if (pos >= delta.length) {
+                    throw new Error('Truncated delta');
+                }
+                const byte = delta[pos++];
+                value += (byte & 0x7f) * scale;
+                scale *= 128;
+                if (!(byte & 0x80)) {
+                    return value;
+                }
+            }
+        };
+        while (pos < delta.length) {
+            const op = delta[pos++];
+            const src = op === OtaOp.COPY ? varint() : 0;
+            const length = varint();
+            if (outPos + length > size) {
+                throw new Error(`Delta op at ${pos} writes past the image`);
+            }
+            if (op === OtaOp.COPY) {
+                if (src + length > base.length) {
+                    throw new Error(`Delta copy at ${pos} reads past the base`);
+                }
+                base.copy(out, outPos, src, src + length);
+            } else if (op === OtaOp.INSERT) {
+                if (pos + length > delta.length) {
+                    throw new Error('Truncated delta');
+                }
+                delta.copy(out, outPos, pos, pos + length);
+                pos += length;
+            } else if (op === OtaOp.FILL) {
+                out.fill(delta[pos++], outPos, outPos + length);
+            } else {
+                throw new Error(`Unknown delta op 0x${op.toString(16)}`);
+            }
+            outPos += length;
+        }
+        if (outPos !== size) {
+            throw new Error(`Delta builds ${outPos} of ${size} bytes`);
+        }
+        return out;
+    }
+}
@@ -15,15 +15,28 @@ import { Prisma } from '../db/prisma/generated/prisma-client'; // Import Prisma
 // If not, we might need to define interfaces for input data.
 // For simplicity, we'll use Partial<User> or Partial<Device> for updates.
 
+// What a device reported since the last write, see DeviceRepository.applyStates().
+export interface DeviceStatePatch {
+    state: Record<string, any>; // Merged into lastKnownState, key by key
+    status?: boolean;
+    firmwareVersion?: string;
+}
+
 export class DeviceRepository {
     private db: Database;
     private logger: Logger;
+    // Told about rows changed by update() and removed by delete() (device null).
+    private onChangeCallback?: (id: string, device: Device | null) => void;
 
     constructor() {
         this.db = Database.getInstance();
         this.logger = Logger.getInstance();
     }
 
+    public setOnChangeCallback(callback: (id: string, device: Device | null) => void) {
+        this.onChangeCallback = callback;
+    }
+
     public async add(deviceData: {
         name: string;
         type: string;
@@ -71,7 +84,7 @@ export class DeviceRepository {
                 where: { id },
                 data: deviceUpdateData,
             });
-            return new Device(
+            const updatedDevice = new Device(
                 updatedDevicePrisma.id, 
                 updatedDevicePrisma.name, 
                 updatedDevicePrisma.type, 
@@ -82,6 +95,8 @@ export class DeviceRepository {
                 undefined, // mqttService is optional
                 updatedDevicePrisma.firmwareVersion || undefined // Pass firmwareVersion
             );
+            this.onChangeCallback?.(id, updatedDevice);
+            return updatedDevice;
         } catch (error) {
             this.logger.logError(`Error updating device ${id}: ${error}`);
             return null;
@@ -91,6 +106,7 @@ export class DeviceRepository {
     public async delete(id: string): Promise<boolean> {
         try {
             await this.db.device.delete({ where: { id } });
+            this.onChangeCallback?.(id, null);
             return true;
         } catch (error) {
             this.logger.logError(`Error deleting device ${id}: ${error}`);
@@ -98,6 +114,44 @@ export class DeviceRepository {
         }
     }
 
+    /*
+     * Writes what many devices reported in one statement. Each state is merged
+     * into lastKnownState like { ...lastKnownState, ...state }, in the database,
+     * so keys written meanwhile by update() are kept; rows deleted meanwhile are
+     * skipped. The change callback is not called, the caller has the state.
+     * Returns the number of rows written, -1 on an error.
+     */
+    public async applyStates(patches: Map<string, DeviceStatePatch>): Promise<number> {
+        const ids: string[] = [];
+        const states: string[] = [];
+        const statuses: (boolean | null)[] = [];
+        const firmwareVersions: (string | null)[] = [];
+        for (const [id, patch] of patches) {
+            ids.push(id);
+            states.push(JSON.stringify(patch.state));
+            statuses.push(patch.status ?? null);
+            firmwareVersions.push(patch.firmwareVersion ?? null);
+        }
+        if (ids.length === 0) {
+            return 0;
+        }
+        try {
+            return await this.db.executeRaw(Prisma.sql`
+                UPDATE "Device" AS d SET
+                    "lastKnownState" = (CASE WHEN jsonb_typeof(d."lastKnownState") = 'object'
+                                        THEN d."lastKnownState" ELSE '{}'::jsonb END) || v.state,
+                    "status" = COALESCE(v.status, d."status"),
+                    "firmwareVersion" = COALESCE(v.firmware_version, d."firmwareVersion"),
+                    "updatedAt" = NOW()
+                FROM UNNEST(${ids}::text[], ${states}::jsonb[], ${statuses}::boolean[], ${firmwareVersions}::text[])
+                    AS v(id, state, status, firmware_version)
+                WHERE d."id" = v.id`);
+        } catch (error) {
+            this.logger.logError(`Error writing the state of ${ids.length} devices: ${error}`);
+            return -1;
+        }
+    }
+
     public async findById(id: string): Promise<Device | null> {
         try {
             const devicePrisma = await this.db.device.findUnique({ where: { id } });
@@ -128,6 +128,162 @@ export function createDeviceRouter(
         deviceController.getDeviceById.bind(deviceController)
     );
 
+    /**
+     * @swagger
+     * /devices/{deviceId}/metrics:
+     *   get:
+     *     summary: Get the latest health metrics of a device
+     *     description: >
+     *       Counters since boot, rates and latency percentiles over the last
+     *       snapshot period, and gauges (heap, RSSI, queue depths), from the
+     *       snapshots the device publishes on home/devices/{deviceId}/telemetry/metrics.
+     *     tags: [Devices]
+     *     security:
+     *       - bearerAuth: []
+     *     parameters:
+     *       - in: path
+     *         name: deviceId
+     *         required: true
+     *         schema:
+     *           type: string
+     *           format: uuid
+     *     responses:
+     *       200:
+     *         description: Device metrics
+     *       401:
+     *         description: Unauthorized
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     *       403:
+     *         description: Forbidden (not owner or admin)
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     *       404:
+     *         description: Device not found or no metrics received yet
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     */
+    router.get(
+        '/:deviceId/metrics',
+        attachContextMiddleware.attachDevice.bind(attachContextMiddleware),
+        deviceController.getDeviceMetrics.bind(deviceController)
+    );
+
+    /**
+     * @swagger
+     * /devices/{deviceId}/commands/latency:
+     *   get:
+     *     summary: Get the command delivery statistics of a device
+     *     description: >
+     *       Commands sent, applied, failed, dropped as redeliveries and timed out,
+     *       with percentiles of the round trip (publish to ack, in ms) and of the
+     *       device receive-to-actuate time (in us) over the last acked commands,
+     *       from the acks the device publishes on home/devices/{deviceId}/ack.
+     *     tags: [Devices]
+     *     security:
+     *       - bearerAuth: []
+     *     parameters:
+     *       - in: path
+     *         name: deviceId
+     *         required: true
+     *         schema:
+     *           type: string
+     *           format: uuid
+     *     responses:
+     *       200:
+     *         description: Command delivery statistics
+     *       401:
+     *         description: Unauthorized
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     *       403:
+     *         description: Forbidden (not owner or admin)
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     *       404:
+     *         description: Device not found or no commands sent yet
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     */
+    router.get(
+        '/:deviceId/commands/latency',
+        attachContextMiddleware.attachDevice.bind(attachContextMiddleware),
+        deviceController.getCommandLatency.bind(deviceController)
+    );
+
+    /**
+     * @swagger
+     * /devices/{deviceId}/ota:
+     *   post:
+     *     summary: Start a firmware update of a device
+     *     description: >
+     *       Streams the image <OTA_IMAGE_DIR>/{version}.bin to the device over
+     *       MQTT, as a delta against the firmware the device runs when that is
+     *       smaller. The device checks the image and restarts into it.
+     *     tags: [Devices]
+     *     security:
+     *       - bearerAuth: []
+     *     parameters:
+     *       - in: path
+     *         name: deviceId
+     *         required: true
+     *         schema:
+     *           type: string
+     *           format: uuid
+     *     requestBody:
+     *       required: true
+     *       content:
+     *         application/json:
+     *           schema:
+     *             type: object
+     *             required: [version]
+     *             properties:
+     *               version: { type: string, example: '1.2.0' }
+     *     responses:
+     *       202:
+     *         description: Update started
+     *       400:
+     *         description: Missing or unknown version, or the device already runs it
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     *       401:
+     *         description: Unauthorized
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     *       403:
+     *         description: Forbidden (not owner or admin)
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     *       404:
+     *         description: Device not found
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     *   get:
+     *     summary: Get the progress of the last firmware update of a device
+     *     tags: [Devices]
+     *     security:
+     *       - bearerAuth: []
+     *     parameters:
+     *       - in: path
+     *         name: deviceId
+     *         required: true
+     *         schema:
+     *           type: string
+     *           format: uuid
+     *     responses:
+     *       200:
+     *         description: Stream and image sizes, offsets sent and confirmed, and state
+     *       401:
+     *         description: Unauthorized
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     *       403:
+     *         description: Forbidden (not owner or admin)
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     *       404:
+     *         description: Device not found or no update started
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     */
+    router.post(
+        '/:deviceId/ota',
+        attachContextMiddleware.attachDevice.bind(attachContextMiddleware),
+        deviceController.startOta.bind(deviceController)
+    );
+    router.get(
+        '/:deviceId/ota',
+        attachContextMiddleware.attachDevice.bind(attachContextMiddleware),
+        deviceController.getOta.bind(deviceController)
+    );
+
     /**
      * @swagger
      * /devices/{deviceId}/command:
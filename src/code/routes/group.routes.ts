@@ -0,0 +1,248 @@
+import { Router } from 'express';
+import { GroupController } from '../controllers';
+import { AuthMiddleware, AttachContextMiddleware } from '../middlewares';
+
+/**
+ * @swagger
+ * tags:
+ *   name: Groups
+ *   description: Device groups switched with one message per group
+ */
+export function createGroupRouter(
+    groupController: GroupController,
+    authMiddleware: AuthMiddleware,
+    attachContextMiddleware: AttachContextMiddleware
+): Router {
+    const router = Router();
+
+    // All group routes require authentication
+    router.use(authMiddleware.authenticateToken.bind(authMiddleware));
+    // Attach full user context after authentication
+    router.use(attachContextMiddleware.attachFullUser.bind(attachContextMiddleware));
+
+    /**
+     * @swagger
+     * /groups:
+     *   post:
+     *     summary: Create a device group
+     *     tags: [Groups]
+     *     security:
+     *       - bearerAuth: []
+     *     requestBody:
+     *       required: true
+     *       content:
+     *         application/json:
+     *           schema:
+     *             type: object
+     *             required:
+     *               - name
+     *             properties:
+     *               name: { type: string, example: 'Living Room' }
+     *     responses:
+     *       201:
+     *         description: Group created successfully
+     *       400:
+     *         description: Missing group name
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     *       401:
+     *         description: Unauthorized
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     */
+    router.post(
+        '/',
+        groupController.createGroup.bind(groupController)
+    );
+
+    /**
+     * @swagger
+     * /groups:
+     *   get:
+     *     summary: List groups of the authenticated user (or all if admin)
+     *     tags: [Groups]
+     *     security:
+     *       - bearerAuth: []
+     *     responses:
+     *       200:
+     *         description: A list of groups with their device IDs
+     *       401:
+     *         description: Unauthorized
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     */
+    router.get(
+        '/',
+        groupController.listGroups.bind(groupController)
+    );
+
+    /**
+     * @swagger
+     * /groups/{groupId}:
+     *   delete:
+     *     summary: Delete a group, removing every device from it
+     *     tags: [Groups]
+     *     security:
+     *       - bearerAuth: []
+     *     parameters:
+     *       - in: path
+     *         name: groupId
+     *         required: true
+     *         schema: { type: string }
+     *     responses:
+     *       204:
+     *         description: Group deleted successfully (No Content)
+     *       403:
+     *         description: Forbidden (not owner or admin)
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     *       404:
+     *         description: Group not found
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     */
+    router.delete(
+        '/:groupId',
+        groupController.deleteGroup.bind(groupController)
+    );
+
+    /**
+     * @swagger
+     * /groups/{groupId}/devices/{deviceId}:
+     *   put:
+     *     summary: Add a device to a group
+     *     description: Sends the group key to the device, which subscribes to the group topic.
+     *     tags: [Groups]
+     *     security:
+     *       - bearerAuth: []
+     *     parameters:
+     *       - in: path
+     *         name: groupId
+     *         required: true
+     *         schema: { type: string }
+     *       - in: path
+     *         name: deviceId
+     *         required: true
+     *         schema: { type: string, format: uuid }
+     *     responses:
+     *       200:
+     *         description: Device added
+     *       403:
+     *         description: Forbidden (group or device not owned)
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     *       404:
+     *         description: Group or device not found
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     */
+    router.put(
+        '/:groupId/devices/:deviceId',
+        groupController.addDevice.bind(groupController)
+    );
+
+    /**
+     * @swagger
+     * /groups/{groupId}/devices/{deviceId}:
+     *   delete:
+     *     summary: Remove a device from a group
+     *     tags: [Groups]
+     *     security:
+     *       - bearerAuth: []
+     *     parameters:
+     *       - in: path
+     *         name: groupId
+     *         required: true
+     *         schema: { type: string }
+     *       - in: path
+     *         name: deviceId
+     *         required: true
+     *         schema: { type: string, format: uuid }
+     *     responses:
+     *       200:
+     *         description: Device removed
+     *       403:
+     *         description: Forbidden (not owner or admin)
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     *       404:
+     *         description: Group not found
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     */
+    router.delete(
+        '/:groupId/devices/:deviceId',
+        groupController.removeDevice.bind(groupController)
+    );
+
+    /**
+     * @swagger
+     * /groups/{groupId}/command:
+     *   post:
+     *     summary: Send a command to every device of a group
+     *     description: Published once on home/groups/{groupId}/command/{commandName}.
+     *     tags: [Groups]
+     *     security:
+     *       - bearerAuth: []
+     *     parameters:
+     *       - in: path
+     *         name: groupId
+     *         required: true
+     *         schema: { type: string }
+     *     requestBody:
+     *       required: true
+     *       content:
+     *         application/json:
+     *           schema:
+     *             type: object
+     *             required:
+     *               - commandName
+     *               - payload
+     *             properties:
+     *               commandName: { type: string, example: 'setLed' }
+     *               payload: { type: object, example: { state: 1 } }
+     *     responses:
+     *       202:
+     *         description: Command accepted for sending
+     *       400:
+     *         description: Missing commandName or payload
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     *       404:
+     *         description: Group not found
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     */
+    router.post(
+        '/:groupId/command',
+        groupController.sendCommand.bind(groupController)
+    );
+
+    /**
+     * @swagger
+     * /groups/{groupId}/scene:
+     *   post:
+     *     summary: Set channel levels on every device of a group
+     *     description: Each device applies the channels it has in one step and ignores the others.
+     *     tags: [Groups]
+     *     security:
+     *       - bearerAuth: []
+     *     parameters:
+     *       - in: path
+     *         name: groupId
+     *         required: true
+     *         schema: { type: string }
+     *     requestBody:
+     *       required: true
+     *       content:
+     *         application/json:
+     *           schema:
+     *             type: object
+     *             additionalProperties: true
+     *             example: { light: true, fan: 40 }
+     *     responses:
+     *       202:
+     *         description: Scene accepted for sending
+     *       400:
+     *         description: Missing channel levels
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     *       404:
+     *         description: Group not found
+     *         content: { application/json: { schema: { $ref: '#/components/schemas/ErrorResponse' } } }
+     */
+    router.post(
+        '/:groupId/scene',
+        groupController.applyScene.bind(groupController)
+    );
+
+    return router;
+}
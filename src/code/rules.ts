@@ -0,0 +1,249 @@
+/*
+    * Home Control Hub
+    *
+    * This file contains the rule compiler for the Home Control Hub application.
+    * Automation rules whose condition only reads the telemetry of the device they
+    * act on are compiled into a program for the device rule engine
+    * (iotdevice/main/hal/rule_engine.h), which evaluates them locally instead of
+    * waiting for a round trip through the backend.
+    *
+*/
+
+import { Command } from './entities';
+
+export const RULE_PROGRAM_VERSION = 1;
+const RULE_HEADER_LEN = 12;
+const RULE_NAME_MAX_LEN = 255;
+const RULE_LEVEL_MAX = 100;
+// Must match RULE_ENGINE_STACK_DEPTH on the device.
+const RULE_STACK_DEPTH = 16;
+
+enum RuleOp {
+    PUSH = 0x01,
+    LOAD = 0x02,
+    GT = 0x10,
+    GE = 0x11,
+    LT = 0x12,
+    LE = 0x13,
+    EQ = 0x14,
+    NE = 0x15,
+    AND = 0x20,
+    OR = 0x21,
+    NOT = 0x22,
+}
+
+const COMPARISONS: Record<string, RuleOp> = {
+    '>': RuleOp.GT,
+    '>=': RuleOp.GE,
+    '<': RuleOp.LT,
+    '<=': RuleOp.LE,
+    '==': RuleOp.EQ,
+    '===': RuleOp.EQ,
+    '!=': RuleOp.NE,
+    '!==': RuleOp.NE,
+};
+
+export interface RuleAction {
+    channel: string;
+    level: number;
+}
+
+export interface CompilableRule {
+    id: string;
+    condition: string;
+    actions: RuleAction[];
+}
+
+export interface RuleProgram {
+    programId: number;
+    bytes: Buffer;
+    // Rule IDs in program order; firing reports refer to rules by index.
+    ruleIds: string[];
+}
+
+/*
+ * Condition grammar, a subset of the JavaScript expressions the backend used to evaluate:
+ *   or      := and ('||' and)*
+ *   and     := unary ('&&' unary)*
+ *   unary   := '!' unary | compare
+ *   compare := operand (('>' | '>=' | '<' | '<=' | '==' | '===' | '!=' | '!==') operand)?
+ *   operand := 'payload.' key | number | 'true' | 'false' | '(' or ')'
+ */
+class ConditionParser {
+    private readonly tokens: string[];
+    private pos = 0;
+    private depth = 0;
+    private maxDepth = 0;
+    private readonly code: number[] = [];
+
+    constructor(condition: string, private readonly symbols: Map<string, number>) {
+        const tokens = condition.match(/\s*(payload\.\w+|-?\d+(?:\.\d+)?(?:[eE][-+]?\d+)?|true|false|===|!==|==|!=|>=|<=|&&|\|\||[<>!()]|\S)/g) ?? [];
+        this.tokens = tokens.map(token => token.trim());
+    }
+
+    public parse(): number[] {
+        this.parseOr();
+        if (this.pos !== this.tokens.length) {
+            throw new Error(`Unexpected '${this.tokens[this.pos]}'`);
+        }
+        if (this.maxDepth > RULE_STACK_DEPTH) {
+            throw new Error(`Condition needs ${this.maxDepth} stack slots, the device has ${RULE_STACK_DEPTH}`);
+        }
+        return this.code;
+    }
+
+    private peek(): string | undefined {
+        return this.tokens[this.pos];
+    }
+
+    private emit(op: RuleOp, stackChange: number, ...operand: number[]): void {
+        this.code.push(op, ...operand);
+        this.depth += stackChange;
+        this.maxDepth = Math.max(this.maxDepth, this.depth);
+    }
+
+    private parseOr(): void {
+        this.parseAnd();
+        while (this.peek() === '||') {
+            this.pos++;
+            this.parseAnd();
+            this.emit(RuleOp.OR, -1);
+        }
+    }
+
+    private parseAnd(): void {
+        this.parseUnary();
+        while (this.peek() === '&&') {
+            this.pos++;
+            this.parseUnary();
+            this.emit(RuleOp.AND, -1);
+        }
+    }
+
+    private parseUnary(): void {
+        if (this.peek() === '!') {
+            this.pos++;
+            this.parseUnary();
+            this.emit(RuleOp.NOT, 0);
+            return;
+        }
+        this.parseOperand();
+        const op = COMPARISONS[this.peek() ?? ''];
+        if (op !== undefined) {
+            this.pos++;
+            this.parseOperand();
+            this.emit(op, -1);
+        }
+    }
+
+    private parseOperand(): void {
+        const token = this.tokens[this.pos++];
+        if (token === undefined) {
+            throw new Error('Unexpected end of condition');
+        }
+        if (token === '(') {
+            this.parseOr();
+            if (this.tokens[this.pos++] !== ')') {
+                throw new Error("Missing ')'");
+            }
+        } else if (token.startsWith('payload.')) {
+            const key = token.slice('payload.'.length);
+            if (!this.symbols.has(key)) {
+                this.symbols.set(key, this.symbols.size);
+            }
+            this.emit(RuleOp.LOAD, 1, this.symbols.get(key)!);
+        } else if (token === 'true' || token === 'false' || /^-?\d/.test(token)) {
+            const value = token === 'true' ? 1 : token === 'false' ? 0 : Number(token);
+            const constant = Buffer.alloc(4);
+            constant.writeFloatLE(value);
+            this.emit(RuleOp.PUSH, 1, ...constant);
+        } else {
+            throw new Error(`Unexpected '${token}'`);
+        }
+    }
+}
+
+export class RuleCompiler {
+    /*
+     * Maps a rule command onto device outputs, or null if the device rule
+     * engine cannot run it: setLed drives the "led" channel, and any command
+     * with a { channel, level } payload drives that actuator channel.
+     */
+    public static toActions(command: Command): RuleAction[] | null {
+        const payload = command.payload ?? {};
+        if (typeof payload.channel === 'string' && Number.isInteger(payload.level) &&
+            payload.level >= 0 && payload.level <= RULE_LEVEL_MAX) {
+            return [{ channel: payload.channel, level: payload.level }];
+        }
+        if (command.name === 'setLed' && typeof payload.state === 'boolean') {
+            return [{ channel: 'led', level: payload.state ? 1 : 0 }];
+        }
+        return null;
+    }
+
+    /*
+     * Compiles one condition on its own, e.g. to check a rule before storing it.
+     * Throws with the reason if the device rule engine cannot run it.
+     */
+    public static compileCondition(condition: string): number[] {
+        return new ConditionParser(condition, new Map()).parse();
+    }
+
+    /*
+     * Program layout: see iotdevice/main/hal/rule_engine.h. The program ID is
+     * a hash of the rest of the program, so compiling the same rules again
+     * gives the same ID and devices can report which program they run.
+     */
+    public static compile(rules: CompilableRule[]): RuleProgram {
+        const symbols = new Map<string, number>();
+        const channels = new Map<string, number>();
+        const bodies: Buffer[] = [];
+
+        for (const rule of rules) {
+            const code = new ConditionParser(rule.condition, symbols).parse();
+            const actions: number[] = [];
+            for (const action of rule.actions) {
+                if (!Number.isInteger(action.level) || action.level < 0 || action.level > RULE_LEVEL_MAX) {
+                    throw new Error(`Rule ${rule.id}: level ${action.level} out of range 0..${RULE_LEVEL_MAX}`);
+                }
+                if (!channels.has(action.channel)) {
+                    channels.set(action.channel, channels.size);
+                }
+                actions.push(channels.get(action.channel)!, action.level);
+            }
+            const body = Buffer.alloc(2 + code.length + 1 + actions.length);
+            body.writeUInt16LE(code.length, 0);
+            Buffer.from(code).copy(body, 2);
+            body[2 + code.length] = rule.actions.length;
+            Buffer.from(actions).copy(body, 3 + code.length);
+            bodies.push(body);
+        }
+
+        const names = [...symbols.keys(), ...channels.keys()].map(name => {
+            const bytes = Buffer.from(name, 'utf8');
+            if (bytes.length === 0 || bytes.length > RULE_NAME_MAX_LEN) {
+                throw new Error(`Name '${name}' must be 1..${RULE_NAME_MAX_LEN} bytes`);
+            }
+            return Buffer.concat([Buffer.from([bytes.length]), bytes]);
+        });
+        const header = Buffer.alloc(RULE_HEADER_LEN);
+        header.write('HR', 0, 'latin1');
+        header[2] = RULE_PROGRAM_VERSION;
+        header[8] = symbols.size;
+        header[9] = channels.size;
+        header[10] = rules.length;
+        const bytes = Buffer.concat([header, ...names, ...bodies]);
+        const programId = RuleCompiler.hash(bytes.subarray(8));
+        bytes.writeUInt32LE(programId, 4);
+        return { programId, bytes, ruleIds: rules.map(rule => rule.id) };
+    }
+
+    // FNV-1a reduced to 1..999999: the device reports the ID as a telemetry value, printed with 6 digits.
+    private static hash(data: Buffer): number {
+        let hash = 0x811c9dc5;
+        for (const byte of data) {
+            hash = Math.imul(hash ^ byte, 0x01000193) >>> 0;
+        }
+        return (hash % 999999) + 1;
+    }
+}
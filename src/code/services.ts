@@ -6,14 +6,21 @@
     *
 */
 
-import { User, Device, Command } from './entities';
+import { User, Device, Command, DeviceGroup } from './entities';
 import { Config, Logger, Database } from './infrastructure';
-import { UserRepository, DeviceRepository } from './repositories';
+import { UserRepository, DeviceRepository, DeviceStatePatch } from './repositories';
 import * as jwt from 'jsonwebtoken';
 import * as bcrypt from 'bcryptjs';
 import * as MQTT from 'mqtt';
 import * as crypto from 'crypto';
-import { UserRole_ENUM } from './enums';
+import { performance } from 'perf_hooks';
+import { UserRole_ENUM, PayloadEncoding_ENUM } from './enums';
+import { PayloadCodec } from './codec';
+import { RuleCompiler, RuleProgram, CompilableRule } from './rules';
+import { DeltaEncoder } from './ota';
+import * as fs from 'fs';
+import * as path from 'path';
+import * as dgram from 'dgram';
 
 const SALT_ROUNDS = 10;
 
@@ -125,6 +132,10 @@ export class MQTTConnection {
                 clientId: `home_control_hub_server_${crypto.randomBytes(8).toString('hex')}`,
                 clean: true, 
             };
+            // A self-signed broker, e.g. the compose Mosquitto on mqtts://localhost:8884.
+            if (this.config.getMqttCaFile()) {
+                options.ca = fs.readFileSync(this.config.getMqttCaFile());
+            }
             this.client = MQTT.connect(brokerUrl, options);
 
             this.client.on('connect', () => {
@@ -204,110 +215,559 @@ export class MQTTConnection {
 }
 
 export class MQTTService {
+    // Messages in a row in the other encoding before commands follow it, see noteEncoding().
+    private static readonly ENCODING_SWITCH_MESSAGES = 5;
     private mqttConnection: MQTTConnection;
     private deviceRepository: DeviceRepository;
     private encryptionService: EncryptionService;
     private automationService!: AutomationService;
+    private groupService?: GroupService;
+    private metricsService?: MetricsService;
+    private commandAckService?: CommandAckService;
+    private otaService?: OtaService;
     private logger: Logger;
+    // Encoding each device publishes with; commands are sent back in the same encoding.
+    private deviceEncodings: Map<string, PayloadEncoding_ENUM> = new Map();
+    private encodingChanges: Map<string, number> = new Map();
+    // LAN listener each device announced on home/devices/<id>/lan, see hal/lan_listener.h.
+    private lanAddresses: Map<string, { address: string; port: number }> = new Map();
+    private lanSocket?: dgram.Socket;
+    // Last shadow version and unmet desired levels per device, see applyShadow().
+    private shadowVersions: Map<string, number> = new Map();
+    private shadowDesired: Map<string, Record<string, number>> = new Map();
+    // Devices by ID as read from the database, with what they reported since:
+    // messages, rules and commands look devices up here, see getDevice(). Kept
+    // in step with DeviceRepository.update() and delete() by onDeviceChanged().
+    private devices: Map<string, Device> = new Map();
+    private deviceLookups: Map<string, Promise<Device | null>> = new Map();
+    // Reported state not in the database yet, and the batch being written.
+    private pendingStates: Map<string, DeviceStatePatch> = new Map();
+    private flushingStates: Map<string, DeviceStatePatch> = new Map();
+    private flushing?: Promise<void>;
+    private flushTimer?: NodeJS.Timeout;
+    private flushMs: number;
+    // Ingest counters since the last home/backend/stats message.
+    private ingest = { received: 0, processed: 0, failed: 0, writes: 0, devicesWritten: 0, handlerMs: new LatencyWindow(1024) };
 
     constructor(mqttConnection: MQTTConnection, deviceRepository: DeviceRepository, encryptionService: EncryptionService) {
         this.mqttConnection = mqttConnection;
         this.deviceRepository = deviceRepository;
         this.encryptionService = encryptionService;
         this.logger = Logger.getInstance();
+        this.flushMs = Config.getInstance().getIngestFlushMs();
+        this.deviceRepository.setOnChangeCallback((id, device) => this.onDeviceChanged(id, device));
     }
     
     public setAutomationService(automationService: AutomationService) {
         this.automationService = automationService;
     }
 
+    public setGroupService(groupService: GroupService) {
+        this.groupService = groupService;
+    }
+
+    public setMetricsService(metricsService: MetricsService) {
+        this.metricsService = metricsService;
+    }
+
+    public setCommandAckService(commandAckService: CommandAckService) {
+        this.commandAckService = commandAckService;
+    }
+
+    public setOtaService(otaService: OtaService) {
+        this.otaService = otaService;
+    }
+
     public async initialize(): Promise<void> {
         await this.mqttConnection.connect();
         this.mqttConnection.setOnMessageCallback(this.handleIncomingMessage.bind(this));
         await this.mqttConnection.subscribe('home/devices/+/status');
         await this.mqttConnection.subscribe('home/devices/+/telemetry');
         await this.mqttConnection.subscribe('home/devices/+/telemetry/firmwareVersion');
+        await this.mqttConnection.subscribe('home/devices/+/telemetry/metrics');
+        await this.mqttConnection.subscribe('home/devices/+/boot');
+        await this.mqttConnection.subscribe('home/devices/+/rules/fired');
+        await this.mqttConnection.subscribe('home/devices/+/ack');
+        await this.mqttConnection.subscribe('home/devices/+/ota/progress');
+        if (Config.getInstance().getLanCommands()) {
+            await this.mqttConnection.subscribe('home/devices/+/lan');
+        }
         this.logger.logInfo('MQTTService initialized and subscribed to device topics.');
+
+        const statsIntervalMs = Config.getInstance().getMqttStatsIntervalMs();
+        if (statsIntervalMs > 0) {
+            setInterval(() => this.publishIngestStats(statsIntervalMs), statsIntervalMs).unref();
+        }
+    }
+
+    /*
+     * Stops taking device messages and writes the reported state still queued,
+     * before the process exits; the database must still be connected.
+     */
+    public async shutdown(): Promise<void> {
+        this.mqttConnection.disconnect();
+        await this.flushDeviceStates();
+        this.logger.logInfo('MQTTService stopped, reported state written.');
+    }
+
+    /*
+     * Ingest rate and handler time over the last interval, with the fleet
+     * command round trip, on home/backend/stats in plain JSON. Read by the
+     * fleet simulator (iotdevice/tools/fleet_sim) during load tests.
+     */
+    private publishIngestStats(intervalMs: number): void {
+        const stats = {
+            intervalMs,
+            received: this.ingest.received,
+            processed: this.ingest.processed,
+            failed: this.ingest.failed,
+            ingestPerS: Math.round(this.ingest.processed * 1000 / intervalMs),
+            handlerMs: this.ingest.handlerMs.summarize(2),
+            stateWrites: this.ingest.writes,
+            devicesWritten: this.ingest.devicesWritten,
+            ...this.commandAckService?.getFleetSummary(),
+        };
+        this.ingest = { received: 0, processed: 0, failed: 0, writes: 0, devicesWritten: 0, handlerMs: new LatencyWindow(1024) };
+        this.mqttConnection.publish('home/backend/stats', JSON.stringify(stats), { qos: 0, retain: false }).catch(() => {});
     }
 
     private async handleIncomingMessage(topic: string, message: Buffer): Promise<void> {
+        const start = performance.now();
+        this.ingest.received++;
+        if (await this.processMessage(topic, message)) {
+            this.ingest.processed++;
+        } else {
+            this.ingest.failed++;
+        }
+        this.ingest.handlerMs.add(performance.now() - start);
+    }
+
+    // false if the message was dropped or its handling failed.
+    private async processMessage(topic: string, message: Buffer): Promise<boolean> {
         this.logger.logInfo(`MQTTService handling message from topic: ${topic}`);
         const topicParts = topic.split('/');
         if (topicParts.length < 4 || topicParts[0] !== 'home' || topicParts[1] !== 'devices') {
             this.logger.logWarn(`Received message on unknown topic structure: ${topic}`);
-            return;
+            return false;
         }
         const deviceId = topicParts[2];
         const messageType = topicParts[3];
         const subMessageType = topicParts.length > 4 ? topicParts[4] : null;
 
-        const device = await this.deviceRepository.findById(deviceId);
+        const device = await this.getDevice(deviceId);
         if (!device) {
             this.logger.logWarn(`Received MQTT message for unknown device ID: ${deviceId} on topic ${topic}`);
-            return;
+            return false;
         }
 
-        const decryptedPayloadString = this.encryptionService.decrypt(message.toString('utf-8'), device.aesKey);
-        if (!decryptedPayloadString) {
+        const decryptedPayload = this.encryptionService.decryptToBuffer(message.toString('utf-8'), device.aesKey);
+        if (!decryptedPayload) {
             this.logger.logError(`Failed to decrypt message from device ${deviceId} on topic ${topic}`);
-            return;
+            return false;
         }
 
         try {
-            const payload = JSON.parse(decryptedPayloadString);
+            const { payload, encoding } = PayloadCodec.decode(decryptedPayload);
+            this.noteEncoding(deviceId, encoding, messageType === 'boot');
             this.logger.logInfo(`Decrypted data from ${deviceId} (${messageType}${subMessageType ? '/' + subMessageType : ''}): ${JSON.stringify(payload)}`);
             
             let updated = false;
-            if (messageType === 'status') {
-                if (typeof payload.status === 'boolean') {
-                    await this.deviceRepository.update(deviceId, { status: payload.status, lastKnownState: payload as any });
-                    updated = true;
-                } else {
-                     await this.deviceRepository.update(deviceId, { lastKnownState: payload as any });
-                     updated = true;
+            let triggeringPayload = payload;
+            if (messageType === 'status' && typeof payload.version === 'number') {
+                const reported = this.applyShadow(device, payload);
+                updated = reported !== null;
+                triggeringPayload = reported ?? payload;
+            } else if (messageType === 'status') {
+                this.reportState(device, payload, typeof payload.status === 'boolean' ? { status: payload.status } : {});
+                updated = true;
+            } else if (messageType === 'telemetry' && subMessageType === 'metrics') {
+                // Device health, kept apart from the device state and the automation rules.
+                if (this.metricsService) {
+                    this.metricsService.ingest(deviceId, payload);
                 }
             } else if (messageType === 'telemetry') {
                 if (subMessageType === 'firmwareVersion' && typeof payload.version === 'string') {
-                    await this.deviceRepository.update(deviceId, { firmwareVersion: payload.version, lastKnownState: device.lastKnownState });
+                    this.reportState(device, {}, { firmwareVersion: payload.version });
                     updated = true;
                 } else {
-                    await this.deviceRepository.update(deviceId, { lastKnownState: payload as any });
+                    this.reportState(device, payload);
                     updated = true;
                 }
+            } else if (messageType === 'boot') {
+                // Published once per boot: microseconds from power-on to each phase.
+                const phases = (payload.phasesUs ?? {}) as Record<string, number>;
+                const summary = Object.entries(phases).map(([phase, us]) => `${phase}=${(us / 1000).toFixed(1)}ms`).join(' ');
+                this.logger.logInfo(`Device ${deviceId} boot profile: ${summary} flags=${payload.flags}`);
+                if (this.automationService) {
+                    await this.automationService.pushRulesToDevice(deviceId);
+                }
+                if (this.groupService) {
+                    await this.groupService.pushMembershipsToDevice(deviceId);
+                }
+                if (this.otaService) {
+                    await this.otaService.resumeAfterBoot(deviceId);
+                }
+            } else if (messageType === 'rules' && subMessageType === 'fired') {
+                if (this.automationService) {
+                    this.automationService.handleRuleFirings(device, payload);
+                }
+            } else if (messageType === 'ack') {
+                if (this.commandAckService) {
+                    this.commandAckService.handleAcks(deviceId, payload);
+                }
+            } else if (messageType === 'ota' && subMessageType === 'progress') {
+                if (this.otaService) {
+                    await this.otaService.handleProgress(deviceId, payload);
+                }
+            } else if (messageType === 'lan') {
+                this.setLanAddress(deviceId, payload);
             } else {
                 this.logger.logWarn(`Unhandled message type '${messageType}' from device ${deviceId}`);
             }
 
+            // The cached device already has the state of this message.
             if (updated && this.automationService) {
-                const freshDeviceState = await this.deviceRepository.findById(deviceId);
-                if (freshDeviceState) {
-                    await this.automationService.executeRulesForDevice(freshDeviceState, payload);
+                await this.automationService.executeRulesForDevice(device, triggeringPayload);
+            }
+            return true;
+        } catch (error) {
+            const encoding = PayloadCodec.detect(decryptedPayload);
+            const printable = encoding === PayloadEncoding_ENUM.CBOR ? decryptedPayload.toString('hex') : decryptedPayload.toString('utf-8');
+            this.logger.logError(`Error processing decrypted message from ${deviceId}: ${error}. Payload (${encoding}): ${printable}`);
+            return false;
+        }
+    }
+
+    /*
+     * Versioned device shadow on home/devices/<id>/status, see hal/device_shadow.h:
+     *   { version, full?, reported: { <channel>: level }, desired: { <channel>: level } }
+     * Only changed channels are sent; they are merged into lastKnownState. A
+     * missed version (or a backend restart) asks the device for a full
+     * snapshot. Returns the reported levels that changed, null if none did.
+     */
+    private applyShadow(device: Device, payload: any): Record<string, number> | null {
+        const known = this.shadowVersions.get(device.id);
+        const full = payload.full === true;
+        if (!full && known === payload.version) {
+            // Retained message redelivered on resubscribe.
+            return null;
+        }
+        if (!full && (known === undefined || payload.version !== known + 1)) {
+            this.logger.logWarn(`Device ${device.id} shadow version ${payload.version} after ${known ?? 'none'}, requesting a snapshot`);
+            this.publishToDevice(device, 'shadow/get', {}, false).catch(() => {});
+        }
+        this.shadowVersions.set(device.id, payload.version);
+
+        const reported: Record<string, number> = payload.reported ?? {};
+        const desired = { ...(full ? {} : this.shadowDesired.get(device.id)), ...payload.desired };
+        // A desired level is only sent while it differs from the reported
+        // one, and once more when they agree again.
+        for (const [channel, level] of Object.entries(desired)) {
+            if ((reported[channel] ?? device.lastKnownState?.[channel]) === level) {
+                delete desired[channel];
+            }
+        }
+        if (Object.keys(desired).length > 0) {
+            this.shadowDesired.set(device.id, desired);
+        } else {
+            this.shadowDesired.delete(device.id);
+        }
+
+        const changed: Record<string, number> = {};
+        for (const [channel, level] of Object.entries(reported)) {
+            if (device.lastKnownState?.[channel] !== level) {
+                changed[channel] = level;
+            }
+        }
+        if (Object.keys(changed).length === 0) {
+            return null;
+        }
+        this.reportState(device, changed);
+        return changed;
+    }
+
+    /*
+     * The device from the cache, read from the database on a miss. Concurrent
+     * misses for one device share the read. Unknown IDs are not cached.
+     */
+    public async getDevice(deviceId: string): Promise<Device | null> {
+        const cached = this.devices.get(deviceId);
+        if (cached) {
+            return cached;
+        }
+        let lookup = this.deviceLookups.get(deviceId);
+        if (!lookup) {
+            const read: Promise<Device | null> = this.deviceRepository.findById(deviceId).then(device => {
+                if (this.deviceLookups.get(deviceId) !== read) {
+                    // The row changed while it was read, onDeviceChanged() has the new one.
+                    return this.devices.get(deviceId) ?? null;
                 }
+                this.deviceLookups.delete(deviceId);
+                return device ? this.cacheDevice(device) : null;
+            });
+            this.deviceLookups.set(deviceId, read);
+            lookup = read;
+        }
+        return lookup;
+    }
+
+    // Row changed through the repository (e.g. the device API), null if deleted.
+    private onDeviceChanged(deviceId: string, device: Device | null): void {
+        this.deviceLookups.delete(deviceId);
+        if (device) {
+            this.cacheDevice(device);
+        } else {
+            this.devices.delete(deviceId);
+            this.pendingStates.delete(deviceId);
+            this.deviceEncodings.delete(deviceId);
+            this.encodingChanges.delete(deviceId);
+        }
+    }
+
+    /*
+     * The boot message is published in the encoding the firmware is built
+     * with, so it sets the encoding at once; so does the first message seen.
+     * Otherwise a device only switches after ENCODING_SWITCH_MESSAGES messages
+     * in a row in the other encoding, so a stray message does not flip it.
+     */
+    private noteEncoding(deviceId: string, encoding: PayloadEncoding_ENUM, boot: boolean): void {
+        const current = this.deviceEncodings.get(deviceId);
+        if (current === encoding) {
+            this.encodingChanges.delete(deviceId);
+            return;
+        }
+        const seen = (this.encodingChanges.get(deviceId) ?? 0) + 1;
+        if (current !== undefined && !boot && seen < MQTTService.ENCODING_SWITCH_MESSAGES) {
+            this.encodingChanges.set(deviceId, seen);
+            return;
+        }
+        this.logger.logInfo(`Device ${deviceId} now uses ${encoding} payloads`);
+        this.deviceEncodings.set(deviceId, encoding);
+        this.encodingChanges.delete(deviceId);
+    }
+
+    // A row read from the database, with what was reported and is not written yet.
+    private cacheDevice(device: Device): Device {
+        for (const patch of [this.flushingStates.get(device.id), this.pendingStates.get(device.id)]) {
+            if (patch) {
+                device.lastKnownState = { ...device.lastKnownState, ...patch.state };
+                device.status = patch.status ?? device.status;
+                device.firmwareVersion = patch.firmwareVersion ?? device.firmwareVersion;
             }
+        }
+        this.devices.set(device.id, device);
+        return device;
+    }
 
-        } catch (error) {
-            this.logger.logError(`Error processing decrypted message from ${deviceId}: ${error}. Payload: ${decryptedPayloadString}`);
+    /*
+     * What a device reported goes to the cached device at once, for the rules
+     * and the next messages, and to the database with the next flush: all the
+     * reports of a flush interval are one statement, and reports of one device
+     * are one row in it.
+     */
+    private reportState(device: Device, state: Record<string, any>, fields: { status?: boolean; firmwareVersion?: string } = {}): void {
+        device.lastKnownState = { ...device.lastKnownState, ...state };
+        device.status = fields.status ?? device.status;
+        device.firmwareVersion = fields.firmwareVersion ?? device.firmwareVersion;
+
+        const pending = this.pendingStates.get(device.id);
+        if (pending) {
+            Object.assign(pending.state, state);
+            pending.status = fields.status ?? pending.status;
+            pending.firmwareVersion = fields.firmwareVersion ?? pending.firmwareVersion;
+        } else {
+            this.pendingStates.set(device.id, { state: { ...state }, ...fields });
+        }
+        if (!this.flushTimer) {
+            this.flushTimer = setTimeout(() => this.flushDeviceStates(), this.flushMs);
         }
     }
 
+    /*
+     * Writes the reported state queued so far and waits for it, after a write
+     * already running. A failed write is queued again under the newer reports
+     * and retried after the flush interval.
+     */
+    public async flushDeviceStates(): Promise<void> {
+        while (this.flushing) {
+            await this.flushing;
+        }
+        clearTimeout(this.flushTimer);
+        this.flushTimer = undefined;
+        if (this.pendingStates.size === 0) {
+            return;
+        }
+        this.flushingStates = this.pendingStates;
+        this.pendingStates = new Map();
+        this.flushing = this.deviceRepository.applyStates(this.flushingStates).then(written => {
+            this.ingest.writes++;
+            if (written >= 0) {
+                this.ingest.devicesWritten += written;
+            } else {
+                for (const [deviceId, patch] of this.flushingStates) {
+                    const newer = this.pendingStates.get(deviceId);
+                    this.pendingStates.set(deviceId, {
+                        state: { ...patch.state, ...newer?.state },
+                        status: newer?.status ?? patch.status,
+                        firmwareVersion: newer?.firmwareVersion ?? patch.firmwareVersion,
+                    });
+                }
+            }
+            this.flushingStates = new Map();
+            this.flushing = undefined;
+            if (this.pendingStates.size > 0 && !this.flushTimer) {
+                this.flushTimer = setTimeout(() => this.flushDeviceStates(), this.flushMs);
+            }
+        });
+        await this.flushing;
+    }
+
+    // Desired levels the device reported it could not set, by device.
+    public getShadowDesired(deviceId: string): Record<string, number> {
+        return { ...this.shadowDesired.get(deviceId) };
+    }
+
     public async publishCommand(deviceId: string, commandName: string, payload: object): Promise<void> {
-        const device = await this.deviceRepository.findById(deviceId);
+        const device = await this.getDevice(deviceId);
         if (!device) {
             this.logger.logError(`Device ${deviceId} not found for publishing command.`);
             throw new Error(`Device ${deviceId} not found`);
         }
+        await this.publishToDevice(device, commandName, payload);
+    }
 
-        const messageString = JSON.stringify(payload);
-        const encryptedMessage = this.encryptionService.encrypt(messageString, device.aesKey);
+    /*
+     * Same as publishCommand() for a device already looked up. Unsequenced
+     * commands are neither deduplicated nor acked by the device; streams with
+     * their own flow control (OTA chunks) use them to keep acks off the wire.
+     */
+    public async publishToDevice(device: Device, commandName: string, payload: object, sequenced = true): Promise<void> {
+        const encoding = this.getDeviceEncoding(device.id);
+        const seq = sequenced ? this.nextSeq(payload) : 0;
+        const message = seq ? { ...payload, seq } : payload;
+        const encryptedMessage = this.encryptionService.encryptBuffer(PayloadCodec.encode(message, encoding), device.aesKey);
 
         if (!encryptedMessage) {
-            this.logger.logError(`Failed to encrypt command for device ${deviceId}`);
+            this.logger.logError(`Failed to encrypt command for device ${device.id}`);
             throw new Error("Encryption failed for command");
         }
 
-        const topic = `home/devices/${deviceId}/command/${commandName}`;
-        await this.mqttConnection.publish(topic, encryptedMessage);
-        this.logger.logInfo(`Published command '${commandName}' to ${topic}`);
+        const topic = `home/devices/${device.id}/command/${commandName}`;
+        if (seq) {
+            this.sendLan(device.id, topic, encryptedMessage);
+        }
+        await this.publishSequenced(topic, encryptedMessage, seq, [device.id]);
+        if (sequenced) {
+            this.logger.logInfo(`Published command '${commandName}' to ${topic} (${encoding}${seq ? ', seq ' + seq : ''})`);
+        }
+    }
+
+    /*
+     * One message for every member of the group: encoded and encrypted once,
+     * with the group key, and fanned out by the broker. No device lookups.
+     * CBOR is only used when every member is known to speak it.
+     */
+    public async publishGroupCommand(group: DeviceGroup, commandName: string, payload: object): Promise<void> {
+        let encoding = group.deviceIds.size > 0 ? PayloadEncoding_ENUM.CBOR : PayloadEncoding_ENUM.JSON;
+        for (const deviceId of group.deviceIds) {
+            if (this.getDeviceEncoding(deviceId) !== PayloadEncoding_ENUM.CBOR) {
+                encoding = PayloadEncoding_ENUM.JSON;
+                break;
+            }
+        }
+        const seq = this.nextSeq(payload);
+        const message = seq ? { ...payload, seq } : payload;
+        const encryptedMessage = this.encryptionService.encryptBuffer(PayloadCodec.encode(message, encoding), group.key);
+        if (!encryptedMessage) {
+            this.logger.logError(`Failed to encrypt command for group ${group.id}`);
+            throw new Error("Encryption failed for command");
+        }
+
+        // Every member acks the same sequence number on its own ack topic.
+        const topic = `home/groups/${group.id}/command/${commandName}`;
+        if (seq) {
+            for (const deviceId of group.deviceIds) {
+                this.sendLan(deviceId, topic, encryptedMessage);
+            }
+        }
+        await this.publishSequenced(topic, encryptedMessage, seq, group.deviceIds);
+        this.logger.logInfo(`Published command '${commandName}' to ${topic} (${encoding}, ${group.deviceIds.size} devices)`);
+    }
+
+    /*
+     * Object payloads get a sequence number so the device can drop QoS 1
+     * redeliveries and ack the command; other payloads go out as they are.
+     */
+    private nextSeq(payload: object): number {
+        if (!this.commandAckService || payload === null || typeof payload !== 'object' ||
+            Array.isArray(payload) || Buffer.isBuffer(payload)) {
+            return 0;
+        }
+        return this.commandAckService.nextSeq();
+    }
+
+    private async publishSequenced(topic: string, message: string, seq: number, deviceIds: Iterable<string>): Promise<void> {
+        if (seq && this.commandAckService) {
+            // The round trip starts before the publish, which is part of it.
+            this.commandAckService.track(seq, deviceIds);
+        }
+        try {
+            await this.mqttConnection.publish(topic, message);
+        } catch (error) {
+            if (seq && this.commandAckService) {
+                this.commandAckService.cancel(seq);
+            }
+            throw error;
+        }
+    }
+
+    /*
+     * A device with CONFIG_LAN_LISTENER publishes its address, retained, each
+     * time it joins the network; an invalid payload forgets it.
+     */
+    private setLanAddress(deviceId: string, payload: any): void {
+        const address = payload?.address;
+        const port = payload?.port;
+        if (typeof address === 'string' && /^\d{1,3}(\.\d{1,3}){3}$/.test(address) &&
+            Number.isInteger(port) && port > 0 && port < 65536) {
+            this.lanAddresses.set(deviceId, { address, port });
+            this.logger.logInfo(`Device ${deviceId} takes LAN commands on ${address}:${port}`);
+        } else {
+            this.lanAddresses.delete(deviceId);
+        }
+    }
+
+    /*
+     * The same frame and sequence number as the MQTT publish, as one
+     * "<topic> <frame>" datagram. Best effort: the device runs whichever copy
+     * comes first and drops the other one, so a lost datagram only costs the
+     * broker hop. Unsequenced commands are not sent, the device refuses them.
+     */
+    private sendLan(deviceId: string, topic: string, message: string): void {
+        const target = this.lanAddresses.get(deviceId);
+        const datagram = `${topic} ${message}`;
+        // LAN_LISTENER_DATAGRAM_MAX on the device; longer commands only go over MQTT.
+        if (!target || datagram.length > 1472) {
+            return;
+        }
+        if (!this.lanSocket) {
+            this.lanSocket = dgram.createSocket('udp4');
+            this.lanSocket.on('error', error => this.logger.logWarn(`LAN command socket: ${error}`));
+            this.lanSocket.unref();
+        }
+        this.lanSocket.send(datagram, target.port, target.address, error => {
+            if (error) {
+                this.logger.logWarn(`LAN command to ${deviceId} failed: ${error}`);
+            }
+        });
+    }
+
+    /*
+     * Devices are assumed to speak JSON until they publish something else,
+     * see noteEncoding().
+     */
+    public getDeviceEncoding(deviceId: string): PayloadEncoding_ENUM {
+        return this.deviceEncodings.get(deviceId) ?? PayloadEncoding_ENUM.JSON;
     }
 }
 
@@ -316,6 +776,10 @@ export class EncryptionService {
     private logger: Logger;
     private readonly algorithm: string = 'aes-256-gcm';
     private readonly ivLength = 12;
+    // Derived keys by device or group key, imported once: a message costs no
+    // SHA-256 and no key setup. The oldest is dropped past DERIVED_KEYS_MAX.
+    private derivedKeys: Map<string, crypto.KeyObject> = new Map();
+    private static readonly DERIVED_KEYS_MAX = 8192;
 
     constructor() {
         this.config = Config.getInstance();
@@ -326,11 +790,24 @@ export class EncryptionService {
         }
     }
 
-    private getDerivedKey(deviceSpecificKey: string): Buffer {
-        return crypto.createHash('sha256').update(String(deviceSpecificKey)).digest();
+    private getDerivedKey(deviceSpecificKey: string): crypto.KeyObject {
+        let key = this.derivedKeys.get(deviceSpecificKey);
+        if (!key) {
+            key = crypto.createSecretKey(crypto.createHash('sha256').update(String(deviceSpecificKey)).digest());
+            if (this.derivedKeys.size >= EncryptionService.DERIVED_KEYS_MAX) {
+                this.derivedKeys.delete(this.derivedKeys.keys().next().value as string);
+            }
+            this.derivedKeys.set(deviceSpecificKey, key);
+        }
+        return key;
     }
 
     public encrypt(text: string, deviceKey: string): string | null {
+        return this.encryptBuffer(Buffer.from(text, 'utf8'), deviceKey);
+    }
+
+    // Same frame as encrypt(), for binary (e.g. CBOR) plaintext.
+    public encryptBuffer(data: Buffer, deviceKey: string): string | null {
         if (!deviceKey) {
             this.logger.logError("Encryption error: Device key is missing.");
             return null;
@@ -339,10 +816,9 @@ export class EncryptionService {
             const key = this.getDerivedKey(deviceKey);
             const iv = crypto.randomBytes(this.ivLength);
             const cipher = crypto.createCipheriv(this.algorithm, key, iv) as crypto.CipherGCM;
-            let encrypted = cipher.update(text, 'utf8', 'hex');
-            encrypted += cipher.final('hex');
+            const encrypted = Buffer.concat([cipher.update(data), cipher.final()]);
             const authTag = cipher.getAuthTag();
-            return `${iv.toString('hex')}:${authTag.toString('hex')}:${encrypted}`;
+            return `${iv.toString('hex')}:${authTag.toString('hex')}:${encrypted.toString('hex')}`;
         } catch (error) {
             this.logger.logError(`Encryption error: ${error}`);
             return null;
@@ -350,6 +826,12 @@ export class EncryptionService {
     }
 
     public decrypt(encryptedText: string, deviceKey: string): string | null {
+        const decrypted = this.decryptToBuffer(encryptedText, deviceKey);
+        return decrypted ? decrypted.toString('utf8') : null;
+    }
+
+    // Same as decrypt() without assuming the plaintext is UTF-8 text.
+    public decryptToBuffer(encryptedText: string, deviceKey: string): Buffer | null {
         if (!deviceKey) {
             this.logger.logError("Decryption error: Device key is missing.");
             return null;
@@ -367,9 +849,7 @@ export class EncryptionService {
 
             const decipher = crypto.createDecipheriv(this.algorithm, key, iv) as crypto.DecipherGCM;
             decipher.setAuthTag(authTag);
-            let decrypted = decipher.update(ciphertext, 'hex', 'utf8');
-            decrypted += decipher.final('utf8');
-            return decrypted;
+            return Buffer.concat([decipher.update(Buffer.from(ciphertext, 'hex')), decipher.final()]);
         } catch (error) {
             this.logger.logError(`Decryption error: ${error}`);
             return null;
@@ -383,17 +863,41 @@ export class AutomationRule {
     public triggerCondition: string;
     public actionDeviceId: string;
     public actionCommand: Command;
+    // Only messages of this device trigger the rule; any device if unset.
+    public triggerDeviceId?: string;
     private logger: Logger;
 
-    constructor(id: string, name: string, triggerCondition: string, actionDeviceId: string, actionCommand: Command) {
+    constructor(id: string, name: string, triggerCondition: string, actionDeviceId: string, actionCommand: Command, triggerDeviceId?: string) {
         this.id = id;
         this.name = name;
         this.triggerCondition = triggerCondition;
         this.actionDeviceId = actionDeviceId;
         this.actionCommand = actionCommand;
+        this.triggerDeviceId = triggerDeviceId;
         this.logger = Logger.getInstance();
     }
 
+    /*
+     * The rule can run on the device itself when it reacts to the device's own
+     * telemetry with one of its outputs; null if it has to stay on the backend.
+     */
+    toCompilable(): CompilableRule | null {
+        if (!this.triggerDeviceId || this.triggerDeviceId !== this.actionDeviceId) {
+            return null;
+        }
+        const actions = RuleCompiler.toActions(this.actionCommand);
+        if (!actions) {
+            return null;
+        }
+        try {
+            RuleCompiler.compileCondition(this.triggerCondition);
+        } catch (e) {
+            this.logger.logWarn(`Rule '${this.name}' stays on the backend: ${e}`);
+            return null;
+        }
+        return { id: this.id, condition: this.triggerCondition, actions };
+    }
+
     evaluate(triggeringDevice: Device, triggeringPayload: any): boolean {
         this.logger.logDebug(`Evaluating rule '${this.name}' for device ${triggeringDevice.name} based on payload: ${JSON.stringify(triggeringPayload)}`);
         try {
@@ -430,6 +934,8 @@ export class AutomationService {
     private mqttService!: MQTTService;
     private logger: Logger;
     private userRepository: UserRepository;
+    // Rule program last sent to each device, to skip its rules here and to read its firing reports.
+    private devicePrograms: Map<string, RuleProgram> = new Map();
 
     constructor(notificationService: NotificationService, userRepository: UserRepository) {
         this.notificationService = notificationService;
@@ -452,18 +958,99 @@ export class AutomationService {
         if (this.rules.has(rule.id)) {
             this.logger.logWarn(`Automation rule with ID ${rule.id} already exists. Updating.`);
         }
+        const previous = this.rules.get(rule.id);
         this.rules.set(rule.id, rule);
         this.logger.logInfo(`Automation rule '${rule.name}' (ID: ${rule.id}) added/updated.`);
+        this.updateDeviceRules(previous?.triggerDeviceId);
+        if (rule.triggerDeviceId !== previous?.triggerDeviceId) {
+            this.updateDeviceRules(rule.triggerDeviceId);
+        }
     }
 
     public removeRule(ruleId: string): void {
-        if (this.rules.delete(ruleId)) {
+        const rule = this.rules.get(ruleId);
+        if (rule && this.rules.delete(ruleId)) {
             this.logger.logInfo(`Automation rule ID ${ruleId} removed.`);
+            this.updateDeviceRules(rule.triggerDeviceId);
         } else {
             this.logger.logWarn(`Automation rule ID ${ruleId} not found for removal.`);
         }
     }
 
+    private updateDeviceRules(deviceId?: string): void {
+        if (!deviceId || !this.mqttService) {
+            return;
+        }
+        this.pushRulesToDevice(deviceId).catch(error => {
+            this.logger.logError(`Error sending rules to device ${deviceId}: ${error}`);
+        });
+    }
+
+    public compileRulesForDevice(deviceId: string): RuleProgram {
+        const compilable: CompilableRule[] = [];
+        for (const rule of this.rules.values()) {
+            const local = rule.triggerDeviceId === deviceId ? rule.toCompilable() : null;
+            if (local) {
+                compilable.push(local);
+            }
+        }
+        return RuleCompiler.compile(compilable);
+    }
+
+    /*
+     * Sends the device its rule program (command "rules"). The device keeps it
+     * across reboots and reports the program ID in its telemetry as ruleProgram.
+     */
+    public async pushRulesToDevice(deviceId: string, force = false): Promise<void> {
+        if (!this.mqttService) {
+            return;
+        }
+        const program = this.compileRulesForDevice(deviceId);
+        if (!force && program.ruleIds.length === 0 && !this.devicePrograms.has(deviceId)) {
+            return;
+        }
+        await this.mqttService.publishCommand(deviceId, 'rules', { program: program.bytes.toString('hex') });
+        this.devicePrograms.set(deviceId, program);
+        this.logger.logInfo(`Sent rule program ${program.programId} (${program.ruleIds.length} rules, ${program.bytes.length} bytes) to device ${deviceId}`);
+    }
+
+    /*
+     * Rules in the program the device says it runs are left to the device.
+     */
+    private async runsOnDevice(rule: AutomationRule, device: Device, payload: any): Promise<boolean> {
+        const reported = payload?.ruleProgram ?? device.lastKnownState?.ruleProgram;
+        if (typeof reported !== 'number') {
+            return false;
+        }
+        if (!this.devicePrograms.has(device.id)) {
+            // Backend restarted: adopt the program if it is still current, resend it otherwise.
+            const program = this.compileRulesForDevice(device.id);
+            if (program.programId === reported || (reported === 0 && program.ruleIds.length === 0)) {
+                this.devicePrograms.set(device.id, program);
+            } else {
+                await this.pushRulesToDevice(device.id, true);
+                return false;
+            }
+        }
+        const program = this.devicePrograms.get(device.id)!;
+        return program.programId === reported && program.ruleIds.includes(rule.id);
+    }
+
+    /*
+     * Payload: { program, now, fired: [[rule index, t ms], ...] }, times in device uptime.
+     */
+    public handleRuleFirings(device: Device, payload: any): void {
+        const program = this.devicePrograms.get(device.id);
+        if (!program || program.programId !== payload.program) {
+            this.logger.logWarn(`Device ${device.id} reported firings of unknown rule program ${payload.program}`);
+            return;
+        }
+        for (const [index, tMs] of payload.fired ?? []) {
+            const rule = this.rules.get(program.ruleIds[index]);
+            this.logger.logInfo(`Rule '${rule?.name ?? index}' fired on device ${device.name} ${payload.now - tMs} ms before the report`);
+        }
+    }
+
     public async executeRulesForDevice(triggeringDevice: Device, triggeringPayload: any): Promise<void> {
         if (!this.mqttService) {
             this.logger.logWarn("MQTTService not set in AutomationService. Cannot execute rule actions.");
@@ -471,6 +1058,12 @@ export class AutomationService {
         }
         this.logger.logDebug(`Executing automation rules triggered by device ${triggeringDevice.name}`);
         for (const rule of this.rules.values()) {
+            if (rule.triggerDeviceId && rule.triggerDeviceId !== triggeringDevice.id) {
+                continue;
+            }
+            if (rule.triggerDeviceId && await this.runsOnDevice(rule, triggeringDevice, triggeringPayload)) {
+                continue;
+            }
             if (rule.evaluate(triggeringDevice, triggeringPayload)) {
                 this.logger.logInfo(`Rule '${rule.name}' triggered by ${triggeringDevice.name}. Executing action on device ${rule.actionDeviceId}.`);
                 try {
@@ -484,6 +1077,773 @@ export class AutomationService {
     }
 }
 
+/*
+ * Groups of devices, kept in memory like the automation rules. Members store
+ * their groups on the device, so a backend restart only loses the ability to
+ * address the group until it is created again.
+ */
+export class GroupService {
+    // Topic segment limit of the firmware (DEVICE_GROUPS_NAME_MAX_LEN).
+    public static readonly GROUP_ID_MAX_LEN = 32;
+    private groups: Map<string, DeviceGroup> = new Map();
+    private mqttService: MQTTService;
+    private logger: Logger;
+
+    constructor(mqttService: MQTTService) {
+        this.mqttService = mqttService;
+        this.logger = Logger.getInstance();
+    }
+
+    public createGroup(name: string, ownerId: string): DeviceGroup {
+        const group = new DeviceGroup(crypto.randomBytes(8).toString('hex'), name, crypto.randomBytes(24).toString('base64url'), ownerId);
+        this.groups.set(group.id, group);
+        this.logger.logInfo(`Device group '${name}' (ID: ${group.id}) created.`);
+        return group;
+    }
+
+    public getGroup(groupId: string): DeviceGroup | undefined {
+        return this.groups.get(groupId);
+    }
+
+    public listGroups(ownerId?: string): DeviceGroup[] {
+        return [...this.groups.values()].filter(group => ownerId === undefined || group.ownerId === ownerId);
+    }
+
+    public async deleteGroup(groupId: string): Promise<void> {
+        const group = this.requireGroup(groupId);
+        for (const deviceId of [...group.deviceIds]) {
+            await this.removeDevice(groupId, deviceId);
+        }
+        this.groups.delete(groupId);
+        this.logger.logInfo(`Device group ${groupId} deleted.`);
+    }
+
+    /*
+     * The device subscribes to the group topic and keeps the membership across reboots.
+     */
+    public async addDevice(groupId: string, deviceId: string): Promise<void> {
+        const group = this.requireGroup(groupId);
+        await this.mqttService.publishCommand(deviceId, 'groups', { join: group.id, key: group.key });
+        group.deviceIds.add(deviceId);
+        this.logger.logInfo(`Device ${deviceId} joined group '${group.name}' (${group.deviceIds.size} devices)`);
+    }
+
+    public async removeDevice(groupId: string, deviceId: string): Promise<void> {
+        const group = this.requireGroup(groupId);
+        if (!group.deviceIds.has(deviceId)) {
+            return;
+        }
+        await this.mqttService.publishCommand(deviceId, 'groups', { leave: group.id });
+        group.deviceIds.delete(deviceId);
+        this.logger.logInfo(`Device ${deviceId} left group '${group.name}'`);
+    }
+
+    /*
+     * Resent on every device boot, in case the device lost its stored groups.
+     */
+    public async pushMembershipsToDevice(deviceId: string): Promise<void> {
+        for (const group of this.groups.values()) {
+            if (group.deviceIds.has(deviceId)) {
+                await this.mqttService.publishCommand(deviceId, 'groups', { join: group.id, key: group.key });
+            }
+        }
+    }
+
+    public async sendCommand(groupId: string, commandName: string, payload: object): Promise<void> {
+        await this.mqttService.publishGroupCommand(this.requireGroup(groupId), commandName, payload);
+    }
+
+    /*
+     * Levels by channel name, e.g. { light: true, fan: 40 }. Each member applies
+     * the channels it has in one step and ignores the others.
+     */
+    public async applyScene(groupId: string, levels: Record<string, number | boolean>): Promise<void> {
+        await this.sendCommand(groupId, 'scene', levels);
+    }
+
+    private requireGroup(groupId: string): DeviceGroup {
+        const group = this.groups.get(groupId);
+        if (!group) {
+            throw new Error(`Group ${groupId} not found`);
+        }
+        return group;
+    }
+}
+
+/*
+ * Latency distribution from one device histogram (hal/device_metrics.h):
+ * bucket 0 counts zeros, bucket i values in [2^(i-1), 2^i). Percentiles are
+ * the upper bound of the bucket they fall in.
+ */
+export interface HistogramSummary {
+    count: number;
+    meanUs: number;
+    p50Us: number;
+    p90Us: number;
+    p99Us: number;
+}
+
+export interface DeviceMetricsView {
+    deviceId: string;
+    receivedAt: Date;
+    uptimeMs: number;
+    // Time since the snapshot before, which rates and latencies cover; null after a (re)boot,
+    // when there are no rates and the latencies cover the time since boot.
+    windowMs: number | null;
+    counters: Record<string, number>;
+    ratesPerMinute: Record<string, number>;
+    gauges: Record<string, number>;
+    latencies: Record<string, HistogramSummary>;
+}
+
+interface MetricsSnapshot {
+    receivedAt: Date;
+    uptimeMs: number;
+    counters: Record<string, number>;
+    gauges: Record<string, number>;
+    histograms: Record<string, { sum: number; buckets: number[] }>;
+}
+
+/*
+ * Snapshots published by the devices on home/devices/<id>/telemetry/metrics.
+ * Only the last two per device are kept, in memory: enough for rates and for
+ * the latencies of the last period.
+ */
+export class MetricsService {
+    public static readonly COUNTERS = ['msgIn', 'msgOut', 'msgQueued', 'publishFailures', 'undecryptable',
+        'commandFailures', 'reconnects', 'wifiDisconnects', 'duplicates', 'lanIn', 'tlsResumed'];
+    public static readonly GAUGES = ['heapFree', 'heapMin', 'heapLargest', 'heapBlocks', 'rssi', 'actuatorQueue',
+        'offlineQueueBytes'];
+    public static readonly HISTOGRAMS = ['dispatchUs', 'publishUs', 'actuateUs', 'tlsConnectUs'];
+    // Device counters are 32-bit and wrap.
+    private static readonly COUNTER_RANGE = 2 ** 32;
+
+    private latest: Map<string, MetricsSnapshot> = new Map();
+    private previous: Map<string, MetricsSnapshot> = new Map();
+    private logger: Logger;
+
+    constructor() {
+        this.logger = Logger.getInstance();
+    }
+
+    public ingest(deviceId: string, payload: Record<string, any>, receivedAt: Date = new Date()): void {
+        if (typeof payload.up !== 'number') {
+            this.logger.logWarn(`Metrics snapshot from device ${deviceId} without uptime, ignored`);
+            return;
+        }
+        const snapshot: MetricsSnapshot = { receivedAt, uptimeMs: payload.up, counters: {}, gauges: {}, histograms: {} };
+        for (const key of MetricsService.COUNTERS) {
+            if (typeof payload[key] === 'number') {
+                snapshot.counters[key] = payload[key];
+            }
+        }
+        for (const key of MetricsService.GAUGES) {
+            if (typeof payload[key] === 'number') {
+                snapshot.gauges[key] = payload[key];
+            }
+        }
+        for (const key of MetricsService.HISTOGRAMS) {
+            const values = payload[key];
+            if (Array.isArray(values) && values.length > 0 && values.every(v => typeof v === 'number')) {
+                snapshot.histograms[key] = { sum: values[0], buckets: values.slice(1) };
+            }
+        }
+
+        const last = this.latest.get(deviceId);
+        if (last && snapshot.uptimeMs > last.uptimeMs) {
+            this.previous.set(deviceId, last);
+        } else {
+            // First snapshot or the device rebooted: counters started over.
+            this.previous.delete(deviceId);
+        }
+        this.latest.set(deviceId, snapshot);
+    }
+
+    public getDeviceMetrics(deviceId: string): DeviceMetricsView | null {
+        const latest = this.latest.get(deviceId);
+        if (!latest) {
+            return null;
+        }
+        const previous = this.previous.get(deviceId);
+        const windowMs = previous ? latest.uptimeMs - previous.uptimeMs : null;
+
+        const ratesPerMinute: Record<string, number> = {};
+        if (previous && windowMs) {
+            for (const [key, value] of Object.entries(latest.counters)) {
+                const delta = MetricsService.counterDelta(value, previous.counters[key] ?? 0);
+                ratesPerMinute[key] = Math.round(delta * 60000 / windowMs * 100) / 100;
+            }
+        }
+
+        const latencies: Record<string, HistogramSummary> = {};
+        for (const [key, histogram] of Object.entries(latest.histograms)) {
+            const before = previous?.histograms[key];
+            const buckets = histogram.buckets.map((count, i) => MetricsService.counterDelta(count, before?.buckets[i] ?? 0));
+            const sum = MetricsService.counterDelta(histogram.sum, before?.sum ?? 0);
+            latencies[key] = MetricsService.summarize(buckets, sum);
+        }
+
+        return {
+            deviceId,
+            receivedAt: latest.receivedAt,
+            uptimeMs: latest.uptimeMs,
+            windowMs,
+            counters: { ...latest.counters },
+            ratesPerMinute,
+            gauges: { ...latest.gauges },
+            latencies,
+        };
+    }
+
+    private static counterDelta(now: number, before: number): number {
+        return (now - before + MetricsService.COUNTER_RANGE) % MetricsService.COUNTER_RANGE;
+    }
+
+    public static summarize(buckets: number[], sum: number): HistogramSummary {
+        const count = buckets.reduce((total, n) => total + n, 0);
+        const percentile = (p: number): number => {
+            const rank = Math.ceil(count * p);
+            let seen = 0;
+            for (let i = 0; i < buckets.length; i++) {
+                seen += buckets[i];
+                if (seen >= rank) {
+                    return i === 0 ? 0 : 2 ** i - 1;
+                }
+            }
+            return 0;
+        };
+        return {
+            count,
+            meanUs: count ? Math.round(sum / count * 10) / 10 : 0,
+            p50Us: count ? percentile(0.5) : 0,
+            p90Us: count ? percentile(0.9) : 0,
+            p99Us: count ? percentile(0.99) : 0,
+        };
+    }
+}
+
+/*
+ * Percentiles over the last samples of a latency (nearest rank).
+ */
+export interface LatencyPercentiles {
+    count: number;
+    p50: number;
+    p90: number;
+    p99: number;
+    max: number;
+}
+
+export interface CommandLatencyView {
+    deviceId: string;
+    sent: number;           // Sequenced commands published to the device, directly or through a group
+    acked: number;          // Commands the device applied
+    failed: number;         // Commands the device rejected
+    duplicates: number;     // Redeliveries the device dropped
+    timedOut: number;       // Commands without ack after ACK_TIMEOUT_MS
+    pending: number;
+    roundTripMs: LatencyPercentiles;    // Publish to ack, on the backend
+    deviceUs: LatencyPercentiles;       // Receive to actuate, on the device
+}
+
+class LatencyWindow {
+    private samples: Float64Array;
+    private next = 0;
+    private count = 0;
+
+    constructor(size: number) {
+        this.samples = new Float64Array(size);
+    }
+
+    public add(value: number): void {
+        this.samples[this.next] = value;
+        this.next = (this.next + 1) % this.samples.length;
+        this.count = Math.min(this.count + 1, this.samples.length);
+    }
+
+    public summarize(decimals: number): LatencyPercentiles {
+        const sorted = this.samples.slice(0, this.count).sort();
+        const scale = 10 ** decimals;
+        const at = (p: number): number =>
+            this.count ? Math.round(sorted[Math.max(Math.ceil(this.count * p) - 1, 0)] * scale) / scale : 0;
+        return { count: this.count, p50: at(0.5), p90: at(0.9), p99: at(0.99), max: at(1) };
+    }
+}
+
+interface DeviceCommandStats {
+    sent: number;
+    acked: number;
+    failed: number;
+    duplicates: number;
+    timedOut: number;
+    roundTripMs: LatencyWindow;
+    deviceUs: LatencyWindow;
+}
+
+interface PendingCommand {
+    sentAt: number;
+    deviceIds: Set<string>;
+}
+
+/*
+ * Sequence numbers of the commands sent by MQTTService and the acks the
+ * devices publish on home/devices/<id>/ack (hal/command_ack.h):
+ *   {"acks":[[seq, status, receive to actuate us], ...]}
+ * status 0 is applied, 1 a redelivery the device dropped, anything else the
+ * device error code. Kept in memory, like the metrics.
+ */
+export class CommandAckService {
+    public static readonly ACK_TIMEOUT_MS = 30000;
+    public static readonly SAMPLES = 256;
+    public static readonly STATUS_DUPLICATE = 1;
+    // The device reads the number as a positive int32.
+    private static readonly SEQ_MAX = 2 ** 31 - 1;
+
+    private seq: number;
+    // In publish order, so expired commands are at the front.
+    private pending: Map<number, PendingCommand> = new Map();
+    private devices: Map<string, DeviceCommandStats> = new Map();
+    // Over all devices, for the fleet view in home/backend/stats.
+    private fleetRoundTripMs = new LatencyWindow(4 * CommandAckService.SAMPLES);
+    private fleetTimedOut = 0;
+    private logger: Logger;
+
+    constructor() {
+        // A random start keeps the numbers of a restarted backend out of the device dedup windows.
+        this.seq = crypto.randomInt(1, CommandAckService.SEQ_MAX);
+        this.logger = Logger.getInstance();
+    }
+
+    public nextSeq(): number {
+        this.seq = this.seq >= CommandAckService.SEQ_MAX ? 1 : this.seq + 1;
+        return this.seq;
+    }
+
+    public track(seq: number, deviceIds: Iterable<string>, now: number = performance.now()): void {
+        this.expire(now);
+        const ids = new Set(deviceIds);
+        for (const deviceId of ids) {
+            this.statsFor(deviceId).sent++;
+        }
+        if (ids.size > 0) {
+            this.pending.set(seq, { sentAt: now, deviceIds: ids });
+        }
+    }
+
+    // The publish failed: the command never left.
+    public cancel(seq: number): void {
+        const command = this.pending.get(seq);
+        if (!command) {
+            return;
+        }
+        for (const deviceId of command.deviceIds) {
+            this.statsFor(deviceId).sent--;
+        }
+        this.pending.delete(seq);
+    }
+
+    public handleAcks(deviceId: string, payload: Record<string, any>, now: number = performance.now()): void {
+        if (!Array.isArray(payload.acks)) {
+            this.logger.logWarn(`Ack from device ${deviceId} without acks, ignored`);
+            return;
+        }
+        const stats = this.statsFor(deviceId);
+        for (const ack of payload.acks) {
+            if (!Array.isArray(ack) || ack.length < 3 || !ack.every(v => typeof v === 'number')) {
+                continue;
+            }
+            const [seq, status, deviceUs] = ack;
+            const command = this.pending.get(seq);
+            if (!command || !command.deviceIds.delete(deviceId)) {
+                // Acked before, or after it timed out.
+                if (status === CommandAckService.STATUS_DUPLICATE) {
+                    stats.duplicates++;
+                }
+                continue;
+            }
+            if (command.deviceIds.size === 0) {
+                this.pending.delete(seq);
+            }
+            stats.roundTripMs.add(now - command.sentAt);
+            this.fleetRoundTripMs.add(now - command.sentAt);
+            if (status === 0) {
+                stats.acked++;
+                stats.deviceUs.add(deviceUs);
+            } else if (status === CommandAckService.STATUS_DUPLICATE) {
+                // The first ack was lost; the command was applied when first delivered.
+                stats.acked++;
+                stats.duplicates++;
+            } else {
+                stats.failed++;
+                this.logger.logWarn(`Device ${deviceId} failed command ${seq}: error 0x${status.toString(16)}`);
+            }
+        }
+    }
+
+    public getCommandLatency(deviceId: string, now: number = performance.now()): CommandLatencyView | null {
+        this.expire(now);
+        const stats = this.devices.get(deviceId);
+        if (!stats) {
+            return null;
+        }
+        let pending = 0;
+        for (const command of this.pending.values()) {
+            pending += command.deviceIds.has(deviceId) ? 1 : 0;
+        }
+        return {
+            deviceId,
+            sent: stats.sent,
+            acked: stats.acked,
+            failed: stats.failed,
+            duplicates: stats.duplicates,
+            timedOut: stats.timedOut,
+            pending,
+            roundTripMs: stats.roundTripMs.summarize(2),
+            deviceUs: stats.deviceUs.summarize(0),
+        };
+    }
+
+    public getFleetSummary(now: number = performance.now()): { commandRoundTripMs: LatencyPercentiles; commandsTimedOut: number } {
+        this.expire(now);
+        return { commandRoundTripMs: this.fleetRoundTripMs.summarize(2), commandsTimedOut: this.fleetTimedOut };
+    }
+
+    private expire(now: number): void {
+        for (const [seq, command] of this.pending) {
+            if (now - command.sentAt < CommandAckService.ACK_TIMEOUT_MS) {
+                break;
+            }
+            for (const deviceId of command.deviceIds) {
+                this.statsFor(deviceId).timedOut++;
+                this.fleetTimedOut++;
+            }
+            this.pending.delete(seq);
+        }
+    }
+
+    private statsFor(deviceId: string): DeviceCommandStats {
+        let stats = this.devices.get(deviceId);
+        if (!stats) {
+            stats = {
+                sent: 0, acked: 0, failed: 0, duplicates: 0, timedOut: 0,
+                roundTripMs: new LatencyWindow(CommandAckService.SAMPLES),
+                deviceUs: new LatencyWindow(CommandAckService.SAMPLES),
+            };
+            this.devices.set(deviceId, stats);
+        }
+        return stats;
+    }
+}
+
+export interface OtaTransferView {
+    deviceId: string;
+    version: string;
+    base: string | null;    // Firmware the delta is built on; null for a raw image
+    format: 'raw' | 'delta';
+    imageBytes: number;
+    streamBytes: number;    // Bytes on the wire, the image or its delta
+    sentBytes: number;      // Stream offset published up to
+    confirmedBytes: number; // Stream offset the device last reported
+    state: string;          // starting, receiving, done, failed or aborted
+    retries: number;        // Begins resent after a stall in a row
+    startedAt: Date;
+    updatedAt: Date;
+}
+
+interface OtaImage {
+    version: string;
+    data: Buffer;
+    sha256: string;
+}
+
+interface OtaStream {
+    format: 'raw' | 'delta';
+    base: string | null;
+    data: Buffer;
+}
+
+interface OtaTransfer {
+    device: Device;
+    image: OtaImage;
+    stream: OtaStream;
+    nextOffset: number;
+    confirmed: number;
+    // Until the device answers a begin, nothing is known about its offset.
+    awaitingBegin: boolean;
+    pumping: boolean;
+    state: string;
+    retries: number;
+    startedAt: number;
+    updatedAt: number;
+    timer?: NodeJS.Timeout;
+}
+
+/*
+ * Firmware updates streamed over MQTT (hal/ota_update.h). Images are read
+ * from <OTA_IMAGE_DIR>/<version>.bin; each device gets a delta against the
+ * firmware it reported on telemetry/firmwareVersion when that is smaller.
+ * Deltas are built once per base and version, so a fleet on the same base
+ * shares one. Chunks are unsequenced commands; the flow control is the
+ * device's progress reports: at most OTA_WINDOW_BYTES past the last
+ * reported offset are in flight, a "resend" rewinds, and a stalled transfer
+ * gets its begin again, which the device answers with its offset. Transfers
+ * are kept in memory; a restarted backend starts them again and the devices
+ * resume from their checkpoints.
+ */
+export class OtaService {
+    public static readonly STALL_MS = 15000;
+    public static readonly MAX_RETRIES = 5;
+    // Chunk data within CONFIG_MQTT_REASSEMBLY_BUFFER_SIZE (4096) after encryption; hex doubles it in JSON.
+    public static readonly CHUNK_BYTES_CBOR = 1536;
+    public static readonly CHUNK_BYTES_JSON = 768;
+    private static readonly VERSION_PATTERN = /^[\w.+-]{1,31}$/;
+
+    private mqttService: MQTTService;
+    private deviceRepository: DeviceRepository;
+    private imageDir: string;
+    private windowBytes: number;
+    private images: Map<string, OtaImage> = new Map();
+    // Keyed by "<base>-><version>".
+    private streams: Map<string, OtaStream> = new Map();
+    private transfers: Map<string, OtaTransfer> = new Map();
+    private logger: Logger;
+
+    constructor(mqttService: MQTTService, deviceRepository: DeviceRepository) {
+        const config = Config.getInstance();
+        this.mqttService = mqttService;
+        this.deviceRepository = deviceRepository;
+        this.imageDir = config.getOtaImageDir();
+        this.windowBytes = config.getOtaWindowBytes();
+        this.logger = Logger.getInstance();
+    }
+
+    public async startUpdate(deviceId: string, version: string): Promise<OtaTransferView> {
+        const device = await this.deviceRepository.findById(deviceId);
+        if (!device) {
+            throw new Error(`Device ${deviceId} not found`);
+        }
+        if (device.firmwareVersion === version) {
+            throw new Error(`Device ${deviceId} already runs firmware ${version}`);
+        }
+        const image = this.loadImage(version);
+        const stream = this.streamFor(image, device.firmwareVersion);
+
+        const previous = this.transfers.get(deviceId);
+        if (previous?.timer) {
+            clearTimeout(previous.timer);
+        }
+        const now = Date.now();
+        const transfer: OtaTransfer = {
+            device, image, stream,
+            nextOffset: 0, confirmed: 0, awaitingBegin: true, pumping: false,
+            state: 'starting', retries: 0, startedAt: now, updatedAt: now,
+        };
+        this.transfers.set(deviceId, transfer);
+        this.logger.logInfo(`OTA ${version} for device ${deviceId}: ${stream.format}${stream.base ? ' from ' + stream.base : ''}, ` +
+            `${stream.data.length} of ${image.data.length} bytes`);
+        await this.sendBegin(transfer);
+        return this.toView(transfer);
+    }
+
+    public getTransfer(deviceId: string): OtaTransferView | null {
+        const transfer = this.transfers.get(deviceId);
+        return transfer ? this.toView(transfer) : null;
+    }
+
+    // A rebooted device lost the transfer; the begin makes it continue from its checkpoint.
+    public async resumeAfterBoot(deviceId: string): Promise<void> {
+        const transfer = this.transfers.get(deviceId);
+        if (transfer && this.isActive(transfer)) {
+            await this.sendBegin(transfer);
+        }
+    }
+
+    public async handleProgress(deviceId: string, payload: Record<string, any>): Promise<void> {
+        const transfer = this.transfers.get(deviceId);
+        if (!transfer || !this.isActive(transfer) || payload.version !== transfer.image.version ||
+            typeof payload.offset !== 'number') {
+            this.logger.logDebug(`OTA progress from device ${deviceId} for no transfer, ignored`);
+            return;
+        }
+        transfer.updatedAt = Date.now();
+        transfer.retries = 0;
+        switch (payload.state) {
+            case 'receiving':
+                if (transfer.awaitingBegin) {
+                    transfer.nextOffset = payload.offset;
+                    transfer.awaitingBegin = false;
+                    transfer.state = 'receiving';
+                }
+                transfer.confirmed = Math.max(transfer.confirmed, payload.offset);
+                break;
+            case 'resend':
+                this.logger.logWarn(`Device ${deviceId} missed OTA data, resending from ${payload.offset}`);
+                transfer.nextOffset = transfer.confirmed = payload.offset;
+                transfer.awaitingBegin = false;
+                break;
+            case 'done':
+            case 'failed':
+            case 'aborted':
+                this.end(transfer, payload.state);
+                return;
+            default:
+                this.logger.logWarn(`Unknown OTA state '${payload.state}' from device ${deviceId}`);
+                return;
+        }
+        this.armTimer(transfer);
+        await this.pump(transfer);
+    }
+
+    private async sendBegin(transfer: OtaTransfer): Promise<void> {
+        const { image, stream } = transfer;
+        transfer.awaitingBegin = true;
+        this.armTimer(transfer);
+        try {
+            await this.mqttService.publishToDevice(transfer.device, 'ota/begin', {
+                version: image.version,
+                size: image.data.length,
+                sha256: image.sha256,
+                format: stream.format,
+                stream: stream.data.length,
+                ...(stream.base ? { base: stream.base } : {}),
+            });
+        } catch (error) {
+            // The stall timer sends it again.
+            this.logger.logError(`OTA begin for device ${transfer.device.id} failed: ${error}`);
+        }
+    }
+
+    // Publishes chunks until the window is full; progress reports call it again.
+    private async pump(transfer: OtaTransfer): Promise<void> {
+        if (transfer.pumping) {
+            return;
+        }
+        transfer.pumping = true;
+        const cbor = this.mqttService.getDeviceEncoding(transfer.device.id) === PayloadEncoding_ENUM.CBOR;
+        const chunkBytes = cbor ? OtaService.CHUNK_BYTES_CBOR : OtaService.CHUNK_BYTES_JSON;
+        const data = transfer.stream.data;
+        try {
+            while (this.isActive(transfer) && !transfer.awaitingBegin && transfer.nextOffset < data.length &&
+                   transfer.nextOffset - transfer.confirmed < this.windowBytes) {
+                const off = transfer.nextOffset;
+                const chunk = data.subarray(off, off + chunkBytes);
+                // Advanced first: a resend arriving during the publish rewinds it.
+                transfer.nextOffset = off + chunk.length;
+                await this.mqttService.publishToDevice(transfer.device, 'ota/chunk',
+                    { off, data: cbor ? chunk : chunk.toString('hex') }, false);
+            }
+        } catch (error) {
+            this.logger.logError(`OTA chunk for device ${transfer.device.id} failed: ${error}`);
+        } finally {
+            transfer.pumping = false;
+        }
+    }
+
+    private armTimer(transfer: OtaTransfer): void {
+        if (transfer.timer) {
+            clearTimeout(transfer.timer);
+        }
+        transfer.timer = setTimeout(() => {
+            transfer.timer = undefined;
+            if (!this.isActive(transfer)) {
+                return;
+            }
+            if (transfer.retries >= OtaService.MAX_RETRIES) {
+                this.logger.logError(`OTA for device ${transfer.device.id} stalled at ${transfer.confirmed}, giving up`);
+                this.end(transfer, 'failed');
+                return;
+            }
+            transfer.retries++;
+            this.sendBegin(transfer);
+        }, OtaService.STALL_MS);
+        transfer.timer.unref();
+    }
+
+    private end(transfer: OtaTransfer, state: string): void {
+        if (transfer.timer) {
+            clearTimeout(transfer.timer);
+            transfer.timer = undefined;
+        }
+        transfer.state = state;
+        transfer.updatedAt = Date.now();
+        if (state === 'done') {
+            transfer.confirmed = transfer.stream.data.length;
+            this.logger.logInfo(`Device ${transfer.device.id} verified firmware ${transfer.image.version}`);
+        } else {
+            this.logger.logWarn(`OTA ${transfer.image.version} for device ${transfer.device.id} ended: ${state}`);
+        }
+    }
+
+    private isActive(transfer: OtaTransfer): boolean {
+        return transfer.state === 'starting' || transfer.state === 'receiving';
+    }
+
+    private loadImage(version: string): OtaImage {
+        if (!OtaService.VERSION_PATTERN.test(version)) {
+            throw new Error(`Invalid firmware version '${version}'`);
+        }
+        let image = this.images.get(version);
+        if (!image) {
+            const file = path.join(this.imageDir, `${version}.bin`);
+            if (!fs.existsSync(file)) {
+                throw new Error(`Firmware image ${version} not found`);
+            }
+            const data = fs.readFileSync(file);
+            image = { version, data, sha256: crypto.createHash('sha256').update(data).digest('hex') };
+            this.images.set(version, image);
+        }
+        return image;
+    }
+
+    /*
+     * The smaller of the image and a delta against the device's firmware.
+     * Without the base image the delta only run length compresses; the device
+     * still checks the base, so it is always named.
+     */
+    private streamFor(image: OtaImage, base: string | undefined): OtaStream {
+        if (!base || !OtaService.VERSION_PATTERN.test(base)) {
+            return { format: 'raw', base: null, data: image.data };
+        }
+        const key = `${base}->${image.version}`;
+        let stream = this.streams.get(key);
+        if (!stream) {
+            let baseData = Buffer.alloc(0);
+            try {
+                baseData = this.loadImage(base).data;
+            } catch {
+                this.logger.logWarn(`No image of firmware ${base}, OTA ${image.version} is sent without COPY ops`);
+            }
+            const start = performance.now();
+            const delta = DeltaEncoder.encode(baseData, image.data);
+            if (!DeltaEncoder.apply(baseData, delta, image.data.length).equals(image.data)) {
+                throw new Error(`Delta ${key} does not rebuild the image`);
+            }
+            this.logger.logInfo(`Delta ${key}: ${delta.length} of ${image.data.length} bytes in ${(performance.now() - start).toFixed(0)} ms`);
+            stream = delta.length < image.data.length
+                ? { format: 'delta', base, data: delta }
+                : { format: 'raw', base: null, data: image.data };
+            this.streams.set(key, stream);
+        }
+        return stream;
+    }
+
+    private toView(transfer: OtaTransfer): OtaTransferView {
+        return {
+            deviceId: transfer.device.id,
+            version: transfer.image.version,
+            base: transfer.stream.base,
+            format: transfer.stream.format,
+            imageBytes: transfer.image.data.length,
+            streamBytes: transfer.stream.data.length,
+            sentBytes: transfer.nextOffset,
+            confirmedBytes: transfer.confirmed,
+            state: transfer.state,
+            retries: transfer.retries,
+            startedAt: new Date(transfer.startedAt),
+            updatedAt: new Date(transfer.updatedAt),
+        };
+    }
+}
+
 export class NotificationService {
     private logger: Logger;
 
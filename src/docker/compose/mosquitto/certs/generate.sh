@@ -0,0 +1,39 @@
+#!/usr/bin/env sh
+# Development CA and broker certificate for the mqtts:// listener (8883, 8884 on the host).
+#
+# Writes ca.crt, server.crt and server.key next to this script, the listener
+# to ../config/conf.d/tls.conf, and copies the CA to the firmware
+# (iotdevice/main/certs/mqtt_broker_ca.pem, embedded with CONFIG_NETWORK_MQTT_TLS).
+# The broker name must be one of the names below; add yours with BROKER_NAMES.
+set -e
+
+cd "$(dirname "$0")"
+NAMES="DNS:mosquitto,DNS:localhost,IP:127.0.0.1${BROKER_NAMES:+,$BROKER_NAMES}"
+DAYS=3650
+
+if [ ! -f ca.key ]; then
+    openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes -days "$DAYS" \
+        -keyout ca.key -out ca.crt -subj "/CN=HomeControlHub development CA"
+fi
+
+openssl req -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes \
+    -keyout server.key -out server.csr -subj "/CN=mosquitto"
+printf 'subjectAltName=%s\n' "$NAMES" > server.ext
+openssl x509 -req -in server.csr -CA ca.crt -CAkey ca.key -CAcreateserial -days "$DAYS" \
+    -extfile server.ext -out server.crt
+rm -f server.csr server.ext
+# The broker runs as the mosquitto user; these are development keys only.
+chmod 644 server.key
+
+cat > ../config/conf.d/tls.conf <<CONF
+listener 8883
+cafile /mosquitto/certs/ca.crt
+certfile /mosquitto/certs/server.crt
+keyfile /mosquitto/certs/server.key
+# The firmware resumes TLS 1.2 sessions only, see iotdevice/main/hal/mqtt_tls.h.
+tls_version tlsv1.2
+CONF
+
+mkdir -p ../../../../../iotdevice/main/certs
+cp ca.crt ../../../../../iotdevice/main/certs/mqtt_broker_ca.pem
+echo "CA: $(pwd)/ca.crt, names: $NAMES"
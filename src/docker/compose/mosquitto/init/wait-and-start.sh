@@ -22,11 +22,16 @@ npx prisma studio --schema=./db/prisma/schema.prisma --port 5555 &
 # Start the backend server in the background
 echo "Starting backend server..."
 node dist/main.js &
+BACKEND_PID=$!
 
 # Start serving the frontend using a simple HTTP server
 echo "Starting frontend server..."
 cd dist-ui
 npx serve -s . -l 9877 &
 
+# The shell is PID 1 and does not pass signals on; let the backend write the
+# device state it still holds on docker stop
+trap 'kill -TERM "$BACKEND_PID"; wait "$BACKEND_PID"; exit 0' TERM INT
+
 # Keep the container running
 wait
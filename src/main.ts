@@ -27,6 +27,20 @@ async function bootstrap() {
         logger.logError(error instanceof Error ? error : String(error));
         process.exit(1);
     }
+
+    // Reported device state is written in batches; write what is queued before exiting.
+    const shutdown = async (signal: string) => {
+        logger.logInfo(`${signal} received, shutting down...`);
+        try {
+            await app.stop();
+            process.exit(0);
+        } catch (error) {
+            logger.logError(error instanceof Error ? error : String(error));
+            process.exit(1);
+        }
+    };
+    process.once('SIGTERM', () => shutdown('SIGTERM'));
+    process.once('SIGINT', () => shutdown('SIGINT'));
 }
 
 bootstrap();
@@ -0,0 +1,152 @@
+/*
+    * Home Control Hub
+    *
+    * Benchmark of the device payload encodings on the backend path: bytes on the
+    * wire, encode and decode time and heap churn of JSON against CBOR. Heap churn
+    * is reported as the garbage collections (and their pause time) the timed loops
+    * caused, since V8 exposes no allocation counter.
+    *
+    * Run with: npx ts-node src/tests/codec.bench.ts
+    *
+*/
+
+import { PerformanceObserver } from 'perf_hooks';
+import { PayloadCodec } from '../code/codec';
+import { PayloadEncoding_ENUM } from '../code/enums';
+
+const ITERATIONS = 50000;
+// "<iv>:<tag>:" prefix of an EncryptionService frame, the ciphertext is hex.
+const FRAME_HEADER_LEN = 2 * 12 + 1 + 2 * 16 + 1;
+
+// Telemetry batch produced by the firmware CBOR encoder (host_test "Codec device CBOR" line).
+const DEVICE_CBOR_BATCH =
+    'a6686c65645374617465016866726565486561701a0002bce06472737369f9d390646b65797383686c656453746174656866726565486561706472737369' +
+    '627473006773616d706c65739f830000008301001a0002bf20830200f9d3b083011903e81a0002bee083021903e8f9d39083011907d01a0002bea0830219' +
+    '07d0f9d3708301190bb81a0002be608302190bb8f9d3508301190fa01a0002be208302190fa0f9d3b083011913881a0002bde08302191388f9d390830119' +
+    '17701a0002bda08302191770f9d3708300191b58018301191b581a0002bd608302191b58f9d3508301191f401a0002bd208302191f40f9d3b08301192328' +
+    '1a0002bce08302192328f9d390ff';
+// {"__proto__": {"polluted": true}}
+const PROTO_CBOR_MAP = 'a1695f5f70726f746f5f5fa168706f6c6c75746564f5';
+
+interface BenchResult {
+    payload: string;
+    encoding: PayloadEncoding_ENUM;
+    bytes: number;
+    wireBytes: number;
+    encodeNs: number;
+    decodeNs: number;
+    gcRuns: number;
+    gcMs: number;
+}
+
+let gcRuns = 0;
+let gcMs = 0;
+
+// GC entries are delivered asynchronously, yield once so the observer sees them.
+function flushGcEntries(): Promise<void> {
+    return new Promise((resolve) => setImmediate(resolve));
+}
+
+function telemetryBatch(samples: number): object {
+    const batch: any = { ledState: 1, freeHeap: 179424, rssi: -60.5, keys: ['ledState', 'freeHeap', 'rssi'], ts: 0, samples: [] };
+    for (let i = 0; i < samples; i++) {
+        batch.samples.push([i % 3, 1000 * Math.floor(i / 3), i % 3 === 2 ? -61.5 + (i % 4) : 180000 - 64 * i]);
+    }
+    return batch;
+}
+
+async function bench(name: string, payload: any, encoding: PayloadEncoding_ENUM): Promise<BenchResult> {
+    const encoded = PayloadCodec.encode(payload, encoding);
+
+    // Warm up so both paths are optimized before timing.
+    for (let i = 0; i < 1000; i++) {
+        PayloadCodec.decode(PayloadCodec.encode(payload, encoding));
+    }
+    await flushGcEntries();
+    gcRuns = 0;
+    gcMs = 0;
+
+    let start = process.hrtime.bigint();
+    for (let i = 0; i < ITERATIONS; i++) {
+        PayloadCodec.encode(payload, encoding);
+    }
+    const encodeNs = Number(process.hrtime.bigint() - start) / ITERATIONS;
+
+    start = process.hrtime.bigint();
+    for (let i = 0; i < ITERATIONS; i++) {
+        PayloadCodec.decode(encoded);
+    }
+    const decodeNs = Number(process.hrtime.bigint() - start) / ITERATIONS;
+    await flushGcEntries();
+
+    return {
+        payload: name,
+        encoding,
+        bytes: encoded.length,
+        wireBytes: FRAME_HEADER_LEN + 2 * encoded.length,
+        encodeNs: Math.round(encodeNs),
+        decodeNs: Math.round(decodeNs),
+        gcRuns,
+        gcMs: Math.round(gcMs * 10) / 10,
+    };
+}
+
+function checkDeviceVector(): void {
+    const { payload, encoding } = PayloadCodec.decode(Buffer.from(DEVICE_CBOR_BATCH, 'hex'));
+    if (encoding !== PayloadEncoding_ENUM.CBOR || payload.rssi !== -60.5 || payload.freeHeap !== 179424 ||
+        payload.keys.length !== 3 || payload.samples.length !== 22) {
+        throw new Error(`Device CBOR batch decoded incorrectly: ${JSON.stringify(payload)}`);
+    }
+    const roundTrip = PayloadCodec.decode(PayloadCodec.encode(payload, PayloadEncoding_ENUM.CBOR)).payload;
+    if (JSON.stringify(roundTrip) !== JSON.stringify(payload)) {
+        throw new Error('CBOR round trip changed the payload');
+    }
+}
+
+function checkReservedKeys(): void {
+    let rejected = false;
+    try {
+        PayloadCodec.decode(Buffer.from(PROTO_CBOR_MAP, 'hex'));
+    } catch (error) {
+        rejected = true;
+    }
+    if (!rejected || ({} as any).polluted !== undefined) {
+        throw new Error('CBOR map with a __proto__ key was accepted');
+    }
+}
+
+async function main(): Promise<void> {
+    checkDeviceVector();
+    console.log('Device CBOR batch: OK');
+    checkReservedKeys();
+    console.log('CBOR reserved keys: OK');
+
+    const payloads: Array<[string, any]> = [
+        ['command_bool', true],
+        ['command', { state: true }],
+        ['telemetry', { ledState: 1, freeHeap: 179424, rssi: -61 }],
+        ['telemetry_batch', telemetryBatch(30)],
+        ['telemetry_batch_large', telemetryBatch(120)],
+    ];
+    const observer = new PerformanceObserver((list) => {
+        for (const entry of list.getEntries()) {
+            gcRuns++;
+            gcMs += entry.duration;
+        }
+    });
+    observer.observe({ entryTypes: ['gc'] });
+
+    const results: BenchResult[] = [];
+    for (const [name, payload] of payloads) {
+        results.push(await bench(name, payload, PayloadEncoding_ENUM.JSON));
+        results.push(await bench(name, payload, PayloadEncoding_ENUM.CBOR));
+    }
+    observer.disconnect();
+    console.log(`${ITERATIONS} encodes and decodes per row`);
+    console.table(results);
+}
+
+main().catch((error) => {
+    console.error(error);
+    process.exit(1);
+});
@@ -0,0 +1,127 @@
+/*
+    * Home Control Hub
+    *
+    * Load test of switching a group of devices: one command per device through
+    * MQTTService.publishCommand against one message per group through
+    * MQTTService.publishGroupCommand, for groups of 1 to 1000 devices. The MQTT
+    * connection and the device repository are in memory, so the numbers are the
+    * server CPU per switch (lookups, encoding, encryption, publish calls) without
+    * the database round trips of the per-device path and without the broker
+    * fan-out of the group path. Device side: host_test "BENCH groups" line.
+    *
+    * Run with: npx ts-node src/tests/groups.bench.ts
+    *
+*/
+
+import { MQTTConnection, MQTTService, EncryptionService, GroupService } from '../code/services';
+import { Device } from '../code/entities';
+import { DeviceRepository } from '../code/repositories';
+
+const GROUP_SIZES = [1, 10, 100, 1000];
+const ROUNDS = 20;
+const SCENE = { light: true, fan: 40 };
+
+class CountingConnection {
+    public publishes = 0;
+    public bytes = 0;
+
+    public async publish(topic: string, message: string | Buffer): Promise<void> {
+        this.publishes++;
+        this.bytes += topic.length + message.length;
+    }
+}
+
+class MemoryDeviceRepository {
+    private devices: Map<string, Device> = new Map();
+
+    public add(device: Device): void {
+        this.devices.set(device.id, device);
+    }
+
+    public async findById(id: string): Promise<Device | null> {
+        return this.devices.get(id) ?? null;
+    }
+
+    // Rows only change through MQTTService here, nothing to tell it.
+    public setOnChangeCallback(): void {}
+}
+
+interface PathResult {
+    commandsPerSecond: number;
+    latencyMs: number;
+    publishes: number;
+    bytes: number;
+}
+
+async function measure(connection: CountingConnection, switchGroup: () => Promise<void>): Promise<PathResult> {
+    await switchGroup(); // Warm up
+    connection.publishes = 0;
+    connection.bytes = 0;
+    let totalNs = 0;
+    for (let round = 0; round < ROUNDS; round++) {
+        const start = process.hrtime.bigint();
+        await switchGroup();
+        totalNs += Number(process.hrtime.bigint() - start);
+    }
+    const latencyMs = totalNs / ROUNDS / 1e6;
+    return {
+        commandsPerSecond: Math.round(1000 / latencyMs),
+        latencyMs: Math.round(latencyMs * 1000) / 1000,
+        publishes: connection.publishes / ROUNDS,
+        bytes: connection.bytes / ROUNDS,
+    };
+}
+
+async function runGroupSize(size: number): Promise<object> {
+    const connection = new CountingConnection();
+    const repository = new MemoryDeviceRepository();
+    const mqttService = new MQTTService(
+        connection as unknown as MQTTConnection,
+        repository as unknown as DeviceRepository,
+        new EncryptionService()
+    );
+    const groupService = new GroupService(mqttService);
+    const group = groupService.createGroup(`bench-${size}`, 'bench');
+
+    for (let i = 0; i < size; i++) {
+        const device = new Device(`device-${i}`, `Device ${i}`, 'SMART_LIGHT', true, `device-key-${i}`, {}, 'bench');
+        repository.add(device);
+        await groupService.addDevice(group.id, device.id);
+    }
+
+    // Per device: every command of the switch is sent before the last one is out.
+    const perDevice = await measure(connection, async () => {
+        await Promise.all([...group.deviceIds].map(deviceId => mqttService.publishCommand(deviceId, 'scene', SCENE)));
+    });
+    const perGroup = await measure(connection, () => groupService.applyScene(group.id, SCENE));
+
+    return {
+        devices: size,
+        perDeviceSwitchesPerS: perDevice.commandsPerSecond,
+        perDeviceLatencyMs: perDevice.latencyMs,
+        perDevicePublishes: perDevice.publishes,
+        perDeviceBytes: perDevice.bytes,
+        groupSwitchesPerS: perGroup.commandsPerSecond,
+        groupLatencyMs: perGroup.latencyMs,
+        groupPublishes: perGroup.publishes,
+        groupBytes: perGroup.bytes,
+    };
+}
+
+async function main(): Promise<void> {
+    // Every publish is logged; keep that out of the timing.
+    const log = console.log;
+    const results: object[] = [];
+    console.log = () => {};
+    try {
+        for (const size of GROUP_SIZES) {
+            results.push(await runGroupSize(size));
+        }
+    } finally {
+        console.log = log;
+    }
+    console.table(results);
+    console.log('Not included: device lookups in the database (per device path), broker fan-out (group path).');
+}
+
+main();
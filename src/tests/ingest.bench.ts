@@ -0,0 +1,194 @@
+/*
+    * Home Control Hub
+    *
+    * Device message ingest against the compose Mosquitto and Postgres, for 10 to
+    * 1000 devices: registered devices publish encrypted telemetry through the
+    * broker and MQTTService handles it as in production (device cache, decrypt,
+    * decode, state written in batches). A fixed number of messages is kept in
+    * flight, so the rate is what the backend sustains and the latency, publish
+    * to handled, is not a queue growing over the run. Database reads and write
+    * statements are counted per message; the state of every device is checked
+    * in the database at the end. The devices are deleted again.
+    *
+    * Run with, from src/ with the compose services up:
+    *   MQTT_BROKER_URL=mqtt://localhost MQTT_PORT=1884 \
+    *   DATABASE_URL=postgresql://<user>:<password>@localhost:<POSTGRES_HOST_PORT>/<db> \
+    *   npx ts-node tests/ingest.bench.ts
+    * INGEST_FLUSH_MS sets the write interval as for the backend; 0 writes after
+    * every turn of the event loop.
+    *
+*/
+
+import * as crypto from 'crypto';
+import * as MQTT from 'mqtt';
+import { performance } from 'perf_hooks';
+import { MQTTConnection, MQTTService, EncryptionService } from '../code/services';
+import { Device } from '../code/entities';
+import { DeviceRepository, DeviceStatePatch, UserRepository } from '../code/repositories';
+import { Config, Database } from '../code/infrastructure';
+import { UserRole_ENUM } from '../code/enums';
+
+const DEVICE_COUNTS = [10, 100, 1000];
+const MESSAGES = 20000;
+const IN_FLIGHT = 64;
+const TIMEOUT_MS = 30000;
+const BENCH_USER = 'ingest-bench';
+
+// Database reads and write statements MQTTService makes.
+class CountingDeviceRepository extends DeviceRepository {
+    public reads = 0;
+    public writes = 0;
+
+    public async findById(id: string): Promise<Device | null> {
+        this.reads++;
+        return super.findById(id);
+    }
+
+    public async applyStates(patches: Map<string, DeviceStatePatch>): Promise<number> {
+        this.writes++;
+        return super.applyStates(patches);
+    }
+}
+
+// Calls back when MQTTService is done with a message, with the message.
+class TimedConnection extends MQTTConnection {
+    public onHandled?: (message: Buffer) => void;
+
+    public setOnMessageCallback(callback: (topic: string, message: Buffer) => void) {
+        super.setOnMessageCallback(async (topic, message) => {
+            await callback(topic, message);
+            this.onHandled?.(message);
+        });
+    }
+}
+
+function percentile(sorted: number[], p: number): number {
+    return sorted.length ? sorted[Math.max(Math.ceil(sorted.length * p) - 1, 0)] : 0;
+}
+
+async function runDeviceCount(count: number, ownerId: string, mqttService: MQTTService, connection: TimedConnection,
+                              repository: CountingDeviceRepository, publisher: MQTT.MqttClient): Promise<object> {
+    const encryption = new EncryptionService();
+    const devices: Device[] = [];
+    for (let i = 0; i < count; i++) {
+        const device = await repository.add({
+            name: `ingest-bench-${i}`, type: 'SENSOR', status: true, ownerId,
+            aesKey: `ingest-bench-${crypto.randomBytes(12).toString('hex')}`,
+        });
+        if (!device) {
+            throw new Error('Could not register the bench devices');
+        }
+        devices.push(device);
+    }
+
+    // Ciphertexts start with a random IV, which identifies the message.
+    const sentAt: Map<string, number> = new Map();
+    const latencies: number[] = [];
+    const lastSeq: number[] = new Array(count).fill(-1);
+    let sent = 0;
+    let handled = 0;
+    repository.reads = 0;
+    repository.writes = 0;
+
+    const start = performance.now();
+    await new Promise<void>((resolve, reject) => {
+        const timer = setTimeout(() => reject(new Error(`${handled} of ${MESSAGES} messages handled in ${TIMEOUT_MS} ms`)),
+                                 TIMEOUT_MS);
+        const publishNext = () => {
+            const index = sent % count;
+            const seq = sent++;
+            const device = devices[index];
+            const message = encryption.encrypt(JSON.stringify({ temperature: 20 + seq % 10, humidity: 55, seq }),
+                                               device.aesKey)!;
+            lastSeq[index] = seq;
+            sentAt.set(message.slice(0, 24), performance.now());
+            publisher.publish(`home/devices/${device.id}/telemetry`, message, { qos: 1 });
+        };
+        connection.onHandled = message => {
+            const at = sentAt.get(message.toString('utf8', 0, 24));
+            if (at === undefined) {
+                return;
+            }
+            latencies.push(performance.now() - at);
+            if (++handled === MESSAGES) {
+                clearTimeout(timer);
+                resolve();
+            } else if (sent < MESSAGES) {
+                publishNext();
+            }
+        };
+        for (let i = 0; i < IN_FLIGHT && sent < MESSAGES; i++) {
+            publishNext();
+        }
+    });
+    const elapsedMs = performance.now() - start;
+    connection.onHandled = undefined;
+
+    // Everything reported is in the database once the last batch is written.
+    await mqttService.flushDeviceStates();
+    let stale = 0;
+    for (let i = 0; i < count; i++) {
+        const row = await Database.getInstance().device.findUnique({ where: { id: devices[i].id } });
+        stale += (row?.lastKnownState as any)?.seq === lastSeq[i] ? 0 : 1;
+    }
+    for (const device of devices) {
+        await repository.delete(device.id);
+    }
+
+    latencies.sort((a, b) => a - b);
+    return {
+        devices: count,
+        messagesPerS: Math.round(MESSAGES * 1000 / elapsedMs),
+        p50Ms: Math.round(percentile(latencies, 0.5) * 100) / 100,
+        p99Ms: Math.round(percentile(latencies, 0.99) * 100) / 100,
+        readsPerMessage: Math.round(repository.reads / MESSAGES * 1000) / 1000,
+        writesPerMessage: Math.round(repository.writes / MESSAGES * 1000) / 1000,
+        staleDevices: stale,
+    };
+}
+
+async function main(): Promise<void> {
+    const config = Config.getInstance();
+    const database = Database.getInstance();
+    await database.connect();
+    const users = new UserRepository();
+    const owner = await users.findByUsername(BENCH_USER) ??
+        await users.add({ username: BENCH_USER, passwordHash: '-', role: UserRole_ENUM.STANDARD_USER });
+    if (!owner) {
+        throw new Error('Could not create the bench user');
+    }
+
+    const connection = new TimedConnection();
+    const repository = new CountingDeviceRepository();
+    const mqttService = new MQTTService(connection, repository, new EncryptionService());
+    const publisher = MQTT.connect(`${config.getMqttBrokerUrl()}:${config.getMqttPort()}`, {
+        clientId: `ingest_bench_${crypto.randomBytes(4).toString('hex')}`,
+    });
+    await new Promise(resolve => publisher.once('connect', resolve));
+
+    // Every message is logged; keep that out of the timing.
+    const log = console.log;
+    const results: object[] = [];
+    console.log = () => {};
+    try {
+        await mqttService.initialize();
+        for (const count of DEVICE_COUNTS) {
+            results.push(await runDeviceCount(count, owner.id, mqttService, connection, repository, publisher));
+        }
+    } finally {
+        console.log = log;
+        publisher.end();
+        connection.disconnect();
+        await database.disconnect();
+    }
+    console.log(`${MESSAGES} telemetry messages per row, ${IN_FLIGHT} in flight, state written every ${config.getIngestFlushMs()} ms`);
+    console.table(results);
+    if (results.some(result => (result as any).staleDevices > 0)) {
+        process.exitCode = 1;
+    }
+}
+
+main().catch(error => {
+    console.error(error);
+    process.exit(1);
+});
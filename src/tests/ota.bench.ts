@@ -0,0 +1,317 @@
+/*
+    * Home Control Hub
+    *
+    * Firmware update streams. First the delta encoder: stream size and encode
+    * time for a few kinds of change to a 1 MB image. Then whole transfers
+    * through OtaService and MQTTService (encoding, encryption, window) to an
+    * in-memory device that decodes the chunks and reports progress the way
+    * hal/ota_update.c does, in JSON and CBOR, raw and delta, and once with a
+    * reboot halfway that resumes from the last checkpoint. The broker and the
+    * flash writes are not part of the time. Device side: host_test "BENCH ota"
+    * line.
+    *
+    * Run with: npx ts-node src/tests/ota.bench.ts
+    *
+*/
+
+import * as crypto from 'crypto';
+import * as fs from 'fs';
+import * as os from 'os';
+import * as path from 'path';
+import { MQTTConnection, MQTTService, EncryptionService, OtaService } from '../code/services';
+import { Device } from '../code/entities';
+import { DeviceRepository, DeviceStatePatch } from '../code/repositories';
+import { PayloadCodec } from '../code/codec';
+import { DeltaEncoder } from '../code/ota';
+import { PayloadEncoding_ENUM } from '../code/enums';
+
+const IMAGE_BYTES = 1024 * 1024;
+// Device defaults, CONFIG_OTA_UPDATE_REPORT_BYTES and CONFIG_OTA_UPDATE_CHECKPOINT_BYTES.
+const REPORT_BYTES = 8192;
+const CHECKPOINT_BYTES = 16384;
+const BASE_VERSION = '1.0.0';
+const DEVICE_ID = 'ota-bench';
+const DEVICE_KEY = 'ota-bench-key';
+
+// Deterministic bytes, so runs compare.
+function randomBytes(length: number, seed: number): Buffer {
+    const out = Buffer.alloc(length);
+    let x = seed >>> 0 || 1;
+    for (let i = 0; i < length; i++) {
+        x ^= x << 13; x >>>= 0;
+        x ^= x >>> 17;
+        x ^= x << 5; x >>>= 0;
+        out[i] = x & 0xff;
+    }
+    return out;
+}
+
+// Code and data, then the erased tail of the partition.
+function baseImage(): Buffer {
+    const used = Math.floor(IMAGE_BYTES * 0.9);
+    return Buffer.concat([randomBytes(used, 1), Buffer.alloc(IMAGE_BYTES - used, 0xff)]);
+}
+
+function patched(base: Buffer, edits: number, editBytes: number, seed: number): Buffer {
+    const out = Buffer.from(base);
+    for (let i = 0; i < edits; i++) {
+        const at = Math.floor((i + 0.5) * out.length / edits);
+        randomBytes(editBytes, seed + i).copy(out, at);
+    }
+    return out;
+}
+
+const CHANGES: { version: string; build: (base: Buffer) => Buffer }[] = [
+    { version: '1.0.1-patch', build: base => patched(base, 20, 64, 100) },
+    {
+        // A function grew: everything after it moved.
+        version: '1.1.0-shift',
+        build: base => patched(Buffer.concat([base.subarray(0, 300000), randomBytes(4096, 7), base.subarray(300000, base.length - 4096)]), 40, 32, 200),
+    },
+    { version: '2.0.0-rebuild', build: base => patched(base, 300, 1024, 300) },
+];
+
+class MemoryDeviceRepository {
+    private devices: Map<string, Device> = new Map();
+
+    public add(device: Device): void {
+        this.devices.set(device.id, device);
+    }
+
+    public async findById(id: string): Promise<Device | null> {
+        return this.devices.get(id) ?? null;
+    }
+
+    // Rows only change through MQTTService here, nothing to tell it.
+    public setOnChangeCallback(): void {}
+
+    // The reported status is kept in MQTTService's cache, which is all this needs.
+    public async applyStates(patches: Map<string, DeviceStatePatch>): Promise<number> {
+        return patches.size;
+    }
+
+    public async update(id: string, data: Partial<Device>): Promise<Device | null> {
+        const device = this.devices.get(id);
+        if (device) {
+            Object.assign(device, data);
+        }
+        return device ?? null;
+    }
+}
+
+/*
+ * The device end of a transfer, as an MQTT connection: commands published by
+ * the backend arrive here, reports go back through the message callback.
+ * Keeps the stream in memory and checkpoints the stream offset; the image is
+ * built and checked at the end.
+ */
+class SimulatedDevice {
+    public publishes = 0;
+    public bytes = 0;
+    public resentBytes = 0;
+    // Stream offset at which the device loses power once.
+    public rebootAt = Infinity;
+
+    private onMessage?: (topic: string, message: Buffer) => Promise<void>;
+    private onEnd?: (state: string) => void;
+    private encryption = new EncryptionService();
+    private version = '';
+    private size = 0;
+    private sha256 = '';
+    private format = '';
+    private stream: Buffer = Buffer.alloc(0);
+    private offset = 0;
+    private checkpoint = 0;
+    private resendAt = -1;
+    private offline = false;
+
+    constructor(private base: Buffer, private encoding: PayloadEncoding_ENUM) {}
+
+    public async connect(): Promise<void> {}
+    public async subscribe(): Promise<void> {}
+
+    public setOnMessageCallback(callback: (topic: string, message: Buffer) => Promise<void>): void {
+        this.onMessage = callback;
+    }
+
+    // Any message tells the backend the encoding the device speaks.
+    public hello(): void {
+        this.send('status', { status: true });
+    }
+
+    public ended(): Promise<string> {
+        return new Promise(resolve => { this.onEnd = resolve; });
+    }
+
+    public async publish(topic: string, message: string | Buffer): Promise<void> {
+        this.publishes++;
+        this.bytes += topic.length + message.length;
+        if (this.offline || !topic.startsWith(`home/devices/${DEVICE_ID}/command/ota/`)) {
+            return;
+        }
+        const plain = this.encryption.decryptToBuffer(message.toString(), DEVICE_KEY);
+        const { payload } = PayloadCodec.decode(plain!);
+        if (topic.endsWith('/begin')) {
+            if (payload.version !== this.version || this.stream.length !== payload.stream) {
+                this.version = payload.version;
+                this.stream = Buffer.alloc(payload.stream);
+                this.offset = this.checkpoint = 0;
+                this.size = payload.size;
+                this.sha256 = payload.sha256;
+                this.format = payload.format;
+            }
+            this.report('receiving');
+            return;
+        }
+
+        const data: Buffer = Buffer.isBuffer(payload.data) ? payload.data : Buffer.from(payload.data, 'hex');
+        if (payload.off + data.length <= this.offset) {
+            this.resentBytes += data.length;
+            return;
+        }
+        if (payload.off > this.offset) {
+            if (this.resendAt !== this.offset) {
+                this.resendAt = this.offset;
+                this.report('resend');
+            }
+            return;
+        }
+        const skip = this.offset - payload.off;
+        data.copy(this.stream, this.offset, skip);
+        const before = this.offset;
+        this.offset += data.length - skip;
+        if (Math.floor(this.offset / CHECKPOINT_BYTES) !== Math.floor(before / CHECKPOINT_BYTES)) {
+            this.checkpoint = this.offset - this.offset % CHECKPOINT_BYTES;
+        }
+        if (this.offset >= this.rebootAt) {
+            this.reboot();
+        } else if (this.offset === this.stream.length) {
+            this.finish();
+        } else if (Math.floor(this.offset / REPORT_BYTES) !== Math.floor(before / REPORT_BYTES)) {
+            this.report('receiving');
+        }
+    }
+
+    // Power loss: what came after the last checkpoint is gone, and chunks in flight are lost.
+    private reboot(): void {
+        this.rebootAt = Infinity;
+        this.offline = true;
+        this.resentBytes += this.offset - this.checkpoint;
+        this.offset = this.checkpoint;
+        setImmediate(() => {
+            this.offline = false;
+            this.send('boot', { phasesUs: {}, flags: 0 });
+        });
+    }
+
+    private finish(): void {
+        const image = this.format === 'delta' ? DeltaEncoder.apply(this.base, this.stream, this.size) : this.stream;
+        const ok = crypto.createHash('sha256').update(image).digest('hex') === this.sha256;
+        this.report(ok ? 'done' : 'failed');
+    }
+
+    private report(state: string): void {
+        this.send('ota/progress', { version: this.version, offset: this.offset, state });
+    }
+
+    // Asynchronous like the broker: the backend sees reports after its publish loop yields.
+    private send(subtopic: string, payload: object): void {
+        const message = this.encryption.encryptBuffer(PayloadCodec.encode(payload, this.encoding), DEVICE_KEY)!;
+        setImmediate(async () => {
+            await this.onMessage!(`home/devices/${DEVICE_ID}/${subtopic}`, Buffer.from(message));
+            const state = (payload as { state?: string }).state;
+            if (state === 'done' || state === 'failed') {
+                this.onEnd?.(state);
+            }
+        });
+    }
+}
+
+async function transfer(base: Buffer, version: string, encoding: PayloadEncoding_ENUM, deltas: boolean,
+                        reboot: boolean): Promise<object> {
+    const device = new SimulatedDevice(base, encoding);
+    const repository = new MemoryDeviceRepository();
+    // Without a known firmware version the backend sends the raw image.
+    repository.add(new Device(DEVICE_ID, 'OTA bench', 'SMART_LIGHT', true, DEVICE_KEY, {}, 'bench', undefined,
+                              deltas ? BASE_VERSION : undefined));
+    const mqttService = new MQTTService(
+        device as unknown as MQTTConnection,
+        repository as unknown as DeviceRepository,
+        new EncryptionService()
+    );
+    const otaService = new OtaService(mqttService, repository as unknown as DeviceRepository);
+    mqttService.setOtaService(otaService);
+    await mqttService.initialize();
+
+    device.hello();
+    await new Promise(resolve => setImmediate(resolve));
+
+    // Delta encoding happens here, on the first device of a base; the first table has its time.
+    const started = await otaService.startUpdate(DEVICE_ID, version);
+    if (reboot) {
+        device.rebootAt = Math.floor(started.streamBytes / 2);
+    }
+    const ended = device.ended();
+    const start = process.hrtime.bigint();
+    await ended;
+    const ms = Number(process.hrtime.bigint() - start) / 1e6;
+    const view = otaService.getTransfer(DEVICE_ID)!;
+    return {
+        encoding,
+        format: view.format,
+        reboot,
+        state: view.state,
+        streamKB: Math.round(view.streamBytes / 102.4) / 10,
+        ms: Math.round(ms),
+        streamMBPerS: Math.round(view.streamBytes / 1048.576 / ms * 10) / 10,
+        publishes: device.publishes,
+        wireKB: Math.round(device.bytes / 1024),
+        resentKB: Math.round(device.resentBytes / 102.4) / 10,
+    };
+}
+
+async function main(): Promise<void> {
+    const base = baseImage();
+    const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'ota-bench-'));
+    process.env.OTA_IMAGE_DIR = dir;
+    fs.writeFileSync(path.join(dir, `${BASE_VERSION}.bin`), base);
+
+    const deltas: object[] = [];
+    for (const change of CHANGES) {
+        const image = change.build(base);
+        fs.writeFileSync(path.join(dir, `${change.version}.bin`), image);
+        const start = process.hrtime.bigint();
+        const delta = DeltaEncoder.encode(base, image);
+        const encodeMs = Number(process.hrtime.bigint() - start) / 1e6;
+        if (!DeltaEncoder.apply(base, delta, image.length).equals(image)) {
+            throw new Error(`Delta for ${change.version} does not rebuild the image`);
+        }
+        deltas.push({
+            version: change.version,
+            imageKB: image.length / 1024,
+            deltaKB: Math.round(delta.length / 102.4) / 10,
+            ratio: Math.round(delta.length / image.length * 1000) / 1000,
+            encodeMs: Math.round(encodeMs),
+        });
+    }
+
+    // Every publish and message is logged; keep that out of the timing.
+    const log = console.log;
+    const transfers: object[] = [];
+    console.log = () => {};
+    try {
+        for (const encoding of [PayloadEncoding_ENUM.JSON, PayloadEncoding_ENUM.CBOR]) {
+            transfers.push(await transfer(base, CHANGES[0].version, encoding, false, false));
+            transfers.push(await transfer(base, CHANGES[0].version, encoding, true, false));
+            transfers.push(await transfer(base, CHANGES[0].version, encoding, false, true));
+        }
+    } finally {
+        console.log = log;
+        fs.rmSync(dir, { recursive: true, force: true });
+    }
+    console.table(deltas);
+    console.table(transfers);
+    console.log('Not included: broker hops, flash erase and write on the device.');
+}
+
+main();
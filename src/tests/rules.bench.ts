@@ -0,0 +1,106 @@
+/*
+    * Home Control Hub
+    *
+    * Benchmark of the backend side of an automation rule reaction, for comparison
+    * with the device rule engine (host_test "BENCH rules" line). The server path
+    * is what MQTTService and AutomationService do per telemetry message, minus the
+    * broker hops and database reads: decrypt, decode, evaluate the rules, encode
+    * and encrypt the command. Also checks that the compiled program matches the one
+    * the firmware host test loads.
+    *
+    * Run with: npx ts-node src/tests/rules.bench.ts
+    *
+*/
+
+import { RuleCompiler, CompilableRule } from '../code/rules';
+import { AutomationRule, EncryptionService } from '../code/services';
+import { Command, Device } from '../code/entities';
+import { PayloadCodec } from '../code/codec';
+import { PayloadEncoding_ENUM } from '../code/enums';
+
+const ITERATIONS = 20000;
+const DEVICE_KEY = '0123456789abcdef-device-key';
+
+// Same rules as iotdevice/host_test/main/bench_rules.c.
+const RULES: CompilableRule[] = [
+    { id: 'fan_on', condition: 'payload.temperature > 28', actions: [{ channel: 'fan', level: 100 }] },
+    { id: 'fan_off', condition: 'payload.temperature <= 26', actions: [{ channel: 'fan', level: 0 }] },
+    { id: 'humid_led', condition: 'payload.humidity > 70 && payload.temperature > 24', actions: [{ channel: 'led', level: 1 }] },
+    { id: 'dry_led', condition: '!(payload.humidity > 60) || payload.ledState === 0', actions: [{ channel: 'led', level: 0 }] },
+];
+
+// Program compiled from RULES, as loaded by the firmware host test (BENCH_PROGRAM_HEX).
+const DEVICE_PROGRAM_HEX =
+    '48520100a7700000030204000b74656d70657261747572650868756d6964697479086c6564537461' +
+    '74650366616e036c656408000200010000e0411001006408000200010000d0411301000011000201' +
+    '0100008c42100200010000c041102001010112000201010000704210220202010000000014210101' +
+    '00';
+
+function checkProgram(): void {
+    const program = RuleCompiler.compile(RULES);
+    const hex = program.bytes.toString('hex');
+    console.log(`Program ${program.programId}: ${program.bytes.length} bytes`);
+    console.log(hex);
+    if (hex !== DEVICE_PROGRAM_HEX) {
+        throw new Error('Compiled program differs from the one in the firmware host test');
+    }
+    if (RuleCompiler.compile(RULES).programId !== program.programId) {
+        throw new Error('Program ID is not stable');
+    }
+    for (const bad of ['payload.a >', 'payload.a > 1 &&', '(payload.a > 1', 'payload.a + 1', 'x > 1']) {
+        try {
+            RuleCompiler.compileCondition(bad);
+        } catch {
+            continue;
+        }
+        throw new Error(`Condition '${bad}' compiled`);
+    }
+}
+
+function serverPathNs(): number {
+    const encryption = new EncryptionService();
+    const device = new Device('bench', 'bench', 'sensor', true, DEVICE_KEY, {}, null);
+    const command = new Command('setPower', { on: true });
+    const rule = new AutomationRule('fan_on', 'Fan on', 'payload.temperature > 28', 'bench', command, 'bench');
+    const frame = encryption.encrypt(JSON.stringify({ temperature: 29.5, humidity: 55, ledState: 0 }), DEVICE_KEY)!;
+
+    const react = () => {
+        const plain = encryption.decryptToBuffer(frame, DEVICE_KEY)!;
+        const { payload } = PayloadCodec.decode(plain);
+        if (rule.evaluate(device, payload)) {
+            encryption.encryptBuffer(PayloadCodec.encode(command.payload, PayloadEncoding_ENUM.JSON), DEVICE_KEY);
+        }
+    };
+    for (let i = 0; i < 1000; i++) {
+        react();
+    }
+    const start = process.hrtime.bigint();
+    for (let i = 0; i < ITERATIONS; i++) {
+        react();
+    }
+    return Number(process.hrtime.bigint() - start) / ITERATIONS;
+}
+
+function compileUs(): number {
+    const start = process.hrtime.bigint();
+    for (let i = 0; i < 1000; i++) {
+        RuleCompiler.compile(RULES);
+    }
+    return Number(process.hrtime.bigint() - start) / 1000 / 1000;
+}
+
+function main(): void {
+    checkProgram();
+    // The server path logs every evaluation; keep that out of the timing.
+    const debug = console.debug;
+    console.debug = () => {};
+    const serverNs = serverPathNs();
+    console.debug = debug;
+    console.table([{
+        serverCpuUsPerMessage: Math.round(serverNs / 100) / 10,
+        compileUs: Math.round(compileUs() * 10) / 10,
+        notIncluded: '2 broker hops, device lookup and state update queries',
+    }]);
+}
+
+main();